@@ -44,5 +44,6 @@
 #include "whisperlib/base/callback/result_callback3.h"
 
 #include "whisperlib/base/callback/callback4.h"
+#include "whisperlib/base/callback/inline_callback.h"
 
 #endif  //  __WHISPERLIB_BASE_CALLBACK_H__
@@ -31,9 +31,17 @@
 #ifndef __WHISPERLIB_BASE_CALLBACK_CALLBACK_H__
 #define __WHISPERLIB_BASE_CALLBACK_CALLBACK_H__
 
+#include "whisperlib/base/callback/callback_pool.h"
+
 namespace whisper {
 class Callback {
 public:
+  static void* operator new(size_t size) {
+    return CallbackPool::Allocate(size);
+  }
+  static void operator delete(void* p, size_t size) {
+    CallbackPool::Free(p, size);
+  }
   Callback() {}
   virtual ~Callback() {}
 };
@@ -0,0 +1,222 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <new>
+#include <utility>
+#include <vector>
+
+#include "whisperlib/base/callback/callback_pool.h"
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/sync/mutex.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_bool(callback_pool,
+            true,
+            "Recycle the memory of the callback objects");
+
+//////////////////////////////////////////////////////////////////////
+
+namespace whisper {
+
+namespace {
+
+const int kNumClasses =
+    CallbackPool::kMaxPooledSize / CallbackPool::kGranularity;
+// A thread keeps at most these many free objects of a class ..
+const size_t kMaxThreadCached = 512;
+// .. and passes them to the shared pool in batches of these many
+const size_t kBatchSize = 256;
+// The shared pool keeps at most these many batches of a class
+const size_t kMaxSharedBatches = 64;
+
+// The class for objects of size bytes (-1 if not pooled)
+inline int SizeClass(size_t size) {
+  if ( size == 0 || size > CallbackPool::kMaxPooledSize ) {
+    return -1;
+  }
+  return (size - 1) / CallbackPool::kGranularity;
+}
+inline size_t ClassSize(int c) {
+  return (c + 1) * CallbackPool::kGranularity;
+}
+
+// Free objects are linked through their first word
+struct FreeObject {
+  FreeObject* next_;
+};
+
+// Releases a chain of free objects to the heap
+void DeleteChain(FreeObject* p) {
+  while ( p != NULL ) {
+    FreeObject* const next = p->next_;
+    ::operator delete(p);
+    p = next;
+  }
+}
+
+// Batches of free objects, shared by all threads
+class SharedPool {
+ public:
+  SharedPool() {
+  }
+  // Returns a chain of free objects of class c (or NULL), and its size
+  FreeObject* Get(int c, size_t* size) {
+    synch::MutexLocker l(&mutex_);
+    if ( batches_[c].empty() ) {
+      return NULL;
+    }
+    FreeObject* const batch = batches_[c].back().first;
+    *size = batches_[c].back().second;
+    batches_[c].pop_back();
+    return batch;
+  }
+  // Takes a chain of size free objects of class c
+  void Put(int c, FreeObject* batch, size_t size) {
+    {
+      synch::MutexLocker l(&mutex_);
+      if ( batches_[c].size() < kMaxSharedBatches ) {
+        batches_[c].push_back(std::make_pair(batch, size));
+        return;
+      }
+    }
+    DeleteChain(batch);
+  }
+ private:
+  synch::Mutex mutex_;
+  std::vector< std::pair<FreeObject*, size_t> > batches_[kNumClasses];
+};
+
+// Never deleted - callbacks may be released very late on exit
+SharedPool* GetSharedPool() {
+  static SharedPool* const shared_pool = new SharedPool();
+  return shared_pool;
+}
+
+struct ThreadCache {
+  FreeObject* free_[kNumClasses];
+  size_t size_[kNumClasses];
+  ThreadCache() {
+    for ( int c = 0; c < kNumClasses; ++c ) {
+      free_[c] = NULL;
+      size_[c] = 0;
+    }
+  }
+  void Flush() {
+    for ( int c = 0; c < kNumClasses; ++c ) {
+      if ( free_[c] != NULL ) {
+        GetSharedPool()->Put(c, free_[c], size_[c]);
+        free_[c] = NULL;
+        size_[c] = 0;
+      }
+    }
+  }
+};
+
+thread_local ThreadCache* tls_cache = NULL;
+// After the thread cache is gone (on thread exit) we go to the heap
+thread_local bool tls_cache_released = false;
+
+struct ThreadCacheReleaser {
+  ~ThreadCacheReleaser() {
+    if ( tls_cache != NULL ) {
+      tls_cache->Flush();
+      delete tls_cache;
+      tls_cache = NULL;
+    }
+    tls_cache_released = true;
+  }
+};
+thread_local ThreadCacheReleaser tls_cache_releaser;
+
+inline ThreadCache* GetThreadCache() {
+  if ( tls_cache == NULL && !tls_cache_released ) {
+    // Touching the releaser gets it constructed (and destroyed on exit)
+    (void)&tls_cache_releaser;
+    tls_cache = new ThreadCache();
+  }
+  return tls_cache;
+}
+}  // namespace
+
+// static
+void* CallbackPool::Allocate(size_t size) {
+  const int c = SizeClass(size);
+  if ( c < 0 ) {
+    return ::operator new(size);
+  }
+  ThreadCache* const cache = FLAGS_callback_pool ? GetThreadCache() : NULL;
+  if ( cache != NULL && cache->free_[c] == NULL ) {
+    cache->free_[c] = GetSharedPool()->Get(c, &cache->size_[c]);
+  }
+  if ( cache == NULL || cache->free_[c] == NULL ) {
+    // Always class sized, so we can pool it later
+    return ::operator new(ClassSize(c));
+  }
+  FreeObject* const p = cache->free_[c];
+  cache->free_[c] = p->next_;
+  --cache->size_[c];
+  return p;
+}
+
+// static
+void CallbackPool::Free(void* p, size_t size) {
+  const int c = SizeClass(size);
+  ThreadCache* const cache = (c < 0 || !FLAGS_callback_pool)
+                             ? NULL : GetThreadCache();
+  if ( cache == NULL ) {
+    ::operator delete(p);
+    return;
+  }
+  FreeObject* const object = reinterpret_cast<FreeObject*>(p);
+  object->next_ = cache->free_[c];
+  cache->free_[c] = object;
+  if ( ++cache->size_[c] < kMaxThreadCached ) {
+    return;
+  }
+  // Pass the first kBatchSize to the shared pool, keep the rest
+  FreeObject* last = object;
+  for ( size_t i = 1; i < kBatchSize; ++i ) {
+    last = last->next_;
+  }
+  cache->free_[c] = last->next_;
+  cache->size_[c] -= kBatchSize;
+  last->next_ = NULL;
+  GetSharedPool()->Put(c, object, kBatchSize);
+}
+
+// static
+void CallbackPool::FlushThreadCache() {
+  if ( tls_cache != NULL ) {
+    tls_cache->Flush();
+  }
+}
+
+}  // namespace whisper
@@ -0,0 +1,62 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Memory for the callback objects (Closure, ResultClosure, CallbackN ..).
+// Most of them are small, one shot, and created / destroyed on each
+// event (often in different threads), so we recycle their memory: sizes
+// up to kMaxPooledSize are rounded up to a multiple of kGranularity, and
+// each thread keeps free lists for these sizes (w/o locking). Free lists
+// that get too long are passed in batches to a shared pool, where the
+// threads that run out of memory get it from.
+//
+
+#ifndef __WHISPERLIB_BASE_CALLBACK_CALLBACK_POOL_H__
+#define __WHISPERLIB_BASE_CALLBACK_CALLBACK_POOL_H__
+
+#include <stddef.h>
+
+namespace whisper {
+
+class CallbackPool {
+ public:
+  static const size_t kGranularity = 16;
+  static const size_t kMaxPooledSize = 128;
+
+  // Returns memory for an object of size bytes
+  static void* Allocate(size_t size);
+  // Releases memory returned by Allocate(size)
+  static void Free(void* p, size_t size);
+
+  // Releases the memory cached by the current thread to the shared pool
+  static void FlushThreadCache();
+};
+
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_BASE_CALLBACK_CALLBACK_POOL_H__
@@ -31,13 +31,22 @@
 #ifndef __WHISPERLIB_BASE_CALLBACK_CLOSURE_H__
 #define __WHISPERLIB_BASE_CALLBACK_CLOSURE_H__
 
+#include "whisperlib/base/callback/callback_pool.h"
 #include "whisperlib/base/log.h"
 
 namespace whisper {
 
 class Closure {
 public:
-  explicit Closure(bool is_permanent) : is_permanent_(is_permanent) {
+  // The memory of callbacks is recycled (see callback_pool.h)
+  static void* operator new(size_t size) {
+    return CallbackPool::Allocate(size);
+  }
+  static void operator delete(void* p, size_t size) {
+    CallbackPool::Free(p, size);
+  }
+  explicit Closure(bool is_permanent)
+    : is_permanent_(is_permanent), queue_next_(NULL) {
     #ifdef _DEBUG
     selector_registered_ = false;
     #endif
@@ -58,6 +67,13 @@ public:
   bool is_permanent() const {
     return is_permanent_;
   }
+  // Link for the intrusive closure queues (synch::MpscQueue)
+  Closure* queue_next() const {
+    return queue_next_;
+  }
+  void set_queue_next(Closure* next) {
+    queue_next_ = next;
+  }
 #ifdef _DEBUG
   void set_selector_registered(bool selector_registered) {
     selector_registered_ = selector_registered;
@@ -67,6 +83,7 @@ protected:
   virtual void RunInternal() = 0;
 private:
   const bool is_permanent_;
+  Closure* queue_next_;
 #ifdef _DEBUG
   bool selector_registered_;
 #endif
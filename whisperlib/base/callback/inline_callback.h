@@ -0,0 +1,286 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// InlineCallback<R(Args...)> is a move only holder for any callable
+// (lambda, functor ..) w/ that signature. Callables of up to kInlineSize
+// bytes (e.g. a lambda that captures a few pointers or integers) are
+// stored in place, so creating, moving and running the callback involves
+// no heap allocation. Larger ones go to the heap.
+//
+//   InlineCallback<void()> f([this, id]() { Process(id); });
+//   f();
+//
+// Where the old interfaces require callback objects, NewInlineCallback()
+// and NewPermanentInlineCallback() wrap an InlineCallback into the
+// Closure / ResultClosure / CallbackN object w/ the same signature
+// (whose memory comes from the CallbackPool - so no heap again).
+//
+
+#ifndef __WHISPERLIB_BASE_CALLBACK_INLINE_CALLBACK_H__
+#define __WHISPERLIB_BASE_CALLBACK_INLINE_CALLBACK_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/callback/closure.h"
+#include "whisperlib/base/callback/callback1.h"
+#include "whisperlib/base/callback/callback2.h"
+#include "whisperlib/base/callback/result_closure.h"
+#include "whisperlib/base/callback/result_callback1.h"
+
+namespace whisper {
+
+template <typename Sig> class InlineCallback;
+
+template <typename R, typename... Args>
+class InlineCallback<R(Args...)> {
+ public:
+  // Callables up to this size are stored in place
+  static const size_t kInlineSize = 6 * sizeof(void*);
+
+  InlineCallback() : ops_(NULL) {
+  }
+  // Accepts anything that can be called w/ Args
+  template <typename F,
+            typename = decltype(std::declval<F&>()(std::declval<Args>()...))>
+  InlineCallback(F f) : ops_(NULL) {
+    Init(std::move(f), std::integral_constant<bool, IsInline<F>::value>());
+  }
+  InlineCallback(InlineCallback&& other) : ops_(other.ops_) {
+    if ( ops_ != NULL ) {
+      ops_->move_(&other.storage_, &storage_);
+      other.ops_ = NULL;
+    }
+  }
+  InlineCallback& operator=(InlineCallback&& other) {
+    if ( this != &other ) {
+      Reset();
+      if ( other.ops_ != NULL ) {
+        other.ops_->move_(&other.storage_, &storage_);
+        ops_ = other.ops_;
+        other.ops_ = NULL;
+      }
+    }
+    return *this;
+  }
+  ~InlineCallback() {
+    Reset();
+  }
+
+  // Releases the callable
+  void Reset() {
+    if ( ops_ != NULL ) {
+      ops_->destroy_(&storage_);
+      ops_ = NULL;
+    }
+  }
+  bool empty() const {
+    return ops_ == NULL;
+  }
+  // True if the callable is stored in place (not on the heap)
+  bool is_inline() const {
+    return ops_ != NULL && ops_->is_inline_;
+  }
+
+  R operator()(Args... args) {
+    DCHECK(ops_ != NULL) << " Running an empty InlineCallback";
+    return ops_->invoke_(&storage_, std::forward<Args>(args)...);
+  }
+
+ private:
+  template <typename F> struct IsInline {
+    static const bool value =
+        sizeof(F) <= kInlineSize &&
+        alignof(F) <= alignof(std::max_align_t) &&
+        std::is_nothrow_move_constructible<F>::value;
+  };
+
+  // What we do w/ the callable - one (static) instance per callable type
+  struct Ops {
+    R (*invoke_)(void* storage, Args&&... args);
+    void (*move_)(void* from, void* to);
+    void (*destroy_)(void* storage);
+    bool is_inline_;
+  };
+  // For callables stored in place
+  template <typename F> struct InlineOps {
+    static R Invoke(void* storage, Args&&... args) {
+      return (*static_cast<F*>(storage))(std::forward<Args>(args)...);
+    }
+    static void Move(void* from, void* to) {
+      new (to) F(std::move(*static_cast<F*>(from)));
+      static_cast<F*>(from)->~F();
+    }
+    static void Destroy(void* storage) {
+      static_cast<F*>(storage)->~F();
+    }
+    static const Ops kOps;
+  };
+  // For callables on the heap (we store a pointer to them)
+  template <typename F> struct HeapOps {
+    static R Invoke(void* storage, Args&&... args) {
+      return (**static_cast<F**>(storage))(std::forward<Args>(args)...);
+    }
+    static void Move(void* from, void* to) {
+      *static_cast<F**>(to) = *static_cast<F**>(from);
+    }
+    static void Destroy(void* storage) {
+      delete *static_cast<F**>(storage);
+    }
+    static const Ops kOps;
+  };
+
+  template <typename F> void Init(F&& f, std::true_type /*is_inline*/) {
+    new (&storage_) F(std::move(f));
+    ops_ = &InlineOps<F>::kOps;
+  }
+  template <typename F> void Init(F&& f, std::false_type /*is_inline*/) {
+    *reinterpret_cast<F**>(&storage_) = new F(std::move(f));
+    ops_ = &HeapOps<F>::kOps;
+  }
+
+  typename std::aligned_storage<kInlineSize,
+                                alignof(std::max_align_t)>::type storage_;
+  const Ops* ops_;
+
+  InlineCallback(const InlineCallback&) = delete;
+  InlineCallback& operator=(const InlineCallback&) = delete;
+};
+
+template <typename R, typename... Args>
+template <typename F>
+const typename InlineCallback<R(Args...)>::Ops
+InlineCallback<R(Args...)>::InlineOps<F>::kOps = {
+  &InlineCallback<R(Args...)>::InlineOps<F>::Invoke,
+  &InlineCallback<R(Args...)>::InlineOps<F>::Move,
+  &InlineCallback<R(Args...)>::InlineOps<F>::Destroy,
+  true
+};
+template <typename R, typename... Args>
+template <typename F>
+const typename InlineCallback<R(Args...)>::Ops
+InlineCallback<R(Args...)>::HeapOps<F>::kOps = {
+  &InlineCallback<R(Args...)>::HeapOps<F>::Invoke,
+  &InlineCallback<R(Args...)>::HeapOps<F>::Move,
+  &InlineCallback<R(Args...)>::HeapOps<F>::Destroy,
+  false
+};
+
+//////////////////////////////////////////////////////////////////////
+//
+// Callback objects that run an InlineCallback
+//
+
+template <typename Sig> class InlineCallbackHolder;
+
+template <>
+class InlineCallbackHolder<void()> : public Closure {
+ public:
+  InlineCallbackHolder(bool is_permanent, InlineCallback<void()> f)
+    : Closure(is_permanent), f_(std::move(f)) {
+  }
+ protected:
+  virtual void RunInternal() {
+    f_();
+  }
+ private:
+  InlineCallback<void()> f_;
+};
+
+template <typename R>
+class InlineCallbackHolder<R()> : public ResultClosure<R> {
+ public:
+  InlineCallbackHolder(bool is_permanent, InlineCallback<R()> f)
+    : ResultClosure<R>(is_permanent), f_(std::move(f)) {
+  }
+ protected:
+  virtual R RunInternal() {
+    return f_();
+  }
+ private:
+  InlineCallback<R()> f_;
+};
+
+template <typename X0>
+class InlineCallbackHolder<void(X0)> : public Callback1<X0> {
+ public:
+  InlineCallbackHolder(bool is_permanent, InlineCallback<void(X0)> f)
+    : Callback1<X0>(is_permanent), f_(std::move(f)) {
+  }
+ protected:
+  virtual void RunInternal(X0 x0) {
+    f_(x0);
+  }
+ private:
+  InlineCallback<void(X0)> f_;
+};
+
+template <typename R, typename X0>
+class InlineCallbackHolder<R(X0)> : public ResultCallback1<R, X0> {
+ public:
+  InlineCallbackHolder(bool is_permanent, InlineCallback<R(X0)> f)
+    : ResultCallback1<R, X0>(is_permanent), f_(std::move(f)) {
+  }
+ protected:
+  virtual R RunInternal(X0 x0) {
+    return f_(x0);
+  }
+ private:
+  InlineCallback<R(X0)> f_;
+};
+
+template <typename X0, typename X1>
+class InlineCallbackHolder<void(X0, X1)> : public Callback2<X0, X1> {
+ public:
+  InlineCallbackHolder(bool is_permanent, InlineCallback<void(X0, X1)> f)
+    : Callback2<X0, X1>(is_permanent), f_(std::move(f)) {
+  }
+ protected:
+  virtual void RunInternal(X0 x0, X1 x1) {
+    f_(x0, x1);
+  }
+ private:
+  InlineCallback<void(X0, X1)> f_;
+};
+
+template <typename Sig>
+InlineCallbackHolder<Sig>* NewInlineCallback(InlineCallback<Sig> f) {
+  return new InlineCallbackHolder<Sig>(false, std::move(f));
+}
+template <typename Sig>
+InlineCallbackHolder<Sig>* NewPermanentInlineCallback(InlineCallback<Sig> f) {
+  return new InlineCallbackHolder<Sig>(true, std::move(f));
+}
+
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_BASE_CALLBACK_INLINE_CALLBACK_H__
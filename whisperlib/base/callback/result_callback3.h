@@ -31,11 +31,19 @@
 #ifndef __WHISPERLIB_BASE_CALLBACK_RESULT_CALLBACK3_H__
 #define __WHISPERLIB_BASE_CALLBACK_RESULT_CALLBACK3_H__
 
+#include "whisperlib/base/callback/callback_pool.h"
+
 namespace whisper {
 
 template<typename R, typename X0, typename X1, typename X2>
 class ResultCallback3 {
 public:
+  static void* operator new(size_t size) {
+    return CallbackPool::Allocate(size);
+  }
+  static void operator delete(void* p, size_t size) {
+    CallbackPool::Free(p, size);
+  }
   ResultCallback3(bool is_permanent)
     : is_permanent_(is_permanent) {
   }
@@ -31,11 +31,19 @@
 #ifndef __WHISPERLIB_CALLBACK_BASE_RESULT_CLOSURE_H__
 #define __WHISPERLIB_CALLBACK_BASE_RESULT_CLOSURE_H__
 
+#include "whisperlib/base/callback/callback_pool.h"
+
 namespace whisper {
 
 template<typename R>
 class ResultClosure {
 public:
+  static void* operator new(size_t size) {
+    return CallbackPool::Allocate(size);
+  }
+  static void operator delete(void* p, size_t size) {
+    CallbackPool::Free(p, size);
+  }
   ResultClosure(bool is_permanent)
     : is_permanent_(is_permanent) {
   }
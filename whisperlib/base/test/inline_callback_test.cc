@@ -0,0 +1,190 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests InlineCallback, the callback objects built on it, and the
+// recycling of callback memory.
+
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/callback.h"
+#include "whisperlib/sync/thread.h"
+
+using namespace whisper;
+
+static int glb_num_alive = 0;
+
+// Counts its live instances (moved from copies included)
+struct Tracked {
+  Tracked() {
+    ++glb_num_alive;
+  }
+  Tracked(const Tracked&) {
+    ++glb_num_alive;
+  }
+  Tracked(Tracked&&) noexcept {
+    ++glb_num_alive;
+  }
+  ~Tracked() {
+    --glb_num_alive;
+  }
+};
+
+static void Add(int* sum, int value) {
+  *sum += value;
+}
+
+void TestInline() {
+  int sum = 0;
+  InlineCallback<void(int)> f([&sum](int x) { sum += x; });
+  CHECK(!f.empty());
+  CHECK(f.is_inline());
+  f(2);
+  f(3);
+  CHECK_EQ(sum, 5);
+
+  // Moves leave the source empty
+  InlineCallback<void(int)> g(std::move(f));
+  CHECK(f.empty());
+  g(10);
+  CHECK_EQ(sum, 15);
+  f = std::move(g);
+  CHECK(g.empty());
+  f(1);
+  CHECK_EQ(sum, 16);
+
+  // Plain function pointers and results
+  InlineCallback<void(int*, int)> p(&Add);
+  p(&sum, 4);
+  CHECK_EQ(sum, 20);
+  InlineCallback<int(int, int)> r([](int a, int b) { return a * b; });
+  CHECK_EQ(r(6, 7), 42);
+  InlineCallback<std::string(const std::string&)> s(
+      [](const std::string& x) { return x + x; });
+  CHECK_EQ(s("ab"), "abab");
+}
+
+void TestHeap() {
+  {
+    // Too large to be stored in place
+    char big[2 * InlineCallback<void()>::kInlineSize] = { 0 };
+    big[1] = 7;
+    Tracked t;
+    int result = 0;
+    InlineCallback<void()> f([big, t, &result]() { result = big[1]; });
+    CHECK(!f.is_inline());
+    CHECK_EQ(glb_num_alive, 2);
+    InlineCallback<void()> g(std::move(f));
+    CHECK_EQ(glb_num_alive, 2);   // no copy - we just moved the pointer
+    g();
+    CHECK_EQ(result, 7);
+  }
+  CHECK_EQ(glb_num_alive, 0);
+  {
+    Tracked t;
+    InlineCallback<void()> f([t]() {});
+    CHECK(f.is_inline());
+    CHECK_EQ(glb_num_alive, 2);
+    f.Reset();
+    CHECK_EQ(glb_num_alive, 1);
+  }
+  CHECK_EQ(glb_num_alive, 0);
+}
+
+void TestHolders() {
+  int sum = 0;
+  // One shot ones delete themselves
+  Closure* c = NewInlineCallback(InlineCallback<void()>([&sum]() { ++sum; }));
+  CHECK(!c->is_permanent());
+  c->Run();
+  CHECK_EQ(sum, 1);
+
+  ResultClosure<bool>* rc = NewPermanentInlineCallback(
+      InlineCallback<bool()>([&sum]() { return ++sum > 2; }));
+  CHECK(!rc->Run());
+  CHECK(rc->Run());
+  delete rc;
+
+  Callback2<int, int>* c2 = NewPermanentInlineCallback(
+      InlineCallback<void(int, int)>([&sum](int a, int b) { sum = a + b; }));
+  c2->Run(20, 22);
+  CHECK_EQ(sum, 42);
+  delete c2;
+
+  ResultCallback1<int, int>* rc1 = NewInlineCallback(
+      InlineCallback<int(int)>([](int a) { return -a; }));
+  CHECK_EQ(rc1->Run(5), -5);
+}
+
+void TestPool() {
+  // Callbacks allocated in a thread and released in another
+  std::vector<Closure*> closures;
+  int sum = 0;
+  thread::Thread producer(NewInlineCallback(InlineCallback<void()>(
+      [&closures, &sum]() {
+        for ( int i = 0; i < 100000; ++i ) {
+          closures.push_back(NewCallback(&Add, &sum, 1));
+        }
+      })));
+  CHECK(producer.SetJoinable());
+  CHECK(producer.Start());
+  CHECK(producer.Join());
+  thread::Thread consumer(NewInlineCallback(InlineCallback<void()>(
+      [&closures]() {
+        for ( size_t i = 0; i < closures.size(); ++i ) {
+          closures[i]->Run();
+        }
+      })));
+  CHECK(consumer.SetJoinable());
+  CHECK(consumer.Start());
+  CHECK(consumer.Join());
+  CHECK_EQ(sum, 100000);
+
+  // Same memory comes back in the same thread
+  Closure* const c = NewCallback(&Add, &sum, 1);
+  void* const p = c;
+  delete c;
+  Closure* const d = NewCallback(&Add, &sum, 2);
+  CHECK(static_cast<void*>(d) == p);
+  d->Run();
+  CHECK_EQ(sum, 100002);
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  TestInline();
+  TestHeap();
+  TestHolders();
+  TestPool();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -31,8 +31,12 @@
 // Author: Catalin Popescu
 //
 
+#include <math.h>
+#include <string.h>
+#include <algorithm>
 #include "whisperlib/http/failsafe_http_client.h"
 #include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
 
 using namespace std;
 
@@ -45,6 +49,98 @@ DEFINE_int32(http_failsafe_max_log_size, 100,
 namespace whisper {
 namespace http {
 
+namespace {
+// Weight of a new latency in the EWMA of a server
+const double kLatencyEwmaAlpha = 0.3;
+// The EWMA latency of a server halves for each this long w/o replies
+const double kLatencyHalfLifeMs = 1000.0;
+// For a failure we count the latency as 4 x EWMA, but at least this
+const double kFailureLatencyUs = 10000.0;
+
+// FNV-1a, w/ a final mix (so close keys land far apart on the ring)
+uint32 RingHash(const char* data, size_t size) {
+  uint32 h = 2166136261U;
+  for ( size_t i = 0; i < size; ++i ) {
+    h = (h ^ uint8(data[i])) * 16777619U;
+  }
+  h ^= h >> 16;
+  h *= 0x85ebca6bU;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35U;
+  h ^= h >> 16;
+  return h;
+}
+// The path of a request URI (w/o the query)
+string UriPath(const string& uri) {
+  const size_t pos = uri.find('?');
+  return pos == string::npos ? uri : uri.substr(0, pos);
+}
+}
+
+struct FailSafeClient::LatencyWindow {
+  vector<int32> samples_us_;
+  size_t next_;
+  size_t num_;
+  // We recompute the percentile after these many new samples
+  size_t num_new_;
+  int64 percentile_us_;
+  LatencyWindow()
+      : samples_us_(kLatencyWindowSize), next_(0), num_(0), num_new_(0),
+        percentile_us_(0) {
+  }
+  void Add(int64 latency_us) {
+    samples_us_[next_] = int32(min(latency_us, int64(kMaxInt32)));
+    next_ = (next_ + 1) % samples_us_.size();
+    num_ = min(num_ + 1, samples_us_.size());
+    ++num_new_;
+  }
+  int64 Percentile(double percentile) {
+    if ( num_new_ > 0 && (num_new_ >= 16 || num_ < samples_us_.size()) ) {
+      vector<int32> sorted(samples_us_.begin(), samples_us_.begin() + num_);
+      const size_t n = min(size_t(percentile * num_), num_ - 1);
+      nth_element(sorted.begin(), sorted.begin() + n, sorted.end());
+      percentile_us_ = sorted[n];
+      num_new_ = 0;
+    }
+    return percentile_us_;
+  }
+};
+
+const char* FailSafeClient::BalancePolicyName(BalancePolicy policy) {
+  switch ( policy ) {
+    CONSIDER(BALANCE_LEAST_OUTSTANDING);
+    CONSIDER(BALANCE_P2C_EWMA);
+    CONSIDER(BALANCE_CONSISTENT_HASH);
+  }
+  return "UNKNOWN";
+}
+
+FailSafeClient::PoolParams::PoolParams()
+    : min_connections_per_host_(0),
+      max_connections_per_host_(1),
+      idle_timeout_ms_(0) {
+}
+
+FailSafeClient::HedgeParams::HedgeParams()
+    : enabled_(false),
+      percentile_(0.95),
+      min_delay_ms_(1),
+      min_samples_(20),
+      max_hedge_percent_(10) {
+}
+
+string FailSafeClient::PoolStats::ToString() const {
+  return strutil::StringPrintf(
+      "open: %d busy: %d outstanding: %" PRId64 " pending: %" PRId64
+      " opened: %" PRId64 " reaped: %" PRId64 " failed: %" PRId64
+      " sent: %" PRId64 " queued: %" PRId64 " hedged: %" PRId64
+      " hedges won: %" PRId64 " losers canceled: %" PRId64,
+      open_connections_, busy_connections_, outstanding_requests_,
+      pending_requests_, connections_opened_, connections_reaped_,
+      connections_failed_, requests_sent_, requests_queued_,
+      requests_hedged_, hedges_won_, losers_canceled_);
+}
+
 FailSafeClient::FailSafeClient(
     net::Selector* selector,
     const ClientParams* client_params,
@@ -64,9 +160,15 @@ FailSafeClient::FailSafeClient(
       request_timeout_ms_(request_timeout_ms),
       reopen_connection_interval_ms_(reopen_connection_interval_ms),
       force_host_header_(force_host_header),
+      pools_(servers.size()),
+      next_client_id_(0),
+      balance_policy_(BALANCE_LEAST_OUTSTANDING),
+      rand_seed_(uint32(size_t(this))),
       pending_requests_(new PendingQueue),
       pending_map_(new PendingMap()),
-      closing_(false) {
+      closing_(false),
+      canceling_client_(false) {
+  memset(&stats_, 0, sizeof(stats_));
   CHECK(connection_factory_->is_permanent());
   CHECK(!servers_.empty());
   // Since this an HTTP client, default to port 80 when no port specified
@@ -74,7 +176,14 @@ FailSafeClient::FailSafeClient(
       if (servers_[i].port() == 0) {
           servers_[i].set_port(80);
       }
+      for (int j = 0; j < kNumVirtualNodes; ++j) {
+          const string node = strutil::StringPrintf(
+              "%s#%d", servers_[i].ToString().c_str(), j);
+          ring_.push_back(make_pair(RingHash(node.data(), node.size()),
+                                    int(i)));
+      }
   }
+  sort(ring_.begin(), ring_.end());
 
   requeue_pending_callback_ = NewPermanentCallback(
       this, &FailSafeClient::RequeuePendingAlarm);
@@ -99,6 +208,10 @@ FailSafeClient::~FailSafeClient() {
   }
   delete pending_requests_;
   delete pending_map_;
+  for ( LatencyMap::const_iterator it = path_latency_.begin();
+        it != path_latency_.end(); ++it ) {
+    delete it->second;
+  }
   selector_->UnregisterAlarm(requeue_pending_callback_);
   delete requeue_pending_callback_;
   if ( auto_delete_connection_factory_ ) {
@@ -109,17 +222,49 @@ FailSafeClient::~FailSafeClient() {
 void FailSafeClient::ForceCloseAll() {
   bool was_closing = closing_;
   closing_ = true;
-  for ( size_t i = 0; i < clients_.size(); ++i ) {
-    if ( clients_[i] != NULL ) {
-      clients_[i]->ResolveAllRequestsWithError();
-      delete clients_[i];
+  vector<ClientProtocol*> clients;
+  for ( size_t i = 0; i < pools_.size(); ++i ) {
+    for ( size_t j = 0; j < pools_[i].clients_.size(); ++j ) {
+      clients.push_back(pools_[i].clients_[j].client_);
     }
+    pools_[i] = HostPool();
+  }
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    clients[i]->ResolveAllRequestsWithError();
+    delete clients[i];
   }
-  death_time_.clear();
-  clients_.clear();
   closing_ = was_closing;
 }
 
+void FailSafeClient::SetPoolParams(const PoolParams& pool_params) {
+  CHECK_GT(pool_params.max_connections_per_host_, 0);
+  CHECK_LE(pool_params.min_connections_per_host_,
+           pool_params.max_connections_per_host_);
+  pool_params_ = pool_params;
+  selector_->RunInSelectLoop(
+      NewCallback(this, &FailSafeClient::MaintainPools));
+}
+
+void FailSafeClient::GetPoolStats(PoolStats* stats) const {
+  *stats = stats_;
+  stats->open_connections_ = 0;
+  stats->busy_connections_ = 0;
+  stats->outstanding_requests_ = 0;
+  for ( size_t i = 0; i < pools_.size(); ++i ) {
+    for ( size_t j = 0; j < pools_[i].clients_.size(); ++j ) {
+      const PooledClient& pc = pools_[i].clients_[j];
+      if ( !pc.client_->IsAlive() ) {
+        continue;
+      }
+      const size_t load = pc.load();
+      ++stats->open_connections_;
+      stats->busy_connections_ += (load > 0);
+      stats->outstanding_requests_ += load;
+    }
+  }
+  stats->pending_requests_ = pending_requests_->size();
+}
+
 void FailSafeClient::StartRequestWithUrgency(ClientRequest* request,
                                              Closure* completion_callback,
                                              bool urgent) {
@@ -150,6 +295,7 @@ bool FailSafeClient::CancelRequest(ClientRequest* request) {
 ////////////////////
 
 void FailSafeClient::RequeuePendingAlarm() {
+  MaintainPools();
   RequeuePending();
   selector_->RegisterAlarm(requeue_pending_callback_, kRequeuePendingAlarmMs);
 }
@@ -227,52 +373,13 @@ bool FailSafeClient::InternalStartRequest(PendingStruct* ps) {
     CompleteWithError(ps, CONN_TOO_MANY_RETRIES);
     return true;
   }
-  int min_id = -1;
-  size_t min_load = 0;
-  while (min_id < 0) {
-    for ( size_t i = 0; i < clients_.size(); ++i ) {
-      if ( clients_[i] != NULL && clients_[i]->IsAlive() ) {
-        const size_t load = (clients_[i]->num_active_requests() +
-                            clients_[i]->num_waiting_requests());
-        if ( load < min_load || min_id < 0 ) {
-          min_load = load;
-          min_id = i;
-        }
-      } else {
-        if ( clients_[i] != NULL ) {
-          ClientProtocol* clients = clients_[i];
-          clients_[i] = NULL;
-          clients->ResolveAllRequestsWithError();
-          delete clients;
-        }
-        if ( selector_->now() - death_time_[i] >
-             reopen_connection_interval_ms_ && death_time_[i] > 0) {
-          LOG_HTTP << " Reopening client for: " << servers_[i].ToString()
-                   << " // " << selector_->now() << " // " << death_time_[i]
-                   << " @" << reopen_connection_interval_ms_;
-          clients_[i] = CreateClient(i);
-          death_time_[i] = selector_->now();
-          min_load = 0; min_id = i;
-        } else if (death_time_[i] == 0) {
-            death_time_[i] = selector_->now();
-        }
-      }
-    }
-    if ( min_id < 0 || min_load > 0) {
-      if (clients_.size() < servers_.size() ) {
-        min_id = clients_.size();
-        min_load = 0;
-        clients_.push_back(CreateClient(clients_.size()));
-        death_time_.push_back(0);
-      } else {
-          break;
-      }
-    }
-  }
-
-  if ( min_id < 0 || // min_load > 0 ) {
-       (min_load > 0 && client_params_->keep_alive_sec_ == 0) ||
-       (min_load >= client_params_->max_concurrent_requests_) ) {
+  const int64 now = selector_->now();
+  int server = -1;
+  size_t ndx = 0;
+  size_t load = 0;
+  if ( !PickClient(ps->req_, now, -1, &server, &ndx, &load) ||
+       !CanSendWithLoad(load) ) {
+    ++stats_.requests_queued_;
     pending_map_->insert(make_pair(ps->req_, ps));
     if (!ps->urgent_) {
       pending_requests_->push_back(ps);
@@ -287,12 +394,13 @@ bool FailSafeClient::InternalStartRequest(PendingStruct* ps) {
   }
 
   LOG_HTTP << " Sending request: " << ps->req_->name()
-           << " to " << servers_[min_id].ToString() << " id: " << min_id
-           << " load: " << min_load;
-  const int64 now = selector_->now();
+           << " to " << servers_[server].ToString()
+           << " id: " << server << "/" << ndx
+           << " load: " << load;
   completion_events_.push_back(
       make_pair(now, ps->ToString(now) +
-                strutil::StringPrintf(" => START [%d]", min_id)));
+                strutil::StringPrintf(" => START [%d/%d]",
+                                      server, int(ndx))));
 
   // bool host_added = false;
   if ( !force_host_header_.empty() ) {
@@ -302,16 +410,58 @@ bool FailSafeClient::InternalStartRequest(PendingStruct* ps) {
   }
 
   ps->req_->request()->client_data()->MarkerSet();
-  clients_[min_id]->SendRequest(
+  PooledClient& pc = pools_[server].clients_[ndx];
+  pc.last_used_ms_ = now;
+  ++stats_.requests_sent_;
+  ps->server_ = server;
+  ps->client_id_ = pc.id_;
+  ps->sent_us_ = timer::TicksUsec();
+
+  // Hedge GET / HEAD requests that are late, when we know the latency
+  const HttpMethod method = ps->req_->request()->client_header()->method();
+  if ( hedge_params_.enabled_ && !ps->hedged_ && servers_.size() > 1 &&
+       (method == METHOD_GET || method == METHOD_HEAD) ) {
+    const LatencyMap::const_iterator it = path_latency_.find(
+        UriPath(ps->req_->request()->client_header()->uri()));
+    if ( it != path_latency_.end() &&
+         it->second->num_ >= size_t(hedge_params_.min_samples_) ) {
+      const int64 delay_ms = max(
+          int64(hedge_params_.min_delay_ms_),
+          (it->second->Percentile(hedge_params_.percentile_) + 999) / 1000);
+      ps->hedge_alarm_ = NewCallback(this, &FailSafeClient::HedgeAlarm, ps);
+      selector_->RegisterAlarm(ps->hedge_alarm_, delay_ms);
+    }
+  }
+
+  pc.client_->SendRequest(
       ps->req_,
-      NewCallback(this, &FailSafeClient::CompletionCallback, ps, min_id));
+      NewCallback(this, &FailSafeClient::CompletionCallback,
+                  ps, server, pc.id_));
   return true;
 }
 
-void FailSafeClient::CompletionCallback(PendingStruct* ps, int client_id) {
+void FailSafeClient::CompletionCallback(PendingStruct* ps,
+                                        int server, int64 client_id) {
   // Is possible to be reset
   // CHECK(ps->req_->is_finalized());
   const int64 now = selector_->now();
+  if ( ps->hedge_alarm_ != NULL ) {
+    selector_->UnregisterAlarm(ps->hedge_alarm_);
+    delete ps->hedge_alarm_;
+    ps->hedge_alarm_ = NULL;
+  }
+  if ( ps->hedge_won_ ) {
+    return;   // we are canceled - HedgeCompletionCallback completes ps
+  }
+  if ( !ps->canceled_ ) {
+    const bool ok = ps->req_->error() == CONN_OK;
+    UpdateClient(server, client_id, ok, now);
+    if ( ok ) {
+      RecordLatency(server, ps->req_, timer::TicksUsec() - ps->sent_us_);
+    } else if ( !closing_ && !canceling_client_ ) {
+      RecordFailure(server);
+    }
+  }
   if ( ps->canceled_ ) {
     ps->req_->request()->client_data()->MarkerRestore();
     RequeuePending();
@@ -319,38 +469,454 @@ void FailSafeClient::CompletionCallback(PendingStruct* ps, int client_id) {
   } else if ( ps->req_->is_finalized() &&
               ps->req_->error() != CONN_INCOMPLETE &&
               (closing_ || ps->req_->error() == CONN_OK) ) {
-    // W/o keep alive - stop it
-    if (client_params_->keep_alive_sec_ == 0 && clients_[client_id] && !closing_) {
-      selector_->RunInSelectLoop(NewCallback(this, &FailSafeClient::ClearClient,
-                                            clients_[client_id]));
-      clients_[client_id] = NULL;
-      death_time_[client_id] = 0;
+    CompleteRequest(ps, now);
+  } else if ( ps->hedge_ != NULL ) {
+    // The hedge may still make it
+    ps->primary_failed_ = true;
+  } else {
+    if ( canceling_client_ && ps->retries_left_ >= 0 ) {
+      ++ps->retries_left_;   // we closed its connection - not a real retry
     }
-    pending_map_->erase(ps->req_);
-    RequeuePending();
-    ps->req_->request()->client_data()->MarkerClear();
-    completion_events_.push_back(make_pair(now, ps->ToString(now) + " => closed w/ " +
-        http::GetHttpReturnCodeName(ps->req_->request()->server_header()->status_code())));
-    if (ps->req_->request()->server_header()->status_code() == http::UNKNOWN) {
-      LOG_WARNING << " Completed Request in UNKNOWN state: " << ps->ToString(now);
+    RetryRequest(ps, now);
+  }
+  while (completion_events_.size() > size_t(FLAGS_http_failsafe_max_log_size)) {
+      completion_events_.pop_front();
+  }
+}
+
+void FailSafeClient::CompleteRequest(PendingStruct* ps, int64 now) {
+  if ( ps->hedge_ != NULL ) {
+    CancelHedge(ps);
+  }
+  // W/o keep alive - stop it
+  const int ndx = FindClient(ps->server_, ps->client_id_);
+  if (client_params_->keep_alive_sec_ == 0 && ndx >= 0 && !closing_) {
+    vector<PooledClient>& clients = pools_[ps->server_].clients_;
+    selector_->RunInSelectLoop(NewCallback(this, &FailSafeClient::ClearClient,
+                                          clients[ndx].client_));
+    clients.erase(clients.begin() + ndx);
+  }
+  pending_map_->erase(ps->req_);
+  RequeuePending();
+  ps->req_->request()->client_data()->MarkerClear();
+  completion_events_.push_back(make_pair(now, ps->ToString(now) + " => closed w/ " +
+      http::GetHttpReturnCodeName(ps->req_->request()->server_header()->status_code())));
+  if (ps->req_->request()->server_header()->status_code() == http::UNKNOWN) {
+    LOG_WARNING << " Completed Request in UNKNOWN state: " << ps->ToString(now);
+  }
+  Closure* completion_closure = ps->completion_closure_;
+  delete ps;
+
+  selector_->RunInSelectLoop(completion_closure);
+}
+
+void FailSafeClient::RetryRequest(PendingStruct* ps, int64 now) {
+  ps->req_->request()->client_data()->MarkerRestore();
+  ps->req_->request()->server_data()->Clear();
+  ps->req_->request()->server_header()->Clear();
+  completion_events_.push_back(make_pair(now, ps->ToString(now) + " => retry w/ " +
+     http::GetHttpReturnCodeName(
+         ps->req_->request()->server_header()->status_code())));
+  InternalStartRequest(ps);
+}
+
+////////////////////
+
+void FailSafeClient::HedgeAlarm(PendingStruct* ps) {
+  ps->hedge_alarm_ = NULL;
+  if ( closing_ || ps->hedge_ != NULL ||
+       stats_.requests_hedged_ * 100 >=
+       stats_.requests_sent_ * hedge_params_.max_hedge_percent_ ) {
+    return;
+  }
+  const int64 now = selector_->now();
+  int server = -1;
+  size_t ndx = 0;
+  size_t load = 0;
+  // The loser connection gets closed, so we hedge only when that touches
+  // no other request
+  const int primary_ndx = FindClient(ps->server_, ps->client_id_);
+  if ( primary_ndx < 0 ||
+       pools_[ps->server_].clients_[primary_ndx].load() != 1 ) {
+    return;
+  }
+  if ( !PickClient(ps->req_, now, ps->server_, &server, &ndx, &load) ||
+       load != 0 ) {
+    return;
+  }
+  ps->hedged_ = true;
+  Hedge* const hedge = new Hedge();
+  hedge->ps_ = ps;
+  hedge->req_.request()->client_header()->CopyHeaders(
+      *ps->req_->request()->client_header(), true);
+  hedge->req_.set_request_timeout_ms(ps->req_->request_timeout_ms());
+  hedge->server_ = server;
+  PooledClient& pc = pools_[server].clients_[ndx];
+  hedge->client_id_ = pc.id_;
+  hedge->sent_us_ = timer::TicksUsec();
+  ps->hedge_ = hedge;
+  pc.last_used_ms_ = now;
+  ++stats_.requests_sent_;
+  ++stats_.requests_hedged_;
+  LOG_HTTP << " Hedging request: " << ps->req_->name()
+           << " to " << servers_[server].ToString();
+  completion_events_.push_back(
+      make_pair(now, ps->ToString(now) +
+                strutil::StringPrintf(" => HEDGE [%d/%d]",
+                                      server, int(ndx))));
+  pc.client_->SendRequest(
+      &hedge->req_,
+      NewCallback(this, &FailSafeClient::HedgeCompletionCallback, hedge));
+}
+
+void FailSafeClient::HedgeCompletionCallback(Hedge* hedge) {
+  PendingStruct* const ps = hedge->ps_;
+  if ( ps == NULL ) {
+    delete hedge;   // lost the race
+    return;
+  }
+  ps->hedge_ = NULL;
+  const int64 now = selector_->now();
+  const bool ok = (hedge->req_.error() == CONN_OK);
+  UpdateClient(hedge->server_, hedge->client_id_, ok, now);
+  if ( !ok ) {
+    if ( !closing_ && !canceling_client_ ) {
+      RecordFailure(hedge->server_);
+    }
+    delete hedge;
+    if ( ps->primary_failed_ ) {
+      ps->primary_failed_ = false;
+      RetryRequest(ps, now);
     }
-    Closure* completion_closure = ps->completion_closure_;
-    delete ps;
+    return;
+  }
+  RecordLatency(hedge->server_, &hedge->req_,
+                timer::TicksUsec() - hedge->sent_us_);
+  ++stats_.hedges_won_;
+  if ( !ps->primary_failed_ ) {
+    // Cancel the original - synchronously, as the caller can delete
+    // ps->req_ when we complete
+    ps->hedge_won_ = true;
+    CancelClient(ps->server_, ps->client_id_);
+    ps->hedge_won_ = false;
+  }
+  ps->primary_failed_ = false;
+  Request* const dest = ps->req_->request();
+  dest->server_header()->Clear();
+  dest->server_header()->CopyHeaders(*hedge->req_.request()->server_header(),
+                                     true);
+  dest->server_data()->Clear();
+  dest->server_data()->AppendStream(hedge->req_.request()->server_data());
+  ps->req_->set_error(CONN_OK);
+  ps->server_ = hedge->server_;
+  ps->client_id_ = hedge->client_id_;
+  delete hedge;
+  CompleteRequest(ps, now);
+}
+
+void FailSafeClient::CancelHedge(PendingStruct* ps) {
+  Hedge* const hedge = ps->hedge_;
+  ps->hedge_ = NULL;
+  hedge->ps_ = NULL;
+  CancelClient(hedge->server_, hedge->client_id_);
+}
+
+void FailSafeClient::CancelClient(int server, int64 client_id) {
+  const int ndx = FindClient(server, client_id);
+  if ( ndx < 0 ) {
+    return;
+  }
+  vector<PooledClient>& clients = pools_[server].clients_;
+  ClientProtocol* const client = clients[ndx].client_;
+  clients.erase(clients.begin() + ndx);
+  ++stats_.losers_canceled_;
+  // (the completion callbacks run right away)
+  const bool was_canceling = canceling_client_;
+  canceling_client_ = true;
+  client->ResolveAllRequestsWithProvidedError(CONN_CLIENT_CLOSE);
+  canceling_client_ = was_canceling;
+  delete client;
+}
+
+////////////////////
+
+bool FailSafeClient::CanSendWithLoad(size_t load) const {
+  return (load == 0 || client_params_->keep_alive_sec_ != 0) &&
+      load < client_params_->max_concurrent_requests_;
+}
+
+bool FailSafeClient::IsServerAvailable(int server, int64 now) const {
+  if ( CanOpenClient(server, now) ) {
+    return true;
+  }
+  const vector<PooledClient>& clients = pools_[server].clients_;
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    if ( CanSendWithLoad(clients[i].load()) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+double FailSafeClient::ServerLatency(int server, int64 now) const {
+  const HostPool& pool = pools_[server];
+  return pool.latency_us_ *
+      ::exp2(-(now - pool.latency_time_ms_) / kLatencyHalfLifeMs);
+}
+
+void FailSafeClient::RecordLatency(int server, ClientRequest* req,
+                                   int64 latency_us) {
+  HostPool& pool = pools_[server];
+  const double latency = ServerLatency(server, selector_->now());
+  // We follow the peaks right away, and go down slowly
+  pool.latency_us_ = (latency_us > latency ? latency_us :
+                      latency + kLatencyEwmaAlpha * (latency_us - latency));
+  pool.latency_time_ms_ = selector_->now();
+
+  string path = UriPath(req->request()->client_header()->uri());
+  LatencyMap::iterator it = path_latency_.find(path);
+  if ( it == path_latency_.end() ) {
+    if ( path_latency_.size() >= kMaxLatencyPaths ) {
+      path.clear();
+      it = path_latency_.find(path);
+    }
+    if ( it == path_latency_.end() ) {
+      it = path_latency_.insert(make_pair(path, new LatencyWindow())).first;
+    }
+  }
+  it->second->Add(latency_us);
+}
 
-    selector_->RunInSelectLoop(completion_closure);
+void FailSafeClient::RecordFailure(int server) {
+  HostPool& pool = pools_[server];
+  pool.latency_us_ = max(4 * ServerLatency(server, selector_->now()),
+                         kFailureLatencyUs);
+  pool.latency_time_ms_ = selector_->now();
+}
+
+void FailSafeClient::UpdateClient(int server, int64 client_id,
+                                  bool ok, int64 now) {
+  const int ndx = FindClient(server, client_id);
+  if ( ndx < 0 ) {
+    return;
+  }
+  PooledClient& pc = pools_[server].clients_[ndx];
+  pc.last_used_ms_ = now;
+  if ( ok ) {
+    ++pc.num_ok_;
   } else {
-    ps->req_->request()->client_data()->MarkerRestore();
-    ps->req_->request()->server_data()->Clear();
-    ps->req_->request()->server_header()->Clear();
-    completion_events_.push_back(make_pair(now, ps->ToString(now) + " => retry w/ " +
-       http::GetHttpReturnCodeName(
-           ps->req_->request()->server_header()->status_code())));
-    InternalStartRequest(ps);
+    pc.failed_ = true;
   }
-  while (completion_events_.size() > size_t(FLAGS_http_failsafe_max_log_size)) {
-      completion_events_.pop_front();
+}
+
+bool FailSafeClient::PickServerClient(int server, int64 now,
+                                      size_t* ndx, size_t* load) {
+  const vector<PooledClient>& clients = pools_[server].clients_;
+  bool found = false;
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    const size_t crt_load = clients[i].load();
+    if ( !found || crt_load < *load ) {
+      found = true;
+      *ndx = i;
+      *load = crt_load;
+    }
+  }
+  if ( (!found || *load > 0) && CanOpenClient(server, now) ) {
+    *ndx = OpenClient(server);
+    *load = 0;
+    found = true;
+  }
+  return found;
+}
+
+bool FailSafeClient::PickClient(ClientRequest* req, int64 now,
+                                int exclude, int* server,
+                                size_t* ndx, size_t* load) {
+  for ( size_t i = 0; i < pools_.size(); ++i ) {
+    RemoveDeadClients(i);
+  }
+  *server = -1;
+  switch ( balance_policy_ ) {
+    case BALANCE_LEAST_OUTSTANDING: {
+      // The least loaded connection of all servers
+      for ( size_t i = 0; i < pools_.size(); ++i ) {
+        if ( int(i) == exclude ) {
+          continue;
+        }
+        const HostPool& pool = pools_[i];
+        for ( size_t j = 0; j < pool.clients_.size(); ++j ) {
+          const size_t crt_load = pool.clients_[j].load();
+          if ( *server < 0 || crt_load < *load ) {
+            *server = i;
+            *ndx = j;
+            *load = crt_load;
+          }
+        }
+      }
+      if ( *server < 0 || *load > 0 ) {
+        // All busy - open a new connection to the server w/ the fewest ones
+        int open_server = -1;
+        for ( size_t i = 0; i < pools_.size(); ++i ) {
+          if ( int(i) != exclude && CanOpenClient(i, now) &&
+               (open_server < 0 || (pools_[i].clients_.size() <
+                                    pools_[open_server].clients_.size())) ) {
+            open_server = i;
+          }
+        }
+        if ( open_server >= 0 ) {
+          *server = open_server;
+          *ndx = OpenClient(open_server);
+          *load = 0;
+        }
+      }
+      return *server >= 0;
+    }
+    case BALANCE_P2C_EWMA: {
+      vector<int> available;
+      for ( size_t i = 0; i < pools_.size(); ++i ) {
+        if ( int(i) != exclude && IsServerAvailable(i, now) ) {
+          available.push_back(i);
+        }
+      }
+      if ( available.empty() ) {
+        return false;
+      }
+      *server = available[::rand_r(&rand_seed_) % available.size()];
+      if ( available.size() > 1 ) {
+        int other = available[::rand_r(&rand_seed_) %
+                              (available.size() - 1)];
+        if ( other == *server ) {
+          other = available.back();
+        }
+        // Score: latency x (outstanding requests + 1)
+        double scores[2] = { 0, 0 };
+        const int candidates[2] = { *server, other };
+        for ( int c = 0; c < 2; ++c ) {
+          size_t outstanding = 0;
+          const HostPool& pool = pools_[candidates[c]];
+          for ( size_t j = 0; j < pool.clients_.size(); ++j ) {
+            outstanding += pool.clients_[j].load();
+          }
+          scores[c] = ServerLatency(candidates[c], now) * (outstanding + 1);
+        }
+        if ( scores[1] < scores[0] ) {
+          *server = other;
+        }
+      }
+      return PickServerClient(*server, now, ndx, load);
+    }
+    case BALANCE_CONSISTENT_HASH: {
+      const string& key = (req->balance_key().empty()
+                           ? req->request()->client_header()->uri()
+                           : req->balance_key());
+      const uint32 h = RingHash(key.data(), key.size());
+      size_t pos = lower_bound(ring_.begin(), ring_.end(),
+                               make_pair(h, -1)) - ring_.begin();
+      // The first available server on the ring
+      for ( size_t i = 0; i < ring_.size(); ++i, ++pos ) {
+        const int crt = ring_[pos % ring_.size()].second;
+        if ( crt != exclude && IsServerAvailable(crt, now) ) {
+          *server = crt;
+          return PickServerClient(crt, now, ndx, load);
+        }
+      }
+      return false;
+    }
+  }
+  return false;
+}
+
+int FailSafeClient::FindClient(int server, int64 client_id) const {
+  const vector<PooledClient>& clients = pools_[server].clients_;
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    if ( clients[i].id_ == client_id ) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool FailSafeClient::CanOpenClient(int server, int64 now) const {
+  const HostPool& pool = pools_[server];
+  if ( pool.clients_.size() >=
+       size_t(pool_params_.max_connections_per_host_) ) {
+    return false;
   }
+  // After an error we wait a bit before retrying the server
+  return (pool.death_time_ == 0 ||
+          now - pool.death_time_ > reopen_connection_interval_ms_);
 }
+
+size_t FailSafeClient::OpenClient(int server) {
+  LOG_HTTP << " Opening client for: " << servers_[server].ToString()
+           << " pool size: " << pools_[server].clients_.size();
+  PooledClient pc;
+  pc.client_ = CreateClient(server);
+  pc.id_ = next_client_id_++;
+  pc.last_used_ms_ = selector_->now();
+  pc.num_ok_ = 0;
+  pc.failed_ = false;
+  pools_[server].clients_.push_back(pc);
+  ++stats_.connections_opened_;
+  return pools_[server].clients_.size() - 1;
+}
+
+void FailSafeClient::RemoveDeadClients(int server) {
+  HostPool& pool = pools_[server];
+  vector<ClientProtocol*> dead;
+  for ( size_t i = 0; i < pool.clients_.size(); ) {
+    const PooledClient& pc = pool.clients_[i];
+    if ( pc.client_->IsAlive() ) {
+      ++i;
+      continue;
+    }
+    // A connection that served us well was just closed by the server
+    // (e.g. keep alive timeout) - nothing wrong w/ the server.
+    if ( pc.failed_ || pc.num_ok_ == 0 ) {
+      LOG_HTTP << " Lost connection to: " << servers_[server].ToString();
+      pool.death_time_ = selector_->now();
+      ++stats_.connections_failed_;
+    }
+    dead.push_back(pc.client_);
+    pool.clients_.erase(pool.clients_.begin() + i);
+  }
+  // The completion callbacks may change the pools - so we resolve at the end
+  for ( size_t i = 0; i < dead.size(); ++i ) {
+    dead[i]->ResolveAllRequestsWithError();
+    delete dead[i];
+  }
+}
+
+void FailSafeClient::MaintainPools() {
+  if ( closing_ ) {
+    return;
+  }
+  const int64 now = selector_->now();
+  for ( size_t i = 0; i < pools_.size(); ++i ) {
+    RemoveDeadClients(i);
+    vector<PooledClient>& clients = pools_[i].clients_;
+    if ( pool_params_.idle_timeout_ms_ > 0 ) {
+      for ( size_t j = 0; j < clients.size() &&
+                int32(clients.size()) >
+                pool_params_.min_connections_per_host_; ) {
+        if ( clients[j].load() == 0 &&
+             now - clients[j].last_used_ms_ > pool_params_.idle_timeout_ms_ ) {
+          ClientProtocol* const client = clients[j].client_;
+          clients.erase(clients.begin() + j);
+          ++stats_.connections_reaped_;
+          ClearClient(client);
+        } else {
+          ++j;
+        }
+      }
+    }
+    while ( int32(clients.size()) < pool_params_.min_connections_per_host_ &&
+            CanOpenClient(i, now) ) {
+      OpenClient(i);
+    }
+  }
+}
+
 ClientStreamReceiverProtocol* FailSafeClient::CreateStreamReceiveClient(size_t ndx) {
     if (servers_.empty()) { return NULL; }
     http::BaseClientConnection* connection = connection_factory_->Run();
@@ -412,12 +978,26 @@ void FailSafeClient::StatusString(string* s) const {
     *s += "\n";
     *s += "\n    Connection status:";
     *s += "\n============================================================";
-    for (size_t i = 0; i < clients_.size(); ++i) {
-        if (clients_[i] == NULL) {
-            *s += strutil::StringPrintf("\n  >>> Connection %d --> CLOSED", i);
-        } else {
-            *s += strutil::StringPrintf("\n  >>> Connection %d Data: ", i);
-            *s += clients_[i]->StatusString();
+    PoolStats stats;
+    GetPoolStats(&stats);
+    *s += "\n  Pool: " + stats.ToString();
+    *s += strutil::StringPrintf("\n  Balance: %s",
+                                BalancePolicyName(balance_policy_));
+    for (size_t i = 0; i < pools_.size(); ++i) {
+        const HostPool& pool = pools_[i];
+        *s += strutil::StringPrintf("\n  >>> Server %s: %d connections"
+                                    " latency: %.3f ms",
+                                    servers_[i].ToString().c_str(),
+                                    int(pool.clients_.size()),
+                                    ServerLatency(i, now) * 1e-3);
+        if (pool.death_time_ > 0) {
+            *s += strutil::StringPrintf(" (last lost %.3f sec ago)",
+                                        (now - pool.death_time_) * 1e-3);
+        }
+        for (size_t j = 0; j < pool.clients_.size(); ++j) {
+            *s += strutil::StringPrintf("\n  >>> Connection %d/%d Data: ",
+                                        int(i), int(j));
+            *s += pool.clients_[j].client_->StatusString();
         }
     }
 }
@@ -451,13 +1031,12 @@ void FailSafeClient::Reset() {
                                           "=== Reset requested ==="));
 
    vector<ClientProtocol*> clients;
-   for (size_t i = 0; i < clients_.size(); ++i) {
-       if (clients_[i] != NULL) {
-           clients.push_back(clients_[i]);
+   for (size_t i = 0; i < pools_.size(); ++i) {
+       for (size_t j = 0; j < pools_[i].clients_.size(); ++j) {
+           clients.push_back(pools_[i].clients_[j].client_);
        }
+       pools_[i] = HostPool();
    }
-   clients_.clear();
-   death_time_.clear();
 
    for (size_t i = 0; i < clients.size(); ++i) {
        clients[i]->ResolveAllRequestsWithProvidedError(CONN_CLIENT_CLOSE);
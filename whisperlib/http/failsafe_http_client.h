@@ -54,6 +54,21 @@ namespace http {
 // successful fetch is performed (ie. no network related trouble happend),
 // or until the retry count goes to zero.
 //
+// For each server we keep a pool of keep-alive connections (see
+// PoolParams): a request goes to the connection w/ the fewest outstanding
+// requests (across all servers), and when all are busy we open a new one,
+// up to max_connections_per_host_. Connections idle for too long are
+// closed, and we keep min_connections_per_host_ warm (pre-connected).
+// By default the pool holds one connection per server.
+//
+// The server for a request is chosen by a BalancePolicy, and GET / HEAD
+// requests can be hedged (see HedgeParams): if the reply is late for
+// the path, a duplicate goes to another server, the first reply wins
+// and the connection of the other is closed (canceling it). We hedge only
+// requests alone on their connection, onto an idle one - requests that
+// joined the closed connection meanwhile are sent again, w/o counting it
+// as a failure or a retry.
+//
 // This is not thread-safe - all call should be (and are) synchronized
 // through the provided selector thread.
 //
@@ -61,6 +76,60 @@ namespace http {
 //
 class FailSafeClient {
  public:
+  enum BalancePolicy {
+    // The connection w/ the fewest outstanding requests, of all servers
+    BALANCE_LEAST_OUTSTANDING,
+    // Power of two choices: of two random servers, the one w/ the lower
+    // (decaying) EWMA latency times outstanding requests
+    BALANCE_P2C_EWMA,
+    // Consistent hashing of ClientRequest::balance_key() on a ring of
+    // servers - w/ the next server on the ring for unavailable ones
+    BALANCE_CONSISTENT_HASH,
+  };
+  static const char* BalancePolicyName(BalancePolicy policy);
+
+  struct PoolParams {
+    PoolParams();
+    // We keep open (and pre-connect) at least these many connections
+    // to each server
+    int32 min_connections_per_host_;
+    // We open at most these many connections to each server
+    int32 max_connections_per_host_;
+    // Connections over min_connections_per_host_ w/o requests for this
+    // long are closed (0 => never)
+    int64 idle_timeout_ms_;
+  };
+  // Connection pool metrics
+  struct PoolStats {
+    int32 open_connections_;       // connections we have now ..
+    int32 busy_connections_;       // .. of which w/ requests
+    int64 outstanding_requests_;   // requests sent on our connections
+    int64 pending_requests_;       // requests waiting for a connection
+    int64 connections_opened_;     // since start
+    int64 connections_reaped_;     // closed by us for being idle
+    int64 connections_failed_;     // died w/o a successful request
+    int64 requests_sent_;          // includes retries
+    int64 requests_queued_;        // times a request found no free connection
+    int64 requests_hedged_;        // duplicates sent to a second server
+    int64 hedges_won_;             // .. that replied first
+    int64 losers_canceled_;        // requests canceled, as the other won
+    std::string ToString() const;
+  };
+  struct HedgeParams {
+    HedgeParams();
+    // Hedge GET / HEAD requests ?
+    bool enabled_;
+    // We hedge requests w/o a reply after this percentile of the latency
+    // of the path (the latest kLatencyWindowSize replies)
+    double percentile_;
+    // .. but never earlier than this
+    int32 min_delay_ms_;
+    // We hedge requests for a path only after these many replies for it
+    int32 min_samples_;
+    // Hedge at most this percent of the requests
+    int32 max_hedge_percent_;
+  };
+
   FailSafeClient(
       net::Selector* selector,
       const ClientParams* client_params,
@@ -101,7 +170,30 @@ class FailSafeClient {
   net::Selector* selector() const {
     return selector_;
   }
-  void Reset() const;
+  const PoolParams& pool_params() const {
+    return pool_params_;
+  }
+  // Sets the connection pool parameters - call this before starting
+  // any request.
+  void SetPoolParams(const PoolParams& pool_params);
+
+  // Returns the connection pool metrics - call from the selector thread.
+  void GetPoolStats(PoolStats* stats) const;
+
+  // Sets how we choose servers / hedge requests - call these before
+  // starting any request.
+  void SetBalancePolicy(BalancePolicy policy) {
+    balance_policy_ = policy;
+  }
+  BalancePolicy balance_policy() const {
+    return balance_policy_;
+  }
+  void SetHedgeParams(const HedgeParams& hedge_params) {
+    hedge_params_ = hedge_params;
+  }
+  const HedgeParams& hedge_params() const {
+    return hedge_params_;
+  }
 
 
   void StartRequest(ClientRequest* request,
@@ -142,6 +234,7 @@ private:
   void WriteStatusLog() const;
   void StatusString(std::string* s) const;
 
+  struct Hedge;
   struct PendingStruct {
     int64 start_time_;
     int retries_left_;
@@ -149,6 +242,20 @@ private:
     Closure* completion_closure_;
     bool canceled_;
     bool urgent_;
+    // Where we sent the request last, and when (usec)
+    int server_;
+    int64 client_id_;
+    int64 sent_us_;
+    // Fires the hedge of the request
+    Closure* hedge_alarm_;
+    // The hedge in flight
+    Hedge* hedge_;
+    // We hedge only once
+    bool hedged_;
+    // The request failed but the hedge is still in flight
+    bool primary_failed_;
+    // The hedge won - we are closing the connection of the request
+    bool hedge_won_;
     PendingStruct(int64 start_time, int retries_left,
                   ClientRequest* req, Closure* completion_closure,
                   bool urgent)
@@ -157,19 +264,104 @@ private:
           req_(req),
           completion_closure_(completion_closure),
           canceled_(false),
-          urgent_(urgent) {
+          urgent_(urgent),
+          server_(-1),
+          client_id_(-1),
+          sent_us_(0),
+          hedge_alarm_(NULL),
+          hedge_(NULL),
+          hedged_(false),
+          primary_failed_(false),
+          hedge_won_(false) {
     }
     std::string ToString(int64 crt_time) const;
   };
+  // A duplicate of a request, sent to another server
+  struct Hedge {
+    PendingStruct* ps_;    // NULL when the original won
+    ClientRequest req_;
+    int server_;
+    int64 client_id_;
+    int64 sent_us_;
+  };
+  // The latest latencies for a path
+  struct LatencyWindow;
+
+  // A connection in the pool of a server
+  struct PooledClient {
+    ClientProtocol* client_;
+    int64 id_;
+    int64 last_used_ms_;   // when we last sent / completed a request
+    int64 num_ok_;         // requests completed successfully
+    bool failed_;          // a request on it failed
+    size_t load() const {
+      return client_->num_active_requests() + client_->num_waiting_requests();
+    }
+  };
+  struct HostPool {
+    std::vector<PooledClient> clients_;
+    // When we last lost a connection to this server in error (0 - never)
+    int64 death_time_;
+    // EWMA of the reply latency (usec), and when we last updated it (ms)
+    double latency_us_;
+    int64 latency_time_ms_;
+    HostPool() : death_time_(0), latency_us_(0), latency_time_ms_(0) {}
+  };
 
   void RequeuePendingAlarm();
   void RequeuePending();
   bool InternalStartRequest(PendingStruct* ps);
-  void CompletionCallback(PendingStruct* ps, int client_id);
+  void CompletionCallback(PendingStruct* ps, int server, int64 client_id);
+  // Returns the index of the given connection in pools_[server], or -1
+  int FindClient(int server, int64 client_id) const;
+  // Opens a new connection to the given server, returns its index
+  size_t OpenClient(int server);
+  // If we can open a new connection to the given server
+  bool CanOpenClient(int server, int64 now) const;
+  // Removes the dead connections of the given server from its pool
+  void RemoveDeadClients(int server);
+  // Reaps idle connections and pre-connects to min_connections_per_host_
+  void MaintainPools();
+  // Closes a connection of ours, canceling its requests
+  void CancelClient(int server, int64 client_id);
+
+  // Chooses the server and connection for a request (not to exclude
+  // server), opening one if needed. Returns false if none available.
+  bool PickClient(ClientRequest* req, int64 now, int exclude,
+                  int* server, size_t* ndx, size_t* load);
+  // The least loaded connection of the server (a new one if all busy and
+  // we can open one), false if none.
+  bool PickServerClient(int server, int64 now, size_t* ndx, size_t* load);
+  // If a request can go to the server now
+  bool IsServerAvailable(int server, int64 now) const;
+  // If a request can be sent on a connection w/ this load
+  bool CanSendWithLoad(size_t load) const;
+  // The EWMA latency of the server, decayed w/ the time since the last
+  // update (so we retry slow servers)
+  double ServerLatency(int server, int64 now) const;
+  void RecordLatency(int server, ClientRequest* req, int64 latency_us);
+  void RecordFailure(int server);
+  // Updates the state of a connection after a request completed on it
+  void UpdateClient(int server, int64 client_id, bool ok, int64 now);
+
+  void HedgeAlarm(PendingStruct* ps);
+  void HedgeCompletionCallback(Hedge* hedge);
+  // The original request won - cancels its hedge
+  void CancelHedge(PendingStruct* ps);
+  // Completes w/ the reply in ps->req_
+  void CompleteRequest(PendingStruct* ps, int64 now);
+  // Sends ps again (or fails it, if out of retries)
+  void RetryRequest(PendingStruct* ps, int64 now);
   void DeleteCanceledPendingStruct(PendingStruct* ps);
   void CompleteWithError(PendingStruct* ps, http::ClientError error);
 
   static const int64 kRequeuePendingAlarmMs = 1000;
+  // Points on the hash ring, for each server
+  static const int kNumVirtualNodes = 64;
+  // How many latencies we keep for a path
+  static const size_t kLatencyWindowSize = 128;
+  // How many paths we keep latencies for (the others share one window)
+  static const size_t kMaxLatencyPaths = 1024;
 
   net::Selector* const selector_;
   const ClientParams* client_params_;
@@ -181,8 +373,18 @@ private:
   const int64 reopen_connection_interval_ms_;
   const std::string force_host_header_;
 
-  std::vector<ClientProtocol*> clients_;
-  std::vector<int64> death_time_;
+  PoolParams pool_params_;
+  std::vector<HostPool> pools_;
+  int64 next_client_id_;
+  PoolStats stats_;
+
+  BalancePolicy balance_policy_;
+  HedgeParams hedge_params_;
+  // The hash ring: (hash, server index), sorted
+  std::vector< std::pair<uint32, int> > ring_;
+  typedef hash_map<std::string, LatencyWindow*> LatencyMap;
+  LatencyMap path_latency_;
+  unsigned int rand_seed_;
 
   typedef std::deque<PendingStruct*> PendingQueue;
   PendingQueue* pending_requests_;
@@ -192,6 +394,8 @@ private:
   std::deque< std::pair<int64, std::string> > completion_events_;
 
   bool closing_;
+  // Set while CancelClient closes a connection - its requests did not fail
+  bool canceling_client_;
   Closure* requeue_pending_callback_;
 };
 }  // namespace http
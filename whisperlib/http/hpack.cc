@@ -0,0 +1,531 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include "whisperlib/http/hpack.h"
+#include "whisperlib/base/log.h"
+
+namespace whisper {
+namespace http {
+namespace hpack {
+
+namespace {
+// RFC 7541, Appendix A
+const Field kStaticTable[kNumStaticEntries] = {
+  Field(":authority", ""),
+  Field(":method", "GET"),
+  Field(":method", "POST"),
+  Field(":path", "/"),
+  Field(":path", "/index.html"),
+  Field(":scheme", "http"),
+  Field(":scheme", "https"),
+  Field(":status", "200"),
+  Field(":status", "204"),
+  Field(":status", "206"),
+  Field(":status", "304"),
+  Field(":status", "400"),
+  Field(":status", "404"),
+  Field(":status", "500"),
+  Field("accept-charset", ""),
+  Field("accept-encoding", "gzip, deflate"),
+  Field("accept-language", ""),
+  Field("accept-ranges", ""),
+  Field("accept", ""),
+  Field("access-control-allow-origin", ""),
+  Field("age", ""),
+  Field("allow", ""),
+  Field("authorization", ""),
+  Field("cache-control", ""),
+  Field("content-disposition", ""),
+  Field("content-encoding", ""),
+  Field("content-language", ""),
+  Field("content-length", ""),
+  Field("content-location", ""),
+  Field("content-range", ""),
+  Field("content-type", ""),
+  Field("cookie", ""),
+  Field("date", ""),
+  Field("etag", ""),
+  Field("expect", ""),
+  Field("expires", ""),
+  Field("from", ""),
+  Field("host", ""),
+  Field("if-match", ""),
+  Field("if-modified-since", ""),
+  Field("if-none-match", ""),
+  Field("if-range", ""),
+  Field("if-unmodified-since", ""),
+  Field("last-modified", ""),
+  Field("link", ""),
+  Field("location", ""),
+  Field("max-forwards", ""),
+  Field("proxy-authenticate", ""),
+  Field("proxy-authorization", ""),
+  Field("range", ""),
+  Field("referer", ""),
+  Field("refresh", ""),
+  Field("retry-after", ""),
+  Field("server", ""),
+  Field("set-cookie", ""),
+  Field("strict-transport-security", ""),
+  Field("transfer-encoding", ""),
+  Field("user-agent", ""),
+  Field("vary", ""),
+  Field("via", ""),
+  Field("www-authenticate", ""),
+};
+
+// RFC 7541, Appendix B - for each symbol (and EOS at 256) the code,
+// aligned to the lsb, and its length in bits
+struct HuffmanCode {
+  uint32 code_;
+  uint8 bits_;
+};
+const HuffmanCode kHuffmanCodes[257] = {
+  { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 }, { 0x1ff9, 13 },
+  { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 }, { 0x3fa, 10 }, { 0x3fb, 10 },
+  { 0xf9, 8 }, { 0x7fb, 11 }, { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 },
+  { 0x18, 6 }, { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 }, { 0x1a, 6 },
+  { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 }, { 0x1e, 6 }, { 0x1f, 6 },
+  { 0x5c, 7 }, { 0xfb, 8 }, { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 },
+  { 0x3fc, 10 }, { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 }, { 0x63, 7 },
+  { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 }, { 0x67, 7 }, { 0x68, 7 },
+  { 0x69, 7 }, { 0x6a, 7 }, { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 },
+  { 0x6e, 7 }, { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 }, { 0x7fff0, 19 },
+  { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 }, { 0x7ffd, 15 }, { 0x3, 5 },
+  { 0x23, 6 }, { 0x4, 5 }, { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 }, { 0x28, 6 }, { 0x29, 6 },
+  { 0x2a, 6 }, { 0x7, 5 }, { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 }, { 0x79, 7 }, { 0x7a, 7 },
+  { 0x7b, 7 }, { 0x7ffe, 15 }, { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 },
+  { 0xffffffc, 28 }, { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 },
+  { 0xfffe8, 20 }, { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 },
+  { 0x7fffd9, 23 }, { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 },
+  { 0x7fffdc, 23 }, { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 },
+  { 0x7fffdf, 23 }, { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 },
+  { 0x7fffe0, 23 }, { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 },
+  { 0x7fffe3, 23 }, { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 },
+  { 0x7fffe5, 23 }, { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 },
+  { 0xffffef, 24 }, { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 },
+  { 0x3fffdb, 22 }, { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 },
+  { 0x1fffde, 21 }, { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 },
+  { 0xfffff0, 24 }, { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 },
+  { 0x7fffec, 23 }, { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 },
+  { 0x1fffe2, 21 }, { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 },
+  { 0x7fffef, 23 }, { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 },
+  { 0x3fffe4, 22 }, { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 },
+  { 0x7ffff1, 23 }, { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 },
+  { 0x7fff1, 19 }, { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 },
+  { 0x1ffffec, 25 }, { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 },
+  { 0x7ffffde, 27 }, { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 },
+  { 0x1ffffed, 25 }, { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 },
+  { 0x7ffffe0, 27 }, { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 },
+  { 0xfffff2, 24 }, { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 },
+  { 0x3ffffe9, 26 }, { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 },
+  { 0x7ffffe5, 27 }, { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 },
+  { 0x1fffe6, 21 }, { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 },
+  { 0x7ffff3, 23 }, { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 },
+  { 0x1ffffef, 25 }, { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 },
+  { 0x7ffff4, 23 }, { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 },
+  { 0x3ffffed, 26 }, { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 },
+  { 0x7ffffea, 27 }, { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 },
+  { 0x7ffffed, 27 }, { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 },
+  { 0x3ffffee, 26 }, { 0x3fffffff, 30 }
+};
+const int kEos = 256;
+
+// Binary tree for decoding: node i has the children at next_[i][bit].
+// A negative child is a leaf with symbol (-child - 1). Node 0 is the root.
+class HuffmanTree {
+ public:
+  HuffmanTree() : num_nodes_(1) {
+    next_[0][0] = next_[0][1] = 0;
+    for ( int sym = 0; sym <= kEos; ++sym ) {
+      const HuffmanCode& c = kHuffmanCodes[sym];
+      int node = 0;
+      for ( int i = c.bits_ - 1; i > 0; --i ) {
+        const int bit = (c.code_ >> i) & 1;
+        if ( next_[node][bit] == 0 ) {
+          next_[num_nodes_][0] = next_[num_nodes_][1] = 0;
+          next_[node][bit] = num_nodes_++;
+        }
+        node = next_[node][bit];
+      }
+      next_[node][c.code_ & 1] = -sym - 1;
+    }
+    CHECK_EQ(num_nodes_, kEos);   // a full binary tree w/ 257 leaves
+  }
+  int16 next(int node, int bit) const { return next_[node][bit]; }
+
+ private:
+  int16 next_[kEos][2];
+  int num_nodes_;
+};
+
+const HuffmanTree& GetHuffmanTree() {
+  static const HuffmanTree tree;
+  return tree;
+}
+}  // namespace
+
+//////////////////////////////////////////////////////////////////////
+
+Table::Table(size_t max_size)
+    : size_(0),
+      max_size_(max_size) {
+}
+
+const Field* Table::Get(size_t index) const {
+  if ( index == 0 ) {
+    return NULL;
+  }
+  if ( index <= kNumStaticEntries ) {
+    return &kStaticTable[index - 1];
+  }
+  index -= kNumStaticEntries + 1;
+  if ( index >= entries_.size() ) {
+    return NULL;
+  }
+  return &entries_[index];
+}
+
+size_t Table::Find(const std::string& name, const std::string& value,
+                   size_t* name_index) const {
+  *name_index = 0;
+  for ( size_t i = 0; i < kNumStaticEntries; ++i ) {
+    if ( kStaticTable[i].first == name ) {
+      if ( kStaticTable[i].second == value ) {
+        return i + 1;
+      }
+      if ( *name_index == 0 ) {
+        *name_index = i + 1;
+      }
+    }
+  }
+  for ( size_t i = 0; i < entries_.size(); ++i ) {
+    if ( entries_[i].first == name ) {
+      if ( entries_[i].second == value ) {
+        return kNumStaticEntries + i + 1;
+      }
+      if ( *name_index == 0 ) {
+        *name_index = kNumStaticEntries + i + 1;
+      }
+    }
+  }
+  return 0;
+}
+
+void Table::Add(const std::string& name, const std::string& value) {
+  const size_t entry_size = name.size() + value.size() + kEntryOverhead;
+  if ( entry_size > max_size_ ) {
+    Evict(0);
+    return;
+  }
+  Evict(max_size_ - entry_size);
+  entries_.push_front(Field(name, value));
+  size_ += entry_size;
+}
+
+void Table::set_max_size(size_t max_size) {
+  max_size_ = max_size;
+  Evict(max_size_);
+}
+
+void Table::Evict(size_t max_size) {
+  while ( size_ > max_size ) {
+    const Field& f = entries_.back();
+    size_ -= f.first.size() + f.second.size() + kEntryOverhead;
+    entries_.pop_back();
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void EncodeInteger(uint32 value, int prefix_bits, uint8 first_byte,
+                   std::string* out) {
+  const uint32 max_prefix = (1 << prefix_bits) - 1;
+  if ( value < max_prefix ) {
+    out->push_back(static_cast<char>(first_byte | value));
+    return;
+  }
+  out->push_back(static_cast<char>(first_byte | max_prefix));
+  value -= max_prefix;
+  while ( value >= 0x80 ) {
+    out->push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+bool DecodeInteger(const uint8** p, const uint8* end, int prefix_bits,
+                   uint32* value) {
+  if ( *p >= end ) {
+    return false;
+  }
+  const uint32 max_prefix = (1 << prefix_bits) - 1;
+  uint32 v = *(*p)++ & max_prefix;
+  if ( v < max_prefix ) {
+    *value = v;
+    return true;
+  }
+  for ( int shift = 0; *p < end; shift += 7 ) {
+    const uint8 b = *(*p)++;
+    // more than 28 bits of continuation are never valid for us
+    if ( shift > 21 ) {
+      return false;
+    }
+    v += static_cast<uint32>(b & 0x7f) << shift;
+    if ( (b & 0x80) == 0 ) {
+      *value = v;
+      return true;
+    }
+  }
+  return false;
+}
+
+void HuffmanEncode(const char* s, size_t size, std::string* out) {
+  uint64 bits = 0;
+  int num_bits = 0;
+  for ( size_t i = 0; i < size; ++i ) {
+    const HuffmanCode& c = kHuffmanCodes[static_cast<uint8>(s[i])];
+    bits = (bits << c.bits_) | c.code_;
+    num_bits += c.bits_;
+    while ( num_bits >= 8 ) {
+      num_bits -= 8;
+      out->push_back(static_cast<char>(bits >> num_bits));
+    }
+  }
+  if ( num_bits > 0 ) {
+    // pad w/ the msb of EOS (i.e. ones)
+    out->push_back(static_cast<char>(
+        (bits << (8 - num_bits)) | (0xff >> num_bits)));
+  }
+}
+
+size_t HuffmanEncodedSize(const char* s, size_t size) {
+  size_t num_bits = 0;
+  for ( size_t i = 0; i < size; ++i ) {
+    num_bits += kHuffmanCodes[static_cast<uint8>(s[i])].bits_;
+  }
+  return (num_bits + 7) / 8;
+}
+
+bool HuffmanDecode(const char* s, size_t size, std::string* out) {
+  const HuffmanTree& tree = GetHuffmanTree();
+  int node = 0;
+  // bits since the last symbol, and whether they were all ones
+  int pending_bits = 0;
+  bool all_ones = true;
+  for ( size_t i = 0; i < size; ++i ) {
+    const uint8 b = static_cast<uint8>(s[i]);
+    for ( int j = 7; j >= 0; --j ) {
+      const int bit = (b >> j) & 1;
+      const int16 next = tree.next(node, bit);
+      if ( next < 0 ) {
+        if ( next == -kEos - 1 ) {
+          return false;
+        }
+        out->push_back(static_cast<char>(-next - 1));
+        node = 0;
+        pending_bits = 0;
+        all_ones = true;
+      } else {
+        node = next;
+        ++pending_bits;
+        all_ones = all_ones && bit;
+      }
+    }
+  }
+  // padding: at most 7 bits of the EOS prefix
+  return pending_bits <= 7 && all_ones;
+}
+
+void EncodeString(const std::string& s, std::string* out) {
+  const size_t huffman_size = HuffmanEncodedSize(s.data(), s.size());
+  if ( huffman_size < s.size() ) {
+    EncodeInteger(huffman_size, 7, 0x80, out);
+    HuffmanEncode(s.data(), s.size(), out);
+  } else {
+    EncodeInteger(s.size(), 7, 0x00, out);
+    out->append(s);
+  }
+}
+
+bool DecodeString(const uint8** p, const uint8* end, size_t max_size,
+                  std::string* out) {
+  if ( *p >= end ) {
+    return false;
+  }
+  const bool is_huffman = (**p & 0x80) != 0;
+  uint32 len;
+  if ( !DecodeInteger(p, end, 7, &len) || len > end - *p ) {
+    return false;
+  }
+  if ( !is_huffman && len > max_size ) {
+    return false;
+  }
+  const char* s = reinterpret_cast<const char*>(*p);
+  *p += len;
+  out->clear();
+  if ( !is_huffman ) {
+    out->assign(s, len);
+    return true;
+  }
+  return HuffmanDecode(s, len, out) && out->size() <= max_size;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+Decoder::Decoder(size_t max_table_size)
+    : table_(max_table_size),
+      max_table_size_(max_table_size) {
+}
+
+bool Decoder::Decode(const char* data, size_t size, size_t max_fields_size,
+                     Fields* fields) {
+  const uint8* p = reinterpret_cast<const uint8*>(data);
+  const uint8* const end = p + size;
+  size_t fields_size = 0;
+  bool at_start = true;
+  while ( p < end ) {
+    const uint8 b = *p;
+    uint32 index;
+    if ( b & 0x80 ) {
+      // Indexed
+      if ( !DecodeInteger(&p, end, 7, &index) ) {
+        return false;
+      }
+      const Field* f = table_.Get(index);
+      if ( f == NULL ) {
+        return false;
+      }
+      fields->push_back(*f);
+    } else if ( (b & 0xe0) == 0x20 ) {
+      // Dynamic table size update - only at the start of a block
+      if ( !DecodeInteger(&p, end, 5, &index) ) {
+        return false;
+      }
+      if ( !at_start || index > max_table_size_ ) {
+        return false;
+      }
+      table_.set_max_size(index);
+      continue;
+    } else {
+      // Literal - w/ incremental indexing (01), or w/o (0000 / 0001)
+      const bool do_index = (b & 0x40) != 0;
+      if ( !DecodeInteger(&p, end, do_index ? 6 : 4, &index) ) {
+        return false;
+      }
+      Field f;
+      if ( index > 0 ) {
+        const Field* name = table_.Get(index);
+        if ( name == NULL ) {
+          return false;
+        }
+        f.first = name->first;
+      } else if ( !DecodeString(&p, end, max_fields_size, &f.first) ) {
+        return false;
+      }
+      if ( !DecodeString(&p, end, max_fields_size, &f.second) ) {
+        return false;
+      }
+      if ( do_index ) {
+        table_.Add(f.first, f.second);
+      }
+      fields->push_back(f);
+    }
+    at_start = false;
+    fields_size += (fields->back().first.size() +
+                    fields->back().second.size() + kEntryOverhead);
+    if ( fields_size > max_fields_size ) {
+      return false;
+    }
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+Encoder::Encoder(size_t max_table_size)
+    : table_(std::min(max_table_size, kDefaultTableSize)),
+      size_update_pending_(false) {
+}
+
+void Encoder::set_max_table_size(size_t max_table_size) {
+  max_table_size = std::min(max_table_size, kDefaultTableSize);
+  if ( max_table_size != table_.max_size() ) {
+    table_.set_max_size(max_table_size);
+    size_update_pending_ = true;
+  }
+}
+
+void Encoder::Encode(const Fields& fields, std::string* out) {
+  if ( size_update_pending_ ) {
+    EncodeInteger(table_.max_size(), 5, 0x20, out);
+    size_update_pending_ = false;
+  }
+  for ( Fields::const_iterator it = fields.begin();
+        it != fields.end(); ++it ) {
+    size_t name_index;
+    const size_t index = table_.Find(it->first, it->second, &name_index);
+    if ( index > 0 ) {
+      EncodeInteger(index, 7, 0x80, out);
+      continue;
+    }
+    // Entries that would wipe out the table go w/o indexing
+    const bool do_index = (it->first.size() + it->second.size() +
+                           kEntryOverhead) <= table_.max_size() / 2;
+    if ( do_index ) {
+      EncodeInteger(name_index, 6, 0x40, out);
+    } else {
+      EncodeInteger(name_index, 4, 0x00, out);
+    }
+    if ( name_index == 0 ) {
+      EncodeString(it->first, out);
+    }
+    EncodeString(it->second, out);
+    if ( do_index ) {
+      table_.Add(it->first, it->second);
+    }
+  }
+}
+
+}  // namespace hpack
+}  // namespace http
+}  // namespace whisper
@@ -0,0 +1,170 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// HPACK - the header compression of HTTP/2 (RFC 7541): the static and
+// dynamic tables, the integer / string (w/ Huffman) primitives, and a
+// decoder / encoder for header blocks.
+//
+// A decoder and an encoder keep state (the dynamic table) for the whole
+// connection, so all the header blocks in a direction go through the same
+// one, in order.
+//
+#ifndef __WHISPERLIB_HTTP_HPACK_H__
+#define __WHISPERLIB_HTTP_HPACK_H__
+
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+#include "whisperlib/base/types.h"
+
+namespace whisper {
+namespace http {
+namespace hpack {
+
+// Header fields, in order (names in lower case, as HTTP/2 wants them)
+typedef std::pair<std::string, std::string> Field;
+typedef std::vector<Field> Fields;
+
+// Default size of the dynamic table (SETTINGS_HEADER_TABLE_SIZE)
+static const size_t kDefaultTableSize = 4096;
+// Entries in the static table
+static const size_t kNumStaticEntries = 61;
+// What an entry counts in the size of the dynamic table, beside the
+// name and value
+static const size_t kEntryOverhead = 32;
+
+// The static table followed by the dynamic one, indexed from 1.
+class Table {
+ public:
+  explicit Table(size_t max_size = kDefaultTableSize);
+
+  // Returns the entry at index (NULL if no such index)
+  const Field* Get(size_t index) const;
+  // Returns the index of the entry w/ this name and value, or 0 if none.
+  // In *name_index we return the index of an entry w/ this name, or 0.
+  size_t Find(const std::string& name, const std::string& value,
+              size_t* name_index) const;
+  // Adds an entry in the dynamic table, evicting the old ones to make
+  // room (an entry larger than the table just empties it)
+  void Add(const std::string& name, const std::string& value);
+  // Changes the size of the dynamic table (evicting what does not fit)
+  void set_max_size(size_t max_size);
+
+  size_t size() const { return size_; }
+  size_t max_size() const { return max_size_; }
+  size_t num_entries() const { return entries_.size(); }
+
+ private:
+  void Evict(size_t max_size);
+
+  // The dynamic table - newest entries first
+  std::deque<Field> entries_;
+  // Sum of name + value + kEntryOverhead of the entries
+  size_t size_;
+  size_t max_size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Table);
+};
+
+// Appends value w/ an N bit prefix; first_byte has the bits before the
+// prefix set.
+void EncodeInteger(uint32 value, int prefix_bits, uint8 first_byte,
+                   std::string* out);
+// Decodes an integer w/ an N bit prefix from [*p, end), advancing *p.
+// Returns false on truncated data or overflow.
+bool DecodeInteger(const uint8** p, const uint8* end, int prefix_bits,
+                   uint32* value);
+
+// Appends the Huffman coding of s
+void HuffmanEncode(const char* s, size_t size, std::string* out);
+// How many bytes would the Huffman coding of s take
+size_t HuffmanEncodedSize(const char* s, size_t size);
+// Appends the decoding of the Huffman coded s. Returns false on bad
+// coding (EOS in the data, or bad padding).
+bool HuffmanDecode(const char* s, size_t size, std::string* out);
+
+// Appends a string literal (Huffman coded, if shorter)
+void EncodeString(const std::string& s, std::string* out);
+// Decodes a string literal from [*p, end), advancing *p. Returns false
+// on bad data, or if the string is longer than max_size.
+bool DecodeString(const uint8** p, const uint8* end, size_t max_size,
+                  std::string* out);
+
+class Decoder {
+ public:
+  explicit Decoder(size_t max_table_size = kDefaultTableSize);
+
+  // Decodes a full header block (i.e. the HEADERS + CONTINUATION
+  // fragments put together), appending the fields. Returns false on a
+  // decoding error - after which the decoder is unusable (the connection
+  // has to be closed w/ a COMPRESSION_ERROR). Fails also if the decoded
+  // fields go over max_fields_size (names + values + kEntryOverhead each).
+  bool Decode(const char* data, size_t size, size_t max_fields_size,
+              Fields* fields);
+
+  // The largest table size we allow the encoder on the other side to use
+  // (what we announce in SETTINGS_HEADER_TABLE_SIZE)
+  void set_max_table_size(size_t max_table_size) {
+    max_table_size_ = max_table_size;
+  }
+  const Table& table() const { return table_; }
+
+ private:
+  Table table_;
+  size_t max_table_size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Decoder);
+};
+
+class Encoder {
+ public:
+  explicit Encoder(size_t max_table_size = kDefaultTableSize);
+
+  // Appends the header block coding fields
+  void Encode(const Fields& fields, std::string* out);
+
+  // The decoder on the other side allows this table size (from its
+  // SETTINGS_HEADER_TABLE_SIZE). We use at most kDefaultTableSize.
+  void set_max_table_size(size_t max_table_size);
+  const Table& table() const { return table_; }
+
+ private:
+  Table table_;
+  // We need to signal a table size change at the start of the next block
+  bool size_update_pending_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Encoder);
+};
+
+}  // namespace hpack
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_HPACK_H__
@@ -0,0 +1,184 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <algorithm>
+#include "whisperlib/http/http2_frames.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/strutil.h"
+
+namespace whisper {
+namespace http {
+namespace http2 {
+
+const char* FrameTypeName(uint8 type) {
+  switch ( type ) {
+    CONSIDER(FRAME_DATA);
+    CONSIDER(FRAME_HEADERS);
+    CONSIDER(FRAME_PRIORITY);
+    CONSIDER(FRAME_RST_STREAM);
+    CONSIDER(FRAME_SETTINGS);
+    CONSIDER(FRAME_PUSH_PROMISE);
+    CONSIDER(FRAME_PING);
+    CONSIDER(FRAME_GOAWAY);
+    CONSIDER(FRAME_WINDOW_UPDATE);
+    CONSIDER(FRAME_CONTINUATION);
+  }
+  return "FRAME_UNKNOWN";
+}
+
+const char* ErrorCodeName(uint32 code) {
+  switch ( code ) {
+    CONSIDER(ERROR_NONE);
+    CONSIDER(ERROR_PROTOCOL);
+    CONSIDER(ERROR_INTERNAL);
+    CONSIDER(ERROR_FLOW_CONTROL);
+    CONSIDER(ERROR_SETTINGS_TIMEOUT);
+    CONSIDER(ERROR_STREAM_CLOSED);
+    CONSIDER(ERROR_FRAME_SIZE);
+    CONSIDER(ERROR_REFUSED_STREAM);
+    CONSIDER(ERROR_CANCEL);
+    CONSIDER(ERROR_COMPRESSION);
+    CONSIDER(ERROR_CONNECT);
+    CONSIDER(ERROR_ENHANCE_YOUR_CALM);
+    CONSIDER(ERROR_INADEQUATE_SECURITY);
+    CONSIDER(ERROR_HTTP_1_1_REQUIRED);
+  }
+  return "ERROR_UNKNOWN";
+}
+
+std::string FrameHeader::ToString() const {
+  return strutil::StringPrintf("%s[stream: %u, flags: 0x%x, length: %u]",
+                               FrameTypeName(type_),
+                               static_cast<unsigned>(stream_id_),
+                               static_cast<unsigned>(flags_),
+                               static_cast<unsigned>(length_));
+}
+
+bool PeekFrameHeader(const io::MemoryStream& in, FrameHeader* header) {
+  char buf[kFrameHeaderSize];
+  if ( in.Peek(buf, sizeof(buf)) < sizeof(buf) ) {
+    return false;
+  }
+  header->length_ = DecodeUInt32(buf) >> 8;
+  header->type_ = static_cast<uint8>(buf[3]);
+  header->flags_ = static_cast<uint8>(buf[4]);
+  header->stream_id_ = DecodeUInt32(buf + 5) & 0x7fffffff;
+  return true;
+}
+
+namespace {
+inline void EncodeUInt32(uint32 value, char* p) {
+  p[0] = static_cast<char>(value >> 24);
+  p[1] = static_cast<char>(value >> 16);
+  p[2] = static_cast<char>(value >> 8);
+  p[3] = static_cast<char>(value);
+}
+}  // namespace
+
+void WriteFrameHeader(const FrameHeader& header, io::MemoryStream* out) {
+  DCHECK_LE(header.length_, kMaxMaxFrameSize);
+  char buf[kFrameHeaderSize];
+  EncodeUInt32(header.length_ << 8, buf);
+  buf[3] = static_cast<char>(header.type_);
+  buf[4] = static_cast<char>(header.flags_);
+  EncodeUInt32(header.stream_id_ & 0x7fffffff, buf + 5);
+  out->Write(buf, sizeof(buf));
+}
+
+void WriteFrame(uint8 type, uint8 flags, uint32 stream_id,
+                const char* payload, size_t size, io::MemoryStream* out) {
+  WriteFrameHeader(FrameHeader(size, type, flags, stream_id), out);
+  if ( size > 0 ) {
+    out->Write(payload, size);
+  }
+}
+
+void WriteSettings(const Settings& settings, io::MemoryStream* out) {
+  std::string payload;
+  for ( size_t i = 0; i < settings.size(); ++i ) {
+    char buf[6];
+    buf[0] = static_cast<char>(settings[i].first >> 8);
+    buf[1] = static_cast<char>(settings[i].first);
+    EncodeUInt32(settings[i].second, buf + 2);
+    payload.append(buf, sizeof(buf));
+  }
+  WriteFrame(FRAME_SETTINGS, 0, 0, payload.data(), payload.size(), out);
+}
+
+void WriteSettingsAck(io::MemoryStream* out) {
+  WriteFrame(FRAME_SETTINGS, FLAG_ACK, 0, NULL, 0, out);
+}
+
+void WritePing(const char* opaque_data, bool ack, io::MemoryStream* out) {
+  WriteFrame(FRAME_PING, ack ? FLAG_ACK : 0, 0, opaque_data, 8, out);
+}
+
+void WriteGoAway(uint32 last_stream_id, ErrorCode error,
+                 io::MemoryStream* out) {
+  char buf[8];
+  EncodeUInt32(last_stream_id & 0x7fffffff, buf);
+  EncodeUInt32(error, buf + 4);
+  WriteFrame(FRAME_GOAWAY, 0, 0, buf, sizeof(buf), out);
+}
+
+void WriteRstStream(uint32 stream_id, ErrorCode error,
+                    io::MemoryStream* out) {
+  char buf[4];
+  EncodeUInt32(error, buf);
+  WriteFrame(FRAME_RST_STREAM, 0, stream_id, buf, sizeof(buf), out);
+}
+
+void WriteWindowUpdate(uint32 stream_id, uint32 increment,
+                       io::MemoryStream* out) {
+  DCHECK_GT(increment, 0U);
+  char buf[4];
+  EncodeUInt32(increment & 0x7fffffff, buf);
+  WriteFrame(FRAME_WINDOW_UPDATE, 0, stream_id, buf, sizeof(buf), out);
+}
+
+void WriteHeaders(uint32 stream_id, const std::string& block, bool end_stream,
+                  size_t max_frame_size, io::MemoryStream* out) {
+  size_t pos = 0;
+  uint8 type = FRAME_HEADERS;
+  uint8 flags = end_stream ? FLAG_END_STREAM : 0;
+  do {
+    const size_t size = std::min(max_frame_size, block.size() - pos);
+    if ( pos + size == block.size() ) {
+      flags |= FLAG_END_HEADERS;
+    }
+    WriteFrame(type, flags, stream_id, block.data() + pos, size, out);
+    pos += size;
+    type = FRAME_CONTINUATION;
+    flags = 0;
+  } while ( pos < block.size() );
+}
+
+}  // namespace http2
+}  // namespace http
+}  // namespace whisper
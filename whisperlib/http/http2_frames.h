@@ -0,0 +1,158 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// HTTP/2 framing (RFC 9113): the constants of the protocol, and helpers
+// for reading and writing frames from / to memory streams - used by
+// http::Http2ServerProtocol and by HTTP/2 clients.
+//
+#ifndef __WHISPERLIB_HTTP_HTTP2_FRAMES_H__
+#define __WHISPERLIB_HTTP_HTTP2_FRAMES_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "whisperlib/base/types.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+
+namespace whisper {
+namespace http {
+namespace http2 {
+
+// What a client sends first on a HTTP/2 connection
+static const char kConnectionPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+static const size_t kConnectionPrefaceSize = sizeof(kConnectionPreface) - 1;
+// The protocol id for ALPN (TLS) - "h2c" is for upgrades, which we do not do
+static const char kAlpnProtocolId[] = "h2";
+
+static const size_t kFrameHeaderSize = 9;
+// Protocol defaults - until the peer's settings tell otherwise
+static const uint32 kDefaultWindowSize = 65535;
+static const uint32 kDefaultMaxFrameSize = 16384;
+static const uint32 kMaxMaxFrameSize = (1 << 24) - 1;
+static const uint32 kMaxWindowSize = 0x7fffffff;
+static const uint32 kDefaultWeight = 16;
+
+enum FrameType {
+  FRAME_DATA = 0x0,
+  FRAME_HEADERS = 0x1,
+  FRAME_PRIORITY = 0x2,
+  FRAME_RST_STREAM = 0x3,
+  FRAME_SETTINGS = 0x4,
+  FRAME_PUSH_PROMISE = 0x5,
+  FRAME_PING = 0x6,
+  FRAME_GOAWAY = 0x7,
+  FRAME_WINDOW_UPDATE = 0x8,
+  FRAME_CONTINUATION = 0x9,
+};
+const char* FrameTypeName(uint8 type);
+
+enum FrameFlag {
+  FLAG_END_STREAM = 0x1,     // DATA, HEADERS
+  FLAG_ACK = 0x1,            // SETTINGS, PING
+  FLAG_END_HEADERS = 0x4,    // HEADERS, CONTINUATION
+  FLAG_PADDED = 0x8,         // DATA, HEADERS
+  FLAG_PRIORITY = 0x20,      // HEADERS
+};
+
+enum SettingId {
+  SETTINGS_HEADER_TABLE_SIZE = 0x1,
+  SETTINGS_ENABLE_PUSH = 0x2,
+  SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+  SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+  SETTINGS_MAX_FRAME_SIZE = 0x5,
+  SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+typedef std::vector< std::pair<uint16, uint32> > Settings;
+
+enum ErrorCode {
+  ERROR_NONE = 0x0,
+  ERROR_PROTOCOL = 0x1,
+  ERROR_INTERNAL = 0x2,
+  ERROR_FLOW_CONTROL = 0x3,
+  ERROR_SETTINGS_TIMEOUT = 0x4,
+  ERROR_STREAM_CLOSED = 0x5,
+  ERROR_FRAME_SIZE = 0x6,
+  ERROR_REFUSED_STREAM = 0x7,
+  ERROR_CANCEL = 0x8,
+  ERROR_COMPRESSION = 0x9,
+  ERROR_CONNECT = 0xa,
+  ERROR_ENHANCE_YOUR_CALM = 0xb,
+  ERROR_INADEQUATE_SECURITY = 0xc,
+  ERROR_HTTP_1_1_REQUIRED = 0xd,
+};
+const char* ErrorCodeName(uint32 code);
+
+struct FrameHeader {
+  uint32 length_;     // of the payload (24 bits)
+  uint8 type_;
+  uint8 flags_;
+  uint32 stream_id_;  // (31 bits)
+  FrameHeader() : length_(0), type_(0), flags_(0), stream_id_(0) {}
+  FrameHeader(uint32 length, uint8 type, uint8 flags, uint32 stream_id)
+      : length_(length), type_(type), flags_(flags), stream_id_(stream_id) {}
+  std::string ToString() const;
+};
+
+// Peeks a frame header from the start of in (w/o consuming it). Returns
+// false if there is not enough data.
+bool PeekFrameHeader(const io::MemoryStream& in, FrameHeader* header);
+
+// Big endian helpers
+inline uint32 DecodeUInt32(const char* p) {
+  const uint8* const b = reinterpret_cast<const uint8*>(p);
+  return (static_cast<uint32>(b[0]) << 24) | (static_cast<uint32>(b[1]) << 16) |
+         (static_cast<uint32>(b[2]) << 8) | b[3];
+}
+inline uint16 DecodeUInt16(const char* p) {
+  const uint8* const b = reinterpret_cast<const uint8*>(p);
+  return (static_cast<uint16>(b[0]) << 8) | b[1];
+}
+
+// Frame writers - each appends a full frame to out:
+void WriteFrameHeader(const FrameHeader& header, io::MemoryStream* out);
+void WriteFrame(uint8 type, uint8 flags, uint32 stream_id,
+                const char* payload, size_t size, io::MemoryStream* out);
+void WriteSettings(const Settings& settings, io::MemoryStream* out);
+void WriteSettingsAck(io::MemoryStream* out);
+void WritePing(const char* opaque_data, bool ack, io::MemoryStream* out);
+void WriteGoAway(uint32 last_stream_id, ErrorCode error,
+                 io::MemoryStream* out);
+void WriteRstStream(uint32 stream_id, ErrorCode error, io::MemoryStream* out);
+void WriteWindowUpdate(uint32 stream_id, uint32 increment,
+                       io::MemoryStream* out);
+// A header block (HPACK encoded), split in HEADERS + CONTINUATION frames
+// of at most max_frame_size.
+void WriteHeaders(uint32 stream_id, const std::string& block, bool end_stream,
+                  size_t max_frame_size, io::MemoryStream* out);
+
+}  // namespace http2
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_HTTP2_FRAMES_H__
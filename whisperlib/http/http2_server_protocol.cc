@@ -0,0 +1,1088 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include "whisperlib/http/http2_server_protocol.h"
+#include "whisperlib/base/strutil.h"
+
+#define LOG_HTTP LOG_INFO_IF(dlog_level_) << name() << ": [h2] "
+
+namespace whisper {
+namespace http {
+
+namespace {
+// We give back flow control credit when we consumed this much
+const uint32 kWindowUpdateThreshold = http2::kDefaultWindowSize / 2;
+
+// Fields that are about the connection - not allowed in HTTP/2
+bool IsConnectionSpecificField(const std::string& name) {
+  return (name == "connection" ||
+          name == "keep-alive" ||
+          name == "proxy-connection" ||
+          name == "transfer-encoding" ||
+          name == "upgrade");
+}
+}  // namespace
+
+Http2ServerProtocol::Http2ServerProtocol(ServerProtocol* protocol)
+    : protocol_(protocol),
+      dlog_level_(protocol->dlog_level()),
+      preface_received_(false),
+      goaway_sent_(false),
+      goaway_received_(false),
+      last_stream_id_(0),
+      header_stream_id_(0),
+      header_flags_(0),
+      peer_max_frame_size_(http2::kDefaultMaxFrameSize),
+      peer_initial_window_(http2::kDefaultWindowSize),
+      send_window_(http2::kDefaultWindowSize),
+      recv_window_(http2::kDefaultWindowSize),
+      recv_unacked_(0),
+      vtime_(0) {
+  // Our settings go first (no need to wait for the client preface)
+  const ServerParams& params = protocol_->protocol_params();
+  const size_t max_streams = std::max(
+      params.max_concurrent_requests_per_connection_, size_t(1));
+  http2::Settings settings;
+  settings.push_back(std::make_pair(
+      static_cast<uint16>(http2::SETTINGS_MAX_CONCURRENT_STREAMS),
+      static_cast<uint32>(max_streams)));
+  settings.push_back(std::make_pair(
+      static_cast<uint16>(http2::SETTINGS_MAX_HEADER_LIST_SIZE),
+      static_cast<uint32>(params.max_header_size_)));
+  http2::WriteSettings(settings, outbuf());
+  // A stream that holds its data does not block the others
+  const int64 connection_window = std::min(
+      static_cast<int64>(http2::kMaxWindowSize),
+      static_cast<int64>(max_streams) * http2::kDefaultWindowSize);
+  if ( connection_window > recv_window_ ) {
+    http2::WriteWindowUpdate(0, connection_window - recv_window_, outbuf());
+    recv_window_ = connection_window;
+  }
+  protocol_->connection_->NotifyWrite();
+}
+
+Http2ServerProtocol::~Http2ServerProtocol() {
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    delete it->second;
+  }
+}
+
+io::MemoryStream* Http2ServerProtocol::outbuf() {
+  return protocol_->connection_->outbuf();
+}
+
+ServerProtocol::ProcessMoreDataResult Http2ServerProtocol::ProcessMoreData() {
+  io::MemoryStream* const in = protocol_->connection_->inbuf();
+  if ( !preface_received_ ) {
+    if ( in->Size() < http2::kConnectionPrefaceSize ) {
+      return ServerProtocol::ProcessMoreDataResult_NEEDMORE;
+    }
+    std::string preface;
+    in->ReadString(&preface, http2::kConnectionPrefaceSize);
+    if ( preface != http2::kConnectionPreface ) {
+      LOG_HTTP << "Bad connection preface - closing";
+      return ServerProtocol::ProcessMoreDataResult_ERROR;
+    }
+    preface_received_ = true;
+  }
+  http2::FrameHeader fh;
+  while ( !protocol_->closed_ && http2::PeekFrameHeader(*in, &fh) ) {
+    // We never announced larger frames
+    if ( fh.length_ > http2::kDefaultMaxFrameSize ) {
+      ConnectionError(http2::ERROR_FRAME_SIZE, "frame too large");
+      break;
+    }
+    if ( in->Size() < http2::kFrameHeaderSize + fh.length_ ) {
+      break;
+    }
+    in->Skip(http2::kFrameHeaderSize);
+    if ( header_stream_id_ != 0 &&
+         (fh.type_ != http2::FRAME_CONTINUATION ||
+          fh.stream_id_ != header_stream_id_) ) {
+      ConnectionError(http2::ERROR_PROTOCOL, "expected CONTINUATION");
+      break;
+    }
+    if ( fh.type_ == http2::FRAME_DATA ) {
+      // The data goes straight from inbuf to the request
+      if ( !ProcessData(fh) ) {
+        break;
+      }
+      continue;
+    }
+    std::string payload;
+    in->ReadString(&payload, fh.length_);
+    if ( !ProcessFrame(fh, payload) ) {
+      break;
+    }
+  }
+  if ( protocol_->connection_ != NULL ) {
+    WriteData();
+    if ( !outbuf()->IsEmpty() ) {
+      protocol_->connection_->NotifyWrite();
+    }
+  }
+  return ServerProtocol::ProcessMoreDataResult_NEEDMORE;
+}
+
+bool Http2ServerProtocol::ProcessFrame(const http2::FrameHeader& fh,
+                                       const std::string& payload) {
+  switch ( fh.type_ ) {
+    case http2::FRAME_HEADERS:
+      return ProcessHeaders(fh, payload);
+    case http2::FRAME_CONTINUATION:
+      if ( header_stream_id_ == 0 ) {
+        return ConnectionError(http2::ERROR_PROTOCOL,
+                               "unexpected CONTINUATION");
+      }
+      header_block_.append(payload);
+      if ( header_block_.size() >
+           protocol_->protocol_params().max_header_size_ ) {
+        return ConnectionError(http2::ERROR_ENHANCE_YOUR_CALM,
+                               "header block too large");
+      }
+      if ( fh.flags_ & http2::FLAG_END_HEADERS ) {
+        const uint32 stream_id = header_stream_id_;
+        header_stream_id_ = 0;
+        return ProcessHeaderBlock(stream_id, header_flags_);
+      }
+      return true;
+    case http2::FRAME_PRIORITY: {
+      if ( fh.stream_id_ == 0 ) {
+        return ConnectionError(http2::ERROR_PROTOCOL, "PRIORITY on stream 0");
+      }
+      Stream* const stream = FindStream(fh.stream_id_);
+      if ( fh.length_ != 5 ) {
+        if ( stream != NULL ) {
+          ResetStream(stream, http2::ERROR_FRAME_SIZE);
+        }
+        return true;
+      }
+      if ( stream != NULL ) {
+        stream->weight_ = static_cast<uint8>(payload[4]) + 1;
+      }
+      return true;
+    }
+    case http2::FRAME_RST_STREAM: {
+      if ( fh.length_ != 4 ) {
+        return ConnectionError(http2::ERROR_FRAME_SIZE, "bad RST_STREAM");
+      }
+      if ( fh.stream_id_ == 0 || fh.stream_id_ > last_stream_id_ ) {
+        return ConnectionError(http2::ERROR_PROTOCOL,
+                               "RST_STREAM on an idle stream");
+      }
+      Stream* const stream = FindStream(fh.stream_id_);
+      if ( stream != NULL ) {
+        LOG_HTTP << "Stream " << fh.stream_id_ << " reset by client: "
+                 << http2::ErrorCodeName(http2::DecodeUInt32(payload.data()));
+        stream->local_closed_ = true;   // no RST_STREAM back
+        ResetStream(stream, http2::ERROR_NONE);
+      }
+      return true;
+    }
+    case http2::FRAME_SETTINGS:
+      return ProcessSettings(fh, payload);
+    case http2::FRAME_PUSH_PROMISE:
+      return ConnectionError(http2::ERROR_PROTOCOL, "PUSH_PROMISE from client");
+    case http2::FRAME_PING:
+      if ( fh.stream_id_ != 0 ) {
+        return ConnectionError(http2::ERROR_PROTOCOL, "PING on a stream");
+      }
+      if ( fh.length_ != 8 ) {
+        return ConnectionError(http2::ERROR_FRAME_SIZE, "bad PING");
+      }
+      if ( (fh.flags_ & http2::FLAG_ACK) == 0 ) {
+        http2::WritePing(payload.data(), true, outbuf());
+      }
+      return true;
+    case http2::FRAME_GOAWAY:
+      if ( fh.stream_id_ != 0 ) {
+        return ConnectionError(http2::ERROR_PROTOCOL, "GOAWAY on a stream");
+      }
+      LOG_HTTP << "Client going away";
+      goaway_received_ = true;
+      if ( protocol_->active_requests_.empty() ) {
+        // Nothing in progress - we are done
+        goaway_sent_ = true;
+        http2::WriteGoAway(last_stream_id_, http2::ERROR_NONE, outbuf());
+        protocol_->closed_ = true;
+        protocol_->connection_->FlushAndClose();
+        return false;
+      }
+      return true;
+    case http2::FRAME_WINDOW_UPDATE:
+      return ProcessWindowUpdate(fh, payload);
+  }
+  // Unknown frame types are to be ignored
+  return true;
+}
+
+bool Http2ServerProtocol::ProcessData(const http2::FrameHeader& fh) {
+  io::MemoryStream* const in = protocol_->connection_->inbuf();
+  if ( fh.stream_id_ == 0 ) {
+    return ConnectionError(http2::ERROR_PROTOCOL, "DATA on stream 0");
+  }
+  // The padding counts for flow control too
+  if ( fh.length_ > recv_window_ ) {
+    return ConnectionError(http2::ERROR_FLOW_CONTROL,
+                           "DATA over the connection window");
+  }
+  recv_window_ -= fh.length_;
+  size_t size = fh.length_;
+  size_t padding = 0;
+  if ( fh.flags_ & http2::FLAG_PADDED ) {
+    uint8 pad_length = 0;
+    if ( size == 0 || in->Read(&pad_length, 1) != 1 || pad_length >= size ) {
+      return ConnectionError(http2::ERROR_PROTOCOL, "bad DATA padding");
+    }
+    padding = pad_length;
+    size -= 1 + padding;
+  }
+  Stream* const stream = FindStream(fh.stream_id_);
+  if ( stream == NULL || stream->remote_closed_ ||
+       fh.length_ > stream->recv_window_ ) {
+    in->Skip(size + padding);
+    if ( fh.stream_id_ > last_stream_id_ ) {
+      return ConnectionError(http2::ERROR_PROTOCOL, "DATA on an idle stream");
+    }
+    CreditData(NULL, fh.length_);
+    if ( stream == NULL ) {
+      http2::WriteRstStream(fh.stream_id_, http2::ERROR_STREAM_CLOSED,
+                            outbuf());
+    } else if ( stream->remote_closed_ ) {
+      ResetStream(stream, http2::ERROR_STREAM_CLOSED);
+    } else {
+      LOG_HTTP << "Stream " << stream->id_ << " - DATA over the window";
+      ResetStream(stream, http2::ERROR_FLOW_CONTROL);
+    }
+    return true;
+  }
+  stream->recv_window_ -= fh.length_;
+  ServerRequest* const req = stream->req_;
+  if ( req == NULL || stream->discard_input_ ) {
+    in->Skip(size);
+  } else {
+    req->request()->client_data()->AppendStream(in, size);
+    req->request()->mutable_stats()->client_raw_size_ +=
+        http2::kFrameHeaderSize + fh.length_;
+    req->request()->mutable_stats()->client_size_ += size;
+  }
+  in->Skip(padding);
+  if ( fh.flags_ & http2::FLAG_END_STREAM ) {
+    stream->remote_closed_ = true;
+  }
+  if ( req == NULL || stream->discard_input_ ) {
+    CreditData(stream, fh.length_);
+    MaybeCloseStream(stream);
+    return true;
+  }
+  if ( req->is_client_streaming() ) {
+    // The processor gives back the credit, as it consumes the data
+    stream->recv_buffered_ += size;
+    CreditData(stream, fh.length_ - size);
+  } else {
+    // We buffer the whole body
+    CreditData(stream, fh.length_);
+  }
+  const ServerParams& params = protocol_->protocol_params();
+  if ( !req->is_client_streaming() &&
+       req->request()->client_data()->Size() > params.max_body_size_ ) {
+    LOG_HTTP << "Stream " << stream->id_ << " body too large";
+    stream->discard_input_ = true;
+    req->request()->client_data()->Clear();
+    req->request()->server_header()->set_status_code(REQUEST_ENTITY_TOO_LARGE);
+    DispatchRequest(stream);
+    return true;
+  }
+  if ( stream->remote_closed_ ) {
+    req->is_parsing_finished_ = true;
+  }
+  if ( req->is_client_streaming() && stream->paused_ ) {
+    stream->dispatch_pending_ = true;   // for when it resumes
+  } else if ( req->is_client_streaming() || stream->remote_closed_ ) {
+    DispatchRequest(stream);
+  }
+  return true;
+}
+
+void Http2ServerProtocol::CreditData(Stream* stream, uint32 size) {
+  recv_unacked_ += size;
+  if ( recv_unacked_ >= kWindowUpdateThreshold ) {
+    http2::WriteWindowUpdate(0, recv_unacked_, outbuf());
+    recv_window_ += recv_unacked_;
+    recv_unacked_ = 0;
+  }
+  if ( stream == NULL || stream->remote_closed_ ) {
+    return;
+  }
+  stream->recv_unacked_ += size;
+  if ( stream->recv_unacked_ >= kWindowUpdateThreshold ) {
+    http2::WriteWindowUpdate(stream->id_, stream->recv_unacked_, outbuf());
+    stream->recv_window_ += stream->recv_unacked_;
+    stream->recv_unacked_ = 0;
+  }
+}
+
+void Http2ServerProtocol::CreditConsumedData(Stream* stream) {
+  const size_t size = (stream->req_ == NULL ? 0 :
+                       stream->req_->request()->client_data()->Size());
+  if ( size < stream->recv_buffered_ ) {
+    CreditData(stream, stream->recv_buffered_ - size);
+    stream->recv_buffered_ = size;
+  }
+}
+
+bool Http2ServerProtocol::ProcessHeaders(const http2::FrameHeader& fh,
+                                         const std::string& payload) {
+  if ( fh.stream_id_ == 0 || (fh.stream_id_ & 1) == 0 ) {
+    return ConnectionError(http2::ERROR_PROTOCOL, "bad HEADERS stream id");
+  }
+  size_t begin = 0;
+  size_t end = payload.size();
+  if ( fh.flags_ & http2::FLAG_PADDED ) {
+    if ( payload.empty() ||
+         static_cast<uint8>(payload[0]) >= payload.size() ) {
+      return ConnectionError(http2::ERROR_PROTOCOL, "bad HEADERS padding");
+    }
+    begin = 1;
+    end -= static_cast<uint8>(payload[0]);
+  }
+  uint32 weight = http2::kDefaultWeight;
+  if ( fh.flags_ & http2::FLAG_PRIORITY ) {
+    if ( end < begin + 5 ) {
+      return ConnectionError(http2::ERROR_FRAME_SIZE, "bad HEADERS priority");
+    }
+    weight = static_cast<uint8>(payload[begin + 4]) + 1;
+    begin += 5;
+  }
+  header_block_.assign(payload.data() + begin, end - begin);
+  Stream* const stream = FindStream(fh.stream_id_);
+  if ( stream != NULL && (fh.flags_ & http2::FLAG_PRIORITY) ) {
+    stream->weight_ = weight;
+  }
+  header_flags_ = fh.flags_;
+  if ( (fh.flags_ & http2::FLAG_END_HEADERS) == 0 ) {
+    header_stream_id_ = fh.stream_id_;
+    return true;
+  }
+  if ( !ProcessHeaderBlock(fh.stream_id_, fh.flags_) ) {
+    return false;
+  }
+  Stream* const new_stream = FindStream(fh.stream_id_);
+  if ( stream == NULL && new_stream != NULL ) {
+    new_stream->weight_ = weight;
+  }
+  return true;
+}
+
+bool Http2ServerProtocol::ProcessHeaderBlock(uint32 stream_id, uint8 flags) {
+  const ServerParams& params = protocol_->protocol_params();
+  // We always decode - the HPACK state is shared by all the streams. We
+  // refuse requests w/ too many headers after that.
+  hpack::Fields fields;
+  if ( !decoder_.Decode(header_block_.data(), header_block_.size(),
+                        16 * params.max_header_size_, &fields) ) {
+    return ConnectionError(http2::ERROR_COMPRESSION, "bad header block");
+  }
+  header_block_.clear();
+  const bool end_stream = (flags & http2::FLAG_END_STREAM) != 0;
+
+  Stream* stream = FindStream(stream_id);
+  if ( stream != NULL || stream_id <= last_stream_id_ ) {
+    // Trailers - we do not pass them to the request
+    if ( stream == NULL ) {
+      // E.g. trailers of a stream we refused or reset - the header block
+      // is decoded above, so the connection is still usable
+      http2::WriteRstStream(stream_id, http2::ERROR_STREAM_CLOSED, outbuf());
+      return true;
+    }
+    if ( !end_stream || stream->remote_closed_ ) {
+      ResetStream(stream, http2::ERROR_PROTOCOL);
+      return true;
+    }
+    stream->remote_closed_ = true;
+    ServerRequest* const req = stream->req_;
+    if ( req == NULL || stream->discard_input_ ) {
+      MaybeCloseStream(stream);
+      return true;
+    }
+    req->is_parsing_finished_ = true;
+    DispatchRequest(stream);
+    return true;
+  }
+  last_stream_id_ = stream_id;
+  if ( goaway_sent_ ) {
+    return true;
+  }
+  size_t num_requests = 0;
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    num_requests += (it->second->req_ != NULL);
+  }
+  if ( num_requests >= std::max(
+           params.max_concurrent_requests_per_connection_, size_t(1)) ) {
+    LOG_HTTP << "Too many streams - refusing " << stream_id;
+    http2::WriteRstStream(stream_id, http2::ERROR_REFUSED_STREAM, outbuf());
+    return true;
+  }
+  stream = new Stream(stream_id, peer_initial_window_,
+                      protocol_->net_selector()->now());
+  streams_.insert(std::make_pair(stream_id, stream));
+  stream->remote_closed_ = end_stream;
+
+  ServerRequest* const req = new ServerRequest(protocol_);
+  req->stream_id_ = stream_id;
+  if ( !PrepareRequest(fields, req) ) {
+    LOG_HTTP << "Malformed request on stream " << stream_id;
+    delete req;
+    ResetStream(stream, http2::ERROR_PROTOCOL);
+    return true;
+  }
+  stream->req_ = req;
+  protocol_->active_requests_.push_back(req);
+  protocol_->server_->GetSpecificProtocolParams(req);
+
+  size_t fields_size = 0;
+  for ( size_t i = 0; i < fields.size(); ++i ) {
+    fields_size += fields[i].first.size() + fields[i].second.size() + 4;
+  }
+  req->request()->mutable_stats()->client_raw_size_ += fields_size;
+  if ( fields_size > params.max_header_size_ ) {
+    stream->discard_input_ = true;
+    req->request()->server_header()->set_status_code(REQUEST_URI_TOO_LARGE);
+    DispatchRequest(stream);
+    return true;
+  }
+  LOG_HTTP << "New stream " << stream_id << ": ["
+           << strutil::StrTrim(
+               req->request()->client_header()->ComposeFirstLine()) << "]";
+  if ( end_stream ) {
+    req->is_parsing_finished_ = true;
+  }
+  if ( end_stream || req->is_client_streaming() ) {
+    DispatchRequest(stream);
+  }
+  // (we stop waiting for the body of the request, if dispatched)
+  ArmReadTimeout();
+  return true;
+}
+
+bool Http2ServerProtocol::PrepareRequest(const hpack::Fields& fields,
+                                         ServerRequest* req) {
+  http::Header* const hc = req->request()->client_header();
+  std::string method, scheme, authority, path, cookie;
+  bool regular_seen = false;
+  for ( size_t i = 0; i < fields.size(); ++i ) {
+    const std::string& name = fields[i].first;
+    const std::string& value = fields[i].second;
+    if ( !name.empty() && name[0] == ':' ) {
+      // Pseudo fields go first, once
+      std::string* dest = NULL;
+      if ( name == ":method" ) {
+        dest = &method;
+      } else if ( name == ":scheme" ) {
+        dest = &scheme;
+      } else if ( name == ":authority" ) {
+        dest = &authority;
+      } else if ( name == ":path" ) {
+        dest = &path;
+      }
+      if ( regular_seen || dest == NULL || !dest->empty() || value.empty() ) {
+        return false;
+      }
+      *dest = value;
+      continue;
+    }
+    regular_seen = true;
+    for ( size_t j = 0; j < name.size(); ++j ) {
+      if ( name[j] >= 'A' && name[j] <= 'Z' ) {
+        return false;
+      }
+    }
+    if ( IsConnectionSpecificField(name) ||
+         (name == "te" && value != "trailers") ) {
+      return false;
+    }
+    if ( name == "cookie" ) {
+      // Cookies may come split (for better compression) - we put them back
+      if ( !cookie.empty() ) {
+        cookie.append("; ");
+      }
+      cookie.append(value);
+      continue;
+    }
+    if ( !hc->AddField(name, value, false) ) {
+      return false;
+    }
+  }
+  if ( method.empty() ||
+       (method != "CONNECT" && (path.empty() || scheme.empty())) ) {
+    return false;
+  }
+  hc->PrepareRequestLine(path.c_str(), GetHttpMethod(method.c_str()),
+                         VERSION_1_1);
+  if ( !authority.empty() && !hc->HasField(kHeaderHost) ) {
+    hc->AddField(kHeaderHost, authority, true);
+  }
+  if ( !cookie.empty() ) {
+    hc->AddField(kHeaderCookie, cookie, true);
+  }
+  return true;
+}
+
+void Http2ServerProtocol::DispatchRequest(Stream* stream) {
+  ServerRequest* const req = stream->req_;
+  const uint32 stream_id = stream->id_;
+  stream->dispatched_ = true;
+  // The processor may reply right away (and the request may be gone)
+  protocol_->server_->ProcessRequest(req);
+  if ( req->is_client_streaming() ) {
+    Stream* const crt = FindStream(stream_id);
+    if ( crt != NULL && crt->req_ == req ) {
+      CreditConsumedData(crt);
+    }
+  }
+}
+
+void Http2ServerProtocol::ResumeStream(uint32 stream_id) {
+  Stream* const stream = FindStream(stream_id);
+  if ( protocol_->connection_ == NULL || protocol_->closed_ ||
+       stream == NULL || stream->req_ == NULL || stream->paused_ ) {
+    return;
+  }
+  CreditConsumedData(stream);
+  if ( stream->dispatch_pending_ ) {
+    stream->dispatch_pending_ = false;
+    DispatchRequest(stream);
+  }
+  if ( protocol_->connection_ != NULL && !outbuf()->IsEmpty() ) {
+    protocol_->connection_->NotifyWrite();
+  }
+}
+
+void Http2ServerProtocol::PauseRequestReading(ServerRequest* req) {
+  Stream* const stream = FindStream(req->stream_id_);
+  if ( stream != NULL && stream->req_ == req ) {
+    stream->paused_ = true;
+  }
+}
+
+void Http2ServerProtocol::ResumeRequestReading(ServerRequest* req) {
+  Stream* const stream = FindStream(req->stream_id_);
+  if ( stream == NULL || stream->req_ != req || !stream->paused_ ) {
+    return;
+  }
+  stream->paused_ = false;
+  // We may be called from the processor - we continue on a fresh call
+  protocol_->net_selector()->RunInSelectLoop(
+      NewCallback(this, &Http2ServerProtocol::ResumeStream, stream->id_));
+}
+
+void Http2ServerProtocol::ArmReadTimeout() {
+  const Stream* oldest = NULL;
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    const Stream* const stream = it->second;
+    if ( stream->req_ != NULL && !stream->dispatched_ &&
+         (oldest == NULL || stream->start_ms_ < oldest->start_ms_) ) {
+      oldest = stream;
+    }
+  }
+  if ( oldest != NULL ) {
+    const int64 elapsed_ms =
+        protocol_->net_selector()->now() - oldest->start_ms_;
+    protocol_->timeouter_.SetTimeout(
+        ServerProtocol::kRequestTimeout,
+        std::max(protocol_->protocol_params().request_read_timeout_ms_ -
+                 elapsed_ms, int64(1)));
+  } else if ( !protocol_->active_requests_.empty() ) {
+    // (w/o requests, it is the keep alive timeout)
+    protocol_->timeouter_.UnsetTimeout(ServerProtocol::kRequestTimeout);
+  }
+}
+
+void Http2ServerProtocol::HandleReadTimeout() {
+  const int64 now = protocol_->net_selector()->now();
+  const int64 timeout_ms = protocol_->protocol_params().request_read_timeout_ms_;
+  std::vector<Stream*> expired;
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    Stream* const stream = it->second;
+    if ( stream->req_ != NULL && !stream->dispatched_ &&
+         now - stream->start_ms_ >= timeout_ms ) {
+      expired.push_back(stream);
+    }
+  }
+  for ( size_t i = 0; i < expired.size() && !protocol_->closed_; ++i ) {
+    LOG_HTTP << "Timeout waiting for the request on stream "
+             << expired[i]->id_;
+    ResetStream(expired[i], http2::ERROR_CANCEL);
+  }
+  if ( protocol_->closed_ ) {
+    return;
+  }
+  ArmReadTimeout();
+  protocol_->connection_->NotifyWrite();
+}
+
+void Http2ServerProtocol::DropUndispatchedRequests() {
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    Stream* const stream = it->second;
+    if ( stream->req_ != NULL && !stream->dispatched_ ) {
+      ServerRequest* const req = stream->req_;
+      stream->req_ = NULL;
+      ServerProtocol::RequestQueue* const active =
+          &protocol_->active_requests_;
+      active->erase(std::find(active->begin(), active->end(), req));
+      delete req;
+    }
+  }
+}
+
+bool Http2ServerProtocol::ProcessSettings(const http2::FrameHeader& fh,
+                                          const std::string& payload) {
+  if ( fh.stream_id_ != 0 ) {
+    return ConnectionError(http2::ERROR_PROTOCOL, "SETTINGS on a stream");
+  }
+  if ( fh.flags_ & http2::FLAG_ACK ) {
+    if ( fh.length_ != 0 ) {
+      return ConnectionError(http2::ERROR_FRAME_SIZE, "bad SETTINGS ack");
+    }
+    return true;
+  }
+  if ( fh.length_ % 6 != 0 ) {
+    return ConnectionError(http2::ERROR_FRAME_SIZE, "bad SETTINGS");
+  }
+  for ( size_t i = 0; i < payload.size(); i += 6 ) {
+    const uint16 id = http2::DecodeUInt16(payload.data() + i);
+    const uint32 value = http2::DecodeUInt32(payload.data() + i + 2);
+    switch ( id ) {
+      case http2::SETTINGS_HEADER_TABLE_SIZE:
+        encoder_.set_max_table_size(value);
+        break;
+      case http2::SETTINGS_ENABLE_PUSH:
+        if ( value > 1 ) {
+          return ConnectionError(http2::ERROR_PROTOCOL, "bad ENABLE_PUSH");
+        }
+        break;
+      case http2::SETTINGS_INITIAL_WINDOW_SIZE: {
+        if ( value > http2::kMaxWindowSize ) {
+          return ConnectionError(http2::ERROR_FLOW_CONTROL,
+                                 "bad INITIAL_WINDOW_SIZE");
+        }
+        // Applies to the open streams too
+        const int64 delta = static_cast<int64>(value) - peer_initial_window_;
+        for ( StreamMap::const_iterator it = streams_.begin();
+              it != streams_.end(); ++it ) {
+          it->second->send_window_ += delta;
+          if ( it->second->send_window_ > http2::kMaxWindowSize ) {
+            return ConnectionError(http2::ERROR_FLOW_CONTROL,
+                                   "stream window overflow");
+          }
+        }
+        peer_initial_window_ = value;
+        break;
+      }
+      case http2::SETTINGS_MAX_FRAME_SIZE:
+        if ( value < http2::kDefaultMaxFrameSize ||
+             value > http2::kMaxMaxFrameSize ) {
+          return ConnectionError(http2::ERROR_PROTOCOL, "bad MAX_FRAME_SIZE");
+        }
+        peer_max_frame_size_ = value;
+        break;
+      default:
+        // MAX_CONCURRENT_STREAMS is about push, we ignore the unknown ones,
+        // and we do not limit the headers we send.
+        break;
+    }
+  }
+  http2::WriteSettingsAck(outbuf());
+  return true;
+}
+
+bool Http2ServerProtocol::ProcessWindowUpdate(const http2::FrameHeader& fh,
+                                              const std::string& payload) {
+  if ( fh.length_ != 4 ) {
+    return ConnectionError(http2::ERROR_FRAME_SIZE, "bad WINDOW_UPDATE");
+  }
+  const uint32 increment = http2::DecodeUInt32(payload.data()) & 0x7fffffff;
+  if ( fh.stream_id_ == 0 ) {
+    if ( increment == 0 ) {
+      return ConnectionError(http2::ERROR_PROTOCOL, "zero WINDOW_UPDATE");
+    }
+    send_window_ += increment;
+    if ( send_window_ > http2::kMaxWindowSize ) {
+      return ConnectionError(http2::ERROR_FLOW_CONTROL, "window overflow");
+    }
+    return true;
+  }
+  Stream* const stream = FindStream(fh.stream_id_);
+  if ( stream == NULL ) {
+    if ( fh.stream_id_ > last_stream_id_ ) {
+      return ConnectionError(http2::ERROR_PROTOCOL,
+                             "WINDOW_UPDATE on an idle stream");
+    }
+    return true;
+  }
+  if ( increment == 0 ) {
+    ResetStream(stream, http2::ERROR_PROTOCOL);
+    return true;
+  }
+  stream->send_window_ += increment;
+  if ( stream->send_window_ > http2::kMaxWindowSize ) {
+    ResetStream(stream, http2::ERROR_FLOW_CONTROL);
+  }
+  return true;
+}
+
+void Http2ServerProtocol::ResetStream(Stream* stream, http2::ErrorCode error) {
+  if ( !stream->local_closed_ ) {
+    http2::WriteRstStream(stream->id_, error, outbuf());
+  }
+  streams_.erase(stream->id_);
+  // The data the processor did not get counts for the connection window
+  CreditData(NULL, stream->recv_buffered_);
+  ServerRequest* const req = stream->req_;
+  const bool dispatched = stream->dispatched_;
+  delete stream;
+  if ( req == NULL ) {
+    return;
+  }
+  if ( !dispatched ) {
+    DropRequest(req);
+    return;
+  }
+  // The processor sees this, and the reply goes nowhere
+  req->is_orphaned_ = true;
+  req->SignalClosed();
+}
+
+void Http2ServerProtocol::DropRequest(ServerRequest* req) {
+  LOG_HTTP << "Dropping the request on stream " << req->stream_id_;
+  if ( RemoveActiveRequest(req) ) {
+    ArmReadTimeout();
+  }
+}
+
+bool Http2ServerProtocol::RemoveActiveRequest(ServerRequest* req) {
+  ServerProtocol::RequestQueue* const active = &protocol_->active_requests_;
+  const ServerProtocol::RequestQueue::iterator it =
+      std::find(active->begin(), active->end(), req);
+  if ( it != active->end() ) {
+    active->erase(it);
+  }
+  protocol_->net_selector()->DeleteInSelectLoop(req);
+  if ( !active->empty() ) {
+    return true;
+  }
+  if ( goaway_received_ ) {
+    goaway_sent_ = true;
+    http2::WriteGoAway(last_stream_id_, http2::ERROR_NONE, outbuf());
+    protocol_->closed_ = true;
+    protocol_->connection_->FlushAndClose();
+    return false;
+  }
+  const ServerParams& params = protocol_->protocol_params();
+  protocol_->timeouter_.SetTimeout(
+      ServerProtocol::kRequestTimeout,
+      params.keep_alive_timeout_sec_ > 0
+      ? params.keep_alive_timeout_sec_ * 1000
+      : params.request_read_timeout_ms_);
+  return true;
+}
+
+void Http2ServerProtocol::MaybeCloseStream(Stream* stream) {
+  if ( stream->req_ != NULL || !stream->local_closed_ ) {
+    return;
+  }
+  if ( !stream->remote_closed_ ) {
+    // We replied before the end of the request
+    http2::WriteRstStream(stream->id_, http2::ERROR_NONE, outbuf());
+  }
+  streams_.erase(stream->id_);
+  delete stream;
+}
+
+bool Http2ServerProtocol::ConnectionError(http2::ErrorCode error,
+                                          const char* reason) {
+  LOG_HTTP << "Connection error: " << http2::ErrorCodeName(error)
+           << " - " << reason;
+  if ( !goaway_sent_ ) {
+    goaway_sent_ = true;
+    http2::WriteGoAway(last_stream_id_, error, outbuf());
+  }
+  protocol_->closed_ = true;
+  protocol_->connection_->FlushAndClose();
+  return false;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+bool Http2ServerProtocol::PrepareResponse(ServerRequest* req,
+                                          HttpReturnCode status) {
+  Stream* const stream = FindStream(req->stream_id_);
+  if ( stream == NULL ) {
+    req->is_orphaned_ = true;
+    return false;
+  }
+  http::Request* const r = req->request();
+  http::Header* const hs = r->server_header();
+  hs->PrepareStatusLine(status, VERSION_1_1);
+  protocol_->AddDefaultReplyFields(req);
+  const bool has_body = !r->NoServerBodyTransmitted();
+  if ( !has_body ) {
+    r->server_data()->Clear();
+  } else if ( !req->is_server_streaming() ) {
+    hs->AddField(kHeaderContentLength,
+                 strutil::Int64ToString(r->server_data()->Size()), true);
+  }
+  hpack::Fields fields;
+  fields.push_back(hpack::Field(":status",
+                                strutil::IntToString(status)));
+  for ( HeaderFields::const_iterator it = hs->fields().begin();
+        it != hs->fields().end(); ++it ) {
+    std::string name(strutil::StrToLower(it->name_str()));
+    if ( !IsConnectionSpecificField(name) ) {
+      fields.push_back(hpack::Field(name, it->value_str()));
+    }
+  }
+  std::string block;
+  encoder_.Encode(fields, &block);
+  const bool end_stream = !req->is_server_streaming() &&
+                          r->server_data()->IsEmpty();
+  const size_t out_size = outbuf()->Size();
+  http2::WriteHeaders(stream->id_, block, end_stream,
+                      peer_max_frame_size_, outbuf());
+  r->mutable_stats()->server_raw_size_ += outbuf()->Size() - out_size;
+  req->is_keep_alive_ = true;
+  if ( end_stream ) {
+    stream->end_pending_ = stream->local_closed_ = true;
+  } else {
+    r->mutable_stats()->server_size_ += r->server_data()->Size();
+    AppendData(stream, r->server_data());
+    stream->end_pending_ = !req->is_server_streaming();
+  }
+  WriteData();
+  protocol_->connection_->NotifyWrite();
+  return true;
+}
+
+bool Http2ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
+  Stream* const stream = FindStream(req->stream_id_);
+  if ( stream == NULL ) {
+    req->is_orphaned_ = true;
+    return true;
+  }
+  http::Request* const r = req->request();
+  if ( r->NoServerBodyTransmitted() ) {
+    r->server_data()->Clear();
+  }
+  if ( !r->server_data()->IsEmpty() ) {
+    const ServerParams& params = protocol_->protocol_params();
+    bool append_data = true;
+    if ( stream->pending_.Size() > params.max_reply_buffer_size_ ) {
+      append_data = false;
+      LOG_WARN << name() << " HTTP/2 stream " << stream->id_
+               << " buffer size exceeded: " << stream->pending_.Size()
+               << " > max_reply_buffer_size: "
+               << params.max_reply_buffer_size_;
+      switch ( params.reply_full_buffer_policy_ ) {
+        case ServerParams::POLICY_CLOSE:
+          LOG_HTTP << "Buffer full - resetting stream " << stream->id_;
+          ResetStream(stream, http2::ERROR_CANCEL);
+          return true;
+        case ServerParams::POLICY_DROP_OLD_DATA:
+          stream->pending_.Clear();
+          append_data = true;
+          break;
+        case ServerParams::POLICY_DROP_NEW_DATA:
+          r->server_data()->Clear();
+          break;
+        case ServerParams::POLICY_BLINK:
+          append_data = true;
+          break;
+      }
+    }
+    if ( append_data ) {
+      r->mutable_stats()->server_size_ += r->server_data()->Size();
+      AppendData(stream, r->server_data());
+    }
+  }
+  if ( is_eos ) {
+    stream->end_pending_ = true;
+  }
+  WriteData();
+  return is_eos;
+}
+
+void Http2ServerProtocol::EndRequestProcessing(ServerRequest* req,
+                                               bool is_eos) {
+  Stream* const stream = FindStream(req->stream_id_);
+  bool signal_ready = false;
+  if ( is_eos || req->is_orphaned() ) {
+    req->SignalClosed();
+  } else if ( stream != NULL && stream->pending_.IsEmpty() ) {
+    signal_ready = true;
+  }
+  if ( is_eos ) {
+    LOG_HTTP << "Request completed on stream " << req->stream_id_ << ": ["
+             << strutil::StrTrim(
+                 req->request()->client_header()->ComposeFirstLine())
+             << "] => " << req->request()->server_header()->status_code();
+    if ( stream != NULL ) {
+      stream->req_ = NULL;
+      CreditConsumedData(stream);   // whatever the processor left
+      MaybeCloseStream(stream);
+    }
+    if ( !RemoveActiveRequest(req) ) {
+      return;
+    }
+  }
+  if ( !outbuf()->IsEmpty() ) {
+    protocol_->timeouter_.SetTimeout(
+        ServerProtocol::kWriteTimeout,
+        protocol_->protocol_params().reply_write_timeout_ms_);
+    protocol_->connection_->NotifyWrite();
+  }
+  if ( signal_ready ) {
+    req->SignalReady();
+  }
+}
+
+void Http2ServerProtocol::NotifyConnectionWrite() {
+  WriteData();
+  // The streams w/ room for more data hear about it
+  std::vector<ServerRequest*> ready;
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    ServerRequest* const req = it->second->req_;
+    if ( req != NULL && req->ready_callback_ != NULL ) {
+      req->UpdateOutputBytes();
+      if ( req->pending_output_bytes() < req->ready_pending_limit_ ) {
+        ready.push_back(req);
+      }
+    }
+  }
+  for ( size_t i = 0; i < ready.size(); ++i ) {
+    ready[i]->SignalReady();
+  }
+}
+
+size_t Http2ServerProtocol::pending_output_bytes(
+    const ServerRequest* req) const {
+  const Stream* const stream = FindStream(req->stream_id_);
+  return stream == NULL ? 0 : stream->pending_.Size();
+}
+
+void Http2ServerProtocol::AppendData(Stream* stream, io::MemoryStream* data) {
+  if ( data->IsEmpty() ) {
+    return;
+  }
+  if ( stream->pending_.IsEmpty() ) {
+    // Starts a new busy period - w/o credit for the time it was idle
+    stream->vtime_ = std::max(stream->vtime_, vtime_);
+  }
+  stream->pending_.AppendStream(data);
+}
+
+Http2ServerProtocol::Stream* Http2ServerProtocol::NextStream() const {
+  Stream* next = NULL;
+  for ( StreamMap::const_iterator it = streams_.begin();
+        it != streams_.end(); ++it ) {
+    Stream* const stream = it->second;
+    if ( stream->local_closed_ ) {
+      continue;
+    }
+    if ( stream->pending_.IsEmpty() ) {
+      // Only the END_STREAM left - it takes no window
+      if ( !stream->end_pending_ ) {
+        continue;
+      }
+    } else if ( send_window_ <= 0 || stream->send_window_ <= 0 ) {
+      continue;
+    }
+    if ( next == NULL || stream->vtime_ < next->vtime_ ) {
+      next = stream;
+    }
+  }
+  return next;
+}
+
+void Http2ServerProtocol::WriteData() {
+  if ( protocol_->connection_ == NULL ) {
+    return;
+  }
+  const size_t max_size = protocol_->protocol_params().max_reply_buffer_size_;
+  io::MemoryStream* const out = outbuf();
+  bool wrote = false;
+  while ( out->Size() < max_size ) {
+    Stream* const stream = NextStream();
+    if ( stream == NULL ) {
+      break;
+    }
+    size_t size = stream->pending_.Size();
+    size = std::min(size, static_cast<size_t>(peer_max_frame_size_));
+    if ( size > 0 ) {
+      size = std::min(size, static_cast<size_t>(
+          std::min(send_window_, stream->send_window_)));
+    }
+    const bool end_stream = (stream->end_pending_ &&
+                             size == stream->pending_.Size());
+    http2::WriteFrameHeader(
+        http2::FrameHeader(size, http2::FRAME_DATA,
+                           end_stream ? http2::FLAG_END_STREAM : 0,
+                           stream->id_), out);
+    out->AppendStream(&stream->pending_, size);
+    if ( stream->req_ != NULL ) {
+      stream->req_->request()->mutable_stats()->server_raw_size_ +=
+          http2::kFrameHeaderSize + size;
+    }
+    send_window_ -= size;
+    stream->send_window_ -= size;
+    // A stream gets bandwidth in proportion w/ its weight
+    stream->vtime_ += (http2::kFrameHeaderSize + size) * 256 / stream->weight_;
+    vtime_ = stream->vtime_;
+    wrote = true;
+    if ( end_stream ) {
+      stream->local_closed_ = true;
+      MaybeCloseStream(stream);
+    }
+  }
+  if ( wrote ) {
+    protocol_->connection_->NotifyWrite();
+  }
+}
+
+}  // namespace http
+}  // namespace whisper
@@ -0,0 +1,256 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The HTTP/2 side of http::ServerProtocol: when a client speaks HTTP/2
+// on a connection (it starts w/ the connection preface - i.e. prior
+// knowledge - or it negotiated "h2" w/ ALPN on a SSL connection), its
+// ServerProtocol passes the conversation to one of these.
+//
+// The streams become regular http::ServerRequest-s, dispatched to the
+// processors registered w/ http::Server::RegisterProcessor, so the
+// processors do not know (or care) about the version of HTTP. The replies
+// are multiplexed on the connection:
+//   - the data of each stream waits in a buffer of its own, and moves to the
+//     connection outbuf in DATA frames, as the flow control windows
+//     announced by the client allow, and while the outbuf holds less than
+//     max_reply_buffer_size_. ServerParams::reply_full_buffer_policy_
+//     applies to these per stream buffers (POLICY_CLOSE resets the stream,
+//     not the connection).
+//   - the streams w/ data to send share the connection by their weights
+//     (weighted fair queuing). We ignore the dependencies between streams -
+//     RFC 9113 deprecated that scheme.
+//
+// The request bodies are flow controlled: we credit the windows of the
+// client for the data as we are done w/ it - right away for the bodies we
+// buffer whole (up to max_body_size_), as the processor consumes it for
+// the client streaming requests (see ServerRequest::PauseReading). Each
+// stream gets the whole initial window, so the connection window covers
+// max_concurrent_requests_per_connection_ of them. A request that does not
+// reach its processor in request_read_timeout_ms_ gets its stream reset.
+//
+// To use ALPN, set in the SslConnectionParams of your acceptor:
+//    alpn_protocols_ = std::string("\x02h2\x08http/1.1", 12);
+//
+// Not supported: server push, gzip encoding of the replies (the
+// Content-Encoding is what the processor set), and the upgrade from
+// HTTP/1.1 (h2c).
+//
+#ifndef __WHISPERLIB_HTTP_HTTP2_SERVER_PROTOCOL_H__
+#define __WHISPERLIB_HTTP_HTTP2_SERVER_PROTOCOL_H__
+
+#include <map>
+#include <string>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/http/hpack.h"
+#include "whisperlib/http/http2_frames.h"
+#include "whisperlib/http/http_server_protocol.h"
+
+namespace whisper {
+namespace http {
+
+class Http2ServerProtocol {
+ public:
+  // We work on the connection of protocol (which owns us)
+  explicit Http2ServerProtocol(ServerProtocol* protocol);
+  ~Http2ServerProtocol();
+
+  // Processes the frames in the connection inbuf
+  ServerProtocol::ProcessMoreDataResult ProcessMoreData();
+
+  // The reply side of the requests on our streams (see the ServerProtocol
+  // functions w/ the same name).
+  // Sends the headers of the reply - and the body, for non streaming
+  // replies. Returns false if the stream is gone (the request is orphaned)
+  bool PrepareResponse(ServerRequest* req, HttpReturnCode status);
+  // Sends more data. Returns the is_eos that applies (we end the
+  // stream if it is gone, or if its buffer is full w/ POLICY_CLOSE)
+  bool StreamData(ServerRequest* req, bool is_eos);
+  // After a reply, or a part of it: disposes the request on is_eos, or
+  // signals it if it can send more
+  void EndRequestProcessing(ServerRequest* req, bool is_eos);
+
+  // Called when the connection wrote some data
+  void NotifyConnectionWrite();
+
+  // Flow control for a client streaming request: while paused the
+  // processor gets no more data, and the client waits for credit.
+  void PauseRequestReading(ServerRequest* req);
+  void ResumeRequestReading(ServerRequest* req);
+
+  // The read timeout fired - resets the streams whose requests did not
+  // reach their processors in time
+  void HandleReadTimeout();
+  // The connection is gone - deletes the requests that never reached
+  // their processors
+  void DropUndispatchedRequests();
+
+  // Reply data of req that still waits in its stream
+  size_t pending_output_bytes(const ServerRequest* req) const;
+
+  size_t num_streams() const { return streams_.size(); }
+  const std::string& name() const { return protocol_->name(); }
+
+ private:
+  struct Stream {
+    Stream(uint32 id, int64 send_window, int64 start_ms)
+        : id_(id), req_(NULL), start_ms_(start_ms), send_window_(send_window),
+          recv_window_(http2::kDefaultWindowSize), recv_unacked_(0),
+          recv_buffered_(0), weight_(http2::kDefaultWeight), vtime_(0),
+          remote_closed_(false), end_pending_(false), local_closed_(false),
+          dispatched_(false), discard_input_(false), paused_(false),
+          dispatch_pending_(false) {
+    }
+    const uint32 id_;
+    // The request on this stream, until it is done (then we may still
+    // have data to send)
+    ServerRequest* req_;
+    // When the stream started (ms)
+    const int64 start_ms_;
+    // Reply data that waits to go out in DATA frames
+    io::MemoryStream pending_;
+    // What the client allows us to send
+    int64 send_window_;
+    // What the client may still send us
+    int64 recv_window_;
+    // Data we are done with, w/o a WINDOW_UPDATE yet
+    uint32 recv_unacked_;
+    // Data of a client streaming request, not consumed by its processor
+    size_t recv_buffered_;
+    // [1, 256] - the share of the connection for this stream
+    uint32 weight_;
+    // Virtual finish time of the data sent so far - we serve the smallest
+    uint64 vtime_;
+    bool remote_closed_;   // the client ended the stream
+    bool end_pending_;     // we end the stream after pending_
+    bool local_closed_;    // we ended the stream
+    bool dispatched_;      // the request went to its processor
+    bool discard_input_;   // we replied w/ an error - ignore the body
+    bool paused_;          // the processor paused reading
+    bool dispatch_pending_;  // new data came while paused
+  };
+  typedef std::map<uint32, Stream*> StreamMap;
+
+  Stream* FindStream(uint32 id) const {
+    const StreamMap::const_iterator it = streams_.find(id);
+    return it == streams_.end() ? NULL : it->second;
+  }
+  io::MemoryStream* outbuf();
+
+  // Frame processing - these return false on a connection error
+  bool ProcessFrame(const http2::FrameHeader& fh, const std::string& payload);
+  bool ProcessData(const http2::FrameHeader& fh);
+  bool ProcessHeaders(const http2::FrameHeader& fh,
+                      const std::string& payload);
+  bool ProcessHeaderBlock(uint32 stream_id, uint8 flags);
+  bool ProcessSettings(const http2::FrameHeader& fh,
+                       const std::string& payload);
+  bool ProcessWindowUpdate(const http2::FrameHeader& fh,
+                           const std::string& payload);
+
+  // Prepares the request from the decoded header block. Returns false
+  // on a malformed request.
+  bool PrepareRequest(const hpack::Fields& fields, ServerRequest* req);
+  // Gives the request to the server, for processing
+  void DispatchRequest(Stream* stream);
+  // Continues a client streaming request that resumed reading
+  void ResumeStream(uint32 stream_id);
+  // Gives back flow control credit for size bytes received on the stream
+  // (NULL for data of no stream), sending WINDOW_UPDATE when enough adds up
+  void CreditData(Stream* stream, uint32 size);
+  // Credits the data consumed by the processor of a client streaming
+  // request (all of it if the request is gone)
+  void CreditConsumedData(Stream* stream);
+  // Arms the read timeout for the oldest stream not dispatched yet
+  void ArmReadTimeout();
+
+  // Sends RST_STREAM and drops the stream (its request is orphaned, or
+  // deleted if it did not reach its processor yet)
+  void ResetStream(Stream* stream, http2::ErrorCode error);
+  // Deletes a request that did not reach its processor
+  void DropRequest(ServerRequest* req);
+  // Takes req out of the active requests of the connection - on the last
+  // one we wait for more, or close if the client goes away. Returns false
+  // if the connection is closing.
+  bool RemoveActiveRequest(ServerRequest* req);
+  // Drops the stream (if we are done w/ it)
+  void MaybeCloseStream(Stream* stream);
+  // Sends GOAWAY and closes the connection
+  bool ConnectionError(http2::ErrorCode error, const char* reason);
+
+  // Moves data from the streams to the connection, in DATA frames, as
+  // flow control and the limit on the connection outbuf allow
+  void WriteData();
+  // The next stream to send data from (NULL if none can)
+  Stream* NextStream() const;
+  // Adds data to send for the stream
+  void AppendData(Stream* stream, io::MemoryStream* data);
+
+ private:
+  ServerProtocol* const protocol_;
+  const bool dlog_level_;
+
+  bool preface_received_;
+  // We sent / got GOAWAY
+  bool goaway_sent_;
+  bool goaway_received_;
+
+  // The streams that are open (or we still send on)
+  StreamMap streams_;
+  // The largest stream id started by the client
+  uint32 last_stream_id_;
+
+  // A header block coming in HEADERS + CONTINUATION frames
+  std::string header_block_;
+  uint32 header_stream_id_;   // 0 - we do not expect CONTINUATION
+  uint8 header_flags_;
+
+  hpack::Decoder decoder_;
+  hpack::Encoder encoder_;
+
+  // The client settings
+  uint32 peer_max_frame_size_;
+  uint32 peer_initial_window_;
+  // What the client allows us to send on the connection
+  int64 send_window_;
+  // What the client may still send us on the connection
+  int64 recv_window_;
+  // Data we are done with, w/o a WINDOW_UPDATE on the connection yet
+  uint32 recv_unacked_;
+
+  // The virtual time of the last stream served (see NextStream)
+  uint64 vtime_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(Http2ServerProtocol);
+};
+
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_HTTP2_SERVER_PROTOCOL_H__
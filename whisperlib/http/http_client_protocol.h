@@ -570,11 +570,13 @@ class ClientRequest  {
   int32 request_timeout_ms() const { return request_timeout_ms_; }
   int64 request_id() const { return request_id_; }
   bool is_pure_dumping() const { return is_pure_dumping_; }
+  const std::string& balance_key() const { return balance_key_; }
 
   void set_error(http::ClientError error) { error_ = error; }
   void set_request_timeout_ms(int32 t) { request_timeout_ms_ = t; }
   void set_request_id(int64 request_id) { request_id_ = request_id; }
   void set_is_pure_dumping(bool val) { is_pure_dumping_ = val; }
+  void set_balance_key(const std::string& key) { balance_key_ = key; }
 
   std::string name() const {
     return strutil::StrTrim(
@@ -593,6 +595,9 @@ class ClientRequest  {
   // If this is on we just dump the request - w/ no content length and
   // other checks..
   bool is_pure_dumping_;
+  // Requests w/ the same key go to the same server, when balancing
+  // by consistent hashing (empty => we use the request URI)
+  std::string balance_key_;
 
   friend class ClientProtocol;
 
@@ -0,0 +1,522 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <time.h>
+#include "whisperlib/http/http_compression.h"
+#include "whisperlib/http/http_request.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/strutil.h"
+
+#if defined(HAVE_LIBZSTD) && defined(HAVE_ZSTD_H)
+#include <zstd.h>
+#define WHISPER_HTTP_ZSTD 1
+#endif
+
+namespace whisper {
+namespace http {
+
+const char* ContentCodingName(ContentCoding coding) {
+  switch ( coding ) {
+    case CODING_IDENTITY: return "identity";
+    case CODING_GZIP: return "gzip";
+    case CODING_DEFLATE: return "deflate";
+    case CODING_ZSTD: return "zstd";
+  }
+  return "unknown";
+}
+
+const char* CompressionPresetName(CompressionPreset preset) {
+  switch ( preset ) {
+    CONSIDER(COMPRESSION_FASTEST);
+    CONSIDER(COMPRESSION_FAST);
+    CONSIDER(COMPRESSION_DEFAULT);
+    CONSIDER(COMPRESSION_BEST);
+  }
+  return "UNKNOWN";
+}
+
+int CompressionLevel(ContentCoding coding, CompressionPreset preset) {
+  static const int kZlibLevels[kNumCompressionPresets] = { 1, 3, 6, 9 };
+  static const int kZstdLevels[kNumCompressionPresets] = { 1, 3, 7, 19 };
+  switch ( coding ) {
+    case CODING_IDENTITY: return 0;
+    case CODING_GZIP:
+    case CODING_DEFLATE: return kZlibLevels[preset];
+    case CODING_ZSTD: return kZstdLevels[preset];
+  }
+  return 0;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+CompressionParams::CompressionParams()
+    : preset_(COMPRESSION_FAST),
+      cache_preset_(COMPRESSION_BEST),
+      min_size_(1024),
+      max_size_(32 << 20),
+      offload_min_size_(64 << 10),
+      num_offload_threads_(2),
+      max_queued_offloads_(100),
+      enable_zstd_(true),
+      max_cache_size_(16 << 20) {
+  content_types_.push_back("text/");
+  content_types_.push_back("application/json");
+  content_types_.push_back("application/javascript");
+  content_types_.push_back("application/x-javascript");
+  content_types_.push_back("application/xml");
+  content_types_.push_back("application/xhtml+xml");
+  content_types_.push_back("application/rss+xml");
+  content_types_.push_back("image/svg+xml");
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+#ifdef WHISPER_HTTP_ZSTD
+// A reusable zstd compression context
+class ZstdCompressor : public io::Compressor {
+ public:
+  explicit ZstdCompressor(int level)
+      : cctx_(ZSTD_createCCtx()),
+        level_(level) {
+    CHECK(cctx_ != NULL);
+  }
+  virtual ~ZstdCompressor() {
+    ZSTD_freeCCtx(cctx_);
+  }
+  virtual bool Compress(io::MemoryStream* in, io::MemoryStream* out) {
+    ZSTD_CCtx_reset(cctx_, ZSTD_reset_session_only);
+    ZSTD_CCtx_setParameter(cctx_, ZSTD_c_compressionLevel, level_);
+    size_t left = in->Size();
+    ZSTD_CCtx_setPledgedSrcSize(cctx_, left);
+    while ( true ) {
+      ZSTD_inBuffer input = { NULL, 0, 0 };
+      if ( left > 0 ) {
+        const char* buf = NULL;
+        size_t size = left;
+        CHECK(in->ReadNext(&buf, &size));
+        input.src = buf;
+        input.size = size;
+        left -= size;
+      }
+      const ZSTD_EndDirective mode = left > 0 ? ZSTD_e_continue : ZSTD_e_end;
+      size_t remaining = 0;
+      do {
+        char* scratch = NULL;
+        size_t scratch_size = 0;
+        out->GetScratchSpace(&scratch, &scratch_size);
+        ZSTD_outBuffer output = { scratch, scratch_size, 0 };
+        remaining = ZSTD_compressStream2(cctx_, &output, &input, mode);
+        out->ConfirmScratch(output.pos);
+        if ( ZSTD_isError(remaining) ) {
+          LOG_WARN << "ZSTD_compressStream2() failed: "
+                   << ZSTD_getErrorName(remaining);
+          return false;
+        }
+      } while ( mode == ZSTD_e_end ? remaining > 0
+                                   : input.pos < input.size );
+      if ( mode == ZSTD_e_end ) {
+        return true;
+      }
+    }
+  }
+ private:
+  ZSTD_CCtx* const cctx_;
+  const int level_;
+  DISALLOW_EVIL_CONSTRUCTORS(ZstdCompressor);
+};
+static const bool kHaveZstd = true;
+#else
+static const bool kHaveZstd = false;
+#endif
+
+// The cpu time of the calling thread
+int64 ThreadCpuNsec() {
+  struct timespec ts;
+  if ( clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) ) {
+    return 0;
+  }
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// We keep at most these many idle compressors of a kind
+static const size_t kMaxPooledCompressors = 16;
+
+// The caches between us and the client need to know that we compress
+static void AddVaryAcceptEncoding(Header* hs) {
+  std::string vary;
+  if ( !hs->FindField(kHeaderVary, &vary) ) {
+    hs->AddField(kHeaderVary, "Accept-Encoding", true);
+  } else if ( strutil::StrToLower(vary).find("accept-encoding") ==
+              std::string::npos ) {
+    hs->AddField(kHeaderVary, "Accept-Encoding", false);
+  }
+}
+
+static bool IsBodylessReply(const Request* req, HttpReturnCode status) {
+  return (req->client_header()->method() == METHOD_HEAD ||
+          (status >= 100 && status < 200) ||
+          status == NO_CONTENT ||
+          status == NOT_MODIFIED);
+}
+}  // namespace
+
+ReplyCompressor::ReplyCompressor(const CompressionParams& params)
+    : params_(params),
+      offload_pool_(NULL),
+      cache_size_(0),
+      num_compressed_(0),
+      num_offloaded_(0),
+      bytes_in_(0),
+      bytes_out_(0),
+      cpu_ns_(0),
+      cache_hits_(0),
+      cache_misses_(0) {
+  if ( params_.offload_min_size_ > 0 && params_.num_offload_threads_ > 0 ) {
+    offload_pool_ = new thread::ThreadPool(
+        params_.num_offload_threads_,
+        std::max(params_.max_queued_offloads_,
+                 params_.num_offload_threads_ + 1));
+  }
+}
+
+ReplyCompressor::~ReplyCompressor() {
+  delete offload_pool_;
+  for ( size_t i = 0; i < kNumContentCodings; ++i ) {
+    for ( size_t j = 0; j < kNumCompressionPresets; ++j ) {
+      for ( size_t k = 0; k < pool_[i][j].size(); ++k ) {
+        delete pool_[i][j][k];
+      }
+    }
+  }
+}
+
+bool ReplyCompressor::IsCompressibleType(
+    const std::string& content_type) const {
+  for ( size_t i = 0; i < params_.content_types_.size(); ++i ) {
+    if ( strutil::StrCasePrefix(content_type.c_str(),
+                                params_.content_types_[i].c_str()) ) {
+      return true;
+    }
+  }
+  return false;
+}
+
+ContentCoding ReplyCompressor::SelectCoding(const Header& client_header,
+                                            const Header& server_header,
+                                            size_t size) const {
+  if ( size < params_.min_size_ ||
+       (params_.max_size_ > 0 && size > params_.max_size_) ||
+       client_header.http_version() < VERSION_1_0 ) {
+    return CODING_IDENTITY;
+  }
+  std::string content_type;
+  if ( !server_header.FindField(kHeaderContentType, &content_type) ||
+       !IsCompressibleType(content_type) ) {
+    return CODING_IDENTITY;
+  }
+  // In our order of preference, for equal q values. A '*' stands only for
+  // the old codings - for zstd we want it named.
+  static const ContentCoding kCodings[] = {
+    CODING_ZSTD, CODING_GZIP, CODING_DEFLATE
+  };
+  ContentCoding best_coding = CODING_IDENTITY;
+  float best_q = 0.0f;
+  for ( size_t i = 0; i < NUMBEROF(kCodings); ++i ) {
+    const bool is_zstd = kCodings[i] == CODING_ZSTD;
+    if ( is_zstd && !(kHaveZstd && params_.enable_zstd_) ) {
+      continue;
+    }
+    const float q = client_header.GetHeaderAcceptance(
+        kHeaderAcceptEncoding, ContentCodingName(kCodings[i]),
+        "", is_zstd ? "" : "*");
+    if ( q > best_q ) {
+      best_q = q;
+      best_coding = kCodings[i];
+    }
+  }
+  return best_coding;
+}
+
+ContentCoding ReplyCompressor::PrepareReply(Request* req,
+                                            HttpReturnCode status) {
+  if ( !req->server_use_gzip_encoding() || req->server_data_encoded() ) {
+    return CODING_IDENTITY;
+  }
+  // We decide from here on - the request sends the body as we leave it
+  req->set_server_data_encoded(true);
+  Header* const hs = req->server_header();
+  if ( IsBodylessReply(req, status) ) {
+    hs->SetContentEncoding(NULL);
+    return CODING_IDENTITY;
+  }
+  std::string content_type;
+  if ( hs->FindField(kHeaderContentType, &content_type) &&
+       IsCompressibleType(content_type) ) {
+    AddVaryAcceptEncoding(hs);
+  }
+  const ContentCoding coding = SelectCoding(
+      *req->client_header(), *hs, req->server_data()->Size());
+  if ( coding == CODING_IDENTITY ) {
+    hs->SetContentEncoding(NULL);
+    return CODING_IDENTITY;
+  }
+  if ( ServeFromCache(req, coding) ) {
+    return CODING_IDENTITY;
+  }
+  return coding;
+}
+
+void ReplyCompressor::CompressReply(Request* req, ContentCoding coding) {
+  Header* const hs = req->server_header();
+  io::MemoryStream* const body = req->server_data();
+  const std::string key(CacheKey(req, coding));
+  const size_t size = body->Size();
+  const int64 start_ns = ThreadCpuNsec();
+  io::MemoryStream compressed;
+  body->MarkerSet();
+  const bool success = Compress(
+      coding, key.empty() ? params_.preset_ : params_.cache_preset_,
+      body, &compressed);
+  cpu_ns_ += ThreadCpuNsec() - start_ns;
+  if ( !success || compressed.Size() >= size ) {
+    // Not worth it (or cannot) - goes as it is
+    body->MarkerRestore();
+    hs->SetContentEncoding(NULL);
+    req->set_server_data_encoded(true);
+    return;
+  }
+  body->MarkerClear();
+  body->Clear();
+  ++num_compressed_;
+  bytes_in_ += size;
+  bytes_out_ += compressed.Size();
+  const std::string etag(hs->FindField(kHeaderETag));
+  if ( !key.empty() ) {
+    ++cache_misses_;
+    CacheStore(key, &compressed);
+  }
+  body->AppendStream(&compressed);
+  SetEncodedReply(req, coding, etag);
+}
+
+bool ReplyCompressor::OffloadReply(Request* req, ContentCoding coding,
+                                   Closure* done_callback) {
+  if ( offload_pool_ == NULL ) {
+    return false;
+  }
+  Closure* const job = NewCallback(this, &ReplyCompressor::OffloadedCompress,
+                                   req, coding, done_callback);
+  if ( !offload_pool_->jobs()->Put(job, 0) ) {
+    delete job;
+    return false;
+  }
+  return true;
+}
+
+void ReplyCompressor::StopOffloading() {
+  if ( offload_pool_ == NULL ) {
+    return;
+  }
+  std::vector<Closure*> jobs;
+  offload_pool_->jobs()->GetAll(&jobs);
+  for ( size_t i = 0; i < jobs.size(); ++i ) {
+    jobs[i]->Run();
+  }
+  delete offload_pool_;
+  offload_pool_ = NULL;
+}
+
+void ReplyCompressor::OffloadedCompress(Request* req, ContentCoding coding,
+                                        Closure* done_callback) {
+  ++num_offloaded_;
+  CompressReply(req, coding);
+  done_callback->Run();
+}
+
+bool ReplyCompressor::ServeFromCache(Request* req, ContentCoding coding) {
+  const std::string key(CacheKey(req, coding));
+  if ( key.empty() ) {
+    return false;
+  }
+  {
+    synch::MutexLocker l(&cache_mutex_);
+    std::map<std::string, CacheList::iterator>::iterator
+        it = cache_map_.find(key);
+    if ( it == cache_map_.end() ) {
+      return false;
+    }
+    // Most recently used goes first
+    cache_list_.splice(cache_list_.begin(), cache_list_, it->second);
+    req->server_data()->Clear();
+    req->server_data()->AppendStreamNonDestructive(&it->second->data_);
+  }
+  ++cache_hits_;
+  SetEncodedReply(req, coding, req->server_header()->FindField(kHeaderETag));
+  return true;
+}
+
+bool ReplyCompressor::Compress(ContentCoding coding, CompressionPreset preset,
+                               io::MemoryStream* in, io::MemoryStream* out) {
+  io::Compressor* const compressor = GetCompressor(coding, preset);
+  if ( compressor == NULL ) {
+    return false;
+  }
+  const bool success = compressor->Compress(in, out);
+  ReturnCompressor(coding, preset, compressor);
+  return success;
+}
+
+void ReplyCompressor::GetStats(Stats* stats) const {
+  stats->num_compressed_ = num_compressed_;
+  stats->num_offloaded_ = num_offloaded_;
+  stats->bytes_in_ = bytes_in_;
+  stats->bytes_out_ = bytes_out_;
+  stats->cpu_ns_ = cpu_ns_;
+  stats->cache_hits_ = cache_hits_;
+  stats->cache_misses_ = cache_misses_;
+  synch::MutexLocker l(&cache_mutex_);
+  stats->cache_size_ = cache_size_;
+}
+
+std::string ReplyCompressor::Stats::ToString() const {
+  return strutil::StringPrintf(
+      "compressed: %lld (offloaded: %lld) - %lld -> %lld bytes, "
+      "%.2f ns cpu / byte, cache: %lld hits / %lld misses, %lld bytes",
+      static_cast<long long>(num_compressed_),
+      static_cast<long long>(num_offloaded_),
+      static_cast<long long>(bytes_in_),
+      static_cast<long long>(bytes_out_),
+      bytes_in_ > 0 ? static_cast<double>(cpu_ns_) / bytes_in_ : 0.0,
+      static_cast<long long>(cache_hits_),
+      static_cast<long long>(cache_misses_),
+      static_cast<long long>(cache_size_));
+}
+
+io::Compressor* ReplyCompressor::GetCompressor(ContentCoding coding,
+                                               CompressionPreset preset) {
+  {
+    synch::MutexLocker l(&pool_mutex_);
+    std::vector<io::Compressor*>& pool = pool_[coding][preset];
+    if ( !pool.empty() ) {
+      io::Compressor* const compressor = pool.back();
+      pool.pop_back();
+      return compressor;
+    }
+  }
+  const int level = CompressionLevel(coding, preset);
+  switch ( coding ) {
+    case CODING_GZIP:
+      return new io::ZlibGzipEncodeWrapper(level);
+    case CODING_DEFLATE:
+      return new io::ZlibDeflateWrapper(level);
+    case CODING_ZSTD:
+#ifdef WHISPER_HTTP_ZSTD
+      return new ZstdCompressor(level);
+#else
+      return NULL;
+#endif
+    case CODING_IDENTITY:
+      break;
+  }
+  return NULL;
+}
+
+void ReplyCompressor::ReturnCompressor(ContentCoding coding,
+                                       CompressionPreset preset,
+                                       io::Compressor* compressor) {
+  {
+    synch::MutexLocker l(&pool_mutex_);
+    std::vector<io::Compressor*>& pool = pool_[coding][preset];
+    if ( pool.size() < kMaxPooledCompressors ) {
+      pool.push_back(compressor);
+      return;
+    }
+  }
+  delete compressor;
+}
+
+std::string ReplyCompressor::CacheKey(const Request* req,
+                                      ContentCoding coding) const {
+  if ( params_.max_cache_size_ == 0 || req->url() == NULL ) {
+    return "";
+  }
+  // Only the strong validators identify the exact body
+  std::string etag;
+  if ( !req->server_header()->FindField(kHeaderETag, &etag) ||
+       etag.size() < 2 || etag[0] != '"' ) {
+    return "";
+  }
+  return strutil::StringPrintf("%s %s ", ContentCodingName(coding),
+                               req->url()->host().c_str()) +
+      req->url()->path() + " " + etag;
+}
+
+void ReplyCompressor::CacheStore(const std::string& key,
+                                 io::MemoryStream* body) {
+  const size_t size = body->Size();
+  if ( size > params_.max_cache_size_ / 4 ) {
+    return;    // would take too much of the cache
+  }
+  synch::MutexLocker l(&cache_mutex_);
+  if ( cache_map_.find(key) != cache_map_.end() ) {
+    return;    // got in meanwhile
+  }
+  while ( !cache_list_.empty() &&
+          cache_size_ + size > params_.max_cache_size_ ) {
+    const CacheEntry& last = cache_list_.back();
+    cache_size_ -= last.data_.Size();
+    cache_map_.erase(last.key_);
+    cache_list_.pop_back();
+  }
+  cache_list_.emplace_front();
+  CacheEntry& entry = cache_list_.front();
+  entry.key_ = key;
+  entry.data_.AppendStreamNonDestructive(body);
+  cache_map_[key] = cache_list_.begin();
+  cache_size_ += size;
+}
+
+void ReplyCompressor::SetEncodedReply(Request* req, ContentCoding coding,
+                                      const std::string& etag) {
+  Header* const hs = req->server_header();
+  hs->SetContentEncoding(ContentCodingName(coding));
+  AddVaryAcceptEncoding(hs);
+  // A different representation needs a different (strong) validator
+  if ( etag.size() >= 2 && etag[0] == '"' &&
+       etag[etag.size() - 1] == '"' ) {
+    hs->AddField(kHeaderETag,
+                 etag.substr(0, etag.size() - 1) + "-" +
+                 ContentCodingName(coding) + "\"", true);
+  }
+  req->set_server_data_encoded(true);
+}
+
+}  // namespace http
+}  // namespace whisper
@@ -0,0 +1,232 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Compression of the HTTP replies, shared by all the requests of a server:
+// negotiates the content coding w/ the client (Accept-Encoding), skips the
+// bodies that are too small / large or of an incompressible type, and
+// compresses the rest w/ pooled (reused) zlib / zstd streams - in the
+// calling thread, or in a few offload threads, for the large bodies, to
+// keep them off the network threads.
+// The replies w/ a (strong) ETag are compressed once, at the best preset,
+// and served from a cache afterwards.
+//
+// zstd is available only when whisperlib is built w/ libzstd
+// (HAVE_LIBZSTD).
+//
+#ifndef __WHISPERLIB_HTTP_HTTP_COMPRESSION_H__
+#define __WHISPERLIB_HTTP_HTTP_COMPRESSION_H__
+
+#include <atomic>
+#include <list>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/callback.h"
+#include "whisperlib/http/http_consts.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/io/zlib/zlibwrapper.h"
+#include "whisperlib/sync/mutex.h"
+#include "whisperlib/sync/thread_pool.h"
+
+namespace whisper {
+namespace http {
+
+class Header;
+class Request;
+
+enum ContentCoding {
+  CODING_IDENTITY,
+  CODING_GZIP,
+  CODING_DEFLATE,
+  CODING_ZSTD,
+};
+static const size_t kNumContentCodings = CODING_ZSTD + 1;
+// The name of the coding, as in Content-Encoding
+const char* ContentCodingName(ContentCoding coding);
+
+// How hard we try - from the cheapest to the densest, a la the brotli
+// quality levels. Each maps to a level of each coding (see
+// CompressionLevel).
+enum CompressionPreset {
+  COMPRESSION_FASTEST,
+  COMPRESSION_FAST,
+  COMPRESSION_DEFAULT,
+  COMPRESSION_BEST,
+};
+static const size_t kNumCompressionPresets = COMPRESSION_BEST + 1;
+const char* CompressionPresetName(CompressionPreset preset);
+// The zlib / zstd compression level for a preset (0 for identity)
+int CompressionLevel(ContentCoding coding, CompressionPreset preset);
+
+struct CompressionParams {
+  CompressionParams();
+
+  // Preset for the replies compressed on the fly
+  CompressionPreset preset_;
+  // Preset for the cached replies (compressed once, served many times)
+  CompressionPreset cache_preset_;
+  // Bodies under this size are sent as they are (compression does not
+  // pay for them), and so are the ones over max_size_ (0 - no limit)
+  size_t min_size_;
+  size_t max_size_;
+  // Bodies of at least this size are compressed in the offload threads
+  // (0 - we compress everything in the calling thread)
+  size_t offload_min_size_;
+  size_t num_offload_threads_;
+  // At most these many bodies wait for an offload thread - over this we
+  // compress in the calling thread.
+  size_t max_queued_offloads_;
+  // Use zstd, if the client accepts it and we have it
+  bool enable_zstd_;
+  // How many bytes of compressed bodies we cache (0 - no cache)
+  size_t max_cache_size_;
+  // Prefixes of the content types we compress (case insensitive)
+  std::vector<std::string> content_types_;
+};
+
+class ReplyCompressor {
+ public:
+  explicit ReplyCompressor(const CompressionParams& params);
+  ~ReplyCompressor();
+
+  const CompressionParams& params() const { return params_; }
+
+  // If the content of this type is worth compressing
+  bool IsCompressibleType(const std::string& content_type) const;
+
+  // Returns the coding for a reply body of this size, w/ the content type
+  // in server_header, to a client that sent client_header - the one the
+  // client prefers (by q value), or CODING_IDENTITY for none.
+  ContentCoding SelectCoding(const Header& client_header,
+                             const Header& server_header,
+                             size_t size) const;
+
+  // Prepares the reply of req w/ status for compression: adds the Vary
+  // field for the compressible types, and returns the coding to use
+  // for the body (CODING_IDENTITY if none). A cached reply is served here,
+  // also w/ CODING_IDENTITY returned.
+  // Unless the request has its gzip encoding turned off, this marks the
+  // request body as encoded (i.e. the request does not compress it
+  // anymore - see Request::server_data_encoded).
+  ContentCoding PrepareReply(Request* req, HttpReturnCode status);
+
+  // Compresses the reply body of req w/ coding, and sets the
+  // Content-Encoding (and the ETag) accordingly.
+  // Can be called from any thread (one at a time for a request).
+  void CompressReply(Request* req, ContentCoding coding);
+
+  // If the reply body of this size should be compressed by the offload
+  // threads
+  bool ShouldOffload(size_t size) const {
+    return offload_pool_ != NULL && size >= params_.offload_min_size_;
+  }
+  // Compresses the reply body of req (CompressReply) in an offload thread,
+  // then runs done_callback there. Returns false if the offload threads
+  // are too busy (done_callback is not used).
+  bool OffloadReply(Request* req, ContentCoding coding,
+                    Closure* done_callback);
+  // Compresses in this thread the replies still waiting for an offload
+  // thread, waits for the ones in process and stops the offload threads.
+  // Nothing is offloaded afterwards.
+  void StopOffloading();
+
+  // Looks up the cache for the reply body of req, compressed w/ coding
+  // (we need an ETag in the server header). On a hit we set the body
+  // and the header fields and return true.
+  bool ServeFromCache(Request* req, ContentCoding coding);
+
+  // Compresses all of in and appends it to out (w/ pooled streams).
+  // Returns false for unavailable codings or errors (in may be consumed).
+  bool Compress(ContentCoding coding, CompressionPreset preset,
+                io::MemoryStream* in, io::MemoryStream* out);
+
+  struct Stats {
+    int64 num_compressed_;     // bodies we compressed
+    int64 num_offloaded_;      // .. of which in the offload threads
+    int64 bytes_in_;           // what we compressed ..
+    int64 bytes_out_;          // .. and what we got
+    int64 cpu_ns_;             // thread cpu time spent compressing
+    int64 cache_hits_;
+    int64 cache_misses_;
+    int64 cache_size_;         // bytes in the cache now
+    std::string ToString() const;
+  };
+  void GetStats(Stats* stats) const;
+
+ private:
+  // Gets / returns a compressor from / to the pool of coding and preset
+  io::Compressor* GetCompressor(ContentCoding coding,
+                                CompressionPreset preset);
+  void ReturnCompressor(ContentCoding coding, CompressionPreset preset,
+                        io::Compressor* compressor);
+  // Cache key for the reply of req in coding ("" - not cacheable)
+  std::string CacheKey(const Request* req, ContentCoding coding) const;
+  void CacheStore(const std::string& key, io::MemoryStream* body);
+  // Sets the header fields for a reply compressed w/ coding
+  static void SetEncodedReply(Request* req, ContentCoding coding,
+                              const std::string& etag);
+  void OffloadedCompress(Request* req, ContentCoding coding,
+                         Closure* done_callback);
+
+  const CompressionParams params_;
+  thread::ThreadPool* offload_pool_;
+
+  // Idle compressors - per coding and preset
+  synch::Mutex pool_mutex_;
+  std::vector<io::Compressor*> pool_[kNumContentCodings]
+                                    [kNumCompressionPresets];
+
+  // Compressed bodies (w/ their ETag), in LRU order (most recent first)
+  struct CacheEntry {
+    std::string key_;
+    io::MemoryStream data_;
+  };
+  typedef std::list<CacheEntry> CacheList;
+  mutable synch::Mutex cache_mutex_;
+  CacheList cache_list_;
+  std::map<std::string, CacheList::iterator> cache_map_;
+  size_t cache_size_;
+
+  std::atomic<int64> num_compressed_;
+  std::atomic<int64> num_offloaded_;
+  std::atomic<int64> bytes_in_;
+  std::atomic<int64> bytes_out_;
+  std::atomic<int64> cpu_ns_;
+  std::atomic<int64> cache_hits_;
+  std::atomic<int64> cache_misses_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ReplyCompressor);
+};
+
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_HTTP_COMPRESSION_H__
@@ -29,9 +29,12 @@
 //
 // Author: Catalin Popescu
 
+#include <string.h>
+#include <strings.h>
 #include <time.h>
 #include "whisperlib/http/http_header.h"
 #include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/io/buffer/data_block.h"
 #include "whisperlib/base/core_errno.h"
 #include "whisperlib/base/strutil.h"
 #include "whisperlib/io/util/base64.h"
@@ -40,6 +43,104 @@ using namespace std;
 
 namespace whisper {
 namespace http {
+
+HeaderFields::HeaderFields() {
+  // most headers fit in here - and we keep the space between uses
+  fields_.reserve(32);
+}
+HeaderFields::~HeaderFields() {
+  Clear();
+}
+
+uint32 HeaderFields::Hash(const char* name, size_t name_size) {
+  // FNV-1a over the lowercased name
+  uint32 hash = 2166136261U;
+  for ( size_t i = 0; i < name_size; ++i ) {
+    hash ^= static_cast<uint8>(name[i]) | 0x20;
+    hash *= 16777619U;
+  }
+  return hash;
+}
+
+const HeaderFields::Field* HeaderFields::Find(const char* name,
+                                              size_t name_size) const {
+  const uint32 hash = Hash(name, name_size);
+  for ( size_t i = 0; i < fields_.size(); ++i ) {
+    const Field& field = fields_[i];
+    if ( field.hash_ == hash && field.name_size_ == name_size &&
+         strncasecmp(field.name_, name, name_size) == 0 ) {
+      return &field;
+    }
+  }
+  return NULL;
+}
+
+void HeaderFields::Add(const char* name, size_t name_size,
+                       const char* value, size_t value_size,
+                       bool copy, bool normalize_name) {
+  Field field;
+  field.name_ = copy ? Copy(name, name_size) : name;
+  field.name_size_ = name_size;
+  field.value_ = copy ? Copy(value, value_size) : value;
+  field.value_size_ = value_size;
+  field.hash_ = Hash(name, name_size);
+  field.normalize_name_ = normalize_name;
+  fields_.push_back(field);
+}
+
+void HeaderFields::SetValue(const Field* field,
+                            const char* value, size_t value_size) {
+  Field* const f = mutable_field(field);
+  f->value_ = Copy(value, value_size);
+  f->value_size_ = value_size;
+}
+
+void HeaderFields::AppendValue(const Field* field, const char* separator,
+                               const char* value, size_t value_size) {
+  Field* const f = mutable_field(field);
+  copies_.push_back(std::string());
+  std::string& s = copies_.back();
+  const size_t separator_size = strlen(separator);
+  s.reserve(f->value_size_ + separator_size + value_size);
+  s.append(f->value_, f->value_size_);
+  s.append(separator, separator_size);
+  s.append(value, value_size);
+  f->value_ = s.data();
+  f->value_size_ = s.size();
+}
+
+bool HeaderFields::Erase(const char* name, size_t name_size) {
+  const Field* const field = Find(name, name_size);
+  if ( field == NULL ) {
+    return false;
+  }
+  fields_.erase(fields_.begin() + (field - &fields_[0]));
+  return true;
+}
+
+void HeaderFields::Pin(io::DataBlock* block) {
+  if ( blocks_.empty() || blocks_.back() != block ) {
+    block->IncRef();
+    blocks_.push_back(block);
+  }
+}
+
+const char* HeaderFields::Copy(const char* data, size_t size) {
+  copies_.push_back(std::string(data, size));
+  return copies_.back().data();
+}
+
+void HeaderFields::Clear() {
+  fields_.clear();
+  copies_.clear();
+  for ( size_t i = 0; i < blocks_.size(); ++i ) {
+    blocks_[i]->DecRef();
+  }
+  blocks_.clear();
+}
+
+//////////////////////////////////////////////////////////////////////
+
 Header::Header(bool is_strict)
   : is_strict_(is_strict) {
   Clear();
@@ -51,8 +152,10 @@ void Header::Clear() {
   bytes_parsed_ = 0;
   parse_error_ = READ_INIT;
   last_parse_error_ = READ_INIT;
-  crt_parsing_field_name_.clear();
-  crt_parsing_field_content_.clear();
+  crt_parsing_field_name_ = NULL;
+  crt_parsing_field_name_size_ = 0;
+  crt_parsing_field_content_ = NULL;
+  crt_parsing_field_content_size_ = 0;
 
   http_version_ = VERSION_UNKNOWN;
   method_ = METHOD_UNKNOWN;
@@ -61,7 +164,7 @@ void Header::Clear() {
   reason_.clear();
   first_line_type_ = UNKNOWN_LINE;
 
-  fields_.clear();
+  fields_.Clear();
   verbatim_.clear();
 }
 
@@ -118,6 +221,25 @@ string Header::NormalizeFieldName(const char* field_name, size_t len) {
   return s;
 }
 
+bool Header::IsNormalizedFieldName(const char* field_name, size_t len) {
+  bool should_upcase = true;
+  for ( size_t i = 0; i < len; ++i ) {
+    const char c = field_name[i];
+    if ( isalpha(c) ) {
+      if ( should_upcase ? islower(c) : isupper(c) ) {
+        return false;
+      }
+      should_upcase = false;
+    } else {
+      if ( IsWhiteSpace(c) || IsLwfChar(c) ) {
+        return false;
+      }
+      should_upcase = true;
+    }
+  }
+  return true;
+}
+
 void Header::PrepareStatusLine(HttpReturnCode code,
                                HttpVersion version) {
   first_line_type_ = STATUS_LINE;
@@ -142,27 +264,32 @@ bool Header::AddField(const char* field_name, size_t field_name_len,
        !IsValidFieldContent(field_content, field_content_len) ) {
     return false;
   }
-  string normalized_name(as_is ?
-      NormalizeFieldName(field_name, field_name_len) :
-      string(field_name, field_name_len));
-  const FieldMap::iterator it = fields_.find(normalized_name);
-  if ( it == fields_.end() ) {
-    fields_.insert(make_pair(normalized_name, string(field_content)));
-  } else if ( replace || it->second.empty() ) {
-    it->second = field_content;
+  string normalized_name;
+  if ( as_is ) {
+    normalized_name = NormalizeFieldName(field_name, field_name_len);
+    field_name = normalized_name.data();
+    field_name_len = normalized_name.size();
+  }
+  const HeaderFields::Field* const field =
+      fields_.Find(field_name, field_name_len);
+  if ( field == NULL ) {
+    fields_.Add(field_name, field_name_len,
+                field_content, field_content_len, true, false);
+  } else if ( replace || field->value_size() == 0 ) {
+    fields_.SetValue(field, field_content, field_content_len);
   } else {
-    it->second += ", ";
-    it->second += field_content;
+    fields_.AppendValue(field, ", ", field_content, field_content_len);
   }
   return true;
 }
 
 // Removes the field alltogether from the field map
 bool Header::ClearField(const char* field_name, size_t len, bool as_is) {
-  string normalized_name(as_is ?
-      NormalizeFieldName(field_name, len) :
-      string(field_name, len));
-  return fields_.erase(normalized_name) > 0;
+  if ( as_is ) {
+    const string normalized_name(NormalizeFieldName(field_name, len));
+    return fields_.Erase(normalized_name.data(), normalized_name.size());
+  }
+  return fields_.Erase(field_name, len);
 }
 
 bool Header::IsValidFieldName(const char* field_name, size_t len) {
@@ -193,9 +320,14 @@ bool Header::IsValidFieldContent(const char* field_content, size_t len) {
 
 size_t Header::CopyHeaderFields(const Header& src, bool replace) {
   size_t num = 0;
-  for ( FieldMap::const_iterator it = src.fields().begin();
+  for ( HeaderFields::const_iterator it = src.fields().begin();
         it != src.fields().end(); ++it ) {
-    if ( AddField(it->first, it->second, replace) ) {
+    // parsed fields get their normalized name (as in the header we compose)
+    const string name(it->normalize_name()
+                      ? NormalizeFieldName(it->name(), it->name_size())
+                      : it->name_str());
+    if ( AddField(name.data(), name.size(),
+                  it->value(), it->value_size(), replace) ) {
       ++num;
     }
   }
@@ -216,21 +348,27 @@ size_t Header::CopyHeaders(const Header& src, bool replace) {
 
 const char* Header::FindField(const string& field_name,
                               size_t* len) const {
-  const FieldMap::const_iterator it = fields_.find(field_name);
-  if ( it == fields_.end() ) {
+  const HeaderFields::Field* const field =
+      fields_.Find(field_name.data(), field_name.size());
+  if ( field == NULL ) {
     return NULL;
   }
-  *len = it->second.size();
-  return it->second.data();
+  *len = field->value_size();
+  return field->value();
 }
 
 void Header::AppendToStream(io::MemoryStream* io) const {
   io->Write(ComposeFirstLine());
-  for ( FieldMap::const_iterator it = fields_.begin();
+  for ( HeaderFields::const_iterator it = fields_.begin();
         it != fields_.end(); ++it ) {
-    io->Write(it->first);
+    if ( it->normalize_name() &&
+         !IsNormalizedFieldName(it->name(), it->name_size()) ) {
+      io->Write(NormalizeFieldName(it->name(), it->name_size()));
+    } else {
+      io->Write(it->name(), it->name_size());
+    }
     io->Write(": ");
-    io->Write(it->second);
+    io->Write(it->value(), it->value_size());
     io->Write("\r\n");
   }
   if ( !verbatim_.empty() ) {
@@ -397,72 +535,161 @@ void Header::ParseStatusCode(const string& status_code_str) {
 
 bool Header::AddCrtParsingData() {
   bool ret = true;
-  if ( !crt_parsing_field_name_.empty() ) {
-    if ( !IsValidFieldName(crt_parsing_field_name_) ||
-         !IsValidFieldContent(crt_parsing_field_content_) ) {
+  if ( crt_parsing_field_name_size_ > 0 ) {
+    if ( !IsValidFieldName(crt_parsing_field_name_,
+                           crt_parsing_field_name_size_) ||
+         !IsValidFieldContent(crt_parsing_field_content_,
+                              crt_parsing_field_content_size_) ) {
       set_parse_error(READ_BAD_FIELD_SPEC);
       ret = false;
     }
     if ( !is_strict_ || ret ) {
-      string normalized_name(
-        NormalizeFieldName(crt_parsing_field_name_));
-      const FieldMap::iterator it = fields_.find(normalized_name);
-      if ( it == fields_.end() ) {
-        fields_.insert(make_pair(normalized_name,
-                                 crt_parsing_field_content_));
+      const char* name = crt_parsing_field_name_;
+      size_t name_size = crt_parsing_field_name_size_;
+      // Names w/ blanks are looked up by their normalized version
+      // (the case does not matter for lookups)
+      for ( size_t i = 0; i < name_size; ++i ) {
+        if ( IsWhiteSpace(name[i]) || IsLwfChar(name[i]) ) {
+          const string normalized_name(NormalizeFieldName(name, name_size));
+          name = fields_.Copy(normalized_name.data(), normalized_name.size());
+          name_size = normalized_name.size();
+          break;
+        }
+      }
+      const HeaderFields::Field* const field = fields_.Find(name, name_size);
+      if ( field == NULL ) {
+        fields_.Add(name, name_size,
+                    crt_parsing_field_content_,
+                    crt_parsing_field_content_size_,
+                    false, true);
       } else {
-        it->second.append(", ");
-        it->second.append(crt_parsing_field_content_);
+        fields_.AppendValue(field, ", ",
+                            crt_parsing_field_content_,
+                            crt_parsing_field_content_size_);
       }
     }
   }
-  crt_parsing_field_name_.clear();
-  crt_parsing_field_content_.clear();
+  crt_parsing_field_name_ = NULL;
+  crt_parsing_field_name_size_ = 0;
+  crt_parsing_field_content_ = NULL;
+  crt_parsing_field_content_size_ = 0;
   return ret;
 }
 
+bool Header::ParseFieldLine(const char* line, size_t size) {
+  if ( size == 0 ) {
+    // The last empty line w/ CRLF
+    if ( AddCrtParsingData() )
+      set_parse_error(READ_OK);
+    return true;
+  }
+  // Is a continuation header ?
+  size_t lwf_end = 0;
+  while ( lwf_end < size && IsLwfChar(line[lwf_end]) )
+    ++lwf_end;
+  if ( lwf_end > 0 ) {
+    // Continuation field
+    if ( crt_parsing_field_name_size_ == 0 ) {
+      // continuation w/ no previous field - discard
+      set_parse_error(READ_NO_FIELD);
+    } else {
+      // continue field content.. (rare enough to just copy)
+      string content(crt_parsing_field_content_,
+                     crt_parsing_field_content_size_);
+      content.append(" ");
+      content.append(line + lwf_end, size - lwf_end);
+      crt_parsing_field_content_ = fields_.Copy(content.data(),
+                                                content.size());
+      crt_parsing_field_content_size_ = content.size();
+    }
+    return false;
+  }
+  // Save whatever is in for us ..
+  AddCrtParsingData();
+  // Parse the current line ..
+  const char* const colon =
+      reinterpret_cast<const char*>(memchr(line, ':', size));
+  if ( colon == NULL ) {
+    set_parse_error(READ_NO_FIELD);
+    return false;
+  }
+  crt_parsing_field_name_ = line;
+  crt_parsing_field_name_size_ = colon - line;
+  // Pass over leading spaces before field content ..
+  const char* content = colon + 1;
+  const char* const end = line + size;
+  while ( content < end && IsLwfChar(*content) )
+    ++content;
+  crt_parsing_field_content_ = content;
+  crt_parsing_field_content_size_ = end - content;
+  return false;
+}
+
+// Returns the CRLF that ends the line starting at p (NULL if none before
+// end). memchr is the fastest scanner around (glibc picks a SSE2 / AVX2 /
+// EVEX version at runtime).
+static const char* FindCRLF(const char* p, const char* end) {
+  const char* q = p;
+  while ( q < end ) {
+    const char* const lf =
+        reinterpret_cast<const char*>(memchr(q, '\n', end - q));
+    if ( lf == NULL ) {
+      return NULL;
+    }
+    if ( lf > p && *(lf - 1) == '\r' ) {
+      return lf - 1;
+    }
+    q = lf + 1;
+  }
+  return NULL;
+}
+
 bool Header::ReadHeaderFields(io::MemoryStream* io) {
-  string line;
-  while ( io->ReadCRLFLine(&line) ) {
-    DCHECK_GE(line.size(), 2);  // at least CRLF
-    bytes_parsed_ += line.size();
-    // Cut the last CRLF
-    line.resize(line.size() - 2);
-
-    // Process the line:
-    if ( line.empty() ) {
-      // The last empty line w/ CRLF
-      if ( AddCrtParsingData() )
-        set_parse_error(READ_OK);
+  while ( true ) {
+    io::BlockSize pos = 0;
+    io::DataBlock* const block = io->PeekReadBlock(&pos);
+    if ( block == NULL ) {
+      break;
+    }
+    // Parse in place all the lines that are entirely in this block
+    const char* const begin = block->is_file_region()
+                              ? NULL : block->buffer() + pos;
+    const char* const end = block->is_file_region()
+                            ? NULL : block->buffer() + block->size();
+    const char* p = begin;
+    bool done = false;
+    while ( p < end ) {
+      const char* const crlf = FindCRLF(p, end);
+      if ( crlf == NULL ) {
+        break;
+      }
+      if ( p == begin ) {
+        fields_.Pin(block);
+      }
+      bytes_parsed_ += crlf + 2 - p;
+      done = ParseFieldLine(p, crlf - p);
+      p = crlf + 2;
+      if ( done ) {
+        break;
+      }
+    }
+    if ( p > begin ) {
+      io->Skip(p - begin);
+    }
+    if ( done ) {
       return true;
     }
-    // Is a continuation header ?
-    size_t lwf_end = 0;
-    while ( IsLwfChar(line[lwf_end]) )
-      ++lwf_end;
-    if ( lwf_end > 0 ) {
-      // Continuation field
-      if ( crt_parsing_field_name_.empty() ) {
-        // continuation w/ no previous field - discard
-        set_parse_error(READ_NO_FIELD);
-      } else {
-        // continue field content..
-        crt_parsing_field_content_.append(" ");
-        crt_parsing_field_content_.append(line.substr(lwf_end));
+    if ( p < end || begin == NULL ) {
+      // This line continues in the next blocks (or is incomplete) - copy it
+      string line;
+      if ( !io->ReadCRLFLine(&line) ) {
+        break;
       }
-    } else {
-      // Save whatever is in for us ..
-      AddCrtParsingData();
-      // Parse the current line ..
-      size_t field_pos = line.find(':');
-      if ( field_pos == string::npos ) {
-        set_parse_error(READ_NO_FIELD);
-      } else {
-        crt_parsing_field_name_ = line.substr(0, field_pos++);
-        // Pass over leading spaces before field content ..
-        while ( IsLwfChar(line[field_pos]) )
-          ++field_pos;
-        crt_parsing_field_content_ = line.substr(field_pos);
+      DCHECK_GE(line.size(), 2);  // at least CRLF
+      bytes_parsed_ += line.size();
+      const size_t size = line.size() - 2;
+      if ( ParseFieldLine(fields_.Copy(line.data(), size), size) ) {
+        return true;
       }
     }
   }
@@ -495,13 +722,13 @@ static const char* kHttpDateFormatsGetOsX[] = {
 
 
 time_t Header::GetDateField(const char* field_name) {
-  size_t len;
-  const char* s = FindField(field_name, &len);
-  if ( !s ) {
+  string value;   // our values are not NUL terminated
+  if ( !FindField(field_name, &value) ) {
     return time_t(0);
   }
-  if ( *(s+len) != '\0' )
+  if ( strlen(value.c_str()) != value.size() )
     return time_t(0);
+  const char* s = value.c_str();
 #ifdef MACOSX
   for ( size_t i = 0; i < NUMBEROF(kHttpDateFormats); ++i ) {
       struct tm t;
@@ -536,13 +763,34 @@ bool Header::SetDateField(const string& field_name, time_t t) {
   return AddField(field_name, string(buffer), true);
 }
 
+const string& Header::CachedDate(time_t t) {
+  static thread_local time_t tls_date_time = -1;
+  static thread_local string tls_date;
+  if ( t != tls_date_time ) {
+    char buffer[128];
+    struct tm tstruct;
+    if ( NULL != gmtime_r(&t, &tstruct) &&
+         strftime(buffer, sizeof(buffer), kHttpDateFormats[0], &tstruct) ) {
+      tls_date = buffer;
+    } else {
+      tls_date.clear();
+    }
+    tls_date_time = t;
+  }
+  return tls_date;
+}
+
 bool Header::GetAuthorizationField(string* user, string* passwd) {
-  size_t len;
-  const char* s = FindField(kHeaderAuthorization, &len);
-  if ( !s || len == 0 ) {
+  string value;   // our values are not NUL terminated
+  if ( !FindField(kHeaderAuthorization, &value) || value.empty() ) {
     return false;
   }
+  const char* s = value.c_str();
+  size_t len = value.size();
   const char* p = strchr(strutil::StrFrontTrim(s), ' ');
+  if ( p == NULL ) {
+    return false;
+  }
   len -= p - s;
   char* const decoded_field = new char[len];
   base64::Decoder decoder;
@@ -697,11 +945,11 @@ bool Header::IsDeflateAcceptableEncoding() const {
 }
 
 bool Header::IsZippableContentType() const {
-  size_t len;
-  const char* s = FindField(kHeaderContentType, &len);
-  if ( !s ) {
+  string value;
+  if ( !FindField(kHeaderContentType, &value) ) {
     return false;
   }
+  const char* s = value.c_str();
   if ( strutil::StrCasePrefix(s, "text/") )
     return true;
   if ( strutil::StrCasePrefix(s, "application/") )
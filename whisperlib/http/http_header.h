@@ -34,7 +34,8 @@
 #define __NET_HTTP_HTTP_HEADER_H__
 
 #include <string>
-#include <map>
+#include <deque>
+#include <vector>
 #include <algorithm>
 
 #include "whisperlib/base/types.h"
@@ -70,15 +71,96 @@
 //
 
 namespace whisper {
-namespace io { class MemoryStream; }
+namespace io { class MemoryStream; class DataBlock; }
 
 namespace http {
+
+// The fields of a Header - a flat table, in the order in which the fields
+// were added, looked up case insensitive by a precomputed hash (for the
+// usual 5 - 30 fields a scan beats any map).
+// The fields of a parsed header point directly into the data blocks of the
+// parsed stream, which we keep referenced until Clear(). Fields added or
+// changed afterwards are copied into strings owned by the table.
+class HeaderFields {
+ public:
+  class Field {
+   public:
+    // NOTE: name and value are *not* NUL terminated
+    const char* name() const { return name_; }
+    size_t name_size() const { return name_size_; }
+    const char* value() const { return value_; }
+    size_t value_size() const { return value_size_; }
+    std::string name_str() const { return std::string(name_, name_size_); }
+    std::string value_str() const { return std::string(value_, value_size_); }
+    // If the name should be passed through Header::NormalizeFieldName
+    // when composing the header
+    bool normalize_name() const { return normalize_name_; }
+   private:
+    const char* name_;
+    size_t name_size_;
+    const char* value_;
+    size_t value_size_;
+    uint32 hash_;
+    bool normalize_name_;
+    friend class HeaderFields;
+  };
+  typedef std::vector<Field>::const_iterator const_iterator;
+
+  HeaderFields();
+  ~HeaderFields();
+
+  const_iterator begin() const { return fields_.begin(); }
+  const_iterator end() const { return fields_.end(); }
+  size_t size() const { return fields_.size(); }
+  bool empty() const { return fields_.empty(); }
+
+  // Returns the field w/ the given name (case insensitive), NULL if none
+  const Field* Find(const char* name, size_t name_size) const;
+
+  // Adds a field w/o looking for an existing one w/ the same name.
+  // If copy is set we copy name and value, else they must stay valid
+  // until Clear().
+  void Add(const char* name, size_t name_size,
+           const char* value, size_t value_size,
+           bool copy, bool normalize_name);
+  // Replaces the value of a field (w/ a copy of value)
+  void SetValue(const Field* field, const char* value, size_t value_size);
+  // Appends separator + value to the value of a field (in a copy)
+  void AppendValue(const Field* field, const char* separator,
+                   const char* value, size_t value_size);
+  // Removes the field w/ the given name. Returns false if none.
+  bool Erase(const char* name, size_t name_size);
+
+  // Keeps a reference to block until Clear() (for fields pointing into it)
+  void Pin(io::DataBlock* block);
+  // Returns a copy of the data that stays valid until Clear()
+  const char* Copy(const char* data, size_t size);
+
+  // Removes all fields, releases our copies and blocks
+  void Clear();
+
+  // Case insensitive hash of a field name
+  static uint32 Hash(const char* name, size_t name_size);
+
+ private:
+  Field* mutable_field(const Field* field) {
+    return &fields_[field - &fields_[0]];
+  }
+
+  std::vector<Field> fields_;
+  // Copied names / values (a deque does not move them around)
+  std::deque<std::string> copies_;
+  // Data blocks that our fields may point into
+  std::vector<io::DataBlock*> blocks_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(HeaderFields);
+};
+
 class Header {
  public:
   explicit Header(bool is_strict = true);
   ~Header();
 
-  typedef std::map<std::string, std::string> FieldMap;
   // Errors that can appear during parsing. They are more severe as
   // the number increases.
   // In general we can continue parsing in all states, however
@@ -124,7 +206,7 @@ class Header {
   ParseError last_parse_error() const { return last_parse_error_; }
 
   // Direct access to fields
-  const FieldMap& fields() const { return fields_; }
+  const HeaderFields& fields() const { return fields_; }
 
   // Things that can appear in the first line..
   HttpVersion http_version() const { return http_version_; }
@@ -205,36 +287,40 @@ class Header {
   static std::string NormalizeFieldName(const std::string& field_name) {
     return NormalizeFieldName(field_name.data(), field_name.size());
   }
+  // Returns true if NormalizeFieldName would leave the name unchanged
+  static bool IsNormalizedFieldName(const char* field_name, size_t len);
 
-  // Field lookup function - in two flavours:
+  // Field lookup function (field names are case insensitive) - in two
+  // flavours:
   // const char* returns NULL on not found (watch out this version as
   //    returns a pointer to the internal buffer, which may go away
-  //    at the very next non-const call !).
+  //    at the very next non-const call, and is *not* NUL terminated !).
   // string* one returns false and makes a copy.
   const char* FindField(const std::string& field_name, size_t* len) const;
   bool FindField(const std::string& field_name, std::string* field_content) const {
-    const FieldMap::const_iterator it = fields_.find(field_name);
-    if ( it == fields_.end() ) {
+    const HeaderFields::Field* const field =
+        fields_.Find(field_name.data(), field_name.size());
+    if ( field == NULL ) {
       return false;
     }
-    *field_content = it->second;
+    field_content->assign(field->value(), field->value_size());
     return true;
   }
   // A more natural field getting - here returns "" if not found by
   // default
   std::string FindField(const std::string& field_name) const {
-    const FieldMap::const_iterator it = fields_.find(field_name);
-    if ( it == fields_.end() ) {
+    const HeaderFields::Field* const field =
+        fields_.Find(field_name.data(), field_name.size());
+    if ( field == NULL ) {
       return "";
     }
-    return it->second;
+    return field->value_str();
   }
 
 
   // Just confirms the field existence
   bool HasField(const std::string& field_name) const {
-    const FieldMap::const_iterator it = fields_.find(field_name);
-    return it != fields_.end();
+    return fields_.Find(field_name.data(), field_name.size()) != NULL;
   }
 
   // Copies the fields from the source Header object to this one,
@@ -270,9 +356,10 @@ class Header {
 
   // Reads the next header fields. Returns true when we are at the end of
   // the headers. May set in the meantime parsing_error and saves a number
-  // of encountered fields into the fields_ map. The read pointer in io
+  // of encountered fields into the fields_ table. The read pointer in io
   // will be set after the headers, or advanced to the point where some
   // fields are processed.
+  // The fields are not copied out of io - we reference its data blocks.
   // Can be used to read some fields without a leading line (like the fields
   // which may appear at teh end of a chunked transfer.
   bool ReadHeaderFields(io::MemoryStream* io);
@@ -318,6 +405,11 @@ class Header {
   // Adds a properly formatted date in the corresponding field
   bool SetDateField(const std::string& field_name, time_t t);
 
+  // Returns t formatted for a date field. The value is cached in each
+  // thread and formatted again only when t changes - i.e. at most once per
+  // second, for the Date field of the replies.
+  static const std::string& CachedDate(time_t t);
+
   // Checks ig the header includes a Authorization: header, and if it does,
   // decodes the user and password and sets them in the specific parameters.
   // Returns: true if the header includs the Authorization header
@@ -383,6 +475,9 @@ class Header {
   void ParseStatusCode(const std::string& status_code_str);
   // Appends the current intermediate values as a field name.
   bool AddCrtParsingData();
+  // Processes a header line (w/o the CRLF), that stays valid until Clear().
+  // Returns true on the last (empty) line.
+  bool ParseFieldLine(const char* line, size_t size);
 
   // If this is on we refuse a bunch of field name/values. Else, we are more
   // permissive
@@ -394,9 +489,12 @@ class Header {
   // The error encountered in the last call to Parse* functions
   ParseError last_parse_error_;
 
-  // Intermadiate values for
-  std::string crt_parsing_field_name_;
-  std::string crt_parsing_field_content_;
+  // Intermadiate values for the field in parsing (it can continue on the
+  // next lines) - they point into data that is in fields_ custody.
+  const char* crt_parsing_field_name_;
+  size_t crt_parsing_field_name_size_;
+  const char* crt_parsing_field_content_;
+  size_t crt_parsing_field_content_size_;
 
   // Things that can appear in the first line..
   HttpVersion http_version_;
@@ -409,7 +507,7 @@ class Header {
   FirstLineType first_line_type_;
 
   // Field name -> field content stuff
-  FieldMap fields_;
+  HeaderFields fields_;
 
   // A verbatim text that we can add at the end of headers
   std::string verbatim_;
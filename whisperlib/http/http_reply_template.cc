@@ -0,0 +1,103 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <string.h>
+#include "whisperlib/http/http_reply_template.h"
+#include "whisperlib/http/http_request.h"
+#include "whisperlib/base/strutil.h"
+
+namespace whisper {
+namespace http {
+
+// The fields that we set per reply
+static const char* const kVariableFields[] = {
+  kHeaderDate,
+  kHeaderContentLength,
+  kHeaderTransferEncoding,
+  kHeaderConnection,
+  kHeaderKeepAlive,
+  kHeaderXRequestId,
+};
+
+ReplyTemplate::ReplyTemplate(HttpReturnCode status, const Header& header)
+    : status_(status),
+      header_(false) {
+  header_.CopyHeaderFields(header, true);
+  for ( size_t i = 0; i < NUMBEROF(kVariableFields); ++i ) {
+    header_.ClearField(kVariableFields[i], strlen(kVariableFields[i]));
+  }
+  header_.PrepareStatusLine(status, VERSION_1_1);
+  // All w/o the empty line at the end - the variable fields follow
+  std::string s(header_.ToString());
+  DCHECK(strutil::StrSuffix(s, "\r\n\r\n"));
+  s.resize(s.size() - 2);
+  // In one block of its own - which we share in the replies
+  char* const buffer = new char[s.size()];
+  memcpy(buffer, s.data(), s.size());
+  encoded_.AppendRaw(buffer, s.size());
+}
+
+void ReplyTemplate::AppendReply(Request* req, time_t now,
+                                bool keep_alive, int32 keep_alive_timeout_sec,
+                                const std::string& request_id,
+                                io::MemoryStream* out) const {
+  const size_t out_size = out->Size();
+  const size_t server_data_size = req->server_data()->Size();
+  out->AppendStreamNonDestructive(&encoded_);
+  std::string fields;
+  fields.reserve(128);
+  fields.append(kHeaderDate).append(": ")
+      .append(Header::CachedDate(now)).append("\r\n");
+  if ( (status_ < 100 || status_ >= 200) &&
+       status_ != NO_CONTENT &&
+       status_ != NOT_MODIFIED &&
+       req->client_header()->method() != METHOD_HEAD ) {
+    fields.append(kHeaderContentLength).append(": ")
+        .append(strutil::Int64ToString(server_data_size)).append("\r\n");
+  }
+  if ( keep_alive ) {
+    fields.append(kHeaderConnection).append(": Keep-Alive\r\n")
+        .append(kHeaderKeepAlive).append(": ")
+        .append(strutil::IntToString(keep_alive_timeout_sec)).append("\r\n");
+  } else {
+    fields.append(kHeaderConnection).append(": Close\r\n");
+  }
+  if ( !request_id.empty() ) {
+    fields.append(kHeaderXRequestId).append(": ")
+        .append(request_id).append("\r\n");
+  }
+  fields.append("\r\n");
+  out->Write(fields);
+  out->AppendStream(req->server_data());
+  req->mutable_stats()->server_raw_size_ += out->Size() - out_size;
+  req->mutable_stats()->server_size_ += server_data_size;
+}
+
+}  // namespace http
+}  // namespace whisper
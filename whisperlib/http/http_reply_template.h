@@ -0,0 +1,86 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Pre-encoded reply headers, for the hot paths of a server: the status
+// line and the fields that are the same in all the replies of a processor
+// are encoded once, in a buffer that is shared (not copied) in each reply.
+// Only the fields that change are added per reply: Date (formatted once
+// per second in each network thread), Content-Length, Connection /
+// Keep-Alive and X-Request-Id.
+//
+// Get one from Server::RegisterReplyTemplate and reply w/
+// ServerRequest::ReplyWithTemplate.
+//
+#ifndef __WHISPERLIB_HTTP_HTTP_REPLY_TEMPLATE_H__
+#define __WHISPERLIB_HTTP_HTTP_REPLY_TEMPLATE_H__
+
+#include <time.h>
+#include <string>
+#include "whisperlib/base/types.h"
+#include "whisperlib/http/http_consts.h"
+#include "whisperlib/http/http_header.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+
+namespace whisper {
+namespace http {
+
+class Request;
+
+class ReplyTemplate {
+ public:
+  // Builds the template for replies w/ the given status and the fields
+  // of header (we drop from there the fields that we add per reply).
+  ReplyTemplate(HttpReturnCode status, const Header& header);
+
+  HttpReturnCode status() const { return status_; }
+  // The fixed fields - for the replies we cannot encode from the template
+  // (e.g. to HTTP/1.0 clients, or on HTTP/2)
+  const Header& header() const { return header_; }
+  // The status line and the fixed fields, as they go on the wire
+  const io::MemoryStream& encoded() const { return encoded_; }
+
+  // Appends to out a HTTP/1.1 reply for req: the encoded part, the variable
+  // fields and the body (consumed from req->server_data()).
+  void AppendReply(Request* req, time_t now,
+                   bool keep_alive, int32 keep_alive_timeout_sec,
+                   const std::string& request_id,
+                   io::MemoryStream* out) const;
+
+ private:
+  const HttpReturnCode status_;
+  Header header_;
+  io::MemoryStream encoded_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ReplyTemplate);
+};
+
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_HTTP_REPLY_TEMPLATE_H__
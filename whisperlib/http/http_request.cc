@@ -56,6 +56,7 @@ Request::Request(bool strict_headers,
     gzip_zwrapper_(NULL),
     server_use_gzip_encoding_(true),
     server_gzip_drain_buffer_(true),
+    server_data_encoded_(false),
     compress_option_(COMPRESS_NONE) {
 }
 
@@ -145,7 +146,7 @@ void Request::AppendClientRequest(io::MemoryStream* out, int64 max_chunk_size) {
          client_header_.method() == METHOD_PUT ) {
       client_header_.AddField(
           kHeaderContentLength,
-          strutil::IntToString(source->Size()),
+          strutil::Int64ToString(source->Size()),
           true);  // replace !
     }
     VLOG(5) << "http::Request - Sending header to server: "
@@ -181,15 +182,23 @@ void Request::AppendServerReply(io::MemoryStream* out,
     server_header_.set_http_version(VERSION_1_0);
   }
   const bool zippable_content = server_header_.IsZippableContentType();
-  if ( server_use_gzip_encoding_ && zippable_content ) {
+  if ( server_data_encoded_ ) {
+    // Leave the data and Content-Encoding as they are
+    compress_option_ = COMPRESS_NONE;
+  } else if ( server_use_gzip_encoding_ && zippable_content ) {
     if ( client_header_.IsGzipAcceptableEncoding() ) {
-      delete gzip_zwrapper_;
-      gzip_zwrapper_ = new io::ZlibGzipEncodeWrapper();
+      if ( gzip_zwrapper_ == NULL ) {
+        gzip_zwrapper_ = new io::ZlibGzipEncodeWrapper();
+      }
+      gzip_state_begin_ = true;
       server_header_.SetContentEncoding("gzip");
       compress_option_ = COMPRESS_GZIP;
     } else if ( client_header_.IsDeflateAcceptableEncoding() ) {
-      delete deflate_zwrapper_;
-      deflate_zwrapper_ = new io::ZlibDeflateWrapper();
+      if ( deflate_zwrapper_ == NULL ) {
+        deflate_zwrapper_ = new io::ZlibDeflateWrapper();
+      } else {
+        deflate_zwrapper_->Reset();
+      }
       server_header_.SetContentEncoding("deflate");
       compress_option_ = COMPRESS_DEFLATE;
     } else {
@@ -242,7 +251,7 @@ void Request::AppendServerReply(io::MemoryStream* out,
          code != NOT_MODIFIED &&
          client_header_.method() != http::METHOD_HEAD) {
       server_header_.AddField(kHeaderContentLength,
-                              strutil::IntToString(source->Size()),
+                              strutil::Int64ToString(source->Size()),
                               true);  // replace !
     }
     // Append the header data and the body
@@ -381,6 +390,7 @@ RequestParser::RequestParser(
     max_body_size_(max_body_size),
     max_chunk_size_(max_chunk_size),
     max_num_chunks_(max_num_chunks),
+    max_payload_read_(-1),
     accept_wrong_method_(accept_wrong_method),
     accept_wrong_version_(accept_wrong_version),
     accept_no_content_length_(accept_no_content_length),
@@ -712,8 +722,10 @@ int32 RequestParser::ParseBodyInternal(io::MemoryStream* in,
     }
   }
   // copy the payload from in to our internal buffer.
-  const int64 to_read = min(body_size_to_read_,
-                            static_cast<int64>(in->Size()));
+  int64 to_read = min(body_size_to_read_, static_cast<int64>(in->Size()));
+  if ( max_payload_read_ > 0 && to_read > max_payload_read_ ) {
+    to_read = max_payload_read_;
+  }
   partial_data_.AppendStreamNonDestructive(in, to_read);
   in->Skip(to_read);
   body_size_to_read_ -= to_read;
@@ -825,6 +837,10 @@ int32 RequestParser::ParseBodyInternal(io::MemoryStream* in,
   }
   // CONTINUE - with the compressed body
   DCHECK_EQ(parse_state_, STATE_BODY_READING);
+  if ( body_size_to_read_ > 0 && !in->IsEmpty() ) {
+    // We stopped at max_payload_read_ - more body is waiting in input
+    return HEADER_READ | BODY_READING | CONTINUE;
+  }
   return HEADER_READ | BODY_READING;
 }
 
@@ -855,6 +871,8 @@ int32 RequestParser::ParseBodyInternal(io::MemoryStream* in,
 int32 RequestParser::ParseChunksInternal(io::MemoryStream* in,
                                          http::Header* header,
                                          io::MemoryStream* out) {
+  // How much chunk data we can still read in this call
+  int64 payload_left = max_payload_read_ > 0 ? max_payload_read_ : kMaxInt64;
   do {
     //////////////////////////////////////////////////////////////////////
     //
@@ -966,8 +984,15 @@ int32 RequestParser::ParseChunksInternal(io::MemoryStream* in,
       if ( in->IsEmpty() ) {
         return HEADER_READ | CHUNKED_BODY_READING;
       }
-      const int64 to_read = min(chunk_size_to_read_,
-                                static_cast<int64>(in->Size()));
+      if ( payload_left == 0 ) {
+        // CONTINUE - got max_payload_read_ in this call, the caller should
+        //            consume the output first
+        return HEADER_READ | CHUNKED_BODY_READING | CONTINUE;
+      }
+      const int64 to_read = min(min(chunk_size_to_read_,
+                                    static_cast<int64>(in->Size())),
+                                payload_left);
+      payload_left -= to_read;
       partial_data_.AppendStreamNonDestructive(in, to_read);
       in->Skip(to_read);
 
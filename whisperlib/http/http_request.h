@@ -151,6 +151,15 @@ class Request {
     server_use_gzip_encoding_ = use_gzip_encoding;
     server_gzip_drain_buffer_ = gzip_drain_buffer;
   }
+  // When set, server_data_ is already in its final content coding (the
+  // one in the Content-Encoding of the server header, if any) - and we
+  // send it as it is (e.g. compressed by a http::ReplyCompressor).
+  bool server_data_encoded() const {
+    return server_data_encoded_;
+  }
+  void set_server_data_encoded(bool server_data_encoded) {
+    server_data_encoded_ = server_data_encoded;
+  }
 
   // In these cases no body must be transmitted
   bool NoServerBodyTransmitted() {
@@ -212,6 +221,7 @@ class Request {
 
   bool server_use_gzip_encoding_;
   bool server_gzip_drain_buffer_;
+  bool server_data_encoded_;
   enum CompressOption {
     COMPRESS_NONE,
     COMPRESS_GZIP,
@@ -400,6 +410,13 @@ class RequestParser {
   void set_max_body_size(int64 max_body_size) {
     max_body_size_ = max_body_size;
   }
+  // Bounds the payload (body / chunk data) we take from the input in one
+  // Parse call (<= 0 => no limit). When we stop because of this we return
+  // CONTINUE, so the caller can consume the output before calling us again
+  // - this is how one receives a body of any size in bounded memory.
+  void set_max_payload_read(int64 max_payload_read) {
+    max_payload_read_ = max_payload_read;
+  }
  private:
   void set_parse_state(ParseState state) {
     if ( dlog_level_ ) {
@@ -432,6 +449,7 @@ class RequestParser {
   int64 max_body_size_;
   const int64 max_chunk_size_;
   int64 max_num_chunks_;
+  int64 max_payload_read_;
   const bool accept_wrong_method_;
   const bool accept_wrong_version_;
   const bool accept_no_content_length_;
@@ -29,8 +29,11 @@
 //
 // Author: Catalin Popescu
 
+#include <string.h>
+#include <algorithm>
+
 #include "whisperlib/http/http_server_protocol.h"
-#include "whisperlib/io/ioutil.h"
+#include "whisperlib/http/http2_server_protocol.h"
 
 #define LOG_HTTP LOG_INFO_IF(dlog_level_) << name() << ": "
 
@@ -46,10 +49,13 @@ ServerParams::ServerParams()
       max_body_size_(1 << 20),
       max_chunk_size_(1 << 18),
       max_num_chunks_(20),
+      client_streaming_read_size_(1 << 16),
       worst_accepted_header_error_(Header::READ_NO_STATUS_REASON),
       max_concurrent_connections_(800),
       max_concurrent_requests_(10000),
       max_concurrent_requests_per_connection_(10),
+      num_worker_threads_(0),
+      max_queued_requests_(1000),
       request_read_timeout_ms_(10000),
       keep_alive_timeout_sec_(15),
       reply_write_timeout_ms_(20000),
@@ -87,11 +93,14 @@ ServerParams::ServerParams(
       max_body_size_(max_body_size),
       max_chunk_size_(max_chunk_size),
       max_num_chunks_(max_num_chunks),
+      client_streaming_read_size_(1 << 16),
       worst_accepted_header_error_(worst_accepted_header_error),
       max_concurrent_connections_(max_concurrent_connections),
       max_concurrent_requests_(max_concurrent_requests),
       max_concurrent_requests_per_connection_(
           max_concurrent_requests_per_connection),
+      num_worker_threads_(0),
+      max_queued_requests_(1000),
       request_read_timeout_ms_(request_read_timeout_ms),
       keep_alive_timeout_sec_(keep_alive_timeout_sec),
       reply_write_timeout_ms_(reply_write_timeout_ms),
@@ -239,10 +248,18 @@ Server::Server(const char* name,
       net_factory_(net_factory),
       protocol_params_(protocol_params),
       acceptors_(),
+      num_shed_requests_(0),
+      compressor_(NULL),
       default_processor_(NewPermanentCallback(
                              this, &Server::DefaultRequestProcessor)),
       error_processor_(NewPermanentCallback(
                            this, &Server::ErrorRequestProcessor)) {
+  if ( protocol_params_.num_worker_threads_ > 0 ) {
+    AddWorkerPool(kDefaultWorkerPool,
+                  protocol_params_.num_worker_threads_,
+                  protocol_params_.max_queued_requests_);
+    SetWorkerPool("/", kDefaultWorkerPool);
+  }
 }
 
 Server::~Server() {
@@ -250,16 +267,46 @@ Server::~Server() {
     delete acceptors_[i];
   }
   acceptors_.clear();
+  // Answers w/ 503 the requests still waiting for a worker (the reply
+  // goes through us, so we wait for it), and waits for the ones in process.
+  for ( WorkerPoolMap::const_iterator it = worker_pools_.begin();
+        it != worker_pools_.end(); ++it ) {
+    std::vector<Closure*> jobs;
+    it->second->jobs()->GetAll(&jobs);
+    for ( size_t i = 0; i < jobs.size(); ++i ) {
+      ServerRequest* const req = static_cast<WorkerJob*>(jobs[i])->req();
+      delete jobs[i];
+      ++num_shed_requests_;
+      req->request()->server_header()->set_status_code(SERVICE_UNAVAILABLE);
+      net::SelectorPool::RunInSelectLoopAndWait(
+          req->net_selector(),
+          NewCallback(req, &ServerRequest::ReplyWithStatus,
+                      SERVICE_UNAVAILABLE));
+    }
+    delete it->second;
+  }
+  worker_pools_.clear();
+  if ( compressor_ != NULL ) {
+    compressor_->StopOffloading();
+  }
+  // No more replies from other threads - send what is queued
+  FlushQueuedReplies();
+  delete compressor_;
+  for ( size_t i = 0; i < reply_templates_.size(); ++i ) {
+    delete reply_templates_[i];
+  }
+  reply_templates_.clear();
 
   // TODO(cpopescu): force close all -
   //                 see how this interacts w/ processor stuff..
   // CHECK(!protocols_.empty());
   //
   synch::MutexLocker l(&mutex_);
-  while ( !processors_.empty() ) {
-    delete processors_.begin()->second;
-    processors_.erase(processors_.begin());
+  for ( CallbackSet::const_iterator it = owned_callbacks_.begin();
+        it != owned_callbacks_.end(); ++it ) {
+    delete *it;
   }
+  owned_callbacks_.clear();
 }
 
 void Server::AddAcceptor(net::PROTOCOL net_protocol,
@@ -292,49 +339,222 @@ void Server::RegisterProcessor(const std::string& path,
   CHECK(callback->is_permanent());
   const std::string reg_path(strutil::NormalizeUrlPath(path));
   synch::MutexLocker l(&mutex_);
-  const ProcessorMap::iterator it = processors_.find(reg_path);
-  if ( it != processors_.end() ) {
-    delete it->second;
+  Router::Entry entry(router_.Get(reg_path));
+  ServerCallback* const old_callback = entry.processor_;
+  if ( old_callback != NULL ) {
     LOG_INFO << "HTTP processor replaced for path: " << reg_path;
-    it->second = new Processor(callback, auto_del_callback);
   } else {
     LOG_INFO << "HTTP listening on path: " << reg_path;
-    processors_[reg_path] = new Processor(callback, auto_del_callback);
   }
+  entry.processor_ = callback;
   if ( is_public ) {
-    allowed_ips_[reg_path] = NULL;  // all alowed
+    entry.has_ips_ = true;
+    entry.ips_ = NULL;  // all alowed
+  }
+  router_.Set(reg_path, entry);
+  // No lookup sees the old one from here on
+  if ( old_callback != callback ) {
+    DeleteOwnedCallback(old_callback);
+  }
+  if ( auto_del_callback ) {
+    owned_callbacks_.insert(callback);
+  } else {
+    owned_callbacks_.erase(callback);
   }
 }
 
 void Server::UnregisterProcessor(const std::string& path) {
   const std::string reg_path(strutil::NormalizeUrlPath(path));
-  const ProcessorMap::iterator it = processors_.find(reg_path);
-  if ( it == processors_.end() ) {
+  synch::MutexLocker l(&mutex_);
+  Router::Entry entry(router_.Get(reg_path));
+  ServerCallback* const old_callback = entry.processor_;
+  if ( old_callback == NULL ) {
     LOG_INFO << "No HTTP processor found to be deleted for path: " << reg_path;
     return;
   }
-  delete it->second;
-  processors_.erase(it);
-  allowed_ips_.erase(reg_path);
+  entry.processor_ = NULL;
+  entry.has_ips_ = false;
+  entry.ips_ = NULL;
+  router_.Set(reg_path, entry);
+  DeleteOwnedCallback(old_callback);
+}
+
+void Server::DeleteOwnedCallback(ServerCallback* callback) {
+  if ( owned_callbacks_.erase(callback) > 0 ) {
+    delete callback;
+  }
 }
 
 void Server::RegisterAllowedIpAddresses(const std::string& path,
                                         const net::IpV4Filter* ips) {
   const std::string reg_path(strutil::NormalizeUrlPath(path));
   synch::MutexLocker l(&mutex_);
-  const AllowedIpsMap::iterator it_ips = allowed_ips_.find(reg_path);
-  if ( it_ips != allowed_ips_.end() ) {
-    it_ips->second = ips;
-  } else {
-    allowed_ips_[reg_path] = ips;
-  }
+  Router::Entry entry(router_.Get(reg_path));
+  entry.has_ips_ = true;
+  entry.ips_ = ips;
+  router_.Set(reg_path, entry);
 }
 
 void Server::RegisterClientStreaming(const std::string& path,
                                      bool is_client_streaming) {
   const std::string reg_path(strutil::NormalizeUrlPath(path));
   synch::MutexLocker l(&mutex_);
-  is_streaming_client_map_[reg_path] = is_client_streaming;
+  Router::Entry entry(router_.Get(reg_path));
+  entry.has_client_streaming_ = true;
+  entry.is_client_streaming_ = is_client_streaming;
+  router_.Set(reg_path, entry);
+}
+
+const char Server::kDefaultWorkerPool[] = "default";
+
+void Server::AddWorkerPool(const std::string& pool_name,
+                           size_t num_threads,
+                           size_t max_queued_requests) {
+  CHECK(!pool_name.empty());
+  CHECK_GT(num_threads, 0);
+  synch::MutexLocker l(&mutex_);
+  CHECK(worker_pools_.find(pool_name) == worker_pools_.end())
+      << "Duplicate worker pool: " << pool_name;
+  // The queue of the pool holds the requests waiting for a thread
+  worker_pools_[pool_name] = new thread::ThreadPool(
+      num_threads, std::max(max_queued_requests, num_threads + 1));
+  LOG_INFO << "HTTP worker pool: " << pool_name << " w/ " << num_threads
+           << " threads, " << max_queued_requests << " queued requests";
+}
+
+void Server::SetWorkerPool(const std::string& path,
+                           const std::string& pool_name) {
+  const std::string reg_path(strutil::NormalizeUrlPath(path));
+  synch::MutexLocker l(&mutex_);
+  thread::ThreadPool* pool = NULL;
+  if ( !pool_name.empty() ) {
+    const WorkerPoolMap::const_iterator it = worker_pools_.find(pool_name);
+    CHECK(it != worker_pools_.end()) << "Unknown worker pool: " << pool_name;
+    pool = it->second;
+  }
+  Router::Entry entry(router_.Get(reg_path));
+  entry.has_worker_pool_ = true;
+  entry.worker_pool_ = pool;
+  router_.Set(reg_path, entry);
+}
+
+void Server::ReplyInSelectLoop(ServerRequest* req, HttpReturnCode status) {
+  net::Selector* const selector = req->net_selector();
+  ReplyQueue* queue = NULL;
+  {
+    synch::MutexLocker l(&replies_mutex_);
+    ReplyQueue*& q = reply_queues_[selector];
+    if ( q == NULL ) {
+      q = new ReplyQueue();
+    }
+    queue = q;
+  }
+  {
+    synch::MutexLocker l(&queue->mutex_);
+    queue->replies_.push_back(std::make_pair(req, status));
+    if ( queue->replies_.size() > 1 ) {
+      return;   // joins the batch already scheduled
+    }
+    ++queue->ref_count_;   // for the callback
+  }
+  selector->RunInSelectLoop(NewCallback(&Server::SendQueuedReplies, queue));
+}
+
+void Server::WorkerJob::RunInternal() {
+  req_->ProcessRequest();
+}
+
+void Server::SendQueuedReplies(ReplyQueue* queue) {
+  ReplyList replies;
+  {
+    synch::MutexLocker l(&queue->mutex_);
+    queue->replies_.swap(replies);
+  }
+  for ( size_t i = 0; i < replies.size(); ++i ) {
+    replies[i].first->ReplyWithStatus(replies[i].second);
+  }
+  ReleaseReplyQueue(queue);
+}
+
+void Server::ReleaseReplyQueue(ReplyQueue* queue) {
+  bool do_delete = false;
+  {
+    synch::MutexLocker l(&queue->mutex_);
+    do_delete = (--queue->ref_count_ == 0);
+  }
+  if ( do_delete ) {
+    delete queue;
+  }
+}
+
+void Server::FlushQueuedReplies() {
+  ReplyQueueMap queues;
+  {
+    synch::MutexLocker l(&replies_mutex_);
+    queues.swap(reply_queues_);
+  }
+  for ( ReplyQueueMap::const_iterator it = queues.begin();
+        it != queues.end(); ++it ) {
+    ReplyQueue* const queue = it->second;
+    {
+      synch::MutexLocker l(&queue->mutex_);
+      ++queue->ref_count_;
+    }
+    // In another network thread this runs after the batches scheduled
+    // there so far. In ours they run later, on an empty queue.
+    net::SelectorPool::RunInSelectLoopAndWait(
+        it->first, NewCallback(&Server::SendQueuedReplies, queue));
+    ReleaseReplyQueue(queue);
+  }
+}
+
+void Server::EnableCompression(const CompressionParams& params) {
+  CHECK(compressor_ == NULL) << "Compression already enabled";
+  compressor_ = new ReplyCompressor(params);
+}
+
+bool Server::CompressReply(ServerRequest* req, HttpReturnCode status,
+                           bool can_offload) {
+  Request* const request = req->request();
+  if ( compressor_ == NULL || req->is_server_streaming() ||
+       req->reply_template() != NULL || request->server_data_encoded() ) {
+    return true;
+  }
+  Header* const hs = request->server_header();
+  if ( !hs->HasField(http::kHeaderContentType) ) {
+    hs->AddField(http::kHeaderContentType,
+                 protocol_params_.default_content_type_, true);
+  }
+  const ContentCoding coding = compressor_->PrepareReply(request, status);
+  if ( coding == CODING_IDENTITY ) {
+    return true;
+  }
+  if ( can_offload &&
+       compressor_->ShouldOffload(request->server_data()->Size()) &&
+       compressor_->OffloadReply(
+           request, coding,
+           NewCallback(this, &Server::ReplyInSelectLoop, req, status)) ) {
+    return false;
+  }
+  compressor_->CompressReply(request, coding);
+  return true;
+}
+
+const ReplyTemplate* Server::RegisterReplyTemplate(const Header& header,
+                                                   HttpReturnCode status) {
+  Header h(false);
+  h.CopyHeaderFields(header, true);
+  if ( !h.HasField(http::kHeaderServer) ) {
+    h.AddField(http::kHeaderServer, name(), true);
+  }
+  if ( !h.HasField(http::kHeaderContentType) ) {
+    h.AddField(http::kHeaderContentType,
+               protocol_params_.default_content_type_, true);
+  }
+  ReplyTemplate* const reply_template = new ReplyTemplate(status, h);
+  synch::MutexLocker l(&mutex_);
+  reply_templates_.push_back(reply_template);
+  return reply_template;
 }
 
 void Server::AddClient(ServerProtocol* proto) {
@@ -391,14 +611,13 @@ static bool VerifyHost(http::Header* client_header, URL* url) {
 }
 
 void Server::GetSpecificProtocolParams(http::ServerRequest* req) {
-  synch::MutexLocker l(&mutex_);
   req->request()->InitializeUrlFromClientRequest(protocol_params_.root_url_);
   URL* const url = req->request()->url();
   if ( url != NULL ) {
     std::string url_path(url->UrlUnescape(url->path().c_str(),
                                      url->path().size()));
-    req->is_client_streaming_ = io::FindPathBased(&is_streaming_client_map_,
-                                                  url_path);
+    req->route_ = router_.Find(url_path);
+    req->is_client_streaming_ = req->route_.is_client_streaming_;
   }
   req->set_client_request_id(
       req->request()->client_header()->FindField(kHeaderXRequestId));
@@ -410,6 +629,9 @@ void Server::ProcessRequest(http::ServerRequest* req) {
     req->server_callback_->Run(req);
     return;
   }
+  if ( !req->is_initialized_ ) {
+    GetSpecificProtocolParams(req);
+  }
 
   Header* const hc = req->request()->client_header();
   Header* const hs = req->request()->server_header();
@@ -446,34 +668,38 @@ void Server::ProcessRequest(http::ServerRequest* req) {
   }
 
   // Accepted request - looks OK !
-  std::string url_path(url->UrlUnescape(url->path().c_str(),
-                                   url->path().size()));
-  std::string url_path2(url_path);
-
   // Identify processor based on path and set req->server_callback_
-  {
-      synch::MutexLocker l(&mutex_);
-      Processor* const proc = io::FindPathBased(&processors_, url_path);
-      if ( proc == NULL ) {
-        LOG_WARN << "Cannot find a processor for path: [" << url_path << "]"
-            ", looking through: " << strutil::ToStringKeys(processors_);
-        req->server_callback_ = default_processor_;
-      } else {
-        // Check if the ip is authorized
-        const net::IpV4Filter* const
-            ipfilter = io::FindPathBased(&allowed_ips_, url_path2);
-        if ( ipfilter != NULL &&
-             !ipfilter->Matches(
-                 net::IpAddress(
-                     req->protocol()->remote_address().ip_object())) ) {
-          hs->set_status_code(FORBIDDEN);
-          req->server_callback_ = error_processor_;
-        } else {
-          req->server_callback_ = proc->callback_;
-        }
-      }
+  const Router::Route& route = req->route_;
+  if ( route.processor_ == NULL ) {
+    LOG_WARN << "Cannot find a processor for path: ["
+             << url->UrlUnescape(url->path().c_str(), url->path().size())
+             << "], looking through: " << router_.size() << " paths";
+    req->server_callback_ = default_processor_;
+  } else if ( route.ips_ != NULL &&
+              !route.ips_->Matches(
+                  net::IpAddress(
+                      req->protocol()->remote_address().ip_object())) ) {
+    // The ip is not authorized
+    hs->set_status_code(FORBIDDEN);
+    req->server_callback_ = error_processor_;
+  } else if ( route.worker_pool_ != NULL && !req->is_client_streaming() ) {
+    // The processor runs in a worker thread - if one frees up in time
+    req->server_callback_ = route.processor_;
+    Closure* const job = new WorkerJob(req);
+    if ( route.worker_pool_->jobs()->Put(job, 0) ) {
+      return;
+    }
+    delete job;
+    ++num_shed_requests_;
+    LOG_EVERY_N(WARNING, 1000)
+        << "Worker pool full - shedding requests for: ["
+        << url->UrlUnescape(url->path().c_str(), url->path().size()) << "]";
+    hs->set_status_code(SERVICE_UNAVAILABLE);
+    req->server_callback_ = error_processor_;
+  } else {
+    req->server_callback_ = route.processor_;
   }
-  // Call processor without holding the mutex_! running parallel HTTP requests
+  // Call processor without holding any lock! running parallel HTTP requests
   req->server_callback_->Run(req);
 }
 
@@ -501,7 +727,10 @@ ServerProtocol::ServerProtocol(net::Selector* server_selector,
               server->protocol_params().worst_accepted_header_error_),
       connection_(NULL),
       crt_recv_(NULL),
-      crt_send_(NULL),
+      parsing_paused_(false),
+      paused_request_(NULL),
+      h2_checked_(false),
+      h2_(NULL),
       closed_(false) {
 }
 
@@ -511,7 +740,7 @@ ServerProtocol::~ServerProtocol() {
   CHECK(connection_ == NULL);
   timeouter_.UnsetAllTimeouts();
   delete crt_recv_;
-  CHECK(crt_send_ == NULL);
+  delete h2_;
 }
 
 void ServerProtocol::set_connection(ServerConnection* conn) {
@@ -528,13 +757,35 @@ void ServerProtocol::set_connection(ServerConnection* conn) {
   parser_.set_name(name_);
   timeouter_.SetTimeout(kRequestTimeout,
                         protocol_params().request_read_timeout_ms_);
+  if ( conn->application_protocol() == http2::kAlpnProtocolId ) {
+    StartHttp2();
+  }
+}
+
+void ServerProtocol::StartHttp2() {
+  CHECK(h2_ == NULL);
+  LOG_HTTP << "Client speaks HTTP/2";
+  h2_checked_ = true;
+  h2_ = new Http2ServerProtocol(this);
+}
+
+size_t ServerProtocol::queued_output_bytes(const ServerRequest* req) const {
+  if ( req->stream_id_ != 0 ) {
+    return h2_ == NULL ? 0 : h2_->pending_output_bytes(req);
+  }
+  return req->queued_reply_ == NULL ? 0 : req->queued_reply_->Size();
 }
 
 net::NetConnection* ServerProtocol::DetachFromFd(ServerRequest* req) {
   CHECK(net_selector()->IsInSelectThread());
   LOG_INFO << name() << " - Detaching FD.";
   CHECK(req->protocol() == this);
-  active_requests_.erase(req);
+  CHECK(h2_ == NULL) << "Cannot detach a HTTP/2 connection";
+  const RequestQueue::iterator it = std::find(active_requests_.begin(),
+                                              active_requests_.end(), req);
+  if ( it != active_requests_.end() ) {
+    active_requests_.erase(it);
+  }
   CHECK(active_requests_.empty())
       << "Cannot detach if you accept multiple concurrent requests!";
   net::NetConnection * net_connection = connection_->DetachFromFd();
@@ -567,10 +818,25 @@ void ServerProtocol::NotifyConnectionDeletion() {
 void ServerProtocol::CloseAllActiveRequests() {
   CHECK(net_selector()->IsInSelectThread());
   CHECK(connection_ == NULL);
+  if ( h2_ != NULL ) {
+    // Nobody processes these yet
+    h2_->DropUndispatchedRequests();
+  }
+  // The replies waiting for their turn are done with
   std::vector<http::ServerRequest*> reqs;
-  for ( RequestSet::const_iterator it = active_requests_.begin();
-        it != active_requests_.end(); ++it ) {
-    reqs.push_back(*it);
+  RequestQueue::iterator it = active_requests_.begin();
+  while ( it != active_requests_.end() ) {
+    if ( (*it)->is_reply_done_ ) {
+      net_selector_->DeleteInSelectLoop(*it);
+      it = active_requests_.erase(it);
+    } else {
+      reqs.push_back(*it);
+      ++it;
+    }
+  }
+  if ( active_requests_.empty() ) {
+    net_selector_->DeleteInSelectLoop(this);
+    return;
   }
   for ( size_t i = 0; i < reqs.size(); ++i ) {
     reqs[i]->SignalClosed();
@@ -583,6 +849,11 @@ void ServerProtocol::CloseAllActiveRequests() {
 }
 
 void ServerProtocol::HandleTimeout(int64 timeout_id) {
+  if ( h2_ != NULL && timeout_id == kRequestTimeout &&
+       !active_requests_.empty() ) {
+    h2_->HandleReadTimeout();
+    return;
+  }
   if (active_requests_.empty()) {
       LOG_HTTP << "Timeout encountered - closing: " << timeout_id;
       if ( connection_ ) {
@@ -598,10 +869,44 @@ ServerProtocol::ProcessMoreDataResult ServerProtocol::ProcessMoreData() {
     connection_->inbuf()->Clear();
     return ProcessMoreDataResult_NEEDMORE;  // 'soft' closed ..
   }
+  if ( h2_ != NULL ) {
+    return h2_->ProcessMoreData();
+  }
+  if ( !h2_checked_ ) {
+    // A client w/ prior knowledge starts w/ the HTTP/2 connection preface
+    char buf[http2::kConnectionPrefaceSize];
+    const size_t size = connection_->inbuf()->Peek(buf, sizeof(buf));
+    if ( memcmp(buf, http2::kConnectionPreface, size) != 0 ) {
+      h2_checked_ = true;
+    } else if ( size < sizeof(buf) ) {
+      return ProcessMoreDataResult_NEEDMORE;
+    } else {
+      StartHttp2();
+      return h2_->ProcessMoreData();
+    }
+  }
   if ( crt_recv_ == NULL ) {
+    if ( active_requests_.size() >= std::max(
+             protocol_params().max_concurrent_requests_per_connection_,
+             size_t(1)) ) {
+      // Pipeline full - the next requests wait in inbuf until some
+      // replies complete (see ResumeParsing)
+      if ( !parsing_paused_ ) {
+        LOG_HTTP << "Pipeline full w/ " << active_requests_.size()
+                 << " requests - pausing.";
+        parsing_paused_ = true;
+        PauseReading();
+      }
+      return ProcessMoreDataResult_NEEDMORE;
+    }
     parser_.Clear();
     parser_.set_max_num_chunks(protocol_params().max_num_chunks_);
+    parser_.set_max_body_size(protocol_params().max_body_size_);
+    parser_.set_max_payload_read(-1);
     crt_recv_ = new ServerRequest(this);
+  } else if ( paused_request_ != NULL ) {
+    // The processor does not want more body yet - it stays in inbuf
+    return ProcessMoreDataResult_NEEDMORE;
   } else {
     CHECK(!parser_.InFinalState());
   }
@@ -623,14 +928,17 @@ ServerProtocol::ProcessMoreDataResult ServerProtocol::ProcessMoreData() {
       if ( !parser_.InFinalState() && crt_recv_->is_client_streaming() ) {
         parser_.set_max_num_chunks(-1);
         parser_.set_max_body_size(-1);
-        active_requests_.insert(crt_recv_);
+        parser_.set_max_payload_read(
+            protocol_params().client_streaming_read_size_);
+        if ( std::find(active_requests_.begin(), active_requests_.end(),
+                       crt_recv_) == active_requests_.end() ) {
+          active_requests_.push_back(crt_recv_);
+        }
 
         crt_recv_->request()->mutable_stats()->client_raw_size_ +=
             in_size - connection_->inbuf()->Size();
         crt_recv_->request()->mutable_stats()->client_size_ +=
             crt_recv_->request()->client_data()->Size() - client_data_size;
-        in_size = connection_->inbuf()->Size();
-        client_data_size = crt_recv_->request()->client_data()->Size();
 
         server_->ProcessRequest(crt_recv_);
         if ( crt_recv_ == NULL || crt_recv_->server_callback_ == NULL ) {
@@ -638,6 +946,14 @@ ServerProtocol::ProcessMoreDataResult ServerProtocol::ProcessMoreData() {
           return ProcessMoreDataResult_ERROR;
         }
         timeouter_.UnsetTimeout(kRequestTimeout);
+        // The processor may have consumed the body data
+        in_size = connection_->inbuf()->Size();
+        client_data_size = crt_recv_->request()->client_data()->Size();
+        if ( paused_request_ == crt_recv_ ) {
+          LOG_HTTP << "Client streaming request paused w/ "
+                   << in_size << " bytes in inbuf.";
+          break;
+        }
       }
     }
     if ( parser_.InFinalState() ) {
@@ -655,11 +971,19 @@ ServerProtocol::ProcessMoreDataResult ServerProtocol::ProcessMoreData() {
     return ProcessMoreDataResult_NEEDMORE;
   }
   timeouter_.UnsetTimeout(kRequestTimeout);
+  if ( std::find(active_requests_.begin(), active_requests_.end(),
+                 crt_recv_) == active_requests_.end() ) {
+    active_requests_.push_back(crt_recv_);
+  }
   if ( parser_.InErrorState() ) {
     LOG_HTTP << net_selector()
              << "Fully parsed an error request " << parser_.ParseStateName();
-    PrepareErrorRequest(crt_recv_);
+    // We read no more - we close after the replies to this and to the
+    // requests before it
     closed_ = true;
+    ServerRequest* const req = crt_recv_;
+    crt_recv_ = NULL;
+    PrepareErrorRequest(req);
     return ProcessMoreDataResult_NEEDMORE;
   } else {
     LOG_HTTP << "Fully parsed an OK request ["
@@ -667,18 +991,10 @@ ServerProtocol::ProcessMoreDataResult ServerProtocol::ProcessMoreData() {
                  crt_recv_->request()->client_header()->ComposeFirstLine())
              << "]";
   }
-  active_requests_.insert(crt_recv_);
-  if ( active_requests_.size() >
-       protocol_params().max_concurrent_requests_per_connection_ ) {
-      crt_recv_->request()->server_header()->PrepareStatusLine(
-          SERVICE_UNAVAILABLE);
-      crt_recv_->request()->server_data()->Write(
-          strutil::StringPrintf("Too many concurrent requests for connection: %zd / %d." ,
-                                active_requests_.size(),
-                                protocol_params().max_concurrent_requests_per_connection_));
-  }
-  server_->ProcessRequest(crt_recv_);
+  // The processor may reply right away - and we may parse the next one
+  ServerRequest* const req = crt_recv_;
   crt_recv_ = NULL;
+  server_->ProcessRequest(req);
   return ProcessMoreDataResult_COMPLETE;
 }
 
@@ -730,32 +1046,21 @@ void ServerProtocol::PrepareErrorRequest(ServerRequest* req) {
 }
 
 
-bool ServerProtocol::PrepareResponse(ServerRequest* req,
-                                     HttpReturnCode status) {
-  CHECK(net_selector()->IsInSelectThread());
-  if ( crt_send_ == NULL ) {
-    crt_send_ = req;
+io::MemoryStream* ServerProtocol::ReplyBuffer(ServerRequest* req) {
+  if ( active_requests_.empty() || active_requests_.front() == req ) {
+    return connection_->outbuf();
   }
-  bool should_close = false;
-  if ( !parser_.InFinalState() ) {
-    should_close = true;
+  if ( req->queued_reply_ == NULL ) {
+    req->queued_reply_ = new io::MemoryStream();
   }
-  // We never orhpan a connection here - causes loads of trouble ..
-  if ( connection_ == NULL )
-    return true;
-  // Prepare the reply parameters
-  http::Header* const hs = req->request()->server_header();  // shortcut
-  hs->PrepareStatusLine(
-      status, req->request()->client_header()->http_version());
-  hs->SetChunkedTransfer(
-      req->request()->client_header()->http_version() >= VERSION_1_1 &&
-      req->is_server_streaming() &&
-      req->is_server_streaming_chunks());
+  return req->queued_reply_;
+}
 
+void ServerProtocol::AddDefaultReplyFields(ServerRequest* req) {
+  http::Header* const hs = req->request()->server_header();  // shortcut
   // Set some necessary headers *if not set*
   if ( !hs->HasField(http::kHeaderDate) ) {
-    time_t crt_time;
-    hs->SetDateField(http::kHeaderDate, time(&crt_time));
+    hs->AddField(http::kHeaderDate, Header::CachedDate(time(NULL)), true);
   }
   if ( !hs->HasField(http::kHeaderServer) ) {
     hs->AddField(http::kHeaderServer, server_->name(), true);
@@ -769,40 +1074,82 @@ bool ServerProtocol::PrepareResponse(ServerRequest* req,
     hs->AddField(http::kHeaderXRequestId,
                  req->client_request_id(), true);
   }
-  // Determine keep-alive stuff
-  if ( protocol_params().keep_alive_timeout_sec_ > 0 &&
-       crt_send_->request()->client_header()->HasField(
-           http::kHeaderKeepAlive) ) {
+}
+
+bool ServerProtocol::PrepareResponse(ServerRequest* req,
+                                     HttpReturnCode status) {
+  CHECK(net_selector()->IsInSelectThread());
+  bool should_close = false;
+  if ( !req->is_parsing_finished() ) {
+    should_close = true;
+  }
+  // We never orhpan a connection here - causes loads of trouble ..
+  if ( connection_ == NULL )
+    return true;
+  // Prepare the reply parameters
+  http::Header* const hc = req->request()->client_header();  // shortcut
+  http::Header* const hs = req->request()->server_header();  // shortcut
+  const ReplyTemplate* reply_template = req->reply_template_;
+  if ( reply_template != NULL &&
+       (req->stream_id_ != 0 || hc->http_version() < VERSION_1_1) ) {
+    // Cannot use the encoded template - we just take its fields
+    hs->CopyHeaderFields(reply_template->header(), false);
+    reply_template = NULL;
+  }
+  if ( req->stream_id_ != 0 ) {
+    // The stream may be gone, but the connection stays
+    return !h2_->PrepareResponse(req, status);
+  }
+  const bool is_chunked = hc->http_version() >= VERSION_1_1 &&
+                          req->is_server_streaming() &&
+                          req->is_server_streaming_chunks();
+  if ( reply_template == NULL ) {
+    hs->PrepareStatusLine(status, hc->http_version());
+    hs->SetChunkedTransfer(is_chunked);
+    AddDefaultReplyFields(req);
+  }
+  // Determine keep-alive stuff: HTTP/1.1 connections are persistent
+  // unless the client says otherwise (and pipelining relies on this),
+  // for HTTP/1.0 the client has to ask. A reply streamed w/o chunks
+  // ends when we close.
+  const bool client_keep_alive =
+      hc->HasField(http::kHeaderKeepAlive) ||
+      hc->IsKeepAliveConnection() ||
+      (hc->http_version() >= VERSION_1_1 &&
+       !strutil::StrCasePrefix(
+           strutil::StrTrim(hc->FindField(http::kHeaderConnection)).c_str(),
+           "close"));
+  req->is_keep_alive_ = protocol_params().keep_alive_timeout_sec_ > 0 &&
+                        client_keep_alive &&
+                        (!req->is_server_streaming() || is_chunked);
+  if ( reply_template != NULL ) {
+    // The template writes these
+  } else if ( req->is_keep_alive_ ) {
     hs->AddField(http::kHeaderConnection, "Keep-Alive", true);
     hs->AddField(
         http::kHeaderKeepAlive,
         strutil::IntToString(protocol_params().keep_alive_timeout_sec_),
         true);
-    crt_send_->is_keep_alive_ = true;
   } else {
     hs->AddField(http::kHeaderConnection, "Close", true);
-    crt_send_->is_keep_alive_ = false;
   }
-  // Write the data out
+  // Write the data out (or queue it, if other replies go before us)
+  io::MemoryStream* const out = ReplyBuffer(req);
   bool append_data = true;
-  if ( connection_->outbuf()->Size() >
-       protocol_params().max_reply_buffer_size_ ) {
+  if ( out->Size() > protocol_params().max_reply_buffer_size_ ) {
     append_data = false;
     switch ( protocol_params().reply_full_buffer_policy_ ) {
       case ServerParams::POLICY_CLOSE:
         LOG_INFO << name() << ": connection outbuf full -> Closing"
-                 << " - " << connection_->outbuf()->Size() << " vs. "
+                 << " - " << out->Size() << " vs. "
                  << protocol_params().max_reply_buffer_size_;
         should_close = true;
-        crt_send_->is_keep_alive_ = false;
+        req->is_keep_alive_ = false;
         break;
       case ServerParams::POLICY_DROP_OLD_DATA:
         LOG_INFO << name() << ": connection outbuf full -> Dropping old data";
-        connection_->outbuf()->Clear();
-        crt_send_->request()->AppendServerReply(
-            connection_->outbuf(),
-            req->is_server_streaming(),
-            req->is_server_streaming_chunks());
+        out->Clear();
+        AppendReply(req, reply_template, out);
         break;
       case ServerParams::POLICY_DROP_NEW_DATA:
         LOG_INFO << name() << ": connection outbuf full -> Dropping new data";
@@ -810,54 +1157,63 @@ bool ServerProtocol::PrepareResponse(ServerRequest* req,
       case ServerParams::POLICY_BLINK:
         append_data = true;
         LOG_INFO << name() << ": connection outbuf full -> Blinking"
-                 << " - " << connection_->outbuf()->Size() << " vs. "
+                 << " - " << out->Size() << " vs. "
                  << protocol_params().max_reply_buffer_size_;
         break;
     }
   }
   if (append_data) {
-    crt_send_->request()->AppendServerReply(
-        connection_->outbuf(),
+    AppendReply(req, reply_template, out);
+    if ( out == connection_->outbuf() ) {
+      connection_->NotifyWrite();
+    }
+  }
+  return should_close;
+}
+
+void ServerProtocol::AppendReply(ServerRequest* req,
+                                 const ReplyTemplate* reply_template,
+                                 io::MemoryStream* out) {
+  if ( reply_template != NULL ) {
+    reply_template->AppendReply(req->request(), time(NULL),
+                                req->is_keep_alive_,
+                                protocol_params().keep_alive_timeout_sec_,
+                                req->client_request_id(), out);
+  } else {
+    req->request()->AppendServerReply(
+        out,
         req->is_server_streaming(),
         req->is_server_streaming_chunks());
-    connection_->NotifyWrite();
   }
-  return should_close;
 }
 
 void ServerProtocol::ReplyForRequest(ServerRequest* req,
                                      HttpReturnCode status) {
   CHECK(net_selector()->IsInSelectThread());
   bool should_close = false;
-  if ( crt_send_ != NULL ) {
-    LOG_INFO << "Dumping invalid request received : " << req;
-    // TODO(miancule): This seems to fix the persistent HTTP bugs,
-    // but I'm pretty sure that this is somehow incorrect...
-    if ( req == crt_send_ ) {
-      crt_send_ = NULL;
-    }
-    net_selector_->DeleteInSelectLoop(req);
-    return;
-  }
-  crt_send_ = req;
   if ( connection_ == NULL ) {
     // Orphaned request:
-    crt_send_->is_orphaned_ = true;
+    req->is_orphaned_ = true;
     should_close = true;
+  } else if ( !server_->CompressReply(req, status, true) ) {
+    return;   // replied when compressed
   } else {
     should_close = PrepareResponse(req, status);
+    req->should_close_ = should_close;
   }
-  EndRequestProcessing(crt_send_,
+  EndRequestProcessing(req,
                        !req->is_server_streaming() || should_close);
 }
 
 void ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
   CHECK(net_selector()->IsInSelectThread());
-  CHECK_EQ(crt_send_, req);
   if ( connection_ == NULL ) {
     // Orphaned request:
     req->is_orphaned_ = true;
+  } else if ( req->stream_id_ != 0 ) {
+    is_eos = h2_->StreamData(req, is_eos);
   } else {
+    io::MemoryStream* const out = ReplyBuffer(req);
     // We need this protection to insure that we don't output empty chunks
     // (which signal EOS) when we don't want. Because of multithreading,
     // two calls to ContinueStreamingData from a worker thread
@@ -866,10 +1222,9 @@ void ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
     if ( !req->request()->server_data()->IsEmpty() ) {
       // Write the data out
       bool append_data = true;
-      if ( connection_->outbuf()->Size() >
-           protocol_params().max_reply_buffer_size_ ) {
+      if ( out->Size() > protocol_params().max_reply_buffer_size_ ) {
         append_data = false;
-        LOG_WARN << "HTTP outbuf size exceeded: " << connection_->outbuf()->Size()
+        LOG_WARN << "HTTP outbuf size exceeded: " << out->Size()
                  << " > max_reply_buffer_size: "
                  << protocol_params().max_reply_buffer_size_;
         switch ( protocol_params().reply_full_buffer_policy_ ) {
@@ -880,11 +1235,11 @@ void ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
             break;
           case ServerParams::POLICY_DROP_OLD_DATA:
             LOG_HTTP << "Buffer full - dropping "
-                     << connection_->outbuf()->Size()
+                     << out->Size()
                      << " bytes from connection.";
-            connection_->outbuf()->Clear();
+            out->Clear();
             req->request()->AppendServerChunk(
-                connection_->outbuf(), req->is_server_streaming_chunks());
+                out, req->is_server_streaming_chunks());
             break;
           case ServerParams::POLICY_DROP_NEW_DATA:
             break;
@@ -895,14 +1250,15 @@ void ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
       }
       if (append_data) {
         req->request()->AppendServerChunk(
-            connection_->outbuf(), req->is_server_streaming_chunks());
+            out, req->is_server_streaming_chunks());
       }
-      connection_->NotifyWrite();
     }
     if ( is_eos ) {
       // The finishing touch
       req->request()->AppendServerChunk(
-          connection_->outbuf(), req->is_server_streaming_chunks());
+          out, req->is_server_streaming_chunks());
+    }
+    if ( out == connection_->outbuf() ) {
       connection_->NotifyWrite();
     }
   }
@@ -911,12 +1267,50 @@ void ServerProtocol::StreamData(ServerRequest* req, bool is_eos) {
 
 void ServerProtocol::EndRequestProcessing(ServerRequest* req, bool is_eos) {
   CHECK(net_selector()->IsInSelectThread());
-  CHECK(crt_send_ == req);
-  if ( is_eos ) {
-    crt_send_ = NULL;
+  if ( connection_ != NULL && req->stream_id_ != 0 ) {
+    h2_->EndRequestProcessing(req, is_eos);
+    return;
+  }
+  if ( connection_ != NULL && req->queued_reply_ != NULL ) {
+    // Not our turn yet - the reply waits for the ones before
+    if ( is_eos ) {
+      req->is_reply_done_ = true;
+    }
+    return;
+  }
+  if ( !EndFirstRequestProcessing(req, is_eos) && is_eos ) {
+    FlushQueuedReplies();
+  }
+}
+
+void ServerProtocol::FlushQueuedReplies() {
+  CHECK(net_selector()->IsInSelectThread());
+  while ( connection_ != NULL && !active_requests_.empty() ) {
+    ServerRequest* const req = active_requests_.front();
+    if ( req->queued_reply_ == NULL ) {
+      break;   // did not reply yet - it will write directly
+    }
+    connection_->outbuf()->AppendStream(req->queued_reply_);
+    delete req->queued_reply_;
+    req->queued_reply_ = NULL;
+    if ( !req->is_reply_done_ ) {
+      // Still streaming - continues directly on the connection
+      req->UpdateOutputBytes();
+      connection_->NotifyWrite();
+      break;
+    }
+    if ( EndFirstRequestProcessing(req, true) ) {
+      break;
+    }
   }
-  const bool should_close = is_eos && (!req->is_keep_alive() ||
-                                       req->is_orphaned());
+}
+
+bool ServerProtocol::EndFirstRequestProcessing(ServerRequest* req,
+                                               bool is_eos) {
+  const bool should_close = is_eos && (req->should_close_ ||
+                                       !req->is_keep_alive() ||
+                                       req->is_orphaned() ||
+                                       !req->is_parsing_finished());
   if ( connection_ != NULL ) {
     if ( !connection_->outbuf()->IsEmpty() ) {
       timeouter_.SetTimeout(kWriteTimeout,
@@ -947,38 +1341,108 @@ void ServerProtocol::EndRequestProcessing(ServerRequest* req, bool is_eos) {
             connection_->count_bytes_read() : -1)
         << " should_close: " << should_close
         << " signal_ready: " << signal_ready;
-    active_requests_.erase(req);
+    const RequestQueue::iterator it = std::find(active_requests_.begin(),
+                                                active_requests_.end(), req);
+    if ( it != active_requests_.end() ) {
+      active_requests_.erase(it);
+    }
     if ( crt_recv_ == req ) {
       crt_recv_ = NULL;
     }
+    if ( paused_request_ == req ) {
+      paused_request_ = NULL;
+    }
     net_selector_->DeleteInSelectLoop(req);
     if ( active_requests_.empty() && connection_ == NULL ) {
       net_selector_->DeleteInSelectLoop(this);
     }
   }
-  if ( should_close ) {
+  if ( should_close || (is_eos && closed_ && active_requests_.empty()) ) {
+    // Closing - on request, or after the last reply
     closed_ = true;
     if ( connection_ != NULL ) {
       LOG_HTTP << "Closing connection.";
       connection_->FlushAndClose();
     }
-  } else if ( is_eos && connection_ != NULL && active_requests_.empty() ) {
-    timeouter_.SetTimeout(kRequestTimeout,
-                          protocol_params().keep_alive_timeout_sec_ * 1000);
+    return true;
+  }
+  if ( is_eos && connection_ != NULL ) {
+    if ( active_requests_.empty() ) {
+      timeouter_.SetTimeout(kRequestTimeout,
+                            protocol_params().keep_alive_timeout_sec_ * 1000);
+    }
+    if ( parsing_paused_ ) {
+      // Room in the pipeline for the requests waiting in inbuf
+      parsing_paused_ = false;
+      net_selector_->RunInSelectLoop(
+          NewCallback(this, &ServerProtocol::ResumeParsing));
+    }
   }
   if ( signal_ready ) {
     req->SignalReady();
   }
+  return false;
+}
+
+void ServerProtocol::ResumeParsing() {
+  CHECK(net_selector()->IsInSelectThread());
+  if ( connection_ == NULL || closed_ || parsing_paused_ ) {
+    return;
+  }
+  ResumeReading();
+  if ( !connection_->inbuf()->IsEmpty() ) {
+    connection_->ProcessInbuf();
+  }
+}
+
+void ServerProtocol::PauseRequestReading(ServerRequest* req) {
+  CHECK(net_selector()->IsInSelectThread());
+  if ( req->stream_id_ != 0 ) {
+    // The stream flow control holds the client, not the connection
+    if ( h2_ != NULL ) {
+      h2_->PauseRequestReading(req);
+    }
+    return;
+  }
+  if ( req == crt_recv_ && req->stream_id_ == 0 ) {
+    paused_request_ = req;
+  }
+  PauseReading();
+}
+
+void ServerProtocol::ResumeRequestReading(ServerRequest* req) {
+  CHECK(net_selector()->IsInSelectThread());
+  if ( req->stream_id_ != 0 ) {
+    if ( h2_ != NULL ) {
+      h2_->ResumeRequestReading(req);
+    }
+    return;
+  }
+  if ( paused_request_ != req ) {
+    ResumeReading();
+    return;
+  }
+  paused_request_ = NULL;
+  if ( connection_ != NULL ) {
+    // We may be called from the processor, while parsing - so we continue
+    // w/ the body in inbuf on a fresh call
+    net_selector_->RunInSelectLoop(
+        NewCallback(this, &ServerProtocol::ResumeParsing));
+  }
 }
 
 void ServerProtocol::NotifyConnectionWrite() {
   DCHECK(net_selector_->IsInSelectThread());
 
-  if ( crt_send_ != NULL ) {
+  if ( h2_ != NULL ) {
+    h2_->NotifyConnectionWrite();
+  } else if ( !active_requests_.empty() &&
+              active_requests_.front()->queued_reply_ == NULL ) {
+    ServerRequest* const crt_send = active_requests_.front();
     // update outbuf_size proxies (outbuf is depleting)
-    crt_send_->UpdateOutputBytes();
-    if ( crt_send_->pending_output_bytes() < crt_send_->ready_pending_limit_ ) {
-      crt_send_->SignalReady();
+    crt_send->UpdateOutputBytes();
+    if ( crt_send->pending_output_bytes() < crt_send->ready_pending_limit_ ) {
+      crt_send->SignalReady();
     }
   }
   if ( !connection_->outbuf()->IsEmpty() ) {
@@ -992,13 +1456,13 @@ void ServerProtocol::NotifyConnectionWrite() {
 //////////////////////////////////////////////////////////////////////
 
 void ServerRequest::ReplyWithStatus(HttpReturnCode status) {
+  CHECK(protocol_ != NULL);
   if (!protocol_->net_selector()->IsInSelectThread()) {
-      protocol_->net_selector()->RunInSelectLoop(NewCallback(this,
-              &ServerRequest::ReplyWithStatus, status));
+      // Compress while still in the worker thread
+      protocol_->server()->CompressReply(this, status, false);
+      protocol_->server()->ReplyInSelectLoop(this, status);
       return;
   }
-  CHECK(protocol_ != NULL);
-  CHECK(protocol_->net_selector()->IsInSelectThread());
   // We do not lock on this one - as the reply happens once
   CHECK(!is_server_streaming_);
   protocol_->ReplyForRequest(this, status);
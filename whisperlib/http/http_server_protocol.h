@@ -64,8 +64,9 @@
 #ifndef __NET_HTTP_HTTP_SERVER_PROTOCOL_H__
 #define __NET_HTTP_HTTP_SERVER_PROTOCOL_H__
 
+#include <atomic>
+#include <deque>
 #include <map>
-#include <set>
 #include <string>
 #include <vector>
 
@@ -76,7 +77,11 @@
 #include WHISPER_HASH_MAP_HEADER
 
 #include "whisperlib/sync/mutex.h"
+#include "whisperlib/sync/thread_pool.h"
+#include "whisperlib/http/http_compression.h"
+#include "whisperlib/http/http_reply_template.h"
 #include "whisperlib/http/http_request.h"
+#include "whisperlib/http/path_router.h"
 #include "whisperlib/net/selector.h"
 #include "whisperlib/net/timeouter.h"
 #include "whisperlib/net/connection.h"
@@ -144,6 +149,12 @@ struct ServerParams {
   // For chunked body, how many chuncks can we accept in a request / reply ?
   // (-1 => no limit)
   int64 max_num_chunks_;
+  // For client streaming requests (no body size limit) how much body we
+  // take from the connection between two calls of the processor. Together
+  // w/ ServerRequest::PauseReading (and a TcpConnectionParams::read_limit_
+  // for the connections) this keeps the memory of an upload of any size
+  // bounded.
+  size_t client_streaming_read_size_;
 
   // When parsing headers, what is the worst acceptable error ?
   // (Recommended: Header::READ_NO_STATUS_REASON)
@@ -154,8 +165,19 @@ struct ServerParams {
   // How many concurrent requests can we accept ?
   size_t max_concurrent_requests_;
   // How many concurrent requests per each connection do we accept ?
+  // This is the depth of the pipeline: we parse ahead and dispatch this
+  // many requests from a connection, then we wait for replies to complete
+  // before reading more. The replies go out in the order of the requests.
   size_t max_concurrent_requests_per_connection_;
 
+  // If > 0, the server processes the requests w/ these many worker threads
+  // (the "default" worker pool), instead of the network threads of their
+  // connections. See Server::AddWorkerPool for the details.
+  size_t num_worker_threads_;
+  // How many requests can wait for a worker thread ? Above this we shed
+  // load - we reply w/ 503 (Service Unavailable) to the new requests.
+  size_t max_queued_requests_;
+
   // How long to wait to receive a request ?
   int32 request_read_timeout_ms_;
   // Timeout on keep-alive connections ? (On 0 - we close the connection)
@@ -176,6 +198,7 @@ class ServerRequest;
 class ServerConnection;
 class ServerProtocol;
 class Server;
+class Http2ServerProtocol;
 
 //////////////////////////////////////////////////////////////////////
 //
@@ -228,8 +251,9 @@ class Server {
   // Creates a server with a given name, main network thread and
   // protocol behavior.
   // The factory callback is used to create the serving connection
-  // of a desired type, and requests may be processed by threads in a
-  // thread pool *iff* threadpool_size > 0
+  // of a desired type, and requests are processed by the threads of a
+  // worker pool *iff* protocol_params.num_worker_threads_ > 0 (else in
+  // the network thread of their connection - see AddWorkerPool).
   Server(const char* name,
          net::Selector* selector,
          const net::NetFactory& net_factory,
@@ -238,6 +262,8 @@ class Server {
 
   // Add an Acceptor for listening on a local port.
   // The local_address should contain at least the port.
+  // If the net_factory has a selector pool, connections are accepted and
+  // served in the threads of that pool (see net::TcpShardedAcceptor).
   void AddAcceptor(net::PROTOCOL net_protocol,
                    const net::HostPort& local_address);
 
@@ -262,7 +288,7 @@ class Server {
   //  "/test1/test3" -> we invoke processor1
   //
   // is_public: If true, all incoming clients are served.
-  //            If false, only certain allowed_ips_ can access this path.
+  //            If false, only certain allowed ips can access this path.
   // auto_del_callback: Should we take ownership of the 'callback'?
   void RegisterProcessor(const std::string& path, ServerCallback* callback,
       bool is_public, bool auto_del_callback);
@@ -283,6 +309,59 @@ class Server {
   void RegisterClientStreaming(const std::string& path,
                                bool is_client_streaming);
 
+  // Name of the worker pool created for ServerParams::num_worker_threads_
+  static const char kDefaultWorkerPool[];
+
+  // Creates a pool of num_threads worker threads, that process the requests
+  // on the paths assigned to it w/ SetWorkerPool. The processors of these
+  // paths run in the worker threads and can block (e.g. wait for a backend)
+  // w/o holding up the other connections. Once the threads are busy, up to
+  // max_queued_requests requests wait in line; the ones above are shed -
+  // replied w/ 503 (Service Unavailable) w/o calling the processor.
+  // Call it before StartServing (the pools are deleted w/ the server).
+  //
+  // NOTE: A processor running in a worker thread can use (from any thread)
+  //  ServerRequest::Reply / ReplyWithStatus. The replies are passed back
+  //  to the network thread of their connections in batches. For anything
+  //  else (e.g. streaming) it needs to run in req->net_selector().
+  //  The client streaming requests are always processed in the network
+  //  threads.
+  void AddWorkerPool(const std::string& pool_name,
+                     size_t num_threads,
+                     size_t max_queued_requests);
+
+  // The requests on the given path are processed in the worker pool
+  // pool_name (an empty pool_name - in the network threads). The path
+  // resolving is same as for processors.
+  void SetWorkerPool(const std::string& path, const std::string& pool_name);
+
+  // How many requests we shed so far, because the worker pools were full
+  int64 num_shed_requests() const {
+    return num_shed_requests_;
+  }
+
+  // Compresses the replies of this server (the ones w/o server streaming)
+  // w/ an http::ReplyCompressor set up w/ params. The replies of the
+  // processors that turn off the gzip encoding of their requests are
+  // left alone. Call it before StartServing.
+  void EnableCompression(const CompressionParams& params);
+  // The compressor of our replies (NULL if not enabled)
+  ReplyCompressor* compressor() { return compressor_; }
+
+  // Registers a reply template w/ the given status and fixed fields
+  // (plus our Server and default Content-Type, if not set there), for
+  // ServerRequest::ReplyWithTemplate. We own it - it lives as long as we
+  // do. Can be called from any thread.
+  const ReplyTemplate* RegisterReplyTemplate(const Header& header,
+                                             HttpReturnCode status = OK);
+
+  // Compresses the reply body of req, if needed. Returns false if the
+  // compression went to the offload threads of the compressor (only
+  // when can_offload) - and the reply is sent w/ ReplyInSelectLoop when
+  // done. Used internally.
+  bool CompressReply(ServerRequest* req, HttpReturnCode status,
+                     bool can_offload);
+
   // Processes a given request - fully read from the client.
   // In this function we call the right handler, and in
   // case of errors (like handlers called from bad ips, 404s or requests
@@ -301,6 +380,10 @@ class Server {
     default_processor_ = default_processor;
   }
 
+  // Replies to the given request (from a thread other than its network
+  // thread). Used internally.
+  void ReplyInSelectLoop(ServerRequest* req, HttpReturnCode status);
+
   // This is called in case an error occurred on the request
   void set_error_processor(ServerCallback* error_processor) {
     delete error_processor_;
@@ -324,6 +407,29 @@ class Server {
  private:
   void DefaultRequestProcessor(ServerRequest* req);
   void ErrorRequestProcessor(ServerRequest* req);
+  // The replies from other threads, that wait to be passed to the network
+  // thread of their connection - one queue per network selector. A batch
+  // is passed in one callback, scheduled by the first reply that gets in.
+  // The queues are reference counted (the server and each scheduled
+  // callback), as a callback can run after the server is gone.
+  typedef std::vector< std::pair<ServerRequest*, HttpReturnCode> > ReplyList;
+  struct ReplyQueue {
+    ReplyQueue() : ref_count_(1) {}
+    synch::Mutex mutex_;
+    ReplyList replies_;   // protected by mutex_
+    int ref_count_;       // protected by mutex_
+  };
+  // Sends the replies in queue, in the network thread of their selector,
+  // then releases the reference of the callback.
+  static void SendQueuedReplies(ReplyQueue* queue);
+  static void ReleaseReplyQueue(ReplyQueue* queue);
+  // Sends all the queued replies, and waits for the batches already
+  // scheduled in the network threads. Called on destruction, after
+  // anything that can produce replies has stopped.
+  void FlushQueuedReplies();
+  // Deletes callback if it was registered w/ auto_del_callback
+  // (w/ mutex_ held, after no lookup can return it)
+  void DeleteOwnedCallback(ServerCallback* callback);
 
   // Name of the server - we return this in the "Server" field
   const std::string name_;
@@ -342,24 +448,42 @@ class Server {
   // We use multiple acceptors, to listen on multiple ports.
   std::vector<ServerAcceptor*> acceptors_;
 
-  // Callbacks for processing regular
-  struct Processor {
-    ServerCallback* callback_;
-    bool auto_del_callback_;
-    Processor(ServerCallback* callback, bool auto_del_callback)
-      : callback_(callback), auto_del_callback_(auto_del_callback) {}
-    ~Processor() { if ( auto_del_callback_ ) { delete callback_; } }
+  // Processor callbacks, allowed ips (NULL -> All allowed) and streaming
+  // client flags and worker pools - per path. Lookups are lock free (and
+  // return the callback itself), updates are done under mutex_.
+  typedef PathRouter<ServerCallback, thread::ThreadPool> Router;
+  Router router_;
+  // The processor callbacks registered w/ auto_del_callback (by mutex_)
+  typedef hash_set<ServerCallback*> CallbackSet;
+  CallbackSet owned_callbacks_;
+
+  // A request waiting for a thread in a worker pool
+  class WorkerJob : public Closure {
+   public:
+    explicit WorkerJob(ServerRequest* req)
+        : Closure(false), req_(req) {
+    }
+    ServerRequest* req() const { return req_; }
+   protected:
+    virtual void RunInternal();
+   private:
+    ServerRequest* const req_;
   };
-  typedef std::map<std::string, Processor*> ProcessorMap;
-  ProcessorMap processors_;
+  // Our worker pools, by name
+  typedef std::map<std::string, thread::ThreadPool*> WorkerPoolMap;
+  WorkerPoolMap worker_pools_;
+  std::atomic<int64> num_shed_requests_;
+
+  // The reply queues, per network selector (protected by replies_mutex_)
+  typedef std::map<net::Selector*, ReplyQueue*> ReplyQueueMap;
+  ReplyQueueMap reply_queues_;
+  synch::Mutex replies_mutex_;
 
-  // Signals streaming clients
-  typedef std::map<std::string, bool> IsStreamingClientMap;
-  IsStreamingClientMap is_streaming_client_map_;
+  // Compresses our replies (if enabled)
+  ReplyCompressor* compressor_;
 
-  // Allowed ips / per path - NULL -> All allowed
-  typedef std::map<std::string, const net::IpV4Filter*> AllowedIpsMap;
-  AllowedIpsMap allowed_ips_;
+  // The reply templates that we gave out (protected by mutex_)
+  std::vector<ReplyTemplate*> reply_templates_;
 
   // This is called when we cannot find a processor for a given path
   // (by default we return a 404)
@@ -378,6 +502,7 @@ class Server {
   typedef hash_map<http::ServerProtocol*, int> ProtoReqMap;
   ProtoReqMap protocol_outstanding_requests_;
  private:
+  friend class ServerRequest;   // keeps its Router::Route
   DISALLOW_EVIL_CONSTRUCTORS(Server);
 };
 
@@ -441,9 +566,18 @@ class ServerConnection {
   int64 count_bytes_read() const {
     return net_connection_->count_bytes_read();
   }
+  // What protocol we agreed w/ the client at the connection setup (ALPN)
+  std::string application_protocol() const {
+    return net_connection_->application_protocol();
+  }
   void FlushAndClose() {
     net_connection_->FlushAndClose();
   }
+  // Processes the data that is already in inbuf() (e.g. after the protocol
+  // stopped parsing for a while)
+  void ProcessInbuf() {
+    ConnectionReadHandler();
+  }
   void ForceClose() {
     net_connection_->ForceClose();
   }
@@ -472,6 +606,8 @@ class ServerConnection {
 //        ones go through the server first, even if in the end come to us).
 //        We have this to separate the protocol decisions themselves
 //        from the implementation details of the communication channel.
+//        If the client speaks HTTP/2, we pass the conversation to
+//        an http::Http2ServerProtocol (see http2_server_protocol.h).
 //
 class ServerProtocol {
  public:
@@ -510,6 +646,10 @@ class ServerProtocol {
     if (sz_used >= protocol_params().max_reply_buffer_size_) return 0;
     return protocol_params().max_reply_buffer_size_ - sz_used;
   }
+  // The reply data of req that waits for its turn to go to the connection
+  size_t queued_output_bytes(const ServerRequest* req) const;
+  // Are we talking HTTP/2 ?
+  bool is_http2() const { return h2_ != NULL; }
 
   // Sets the underground TCP connection - call it once
   // (We also set some parameters)
@@ -537,10 +677,16 @@ class ServerProtocol {
     }
   }
   void ResumeReading() {
-    if ( connection_ != NULL ) {
+    if ( connection_ != NULL && paused_request_ == NULL ) {
       connection_->RequestReadEvents(true);
     }
   }
+  // Flow control on behalf of a request. For the request that we still
+  // receive (i.e. client streaming) we also stop parsing - its body waits
+  // in inbuf (and in the TCP buffers) until it resumes. On HTTP/2 only the
+  // stream of the request waits (see Http2ServerProtocol).
+  void PauseRequestReading(ServerRequest* req);
+  void ResumeRequestReading(ServerRequest* req);
   void ResumeWriting() {
     if ( connection_ != NULL ) {
       connection_->RequestWriteEvents(true);
@@ -584,8 +730,27 @@ class ServerProtocol {
  private:
   // Prepares what status to return on a parsing error
   void PrepareErrorRequest(ServerRequest* server_request);
+  // Sets the reply fields that we always send (Date, Server etc.)
+  void AddDefaultReplyFields(ServerRequest* req);
+  // Appends the reply of req to out - from the template, if not NULL
+  void AppendReply(ServerRequest* req, const ReplyTemplate* reply_template,
+                   io::MemoryStream* out);
+  // Passes the conversation to a Http2ServerProtocol
+  void StartHttp2();
   // This disposes the request and maybe closes the connection..
   void EndRequestProcessing(ServerRequest* req, bool is_eos);
+  // Same as above, for a request first in line (or orphaned).
+  // Returns true if the connection is closing.
+  bool EndFirstRequestProcessing(ServerRequest* req, bool is_eos);
+  // Where the reply of req goes now: to the connection if req is first in
+  // line, else to its own buffer, until the requests before it complete.
+  io::MemoryStream* ReplyBuffer(ServerRequest* req);
+  // Moves to the connection the replies buffered by the requests that got
+  // first in line (all in one go - so they leave in the same write).
+  void FlushQueuedReplies();
+  // Continues parsing the requests in inbuf, after we stopped because
+  // the pipeline was full.
+  void ResumeParsing();
   // Timeout handling - basically we close the connection
   void HandleTimeout(int64 timeout_id);
 
@@ -617,14 +782,27 @@ class ServerProtocol {
   // The connection that we process. THIS may GO AWAY
   ServerConnection* connection_;
 
-  // The connection that we process
+  // The request in process of receiving
   http::ServerRequest* crt_recv_;
-  // The request in process of sending
-
-  http::ServerRequest* crt_send_;
 
-  typedef std::set<http::ServerRequest*> RequestSet;
-  RequestSet active_requests_;
+  // The requests in process (fully received, or client streaming), in the
+  // order we received them. The replies go out in this order: only the
+  // first one writes directly to the connection, the others prepare their
+  // replies in their own buffers, and wait for their turn.
+  typedef std::deque<http::ServerRequest*> RequestQueue;
+  RequestQueue active_requests_;
+
+  // We stopped parsing (and reading) because the pipeline is full
+  bool parsing_paused_;
+  // The request in receiving that paused reading - we parse no more of
+  // its body until it resumes.
+  ServerRequest* paused_request_;
+
+  // We know if the client speaks HTTP/2 (i.e. we checked the start of the
+  // conversation for the connection preface).
+  bool h2_checked_;
+  // Talks HTTP/2 on the connection, if the client does
+  Http2ServerProtocol* h2_;
 
   // The address & port where we received the request. Copied from connection_
   net::HostPort local_address_;
@@ -635,6 +813,7 @@ class ServerProtocol {
   bool closed_;
 
   friend class Server;
+  friend class Http2ServerProtocol;
 
   DISALLOW_EVIL_CONSTRUCTORS(ServerProtocol);
 };
@@ -664,7 +843,12 @@ class ServerProtocol {
 //        is_server_streaming_ is true
 //  is_client_streaming_ - the client sends data in multiple chunks.
 //        when this is on, expect to have your handler called
-//        multiple times with the same ServerRequest
+//        multiple times with the same ServerRequest, each time w/ some
+//        new body data in request()->client_data() (at most
+//        client_streaming_read_size_ of encoded body). Consume it as it
+//        comes (and PauseReading() / ResumeReading() if you cannot keep
+//        up) to receive bodies of any size in bounded memory. The last
+//        call has is_parsing_finished() on.
 //  is_keep_alive_ - used internally, this signals a "Keep-Alive"
 //        underline http connection
 //  is_orphaned_ - is turned on by the server for connections that
@@ -695,6 +879,11 @@ class ServerRequest {
         is_keep_alive_(false),
         is_orphaned_(false),
         is_parsing_finished_(false),
+        reply_template_(NULL),
+        queued_reply_(NULL),
+        is_reply_done_(false),
+        should_close_(false),
+        stream_id_(0),
         ready_pending_limit_(0),
         ready_callback_(NULL),
         closed_callback_(NULL),
@@ -706,6 +895,7 @@ class ServerRequest {
     clear_closed_callback();
     delete ready_callback_;
     ready_callback_ = NULL;
+    delete queued_reply_;
   }
   //////////////////////////////////////////////////////////////////////
   //
@@ -753,8 +943,12 @@ class ServerRequest {
   void UpdateOutputBytes() {
     CHECK(protocol_->net_selector()->IsInSelectThread());
 
-    outbuf_size_ = protocol_->outbuf_size();
-    free_outbuf_size_ = protocol_->free_outbuf_size();
+    // While waiting for our turn, our reply is buffered on top of
+    // what the connection has to send
+    const size_t queued_size = protocol_->queued_output_bytes(this);
+    outbuf_size_ = protocol_->outbuf_size() + queued_size;
+    const size_t free_size = protocol_->free_outbuf_size();
+    free_outbuf_size_ = free_size > queued_size ? free_size - queued_size : 0;
   }
 
   // Who is on the other side of the wire ?
@@ -814,6 +1008,15 @@ class ServerRequest {
   void Reply() {
     ReplyWithStatus(http::OK);
   }
+  // Replies w/ the status and fields of the given template (see
+  // Server::RegisterReplyTemplate) and the body in request()->server_data().
+  // The fields set in request()->server_header() are ignored (except for
+  // the HTTP/1.0 and HTTP/2 replies) and the body is not compressed.
+  void ReplyWithTemplate(const ReplyTemplate* reply_template) {
+    reply_template_ = reply_template;
+    ReplyWithStatus(reply_template->status());
+  }
+  const ReplyTemplate* reply_template() const { return reply_template_; }
 
   //////////////////////////////////////////////////////////////////////
   //
@@ -854,12 +1057,13 @@ class ServerRequest {
     return protocol_->DetachFromFd(this);
   }
 
-  // Flow control functions:
+  // Flow control functions. A client streaming request is given no more
+  // body data while reading is paused.
   void PauseReading() {
-    protocol_->PauseReading();
+    protocol_->PauseRequestReading(this);
   }
   void ResumeReading() {
-    protocol_->ResumeReading();
+    protocol_->ResumeRequestReading(this);
   }
   void ResumeWriting() {
     protocol_->ResumeWriting();
@@ -892,6 +1096,8 @@ class ServerRequest {
   bool is_parsing_finished() const {
     return is_parsing_finished_;
   }
+  // The HTTP/2 stream of this request (0 if the client speaks HTTP/1.x)
+  uint32 stream_id() const { return stream_id_; }
   net::Selector* net_selector() { return protocol_->net_selector(); }
 
  private:
@@ -944,6 +1150,18 @@ class ServerRequest {
   bool is_keep_alive_;
   bool is_orphaned_;
   bool is_parsing_finished_;
+  // We reply w/ this template (if not NULL)
+  const ReplyTemplate* reply_template_;
+  // Our reply, while requests received before us on the same connection
+  // are still replying (NULL - we are first, or did not reply yet)
+  io::MemoryStream* queued_reply_;
+  // Our reply is complete, but waits in queued_reply_ for its turn
+  bool is_reply_done_;
+  // The connection closes after our reply (decided when the reply was
+  // prepared - applied when it is done, maybe much later if queued)
+  bool should_close_;
+  // The HTTP/2 stream of this request (0 for HTTP/1.x)
+  uint32 stream_id_;
   std::string client_request_id_;
   // When output pending bytes drops below this threshold, call read_callback_
   size_t ready_pending_limit_;
@@ -960,6 +1178,9 @@ class ServerRequest {
   // Used internally to signal the header is passed and request has some
   // specific members set.
   bool is_initialized_;
+  // What the server registered for our path - looked up once, when
+  // initialized
+  Server::Router::Route route_;
 
   // a proxy duplicate of the protocol_->connection_->net_connection->outbuf()
   //   ->Size(). Because this value is needed in media_thread for flow control,
@@ -969,6 +1190,7 @@ class ServerRequest {
 
   friend class Server;
   friend class ServerProtocol;
+  friend class Http2ServerProtocol;
 
   DISALLOW_EVIL_CONSTRUCTORS(ServerRequest);
 };
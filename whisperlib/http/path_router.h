@@ -0,0 +1,342 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A compressed trie (radix tree) of url paths, that resolves in a single
+// pass over the path, and w/o allocations, everything that http::Server
+// needs for a request: the processor, the allowed ips, the client
+// streaming flag and the worker pool - each from the most specific path
+// registered for it.
+//
+// As with io::FindPathBased, a registered path matches a request path if
+// it is the same, or a prefix ending right before or right after a '/'.
+// E.g. "/a/b/c" is served by the first registered path in
+//   "/a/b/c", "/a/b/", "/a/b", "/a/", "/a", "/", ""
+//
+// Lookups are lock free: the tree is never changed in place. An update
+// copies the nodes on the way to the changed one, publishes the new root,
+// waits for the lookups that may still see the old nodes (RCU style,
+// using two reader counters alternated by an epoch), and deletes them.
+// The reader counters are spread in slots, by thread, so concurrent
+// lookups do not contend on the same cache line. Updates are meant to be
+// rare (mostly at startup).
+//
+#ifndef __WHISPERLIB_HTTP_PATH_ROUTER_H__
+#define __WHISPERLIB_HTTP_PATH_ROUTER_H__
+
+#include <sched.h>
+#include <string.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+#include "whisperlib/base/types.h"
+#include "whisperlib/sync/mutex.h"
+
+namespace whisper {
+namespace net { class IpV4Filter; }
+
+namespace http {
+
+template <class P, class W = void>
+class PathRouter {
+ public:
+  // What is registered for a path
+  struct Entry {
+    Entry()
+        : processor_(NULL), has_ips_(false), ips_(NULL),
+          has_client_streaming_(false), is_client_streaming_(false),
+          has_worker_pool_(false), worker_pool_(NULL) {
+    }
+    bool empty() const {
+      return processor_ == NULL && !has_ips_ && !has_client_streaming_ &&
+          !has_worker_pool_;
+    }
+    P* processor_;
+    // If set, the allowed ips for the path (NULL - all allowed)
+    bool has_ips_;
+    const net::IpV4Filter* ips_;
+    // If set, the client streaming flag for the path
+    bool has_client_streaming_;
+    bool is_client_streaming_;
+    // If set, the worker pool for the path (NULL - none)
+    bool has_worker_pool_;
+    W* worker_pool_;
+  };
+  // The result of a lookup
+  struct Route {
+    Route()
+        : processor_(NULL), ips_(NULL), is_client_streaming_(false),
+          worker_pool_(NULL) {
+    }
+    P* processor_;
+    const net::IpV4Filter* ips_;
+    bool is_client_streaming_;
+    W* worker_pool_;
+  };
+
+  PathRouter()
+      : root_(new Node()), epoch_(0), size_(0) {
+    for ( size_t i = 0; i < kNumReaderSlots; ++i ) {
+      slots_[i].readers_[0] = 0;
+      slots_[i].readers_[1] = 0;
+    }
+  }
+  ~PathRouter() {
+    DeleteTree(root_.load());
+  }
+
+  // Lock free - can be called from any thread, anytime.
+  Route Find(const char* path, size_t size) const {
+    const uint32 epoch = epoch_.load();
+    std::atomic<int64>& readers =
+        slots_[ReaderSlotIndex()].readers_[epoch & 1];
+    ++readers;
+    Route route;
+    const Node* node = root_.load();
+    size_t pos = 0;
+    while ( true ) {
+      if ( pos == 0 || pos == size ||
+           path[pos] == '/' || path[pos - 1] == '/' ) {
+        const Entry& entry = node->entry_;
+        if ( entry.processor_ != NULL ) {
+          route.processor_ = entry.processor_;
+        }
+        if ( entry.has_ips_ ) {
+          route.ips_ = entry.ips_;
+        }
+        if ( entry.has_client_streaming_ ) {
+          route.is_client_streaming_ = entry.is_client_streaming_;
+        }
+        if ( entry.has_worker_pool_ ) {
+          route.worker_pool_ = entry.worker_pool_;
+        }
+      }
+      if ( pos == size ) {
+        break;
+      }
+      const Node* const child = node->FindChild(path[pos]);
+      if ( child == NULL ||
+           child->label_.size() > size - pos ||
+           memcmp(child->label_.data(), path + pos,
+                  child->label_.size()) != 0 ) {
+        break;
+      }
+      pos += child->label_.size();
+      node = child;
+    }
+    --readers;
+    return route;
+  }
+  Route Find(const std::string& path) const {
+    return Find(path.data(), path.size());
+  }
+
+  // Returns what is registered exactly for path (an empty entry if none)
+  Entry Get(const std::string& path) const {
+    synch::MutexLocker l(&mutex_);
+    const Node* node = root_.load();
+    size_t pos = 0;
+    while ( pos < path.size() ) {
+      node = node->FindChild(path[pos]);
+      if ( node == NULL ||
+           path.compare(pos, node->label_.size(), node->label_) != 0 ) {
+        return Entry();
+      }
+      pos += node->label_.size();
+    }
+    return node->entry_;
+  }
+
+  // Registers entry for path (replacing the current one). When this
+  // returns no lookup sees the old entry any more.
+  void Set(const std::string& path, const Entry& entry) {
+    synch::MutexLocker l(&mutex_);
+    std::vector<Node*> retired;
+    Node* const root = Insert(root_.load(), path.data(), path.size(),
+                              entry, &retired);
+    root_.store(root);
+    Synchronize();
+    for ( size_t i = 0; i < retired.size(); ++i ) {
+      delete retired[i];
+    }
+  }
+
+  // Number of paths w/ a non empty entry
+  size_t size() const {
+    synch::MutexLocker l(&mutex_);
+    return size_;
+  }
+
+  // Returns all the paths w/ a non empty entry, w/ their entries
+  void GetEntries(std::vector< std::pair<std::string, Entry> >* out) const {
+    synch::MutexLocker l(&mutex_);
+    std::string path;
+    CollectEntries(root_.load(), &path, out);
+  }
+
+ private:
+  // Per slot lookups in progress, by epoch parity. Padded to a cache line.
+  static const size_t kNumReaderSlots = 32;
+  struct ReaderSlot {
+    std::atomic<int64> readers_[2];
+    char padding_[64 - 2 * sizeof(std::atomic<int64>)];
+  };
+  // The reader slot of the calling thread (threads take them in turns)
+  static size_t ReaderSlotIndex() {
+    static std::atomic<size_t> next_index(0);
+    static thread_local size_t index = next_index++ % kNumReaderSlots;
+    return index;
+  }
+
+  struct Node {
+    Node() {
+    }
+    explicit Node(const char* label, size_t size)
+        : label_(label, size) {
+    }
+    const Node* FindChild(char c) const {
+      const char* const p = reinterpret_cast<const char*>(
+          memchr(child_chars_.data(), c, child_chars_.size()));
+      return p == NULL ? NULL : children_[p - child_chars_.data()];
+    }
+    // The path piece from our parent to us
+    std::string label_;
+    // The first char in the label of each child, and the children
+    // (which may be shared w/ other versions of this node)
+    std::string child_chars_;
+    std::vector<Node*> children_;
+    Entry entry_;
+  };
+
+  // Returns a copy of node (which is retired) w/ the path below it set to
+  // entry.
+  Node* Insert(Node* node, const char* path, size_t size,
+               const Entry& entry, std::vector<Node*>* retired) {
+    Node* const copy = new Node(*node);
+    retired->push_back(node);
+    if ( size == 0 ) {
+      size_ += int(!entry.empty()) - int(!copy->entry_.empty());
+      copy->entry_ = entry;
+      return copy;
+    }
+    const char* const p = reinterpret_cast<const char*>(
+        memchr(copy->child_chars_.data(), path[0], copy->child_chars_.size()));
+    if ( p == NULL ) {
+      if ( !entry.empty() ) {
+        Node* const leaf = new Node(path, size);
+        leaf->entry_ = entry;
+        ++size_;
+        copy->child_chars_.push_back(path[0]);
+        copy->children_.push_back(leaf);
+      }
+      return copy;
+    }
+    const size_t index = p - copy->child_chars_.data();
+    Node* const child = copy->children_[index];
+    size_t common = 0;
+    while ( common < child->label_.size() && common < size &&
+            child->label_[common] == path[common] ) {
+      ++common;
+    }
+    if ( common == child->label_.size() ) {
+      copy->children_[index] = Insert(child, path + common, size - common,
+                                      entry, retired);
+      return copy;
+    }
+    if ( entry.empty() ) {
+      return copy;   // nothing to clear
+    }
+    // Split the child label at common
+    Node* const middle = new Node(path, common);
+    Node* const rest = new Node(*child);
+    retired->push_back(child);
+    rest->label_.erase(0, common);
+    middle->child_chars_.push_back(rest->label_[0]);
+    middle->children_.push_back(rest);
+    if ( common == size ) {
+      middle->entry_ = entry;
+    } else {
+      Node* const leaf = new Node(path + common, size - common);
+      leaf->entry_ = entry;
+      middle->child_chars_.push_back(leaf->label_[0]);
+      middle->children_.push_back(leaf);
+    }
+    ++size_;
+    copy->children_[index] = middle;
+    return copy;
+  }
+
+  // Waits for all the lookups that may have seen the previous root
+  void Synchronize() {
+    for ( int i = 0; i < 2; ++i ) {
+      // New lookups go to the other counter, we wait for the current one
+      const uint32 epoch = epoch_.fetch_add(1);
+      for ( size_t j = 0; j < kNumReaderSlots; ++j ) {
+        while ( slots_[j].readers_[epoch & 1].load() != 0 ) {
+          sched_yield();
+        }
+      }
+    }
+  }
+
+  static void DeleteTree(Node* node) {
+    for ( size_t i = 0; i < node->children_.size(); ++i ) {
+      DeleteTree(node->children_[i]);
+    }
+    delete node;
+  }
+
+  static void CollectEntries(
+      const Node* node, std::string* path,
+      std::vector< std::pair<std::string, Entry> >* out) {
+    const size_t size = path->size();
+    path->append(node->label_);
+    if ( !node->entry_.empty() ) {
+      out->push_back(std::make_pair(*path, node->entry_));
+    }
+    for ( size_t i = 0; i < node->children_.size(); ++i ) {
+      CollectEntries(node->children_[i], path, out);
+    }
+    path->resize(size);
+  }
+
+  // Serializes the updates
+  mutable synch::Mutex mutex_;
+  std::atomic<Node*> root_;
+  std::atomic<uint32> epoch_;
+  mutable ReaderSlot slots_[kNumReaderSlots];
+  size_t size_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(PathRouter);
+};
+
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_HTTP_PATH_ROUTER_H__
@@ -0,0 +1,215 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <strings.h>
+#include <algorithm>
+
+#include "whisperlib/http/static_file_handler.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/http/http_compression.h"
+#include "whisperlib/base/core_errno.h"
+#include "whisperlib/base/strutil.h"
+
+namespace whisper {
+namespace http {
+
+namespace {
+struct ContentType {
+  const char* extension_;
+  const char* content_type_;
+};
+static const ContentType kContentTypes[] = {
+  { "html", "text/html" },
+  { "htm", "text/html" },
+  { "css", "text/css" },
+  { "js", "application/javascript" },
+  { "json", "application/json" },
+  { "xml", "text/xml" },
+  { "txt", "text/plain" },
+  { "jpg", "image/jpeg" },
+  { "jpeg", "image/jpeg" },
+  { "gif", "image/gif" },
+  { "png", "image/png" },
+  { "svg", "image/svg+xml" },
+  { "ico", "image/x-icon" },
+  { "pdf", "application/pdf" },
+  { "mp3", "audio/mpeg" },
+  { "mp4", "video/mp4" },
+  { "flv", "video/x-flv" },
+  { "ts", "video/mp2t" },
+  { "m3u8", "application/vnd.apple.mpegurl" },
+};
+static const char kDefaultContentType[] = "application/octet-stream";
+
+void CloseFile(int fd) {
+  ::close(fd);
+}
+
+// Reads size bytes from the start of fd into out
+bool ReadFile(int fd, int64 size, io::MemoryStream* out) {
+  int64 offset = 0;
+  while ( offset < size ) {
+    char* buffer = NULL;
+    size_t buffer_size = 0;
+    out->GetScratchSpace(&buffer, &buffer_size);
+    const ssize_t cb = ::pread(
+        fd, buffer, std::min(static_cast<int64>(buffer_size), size - offset),
+        offset);
+    if ( cb <= 0 ) {
+      if ( cb < 0 && errno == EINTR ) {
+        out->ConfirmScratch(0);
+        continue;
+      }
+      out->ConfirmScratch(0);
+      LOG_ERROR << "Error reading static file: "
+                << GetLastSystemErrorDescription();
+      return false;
+    }
+    out->ConfirmScratch(cb);
+    offset += cb;
+  }
+  return true;
+}
+}
+
+StaticFileHandler::StaticFileHandler(Server* server,
+                                     const std::string& path,
+                                     const std::string& root_dir,
+                                     bool is_public)
+    : server_(server),
+      path_(path),
+      root_dir_(root_dir) {
+  server_->RegisterProcessor(
+      path_, NewPermanentCallback(this, &StaticFileHandler::ProcessRequest),
+      is_public, true);
+}
+
+StaticFileHandler::~StaticFileHandler() {
+  server_->UnregisterProcessor(path_);
+}
+
+// static
+const char* StaticFileHandler::GetContentType(const std::string& filename) {
+  const size_t pos_dot = filename.rfind('.');
+  const size_t pos_slash = filename.rfind('/');
+  if ( pos_dot == std::string::npos ||
+       (pos_slash != std::string::npos && pos_dot < pos_slash) ) {
+    return kDefaultContentType;
+  }
+  const char* const extension = filename.c_str() + pos_dot + 1;
+  for ( size_t i = 0; i < NUMBEROF(kContentTypes); ++i ) {
+    if ( !strcasecmp(extension, kContentTypes[i].extension_) ) {
+      return kContentTypes[i].content_type_;
+    }
+  }
+  return kDefaultContentType;
+}
+
+void StaticFileHandler::ProcessRequest(ServerRequest* req) {
+  Request* const request = req->request();
+  const HttpMethod method = request->client_header()->method();
+  if ( method != METHOD_GET && method != METHOD_HEAD ) {
+    request->server_header()->AddField(kHeaderAllow, "GET, HEAD", true);
+    req->ReplyWithStatus(METHOD_NOT_ALLOWED);
+    return;
+  }
+  if ( request->url() == NULL ) {
+    req->ReplyWithStatus(BAD_REQUEST);
+    return;
+  }
+  std::string rel_path(URL::UrlUnescape(request->url()->path()));
+  if ( strutil::StrStartsWith(rel_path, path_) ) {
+    rel_path = rel_path.substr(path_.size());
+  }
+  // No way out of root_dir_
+  if ( rel_path.find('\0') != std::string::npos ||
+       rel_path == ".." ||
+       strutil::StrStartsWith(rel_path, "../") ||
+       strutil::StrEndsWith(rel_path, "/..") ||
+       rel_path.find("/../") != std::string::npos ) {
+    req->ReplyWithStatus(FORBIDDEN);
+    return;
+  }
+  std::string file_path(strutil::JoinPaths(root_dir_, rel_path));
+  if ( rel_path.empty() || rel_path[rel_path.size() - 1] == '/' ) {
+    file_path = strutil::JoinPaths(file_path, "index.html");
+  }
+  const int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if ( fd < 0 ) {
+    req->ReplyWithStatus((errno == ENOENT || errno == ENOTDIR)
+                         ? NOT_FOUND : FORBIDDEN);
+    return;
+  }
+  struct stat st;
+  if ( ::fstat(fd, &st) || !S_ISREG(st.st_mode) ) {
+    ::close(fd);
+    req->ReplyWithStatus(FORBIDDEN);
+    return;
+  }
+  Header* const hs = request->server_header();
+  hs->AddField(kHeaderContentType, GetContentType(file_path), true);
+  // A strong validator for this version of the file
+  hs->AddField(kHeaderETag, strutil::StringPrintf(
+                   "\"%llx-%llx\"",
+                   static_cast<unsigned long long>(st.st_size),
+                   static_cast<unsigned long long>(st.st_mtime)), true);
+  ReplyCompressor* const compressor = server_->compressor();
+  if ( compressor != NULL && method == METHOD_GET ) {
+    const ContentCoding coding = compressor->SelectCoding(
+        *request->client_header(), *hs, st.st_size);
+    // The server compresses the data once, and serves it from the cache
+    // of its compressor afterwards (by ETag)
+    if ( coding != CODING_IDENTITY ) {
+      if ( compressor->ServeFromCache(request, coding) ||
+           ReadFile(fd, st.st_size, request->server_data()) ) {
+        ::close(fd);
+        req->Reply();
+        return;
+      }
+      request->server_data()->Clear();
+    }
+  }
+  // Compressing would mean reading the file data
+  request->set_server_use_gzip_encoding(false, false);
+  if ( method == METHOD_HEAD || st.st_size == 0 ) {
+    request->server_header()->AddField(
+        kHeaderContentLength, strutil::Int64ToString(st.st_size), true);
+    ::close(fd);
+  } else {
+    request->server_data()->AppendFileRegion(
+        fd, 0, st.st_size, NewCallback(&CloseFile, fd));
+  }
+  req->Reply();
+}
+
+}  // namespace http
+}  // namespace whisper
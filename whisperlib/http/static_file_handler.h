@@ -0,0 +1,84 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Serves the files under a directory. The file data is not read in memory:
+// the replies carry file regions (see io::MemoryStream::AppendFileRegion),
+// that the connections send w/ sendfile.
+// The exception: when the server compresses its replies (see
+// http::Server::EnableCompression), the compressible files are read and
+// compressed once, then served from the cache of the server compressor
+// (by ETag).
+//
+
+#ifndef __NET_HTTP_STATIC_FILE_HANDLER_H__
+#define __NET_HTTP_STATIC_FILE_HANDLER_H__
+
+#include <string>
+#include "whisperlib/base/types.h"
+
+namespace whisper {
+namespace http {
+
+class Server;
+class ServerRequest;
+
+class StaticFileHandler {
+ public:
+  // Serves GET / HEAD requests for path/<file> w/ root_dir/<file>
+  // (and path/<dir>/ w/ root_dir/<dir>/index.html).
+  // We don't own the server, which must be around while we live.
+  StaticFileHandler(Server* server,
+                    const std::string& path,
+                    const std::string& root_dir,
+                    bool is_public = true);
+  ~StaticFileHandler();
+
+  const std::string& path() const {
+    return path_;
+  }
+  const std::string& root_dir() const {
+    return root_dir_;
+  }
+
+  // The content type that we send for this file (by extension)
+  static const char* GetContentType(const std::string& filename);
+
+ private:
+  void ProcessRequest(ServerRequest* req);
+
+  Server* const server_;
+  const std::string path_;
+  const std::string root_dir_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(StaticFileHandler);
+};
+}  // namespace http
+}  // namespace whisper
+
+#endif  // __NET_HTTP_STATIC_FILE_HANDLER_H__
@@ -0,0 +1,354 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Simulates a set of local backends (http::Server-s) of which one is
+// artificially slow, and sends them requests through a FailSafeClient
+// w/ each balancing policy, w/ and w/o hedging. Reports the share of the
+// slow backend and the latency percentiles, and checks that latency
+// aware balancing avoids the slow backend, that consistent hashing keeps
+// a key on a backend, and that hedging cuts the tail latency.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/failsafe_http_client.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/sync/event.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_backends,
+             8,
+             "Simulate these many backends ..");
+DEFINE_int32(fast_latency_ms,
+             2,
+             ".. that reply after this time ..");
+DEFINE_int32(slow_latency_ms,
+             25,
+             ".. except for one that replies after this time");
+DEFINE_int32(concurrency,
+             8,
+             "Keep these many requests in flight");
+DEFINE_int32(num_requests,
+             600,
+             "Send these many requests for a policy");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+struct Backend {
+  int index_;
+  int latency_ms_;
+  int64 num_requests_;
+  net::HostPort address_;
+  http::Server* server_;
+};
+
+// Replies w/ the index of the backend, after its latency
+void HandleWork(Backend* backend, http::ServerRequest* req) {
+  ++backend->num_requests_;
+  req->request()->server_data()->Write(
+      strutil::StringPrintf("%d", backend->index_));
+  req->net_selector()->RegisterAlarm(
+      NewCallback(req, &http::ServerRequest::Reply), backend->latency_ms_);
+}
+
+void StartServer(Backend* backend) {
+  backend->server_->RegisterProcessor("/work",
+      NewPermanentCallback(&HandleWork, backend), true, true);
+  backend->server_->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+http::BaseClientConnection* CreateConnection(net::Selector* selector,
+                                             net::NetFactory* net_factory) {
+  return new http::SimpleClientConnection(selector, *net_factory,
+                                          net::PROTOCOL_TCP);
+}
+
+net::HostPort FreePort() {
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  ::close(tmp_fd);
+  return net::HostPort("127.0.0.1", ntohs(tmp_addr.sin_port));
+}
+
+// What we got from a run
+struct Result {
+  std::vector<int64> latencies_us_;
+  std::vector<int64> per_backend_;
+  // The backend that served each key
+  std::map<std::string, std::vector<int> > key_backends_;
+  http::FailSafeClient::PoolStats stats_;
+  int64 Percentile(double p) const {
+    std::vector<int64> sorted(latencies_us_);
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(size_t(p * sorted.size()), sorted.size() - 1)];
+  }
+  // How many requests took about as long as the slow backend
+  int NumSlow() const {
+    int num = 0;
+    for ( size_t i = 0; i < latencies_us_.size(); ++i ) {
+      num += (latencies_us_[i] >= FLAGS_slow_latency_ms * 900);
+    }
+    return num;
+  }
+};
+
+// Keeps a number of requests in flight through a FailSafeClient, until
+// a total number completes. Runs in the selector thread of the client.
+class Load {
+ public:
+  Load(http::FailSafeClient* fsc, Result* result)
+      : fsc_(fsc),
+        result_(result),
+        num_started_(0),
+        num_done_(0),
+        done_(false, true) {
+    result_->per_backend_.resize(FLAGS_num_backends, 0);
+  }
+  void Run() {
+    fsc_->selector()->RunInSelectLoop(NewCallback(this, &Load::Start));
+    CHECK(done_.Wait(60000)) << " Load timed out: " << num_done_;
+  }
+
+ private:
+  void Start() {
+    for ( int i = 0; i < FLAGS_concurrency; ++i ) {
+      StartOne();
+    }
+  }
+  void StartOne() {
+    if ( num_started_ >= FLAGS_num_requests ) {
+      return;
+    }
+    http::ClientRequest* const req = new http::ClientRequest(
+        http::METHOD_GET, strutil::StringPrintf("/work?id=%d", num_started_));
+    req->set_balance_key(strutil::StringPrintf("key%d", num_started_ % 200));
+    ++num_started_;
+    fsc_->StartRequest(req, NewCallback(this, &Load::Done, req,
+                                        timer::TicksUsec()));
+  }
+  void Done(http::ClientRequest* req, int64 start_us) {
+    CHECK_EQ(req->error(), http::CONN_OK) << req->error_name();
+    CHECK_EQ(req->request()->server_header()->status_code(), http::OK);
+    result_->latencies_us_.push_back(timer::TicksUsec() - start_us);
+    const int backend = ::atoi(
+        req->request()->server_data()->ToString().c_str());
+    CHECK_LT(backend, FLAGS_num_backends);
+    ++result_->per_backend_[backend];
+    result_->key_backends_[req->balance_key()].push_back(backend);
+    delete req;
+    if ( ++num_done_ == FLAGS_num_requests ) {
+      fsc_->GetPoolStats(&result_->stats_);
+      done_.Signal();
+    } else {
+      StartOne();
+    }
+  }
+
+  http::FailSafeClient* const fsc_;
+  Result* const result_;
+  int num_started_;
+  int num_done_;
+  synch::Event done_;
+};
+
+struct Client {
+  net::Selector* selector_;
+  net::NetFactory* net_factory_;
+  http::ClientParams params_;
+  std::vector<net::HostPort> servers_;
+  http::FailSafeClient* fsc_;
+};
+
+void CreateClient(Client* c, http::FailSafeClient::BalancePolicy policy,
+                  bool hedge) {
+  c->fsc_ = new http::FailSafeClient(
+      c->selector_, &c->params_, c->servers_,
+      NewPermanentCallback(&CreateConnection, c->selector_, c->net_factory_),
+      true, 3, 20000, 2000, "");
+  http::FailSafeClient::PoolParams pool_params;
+  pool_params.max_connections_per_host_ = FLAGS_concurrency;
+  c->fsc_->SetPoolParams(pool_params);
+  c->fsc_->SetBalancePolicy(policy);
+  http::FailSafeClient::HedgeParams hedge_params;
+  hedge_params.enabled_ = hedge;
+  hedge_params.percentile_ = 0.75;
+  hedge_params.max_hedge_percent_ = 30;
+  c->fsc_->SetHedgeParams(hedge_params);
+}
+
+void DeleteClient(Client* c) {
+  delete c->fsc_;
+  c->fsc_ = NULL;
+}
+
+Result Run(Client* c, http::FailSafeClient::BalancePolicy policy,
+           bool hedge) {
+  net::SelectorPool::RunInSelectLoopAndWait(
+      c->selector_, NewCallback(&CreateClient, c, policy, hedge));
+  Result result;
+  Load load(c->fsc_, &result);
+  load.Run();
+  net::SelectorPool::RunInSelectLoopAndWait(
+      c->selector_, NewCallback(&DeleteClient, c));
+  LOG_INFO << " " << http::FailSafeClient::BalancePolicyName(policy)
+           << (hedge ? " w/ hedging" : "") << ": slow backend got "
+           << result.per_backend_[0] << " / " << FLAGS_num_requests
+           << " - p50: " << result.Percentile(0.5) / 1000.0
+           << " ms p99: " << result.Percentile(0.99) / 1000.0
+           << " ms p99.9: " << result.Percentile(0.999) / 1000.0 << " ms"
+           << " - slow requests: " << result.NumSlow();
+  LOG_INFO << "   " << result.stats_.ToString();
+  return result;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  std::vector<Backend> backends(FLAGS_num_backends);
+  for ( int i = 0; i < FLAGS_num_backends; ++i ) {
+    Backend& backend = backends[i];
+    backend.index_ = i;
+    // The first one is the slow one
+    backend.latency_ms_ = (i == 0 ? FLAGS_slow_latency_ms
+                           : FLAGS_fast_latency_ms);
+    backend.num_requests_ = 0;
+    backend.address_ = FreePort();
+    backend.server_ = new http::Server(
+        "failsafe_balance_test", server_thread.mutable_selector(),
+        net_factory, params);
+    backend.server_->AddAcceptor(net::PROTOCOL_TCP, backend.address_);
+    net::SelectorPool::RunInSelectLoopAndWait(
+        server_thread.mutable_selector(), NewCallback(&StartServer, &backend));
+  }
+
+  net::SelectorThread client_thread;
+  client_thread.Start();
+  net::NetFactory client_net_factory(client_thread.mutable_selector());
+  Client c;
+  c.selector_ = client_thread.mutable_selector();
+  c.net_factory_ = &client_net_factory;
+  for ( int i = 0; i < FLAGS_num_backends; ++i ) {
+    c.servers_.push_back(backends[i].address_);
+  }
+  c.fsc_ = NULL;
+
+  const Result least = Run(&c, http::FailSafeClient::BALANCE_LEAST_OUTSTANDING,
+                           false);
+  const Result p2c = Run(&c, http::FailSafeClient::BALANCE_P2C_EWMA, false);
+  const Result hash = Run(&c, http::FailSafeClient::BALANCE_CONSISTENT_HASH,
+                          false);
+  const Result least_hedged = Run(
+      &c, http::FailSafeClient::BALANCE_LEAST_OUTSTANDING, true);
+  const Result hash_hedged = Run(
+      &c, http::FailSafeClient::BALANCE_CONSISTENT_HASH, true);
+  Run(&c, http::FailSafeClient::BALANCE_P2C_EWMA, true);
+  client_thread.Stop();
+
+  // The latency aware policy keeps away from the slow backend
+  CHECK_LT(p2c.per_backend_[0], FLAGS_num_requests / FLAGS_num_backends / 2);
+  CHECK_LT(p2c.per_backend_[0], least.per_backend_[0]);
+  // Consistent hashing keeps each key on a backend, and spreads the keys
+  int num_used = 0;
+  for ( int i = 0; i < FLAGS_num_backends; ++i ) {
+    num_used += (hash.per_backend_[i] > 0);
+  }
+  CHECK_GT(num_used, 1);
+  for ( std::map<std::string, std::vector<int> >::const_iterator
+            it = hash.key_backends_.begin();
+        it != hash.key_backends_.end(); ++it ) {
+    for ( size_t i = 1; i < it->second.size(); ++i ) {
+      CHECK_EQ(it->second[i], it->second[0]) << it->first;
+    }
+  }
+  // Hedging cuts the tail: the keys of the slow backend are served
+  // by another one
+  CHECK_GT(hash_hedged.stats_.requests_hedged_, 0);
+  CHECK_GT(hash_hedged.stats_.hedges_won_, 0);
+  CHECK_GT(hash_hedged.stats_.losers_canceled_, 0);
+  CHECK_LT(hash_hedged.NumSlow() * 2, hash.NumSlow());
+  CHECK_LE(least_hedged.NumSlow(), least.NumSlow());
+
+  for ( int i = 0; i < FLAGS_num_backends; ++i ) {
+    net::SelectorPool::RunInSelectLoopAndWait(
+        server_thread.mutable_selector(),
+        NewCallback(&StopServer, backends[i].server_));
+  }
+  const int64 start = timer::TicksMsec();
+  for ( int i = 0; i < FLAGS_num_backends; ++i ) {
+    while ( backends[i].server_->num_connections() > 0 ) {
+      CHECK_LT(timer::TicksMsec() - start, 10000);
+      ::usleep(1000);
+    }
+    net::SelectorPool::RunInSelectLoopAndWait(
+        server_thread.mutable_selector(),
+        NewCallback(&DeleteServer, backends[i].server_));
+  }
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
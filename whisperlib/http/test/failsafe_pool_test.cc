@@ -0,0 +1,354 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the connection pool of http::FailSafeClient against a local
+// http::Server that stands in for a backend (replies after a fixed
+// latency): pre-connecting, growing the pool under load, least loaded
+// selection, idle reaping and failing over from a dead server. Then
+// reports the request rate vs. the number of concurrent requests, for a
+// single connection and for a pool.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/failsafe_http_client.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/sync/event.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(backend_latency_ms,
+             2,
+             "The backend replies after this time");
+DEFINE_int32(pool_size,
+             16,
+             "Benchmark: max connections per server for the pool");
+DEFINE_int32(num_requests,
+             300,
+             "Benchmark: send these many requests for a concurrency level");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// "/work" - replies w/ the path, after backend_latency_ms
+void HandleWork(http::ServerRequest* req) {
+  req->request()->server_data()->Write(req->request()->url()->path());
+  req->net_selector()->RegisterAlarm(
+      NewCallback(req, &http::ServerRequest::Reply),
+      FLAGS_backend_latency_ms);
+}
+
+void StartServer(http::Server* server) {
+  server->RegisterProcessor("/work",
+      NewPermanentCallback(&HandleWork), true, true);
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+http::BaseClientConnection* CreateConnection(net::Selector* selector,
+                                             net::NetFactory* net_factory) {
+  return new http::SimpleClientConnection(selector, *net_factory,
+                                          net::PROTOCOL_TCP);
+}
+
+net::HostPort FreePort() {
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  ::close(tmp_fd);
+  return net::HostPort("127.0.0.1", ntohs(tmp_addr.sin_port));
+}
+
+// Keeps a number of requests in flight through a FailSafeClient, until
+// a total number completes.
+class Load {
+ public:
+  Load(http::FailSafeClient* fsc, int concurrency, int num_requests)
+      : fsc_(fsc),
+        concurrency_(concurrency),
+        num_requests_(num_requests),
+        num_started_(0),
+        num_done_(0),
+        max_open_(0),
+        done_(false, true) {
+  }
+  // Runs in the selector thread
+  void Start() {
+    for ( int i = 0; i < concurrency_; ++i ) {
+      StartOne();
+    }
+  }
+  // Runs in the main thread - returns the duration in nanoseconds
+  int64 Run() {
+    const int64 start = timer::TicksNsec();
+    fsc_->selector()->RunInSelectLoop(NewCallback(this, &Load::Start));
+    CHECK(done_.Wait(60000)) << " Load timed out: " << num_done_;
+    return timer::TicksNsec() - start;
+  }
+  int32 max_open() const { return max_open_; }
+
+ private:
+  void StartOne() {
+    if ( num_started_ >= num_requests_ ) {
+      return;
+    }
+    http::ClientRequest* const req = new http::ClientRequest(
+        http::METHOD_GET,
+        strutil::StringPrintf("/work/%d", num_started_));
+    ++num_started_;
+    fsc_->StartRequest(req, NewCallback(this, &Load::Done, req));
+    http::FailSafeClient::PoolStats stats;
+    fsc_->GetPoolStats(&stats);
+    max_open_ = std::max(max_open_, stats.open_connections_);
+  }
+  void Done(http::ClientRequest* req) {
+    CHECK_EQ(req->error(), http::CONN_OK) << req->error_name();
+    CHECK_EQ(req->request()->server_header()->status_code(), http::OK);
+    CHECK_EQ(req->request()->server_data()->ToString(),
+             req->request()->client_header()->uri());
+    delete req;
+    if ( ++num_done_ == num_requests_ ) {
+      done_.Signal();
+    } else {
+      StartOne();
+    }
+  }
+
+  http::FailSafeClient* const fsc_;
+  const int concurrency_;
+  const int num_requests_;
+  int num_started_;
+  int num_done_;
+  int32 max_open_;
+  synch::Event done_;
+};
+
+struct Client {
+  net::Selector* selector_;
+  net::NetFactory* net_factory_;
+  http::ClientParams params_;
+  http::FailSafeClient* fsc_;
+};
+
+void CreateClient(Client* c, const std::vector<net::HostPort>* servers,
+                  const http::FailSafeClient::PoolParams* pool_params) {
+  c->fsc_ = new http::FailSafeClient(
+      c->selector_, &c->params_, *servers,
+      NewPermanentCallback(&CreateConnection, c->selector_, c->net_factory_),
+      true, 3, 20000, 2000, "");
+  c->fsc_->SetPoolParams(*pool_params);
+}
+
+void DeleteClient(Client* c) {
+  delete c->fsc_;
+  c->fsc_ = NULL;
+}
+
+void GetPoolStats(http::FailSafeClient* fsc,
+                  http::FailSafeClient::PoolStats* stats) {
+  fsc->GetPoolStats(stats);
+}
+
+http::FailSafeClient::PoolStats PoolStats(Client* c) {
+  http::FailSafeClient::PoolStats stats;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      c->selector_, NewCallback(&GetPoolStats, c->fsc_, &stats));
+  return stats;
+}
+
+void StartClient(Client* c, const std::vector<net::HostPort>& servers,
+                 const http::FailSafeClient::PoolParams& pool_params) {
+  net::SelectorPool::RunInSelectLoopAndWait(
+      c->selector_, NewCallback(&CreateClient, c, &servers, &pool_params));
+}
+
+void StopClient(Client* c) {
+  net::SelectorPool::RunInSelectLoopAndWait(
+      c->selector_, NewCallback(&DeleteClient, c));
+}
+
+void TestPool(Client* c, const net::HostPort& server) {
+  http::FailSafeClient::PoolParams pool_params;
+  pool_params.min_connections_per_host_ = 2;
+  pool_params.max_connections_per_host_ = 4;
+  pool_params.idle_timeout_ms_ = 200;
+  StartClient(c, std::vector<net::HostPort>(1, server), pool_params);
+
+  // Pre-connected
+  http::FailSafeClient::PoolStats stats = PoolStats(c);
+  CHECK_EQ(stats.open_connections_, 2);
+  CHECK_EQ(stats.connections_opened_, 2);
+
+  // Under load the pool grows up to its maximum ..
+  Load load(c->fsc_, 10, 100);
+  load.Run();
+  CHECK_EQ(load.max_open(), 4);
+  stats = PoolStats(c);
+  LOG_INFO << " After load: " << stats.ToString();
+  CHECK_EQ(stats.open_connections_, 4);
+  CHECK_EQ(stats.connections_opened_, 4);
+  CHECK_EQ(stats.requests_sent_, 100);
+  CHECK_GT(stats.requests_queued_, 0);
+  CHECK_EQ(stats.outstanding_requests_, 0);
+  CHECK_EQ(stats.pending_requests_, 0);
+
+  // .. one request at a time uses the warm connections ..
+  Load serial(c->fsc_, 1, 20);
+  serial.Run();
+  stats = PoolStats(c);
+  CHECK_EQ(stats.connections_opened_, 4);
+
+  // .. and the idle ones are reaped down to the minimum
+  const int64 start = timer::TicksMsec();
+  while ( stats.connections_reaped_ < 2 ) {
+    CHECK_LT(timer::TicksMsec() - start, 5000);
+    ::usleep(50000);
+    stats = PoolStats(c);
+  }
+  LOG_INFO << " After reaping: " << stats.ToString();
+  CHECK_EQ(stats.open_connections_, 2);
+  CHECK_EQ(stats.connections_failed_, 0);
+  StopClient(c);
+  LOG_INFO << "Pool test PASS";
+}
+
+void TestFailover(Client* c, const net::HostPort& server) {
+  std::vector<net::HostPort> servers;
+  servers.push_back(FreePort());   // none listening here
+  servers.push_back(server);
+  http::FailSafeClient::PoolParams pool_params;
+  pool_params.max_connections_per_host_ = 2;
+  StartClient(c, servers, pool_params);
+
+  Load load(c->fsc_, 4, 40);
+  load.Run();
+  const http::FailSafeClient::PoolStats stats = PoolStats(c);
+  LOG_INFO << " After failover: " << stats.ToString();
+  CHECK_GT(stats.connections_failed_, 0);
+  CHECK_GT(stats.requests_sent_, 40);
+  StopClient(c);
+  LOG_INFO << "Failover test PASS";
+}
+
+// Returns the requests per second
+double RunLoad(Client* c, const net::HostPort& server,
+               int pool_size, int concurrency) {
+  http::FailSafeClient::PoolParams pool_params;
+  pool_params.min_connections_per_host_ = pool_size;
+  pool_params.max_connections_per_host_ = pool_size;
+  StartClient(c, std::vector<net::HostPort>(1, server), pool_params);
+  Load load(c->fsc_, concurrency, FLAGS_num_requests);
+  const int64 duration = load.Run();
+  const double rate = FLAGS_num_requests * 1e9 / duration;
+  LOG_INFO << " " << pool_size << " connections, " << concurrency
+           << " concurrent requests: " << FLAGS_num_requests
+           << " requests in " << duration / 1000000 << " ms - "
+           << int64(rate) << " requests per second";
+  StopClient(c);
+  return rate;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  const net::HostPort server_address = FreePort();
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  http::Server* const server = new http::Server(
+      "failsafe_pool_test", server_thread.mutable_selector(), net_factory,
+      params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  net::SelectorThread client_thread;
+  client_thread.Start();
+  net::NetFactory client_net_factory(client_thread.mutable_selector());
+  Client c;
+  c.selector_ = client_thread.mutable_selector();
+  c.net_factory_ = &client_net_factory;
+  c.fsc_ = NULL;
+
+  TestPool(&c, server_address);
+  TestFailover(&c, server_address);
+
+  static const int kConcurrency[] = { 1, 4, 16, 64 };
+  for ( size_t i = 0; i < NUMBEROF(kConcurrency); ++i ) {
+    const double rate1 = RunLoad(&c, server_address, 1, kConcurrency[i]);
+    const double rate = RunLoad(&c, server_address,
+                                FLAGS_pool_size, kConcurrency[i]);
+    LOG_INFO << " Concurrency " << kConcurrency[i]
+             << " - pool speedup: " << rate / rate1;
+  }
+  client_thread.Stop();
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
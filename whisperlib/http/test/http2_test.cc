@@ -0,0 +1,894 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the HTTP/2 support of http::Server: HPACK (w/ the examples from
+// RFC 7541), then a blocking HTTP/2 client (prior knowledge) checks
+// multiplexed replies, request bodies, flow control, stream priorities and
+// the limit of concurrent streams. In the end compares the request rate
+// and latency of HTTP/2 (all requests on one connection) w/ HTTP/1.1 (a
+// connection per request in flight).
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/hpack.h"
+#include "whisperlib/http/http2_frames.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(concurrency,
+             8,
+             "Benchmark: keep these many requests in flight");
+DEFINE_int32(num_requests,
+             20000,
+             "Benchmark: send these many requests for each protocol");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+std::string Hex(const std::string& s) {
+  std::string ret;
+  for ( size_t i = 0; i < s.size(); ++i ) {
+    ret += strutil::StringPrintf("%02x", static_cast<uint8>(s[i]));
+  }
+  return ret;
+}
+
+std::string Unhex(const char* s) {
+  std::string ret;
+  for ( ; s[0] && s[1]; s += 2 ) {
+    ret.push_back(static_cast<char>(::strtol(std::string(s, 2).c_str(),
+                                             NULL, 16)));
+  }
+  return ret;
+}
+
+void DecodeBlock(http::hpack::Decoder* decoder, const char* hex,
+                 const http::hpack::Fields& expected, size_t table_size) {
+  const std::string block(Unhex(hex));
+  http::hpack::Fields fields;
+  CHECK(decoder->Decode(block.data(), block.size(), 1 << 16, &fields));
+  CHECK_EQ(fields.size(), expected.size());
+  for ( size_t i = 0; i < fields.size(); ++i ) {
+    CHECK_EQ(fields[i].first, expected[i].first);
+    CHECK_EQ(fields[i].second, expected[i].second);
+  }
+  CHECK_EQ(decoder->table().size(), table_size);
+}
+
+void TestHpack() {
+  // RFC 7541, C.1 - integers
+  std::string s;
+  http::hpack::EncodeInteger(10, 5, 0, &s);
+  CHECK_EQ(Hex(s), "0a");
+  s.clear();
+  http::hpack::EncodeInteger(1337, 5, 0, &s);
+  CHECK_EQ(Hex(s), "1f9a0a");
+  const uint8* p = reinterpret_cast<const uint8*>(s.data());
+  uint32 value = 0;
+  CHECK(http::hpack::DecodeInteger(&p, p + s.size(), 5, &value));
+  CHECK_EQ(value, 1337);
+
+  // C.4.1 - Huffman
+  s.clear();
+  http::hpack::HuffmanEncode("www.example.com", 15, &s);
+  CHECK_EQ(Hex(s), "f1e3c2e5f23a6ba0ab90f4ff");
+  std::string d;
+  CHECK(http::hpack::HuffmanDecode(s.data(), s.size(), &d));
+  CHECK_EQ(d, "www.example.com");
+  // Bad padding (zeros) is an error
+  s = Unhex("f1e3c2e5f23a6ba0ab90f400");
+  d.clear();
+  CHECK(!http::hpack::HuffmanDecode(s.data(), s.size(), &d));
+  // All the bytes go through
+  std::string all;
+  for ( int i = 0; i < 256; ++i ) {
+    all.push_back(static_cast<char>(i));
+  }
+  s.clear();
+  d.clear();
+  http::hpack::HuffmanEncode(all.data(), all.size(), &s);
+  CHECK_EQ(s.size(), http::hpack::HuffmanEncodedSize(all.data(), all.size()));
+  CHECK(http::hpack::HuffmanDecode(s.data(), s.size(), &d));
+  CHECK(d == all);
+
+  // C.4 - requests w/ Huffman coding, on the same decoder
+  http::hpack::Decoder decoder;
+  http::hpack::Fields expected;
+  expected.push_back(http::hpack::Field(":method", "GET"));
+  expected.push_back(http::hpack::Field(":scheme", "http"));
+  expected.push_back(http::hpack::Field(":path", "/"));
+  expected.push_back(http::hpack::Field(":authority", "www.example.com"));
+  DecodeBlock(&decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff", expected, 57);
+  expected.push_back(http::hpack::Field("cache-control", "no-cache"));
+  DecodeBlock(&decoder, "828684be5886a8eb10649cbf", expected, 110);
+  expected.clear();
+  expected.push_back(http::hpack::Field(":method", "GET"));
+  expected.push_back(http::hpack::Field(":scheme", "https"));
+  expected.push_back(http::hpack::Field(":path", "/index.html"));
+  expected.push_back(http::hpack::Field(":authority", "www.example.com"));
+  expected.push_back(http::hpack::Field("custom-key", "custom-value"));
+  DecodeBlock(&decoder,
+              "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf",
+              expected, 164);
+  // A bad index kills the decoder
+  http::hpack::Fields fields;
+  s = Unhex("ff00");
+  CHECK(!decoder.Decode(s.data(), s.size(), 1 << 16, &fields));
+
+  // Our encoder and decoder agree - through table updates and evictions
+  http::hpack::Encoder encoder;
+  http::hpack::Decoder decoder2;
+  size_t total_size = 0;
+  for ( int i = 0; i < 200; ++i ) {
+    http::hpack::Fields f;
+    f.push_back(http::hpack::Field(":status", "200"));
+    f.push_back(http::hpack::Field("content-type", "text/html"));
+    f.push_back(http::hpack::Field(strutil::StringPrintf("x-field-%d", i % 30),
+                                   strutil::StringPrintf("value %d", i % 17)));
+    f.push_back(http::hpack::Field("x-big", std::string(i * 13, 'a' + i % 26)));
+    if ( i == 100 ) {
+      encoder.set_max_table_size(256);
+    }
+    std::string block;
+    encoder.Encode(f, &block);
+    total_size += block.size();
+    http::hpack::Fields out;
+    CHECK(decoder2.Decode(block.data(), block.size(), 1 << 16, &out));
+    CHECK_EQ(out.size(), f.size());
+    for ( size_t j = 0; j < f.size(); ++j ) {
+      CHECK(out[j] == f[j]) << i << ": " << out[j].first;
+    }
+    CHECK_EQ(decoder2.table().size(), encoder.table().size());
+  }
+  LOG_INFO << "HPACK test PASS - " << total_size << " bytes encoded";
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// The replies contain the path of the request
+
+void HandleNow(http::ServerRequest* req) {
+  req->request()->server_data()->Write(req->request()->url()->path());
+  req->Reply();
+}
+
+// "/later/<ms>" - replies after <ms>
+void HandleLater(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  req->request()->server_data()->Write(path);
+  const int64 ms = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->net_selector()->RegisterAlarm(
+      NewCallback(req, &http::ServerRequest::Reply), ms);
+}
+
+void EndStream(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  req->request()->server_data()->Write(path.substr(path.size() / 2));
+  req->ContinueStreamingData();
+  req->EndStreamingData();
+}
+
+// "/stream/<ms>" - streams the path in two chunks, <ms> apart
+void HandleStream(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  const int64 ms = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->BeginStreamingData(http::OK, NULL, true);
+  req->request()->server_data()->Write(path.substr(0, path.size() / 2));
+  req->ContinueStreamingData();
+  req->net_selector()->RegisterAlarm(NewCallback(&EndStream, req), ms);
+}
+
+// "/big/<n>" - replies w/ n bytes
+void HandleBig(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  const int64 n = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->request()->server_data()->Write(std::string(n, 'x'));
+  req->Reply();
+}
+
+// Replies w/ the request body
+void HandleEcho(http::ServerRequest* req) {
+  CHECK(req->stream_id() != 0);
+  req->request()->server_data()->AppendStream(
+      req->request()->client_data());
+  req->Reply();
+}
+
+// Client streaming - consumes the body slowly (pausing the reading in
+// between), and replies w/ its size
+std::map<http::ServerRequest*, int64> g_upload_size;
+void ConsumeUpload(http::ServerRequest* req) {
+  if ( req->is_orphaned() ) {
+    g_upload_size.erase(req);
+    req->Reply();   // (goes nowhere)
+    return;
+  }
+  g_upload_size[req] += req->request()->client_data()->Size();
+  req->request()->client_data()->Clear();
+  req->ResumeReading();
+}
+void HandleUpload(http::ServerRequest* req) {
+  // The client keeps to the window of the stream
+  CHECK_LE(req->request()->client_data()->Size(),
+           http::http2::kDefaultWindowSize);
+  if ( !req->is_parsing_finished() ) {
+    req->PauseReading();
+    req->net_selector()->RegisterAlarm(NewCallback(&ConsumeUpload, req), 2);
+    return;
+  }
+  const int64 size = g_upload_size[req] +
+                     req->request()->client_data()->Size();
+  g_upload_size.erase(req);
+  req->request()->client_data()->Clear();
+  req->request()->server_data()->Write(strutil::Int64ToString(size));
+  req->Reply();
+}
+
+void StartServer(http::Server* server) {
+  server->RegisterProcessor("/now",
+      NewPermanentCallback(&HandleNow), true, true);
+  server->RegisterProcessor("/later",
+      NewPermanentCallback(&HandleLater), true, true);
+  server->RegisterProcessor("/stream",
+      NewPermanentCallback(&HandleStream), true, true);
+  server->RegisterProcessor("/big",
+      NewPermanentCallback(&HandleBig), true, true);
+  server->RegisterProcessor("/echo",
+      NewPermanentCallback(&HandleEcho), true, true);
+  server->RegisterProcessor("/upload",
+      NewPermanentCallback(&HandleUpload), true, true);
+  server->RegisterClientStreaming("/upload", true);
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+int Connect(const struct sockaddr_storage& addr) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0);
+  // The client writes small frames (e.g. SETTINGS acks) before requests
+  const int one = 1;
+  CHECK_EQ(::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)), 0);
+  CHECK_EQ(::connect(fd, reinterpret_cast<const struct sockaddr*>(&addr),
+                     sizeof(struct sockaddr_in)), 0);
+  return fd;
+}
+
+void WriteAll(int fd, io::MemoryStream* out) {
+  std::string s;
+  out->ReadString(&s);
+  size_t pos = 0;
+  while ( pos < s.size() ) {
+    const ssize_t cb = ::write(fd, s.data() + pos, s.size() - pos);
+    CHECK_GT(cb, 0);
+    pos += cb;
+  }
+}
+
+// A blocking HTTP/2 client (w/ prior knowledge)
+class Http2Client {
+ public:
+  struct Response {
+    Response()
+        : status_(0), done_(false), reset_(false), reset_error_(0),
+          recv_window_(0), send_window_(http::http2::kDefaultWindowSize),
+          done_ns_(0) {
+    }
+    int status_;
+    std::map<std::string, std::string> headers_;
+    std::string body_;
+    bool done_;
+    bool reset_;
+    uint32 reset_error_;
+    int64 recv_window_;
+    // What the server allows us to send, and what waits for that
+    int64 send_window_;
+    std::string pending_body_;
+    int64 done_ns_;
+  };
+
+  Http2Client(const struct sockaddr_storage& addr, uint32 initial_window)
+      : fd_(Connect(addr)),
+        next_stream_id_(1),
+        initial_window_(initial_window),
+        header_stream_id_(0),
+        header_flags_(0),
+        recv_window_(http::http2::kDefaultWindowSize),
+        send_window_(http::http2::kDefaultWindowSize) {
+    out_.Write(http::http2::kConnectionPreface,
+               http::http2::kConnectionPrefaceSize);
+    http::http2::Settings settings;
+    settings.push_back(std::make_pair(
+        static_cast<uint16>(http::http2::SETTINGS_INITIAL_WINDOW_SIZE),
+        initial_window_));
+    http::http2::WriteSettings(settings, &out_);
+    // A large connection window - the streams limit the flow
+    http::http2::WriteWindowUpdate(0, 1 << 30, &out_);
+    recv_window_ += 1 << 30;
+    Flush();
+  }
+  ~Http2Client() {
+    ::close(fd_);
+  }
+
+  // Queues a request, returns its stream id (call Flush to send)
+  uint32 Request(const std::string& method, const std::string& path,
+                 const std::string& body = "", int weight = 0) {
+    const uint32 id = WriteHeaders(method, path, body.empty(), weight);
+    responses_[id].pending_body_ = body;
+    SendBody(id);
+    return id;
+  }
+  // Opens a POST stream w/o sending its body
+  uint32 OpenStream(const std::string& path) {
+    return WriteHeaders("POST", path, false, 0);
+  }
+  // Sends size bytes on the stream, w/o minding the flow control
+  void SendDataUnchecked(uint32 id, size_t size) {
+    const std::string data(http::http2::kDefaultMaxFrameSize, 'x');
+    for ( size_t pos = 0; pos < size; pos += data.size() ) {
+      http::http2::WriteFrame(http::http2::FRAME_DATA, 0, id, data.data(),
+                              std::min(size - pos, data.size()), &out_);
+    }
+  }
+  // Ends the stream w/ a trailers HEADERS frame
+  void SendTrailers(uint32 id) {
+    http::hpack::Fields fields;
+    fields.push_back(http::hpack::Field("x-trailer", "done"));
+    std::string block;
+    encoder_.Encode(fields, &block);
+    http::http2::WriteFrame(
+        http::http2::FRAME_HEADERS,
+        http::http2::FLAG_END_HEADERS | http::http2::FLAG_END_STREAM,
+        id, block.data(), block.size(), &out_);
+  }
+  void Flush() {
+    WriteAll(fd_, &out_);
+  }
+  // Reads until the stream is done
+  const Response& Wait(uint32 id) {
+    while ( !responses_[id].done_ ) {
+      ReadFrame();
+    }
+    return responses_[id];
+  }
+  const Response& response(uint32 id) {
+    return responses_[id];
+  }
+  void Forget(uint32 id) {
+    responses_.erase(id);
+  }
+
+ private:
+  void ReadFrame() {
+    http::http2::FrameHeader fh;
+    while ( !http::http2::PeekFrameHeader(in_, &fh) ||
+            in_.Size() < http::http2::kFrameHeaderSize + fh.length_ ) {
+      char buf[16384];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      in_.Write(buf, cb);
+    }
+    in_.Skip(http::http2::kFrameHeaderSize);
+    std::string payload;
+    in_.ReadString(&payload, fh.length_);
+    switch ( fh.type_ ) {
+      case http::http2::FRAME_SETTINGS:
+        if ( (fh.flags_ & http::http2::FLAG_ACK) == 0 ) {
+          http::http2::WriteSettingsAck(&out_);
+          Flush();
+        }
+        break;
+      case http::http2::FRAME_HEADERS:
+      case http::http2::FRAME_CONTINUATION:
+        if ( fh.type_ == http::http2::FRAME_HEADERS ) {
+          header_stream_id_ = fh.stream_id_;
+          header_flags_ = fh.flags_;
+          header_block_.clear();
+        }
+        CHECK_EQ(fh.stream_id_, header_stream_id_);
+        header_block_.append(payload);
+        if ( fh.flags_ & http::http2::FLAG_END_HEADERS ) {
+          ProcessHeaders();
+        }
+        break;
+      case http::http2::FRAME_DATA: {
+        // The server keeps to our windows
+        Response& r = responses_[fh.stream_id_];
+        r.recv_window_ -= fh.length_;
+        recv_window_ -= fh.length_;
+        CHECK_GE(r.recv_window_, 0) << " stream: " << fh.stream_id_;
+        CHECK_GE(recv_window_, 0);
+        r.body_.append(payload);
+        if ( fh.flags_ & http::http2::FLAG_END_STREAM ) {
+          Done(&r);
+        } else if ( fh.length_ > 0 ) {
+          http::http2::WriteWindowUpdate(fh.stream_id_, fh.length_, &out_);
+          r.recv_window_ += fh.length_;
+        }
+        if ( recv_window_ < (1 << 29) ) {
+          http::http2::WriteWindowUpdate(0, 1 << 29, &out_);
+          recv_window_ += 1 << 29;
+        }
+        Flush();
+        break;
+      }
+      case http::http2::FRAME_RST_STREAM: {
+        Response& r = responses_[fh.stream_id_];
+        r.reset_ = true;
+        r.reset_error_ = http::http2::DecodeUInt32(payload.data());
+        Done(&r);
+        break;
+      }
+      case http::http2::FRAME_WINDOW_UPDATE: {
+        const uint32 increment = http::http2::DecodeUInt32(payload.data());
+        if ( fh.stream_id_ == 0 ) {
+          send_window_ += increment;
+          for ( std::map<uint32, Response>::const_iterator
+                    it = responses_.begin(); it != responses_.end(); ++it ) {
+            SendBody(it->first);
+          }
+        } else {
+          responses_[fh.stream_id_].send_window_ += increment;
+          SendBody(fh.stream_id_);
+        }
+        Flush();
+        break;
+      }
+      case http::http2::FRAME_PING:
+        if ( (fh.flags_ & http::http2::FLAG_ACK) == 0 ) {
+          http::http2::WritePing(payload.data(), true, &out_);
+          Flush();
+        }
+        break;
+      case http::http2::FRAME_GOAWAY:
+        LOG_FATAL << "Unexpected GOAWAY: "
+                  << http::http2::ErrorCodeName(
+                      http::http2::DecodeUInt32(payload.data() + 4));
+        break;
+    }
+  }
+  void ProcessHeaders() {
+    http::hpack::Fields fields;
+    CHECK(decoder_.Decode(header_block_.data(), header_block_.size(),
+                          1 << 16, &fields));
+    Response& r = responses_[header_stream_id_];
+    for ( size_t i = 0; i < fields.size(); ++i ) {
+      if ( fields[i].first == ":status" ) {
+        r.status_ = ::atoi(fields[i].second.c_str());
+      } else {
+        r.headers_[fields[i].first] = fields[i].second;
+      }
+    }
+    if ( header_flags_ & http::http2::FLAG_END_STREAM ) {
+      Done(&r);
+    }
+  }
+  // Starts a stream - returns its id
+  uint32 WriteHeaders(const std::string& method, const std::string& path,
+                      bool end_stream, int weight) {
+    const uint32 id = next_stream_id_;
+    next_stream_id_ += 2;
+    http::hpack::Fields fields;
+    fields.push_back(http::hpack::Field(":method", method));
+    fields.push_back(http::hpack::Field(":scheme", "http"));
+    fields.push_back(http::hpack::Field(":authority", "localhost"));
+    fields.push_back(http::hpack::Field(":path", path));
+    fields.push_back(http::hpack::Field("user-agent", "http2_test"));
+    std::string block;
+    encoder_.Encode(fields, &block);
+    uint8 flags = http::http2::FLAG_END_HEADERS;
+    if ( end_stream ) {
+      flags |= http::http2::FLAG_END_STREAM;
+    }
+    if ( weight > 0 ) {
+      flags |= http::http2::FLAG_PRIORITY;
+      std::string priority(4, '\0');
+      priority.push_back(static_cast<char>(weight - 1));
+      block = priority + block;
+    }
+    http::http2::WriteFrame(http::http2::FRAME_HEADERS, flags, id,
+                            block.data(), block.size(), &out_);
+    responses_[id].recv_window_ = initial_window_;
+    return id;
+  }
+  // Sends what the windows allow from the body of the stream
+  void SendBody(uint32 id) {
+    Response& r = responses_[id];
+    while ( !r.pending_body_.empty() &&
+            r.send_window_ > 0 && send_window_ > 0 ) {
+      const size_t size = std::min(
+          r.pending_body_.size(),
+          static_cast<size_t>(std::min(
+              std::min(r.send_window_, send_window_),
+              static_cast<int64>(http::http2::kDefaultMaxFrameSize))));
+      const uint8 flags = (size == r.pending_body_.size()
+                           ? http::http2::FLAG_END_STREAM : 0);
+      http::http2::WriteFrame(http::http2::FRAME_DATA, flags, id,
+                              r.pending_body_.data(), size, &out_);
+      r.pending_body_.erase(0, size);
+      r.send_window_ -= size;
+      send_window_ -= size;
+    }
+  }
+  void Done(Response* r) {
+    r->done_ = true;
+    r->done_ns_ = timer::TicksNsec();
+  }
+
+  const int fd_;
+  io::MemoryStream in_;
+  io::MemoryStream out_;
+  http::hpack::Encoder encoder_;
+  http::hpack::Decoder decoder_;
+  uint32 next_stream_id_;
+  const uint32 initial_window_;
+  std::map<uint32, Response> responses_;
+  std::string header_block_;
+  uint32 header_stream_id_;
+  uint8 header_flags_;
+  int64 recv_window_;
+  int64 send_window_;
+};
+
+// A blocking HTTP/1.1 client, w/ a request in flight
+class Http1Client {
+ public:
+  explicit Http1Client(const struct sockaddr_storage& addr)
+      : fd_(Connect(addr)),
+        parser_("client") {
+  }
+  ~Http1Client() {
+    ::close(fd_);
+  }
+  void Send(const std::string& path) {
+    io::MemoryStream out;
+    out.Write("GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    WriteAll(fd_, &out);
+  }
+  std::string ReadReply() {
+    http::Request reply;
+    parser_.Clear();
+    while ( true ) {
+      if ( !inbuf_.IsEmpty() ) {
+        const int32 state = parser_.ParseServerReply(&inbuf_, &reply);
+        if ( state & http::RequestParser::REQUEST_FINISHED ) {
+          break;
+        }
+        if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+          continue;
+        }
+      }
+      char buf[16384];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      inbuf_.Write(buf, cb);
+    }
+    CHECK_EQ(reply.server_header()->status_code(), http::OK);
+    return reply.server_data()->ToString();
+  }
+ private:
+  const int fd_;
+  http::RequestParser parser_;
+  io::MemoryStream inbuf_;
+};
+
+//////////////////////////////////////////////////////////////////////
+
+void TestRequests(const struct sockaddr_storage& addr) {
+  Http2Client client(addr, http::http2::kDefaultWindowSize);
+  const uint32 id = client.Request("GET", "/now/first");
+  client.Flush();
+  const Http2Client::Response& r = client.Wait(id);
+  CHECK_EQ(r.status_, 200);
+  CHECK_EQ(r.body_, "/now/first");
+  CHECK_EQ(r.headers_.find("content-length")->second, "10");
+  CHECK(r.headers_.find("server") != r.headers_.end());
+  CHECK(r.headers_.find("connection") == r.headers_.end());
+
+  // Multiplexed: the replies come as they are ready
+  std::vector<std::string> paths;
+  paths.push_back("/later/200");
+  paths.push_back("/stream/100");
+  paths.push_back("/later/50");
+  paths.push_back("/now/x");
+  paths.push_back("/nothing/here");
+  std::vector<uint32> ids;
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    ids.push_back(client.Request("GET", paths[i]));
+  }
+  client.Flush();
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    const Http2Client::Response& r = client.Wait(ids[i]);
+    if ( i == paths.size() - 1 ) {
+      CHECK_EQ(r.status_, 404);
+    } else {
+      CHECK_EQ(r.status_, 200);
+      CHECK_EQ(r.body_, paths[i]);
+    }
+  }
+  CHECK_LT(client.response(ids[3]).done_ns_, client.response(ids[2]).done_ns_);
+  CHECK_LT(client.response(ids[2]).done_ns_, client.response(ids[1]).done_ns_);
+  CHECK_LT(client.response(ids[1]).done_ns_, client.response(ids[0]).done_ns_);
+  CHECK(client.response(ids[1]).headers_.find("content-length") ==
+        client.response(ids[1]).headers_.end());
+
+  // Request bodies (larger than the initial window)
+  std::string body;
+  for ( int i = 0; body.size() < 200000; ++i ) {
+    body += strutil::StringPrintf("%d,", i);
+  }
+  const uint32 echo_id = client.Request("POST", "/echo", body);
+  client.Flush();
+  CHECK_EQ(client.Wait(echo_id).status_, 200);
+  CHECK(client.Wait(echo_id).body_ == body);
+  LOG_INFO << "Requests test PASS";
+}
+
+void TestFlowControl(const struct sockaddr_storage& addr) {
+  // Small stream windows - the client checks that the server keeps to them
+  Http2Client client(addr, 1000);
+  const uint32 id = client.Request("GET", "/big/300000");
+  client.Flush();
+  const Http2Client::Response& r = client.Wait(id);
+  CHECK_EQ(r.status_, 200);
+  CHECK_EQ(r.body_.size(), 300000);
+
+  // Our data goes as the processor consumes it
+  const uint32 upload_id = client.Request("POST", "/upload",
+                                          std::string(300000, 'u'));
+  client.Flush();
+  CHECK_EQ(client.Wait(upload_id).status_, 200);
+  CHECK_EQ(client.Wait(upload_id).body_, "300000");
+
+  // Data over the window resets the stream
+  const uint32 bad_id = client.OpenStream("/upload");
+  client.SendDataUnchecked(bad_id, 3 * http::http2::kDefaultWindowSize);
+  client.Flush();
+  CHECK(client.Wait(bad_id).reset_);
+  CHECK_EQ(client.Wait(bad_id).reset_error_, http::http2::ERROR_FLOW_CONTROL);
+  const uint32 after_id = client.Request("GET", "/now/after");
+  client.Flush();
+  CHECK_EQ(client.Wait(after_id).body_, "/now/after");
+  LOG_INFO << "Flow control test PASS";
+}
+
+void TestReadTimeout(const struct sockaddr_storage& addr,
+                     int64 timeout_ms) {
+  Http2Client client(addr, http::http2::kDefaultWindowSize);
+  // A request w/o its body never reaches the processor
+  const int64 start = timer::TicksMsec();
+  const uint32 id = client.OpenStream("/echo");
+  client.Flush();
+  CHECK(client.Wait(id).reset_);
+  CHECK_EQ(client.Wait(id).reset_error_, http::http2::ERROR_CANCEL);
+  CHECK_GE(timer::TicksMsec() - start, timeout_ms);
+  const uint32 after_id = client.Request("GET", "/now/after");
+  client.Flush();
+  CHECK_EQ(client.Wait(after_id).body_, "/now/after");
+  {
+    // .. nor when the client goes away
+    Http2Client gone_client(addr, http::http2::kDefaultWindowSize);
+    gone_client.OpenStream("/echo");
+    gone_client.Flush();
+  }
+  LOG_INFO << "Read timeout test PASS";
+}
+
+void TestPriority(const struct sockaddr_storage& addr) {
+  Http2Client client(addr, http::http2::kMaxWindowSize);
+  const size_t kSize = 1 << 20;
+  const std::string path = strutil::StringPrintf("/big/%d",
+                                                 static_cast<int>(kSize));
+  const uint32 light = client.Request("GET", path, "", 16);
+  const uint32 heavy = client.Request("GET", path, "", 256);
+  client.Flush();
+  CHECK_EQ(client.Wait(heavy).body_.size(), kSize);
+  const size_t light_size = client.response(light).body_.size();
+  LOG_INFO << "When the heavy stream completed the light one got: "
+           << light_size << " bytes";
+  // The light stream starts first, but gets 1/16 of the heavy one
+  CHECK_LT(light_size, kSize / 2);
+  CHECK_EQ(client.Wait(light).body_.size(), kSize);
+  LOG_INFO << "Priority test PASS";
+}
+
+void TestRefusedStreams(const struct sockaddr_storage& addr,
+                        size_t max_streams) {
+  Http2Client client(addr, http::http2::kDefaultWindowSize);
+  std::vector<uint32> ids;
+  for ( size_t i = 0; i < max_streams + 2; ++i ) {
+    ids.push_back(client.Request("GET", "/later/50"));
+  }
+  client.Flush();
+  size_t num_refused = 0;
+  uint32 refused_id = 0;
+  for ( size_t i = 0; i < ids.size(); ++i ) {
+    const Http2Client::Response& r = client.Wait(ids[i]);
+    if ( r.reset_ ) {
+      ++num_refused;
+      refused_id = ids[i];
+    } else {
+      CHECK_EQ(r.body_, "/later/50");
+    }
+  }
+  CHECK_EQ(num_refused, 2);
+  // Trailers on a refused stream reset just that stream
+  client.SendTrailers(refused_id);
+  // And the connection is still good
+  const uint32 id = client.Request("GET", "/now/after");
+  client.Flush();
+  CHECK_EQ(client.Wait(id).body_, "/now/after");
+  LOG_INFO << "Refused streams test PASS";
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void LogBenchmark(const char* name, int num_connections, int64 num_done,
+                  int64 duration, int64 total_latency) {
+  LOG_INFO << " " << name << ": " << num_connections << " connections, "
+           << num_done << " requests in " << duration / 1000000 << " ms - "
+           << static_cast<int64>(num_done * 1e9 / duration)
+           << " requests per second, mean latency: "
+           << total_latency / num_done / 1000 << " us";
+}
+
+void RunHttp2Benchmark(const struct sockaddr_storage& addr,
+                       int concurrency, int num_requests) {
+  Http2Client client(addr, http::http2::kDefaultWindowSize);
+  const int num_rounds = std::max(1, num_requests / concurrency);
+  std::vector<uint32> ids(concurrency);
+  int64 total_latency = 0;
+  const int64 start = timer::TicksNsec();
+  for ( int round = 0; round < num_rounds; ++round ) {
+    const int64 sent = timer::TicksNsec();
+    for ( int i = 0; i < concurrency; ++i ) {
+      ids[i] = client.Request("GET", strutil::StringPrintf("/now/%d", i));
+    }
+    client.Flush();
+    for ( int i = 0; i < concurrency; ++i ) {
+      const Http2Client::Response& r = client.Wait(ids[i]);
+      CHECK_EQ(r.status_, 200);
+      total_latency += r.done_ns_ - sent;
+      client.Forget(ids[i]);
+    }
+  }
+  LogBenchmark("HTTP/2", 1, int64(num_rounds) * concurrency,
+               timer::TicksNsec() - start, total_latency);
+}
+
+void RunHttp1Benchmark(const struct sockaddr_storage& addr,
+                       int concurrency, int num_requests) {
+  std::vector<Http1Client*> clients;
+  for ( int i = 0; i < concurrency; ++i ) {
+    clients.push_back(new Http1Client(addr));
+  }
+  const int num_rounds = std::max(1, num_requests / concurrency);
+  int64 total_latency = 0;
+  const int64 start = timer::TicksNsec();
+  for ( int round = 0; round < num_rounds; ++round ) {
+    const int64 sent = timer::TicksNsec();
+    for ( int i = 0; i < concurrency; ++i ) {
+      clients[i]->Send(strutil::StringPrintf("/now/%d", i));
+    }
+    for ( int i = 0; i < concurrency; ++i ) {
+      CHECK_EQ(clients[i]->ReadReply(), strutil::StringPrintf("/now/%d", i));
+      total_latency += timer::TicksNsec() - sent;
+    }
+  }
+  LogBenchmark("HTTP/1.1", concurrency, int64(num_rounds) * concurrency,
+               timer::TicksNsec() - start, total_latency);
+  for ( int i = 0; i < concurrency; ++i ) {
+    delete clients[i];
+  }
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  TestHpack();
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  params.max_concurrent_requests_per_connection_ = 8;
+  // Small, so the stream scheduling shows
+  params.max_reply_buffer_size_ = 1 << 16;
+  params.request_read_timeout_ms_ = 500;
+  http::Server* const server = new http::Server(
+      "http2_test", server_thread.mutable_selector(), net_factory, params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+  TestRequests(addr);
+  TestFlowControl(addr);
+  TestReadTimeout(addr, params.request_read_timeout_ms_);
+  TestPriority(addr);
+  TestRefusedStreams(addr, params.max_concurrent_requests_per_connection_);
+
+  RunHttp1Benchmark(addr, FLAGS_concurrency, FLAGS_num_requests);
+  RunHttp2Benchmark(addr, FLAGS_concurrency, FLAGS_num_requests);
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,613 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the compression of http::Server replies w/ http::ReplyCompressor:
+// the content coding negotiation, the round trip through the pooled
+// compressors, the thresholds, the offload threads and the cache of
+// compressed static files. As a benchmark, compares the cpu / byte and the
+// latency of small requests under a load of large compressible replies -
+// w/ the per request gzip of http::Request, then w/ the compressor.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/http_compression.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/http/static_file_handler.h"
+#include "whisperlib/io/zlib/zlibwrapper.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/sync/thread.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(large_size,
+             128 << 10,
+             "Benchmark: size of the large replies");
+DEFINE_int32(num_large_clients,
+             4,
+             "Benchmark: these many clients get large replies, in a loop");
+DEFINE_int32(num_small_requests,
+             100,
+             "Benchmark: measure the latency of these many small requests");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// Some text that compresses like the real one (more or less)
+std::string MakeText(size_t size) {
+  static const char* const kWords[] = {
+    "<div class=\"item\">", "</div>\n", "whisper", "lib", "server",
+    "request", "reply", "the", "of", "and", "compression", "<span>",
+    "</span>", " ", ", ", "http", "selector", "connection", "{\"id\": ",
+    "}", "value", "name",
+  };
+  std::string s;
+  uint32 seed = 17;
+  while ( s.size() < size ) {
+    seed = seed * 1103515245 + 12345;
+    s.append(kWords[(seed >> 16) % NUMBEROF(kWords)]);
+    if ( (seed >> 8) % 7 == 0 ) {
+      s.append(strutil::IntToString((seed >> 4) % 10000));
+    }
+  }
+  s.resize(size);
+  return s;
+}
+
+std::string Decode(http::ContentCoding coding, io::MemoryStream* in) {
+  io::MemoryStream out;
+  if ( coding == http::CODING_GZIP ) {
+    io::ZlibGzipDecodeWrapper decoder;
+    const int err = decoder.Decode(in, &out);
+    CHECK(err == Z_OK || err == Z_STREAM_END) << " Gzip error: " << err;
+  } else if ( coding == http::CODING_DEFLATE ) {
+    io::ZlibInflateWrapper inflater;
+    const int err = inflater.Inflate(in, &out);
+    CHECK_EQ(err, Z_STREAM_END);
+  } else {
+    LOG_FATAL << "Cannot decode: " << http::ContentCodingName(coding);
+  }
+  return out.ToString();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void TestSelectCoding() {
+  http::CompressionParams params;
+  http::ReplyCompressor compressor(params);
+  http::Header hs;
+  hs.AddField(http::kHeaderContentType, "text/html; charset=utf-8", true);
+  struct Case {
+    const char* accept_encoding_;
+    http::ContentCoding coding_;
+  };
+#if defined(HAVE_LIBZSTD) && defined(HAVE_ZSTD_H)
+  const http::ContentCoding kZstdOrGzip = http::CODING_ZSTD;
+#else
+  const http::ContentCoding kZstdOrGzip = http::CODING_GZIP;
+#endif
+  const Case kCases[] = {
+    { NULL, http::CODING_IDENTITY },
+    { "gzip, deflate", http::CODING_GZIP },
+    { "deflate", http::CODING_DEFLATE },
+    { "gzip;q=0.5, deflate", http::CODING_DEFLATE },
+    { "gzip;q=0, deflate;q=0", http::CODING_IDENTITY },
+    { "identity", http::CODING_IDENTITY },
+    { "br", http::CODING_IDENTITY },
+    { "*", http::CODING_GZIP },
+    { "zstd;q=0.9, gzip", http::CODING_GZIP },
+    { "gzip, deflate, br, zstd", kZstdOrGzip },
+  };
+  for ( size_t i = 0; i < NUMBEROF(kCases); ++i ) {
+    http::Header hc;
+    hc.PrepareRequestLine("/");
+    if ( kCases[i].accept_encoding_ != NULL ) {
+      hc.AddField(http::kHeaderAcceptEncoding,
+                  kCases[i].accept_encoding_, true);
+    }
+    CHECK_EQ(compressor.SelectCoding(hc, hs, 10000), kCases[i].coding_)
+        << " For: " << (kCases[i].accept_encoding_ != NULL
+                        ? kCases[i].accept_encoding_ : "NULL");
+  }
+  http::Header hc;
+  hc.PrepareRequestLine("/");
+  hc.AddField(http::kHeaderAcceptEncoding, "gzip", true);
+  // Thresholds
+  CHECK_EQ(compressor.SelectCoding(hc, hs, params.min_size_ - 1),
+           http::CODING_IDENTITY);
+  CHECK_EQ(compressor.SelectCoding(hc, hs, params.min_size_),
+           http::CODING_GZIP);
+  CHECK_EQ(compressor.SelectCoding(hc, hs, params.max_size_ + 1),
+           http::CODING_IDENTITY);
+  // Content types
+  CHECK(compressor.IsCompressibleType("application/json"));
+  CHECK(compressor.IsCompressibleType("Text/CSS"));
+  CHECK(compressor.IsCompressibleType("image/svg+xml"));
+  CHECK(!compressor.IsCompressibleType("image/png"));
+  CHECK(!compressor.IsCompressibleType("application/octet-stream"));
+  http::Header hs_png;
+  hs_png.AddField(http::kHeaderContentType, "image/png", true);
+  CHECK_EQ(compressor.SelectCoding(hc, hs_png, 10000), http::CODING_IDENTITY);
+  LOG_INFO << "SelectCoding test PASS";
+}
+
+void TestRoundTrip() {
+  http::CompressionParams params;
+  http::ReplyCompressor compressor(params);
+  const std::string text(MakeText(100000));
+  const http::ContentCoding kCodings[] = {
+    http::CODING_GZIP, http::CODING_DEFLATE
+  };
+  for ( size_t c = 0; c < NUMBEROF(kCodings); ++c ) {
+    for ( size_t p = 0; p < http::kNumCompressionPresets; ++p ) {
+      // A few times - w/ the same pooled compressor
+      for ( size_t size = 0; size <= text.size(); size += text.size() / 4 ) {
+        io::MemoryStream in;
+        in.Write(text.data(), size);
+        io::MemoryStream out;
+        CHECK(compressor.Compress(kCodings[c],
+                                  http::CompressionPreset(p), &in, &out));
+        CHECK(in.IsEmpty());
+        const size_t compressed_size = out.Size();
+        CHECK(Decode(kCodings[c], &out) == text.substr(0, size))
+            << http::ContentCodingName(kCodings[c]) << " / "
+            << http::CompressionPresetName(http::CompressionPreset(p))
+            << " / " << size;
+        if ( size == text.size() ) {
+          LOG_INFO << http::ContentCodingName(kCodings[c]) << " / "
+                   << http::CompressionPresetName(http::CompressionPreset(p))
+                   << ": " << size << " -> " << compressed_size;
+        }
+      }
+    }
+  }
+  // Bare zlib deflate wrapper reuse
+  io::ZlibDeflateWrapper deflater;
+  for ( int i = 0; i < 3; ++i ) {
+    io::MemoryStream out;
+    CHECK(deflater.Deflate(text.data(), text.size(), &out));
+    CHECK(Decode(http::CODING_DEFLATE, &out) == text);
+  }
+  LOG_INFO << "RoundTrip test PASS";
+}
+
+void PrepareRequest(http::Request* req, const std::string& path,
+                    const char* accept_encoding, const std::string& body) {
+  req->client_header()->PrepareRequestLine(path.c_str());
+  req->client_header()->AddField(http::kHeaderAcceptEncoding,
+                                 accept_encoding, true);
+  CHECK(req->InitializeUrlFromClientRequest(URL("http://localhost/")));
+  req->server_header()->AddField(http::kHeaderContentType, "text/html", true);
+  req->server_header()->AddField(http::kHeaderETag, "\"1234\"", true);
+  req->server_data()->Write(body);
+}
+
+void TestCache() {
+  http::CompressionParams params;
+  http::ReplyCompressor compressor(params);
+  const std::string text(MakeText(50000));
+
+  http::Request req1;
+  PrepareRequest(&req1, "/a.html", "gzip", text);
+  CHECK_EQ(compressor.PrepareReply(&req1, http::OK), http::CODING_GZIP);
+  compressor.CompressReply(&req1, http::CODING_GZIP);
+  CHECK(req1.server_data_encoded());
+  CHECK_EQ(req1.server_header()->FindField(http::kHeaderContentEncoding),
+           "gzip");
+  CHECK_EQ(req1.server_header()->FindField(http::kHeaderETag),
+           "\"1234-gzip\"");
+  CHECK_EQ(req1.server_header()->FindField(http::kHeaderVary),
+           "Accept-Encoding");
+  const std::string compressed(req1.server_data()->ToString());
+  CHECK_LT(compressed.size(), text.size() / 2);
+
+  // Now from the cache
+  http::Request req2;
+  PrepareRequest(&req2, "/a.html", "gzip", text);
+  CHECK_EQ(compressor.PrepareReply(&req2, http::OK), http::CODING_IDENTITY);
+  CHECK(req2.server_data_encoded());
+  CHECK_EQ(req2.server_header()->FindField(http::kHeaderETag),
+           "\"1234-gzip\"");
+  CHECK(req2.server_data()->ToString() == compressed);
+  // Other path, coding or a HEAD - no hit
+  http::Request req3;
+  PrepareRequest(&req3, "/b.html", "gzip", text);
+  CHECK_EQ(compressor.PrepareReply(&req3, http::OK), http::CODING_GZIP);
+  http::Request req4;
+  PrepareRequest(&req4, "/a.html", "deflate", text);
+  CHECK_EQ(compressor.PrepareReply(&req4, http::OK), http::CODING_DEFLATE);
+  http::Request req5;
+  PrepareRequest(&req5, "/a.html", "gzip", "");
+  req5.client_header()->PrepareRequestLine("/a.html", http::METHOD_HEAD);
+  CHECK_EQ(compressor.PrepareReply(&req5, http::OK), http::CODING_IDENTITY);
+  CHECK(!req5.server_header()->HasField(http::kHeaderContentEncoding));
+
+  http::ReplyCompressor::Stats stats;
+  compressor.GetStats(&stats);
+  LOG_INFO << "Stats: " << stats.ToString();
+  CHECK_EQ(stats.num_compressed_, 1);
+  CHECK_EQ(stats.cache_hits_, 1);
+  CHECK_EQ(stats.cache_misses_, 1);
+  CHECK_EQ(stats.cache_size_, int64(compressed.size()));
+
+  // Incompressible data goes as it is
+  http::Request req6;
+  PrepareRequest(&req6, "/c.html", "gzip", "");
+  for ( int i = 0; i < 4000; ++i ) {
+    const int32 r = random();
+    req6.server_data()->Write(&r, sizeof(r));
+  }
+  const size_t size6 = req6.server_data()->Size();
+  CHECK_EQ(compressor.PrepareReply(&req6, http::OK), http::CODING_GZIP);
+  compressor.CompressReply(&req6, http::CODING_GZIP);
+  CHECK(req6.server_data_encoded());
+  CHECK(!req6.server_header()->HasField(http::kHeaderContentEncoding));
+  CHECK_EQ(req6.server_data()->Size(), size6);
+  LOG_INFO << "Cache test PASS";
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// "/text/<size>" - some text of <size> bytes
+void HandleText(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  const int64 size = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->request()->server_header()->AddField(http::kHeaderContentType,
+                                            "text/html", true);
+  req->request()->server_data()->Write(MakeText(size));
+  req->Reply();
+}
+
+void StartServer(http::Server* server) {
+  server->RegisterProcessor("/text",
+      NewPermanentCallback(&HandleText), true, true);
+  server->StartServing();
+}
+
+void EnableCompression(http::Server* server) {
+  http::CompressionParams params;
+  params.max_cache_size_ = 1 << 20;
+  server->EnableCompression(params);
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// A blocking HTTP/1.1 client, w/ a request in flight
+class Client {
+ public:
+  explicit Client(const struct sockaddr_storage& addr)
+      : fd_(::socket(AF_INET, SOCK_STREAM, 0)),
+        parser_("client") {
+    CHECK_GE(fd_, 0);
+    const int one = 1;
+    CHECK_EQ(::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY,
+                          &one, sizeof(one)), 0);
+    CHECK_EQ(::connect(fd_, reinterpret_cast<const struct sockaddr*>(&addr),
+                       sizeof(struct sockaddr_in)), 0);
+  }
+  ~Client() {
+    ::close(fd_);
+  }
+  // Gets path, accepting the given encoding. Returns the (decoded) body,
+  // and the server header in *header.
+  std::string Get(const std::string& path, const char* accept_encoding,
+                  http::Header* header = NULL) {
+    const std::string s(
+        "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n"
+        "Accept-Encoding: " + accept_encoding + "\r\n\r\n");
+    size_t pos = 0;
+    while ( pos < s.size() ) {
+      const ssize_t cb = ::write(fd_, s.data() + pos, s.size() - pos);
+      CHECK_GT(cb, 0);
+      pos += cb;
+    }
+    http::Request reply;
+    parser_.Clear();
+    while ( true ) {
+      if ( !inbuf_.IsEmpty() ) {
+        const int32 state = parser_.ParseServerReply(&inbuf_, &reply);
+        if ( state & http::RequestParser::REQUEST_FINISHED ) {
+          break;
+        }
+        if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+          continue;
+        }
+      }
+      char buf[65536];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      inbuf_.Write(buf, cb);
+    }
+    CHECK_EQ(reply.server_header()->status_code(), http::OK) << path;
+    if ( header != NULL ) {
+      header->CopyHeaders(*reply.server_header(), true);
+    }
+    return reply.server_data()->ToString();
+  }
+ private:
+  const int fd_;
+  http::RequestParser parser_;
+  io::MemoryStream inbuf_;
+};
+
+//////////////////////////////////////////////////////////////////////
+
+void TestServer(http::Server* server, const struct sockaddr_storage& addr,
+                const std::string& static_text) {
+  Client client(addr);
+  const http::ReplyCompressor* const compressor = server->compressor();
+  CHECK(compressor != NULL);
+  http::ReplyCompressor::Stats stats;
+  {
+    http::Header header;
+    CHECK(client.Get("/text/100", "gzip", &header) == MakeText(100));
+    CHECK(!header.HasField(http::kHeaderContentEncoding));
+  }
+  {
+    http::Header header;
+    CHECK(client.Get("/text/20000", "gzip", &header) == MakeText(20000));
+    CHECK_EQ(header.FindField(http::kHeaderContentEncoding), "gzip");
+    CHECK_EQ(header.FindField(http::kHeaderVary), "Accept-Encoding");
+    compressor->GetStats(&stats);
+    CHECK_EQ(stats.num_compressed_, 1);
+    CHECK_EQ(stats.num_offloaded_, 0);
+  }
+  {
+    http::Header header;
+    CHECK(client.Get("/text/20000", "deflate", &header) == MakeText(20000));
+    CHECK_EQ(header.FindField(http::kHeaderContentEncoding), "deflate");
+  }
+  {
+    // Large - compressed in the offload threads
+    http::Header header;
+    CHECK(client.Get("/text/200000", "gzip", &header) == MakeText(200000));
+    CHECK_EQ(header.FindField(http::kHeaderContentEncoding), "gzip");
+    compressor->GetStats(&stats);
+    CHECK_EQ(stats.num_compressed_, 3);
+    CHECK_EQ(stats.num_offloaded_, 1);
+  }
+  {
+    // Static files - compressed once
+    http::Header header;
+    CHECK(client.Get("/static/a.html", "gzip", &header) == static_text);
+    CHECK_EQ(header.FindField(http::kHeaderContentEncoding), "gzip");
+    const std::string etag(header.FindField(http::kHeaderETag));
+    CHECK(strutil::StrEndsWith(etag, "-gzip\"")) << etag;
+    http::Header header2;
+    CHECK(client.Get("/static/a.html", "gzip", &header2) == static_text);
+    CHECK_EQ(header2.FindField(http::kHeaderETag), etag);
+    http::Header header3;
+    CHECK(client.Get("/static/a.html", "identity", &header3) == static_text);
+    CHECK(!header3.HasField(http::kHeaderContentEncoding));
+    compressor->GetStats(&stats);
+    CHECK_EQ(stats.cache_hits_, 1);
+    CHECK_EQ(stats.cache_misses_, 1);
+  }
+  LOG_INFO << "Server test PASS - " << stats.ToString();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// Benchmark: cpu / byte of a fresh gzip wrapper per body at the default
+// level (as http::Request does) vs. the pooled compressor, at its preset
+void BenchmarkCpu() {
+  const std::string text(MakeText(FLAGS_large_size));
+  const int kNumRounds = 50;
+  io::MemoryStream out;
+  int64 start = timer::CpuNsec();
+  for ( int i = 0; i < kNumRounds; ++i ) {
+    io::MemoryStream in;
+    in.Write(text);
+    io::ZlibGzipEncodeWrapper wrapper;
+    wrapper.Encode(&in, &out);
+    out.Clear();
+  }
+  const double before = static_cast<double>(timer::CpuNsec() - start) /
+                        (kNumRounds * text.size());
+  http::CompressionParams params;
+  http::ReplyCompressor compressor(params);
+  // The same level, then the one of our preset
+  const http::CompressionPreset kPresets[] = {
+    http::COMPRESSION_DEFAULT, params.preset_
+  };
+  double after[NUMBEROF(kPresets)];
+  for ( size_t p = 0; p < NUMBEROF(kPresets); ++p ) {
+    start = timer::CpuNsec();
+    for ( int i = 0; i < kNumRounds; ++i ) {
+      io::MemoryStream in;
+      in.Write(text);
+      CHECK(compressor.Compress(http::CODING_GZIP, kPresets[p], &in, &out));
+      out.Clear();
+    }
+    after[p] = static_cast<double>(timer::CpuNsec() - start) /
+               (kNumRounds * text.size());
+  }
+  LOG_INFO << "Compression cpu / byte - fresh gzip wrapper at default level: "
+           << before << " ns, pooled compressor at "
+           << http::CompressionPresetName(kPresets[0]) << ": " << after[0]
+           << " ns, at " << http::CompressionPresetName(kPresets[1]) << ": "
+           << after[1] << " ns";
+}
+
+void LargeClientLoop(const struct sockaddr_storage* addr,
+                     const std::atomic_bool* done,
+                     std::atomic<int64>* num_requests) {
+  Client client(*addr);
+  const std::string path(strutil::StringPrintf("/text/%d", FLAGS_large_size));
+  while ( !*done ) {
+    CHECK_EQ(client.Get(path, "gzip").size(), size_t(FLAGS_large_size));
+    ++*num_requests;
+  }
+}
+
+// Returns the p99 latency (in ns) of small requests, while large
+// replies are compressed
+int64 RunMixedLoad(const char* name, const struct sockaddr_storage& addr) {
+  std::atomic_bool done(false);
+  std::atomic<int64> num_large(0);
+  std::vector<thread::Thread*> threads;
+  for ( int i = 0; i < FLAGS_num_large_clients; ++i ) {
+    threads.push_back(new thread::Thread(
+        NewCallback(&LargeClientLoop, &addr,
+                    const_cast<const std::atomic_bool*>(&done), &num_large)));
+    threads.back()->SetJoinable();
+    threads.back()->Start();
+  }
+  ::usleep(20000);
+
+  Client client(addr);
+  std::vector<int64> latencies;
+  const int64 start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_small_requests; ++i ) {
+    const int64 sent = timer::TicksNsec();
+    CHECK_EQ(client.Get("/text/64", "gzip").size(), 64);
+    latencies.push_back(timer::TicksNsec() - sent);
+  }
+  const int64 duration = timer::TicksNsec() - start;
+  done = true;
+  for ( size_t i = 0; i < threads.size(); ++i ) {
+    threads[i]->Join();
+    delete threads[i];
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const int64 p99 = latencies[latencies.size() * 99 / 100];
+  LOG_INFO << " " << name << ": " << latencies.size() << " small requests in "
+           << duration / 1000000 << " ms, latency - median: "
+           << latencies[latencies.size() / 2] / 1000 << " us, p99: "
+           << p99 / 1000 << " us, max: "
+           << latencies.back() / 1000 << " us ("
+           << num_large << " large replies of " << FLAGS_large_size
+           << " bytes)";
+  return p99;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  TestSelectCoding();
+  TestRoundTrip();
+  TestCache();
+
+  char dir_template[] = "/tmp/http_compression_test.XXXXXX";
+  CHECK(mkdtemp(dir_template) != NULL);
+  const std::string static_text(MakeText(30000));
+  const std::string file_path(std::string(dir_template) + "/a.html");
+  const int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT, 0644);
+  CHECK_GE(fd, 0);
+  CHECK_EQ(::write(fd, static_text.data(), static_text.size()),
+           ssize_t(static_text.size()));
+  ::close(fd);
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  params.max_concurrent_connections_ = 100;
+  params.max_reply_buffer_size_ = 4 * FLAGS_large_size;
+  http::Server* const server = new http::Server(
+      "http_compression_test", server_thread.mutable_selector(),
+      net_factory, params);
+  http::StaticFileHandler* const handler =
+      new http::StaticFileHandler(server, "/static", dir_template);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+
+  BenchmarkCpu();
+  // Before: each request gzips its reply in the network thread
+  const int64 before_p99 = RunMixedLoad("Per request gzip", addr);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(),
+      NewCallback(&EnableCompression, server));
+  TestServer(server, addr, static_text);
+  const int64 after_p99 = RunMixedLoad("Reply compressor", addr);
+  http::ReplyCompressor::Stats stats;
+  server->compressor()->GetStats(&stats);
+  LOG_INFO << "p99 latency of the small requests: " << before_p99 / 1000
+           << " us -> " << after_p99 / 1000 << " us; " << stats.ToString();
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  delete handler;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  ::unlink(file_path.c_str());
+  ::rmdir(dir_template);
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -29,10 +29,18 @@
 //
 // Author: Catalin Popescu
 
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
 #include "whisperlib/base/types.h"
 #include "whisperlib/base/log.h"
 #include "whisperlib/base/system.h"
+#include "whisperlib/base/timer.h"
 #include "whisperlib/base/gflags.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/io/file/file_input_stream.h"
+#include "whisperlib/io/ioutil.h"
 
 #include "whisperlib/http/http_header.h"
 #include "whisperlib/io/buffer/memory_stream.h"
@@ -46,6 +54,13 @@ DEFINE_int32(memstream_bufsize,
              128,
              "We dimmensionate the MemoryStream buffer to "
              "this value");
+DEFINE_string(test_data_dir,
+              "",
+              "Where the client_req_* files for the parsing benchmark are "
+              "(by default we look under $srcdir)");
+DEFINE_int32(benchmark_rounds,
+             2000,
+             "Parse each benchmark request these many times");
 
 //////////////////////////////////////////////////////////////////////
 
@@ -136,6 +151,146 @@ void RunSimpleTests() {
   }
 }
 
+// Parses the requests in one piece, and delivered in bits - resuming the
+// parsing as data comes. Headers should be the same.
+void RunSplitTests(const std::vector<std::string>& requests) {
+  for ( size_t i = 0; i < requests.size(); ++i ) {
+    whisper::http::Header expected(true);
+    {
+      whisper::io::MemoryStream ms;
+      ms.Write(requests[i]);
+      CHECK(expected.ParseHttpRequest(&ms));
+    }   // the parsed fields should survive the stream
+    const std::string expected_str(expected.ToString());
+    for ( size_t step = 1; step < 64; step *= 3 ) {
+      whisper::http::Header headers(true);
+      whisper::io::MemoryStream ms(16);  // small blocks: lines across them
+      size_t pos = 0;
+      bool done = false;
+      while ( !done ) {
+        CHECK_LT(pos, requests[i].size());
+        const size_t size = std::min(step, requests[i].size() - pos);
+        ms.Write(requests[i].data() + pos, size);
+        pos += size;
+        done = headers.ParseHttpRequest(&ms);
+      }
+      // (parse_error() keeps the READ_NO_DATA of the incomplete parses)
+      CHECK_EQ(headers.last_parse_error(), expected.parse_error());
+      CHECK_EQ(headers.bytes_parsed(), expected.bytes_parsed());
+      CHECK_EQ(headers.ToString(), expected_str);
+    }
+  }
+}
+
+void RunFieldTests() {
+  whisper::http::Header headers(true);
+  whisper::io::MemoryStream ms;
+  ms.Write("GET / HTTP/1.1\r\n"
+           "content-length: 10\r\n"
+           "X-ABC: a\r\n"
+           "x-abc: b\r\n"
+           "  c\r\n"
+           "Host: example.com\r\n"
+           "\r\n");
+  CHECK(headers.ParseHttpRequest(&ms));
+  CHECK_EQ(headers.parse_error(), whisper::http::Header::READ_OK);
+  CHECK_EQ(headers.fields().size(), 3);
+  // Lookups are case insensitive
+  CHECK_EQ(headers.FindField("Content-Length"), "10");
+  CHECK_EQ(headers.FindField("CONTENT-LENGTH"), "10");
+  CHECK_EQ(headers.FindField("X-Abc"), "a, b c");
+  CHECK(!headers.HasField("Content"));
+  // We keep the order, and compose normalized names
+  CHECK_EQ(headers.ToString(),
+           "GET / HTTP/1.1\r\n"
+           "Content-Length: 10\r\n"
+           "X-Abc: a, b c\r\n"
+           "Host: example.com\r\n"
+           "\r\n");
+  // Changes
+  CHECK(headers.AddField(std::string("Host"), "other.com", true));
+  CHECK(headers.AddField(std::string("X-Abc"), "d", false));
+  CHECK(headers.AddField(std::string("X-New"), "e", false));
+  CHECK(headers.ClearField("content-length"));
+  CHECK(!headers.ClearField("content-length"));
+  CHECK_EQ(headers.ToString(),
+           "GET / HTTP/1.1\r\n"
+           "X-Abc: a, b c, d\r\n"
+           "Host: other.com\r\n"
+           "X-New: e\r\n"
+           "\r\n");
+  whisper::http::Header copy(true);
+  CHECK_EQ(copy.CopyHeaders(headers, true), 3);
+  headers.Clear();
+  CHECK_EQ(copy.ToString(),
+           "GET / HTTP/1.1\r\n"
+           "X-Abc: a, b c, d\r\n"
+           "Host: other.com\r\n"
+           "X-New: e\r\n"
+           "\r\n");
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static std::string TestDataDir() {
+  if ( !FLAGS_test_data_dir.empty() ) {
+    return FLAGS_test_data_dir;
+  }
+  const char* srcdir = getenv("srcdir");
+  return strutil::JoinPaths(srcdir == NULL ? "." : srcdir,
+                            "whisperlib/http/test/test_data");
+}
+
+// Loads the client_req_* test requests
+static void LoadRequests(std::vector<std::string>* requests) {
+  const std::string dir(TestDataDir());
+  for ( int i = 0; i < 1000; ++i ) {
+    const std::string file(strutil::JoinPaths(
+        dir, strutil::StringPrintf("client_req_%04d", i)));
+    std::string content;
+    if ( whisper::io::IsReadableFile(file) &&
+         whisper::io::FileInputStream::TryReadFile(file, &content) ) {
+      requests->push_back(content);
+    }
+  }
+}
+
+void RunParseBenchmark(const std::vector<std::string>& requests) {
+  std::vector<whisper::io::MemoryStream*> sources;
+  size_t total_size = 0;
+  for ( size_t i = 0; i < requests.size(); ++i ) {
+    sources.push_back(new whisper::io::MemoryStream());
+    sources.back()->Write(requests[i]);
+    total_size += requests[i].size();
+  }
+  whisper::http::Header headers(true);
+  size_t num_found = 0;
+  const int64 start = whisper::timer::TicksNsec();
+  for ( int32 round = 0; round < FLAGS_benchmark_rounds; ++round ) {
+    for ( size_t i = 0; i < sources.size(); ++i ) {
+      whisper::io::MemoryStream ms;
+      ms.AppendStreamNonDestructive(sources[i]);
+      headers.Clear();
+      CHECK(headers.ParseHttpRequest(&ms));
+      size_t len;
+      if ( headers.FindField(whisper::http::kHeaderHost, &len) != NULL ) {
+        ++num_found;
+      }
+    }
+  }
+  const int64 duration = whisper::timer::TicksNsec() - start;
+  const int64 num_parsed = int64(FLAGS_benchmark_rounds) * sources.size();
+  CHECK_EQ(num_found, num_parsed);
+  LOG_INFO << " Parsed " << num_parsed << " headers ("
+           << total_size * FLAGS_benchmark_rounds << " bytes) in "
+           << duration / 1000 << " us - "
+           << duration / num_parsed << " ns per header, "
+           << int64(num_parsed * 1e9 / duration) << " headers per second";
+  for ( size_t i = 0; i < sources.size(); ++i ) {
+    delete sources[i];
+  }
+}
+
 int main(int argc, char* argv[]) {
   whisper::common::Init(argc, argv);
 
@@ -223,6 +378,17 @@ int main(int argc, char* argv[]) {
           "\t !@#$%^&*()_+{}[]|:;\"'\\<>,./?"));
 
   RunSimpleTests();
+  RunFieldTests();
+
+  std::vector<std::string> requests;
+  LoadRequests(&requests);
+  if ( requests.empty() ) {
+    LOG_WARNING << " No test requests found in " << TestDataDir()
+                << " - skipping the parsing benchmark";
+  } else {
+    RunSplitTests(requests);
+    RunParseBenchmark(requests);
+  }
 
   if ( !FLAGS_data_file.empty() ) {
     whisper::io::MemoryStream ms(FLAGS_memstream_bufsize);
@@ -0,0 +1,288 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests HTTP/1.1 pipelining in http::Server: requests sent back to back on
+// a connection are dispatched together, their replies (which complete in
+// any order) come back in the order of the requests. Then works as a
+// pipelined load generator: a number of connections, each keeping a
+// number of requests in flight, and reports the request rate.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_connections,
+             8,
+             "Load generator: open these many connections");
+DEFINE_int32(pipeline_depth,
+             16,
+             "Load generator: send these many requests back to back on a "
+             "connection");
+DEFINE_int32(num_requests,
+             40000,
+             "Load generator: send these many requests in total");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// The replies contain the path of the request
+
+void HandleNow(http::ServerRequest* req) {
+  req->request()->server_data()->Write(req->request()->url()->path());
+  req->Reply();
+}
+
+// "/later/<ms>" - replies after <ms>
+void HandleLater(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  req->request()->server_data()->Write(path);
+  const int64 ms = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->net_selector()->RegisterAlarm(
+      NewCallback(req, &http::ServerRequest::Reply), ms);
+}
+
+void EndStream(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  req->request()->server_data()->Write(path.substr(path.size() / 2));
+  req->ContinueStreamingData();
+  req->EndStreamingData();
+}
+
+// "/stream/<ms>" - streams the path in two chunks, <ms> apart
+void HandleStream(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  const int64 ms = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  req->BeginStreamingData(http::OK, NULL, true);
+  req->request()->server_data()->Write(path.substr(0, path.size() / 2));
+  req->ContinueStreamingData();
+  req->net_selector()->RegisterAlarm(NewCallback(&EndStream, req), ms);
+}
+
+void StartServer(http::Server* server) {
+  server->RegisterProcessor("/now",
+      NewPermanentCallback(&HandleNow), true, true);
+  server->RegisterProcessor("/later",
+      NewPermanentCallback(&HandleLater), true, true);
+  server->RegisterProcessor("/stream",
+      NewPermanentCallback(&HandleStream), true, true);
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+// A blocking client connection
+class Client {
+ public:
+  explicit Client(const struct sockaddr_storage& addr)
+      : fd_(::socket(AF_INET, SOCK_STREAM, 0)),
+        parser_("client") {
+    CHECK_GE(fd_, 0);
+    CHECK_EQ(::connect(fd_, reinterpret_cast<const struct sockaddr*>(&addr),
+                       sizeof(struct sockaddr_in)), 0);
+  }
+  ~Client() {
+    ::close(fd_);
+  }
+  // Sends all requests in one write
+  void Send(const std::vector<std::string>& paths) {
+    std::string s;
+    for ( size_t i = 0; i < paths.size(); ++i ) {
+      s += "GET " + paths[i] + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    }
+    size_t pos = 0;
+    while ( pos < s.size() ) {
+      const ssize_t cb = ::write(fd_, s.data() + pos, s.size() - pos);
+      CHECK_GT(cb, 0);
+      pos += cb;
+    }
+  }
+  // Reads the next reply, returns its body
+  std::string ReadReply() {
+    http::Request reply;
+    parser_.Clear();
+    while ( true ) {
+      if ( !inbuf_.IsEmpty() ) {
+        const int32 state = parser_.ParseServerReply(&inbuf_, &reply);
+        if ( state & http::RequestParser::REQUEST_FINISHED ) {
+          break;
+        }
+        if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+          continue;
+        }
+      }
+      char buf[16384];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      inbuf_.Write(buf, cb);
+    }
+    CHECK(!parser_.InErrorState()) << parser_.ParseStateName();
+    CHECK_EQ(reply.server_header()->status_code(), http::OK);
+    CHECK(reply.server_header()->IsKeepAliveConnection());
+    return reply.server_data()->ToString();
+  }
+ private:
+  const int fd_;
+  http::RequestParser parser_;
+  io::MemoryStream inbuf_;
+};
+
+// Replies complete in a different order than the requests
+void RunOrderTest(const struct sockaddr_storage& addr) {
+  Client client(addr);
+  std::vector<std::string> paths;
+  for ( int i = 0; i < 5; ++i ) {
+    paths.push_back(strutil::StringPrintf("/later/%d", 100 - 20 * i));
+    paths.push_back(strutil::StringPrintf("/now/%d", i));
+    paths.push_back(strutil::StringPrintf("/stream/%d", 50 - 10 * i));
+    paths.push_back(strutil::StringPrintf("/later/%d", i));
+  }
+  const int64 start = timer::TicksMsec();
+  client.Send(paths);
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    CHECK_EQ(client.ReadReply(), paths[i]);
+  }
+  LOG_INFO << "Order test PASS - " << paths.size() << " replies in "
+           << timer::TicksMsec() - start << " ms";
+  // And the connection is still good
+  paths.resize(1);
+  client.Send(paths);
+  CHECK_EQ(client.ReadReply(), paths[0]);
+}
+
+// Returns the requests per second
+double RunLoad(const struct sockaddr_storage& addr,
+               int num_connections, int depth, int num_requests) {
+  std::vector<Client*> clients;
+  for ( int i = 0; i < num_connections; ++i ) {
+    clients.push_back(new Client(addr));
+  }
+  std::vector<std::string> paths;
+  for ( int i = 0; i < depth; ++i ) {
+    paths.push_back(strutil::StringPrintf("/now/%d", i));
+  }
+  const int num_rounds = std::max(1, num_requests / (num_connections * depth));
+  const int64 start = timer::TicksNsec();
+  for ( int round = 0; round < num_rounds; ++round ) {
+    for ( int i = 0; i < num_connections; ++i ) {
+      clients[i]->Send(paths);
+    }
+    for ( int i = 0; i < num_connections; ++i ) {
+      for ( int j = 0; j < depth; ++j ) {
+        CHECK_EQ(clients[i]->ReadReply(), paths[j]);
+      }
+    }
+  }
+  const int64 duration = timer::TicksNsec() - start;
+  for ( int i = 0; i < num_connections; ++i ) {
+    delete clients[i];
+  }
+  const int64 num_done = int64(num_rounds) * num_connections * depth;
+  const double rate = num_done * 1e9 / duration;
+  LOG_INFO << " " << num_connections << " connections, pipeline depth "
+           << depth << ": " << num_done << " requests in "
+           << duration / 1000000 << " ms - " << int64(rate)
+           << " requests per second";
+  return rate;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  params.max_concurrent_requests_per_connection_ = 8;
+  http::Server* const server = new http::Server(
+      "pipeline_test", server_thread.mutable_selector(), net_factory, params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+  RunOrderTest(addr);
+
+  const double rate1 = RunLoad(addr, FLAGS_num_connections, 1,
+                               FLAGS_num_requests / 4);
+  const double rate = RunLoad(addr, FLAGS_num_connections,
+                              FLAGS_pipeline_depth, FLAGS_num_requests);
+  LOG_INFO << " Pipelining speedup: " << rate / rate1;
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
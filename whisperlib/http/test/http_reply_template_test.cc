@@ -0,0 +1,327 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the replies w/ http::ReplyTemplate: they carry the same fields as
+// the regular replies (for HTTP/1.1, HTTP/1.0 and HEAD requests). Then
+// measures the cost of composing a small reply, regular vs. from a
+// template, and the request rate of a small response endpoint served
+// either way (w/ pipelined requests).
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/http_reply_template.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_compose,
+             200000,
+             "Compose these many replies for the reply cost measurement");
+DEFINE_int32(num_connections,
+             4,
+             "Load generator: open these many connections");
+DEFINE_int32(pipeline_depth,
+             16,
+             "Load generator: send these many requests back to back on a "
+             "connection");
+DEFINE_int32(num_requests,
+             100000,
+             "Load generator: send these many requests in total");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static const char kBody[] = "{\"status\":\"ok\"}";
+static const http::ReplyTemplate* g_reply_template = NULL;
+
+static void SetFixedFields(http::Header* h) {
+  h->AddField(http::kHeaderContentType, "application/json", true);
+  h->AddField("Cache-Control", "no-cache", true);
+  h->AddField("X-Frame-Options", "DENY", true);
+}
+
+void HandlePlain(http::ServerRequest* req) {
+  SetFixedFields(req->request()->server_header());
+  req->request()->server_data()->Write(kBody);
+  req->Reply();
+}
+
+void HandleTemplate(http::ServerRequest* req) {
+  req->request()->server_data()->Write(kBody);
+  req->ReplyWithTemplate(g_reply_template);
+}
+
+void StartServer(http::Server* server) {
+  http::Header fields;
+  SetFixedFields(&fields);
+  g_reply_template = server->RegisterReplyTemplate(fields);
+  server->RegisterProcessor("/plain",
+      NewPermanentCallback(&HandlePlain), true, true);
+  server->RegisterProcessor("/template",
+      NewPermanentCallback(&HandleTemplate), true, true);
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+// A blocking client connection
+class Client {
+ public:
+  explicit Client(const struct sockaddr_storage& addr)
+      : fd_(::socket(AF_INET, SOCK_STREAM, 0)),
+        parser_("client") {
+    CHECK_GE(fd_, 0);
+    CHECK_EQ(::connect(fd_, reinterpret_cast<const struct sockaddr*>(&addr),
+                       sizeof(struct sockaddr_in)), 0);
+  }
+  ~Client() {
+    ::close(fd_);
+  }
+  void Send(const std::string& s) {
+    size_t pos = 0;
+    while ( pos < s.size() ) {
+      const ssize_t cb = ::write(fd_, s.data() + pos, s.size() - pos);
+      CHECK_GT(cb, 0);
+      pos += cb;
+    }
+  }
+  // Reads the next reply in *reply
+  void ReadReply(http::Request* reply, bool is_head) {
+    parser_.Clear();
+    // The parser needs to know about the HEAD requests (no body)
+    reply->client_header()->set_method(
+        is_head ? http::METHOD_HEAD : http::METHOD_GET);
+    while ( true ) {
+      if ( !inbuf_.IsEmpty() ) {
+        const int32 state = parser_.ParseServerReply(&inbuf_, reply);
+        if ( state & http::RequestParser::REQUEST_FINISHED ) {
+          break;
+        }
+        if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+          continue;
+        }
+      }
+      char buf[16384];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      inbuf_.Write(buf, cb);
+    }
+    CHECK(!parser_.InErrorState()) << parser_.ParseStateName();
+  }
+ private:
+  const int fd_;
+  http::RequestParser parser_;
+  io::MemoryStream inbuf_;
+};
+
+// Asks the path w/ the given method / version / extra fields, returns the
+// reply (w/ the fields sorted, and w/o the Date, which can differ)
+std::string Ask(const struct sockaddr_storage& addr, const std::string& path,
+                const char* method, const char* version,
+                const char* extra_fields) {
+  Client client(addr);
+  client.Send(strutil::StringPrintf(
+                  "%s %s %s\r\nHost: localhost\r\n%s\r\n",
+                  method, path.c_str(), version, extra_fields));
+  http::Request reply;
+  client.ReadReply(&reply, strcmp(method, "HEAD") == 0);
+  CHECK(reply.server_header()->HasField(http::kHeaderDate));
+  reply.server_header()->ClearField(http::kHeaderDate,
+                                    strlen(http::kHeaderDate));
+  std::vector<std::string> lines;
+  strutil::SplitString(reply.server_header()->ToString(), "\r\n", &lines);
+  std::sort(lines.begin(), lines.end());
+  return strutil::JoinStrings(lines, "\n") + "\n" +
+      reply.server_data()->ToString();
+}
+
+void RunFieldsTest(const struct sockaddr_storage& addr) {
+  static const char* const kCases[][3] = {
+    { "GET", "HTTP/1.1", "" },
+    { "GET", "HTTP/1.1", "X-Request-Id: abc-123\r\n" },
+    { "GET", "HTTP/1.1", "Connection: close\r\n" },
+    { "HEAD", "HTTP/1.1", "" },
+    { "GET", "HTTP/1.0", "" },
+    { "GET", "HTTP/1.0", "Connection: Keep-Alive\r\n" },
+  };
+  for ( size_t i = 0; i < NUMBEROF(kCases); ++i ) {
+    const std::string plain = Ask(addr, "/plain", kCases[i][0],
+                                  kCases[i][1], kCases[i][2]);
+    const std::string templated = Ask(addr, "/template", kCases[i][0],
+                                      kCases[i][1], kCases[i][2]);
+    LOG_INFO << "Reply to " << kCases[i][0] << " " << kCases[i][1]
+             << " " << strutil::StrTrim(kCases[i][2]) << ":\n" << templated;
+    CHECK_EQ(plain, templated);
+  }
+  LOG_INFO << "Fields test PASS";
+}
+
+// The cost of composing a reply, as in ServerProtocol::PrepareResponse
+void RunComposeTest(const http::ReplyTemplate* reply_template) {
+  http::Request req;
+  req.client_header()->PrepareRequestLine("/");
+  io::MemoryStream out;
+  int64 start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_compose; ++i ) {
+    http::Header* const hs = req.server_header();
+    hs->Clear();
+    hs->PrepareStatusLine(http::OK);
+    hs->SetDateField(http::kHeaderDate, time(NULL));
+    hs->AddField(http::kHeaderServer, "reply_template_test", true);
+    SetFixedFields(hs);
+    hs->AddField(http::kHeaderConnection, "Keep-Alive", true);
+    hs->AddField(http::kHeaderKeepAlive, "15", true);
+    req.server_data()->Write(kBody);
+    req.AppendServerReply(&out, false, false);
+    out.Clear();
+  }
+  const int64 plain_ns = (timer::TicksNsec() - start) / FLAGS_num_compose;
+  start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_compose; ++i ) {
+    req.server_data()->Write(kBody);
+    reply_template->AppendReply(&req, time(NULL), true, 15, "", &out);
+    out.Clear();
+  }
+  const int64 template_ns = (timer::TicksNsec() - start) / FLAGS_num_compose;
+  LOG_INFO << "Compose a reply: " << plain_ns << " ns regular, "
+           << template_ns << " ns from template";
+}
+
+// Returns the requests per second
+double RunLoad(const struct sockaddr_storage& addr, const char* path) {
+  std::vector<Client*> clients;
+  for ( int i = 0; i < FLAGS_num_connections; ++i ) {
+    clients.push_back(new Client(addr));
+  }
+  std::string requests;
+  for ( int i = 0; i < FLAGS_pipeline_depth; ++i ) {
+    requests += strutil::StringPrintf(
+        "GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n", path);
+  }
+  const int num_rounds = std::max(1, FLAGS_num_requests /
+      (FLAGS_num_connections * FLAGS_pipeline_depth));
+  const int64 start = timer::TicksNsec();
+  for ( int round = 0; round < num_rounds; ++round ) {
+    for ( int i = 0; i < FLAGS_num_connections; ++i ) {
+      clients[i]->Send(requests);
+    }
+    for ( int i = 0; i < FLAGS_num_connections; ++i ) {
+      for ( int j = 0; j < FLAGS_pipeline_depth; ++j ) {
+        http::Request reply;
+        clients[i]->ReadReply(&reply, false);
+        CHECK_EQ(reply.server_data()->ToString(), kBody);
+      }
+    }
+  }
+  const int64 duration = timer::TicksNsec() - start;
+  for ( int i = 0; i < FLAGS_num_connections; ++i ) {
+    delete clients[i];
+  }
+  const int64 num_done =
+      int64(num_rounds) * FLAGS_num_connections * FLAGS_pipeline_depth;
+  const double rate = num_done * 1e9 / duration;
+  LOG_INFO << " " << path << ": " << num_done << " requests in "
+           << duration / 1000000 << " ms - " << int64(rate)
+           << " requests per second";
+  return rate;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  params.max_concurrent_requests_per_connection_ = 16;
+  http::Server* const server = new http::Server(
+      "reply_template_test", server_thread.mutable_selector(),
+      net_factory, params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+  RunFieldsTest(addr);
+  RunComposeTest(g_reply_template);
+  const double plain_rate = RunLoad(addr, "/plain");
+  const double template_rate = RunLoad(addr, "/template");
+  LOG_INFO << " Reply template speedup: " << template_rate / plain_rate;
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
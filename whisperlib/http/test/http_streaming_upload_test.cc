@@ -0,0 +1,350 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests client streaming uploads to http::Server: the body (de-chunked
+// and decompressed) gets to the processor as it comes, and the processor
+// pauses / resumes reading for flow control - so the memory stays bounded
+// no matter the size of the upload. Uploads a Content-Length body, a
+// chunked body and a chunked gzip body, and reports the upload speed.
+// For the big test run w/ --upload_size_mb=10240.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <string>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/io/buffer/block_pool.h"
+#include "whisperlib/io/zlib/zlibwrapper.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(upload_size_mb,
+             256,
+             "Upload these many MB of identity encoded body");
+DEFINE_int32(gzip_upload_size_mb,
+             32,
+             "Upload these many MB of gzip encoded body");
+DEFINE_int32(pause_every,
+             16,
+             "The processor pauses reading (for 1 ms) every these many calls");
+DEFINE_int32(max_block_mb,
+             16,
+             "Fail if we hold more than these many MB in data blocks");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// The body byte at position i is kPattern[i % kPeriod] - w/ a period
+// longer than the gzip window, so it does not compress.
+static const int32 kPeriod = 65521;
+static const int32 kBlockSize = 1 << 15;
+static char kPattern[2 * kPeriod];
+
+static int64 BlockBytes() {
+  io::BlockPool::Stats stats;
+  io::BlockPool::GetStats(&stats);
+  return stats.outstanding_bytes_;
+}
+
+// Receives the uploads (one at a time), checks the data and replies w/
+// the number of bytes received.
+class UploadSink {
+ public:
+  UploadSink()
+      : req_(NULL), received_(0), num_calls_(0), num_pauses_(0),
+        max_data_size_(0), max_block_bytes_(0), paused_(false) {
+  }
+  void Reset() {
+    req_ = NULL;
+    received_ = 0;
+    num_calls_ = 0;
+    num_pauses_ = 0;
+    max_data_size_ = 0;
+    max_block_bytes_ = 0;
+  }
+  void Process(http::ServerRequest* req) {
+    CHECK(req_ == NULL || req_ == req);
+    CHECK(!paused_) << " Got data while paused";
+    req_ = req;
+    ++num_calls_;
+    io::MemoryStream* const data = req->request()->client_data();
+    max_data_size_ = std::max(max_data_size_, int64(data->Size()));
+    max_block_bytes_ = std::max(max_block_bytes_, BlockBytes());
+    char buf[kBlockSize];
+    while ( !data->IsEmpty() ) {
+      const size_t cb = data->Read(buf, sizeof(buf));
+      CHECK(memcmp(buf, kPattern + received_ % kPeriod, cb) == 0)
+          << " Bad data at: " << received_;
+      received_ += cb;
+    }
+    if ( req->is_parsing_finished() ) {
+      req->request()->server_data()->Write(
+          strutil::StringPrintf("%lld", static_cast<long long>(received_)));
+      req->Reply();
+      req_ = NULL;
+      return;
+    }
+    if ( FLAGS_pause_every > 0 && num_calls_ % FLAGS_pause_every == 0 ) {
+      ++num_pauses_;
+      paused_ = true;
+      req->PauseReading();
+      req->net_selector()->RegisterAlarm(
+          NewCallback(this, &UploadSink::Resume, req), 1);
+    }
+  }
+  int64 num_calls() const { return num_calls_; }
+  int64 num_pauses() const { return num_pauses_; }
+  int64 max_data_size() const { return max_data_size_; }
+  int64 max_block_bytes() const { return max_block_bytes_; }
+
+ private:
+  void Resume(http::ServerRequest* req) {
+    paused_ = false;
+    req->ResumeReading();
+  }
+  http::ServerRequest* req_;
+  int64 received_;
+  int64 num_calls_;
+  int64 num_pauses_;
+  int64 max_data_size_;
+  int64 max_block_bytes_;
+  bool paused_;
+};
+
+void StartServer(http::Server* server, UploadSink* sink) {
+  server->RegisterProcessor("/upload",
+      NewPermanentCallback(sink, &UploadSink::Process), true, true);
+  server->RegisterClientStreaming("/upload", true);
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+static void WriteAll(int fd, const char* buf, size_t size) {
+  while ( size > 0 ) {
+    const ssize_t cb = ::write(fd, buf, size);
+    CHECK_GT(cb, 0);
+    buf += cb;
+    size -= cb;
+  }
+}
+
+static void WriteChunk(int fd, io::MemoryStream* data) {
+  if ( data->IsEmpty() ) {
+    return;   // an empty chunk would end the body
+  }
+  const std::string head = strutil::StringPrintf("%x\r\n",
+      static_cast<unsigned int>(data->Size()));
+  WriteAll(fd, head.data(), head.size());
+  char buf[kBlockSize];
+  while ( !data->IsEmpty() ) {
+    const size_t cb = data->Read(buf, sizeof(buf));
+    WriteAll(fd, buf, cb);
+  }
+  WriteAll(fd, "\r\n", 2);
+}
+
+// Uploads size bytes, returns what the server says it got
+int64 Upload(const struct sockaddr_storage& addr, int64 size,
+             bool chunked, bool gzip) {
+  const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(fd, 0);
+  CHECK_EQ(::connect(fd, reinterpret_cast<const struct sockaddr*>(&addr),
+                     sizeof(struct sockaddr_in)), 0);
+  std::string header("POST /upload HTTP/1.1\r\nHost: localhost\r\n");
+  if ( chunked ) {
+    header += "Transfer-Encoding: chunked\r\n";
+  } else {
+    header += strutil::StringPrintf("Content-Length: %lld\r\n",
+                                    static_cast<long long>(size));
+  }
+  if ( gzip ) {
+    header += "Content-Encoding: gzip\r\n";
+  }
+  header += "\r\n";
+  WriteAll(fd, header.data(), header.size());
+
+  io::ZlibGzipEncodeWrapper encoder(Z_BEST_SPEED);
+  io::MemoryStream encoded;
+  if ( gzip ) {
+    encoder.BeginEncoding(&encoded);
+  }
+  for ( int64 pos = 0; pos < size; pos += kBlockSize ) {
+    const size_t cb = std::min(size - pos, int64(kBlockSize));
+    const char* const block = kPattern + pos % kPeriod;
+    if ( !gzip && !chunked ) {
+      WriteAll(fd, block, cb);
+      continue;
+    }
+    io::MemoryStream plain;
+    plain.Write(block, cb);
+    if ( gzip ) {
+      encoder.ContinueEncoding(&plain, &encoded);
+      WriteChunk(fd, &encoded);
+    } else {
+      WriteChunk(fd, &plain);
+    }
+  }
+  if ( gzip ) {
+    encoder.EndEncoding(&encoded);
+    WriteChunk(fd, &encoded);
+  }
+  if ( chunked ) {
+    WriteAll(fd, "0\r\n\r\n", 5);
+  }
+
+  http::RequestParser parser("client");
+  http::Request reply;
+  io::MemoryStream inbuf;
+  while ( true ) {
+    if ( !inbuf.IsEmpty() ) {
+      const int32 state = parser.ParseServerReply(&inbuf, &reply);
+      if ( state & http::RequestParser::REQUEST_FINISHED ) {
+        break;
+      }
+      if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+        continue;
+      }
+    }
+    char buf[1024];
+    const ssize_t cb = ::read(fd, buf, sizeof(buf));
+    CHECK_GT(cb, 0) << " Server closed on us";
+    inbuf.Write(buf, cb);
+  }
+  ::close(fd);
+  CHECK(!parser.InErrorState()) << parser.ParseStateName();
+  CHECK_EQ(reply.server_header()->status_code(), http::OK);
+  return ::strtoll(reply.server_data()->ToString().c_str(), NULL, 10);
+}
+
+void RunUpload(const struct sockaddr_storage& addr, UploadSink* sink,
+               const http::ServerParams& params,
+               int64 size, bool chunked, bool gzip) {
+  sink->Reset();
+  const int64 start = timer::TicksMsec();
+  const int64 received = Upload(addr, size, chunked, gzip);
+  const int64 duration = std::max(timer::TicksMsec() - start, int64(1));
+  LOG_INFO << (chunked ? "Chunked" : "Content-Length")
+           << (gzip ? " gzip" : "") << " upload: "
+           << (size >> 20) << " MB in " << duration << " ms - "
+           << (size >> 10) / duration << " MB/s, "
+           << sink->num_calls() << " processor calls, "
+           << sink->num_pauses() << " pauses, max body data in a call: "
+           << sink->max_data_size() << ", max data block bytes: "
+           << sink->max_block_bytes();
+  CHECK_EQ(received, size);
+  // What we give in one call is bounded by client_streaming_read_size_
+  // (the inflated size for gzip - here about the same)
+  CHECK_LE(sink->max_data_size(),
+           int64(params.client_streaming_read_size_) * (gzip ? 2 : 1));
+  CHECK_LT(sink->max_block_bytes(), int64(FLAGS_max_block_mb) << 20);
+  if ( FLAGS_pause_every > 0 ) {
+    CHECK_GT(sink->num_pauses(), 0);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  for ( int32 i = 0; i < kPeriod; ++i ) {
+    kPattern[i] = kPattern[i + kPeriod] = static_cast<char>(::random());
+  }
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  // Bound what a connection reads in one go - else a fast client fills
+  // inbuf before the processor gets to pause
+  net::TcpAcceptorParams tcp_params;
+  tcp_params.tcp_connection_params_.read_limit_ = 1 << 18;
+  net_factory.SetTcpParams(tcp_params);
+  http::ServerParams params;
+  UploadSink sink;
+  http::Server* const server = new http::Server(
+      "upload_test", server_thread.mutable_selector(), net_factory, params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(),
+      NewCallback(&StartServer, server, &sink));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+  const int64 size = int64(FLAGS_upload_size_mb) << 20;
+  const int64 gzip_size = int64(FLAGS_gzip_upload_size_mb) << 20;
+  // Way over max_body_size_ - and not a multiple of our block size
+  RunUpload(addr, &sink, params, size + 12345, false, false);
+  RunUpload(addr, &sink, params, size + 12345, true, false);
+  RunUpload(addr, &sink, params, gzip_size + 12345, true, true);
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,341 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the processing of requests in http::Server worker pools: where
+// the processors run, the shedding of requests w/ 503 when a pool is full,
+// and (as a benchmark) the latency of fast requests while slow processors
+// hold up threads - w/ the slow processors in the network thread, then in
+// a worker pool.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/sync/thread.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(slow_ms,
+             10,
+             "Benchmark: the slow requests take these many ms");
+DEFINE_int32(num_slow_clients,
+             4,
+             "Benchmark: these many clients send slow requests, in a loop");
+DEFINE_int32(num_fast_requests,
+             100,
+             "Benchmark: measure the latency of these many fast requests");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// The replies contain the path of the request
+
+void HandleFast(http::ServerRequest* req) {
+  req->request()->server_data()->Write(req->request()->url()->path());
+  req->Reply();
+}
+
+// "/slow/<ms>", "/tiny/<ms>" - blocks the thread for <ms>
+void HandleSlow(http::ServerRequest* req) {
+  const std::string& path = req->request()->url()->path();
+  const int64 ms = ::strtoll(path.c_str() + path.rfind('/') + 1, NULL, 10);
+  ::usleep(ms * 1000);
+  req->request()->server_data()->Write(path);
+  req->Reply();
+}
+
+// Replies w/ the kind of thread we run in
+void HandleWhere(http::ServerRequest* req) {
+  req->request()->server_data()->Write(
+      req->net_selector()->IsInSelectThread() ? "network" : "worker");
+  req->Reply();
+}
+
+void StartServer(http::Server* server) {
+  server->RegisterProcessor("/fast",
+      NewPermanentCallback(&HandleFast), true, true);
+  server->RegisterProcessor("/slow",
+      NewPermanentCallback(&HandleSlow), true, true);
+  server->RegisterProcessor("/tiny",
+      NewPermanentCallback(&HandleSlow), true, true);
+  server->RegisterProcessor("/where",
+      NewPermanentCallback(&HandleWhere), true, true);
+  server->AddWorkerPool("slow", FLAGS_num_slow_clients, 64);
+  server->AddWorkerPool("tiny", 1, 2);
+  server->SetWorkerPool("/tiny", "tiny");
+  server->StartServing();
+}
+
+void StopServer(http::Server* server) {
+  server->StopServing();
+}
+
+void DeleteServer(http::Server* server) {
+  delete server;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// A blocking HTTP/1.1 client, w/ a request in flight
+class Client {
+ public:
+  explicit Client(const struct sockaddr_storage& addr)
+      : fd_(::socket(AF_INET, SOCK_STREAM, 0)),
+        parser_("client") {
+    CHECK_GE(fd_, 0);
+    const int one = 1;
+    CHECK_EQ(::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY,
+                          &one, sizeof(one)), 0);
+    CHECK_EQ(::connect(fd_, reinterpret_cast<const struct sockaddr*>(&addr),
+                       sizeof(struct sockaddr_in)), 0);
+  }
+  ~Client() {
+    ::close(fd_);
+  }
+  void Send(const std::string& path) {
+    const std::string s("GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    size_t pos = 0;
+    while ( pos < s.size() ) {
+      const ssize_t cb = ::write(fd_, s.data() + pos, s.size() - pos);
+      CHECK_GT(cb, 0);
+      pos += cb;
+    }
+  }
+  // Returns the status code, and the body in *body
+  int ReadReply(std::string* body) {
+    http::Request reply;
+    parser_.Clear();
+    while ( true ) {
+      if ( !inbuf_.IsEmpty() ) {
+        const int32 state = parser_.ParseServerReply(&inbuf_, &reply);
+        if ( state & http::RequestParser::REQUEST_FINISHED ) {
+          break;
+        }
+        if ( (state & http::RequestParser::CONTINUE) != 0 ) {
+          continue;
+        }
+      }
+      char buf[16384];
+      const ssize_t cb = ::read(fd_, buf, sizeof(buf));
+      CHECK_GT(cb, 0) << " Server closed on us";
+      inbuf_.Write(buf, cb);
+    }
+    *body = reply.server_data()->ToString();
+    return reply.server_header()->status_code();
+  }
+  std::string Get(const std::string& path) {
+    Send(path);
+    std::string body;
+    CHECK_EQ(ReadReply(&body), http::OK) << path;
+    return body;
+  }
+ private:
+  const int fd_;
+  http::RequestParser parser_;
+  io::MemoryStream inbuf_;
+};
+
+//////////////////////////////////////////////////////////////////////
+
+void TestWhere(http::Server* server, const struct sockaddr_storage& addr) {
+  Client client(addr);
+  CHECK_EQ(client.Get("/where"), "network");
+  server->SetWorkerPool("/where", "slow");
+  CHECK_EQ(client.Get("/where"), "worker");
+  CHECK_EQ(client.Get("/where/below"), "worker");
+  server->SetWorkerPool("/where/below", "");
+  CHECK_EQ(client.Get("/where/below"), "network");
+  CHECK_EQ(client.Get("/where"), "worker");
+  server->SetWorkerPool("/where", "");
+  CHECK_EQ(client.Get("/where"), "network");
+  // Unknown paths are not processed in pools
+  server->SetWorkerPool("/nothing", "slow");
+  client.Send("/nothing/here");
+  std::string body;
+  CHECK_EQ(client.ReadReply(&body), http::NOT_FOUND);
+  LOG_INFO << "Where test PASS";
+}
+
+void TestShedding(http::Server* server, const struct sockaddr_storage& addr) {
+  // The "tiny" pool has a thread and two places in line
+  const int kNumClients = 6;
+  std::vector<Client*> clients;
+  for ( int i = 0; i < kNumClients; ++i ) {
+    clients.push_back(new Client(addr));
+    clients.back()->Send("/tiny/300");
+  }
+  int num_ok = 0;
+  int num_shed = 0;
+  for ( int i = 0; i < kNumClients; ++i ) {
+    std::string body;
+    const int status = clients[i]->ReadReply(&body);
+    if ( status == http::OK ) {
+      CHECK_EQ(body, "/tiny/300");
+      ++num_ok;
+    } else {
+      CHECK_EQ(status, http::SERVICE_UNAVAILABLE);
+      ++num_shed;
+    }
+    delete clients[i];
+  }
+  LOG_INFO << "Processed: " << num_ok << " shed: " << num_shed;
+  CHECK_GE(num_ok, 2);
+  CHECK_LE(num_ok, 3);
+  CHECK_EQ(num_ok + num_shed, kNumClients);
+  CHECK_EQ(server->num_shed_requests(), num_shed);
+  LOG_INFO << "Shedding test PASS";
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void SlowClientLoop(const struct sockaddr_storage* addr,
+                    const std::atomic_bool* done,
+                    std::atomic<int64>* num_requests) {
+  Client client(*addr);
+  const std::string path(strutil::StringPrintf("/slow/%d", FLAGS_slow_ms));
+  while ( !*done ) {
+    CHECK_EQ(client.Get(path), path);
+    ++*num_requests;
+  }
+}
+
+// Returns the median latency (in ns) of the fast requests
+int64 RunMixedLoad(const char* name, const struct sockaddr_storage& addr) {
+  std::atomic_bool done(false);
+  std::atomic<int64> num_slow(0);
+  std::vector<thread::Thread*> threads;
+  for ( int i = 0; i < FLAGS_num_slow_clients; ++i ) {
+    threads.push_back(new thread::Thread(
+        NewCallback(&SlowClientLoop, &addr,
+                    const_cast<const std::atomic_bool*>(&done), &num_slow)));
+    threads.back()->SetJoinable();
+    threads.back()->Start();
+  }
+  ::usleep(FLAGS_slow_ms * 1000);
+
+  Client client(addr);
+  std::vector<int64> latencies;
+  const int64 start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_fast_requests; ++i ) {
+    const int64 sent = timer::TicksNsec();
+    CHECK_EQ(client.Get("/fast"), "/fast");
+    latencies.push_back(timer::TicksNsec() - sent);
+  }
+  const int64 duration = timer::TicksNsec() - start;
+  done = true;
+  for ( size_t i = 0; i < threads.size(); ++i ) {
+    threads[i]->Join();
+    delete threads[i];
+  }
+  std::sort(latencies.begin(), latencies.end());
+  const int64 median = latencies[latencies.size() / 2];
+  LOG_INFO << " " << name << ": " << latencies.size() << " fast requests in "
+           << duration / 1000000 << " ms, latency - median: "
+           << median / 1000 << " us, p99: "
+           << latencies[latencies.size() * 99 / 100] / 1000 << " us, max: "
+           << latencies.back() / 1000 << " us ("
+           << num_slow << " slow requests of " << FLAGS_slow_ms << " ms)";
+  return median;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  // Find a free port
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  const net::HostPort server_address("127.0.0.1", ntohs(tmp_addr.sin_port));
+  ::close(tmp_fd);
+
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  http::ServerParams params;
+  params.max_concurrent_connections_ = 100;
+  http::Server* const server = new http::Server(
+      "http_worker_pool_test", server_thread.mutable_selector(),
+      net_factory, params);
+  server->AddAcceptor(net::PROTOCOL_TCP, server_address);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StartServer, server));
+
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+  TestWhere(server, addr);
+  TestShedding(server, addr);
+
+  const int64 network_median = RunMixedLoad("Slow requests in network thread",
+                                            addr);
+  server->SetWorkerPool("/slow", "slow");
+  const int64 worker_median = RunMixedLoad("Slow requests in worker pool",
+                                           addr);
+  // The fast requests do not wait for the slow ones any more
+  CHECK_LT(worker_median, FLAGS_slow_ms * 1000000LL);
+  LOG_INFO << "Median latency improved: "
+           << network_median / std::max(worker_median, int64(1)) << " times";
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&StopServer, server));
+  const int64 start = timer::TicksMsec();
+  while ( server->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(), NewCallback(&DeleteServer, server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,366 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Checks http::PathRouter against io::FindPathBased (what http::Server
+// used before) and benchmarks the two w/ a lot of registered paths.
+//
+
+#include <stdlib.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/io/ioutil.h"
+#include "whisperlib/sync/thread.h"
+
+#include "whisperlib/http/path_router.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_paths,
+             10000,
+             "Register these many paths for the benchmark");
+DEFINE_int32(num_lookups,
+             1000000,
+             "Route these many request paths in the benchmark");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+typedef http::PathRouter<int> Router;
+
+struct Maps {
+  std::map<std::string, int*> processors_;
+  std::map<std::string, const net::IpV4Filter*> ips_;
+  std::map<std::string, bool> streaming_;
+};
+
+// We never dereference these
+const net::IpV4Filter* FakeFilter(int i) {
+  return reinterpret_cast<const net::IpV4Filter*>(
+      static_cast<intptr_t>(0x1000 + 8 * i));
+}
+
+void CheckSame(const Router& router, Maps* maps, const std::string& path) {
+  const Router::Route route(router.Find(path));
+  std::string p1(path), p2(path), p3(path);
+  CHECK_EQ(route.processor_, io::FindPathBased(&maps->processors_, p1))
+      << " for: [" << path << "]";
+  CHECK_EQ(route.ips_, io::FindPathBased(&maps->ips_, p2))
+      << " for: [" << path << "]";
+  CHECK_EQ(route.is_client_streaming_,
+           io::FindPathBased(&maps->streaming_, p3))
+      << " for: [" << path << "]";
+}
+
+void RunSimpleTests() {
+  int p[4] = { 0, 1, 2, 3 };
+  Router router;
+  CHECK(router.Find("/a").processor_ == NULL);
+  Router::Entry e;
+  e.processor_ = &p[0];
+  router.Set("/test1", e);
+  e.processor_ = &p[1];
+  router.Set("/test1/test2", e);
+  CHECK_EQ(router.Find("/test1/test2/test3").processor_, &p[1]);
+  CHECK_EQ(router.Find("/test1").processor_, &p[0]);
+  CHECK_EQ(router.Find("/test1/test3").processor_, &p[0]);
+  CHECK_EQ(router.Find("/test1/").processor_, &p[0]);
+  CHECK(router.Find("/test").processor_ == NULL);
+  CHECK(router.Find("/test12").processor_ == NULL);
+  CHECK(router.Find("").processor_ == NULL);
+
+  // Attributes are resolved independently
+  Router::Entry ips;
+  ips.has_ips_ = true;
+  ips.ips_ = FakeFilter(1);
+  router.Set("/test1/", ips);
+  Router::Entry streaming;
+  streaming.has_client_streaming_ = true;
+  streaming.is_client_streaming_ = true;
+  router.Set("/", streaming);
+  Router::Route route(router.Find("/test1/test2/x"));
+  CHECK_EQ(route.processor_, &p[1]);
+  CHECK_EQ(route.ips_, FakeFilter(1));
+  CHECK(route.is_client_streaming_);
+  route = router.Find("/test1");
+  CHECK_EQ(route.processor_, &p[0]);
+  CHECK(route.ips_ == NULL);
+  CHECK(route.is_client_streaming_);
+  // A NULL filter shadows the one above
+  ips.ips_ = NULL;
+  router.Set("/test1/test2", ips);   // replaces the processor too
+  route = router.Find("/test1/test2/x");
+  CHECK_EQ(route.processor_, &p[0]);
+  CHECK(route.ips_ == NULL);
+
+  CHECK_EQ(router.size(), 4);
+  CHECK(router.Get("/test1/").has_ips_);
+  CHECK(router.Get("/test1/").processor_ == NULL);
+  CHECK(router.Get("/test").empty());
+  router.Set("/test1/", Router::Entry());
+  router.Set("/nothing", Router::Entry());
+  CHECK_EQ(router.size(), 3);
+  CHECK(router.Find("/test1/test3").ips_ == NULL);
+  std::vector< std::pair<std::string, Router::Entry> > entries;
+  router.GetEntries(&entries);
+  CHECK_EQ(entries.size(), 3);
+  CHECK_EQ(entries[0].first, "/");
+  CHECK_EQ(entries[1].first, "/test1");
+  CHECK_EQ(entries[2].first, "/test1/test2");
+
+  // Worker pools - a NULL one shadows the one above
+  Router::Entry pool(router.Get("/test1"));
+  pool.has_worker_pool_ = true;
+  pool.worker_pool_ = &p[2];
+  router.Set("/test1", pool);
+  CHECK(router.Find("/test1/test2/x").worker_pool_ == &p[2]);
+  CHECK_EQ(router.Find("/test1/test2/x").processor_, &p[0]);
+  CHECK(router.Find("/").worker_pool_ == NULL);
+  pool = router.Get("/test1/test2");
+  pool.has_worker_pool_ = true;
+  pool.worker_pool_ = NULL;
+  router.Set("/test1/test2", pool);
+  CHECK(router.Find("/test1/test2/x").worker_pool_ == NULL);
+  CHECK(router.Find("/test1/x").worker_pool_ == &p[2]);
+  CHECK_EQ(router.size(), 3);
+  LOG_INFO << "Simple tests PASS";
+}
+
+// Generates num paths, w/ plenty of common prefixes
+void GeneratePaths(int num, std::vector<std::string>* paths) {
+  static const char* const kPieces[] = {
+    "api", "v1", "v2", "users", "user", "static", "img", "a", "ab", "",
+  };
+  const int kNumPieces = NUMBEROF(kPieces);
+  std::map<std::string, bool> seen;
+  while ( int(paths->size()) < num ) {
+    std::string path;
+    const int depth = 1 + random() % 5;
+    for ( int i = 0; i < depth; ++i ) {
+      path += "/";
+      path += kPieces[random() % kNumPieces];
+      if ( (random() % 3) == 0 ) {
+        path += strutil::IntToString(random() % 100);
+      }
+    }
+    if ( (random() % 4) == 0 ) {
+      path += "/";
+    }
+    if ( seen.insert(std::make_pair(path, true)).second ) {
+      paths->push_back(path);
+    }
+  }
+}
+
+// Request paths: the registered ones, and a variation on them
+std::string RequestPath(const std::vector<std::string>& paths, int i) {
+  const std::string& path = paths[i % paths.size()];
+  switch ( i % 4 ) {
+    case 0: return path;
+    case 1: return path + "/index.html";
+    case 2: return path + "x";
+    default: return path.substr(0, path.size() / 2);
+  }
+}
+
+void RunCompareTests(const std::vector<std::string>& paths,
+                     Router* router, Maps* maps) {
+  std::vector<int> values(paths.size());
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    Router::Entry e;
+    switch ( i % 3 ) {
+      case 0:
+        e.processor_ = &values[i];
+        maps->processors_[paths[i]] = e.processor_;
+        if ( (i % 2) == 0 ) {
+          e.has_ips_ = true;
+          e.ips_ = (i % 4) == 0 ? NULL : FakeFilter(i);
+          maps->ips_[paths[i]] = e.ips_;
+        }
+        break;
+      case 1:
+        e.has_ips_ = true;
+        e.ips_ = FakeFilter(i);
+        maps->ips_[paths[i]] = e.ips_;
+        break;
+      default:
+        e.has_client_streaming_ = true;
+        e.is_client_streaming_ = (i % 2) == 0;
+        maps->streaming_[paths[i]] = e.is_client_streaming_;
+        e.processor_ = &values[i];
+        maps->processors_[paths[i]] = e.processor_;
+        break;
+    }
+    router->Set(paths[i], e);
+  }
+  CHECK_EQ(router->size(), paths.size());
+  for ( size_t i = 0; i < 4 * paths.size(); ++i ) {
+    CheckSame(*router, maps, RequestPath(paths, i));
+  }
+  // Change some of them, and check again
+  for ( size_t i = 0; i < paths.size(); i += 7 ) {
+    router->Set(paths[i], Router::Entry());
+    maps->processors_.erase(paths[i]);
+    maps->ips_.erase(paths[i]);
+    maps->streaming_.erase(paths[i]);
+  }
+  for ( size_t i = 0; i < 4 * paths.size(); ++i ) {
+    CheckSame(*router, maps, RequestPath(paths, i));
+  }
+  LOG_INFO << "Compare tests on " << paths.size() << " paths PASS";
+}
+
+void RunBenchmark(const std::vector<std::string>& paths) {
+  std::vector<int> values(paths.size());
+  Router router;
+  std::map<std::string, int*> processors;
+  std::map<std::string, const net::IpV4Filter*> ips;
+  std::map<std::string, bool> streaming;
+  int64 start = timer::TicksNsec();
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    Router::Entry e;
+    e.processor_ = &values[i];
+    e.has_ips_ = true;
+    e.has_client_streaming_ = true;
+    router.Set(paths[i], e);
+  }
+  LOG_INFO << " Registered " << paths.size() << " paths in "
+           << (timer::TicksNsec() - start) / 1000 << " us";
+  for ( size_t i = 0; i < paths.size(); ++i ) {
+    processors[paths[i]] = &values[i];
+    ips[paths[i]] = NULL;
+    streaming[paths[i]] = false;
+  }
+  std::vector<std::string> requests;
+  for ( int i = 0; i < 4096; ++i ) {
+    requests.push_back(RequestPath(paths, random()));
+  }
+  const int num_lookups = FLAGS_num_lookups;
+  size_t num_found = 0;
+  start = timer::TicksNsec();
+  for ( int i = 0; i < num_lookups; ++i ) {
+    const std::string& path = requests[i % requests.size()];
+    num_found += (router.Find(path).processor_ != NULL);
+  }
+  const int64 router_duration = timer::TicksNsec() - start;
+  size_t num_found_maps = 0;
+  start = timer::TicksNsec();
+  for ( int i = 0; i < num_lookups; ++i ) {
+    // What the server did, for each of the three
+    std::string p1(requests[i % requests.size()]), p2(p1), p3(p1);
+    num_found_maps += (io::FindPathBased(&processors, p1) != NULL);
+    io::FindPathBased(&ips, p2);
+    io::FindPathBased(&streaming, p3);
+  }
+  const int64 maps_duration = timer::TicksNsec() - start;
+  CHECK_EQ(num_found, num_found_maps);
+  LOG_INFO << " Routed " << num_lookups << " paths through "
+           << paths.size() << " registered paths: "
+           << router_duration / num_lookups << " ns per path w/ PathRouter, "
+           << maps_duration / num_lookups << " ns per path w/ FindPathBased";
+}
+
+void ReaderThread(const Router* router, const std::vector<std::string>* paths,
+                  std::atomic_bool* done, std::atomic<int64>* num_lookups) {
+  int64 num = 0;
+  int i = 0;
+  while ( !*done ) {
+    const Router::Route route(router->Find(RequestPath(*paths, i++)));
+    if ( route.processor_ != NULL ) {
+      CHECK_GE(*route.processor_, 0);
+    }
+    ++num;
+  }
+  *num_lookups += num;
+}
+
+void RunConcurrentTests(const std::vector<std::string>& paths) {
+  const int kNumReaders = 3;
+  std::vector<int> values(paths.size());
+  for ( size_t i = 0; i < values.size(); ++i ) {
+    values[i] = i;
+  }
+  Router router;
+  std::atomic_bool done(false);
+  std::atomic<int64> num_lookups(0);
+  std::vector<thread::Thread*> readers;
+  for ( int i = 0; i < kNumReaders; ++i ) {
+    readers.push_back(new thread::Thread(
+        NewCallback(&ReaderThread, const_cast<const Router*>(&router),
+                    &paths, &done, &num_lookups)));
+    readers.back()->SetJoinable();
+    readers.back()->Start();
+  }
+  const size_t num_updates = std::min(paths.size(), size_t(2000));
+  const int64 start = timer::TicksNsec();
+  for ( size_t i = 0; i < num_updates; ++i ) {
+    Router::Entry e;
+    e.processor_ = &values[i];
+    router.Set(paths[i], e);
+    if ( (i % 5) == 0 ) {
+      router.Set(paths[i / 2], Router::Entry());
+    }
+  }
+  const int64 duration = timer::TicksNsec() - start;
+  done = true;
+  for ( int i = 0; i < kNumReaders; ++i ) {
+    readers[i]->Join();
+    delete readers[i];
+  }
+  LOG_INFO << " Concurrent: " << num_updates << " updates in "
+           << duration / 1000 << " us, w/ " << num_lookups.load()
+           << " lookups in parallel";
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  RunSimpleTests();
+
+  std::vector<std::string> paths;
+  GeneratePaths(FLAGS_num_paths, &paths);
+  {
+    Router router;
+    Maps maps;
+    RunCompareTests(paths, &router, &maps);
+  }
+  RunBenchmark(paths);
+  RunConcurrentTests(paths);
+
+  LOG_INFO << "PASS";
+}
@@ -0,0 +1,349 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Checks the replies of http::StaticFileHandler, and measures the cpu spent
+// per Gbit of served file data, when sending from the file (sendfile) vs.
+// when reading the file in the reply (the regular copy path) vs. when
+// sending it from memory w/ MSG_ZEROCOPY.
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/http/static_file_handler.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(port,
+             18087,
+             "Serve on this port");
+DEFINE_int32(file_size,
+             16 << 20,
+             "Size of the served file");
+DEFINE_int32(num_requests,
+             16,
+             "Serve the file this many times w/ each method");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static std::string g_dir;
+static std::string g_content;
+
+// The regular way: the file is read in the reply
+class CopyFileHandler {
+ public:
+  explicit CopyFileHandler(http::Server* server) {
+    server->RegisterProcessor(
+        "/copy", NewPermanentCallback(this, &CopyFileHandler::Process),
+        true, true);
+  }
+ private:
+  void Process(http::ServerRequest* req) {
+    const int fd = ::open((g_dir + "/data.bin").c_str(), O_RDONLY);
+    CHECK_GE(fd, 0);
+    io::MemoryStream* const out = req->request()->server_data();
+    while ( true ) {
+      char* buffer;
+      size_t size;
+      out->GetScratchSpace(&buffer, &size);
+      const ssize_t crt_cb = ::read(fd, buffer, size);
+      CHECK_GE(crt_cb, 0);
+      out->ConfirmScratch(crt_cb);
+      if ( crt_cb == 0 ) {
+        break;
+      }
+    }
+    ::close(fd);
+    req->request()->set_server_use_gzip_encoding(false, false);
+    req->Reply();
+  }
+};
+
+// g_content is not ours to delete
+static void KeepContent() {
+}
+
+// Replies w/ the file content from memory, as an external block - large
+// enough to go out w/ MSG_ZEROCOPY
+class RawHandler {
+ public:
+  explicit RawHandler(http::Server* server) {
+    server->RegisterProcessor(
+        "/raw", NewPermanentCallback(this, &RawHandler::Process),
+        true, true);
+  }
+ private:
+  void Process(http::ServerRequest* req) {
+    req->request()->server_data()->AppendRaw(g_content.data(),
+                                             g_content.size(),
+                                             NewCallback(&KeepContent));
+    req->request()->set_server_use_gzip_encoding(false, false);
+    req->Reply();
+  }
+};
+
+// Gets a path and checks the reply
+class Fetcher {
+ public:
+  Fetcher(net::NetFactory* net_factory,
+          const std::string& method, const std::string& path,
+          int expected_status, const std::string* expected_body,
+          Closure* done_callback)
+      : connection_(net_factory->CreateConnection(net::PROTOCOL_TCP)),
+        request_(method + " " + path + " HTTP/1.1\r\n"
+                 "Host: localhost\r\n"
+                 "Connection: close\r\n\r\n"),   // we read until close
+        expected_status_(expected_status),
+        expected_body_(expected_body),
+        done_callback_(done_callback),
+        header_done_(false),
+        received_(0) {
+    connection_->SetConnectHandler(NewPermanentCallback(
+        this, &Fetcher::ConnectHandler), true);
+    connection_->SetReadHandler(NewPermanentCallback(
+        this, &Fetcher::ReadHandler), true);
+    connection_->SetWriteHandler(NewPermanentCallback(
+        this, &Fetcher::WriteHandler), true);
+    connection_->SetCloseHandler(NewPermanentCallback(
+        this, &Fetcher::CloseHandler), true);
+    CHECK(connection_->Connect(net::HostPort("127.0.0.1", FLAGS_port)));
+  }
+  ~Fetcher() {
+    delete connection_;
+  }
+
+ private:
+  void ConnectHandler() {
+    connection_->Write(request_);
+  }
+  bool ReadHandler() {
+    io::MemoryStream* const in = connection_->inbuf();
+    if ( !header_done_ ) {
+      header_ += in->ToString();
+      const size_t pos = header_.find("\r\n\r\n");
+      if ( pos == std::string::npos ) {
+        return true;
+      }
+      header_done_ = true;
+      CHECK(strutil::StrStartsWith(
+                header_, strutil::StringPrintf("HTTP/1.1 %d",
+                                               expected_status_)))
+          << header_;
+      CheckBody(header_.data() + pos + 4, header_.size() - pos - 4);
+      header_.resize(pos);
+    }
+    const char* buffer;
+    size_t size;
+    while ( in->ReadNext(&buffer, &size) ) {
+      CheckBody(buffer, size);
+    }
+    return true;
+  }
+  void CheckBody(const char* buffer, size_t size) {
+    CHECK_LE(received_ + size, expected_body_->size()) << header_;
+    CHECK(!memcmp(buffer, expected_body_->data() + received_, size))
+        << " Bad data at: " << received_;
+    received_ += size;
+  }
+  bool WriteHandler() {
+    return true;
+  }
+  void CloseHandler(int err, net::NetConnection::CloseWhat what) {
+    if ( what != net::NetConnection::CLOSE_READ_WRITE ) {
+      connection_->FlushAndClose();
+      return;
+    }
+    CHECK(header_done_);
+    CHECK_EQ(received_, expected_body_->size()) << header_;
+    connection_->net_selector()->DeleteInSelectLoop(this);
+    connection_->net_selector()->RunInSelectLoop(done_callback_);
+  }
+
+  net::NetConnection* const connection_;
+  const std::string request_;
+  const int expected_status_;
+  const std::string* const expected_body_;
+  Closure* const done_callback_;
+  std::string header_;
+  bool header_done_;
+  int64 received_;
+};
+
+// Runs the fetches one by one, and reports the cpu spent on each benchmark
+class Runner {
+ public:
+  struct Step {
+    std::string method_;
+    std::string path_;
+    int status_;
+    const std::string* body_;
+    // If not empty, we measure the fetches w/ this name
+    std::string benchmark_;
+  };
+  Runner(net::Selector* selector, net::NetFactory* net_factory)
+      : selector_(selector),
+        net_factory_(net_factory),
+        next_(0),
+        start_ts_(0),
+        start_cpu_(0),
+        benchmark_bytes_(0) {
+  }
+  void Add(const std::string& method, const std::string& path,
+           int status, const std::string* body,
+           const std::string& benchmark = "") {
+    steps_.push_back(Step());
+    steps_.back().method_ = method;
+    steps_.back().path_ = path;
+    steps_.back().status_ = status;
+    steps_.back().body_ = body;
+    steps_.back().benchmark_ = benchmark;
+  }
+  void Next() {
+    const std::string& last_benchmark =
+        next_ > 0 ? steps_[next_ - 1].benchmark_ : std::string();
+    const std::string& benchmark =
+        next_ < steps_.size() ? steps_[next_].benchmark_ : std::string();
+    if ( last_benchmark != benchmark ) {
+      if ( !last_benchmark.empty() ) {
+        Report(last_benchmark);
+      }
+      start_ts_ = timer::TicksUsec();
+      start_cpu_ = timer::CpuNsec();
+      benchmark_bytes_ = 0;
+    }
+    if ( next_ >= steps_.size() ) {
+      selector_->MakeLoopExit();
+      return;
+    }
+    const Step& step = steps_[next_++];
+    benchmark_bytes_ += step.body_->size();
+    new Fetcher(net_factory_, step.method_, step.path_, step.status_,
+                step.body_, NewCallback(this, &Runner::Next));
+  }
+ private:
+  void Report(const std::string& name) {
+    const int64 duration_us = timer::TicksUsec() - start_ts_;
+    const int64 cpu_ns = timer::CpuNsec() - start_cpu_;
+    const double gbits = 8.0 * benchmark_bytes_ / 1e9;
+    LOG_INFO << name << ": " << gbits * 1e6 / duration_us << " Gbit/s, "
+             << "cpu: " << cpu_ns / 1e6 / gbits << " ms / Gbit served "
+             << "(client included)";
+  }
+
+  net::Selector* const selector_;
+  net::NetFactory* const net_factory_;
+  std::vector<Step> steps_;
+  size_t next_;
+  int64 start_ts_;
+  int64 start_cpu_;
+  int64 benchmark_bytes_;
+};
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  char dir_template[] = "/tmp/static_file_handler_test.XXXXXX";
+  CHECK(mkdtemp(dir_template) != NULL);
+  g_dir = dir_template;
+  for ( int32 i = 0; i < FLAGS_file_size; ++i ) {
+    g_content.push_back(static_cast<char>(random() % 256));
+  }
+  const std::string file_path(g_dir + "/data.bin");
+  const int fd = ::open(file_path.c_str(), O_WRONLY | O_CREAT, 0644);
+  CHECK_GE(fd, 0);
+  CHECK_EQ(::write(fd, g_content.data(), g_content.size()),
+           ssize_t(g_content.size()));
+  ::close(fd);
+  const std::string index_path(g_dir + "/index.html");
+  const int index_fd = ::open(index_path.c_str(), O_WRONLY | O_CREAT, 0644);
+  CHECK_GE(index_fd, 0);
+  CHECK_EQ(::write(index_fd, "<h1>Hi</h1>", 11), ssize_t(11));
+  ::close(index_fd);
+
+  net::Selector selector;
+  net::NetFactory net_factory(&selector);
+  net::TcpConnectionParams tcp_connection_params;
+  tcp_connection_params.zerocopy_min_size_ = 1 << 16;
+  net_factory.SetTcpParams(net::TcpAcceptorParams(tcp_connection_params),
+                           tcp_connection_params);
+  http::ServerParams params;
+  params.max_reply_buffer_size_ = 2 * FLAGS_file_size;
+  http::Server server("Static Test Server", &selector, net_factory, params);
+  http::StaticFileHandler handler(&server, "/static", g_dir);
+  CopyFileHandler copy_handler(&server);
+  RawHandler raw_handler(&server);
+  server.AddAcceptor(net::PROTOCOL_TCP, net::HostPort(0, FLAGS_port));
+  server.StartServing();
+
+  CHECK_EQ(std::string(http::StaticFileHandler::GetContentType("a/b.HTML")),
+           "text/html");
+  CHECK_EQ(std::string(http::StaticFileHandler::GetContentType("a.b/c")),
+           "application/octet-stream");
+
+  const std::string index("<h1>Hi</h1>");
+  const std::string empty;
+  Runner runner(&selector, &net_factory);
+  runner.Add("GET", "/static/index.html", 200, &index);
+  runner.Add("GET", "/static/", 200, &index);
+  runner.Add("HEAD", "/static/data.bin", 200, &empty);
+  runner.Add("GET", "/static/none.bin", 404, &empty);
+  runner.Add("GET", "/static/%2e%2e/etc/passwd", 403, &empty);
+  for ( int32 i = 0; i < FLAGS_num_requests; ++i ) {
+    runner.Add("GET", "/copy", 200, &g_content, "copy");
+  }
+  for ( int32 i = 0; i < FLAGS_num_requests; ++i ) {
+    runner.Add("GET", "/static/data.bin", 200, &g_content, "sendfile");
+  }
+  // NOTE: on loopback the kernel copies the MSG_ZEROCOPY data anyway (and
+  //       we stop using it after the first notification about it).
+  for ( int32 i = 0; i < FLAGS_num_requests; ++i ) {
+    runner.Add("GET", "/raw", 200, &g_content, "zerocopy");
+  }
+  selector.RunInSelectLoop(NewCallback(&runner, &Runner::Next));
+  selector.Loop();
+
+  server.StopServing();
+  selector.CleanAndCloseAll();
+  ::unlink(file_path.c_str());
+  ::unlink(index_path.c_str());
+  ::rmdir(g_dir.c_str());
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,356 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include <atomic>
+#include <set>
+#include <vector>
+
+#include "whisperlib/io/buffer/block_pool.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/sync/mutex.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_bool(data_block_pool,
+            true,
+            "Pool the memory of the io::DataBlock buffers "
+            "(in size classes, w/ per thread caches)");
+DEFINE_int32(data_block_pool_max_cached_mb,
+             64,
+             "Keep at most these many MB of free DataBlock buffers in "
+             "the free list shared by all threads");
+
+//////////////////////////////////////////////////////////////////////
+
+namespace whisper {
+namespace io {
+
+namespace {
+
+const int kMinClassShift = 6;
+const int kMaxClassShift = 16;
+const int kNumClasses = kMaxClassShift - kMinClassShift + 1;
+// A thread caches at most these many bytes of free buffers of a class
+const int64 kThreadCacheClassBytes = 256 << 10;
+// .. but at least these many buffers
+const size_t kMinThreadCacheBuffers = 4;
+
+// The class for buffers of size bytes (-1 if not pooled)
+inline int SizeClass(int32 size) {
+  if ( size > BlockPool::kMaxPooledSize ) {
+    return -1;
+  }
+  if ( size <= (1 << kMinClassShift) ) {
+    return 0;
+  }
+  return 32 - __builtin_clz(size - 1) - kMinClassShift;
+}
+inline int32 ClassSize(int c) {
+  return 1 << (c + kMinClassShift);
+}
+inline size_t MaxThreadCacheBuffers(int c) {
+  return std::max(kMinThreadCacheBuffers,
+                  size_t(kThreadCacheClassBytes >> (c + kMinClassShift)));
+}
+
+// Counters are updated only by their thread - w/o atomic read-modify-write
+// operations - and read by anybody (GetStats).
+inline void AddCounter(std::atomic<int64>* counter, int64 delta) {
+  counter->store(counter->load(std::memory_order_relaxed) + delta,
+                 std::memory_order_relaxed);
+}
+inline int64 GetCounter(const std::atomic<int64>& counter) {
+  return counter.load(std::memory_order_relaxed);
+}
+
+struct ThreadCache {
+  std::vector<char*> free_[kNumClasses];
+  std::atomic<int64> hits_;
+  std::atomic<int64> misses_;
+  std::atomic<int64> allocated_bytes_;
+  std::atomic<int64> freed_bytes_;
+  std::atomic<int64> cached_bytes_;
+  ThreadCache()
+      : hits_(0), misses_(0), allocated_bytes_(0), freed_bytes_(0),
+        cached_bytes_(0) {
+  }
+};
+
+// The free list shared by all threads
+class SharedPool {
+ public:
+  SharedPool()
+      : cached_bytes_(0), hits_(0), misses_(0), outstanding_bytes_(0) {
+  }
+  // Moves at most num buffers of class c to out
+  void Get(int c, size_t num, std::vector<char*>* out) {
+    synch::MutexLocker l(&mutex_);
+    std::vector<char*>& free_list = free_[c];
+    num = std::min(num, free_list.size());
+    out->insert(out->end(), free_list.end() - num, free_list.end());
+    free_list.resize(free_list.size() - num);
+    cached_bytes_ -= int64(num) * ClassSize(c);
+  }
+  // Moves the last num buffers of class c from in (we keep only
+  // what fits in our limit)
+  void Put(int c, size_t num, std::vector<char*>* in) {
+    const int64 max_cached_bytes =
+        int64(FLAGS_data_block_pool_max_cached_mb) << 20;
+    size_t i = in->size() - num;
+    {
+      synch::MutexLocker l(&mutex_);
+      for ( ; i < in->size() && cached_bytes_ < max_cached_bytes; ++i ) {
+        free_[c].push_back((*in)[i]);
+        cached_bytes_ += ClassSize(c);
+      }
+    }
+    for ( ; i < in->size(); ++i ) {
+      delete [] (*in)[i];
+    }
+    in->resize(in->size() - num);
+  }
+  // For threads that lost their cache (i.e. exiting)
+  char* Allocate(int c) {
+    char* buffer = NULL;
+    {
+      synch::MutexLocker l(&mutex_);
+      outstanding_bytes_ += ClassSize(c);
+      if ( !free_[c].empty() ) {
+        ++hits_;
+        cached_bytes_ -= ClassSize(c);
+        buffer = free_[c].back();
+        free_[c].pop_back();
+        return buffer;
+      }
+      ++misses_;
+    }
+    return new char[ClassSize(c)];
+  }
+  void Free(int c, char* buffer) {
+    std::vector<char*> v(1, buffer);
+    {
+      synch::MutexLocker l(&mutex_);
+      outstanding_bytes_ -= ClassSize(c);
+    }
+    Put(c, 1, &v);
+  }
+  void CountHeapAllocation(int64 size) {
+    synch::MutexLocker l(&mutex_);
+    ++misses_;
+    outstanding_bytes_ += size;
+  }
+  void CountHeapFree(int64 size) {
+    synch::MutexLocker l(&mutex_);
+    outstanding_bytes_ -= size;
+  }
+
+  void Register(ThreadCache* cache) {
+    synch::MutexLocker l(&mutex_);
+    caches_.insert(cache);
+  }
+  void Unregister(ThreadCache* cache) {
+    synch::MutexLocker l(&mutex_);
+    caches_.erase(cache);
+    hits_ += GetCounter(cache->hits_);
+    misses_ += GetCounter(cache->misses_);
+    outstanding_bytes_ += GetCounter(cache->allocated_bytes_) -
+                          GetCounter(cache->freed_bytes_);
+  }
+  void GetStats(BlockPool::Stats* stats) {
+    synch::MutexLocker l(&mutex_);
+    stats->hits_ = hits_;
+    stats->misses_ = misses_;
+    stats->outstanding_bytes_ = outstanding_bytes_;
+    stats->cached_bytes_ = cached_bytes_;
+    for ( std::set<ThreadCache*>::const_iterator it = caches_.begin();
+          it != caches_.end(); ++it ) {
+      stats->hits_ += GetCounter((*it)->hits_);
+      stats->misses_ += GetCounter((*it)->misses_);
+      stats->outstanding_bytes_ += GetCounter((*it)->allocated_bytes_) -
+                                   GetCounter((*it)->freed_bytes_);
+      stats->cached_bytes_ += GetCounter((*it)->cached_bytes_);
+    }
+  }
+  void Trim() {
+    for ( int c = 0; c < kNumClasses; ++c ) {
+      std::vector<char*> to_delete;
+      {
+        synch::MutexLocker l(&mutex_);
+        to_delete.swap(free_[c]);
+        cached_bytes_ -= int64(to_delete.size()) * ClassSize(c);
+      }
+      for ( size_t i = 0; i < to_delete.size(); ++i ) {
+        delete [] to_delete[i];
+      }
+    }
+  }
+
+ private:
+  synch::Mutex mutex_;
+  std::vector<char*> free_[kNumClasses];
+  int64 cached_bytes_;
+  std::set<ThreadCache*> caches_;
+  // Counters from the threads that are gone (or lost their cache)
+  int64 hits_;
+  int64 misses_;
+  int64 outstanding_bytes_;
+};
+
+// Never deleted - blocks may be released very late on exit
+SharedPool* GetSharedPool() {
+  static SharedPool* const shared_pool = new SharedPool();
+  return shared_pool;
+}
+
+void FlushCache(ThreadCache* cache) {
+  for ( int c = 0; c < kNumClasses; ++c ) {
+    AddCounter(&cache->cached_bytes_,
+        -int64(cache->free_[c].size()) * ClassSize(c));
+    GetSharedPool()->Put(c, cache->free_[c].size(), &cache->free_[c]);
+  }
+}
+
+thread_local ThreadCache* tls_cache = NULL;
+// After the thread cache is gone (on thread exit) we go to the shared pool
+thread_local bool tls_cache_released = false;
+
+struct ThreadCacheReleaser {
+  ~ThreadCacheReleaser() {
+    if ( tls_cache != NULL ) {
+      FlushCache(tls_cache);
+      GetSharedPool()->Unregister(tls_cache);
+      delete tls_cache;
+      tls_cache = NULL;
+    }
+    tls_cache_released = true;
+  }
+};
+thread_local ThreadCacheReleaser tls_cache_releaser;
+
+inline ThreadCache* GetThreadCache() {
+  if ( tls_cache == NULL && !tls_cache_released ) {
+    // Touching the releaser gets it constructed (and destroyed on exit)
+    (void)&tls_cache_releaser;
+    tls_cache = new ThreadCache();
+    GetSharedPool()->Register(tls_cache);
+  }
+  return tls_cache;
+}
+}  // namespace
+
+// static
+char* BlockPool::Allocate(int32 size) {
+  const int c = SizeClass(size);
+  ThreadCache* const cache = GetThreadCache();
+  if ( cache == NULL ) {
+    if ( c < 0 ) {
+      GetSharedPool()->CountHeapAllocation(size);
+      return new char[size];
+    }
+    return GetSharedPool()->Allocate(c);
+  }
+  const int32 alloc_size = c < 0 ? size : ClassSize(c);
+  AddCounter(&cache->allocated_bytes_, alloc_size);
+  if ( c >= 0 && FLAGS_data_block_pool ) {
+    std::vector<char*>& free_list = cache->free_[c];
+    if ( free_list.empty() ) {
+      GetSharedPool()->Get(c, MaxThreadCacheBuffers(c) / 2, &free_list);
+      AddCounter(&cache->cached_bytes_, int64(free_list.size()) * alloc_size);
+    }
+    if ( !free_list.empty() ) {
+      char* const buffer = free_list.back();
+      free_list.pop_back();
+      AddCounter(&cache->cached_bytes_, -alloc_size);
+      AddCounter(&cache->hits_, 1);
+      return buffer;
+    }
+  }
+  AddCounter(&cache->misses_, 1);
+  // Always class sized, so we can pool it later
+  return new char[alloc_size];
+}
+
+// static
+void BlockPool::Free(char* buffer, int32 size) {
+  const int c = SizeClass(size);
+  ThreadCache* const cache = GetThreadCache();
+  if ( cache == NULL ) {
+    if ( c < 0 ) {
+      GetSharedPool()->CountHeapFree(size);
+      delete [] buffer;
+    } else {
+      GetSharedPool()->Free(c, buffer);
+    }
+    return;
+  }
+  const int32 alloc_size = c < 0 ? size : ClassSize(c);
+  AddCounter(&cache->freed_bytes_, alloc_size);
+  if ( c < 0 || !FLAGS_data_block_pool ) {
+    delete [] buffer;
+    return;
+  }
+  std::vector<char*>& free_list = cache->free_[c];
+  free_list.push_back(buffer);
+  AddCounter(&cache->cached_bytes_, alloc_size);
+  const size_t max_size = MaxThreadCacheBuffers(c);
+  if ( free_list.size() > max_size ) {
+    const size_t num = max_size / 2;
+    AddCounter(&cache->cached_bytes_, -int64(num) * alloc_size);
+    GetSharedPool()->Put(c, num, &free_list);
+  }
+}
+
+// static
+void BlockPool::FlushThreadCache() {
+  if ( tls_cache != NULL ) {
+    FlushCache(tls_cache);
+  }
+}
+
+// static
+void BlockPool::Trim() {
+  GetSharedPool()->Trim();
+}
+
+// static
+void BlockPool::GetStats(Stats* stats) {
+  GetSharedPool()->GetStats(stats);
+}
+
+std::string BlockPool::Stats::ToString() const {
+  return strutil::StringPrintf(
+      "hits: %" PRId64 ", misses: %" PRId64 ", outstanding: %" PRId64
+      " bytes, cached: %" PRId64 " bytes",
+      hits_, misses_, outstanding_bytes_, cached_bytes_);
+}
+
+}  // namespace io
+}  // namespace whisper
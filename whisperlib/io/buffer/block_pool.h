@@ -0,0 +1,86 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Pools the memory for the DataBlock buffers. The buffers are grouped in
+// size classes (powers of 2, from kMinPooledSize to kMaxPooledSize), and
+// each thread caches some free buffers of each class, w/o any locking.
+// A buffer can be freed in any thread (e.g. blocks that go from a network
+// selector to a server thread and back): it is cached by the thread that
+// frees it. The thread caches overflow into (and refill from) a shared
+// free list, in batches.
+//
+// Buffers larger than kMaxPooledSize come straight from the heap.
+//
+
+#ifndef __WHISPERLIB_IO_BUFFER_BLOCK_POOL_H__
+#define __WHISPERLIB_IO_BUFFER_BLOCK_POOL_H__
+
+#include <string>
+#include "whisperlib/base/types.h"
+
+namespace whisper {
+namespace io {
+
+class BlockPool {
+ public:
+  static const int32 kMinPooledSize = 64;
+  static const int32 kMaxPooledSize = 65536;
+
+  // Returns a buffer of at least size bytes
+  static char* Allocate(int32 size);
+  // Releases a buffer obtained from Allocate (w/ the same size)
+  static void Free(char* buffer, int32 size);
+
+  // Returns the free buffers cached by the calling thread to the shared
+  // free list (we do this anyway on thread exit).
+  static void FlushThreadCache();
+  // Frees the buffers in the shared free list.
+  static void Trim();
+
+  struct Stats {
+    // Allocations served from the pool
+    int64 hits_;
+    // Allocations that went to the heap
+    int64 misses_;
+    // Size of the buffers in use
+    int64 outstanding_bytes_;
+    // Size of the free buffers kept by the pool
+    int64 cached_bytes_;
+    Stats()
+        : hits_(0), misses_(0), outstanding_bytes_(0), cached_bytes_(0) {
+    }
+    std::string ToString() const;
+  };
+  static void GetStats(Stats* stats);
+};
+
+}  // namespace io
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_IO_BUFFER_BLOCK_POOL_H__
@@ -0,0 +1,84 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/io/buffer/buffer_ring.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/base/log.h"
+
+namespace whisper {
+namespace io {
+
+BufferRing::BufferRing(BlockSize block_size, BlockSize min_read_size)
+    : block_size_(block_size),
+      min_read_size_(min_read_size),
+      block_(NULL),
+      pos_(0),
+      num_blocks_allocated_(0) {
+  CHECK_GT(min_read_size_, 0);
+  CHECK_LE(min_read_size_, block_size_);
+}
+
+BufferRing::~BufferRing() {
+  if ( block_ != NULL ) {
+    block_->DecRef();
+  }
+}
+
+void BufferRing::GetSpace(char** buffer, size_t* size) {
+  if ( block_ != NULL && block_->ref_count() == 1 ) {
+    // No slices out there - start over (keeps us in the same, warm, memory)
+    pos_ = 0;
+  }
+  if ( block_ == NULL || block_size_ - pos_ < min_read_size_ ) {
+    if ( block_ != NULL ) {
+      block_->DecRef();
+    }
+    block_ = new DataBlock(block_size_);
+    block_->IncRef();
+    pos_ = 0;
+    ++num_blocks_allocated_;
+  }
+  *buffer = block_->mutable_buffer() + pos_;
+  *size = block_size_ - pos_;
+}
+
+void BufferRing::ConfirmSpace(size_t size, MemoryStream* ms) {
+  if ( size == 0 ) {
+    return;
+  }
+  CHECK(block_ != NULL);
+  CHECK_LE(pos_ + size, size_t(block_size_));
+  // The slice releases the block when done
+  block_->IncRef();
+  ms->AppendBlock(new DataBlock(block_->buffer() + pos_, size, NULL, block_));
+  pos_ += size;
+}
+
+}  // namespace io
+}  // namespace whisper
@@ -0,0 +1,89 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A BufferRing lends the free space of a large DataBlock to many readers
+// (e.g. all the connections of a selector). Each reader reads into it and
+// only the bytes actually read are attached to the reader's MemoryStream,
+// as a slice that shares the ring block. So a reader that has consumed all
+// its data holds no buffer memory at all.
+//
+// When the free space in the ring block gets low we go back to its
+// beginning if nobody holds slices of it anymore, else we continue in a
+// new block (the old one lives for as long as its slices do).
+//
+// Not thread safe - use it from one thread (e.g. the select thread).
+//
+
+#ifndef __WHISPERLIB_IO_BUFFER_BUFFER_RING_H__
+#define __WHISPERLIB_IO_BUFFER_BUFFER_RING_H__
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/io/buffer/data_block.h"
+
+namespace whisper {
+namespace io {
+
+class MemoryStream;
+
+class BufferRing {
+ public:
+  // We read in blocks of block_size, and we offer at least min_read_size
+  // bytes for each read.
+  BufferRing(BlockSize block_size, BlockSize min_read_size);
+  ~BufferRing();
+
+  // Returns the space for the next read
+  void GetSpace(char** buffer, size_t* size);
+  // Appends to ms the first size bytes of the last space we returned
+  void ConfirmSpace(size_t size, MemoryStream* ms);
+
+  BlockSize block_size() const {
+    return block_size_;
+  }
+  // How many ring blocks we allocated so far
+  int64 num_blocks_allocated() const {
+    return num_blocks_allocated_;
+  }
+
+ private:
+  const BlockSize block_size_;
+  const BlockSize min_read_size_;
+  // The block we read into now (we hold a reference on it)
+  DataBlock* block_;
+  // The beginning of the free space in block_
+  BlockSize pos_;
+  int64 num_blocks_allocated_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(BufferRing);
+};
+
+}  // namespace io
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_IO_BUFFER_BUFFER_RING_H__
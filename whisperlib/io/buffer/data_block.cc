@@ -29,8 +29,14 @@
 //
 // Author: Catalin Popescu
 
+#include <sys/mman.h>
+#include <unistd.h>
+#include <string.h>
+
 #include "whisperlib/base/log.h"
+#include "whisperlib/base/core_errno.h"
 #include "whisperlib/io/buffer/data_block.h"
+#include "whisperlib/io/buffer/block_pool.h"
 
 using namespace std;
 
@@ -42,12 +48,16 @@ namespace io {
 
 DataBlock::DataBlock(BlockSize buffer_size)
     : RefCounted(),
-      writable_buffer_(new char[buffer_size]),
+      writable_buffer_(BlockPool::Allocate(buffer_size)),
       readable_buffer_(writable_buffer_),
       alloc_block_(NULL),
       buffer_size_(buffer_size),
       size_(0),
-      disposer_(NULL) {
+      disposer_(NULL),
+      file_fd_(-1),
+      file_offset_(0),
+      mapping_(NULL),
+      mapping_size_(0) {
   CHECK_GT(buffer_size_, 0);
 }
 
@@ -62,22 +72,95 @@ DataBlock::DataBlock(const char* buffer,
       alloc_block_(alloc_block),
       buffer_size_(size),
       size_(size),
-      disposer_(disposer) {
+      disposer_(disposer),
+      file_fd_(-1),
+      file_offset_(0),
+      mapping_(NULL),
+      mapping_size_(0) {
+  CHECK_GT(size_, 0);
+}
+
+DataBlock::DataBlock(int fd, int64 offset, BlockSize size,
+                     Closure* disposer, DataBlock* alloc_block)
+    : RefCounted(),
+      writable_buffer_(NULL),
+      readable_buffer_(NULL),
+      alloc_block_(alloc_block),
+      buffer_size_(size),
+      size_(size),
+      disposer_(disposer),
+      file_fd_(fd),
+      file_offset_(offset),
+      mapping_(NULL),
+      mapping_size_(0) {
   CHECK_GT(size_, 0);
+  CHECK_GE(file_fd_, 0);
+  CHECK_GE(file_offset_, 0);
 }
 
 DataBlock::~DataBlock() {
+  if ( file_fd_ >= 0 ) {
+    if ( mapping_ == MAP_FAILED ) {
+      delete[] readable_buffer_;
+    } else if ( mapping_ != NULL ) {
+      ::munmap(mapping_, mapping_size_);
+    }
+  }
   if ( alloc_block_ != NULL ) {
     alloc_block_->DecRef();
   } else {
     if ( disposer_ != NULL ) {
       disposer_->Run();
-    } else {
+    } else if ( writable_buffer_ != NULL ) {
+      BlockPool::Free(writable_buffer_, buffer_size_);
+    } else if ( file_fd_ < 0 ) {
       delete[] readable_buffer_;
     }
   }
 }
 
+void* DataBlock::operator new(size_t size) {
+  return BlockPool::Allocate(size);
+}
+void DataBlock::operator delete(void* p, size_t size) {
+  BlockPool::Free(reinterpret_cast<char*>(p), size);
+}
+
+void DataBlock::MapFileRegion() const {
+  if ( file_fd_ < 0 || readable_buffer_ != NULL ) {
+    return;
+  }
+  static const int64 kPageSize = ::sysconf(_SC_PAGESIZE);
+  const int64 map_offset = file_offset_ - file_offset_ % kPageSize;
+  const size_t delta = file_offset_ - map_offset;
+  mapping_size_ = delta + size_;
+  mapping_ = ::mmap(NULL, mapping_size_, PROT_READ, MAP_PRIVATE,
+                    file_fd_, map_offset);
+  if ( mapping_ != MAP_FAILED ) {
+    readable_buffer_ = reinterpret_cast<const char*>(mapping_) + delta;
+    return;
+  }
+  // Not mappable - read it
+  LOG_WARN << "Cannot map file region, fd: " << file_fd_
+           << " offset: " << file_offset_ << " size: " << size_
+           << " - " << GetLastSystemErrorDescription() << " - reading it";
+  char* const buffer = new char[size_];
+  BlockSize cb = 0;
+  while ( cb < size_ ) {
+    const ssize_t crt_cb = ::pread(file_fd_, buffer + cb, size_ - cb,
+                                   file_offset_ + cb);
+    if ( crt_cb <= 0 ) {
+      LOG_ERROR << "Cannot read file region, fd: " << file_fd_
+                << " offset: " << file_offset_ + cb
+                << " - " << GetLastSystemErrorDescription();
+      memset(buffer + cb, 0, size_ - cb);
+      break;
+    }
+    cb += crt_cb;
+  }
+  readable_buffer_ = buffer;
+}
+
 
 //////////////////////////////////////////////////////////////////////
 
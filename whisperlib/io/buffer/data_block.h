@@ -199,14 +199,27 @@ class DataBlock : public RefCounted {
  public:
   static const BlockSize kDefaultBufferSize = 4096; // 16384;
   // Constructs a buffer that is writable w/ a given size
+  // (the memory comes from the BlockPool, as for the block itself)
   explicit DataBlock(BlockSize buffer_size = kDefaultBufferSize);
   // Constructs a raw buffer - we do not own it so we cannot write it
   explicit DataBlock(const char* buffer, BlockSize size,
                      Closure* disposer,
                      DataBlock* alloc_block);
+  // Constructs a block w/ size bytes from the file fd, starting at offset.
+  // The data is not read: connections send it directly from the file
+  // (w/ sendfile), and the file region is mapped in memory only if
+  // somebody asks for buffer(). The disposer (if any) is run on
+  // destruction (normally to close the fd), and the file is not supposed
+  // to change meanwhile. As for the raw buffers, if alloc_block is
+  // specified we release that one instead of running the disposer.
+  DataBlock(int fd, int64 offset, BlockSize size,
+            Closure* disposer, DataBlock* alloc_block);
 
   ~DataBlock();
 
+  static void* operator new(size_t size);
+  static void operator delete(void* p, size_t size);
+
   // Accessors
   BlockSize buffer_size() const {
     return buffer_size_;
@@ -223,6 +236,9 @@ class DataBlock : public RefCounted {
     return writable_buffer_ != NULL;
   }
   const char* buffer() const {
+    if ( readable_buffer_ == NULL ) {
+      MapFileRegion();
+    }
     return readable_buffer_;
   }
   char* mutable_buffer() {
@@ -233,12 +249,33 @@ class DataBlock : public RefCounted {
     return (alloc_block_ == NULL) ? this : alloc_block_;
   }
 
+  // If this block is a file region (w/ the data in file_fd())
+  bool is_file_region() const {
+    return file_fd_ >= 0;
+  }
+  int file_fd() const {
+    return file_fd_;
+  }
+  int64 file_offset() const {
+    return file_offset_;
+  }
+  // If this is a read only block w/ memory we do not own (i.e. not
+  // a file region, nor one of our writable blocks)
+  bool is_external() const {
+    return writable_buffer_ == NULL && file_fd_ < 0;
+  }
+
+ private:
+  // Brings the file region in memory
+  void MapFileRegion() const;
+
  private:
   // The beginning of the writable memory buffer (normally, if writable,
   // writable_buffer_ == readable_buffer_
   char* writable_buffer_;
-  // The beginning of the readable memory buffer
-  const char* readable_buffer_;
+  // The beginning of the readable memory buffer (for file regions,
+  // NULL until mapped)
+  mutable const char* readable_buffer_;
   // The allocation belongs to this guy..
   DataBlock* const alloc_block_;
   // Size of the buffer - total allocated memory
@@ -249,6 +286,13 @@ class DataBlock : public RefCounted {
   // If we should call some callback in order to dispose
   Closure* const disposer_;
 
+  // For file regions: the file and the offset of our data in it
+  const int file_fd_;
+  const int64 file_offset_;
+  // For file regions: what we mapped (or allocated, if we could not map)
+  mutable void* mapping_;
+  mutable size_t mapping_size_;
+
   DISALLOW_EVIL_CONSTRUCTORS(DataBlock);
 };
 
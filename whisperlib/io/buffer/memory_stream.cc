@@ -68,6 +68,40 @@ void MemoryStream::AppendRaw(const char* data, size_t size, Closure* disposer) {
   AppendBlock(new DataBlock(data, size, disposer, NULL));
 }
 
+void MemoryStream::AppendFileRegion(int fd, int64 offset, int64 size,
+                                    Closure* disposer) {
+  // Blocks have limited size - larger regions are split in blocks that
+  // keep the first one (which runs the disposer) alive.
+  static const int64 kMaxFileRegionBlockSize = 1 << 30;
+  CHECK_GT(size, 0);
+  DataBlock* const first = new DataBlock(
+      fd, offset, std::min(size, kMaxFileRegionBlockSize), disposer, NULL);
+  AppendBlock(first);
+  for ( int64 pos = first->size(); pos < size;
+        pos += kMaxFileRegionBlockSize ) {
+    first->IncRef();
+    AppendBlock(new DataBlock(fd, offset + pos,
+                              std::min(size - pos, kMaxFileRegionBlockSize),
+                              NULL, first));
+  }
+}
+
+DataBlock* MemoryStream::PeekReadBlock(BlockSize* pos) {
+  if ( !MaybeInitReadPointer() ) {
+    return NULL;
+  }
+  BlockSize crt_pos = read_pointer_.pos();
+  for ( BlockId id = read_pointer_.block_id(); id < blocks_.end_id();
+        ++id, crt_pos = 0 ) {
+    DataBlock* const block = blocks_.mutable_block(id);
+    if ( crt_pos < block->size() ) {
+      *pos = crt_pos;
+      return block;
+    }
+  }
+  return NULL;
+}
+
 void MemoryStream::AppendBlock(DataBlock* block) {
   block->IncRef();
   blocks_.push_back(block);
@@ -119,6 +153,41 @@ size_t MemoryStream::ReadForWritev(struct ::iovec** iov,
   DCHECK_EQ(read_pointer_.Distance(write_pointer_), size_);
   return sz;
 }
+
+size_t MemoryStream::PeekForWritev(struct ::iovec* iov,
+                                   int max_iovcnt,
+                                   int* iovcnt,
+                                   size_t max_size,
+                                   BlockSize min_external_size) {
+  CHECK(scratch_pointer_.IsNull())
+    << "Unconfirmed scratch before Read Next..";
+  *iovcnt = 0;
+  if ( !MaybeInitReadPointer() ) {
+    return 0;
+  }
+  size_t sz = 0;
+  BlockSize pos = read_pointer_.pos();
+  for ( BlockId id = read_pointer_.block_id();
+        id < blocks_.end_id() && sz < max_size && *iovcnt < max_iovcnt;
+        ++id, pos = 0 ) {
+    const DataBlock* const block = blocks_.block(id);
+    const BlockSize size = block->size() - pos;
+    if ( size <= 0 ) {
+      continue;
+    }
+    if ( block->is_file_region() ||
+         (min_external_size > 0 && block->is_external() &&
+          size >= min_external_size) ) {
+      break;
+    }
+    const size_t len = std::min(size_t(size), max_size - sz);
+    iov[*iovcnt].iov_base = const_cast<char*>(block->buffer() + pos);
+    iov[*iovcnt].iov_len = len;
+    ++*iovcnt;
+    sz += len;
+  }
+  return sz;
+}
 #endif   // (HAVE_SYS_UIO_H)
 
 
@@ -514,6 +583,14 @@ void MemoryStream::AppendNewBlock(DataBlock* data,
   DCHECK_GE(pos_end, pos_begin);
   size_t size = pos_end - pos_begin;
 
+  if ( size > 0 && data->is_file_region() ) {
+    // No copy for file data - a smaller region keeps the original alive
+    data->IncRef();
+    AppendBlock(new DataBlock(data->file_fd(),
+                              data->file_offset() + pos_begin,
+                              size, NULL, data));
+    return;
+  }
   if ( size > 0 ) {
 #if defined(__APPEND_BLOCK_WITH_PARTIAL_BLOCK_REUSE__)
     size_t available = write_pointer_.AvailableForWrite();
@@ -85,6 +85,17 @@ class MemoryStream {
   // count)
   void AppendBlock(DataBlock* data);
 
+  // Appends size bytes from the file fd, starting at offset, w/o reading
+  // them (see the file region DataBlock constructor). The disposer is run
+  // when all the data is released.
+  void AppendFileRegion(int fd, int64 offset, int64 size,
+                        Closure* disposer = NULL);
+
+  // Returns the block at the read position, and in *pos the position of
+  // the first unread byte in it (NULL if we are empty). The block
+  // belongs to us - IncRef it if you need it after consuming its data.
+  DataBlock* PeekReadBlock(BlockSize* pos);
+
   // Returns a piece of data from the buffer and advances the read.
   // If not 0, *size may specify the maximum ammount ot be read..
   // The returned buffer is valid until next read / append of any kind
@@ -93,8 +104,19 @@ class MemoryStream {
   bool ReadNext(const char** buffer, size_t* size);
 
   // Reads all the internal buffers for a writev operation
+  // (allocates *iov - prefer PeekForWritev)
 #if defined(HAVE_SYS_UIO_H)
   size_t ReadForWritev(struct ::iovec** iov, int* iovcnt, size_t max_size);
+
+  // Describes in iov (up to max_iovcnt entries) up to max_size bytes from
+  // the read position, without consuming them (no copy, no allocation).
+  // Returns the number of bytes described, and the number of used entries
+  // in *iovcnt. Consume what you actually wrote w/ Skip().
+  // We stop before file regions and, if min_external_size > 0, before
+  // external blocks w/ at least these many bytes left (PeekReadBlock
+  // returns them, for sending by other means).
+  size_t PeekForWritev(struct ::iovec* iov, int max_iovcnt, int* iovcnt,
+                       size_t max_size, BlockSize min_external_size = 0);
 #endif
 
   // Returns a piece of buffer already allocated and ready to be written to
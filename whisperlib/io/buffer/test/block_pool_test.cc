@@ -0,0 +1,180 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the io::BlockPool, and measures the heap allocations and the
+// throughput of MemoryStream traffic w/ and w/o it: in one thread, and
+// between two threads (the blocks are freed in another thread than the
+// one that allocated them).
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/sync/thread.h"
+#include "whisperlib/sync/producer_consumer_queue.h"
+
+#include "whisperlib/io/buffer/block_pool.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_messages,
+             200000,
+             "Pass these many messages through MemoryStreams");
+DEFINE_int32(message_size,
+             10000,
+             "Size of the messages");
+
+DECLARE_bool(data_block_pool);
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static std::string g_message;
+
+// Writes a message, as a connection reading it would
+static io::MemoryStream* MakeMessage() {
+  io::MemoryStream* const ms = new io::MemoryStream();
+  ms->Write(g_message);
+  return ms;
+}
+// Reads a message, as a connection writing it would
+static void ConsumeMessage(io::MemoryStream* ms) {
+  const char* buffer;
+  size_t size;
+  size_t cb = 0;
+  while ( ms->ReadNext(&buffer, &size) ) {
+    DCHECK(!memcmp(buffer, g_message.data() + cb, size));
+    cb += size;
+  }
+  CHECK_EQ(cb, g_message.size());
+  delete ms;
+}
+
+static void Produce(synch::ProducerConsumerQueue<io::MemoryStream*>* q) {
+  for ( int32 i = 0; i < FLAGS_num_messages; ++i ) {
+    q->Put(MakeMessage());
+  }
+  q->Put(NULL);
+}
+
+static void RunBenchmark(const char* name, bool use_pool, bool two_threads) {
+  FLAGS_data_block_pool = use_pool;
+  io::BlockPool::FlushThreadCache();
+  io::BlockPool::Trim();
+  io::BlockPool::Stats start;
+  io::BlockPool::GetStats(&start);
+  const int64 start_ts = timer::TicksUsec();
+  if ( two_threads ) {
+    synch::ProducerConsumerQueue<io::MemoryStream*> q(1000);
+    thread::Thread producer(NewCallback(&Produce, &q));
+    CHECK(producer.SetJoinable());
+    CHECK(producer.Start());
+    while ( true ) {
+      io::MemoryStream* const ms = q.Get();
+      if ( ms == NULL ) {
+        break;
+      }
+      ConsumeMessage(ms);
+    }
+    CHECK(producer.Join());
+  } else {
+    for ( int32 i = 0; i < FLAGS_num_messages; ++i ) {
+      ConsumeMessage(MakeMessage());
+    }
+  }
+  const int64 duration_us = timer::TicksUsec() - start_ts;
+  io::BlockPool::Stats end;
+  io::BlockPool::GetStats(&end);
+  const int64 allocations = (end.hits_ + end.misses_) -
+                            (start.hits_ + start.misses_);
+  const int64 heap_allocations = end.misses_ - start.misses_;
+  LOG_INFO << name << ": "
+           << double(FLAGS_num_messages) * g_message.size() / duration_us
+           << " MB/s, " << allocations << " allocations, "
+           << heap_allocations << " from the heap";
+  if ( use_pool ) {
+    CHECK_LT(heap_allocations, allocations / 10);
+  } else {
+    CHECK_EQ(heap_allocations, allocations);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  LOG_INFO << "Test Allocate / Free";
+  {
+    io::BlockPool::Stats start;
+    io::BlockPool::GetStats(&start);
+    char* const p1 = io::BlockPool::Allocate(100);
+    memset(p1, 'a', 100);
+    io::BlockPool::Free(p1, 100);
+    // Same size class - same buffer
+    char* const p2 = io::BlockPool::Allocate(128);
+    CHECK(p1 == p2);
+    memset(p2, 'b', 128);
+    // Other class
+    char* const p3 = io::BlockPool::Allocate(129);
+    CHECK(p3 != p2);
+    // Not pooled
+    char* const p4 = io::BlockPool::Allocate(1 << 20);
+    io::BlockPool::Stats stats;
+    io::BlockPool::GetStats(&stats);
+    CHECK_EQ(stats.hits_ - start.hits_, 1);
+    CHECK_EQ(stats.misses_ - start.misses_, 3);
+    CHECK_EQ(stats.outstanding_bytes_ - start.outstanding_bytes_,
+             128 + 256 + (1 << 20));
+    io::BlockPool::Free(p2, 128);
+    io::BlockPool::Free(p3, 129);
+    io::BlockPool::Free(p4, 1 << 20);
+    io::BlockPool::GetStats(&stats);
+    CHECK_EQ(stats.outstanding_bytes_, start.outstanding_bytes_);
+    LOG_INFO << stats.ToString();
+  }
+
+  for ( int32 i = 0; i < FLAGS_message_size; ++i ) {
+    g_message.push_back(static_cast<char>(random() % 256));
+  }
+  RunBenchmark("one thread, heap", false, false);
+  RunBenchmark("one thread, pool", true, false);
+  RunBenchmark("two threads, heap", false, true);
+  RunBenchmark("two threads, pool", true, true);
+
+  // The blocks freed by other threads are all accounted for
+  io::BlockPool::Stats stats;
+  io::BlockPool::GetStats(&stats);
+  LOG_INFO << stats.ToString();
+  CHECK_EQ(stats.outstanding_bytes_, 0);
+
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
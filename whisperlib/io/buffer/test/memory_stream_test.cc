@@ -29,6 +29,10 @@
 //
 // Author: Catalin Popescu
 
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
 #include "whisperlib/base/types.h"
 #include "whisperlib/base/log.h"
 #include "whisperlib/base/timer.h"
@@ -36,6 +40,7 @@
 #include "whisperlib/base/gflags.h"
 
 #include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/io/file/file.h"
 #include "whisperlib/io/num_streaming.h"
 
 using namespace std;
@@ -48,6 +53,10 @@ DEFINE_int32(rand_seed, 0, "Seed the random with this guy");
 
 static unsigned int rand_seed;
 
+static void CloseFile(int fd) {
+  ::close(fd);
+}
+
 //
 // This tests MemoryStream, and implicily the data_block.{h,cc} classes
 //
@@ -290,6 +299,90 @@ int main(int argc, char* argv[]) {
     CHECK_EQ(s, "\r\n");
     CHECK(!a.ReadCRLFLine(&s));
   }
+#if defined(HAVE_SYS_UIO_H)
+  LOG_INFO << "Test PeekForWritev";
+  {
+    whisper::io::MemoryStream a(4);
+    a.Write("0123");
+    a.Write("4567");
+    a.Write("89ab");
+    a.Write("cdef");
+    struct ::iovec iov[3];
+    int iovcnt = 0;
+    // Limited by the number of entries
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 100), 12);
+    CHECK_EQ(iovcnt, 3);
+    CHECK_EQ(a.Size(), 16);
+    CHECK(!memcmp(iov[0].iov_base, "0123", 4));
+    CHECK(!memcmp(iov[2].iov_base, "89ab", 4));
+    // Limited by size
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 6), 6);
+    CHECK_EQ(iovcnt, 2);
+    CHECK_EQ(iov[1].iov_len, 2);
+    // Consume part of it
+    CHECK_EQ(a.Skip(5), 5);
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 100), 11);
+    CHECK(!memcmp(iov[0].iov_base, "567", 3));
+    a.Skip(11);
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 100), 0);
+    CHECK_EQ(iovcnt, 0);
+  }
+  LOG_INFO << "Test AppendFileRegion";
+  {
+    char path[] = "/tmp/memory_stream_test.XXXXXX";
+    const int fd = mkstemp(path);
+    CHECK_GE(fd, 0);
+    CHECK_EQ(::write(fd, "0123456789abcdef", 16), 16);
+    whisper::io::MemoryStream a(4);
+    a.Write("xy");
+    a.AppendFileRegion(fd, 4, 8, whisper::NewCallback(&CloseFile, fd));
+    a.Write("zt");
+    CHECK_EQ(a.Size(), 12);
+    // We stop before the file data
+    struct ::iovec iov[3];
+    int iovcnt = 0;
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 100), 2);
+    CHECK_EQ(iovcnt, 1);
+    a.Skip(1);
+    whisper::io::BlockSize pos = 0;
+    CHECK_EQ(a.PeekReadBlock(&pos)->size() - pos, 1);
+    a.Skip(1);
+    const whisper::io::DataBlock* const block = a.PeekReadBlock(&pos);
+    CHECK(block->is_file_region());
+    CHECK_EQ(block->file_offset(), 4);
+    CHECK_EQ(pos, 0);
+    CHECK_EQ(a.PeekForWritev(iov, 3, &iovcnt, 100), 0);
+    // Shared by appends, mapped when read
+    whisper::io::MemoryStream b;
+    b.AppendStreamNonDestructive(&a);
+    CHECK_EQ(b.ToString(), "456789abzt");
+    a.Skip(3);
+    CHECK_EQ(a.ToString(), "789abzt");
+    // Written to a file, w/ the region in the middle (fd is closed by now)
+    const int in_fd = ::open(path, O_RDONLY);
+    CHECK_GE(in_fd, 0);
+    whisper::io::MemoryStream c;
+    c.Write("xy");
+    c.AppendFileRegion(in_fd, 4, 8, whisper::NewCallback(&CloseFile, in_fd));
+    c.Write("zt");
+    const std::string out_path = std::string(path) + ".out";
+    whisper::io::File out;
+    CHECK(out.Open(out_path, whisper::io::File::GENERIC_READ_WRITE,
+                   whisper::io::File::CREATE_ALWAYS));
+    CHECK_EQ(out.Write(&c, 5), 5);
+    CHECK_EQ(c.Size(), 7);
+    CHECK_EQ(out.Write(&c), 7);
+    CHECK(c.IsEmpty());
+    CHECK_EQ(out.Size(), 12);
+    out.SetPosition(0, whisper::io::File::FILE_SET);
+    char buf[16] = { 0, };
+    CHECK_EQ(out.ReadBuffer(buf, sizeof(buf)), 12);
+    CHECK_EQ(std::string(buf), "xy456789abzt");
+    out.Close();
+    ::unlink(out_path.c_str());
+    ::unlink(path);
+  }
+#endif
   LOG_INFO << "Test Tokens";
   {
     whisper::io::MemoryStream a(12);
@@ -39,6 +39,10 @@
 #include "whisperlib/io/file/file.h"
 #include "whisperlib/io/file/fd.h"
 
+#if defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+
 using namespace std;
 
 #ifdef HAVE_LSEEK64
@@ -67,6 +71,7 @@ using namespace std;
 
 #if defined(HAVE_SYS_UIO_H)
 static const int  kReadForWritevSize = 16384;
+static const int  kMaxWritevIovecs = 64;
 #endif
 
 namespace whisper {
@@ -313,39 +318,57 @@ ssize_t File::Write(const string& s) {
   return WriteBuffer(s.data(), s.size());
 }
 
+#if defined(HAVE_SYS_UIO_H)
+// Writes size bytes from the file region block, starting at pos, to fd
+static ssize_t WriteFileRegion(int fd, io::DataBlock* block,
+                               io::BlockSize pos, size_t size) {
+#if defined(HAVE_SYS_SENDFILE_H)
+  off_t offset = block->file_offset() + pos;
+  const ssize_t cb = ::sendfile(fd, block->file_fd(), &offset, size);
+  if ( cb >= 0 || (errno != EINVAL && errno != ENOSYS) ) {
+    return cb;
+  }
+  // fd does not take sendfile - write the data (mapped in memory)
+#endif
+  return ::write(fd, block->buffer() + pos, size);
+}
+#endif
+
 ssize_t File::Write(io::MemoryStream* ms, ssize_t len) {
 #if defined(HAVE_SYS_UIO_H)
-  size_t scratch = 0;
   ssize_t cb = 0;
+  struct ::iovec iov[kMaxWritevIovecs];
   while ( !ms->IsEmpty() && (len < 0 || cb < len) ) {
-    ms->MarkerSet();
-    struct ::iovec* iov = NULL;
-    int iovcnt = 0;
-    scratch = ms->ReadForWritev(&iov, &iovcnt,
-                                (len < 0) ? kReadForWritevSize :
-                                std::min(len - cb, ssize_t(kReadForWritevSize)));
-    if ( iovcnt > 0 ) {
-      const ssize_t crt_cb = ::writev(fd_, iov, iovcnt);
-      delete [] iov;
-      if ( crt_cb < 0 ) {
-        ms->MarkerRestore();
-        UpdatePosition();  // don't know where the file pointer ended-up
-        size_ = std::max(size_, position_);
-        return crt_cb;
+    io::BlockSize pos = 0;
+    io::DataBlock* const block = ms->PeekReadBlock(&pos);
+    size_t scratch = block->size() - pos;
+    ssize_t crt_cb;
+    if ( block->is_file_region() ) {
+      // PeekForWritev stops before these
+      if ( len >= 0 ) {
+        scratch = std::min(scratch, size_t(len - cb));
       }
-      if ( size_t(crt_cb) < scratch ) {
-        // Written something but not all - we need to return and mark
-        // the right amount in the buffer
-        ms->MarkerRestore();
-        ms->Skip(crt_cb);
-      } else {
-        // Everything written - no need for the marker
-        ms->MarkerClear();
-      }
-      cb += crt_cb;
-      if ( size_t(crt_cb) < scratch ) {
+      crt_cb = WriteFileRegion(fd_, block, pos, scratch);
+    } else {
+      int iovcnt = 0;
+      scratch = ms->PeekForWritev(
+          iov, NUMBEROF(iov), &iovcnt,
+          (len < 0) ? kReadForWritevSize :
+          std::min(len - cb, ssize_t(kReadForWritevSize)));
+      if ( iovcnt == 0 ) {
         break;
       }
+      crt_cb = ::writev(fd_, iov, iovcnt);
+    }
+    if ( crt_cb < 0 ) {
+      UpdatePosition();  // don't know where the file pointer ended-up
+      size_ = std::max(size_, position_);
+      return crt_cb;
+    }
+    ms->Skip(crt_cb);
+    cb += crt_cb;
+    if ( size_t(crt_cb) < scratch ) {
+      break;
     }
   }
   position_ += cb;
@@ -84,10 +84,19 @@ bool ZlibDeflateWrapper::Initialize() {
   initialized_ = true;
   return true;
 }
+bool ZlibDeflateWrapper::Reset() {
+  if ( !initialized_ ) {
+    return Initialize();
+  }
+  if ( Z_OK != deflateReset(&strm_) ) {
+    return Initialize();
+  }
+  return true;
+}
 
 bool ZlibDeflateWrapper::Deflate(const char* in, size_t in_size,
                                  io::MemoryStream* out) {
-  if ( !initialized_ && !Initialize() ) {
+  if ( !Reset() ) {
     return false;
   }
   size_t out_size = 0;
@@ -152,7 +161,8 @@ bool ZlibDeflateWrapper::DeflateSize(io::MemoryStream* in,
       deflate(&strm_, Z_FINISH);
       out->ConfirmScratch(out_size - strm_.avail_out);
     } while ( out_size > strm_.avail_out );
-    Clear();
+    // Ready for the next one (w/o reallocating the zlib state)
+    Reset();
   }
   return true;
 }
@@ -67,7 +67,11 @@ class ZlibDeflateWrapper : public Compressor {
  public:
   explicit ZlibDeflateWrapper(int compress_level = Z_DEFAULT_COMPRESSION);
   virtual ~ZlibDeflateWrapper();
+  // Releases the zlib stream (it is allocated again on the next use).
   void Clear();
+  // Drops any compression in progress. Unlike Clear, keeps the zlib
+  // stream (w/ its buffers) for the next compression.
+  bool Reset();
   // Compresses *at most* *size bytes from in and writes the result to out.
   // Updates *size to reflect the leftover bytes (*size -= in->Size())
   // If we are able to extract *size bytes from in we also flush the
@@ -79,7 +83,9 @@ class ZlibDeflateWrapper : public Compressor {
   // Compresses the entire content of in and appends it to out.
   // Returns true on success and false on some error.
   bool Deflate(io::MemoryStream* in, io::MemoryStream* out) {
-    Clear();   // just in case..
+    if ( !Reset() ) {   // just in case..
+      return false;
+    }
     size_t size = in->Size();
     return DeflateSize(in, out, &size);
   }
@@ -29,7 +29,9 @@
 //
 // Author: Cosmin Tudorache
 
+#include <atomic>
 #include "whisperlib/net/alarm.h"
+#include "whisperlib/sync/mutex.h"
 
 // Disabled - most of the time.. :)
 #define LOG_ALARM if(0) LOG_WARNING
@@ -37,9 +39,83 @@
 namespace whisper {
 namespace util {
 
+// Reference counted by the Alarm and by each timer operation posted to the
+// selector. The timer is used only in the selector thread (or while the
+// selector does not loop), and so is the state deleted.
+class Alarm::TimerState {
+ public:
+  TimerState(Alarm* alarm, net::Selector* selector)
+    : alarm_(alarm),
+      selector_(selector),
+      fire_callback_(NewPermanentCallback(this, &TimerState::Fire)),
+      timer_(fire_callback_),
+      ref_count_(1) {
+  }
+  // Schedules the timer after timeout ms (start), or cancels it - now if
+  // we can, else in the selector thread
+  void Update(bool start, int64 timeout) {
+    if ( selector_->IsLooping() && !selector_->IsInSelectThread() ) {
+      ++ref_count_;
+      selector_->RunInSelectLoop(
+          NewCallback(this, &TimerState::UpdateAndRelease, start, timeout));
+    } else {
+      UpdateTimer(start, timeout);
+    }
+  }
+  // Called by the alarm on destruction
+  void Detach() {
+    {
+      // Fire may run right now, in the selector thread
+      synch::MutexLocker l(&mutex_);
+      alarm_ = NULL;
+    }
+    Update(false, 0);
+    Release();
+  }
+
+ private:
+  ~TimerState() {
+    delete fire_callback_;
+  }
+  void UpdateTimer(bool start, int64 timeout) {
+    if ( start ) {
+      selector_->RegisterTimer(&timer_, timeout);
+    } else {
+      selector_->UnregisterTimer(&timer_);
+    }
+  }
+  void UpdateAndRelease(bool start, int64 timeout) {
+    UpdateTimer(start, timeout);
+    Release();
+  }
+  void Release() {
+    if ( --ref_count_ == 0 ) {
+      delete this;
+    }
+  }
+  void Fire() {
+    synch::MutexLocker l(&mutex_);
+    if ( alarm_ != NULL ) {
+      alarm_->Fire();
+    }
+  }
+
+  // NULL after the alarm is gone (protected by mutex_ - set by the alarm
+  // and read in the selector thread)
+  Alarm* alarm_;
+  net::Selector* const selector_;
+  // permanent callback to Fire
+  Closure* const fire_callback_;
+  net::TimerWheel::Timer timer_;
+  std::atomic<int> ref_count_;
+  synch::Mutex mutex_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TimerState);
+};
+
 Alarm::Alarm(net::Selector & selector)
   : selector_(selector),
-    fire_callback_(NewPermanentCallback(this, &Alarm::Fire)),
+    state_(new TimerState(this, &selector)),
     alarm_(NULL),
     auto_delete_(false),
     timeout_(0),
@@ -51,8 +127,7 @@ Alarm::Alarm(net::Selector & selector)
 Alarm::~Alarm() {
   CHECK(!firing_) << "Do NOT delete the alarm from notification callback!";
   Clear();
-  delete fire_callback_;
-  fire_callback_ = NULL;
+  state_->Detach();
 }
 
 void Alarm::Set(Closure * closure, bool auto_delete, int64 timeout,
@@ -103,16 +178,14 @@ void Alarm::Stop() {
     // nothing to stop
     return;
   }
-  selector_.RunInSelectLoop(
-      NewCallback(&selector_, &net::Selector::UnregisterAlarm, fire_callback_));
+  state_->Update(false, 0);
   last_start_ts_ = -1;
   LOG_ALARM << "Stop Alarm: " << alarm_;
 }
 void Alarm::Start() {
   LOG_ALARM << "Start Alarm: " << alarm_;
   CHECK(IsSet());
-  selector_.RunInSelectLoop(NewCallback(&selector_, &net::Selector::RegisterAlarm,
-                                        fire_callback_, timeout_));
+  state_->Update(true, timeout_);
   last_start_ts_ = selector_.now();
 }
 
@@ -121,6 +194,9 @@ void Alarm::Fire() {
   last_fire_ts_ = selector_.now();
   last_start_ts_ = -1;
   Closure * alarm = alarm_;
+  if ( alarm == NULL ) {
+    return;   // cleared from another thread, w/ the stop still pending
+  }
 
   firing_ = true;
   alarm->Run();
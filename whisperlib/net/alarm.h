@@ -80,6 +80,9 @@ public:
   void Clear();
 
   // Stop the alarm. During stop the alarm won't fire.
+  // Stop and Start can be called from any thread: from a thread other
+  // than the one of the selector they are performed later, in the
+  // selector thread (the alarm can be deleted meanwhile).
   void Stop();
   // Start or restart the alarm. The alarm will fire after timeout_ ms from now.
   // If repeat == true, the alarm will repeat.
@@ -92,8 +95,11 @@ private:
 private:
   net::Selector & selector_;
 
-  // permanent callback to Fire
-  Closure * fire_callback_;
+  // Our selector timer, which calls Fire. It lives outside of us, w/ the
+  // timer operations still pending in the selector, so we can be deleted
+  // from any thread w/o waiting for them.
+  class TimerState;
+  TimerState* const state_;
 
   Closure * alarm_;
   bool auto_delete_;
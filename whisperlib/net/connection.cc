@@ -42,6 +42,9 @@
 #ifdef LINUX_ERQUEUE_H
 #include <linux/errqueue.h>
 #endif
+#if defined(__linux__)
+#include <linux/filter.h>
+#endif
 
 #include "whisperlib/base/core_errno.h"
 #include "whisperlib/base/log.h"
@@ -204,7 +207,9 @@ TcpAcceptor::TcpAcceptor(Selector* selector,
   : NetAcceptor(tcp_params),
     Selectable(selector),
     tcp_params_(tcp_params),
-    fd_(INVALID_FD_VALUE) {
+    fd_(INVALID_FD_VALUE),
+    reuse_port_(false),
+    cpu_steering_(false) {
 }
 TcpAcceptor::~TcpAcceptor() {
   InternalClose(0);
@@ -251,6 +256,11 @@ bool TcpAcceptor::Listen(const HostPort& local_addr) {
     fd_ = INVALID_FD_VALUE;
     return false;
   }
+  // The steering program is per reuse group - we can attach it only
+  // after bind. Failing here is not fatal: the kernel hashes connections.
+  if ( cpu_steering_ && !AttachCpuSteering() ) {
+    ECONNLOG << "Cannot attach the cpu steering program, fd: " << fd_;
+  }
 
   // listen on socket
   if ( ::listen(fd_, tcp_params_.backlog_) ) {
@@ -338,9 +348,56 @@ bool TcpAcceptor::SetSocketOptions() {
     return false;
   }
 #endif
+  if ( reuse_port_ && !SetReusePortOptions() ) {
+    return false;
+  }
+
+  return true;
+}
 
+bool TcpAcceptor::SetReusePortOptions() {
+#if defined(SO_REUSEPORT)
+  // Multiple sockets (one per selector thread) bind the same address,
+  // and the kernel distributes the incoming connections among them.
+  const int true_flag = 1;
+  if ( setsockopt(fd_, SOL_SOCKET, SO_REUSEPORT,
+                  reinterpret_cast<const char *>(&true_flag),
+                  sizeof(true_flag)) < 0 ) {
+    ECONNLOG << "::setsockopt SO_REUSEPORT failed for fd_=" << fd_
+             << " err: " << GetLastSystemErrorDescription();
+    return false;
+  }
+  return true;
+#else
+  ECONNLOG << "SO_REUSEPORT not supported on this platform";
+  return false;
+#endif
+}
 
+bool TcpAcceptor::AttachCpuSteering() {
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  // A classic BPF program that returns the cpu processing the incoming
+  // SYN, which is used as index in the reuse port group. With the
+  // acceptors bound in cpu order this keeps a connection on the cpu
+  // that received it. An out of range index falls back to hashing.
+  struct sock_filter code[] = {
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0,
+      static_cast<uint32>(SKF_AD_OFF + SKF_AD_CPU) },
+    { BPF_RET | BPF_A, 0, 0, 0 },
+  };
+  struct sock_fprog prog;
+  prog.len = NUMBEROF(code);
+  prog.filter = code;
+  if ( setsockopt(fd_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+                  &prog, sizeof(prog)) < 0 ) {
+    ECONNLOG << "::setsockopt SO_ATTACH_REUSEPORT_CBPF failed for fd_="
+             << fd_ << " err: " << GetLastSystemErrorDescription();
+    return false;
+  }
   return true;
+#else
+  return false;
+#endif
 }
 
 int TcpAcceptor::ExtractSocketErrno() {
@@ -500,6 +557,117 @@ bool TcpAcceptor::HandleErrorEvent(const SelectorEventData& event) {
 //////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////
 
+TcpShardedAcceptor::TcpShardedAcceptor(Selector* selector,
+                                       SelectorPool* pool,
+                                       const TcpAcceptorParams& tcp_params)
+  : NetAcceptor(tcp_params),
+    selector_(selector),
+    pool_(pool),
+    tcp_params_(tcp_params) {
+  CHECK_GT(pool_->size(), 0);
+#if defined(SO_REUSEPORT)
+  const bool reuse_port = tcp_params_.reuse_port_;
+#else
+  const bool reuse_port = false;
+#endif
+  if ( reuse_port ) {
+    // Accepted connections stay in the thread that accepted them
+    TcpAcceptorParams params(tcp_params_.tcp_connection_params_,
+                             tcp_params_.backlog_);
+    for ( size_t i = 0; i < pool_->size(); ++i ) {
+      acceptors_.push_back(new TcpAcceptor(pool_->selector(i), params));
+      acceptors_.back()->set_reuse_port(true, tcp_params_.cpu_steering_);
+      selectors_.push_back(pool_->selector(i));
+    }
+  } else {
+    if ( tcp_params_.client_threads() == NULL ) {
+      tcp_params_.set_client_threads(pool_->threads());
+      tcp_params_.set_least_loaded(true);
+    }
+    acceptors_.push_back(new TcpAcceptor(selector_, tcp_params_));
+    selectors_.push_back(selector_);
+  }
+  for ( size_t i = 0; i < acceptors_.size(); ++i ) {
+    acceptors_[i]->SetFilterHandler(NewPermanentCallback(
+        this, &TcpShardedAcceptor::TcpAcceptorFilterHandler), true);
+    acceptors_[i]->SetAcceptHandler(NewPermanentCallback(
+        this, &TcpShardedAcceptor::TcpAcceptorAcceptHandler), true);
+  }
+}
+
+TcpShardedAcceptor::~TcpShardedAcceptor() {
+  Close();
+  for ( size_t i = 0; i < acceptors_.size(); ++i ) {
+    delete acceptors_[i];
+  }
+  acceptors_.clear();
+}
+
+bool TcpShardedAcceptor::Listen(const HostPort& local_addr) {
+  CHECK(state() == DISCONNECTED) << "Attempting Listen on listening socket";
+  CHECK(pool_->is_running()) << "The selector pool must be started";
+  HostPort addr(local_addr);
+  for ( size_t i = 0; i < acceptors_.size(); ++i ) {
+    bool success = false;
+    SelectorPool::RunInSelectLoopAndWait(selectors_[i],
+        NewCallback(this, &TcpShardedAcceptor::ListenAcceptor,
+                    acceptors_[i], addr, &success));
+    if ( !success ) {
+      ECONNLOG << "Listen failed for acceptor: " << i;
+      Close();
+      return false;
+    }
+    if ( i == 0 ) {
+      // In case of port 0, all acceptors must use the one chosen by system
+      set_local_address(acceptors_[0]->local_address());
+      addr = HostPort(local_addr.ip_object(), local_address().port());
+    }
+  }
+  set_state(LISTENING);
+  AICONNLOG << "Listening on " << acceptors_.size() << " socket(s)";
+  return true;
+}
+
+void TcpShardedAcceptor::Close() {
+  // If the pool is stopped already (usual on shutdown), the acceptors are
+  // closed right here (see RunInSelectLoopAndWait).
+  for ( size_t i = 0; i < acceptors_.size(); ++i ) {
+    if ( acceptors_[i]->state() != DISCONNECTED ) {
+      SelectorPool::RunInSelectLoopAndWait(selectors_[i],
+          NewCallback(this, &TcpShardedAcceptor::CloseAcceptor,
+                      acceptors_[i]));
+    }
+  }
+  set_state(DISCONNECTED);
+}
+
+std::string TcpShardedAcceptor::PrefixInfo() const {
+  std::ostringstream oss;
+  oss << StateName() << " : [" << local_address()
+      << " (sockets: " << acceptors_.size() << ")] ";
+  return oss.str();
+}
+
+bool TcpShardedAcceptor::TcpAcceptorFilterHandler(const HostPort& peer_addr) {
+  return InvokeFilterHandler(peer_addr);
+}
+void TcpShardedAcceptor::TcpAcceptorAcceptHandler(NetConnection* connection) {
+  InvokeAcceptHandler(connection);
+}
+
+void TcpShardedAcceptor::ListenAcceptor(TcpAcceptor* acceptor,
+                                        HostPort local_addr,
+                                        bool* success) {
+  *success = acceptor->Listen(local_addr);
+}
+void TcpShardedAcceptor::CloseAcceptor(TcpAcceptor* acceptor) {
+  acceptor->Close();
+}
+
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+//////////////////////////////////////////////////////////////////////
+
 TcpConnection::TcpConnection(Selector* selector,
                              const TcpConnectionParams& tcp_params)
     : NetConnection(selector, tcp_params),
@@ -745,7 +913,9 @@ bool TcpConnection::HandleReadEvent(const SelectorEventData& event) {
         state() == FLUSHING) << "Illegal state: " << StateName();
 
   // Read from network into inbuf_
-  const ssize_t cb = Selectable::Read(inbuf(), tcp_params_.read_limit_);
+  const ssize_t cb = tcp_params_.shared_read_buffer_
+                     ? Selectable::ReadShared(inbuf(), tcp_params_.read_limit_)
+                     : Selectable::Read(inbuf(), tcp_params_.read_limit_);
   if ( cb < 0 ) {
     const int err = ExtractSocketErrno();
     ECONNLOG << "Closing connection because Read failed: "
@@ -770,6 +940,11 @@ bool TcpConnection::HandleReadEvent(const SelectorEventData& event) {
     D10CONNLOG << "HandleReadEvent: after read_handler_"
                << " #" << inbuf()->Size() << " bytes still remaining in inbuf_"
                << " / " << tcp_params_.read_limit_;
+    if ( tcp_params_.shared_read_buffer_ &&
+         inbuf()->IsEmpty() && !inbuf()->MarkerIsSet() ) {
+      // release the slice of the shared buffer that we still hold
+      inbuf()->Clear();
+    }
   }
 
   if ( cb == 0 ) {
@@ -895,11 +1070,29 @@ bool TcpConnection::HandleErrorEvent(const SelectorEventData& event) {
   if ( (events & POLLERR) == POLLERR )
 #endif
   {
-    const int err = ExtractSocketErrno();
-    ECONNLOG << " HandleErrorEvent err=" << err
-             << " - " << GetSystemErrorDescription(err);
-    InternalClose(err, true);
-    return false;
+    // The completions of MSG_ZEROCOPY sends come as socket errors
+    int err = 0;
+    if ( tcp_params_.zerocopy_min_size_ > 0 &&
+         !ProcessZeroCopyCompletions() ) {
+      err = GetLastSystemError();
+    }
+    if ( err == 0 ) {
+      err = ExtractSocketErrno();
+    }
+    if ( err != 0 || tcp_params_.zerocopy_min_size_ <= 0 ) {
+      ECONNLOG << " HandleErrorEvent err=" << err
+               << " - " << GetSystemErrorDescription(err);
+      InternalClose(err, true);
+      return false;
+    }
+#if defined(HAVE_SYS_EPOLL_H)
+    if ( (events & (EPOLLHUP | EPOLLRDHUP)) == 0 )
+#else
+    if ( (events & (POLLHUP | POLLRDHUP)) == 0 )
+#endif
+    {
+      return true;
+    }
   }
 
   // IMPORTANT:
@@ -1033,6 +1226,12 @@ bool TcpConnection::SetSocketOptions() {
     return false;
   }
 #endif
+  if ( tcp_params_.zerocopy_min_size_ > 0 &&
+       !EnableZeroCopy(tcp_params_.zerocopy_min_size_) ) {
+    // Not fatal - we just copy
+    WCONNLOG << "MSG_ZEROCOPY not available for fd=" << fd_
+             << " err: " << GetLastSystemErrorDescription();
+  }
 
   return true;
 }
@@ -1082,7 +1281,7 @@ void TcpConnection::InternalClose(int err, bool call_close_handler) {
     selector_->Unregister(this);
     ::shutdown(fd_, SHUT_RDWR);
     DCONNLOG << "Performing the ::close... ";
-    if ( ::close(fd_) < 0 ) {
+    if ( !DrainZeroCopy(fd_) && ::close(fd_) < 0 ) {
       ECONNLOG << "Error closing fd: " << fd_ << " err: "
                << GetLastSystemErrorDescription();
     }
@@ -1207,6 +1406,24 @@ std::string SslAcceptor::PrefixInfo() const {
   return tcp_acceptor_.PrefixInfo() + " [SSL]: ";
 }
 
+namespace {
+// Picks the first of our protocols (in arg) that the client offers
+int SslAlpnSelectCallback(SSL* /*ssl*/, const unsigned char** out,
+                          unsigned char* outlen, const unsigned char* in,
+                          unsigned int inlen, void* arg) {
+  const std::string* const protocols = static_cast<const std::string*>(arg);
+  unsigned char* selected = NULL;
+  if ( SSL_select_next_proto(
+           &selected, outlen,
+           reinterpret_cast<const unsigned char*>(protocols->data()),
+           protocols->size(), in, inlen) != OPENSSL_NPN_NEGOTIATED ) {
+    return SSL_TLSEXT_ERR_NOACK;
+  }
+  *out = selected;
+  return SSL_TLSEXT_ERR_OK;
+}
+}  // namespace
+
 // TODO(cosmin): test, remove
 bool SslAcceptor::SslInitialize() {
   if ( params_.ssl_connection_params_.ssl_context_ == NULL ) {
@@ -1218,10 +1435,22 @@ bool SslAcceptor::SslInitialize() {
     ECONNLOG << "SslAcceptor needs an SSL certificate & key";
     //return false;
   }
+  if ( !params_.ssl_connection_params_.alpn_protocols_.empty() ) {
+    SSL_CTX_set_alpn_select_cb(
+        params_.ssl_connection_params_.ssl_context_, SslAlpnSelectCallback,
+        const_cast<std::string*>(
+            &params_.ssl_connection_params_.alpn_protocols_));
+  }
 
   return true;
 }
 void SslAcceptor::SslClear() {
+  // The context may outlive us - and our protocols
+  if ( params_.ssl_connection_params_.ssl_context_ != NULL &&
+       !params_.ssl_connection_params_.alpn_protocols_.empty() ) {
+    SSL_CTX_set_alpn_select_cb(params_.ssl_connection_params_.ssl_context_,
+                               NULL, NULL);
+  }
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -1336,6 +1565,18 @@ std::string SslConnection::PrefixInfo() const {
   return tcp_connection_->PrefixInfo() +
          "[SSL: " + StateName() + "]: ";
 }
+std::string SslConnection::application_protocol() const {
+  if ( p_ssl_ == NULL ) {
+    return "";
+  }
+  const unsigned char* data = NULL;
+  unsigned int size = 0;
+  SSL_get0_alpn_selected(p_ssl_, &data, &size);
+  if ( data == NULL ) {
+    return "";
+  }
+  return std::string(reinterpret_cast<const char*>(data), size);
+}
 
 
 bool SslConnection::HandleReadEvent(const SelectorEventData& event) {
@@ -1866,6 +2107,13 @@ bool SslConnection::SslInitialize(bool is_server) {
     SSL_set_accept_state(p_ssl_);
   } else {
     SSL_set_connect_state(p_ssl_);
+    const std::string& protocols = ssl_params_.alpn_protocols_;
+    if ( !protocols.empty() &&
+         SSL_set_alpn_protos(
+             p_ssl_, reinterpret_cast<const unsigned char*>(protocols.data()),
+             protocols.size()) != 0 ) {
+      ECONNLOG << "SSL_set_alpn_protos failed: " << SslLastError();
+    }
   }
   return true;
 }
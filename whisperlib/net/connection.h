@@ -94,31 +94,55 @@ struct NetConnectionParams {
 struct NetAcceptorParams {
   NetAcceptorParams()
       : next_client_thread_(0),
-        client_threads_(NULL) {
+        client_threads_(NULL),
+        least_loaded_(false) {
   }
   NetAcceptorParams(const NetAcceptorParams& params)
       : next_client_thread_(0),
-        client_threads_(params.client_threads_) {
+        client_threads_(params.client_threads_),
+        least_loaded_(params.least_loaded_) {
   }
   void set_client_threads(const std::vector<SelectorThread*>* client_threads) {
     CHECK(client_threads_ == NULL);
     client_threads_ = client_threads;
   }
+  const std::vector<SelectorThread*>* client_threads() const {
+    return client_threads_;
+  }
+  // If set, accepted connections are handed to the client thread with
+  // the fewest registered connections, instead of round-robin.
+  void set_least_loaded(bool least_loaded) {
+    least_loaded_ = least_loaded;
+  }
+  bool least_loaded() const {
+    return least_loaded_;
+  }
   Selector* GetNextSelector() {
-    if ( client_threads_ == NULL ) {
+    if ( client_threads_ == NULL || client_threads_->empty() ) {
       return NULL;
     }
     if ( next_client_thread_ >= client_threads_->size() ) {
       next_client_thread_ = 0;
     }
-    Selector* const chosen =
+    Selector* chosen =
         (*client_threads_)[next_client_thread_]->mutable_selector();
+    if ( least_loaded_ ) {
+      // Start from the round-robin position, so ties are spread around
+      for ( size_t i = 1; i < client_threads_->size(); ++i ) {
+        Selector* const crt = (*client_threads_)[
+            (next_client_thread_ + i) % client_threads_->size()]->mutable_selector();
+        if ( crt->num_registered() < chosen->num_registered() ) {
+          chosen = crt;
+        }
+      }
+    }
     next_client_thread_++;
     return chosen;
   }
  private:
   size_t next_client_thread_;
   const std::vector<SelectorThread*>* client_threads_;
+  bool least_loaded_;
 };
 
 ////////////////////////////////////////////////////////////////////////////
@@ -202,6 +226,17 @@ class NetAcceptor {
   void SetFilterHandler(FilterHandler* filter_handler, bool own);
   void DetachFilterHandler();
   void SetAcceptHandler(AcceptHandler* accept_handler, bool own);
+  // Same as above, for lambdas or other callables (we own them)
+  void SetFilterHandler(
+      InlineCallback<bool(const whisper::net::HostPort&)> filter_handler) {
+    SetFilterHandler(NewPermanentInlineCallback(std::move(filter_handler)),
+                     true);
+  }
+  void SetAcceptHandler(
+      InlineCallback<void(NetConnection*)> accept_handler) {
+    SetAcceptHandler(NewPermanentInlineCallback(std::move(accept_handler)),
+                     true);
+  }
   void DetachAcceptHandler();
   void DetachAllHandlers();
 
@@ -312,6 +347,11 @@ class NetConnection {
   // yields a log line like:
   //  "CONNECTED : [12.34.56.78:5665 -> 87.65.43.21:6556 (fd: 7)] foo"
   virtual std::string PrefixInfo() const = 0;
+  // The application protocol agreed w/ the peer when connecting (e.g. by
+  // TLS ALPN: "h2", "http/1.1"), empty if none.
+  virtual std::string application_protocol() const {
+    return "";
+  }
 
 
   typedef Closure ConnectHandler;
@@ -330,6 +370,22 @@ class NetConnection {
   void SetWriteHandler(WriteHandler* write_handler, bool own);
   void DetachWriteHandler();
   void SetCloseHandler(CloseHandler* close_handler, bool own);
+  // Same as above, for lambdas or other callables (we own them)
+  void SetConnectHandler(InlineCallback<void()> connect_handler) {
+    SetConnectHandler(NewPermanentInlineCallback(std::move(connect_handler)),
+                      true);
+  }
+  void SetReadHandler(InlineCallback<bool()> read_handler) {
+    SetReadHandler(NewPermanentInlineCallback(std::move(read_handler)), true);
+  }
+  void SetWriteHandler(InlineCallback<bool()> write_handler) {
+    SetWriteHandler(NewPermanentInlineCallback(std::move(write_handler)),
+                    true);
+  }
+  void SetCloseHandler(InlineCallback<void(int, CloseWhat)> close_handler) {
+    SetCloseHandler(NewPermanentInlineCallback(std::move(close_handler)),
+                    true);
+  }
   void DetachCloseHandler();
   void DetachAllHandlers();
 
@@ -426,13 +482,17 @@ struct TcpConnectionParams : public NetConnectionParams {
                       int recv_buffer_size = -1,
                       int64 shutdown_linger_timeout_ms = 5000,
                       int read_limit = -1,
-                      int write_limit = -1)
+                      int write_limit = -1,
+                      int zerocopy_min_size = 0,
+                      bool shared_read_buffer = false)
     : NetConnectionParams(block_size),
       send_buffer_size_(send_buffer_size),
       recv_buffer_size_(recv_buffer_size),
       shutdown_linger_timeout_ms_(shutdown_linger_timeout_ms),
       read_limit_(read_limit),
-      write_limit_(write_limit) {
+      write_limit_(write_limit),
+      zerocopy_min_size_(zerocopy_min_size),
+      shared_read_buffer_(shared_read_buffer) {
   }
   int send_buffer_size_; // if -1 the system default is used
   int recv_buffer_size_; // if -1 the system default is used
@@ -442,21 +502,44 @@ struct TcpConnectionParams : public NetConnectionParams {
   int read_limit_;
   // Buffered write operations are limited to this size
   int write_limit_;
+  // External blocks (MemoryStream::AppendRaw) of at least this size are
+  // sent w/ MSG_ZEROCOPY (0 - never). Pays off only for large blocks
+  // going to real network interfaces (loopback copies anyway).
+  int zerocopy_min_size_;
+  // If set, we read in the buffer ring of our selector (shared w/ the
+  // other connections), and the input buffer holds no memory when
+  // the application consumed all the data. Use for many mostly idle
+  // connections.
+  bool shared_read_buffer_;
 };
 
 struct TcpAcceptorParams : public NetAcceptorParams {
   TcpAcceptorParams(
       // insert NetAcceptorParams here, with default values
       const TcpConnectionParams& tcp_connection_params = TcpConnectionParams(),
-      int backlog = 100)
+      int backlog = 100,
+      bool reuse_port = true,
+      bool cpu_steering = false)
         : NetAcceptorParams(),
           tcp_connection_params_(tcp_connection_params),
-          backlog_(backlog) {
+          backlog_(backlog),
+          reuse_port_(reuse_port),
+          cpu_steering_(cpu_steering) {
   }
   // parameter for spawned connections
   TcpConnectionParams tcp_connection_params_;
   int backlog_;
 
+  // These apply to acceptors created over a SelectorPool
+  // (see TcpShardedAcceptor):
+  // If set, each thread in the pool listens on its own SO_REUSEPORT
+  // socket, else a single socket accepts and hands over the connections
+  // to the least loaded thread.
+  bool reuse_port_;
+  // If set (linux only), the kernel steers a new connection to the socket
+  // of the thread running on the cpu that received it. Makes sense only
+  // with a pool pinned to cpus, with one thread per cpu.
+  bool cpu_steering_;
 };
 
 /////////////////////////////////////////////////////////////////////////////
@@ -494,6 +577,13 @@ class TcpAcceptor : public NetAcceptor, private Selectable {
   // Initializes a new connection in the provided selector
   void InitializeAcceptedConnection(Selector* selector, int client_fd);
 
+  // TcpShardedAcceptor turns on SO_REUSEPORT for its acceptors
+  void set_reuse_port(bool reuse_port, bool cpu_steering) {
+    reuse_port_ = reuse_port;
+    cpu_steering_ = cpu_steering;
+  }
+  friend class TcpShardedAcceptor;
+
   // read local_address from socket
   void InitializeLocalAddress();
 
@@ -501,6 +591,10 @@ class TcpAcceptor : public NetAcceptor, private Selectable {
   //  non-blocking, fast bind reusing
   bool SetSocketOptions();
 
+  // Sets SO_REUSEPORT on the socket, and optionally the cpu steering program.
+  bool SetReusePortOptions();
+  bool AttachCpuSteering();
+
   // returns the errno associated with local fd_
   int ExtractSocketErrno();
 
@@ -512,6 +606,55 @@ class TcpAcceptor : public NetAcceptor, private Selectable {
 
   // The fd of the socket
   int fd_;
+
+  // Listen on a SO_REUSEPORT socket (maybe w/ cpu steering)
+  bool reuse_port_;
+  bool cpu_steering_;
+};
+
+// TcpShardedAcceptor
+// ------------------
+// Accepts connections for all the threads of a SelectorPool.
+// Where SO_REUSEPORT is available (and tcp_params.reuse_port_ is set) every
+// thread listens on its own socket bound to the same address, and the
+// connections accepted there stay on that thread. Otherwise one socket,
+// registered with the main selector, accepts and hands over connections to
+// the least loaded thread of the pool.
+// The filter and accept handlers are called in the threads of the pool.
+// Listen and Close wait for the pool threads, so the pool must be running.
+class TcpShardedAcceptor : public NetAcceptor {
+ public:
+  TcpShardedAcceptor(Selector* selector,
+                     SelectorPool* pool,
+                     const TcpAcceptorParams& tcp_params = TcpAcceptorParams());
+  virtual ~TcpShardedAcceptor();
+
+  virtual bool Listen(const HostPort& local_addr);
+  virtual void Close();
+  virtual std::string PrefixInfo() const;
+
+  // Number of listening sockets
+  size_t num_acceptors() const {
+    return acceptors_.size();
+  }
+
+ private:
+  bool TcpAcceptorFilterHandler(const HostPort& peer_addr);
+  void TcpAcceptorAcceptHandler(NetConnection* connection);
+
+  void ListenAcceptor(TcpAcceptor* acceptor, HostPort local_addr,
+                      bool* success);
+  void CloseAcceptor(TcpAcceptor* acceptor);
+
+ private:
+  Selector* const selector_;
+  SelectorPool* const pool_;
+  TcpAcceptorParams tcp_params_;
+  // The listening acceptors, and the selectors they run in
+  std::vector<TcpAcceptor*> acceptors_;
+  std::vector<Selector*> selectors_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TcpShardedAcceptor);
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -670,6 +813,10 @@ struct SslConnectionParams : public NetConnectionParams {
           write_limit_(write_limit) {
   }
   SSL_CTX* ssl_context_;
+  // The application protocols we speak (for ALPN), in order of preference,
+  // in the wire format: length prefixed names (e.g. "\x02h2\x08http/1.1").
+  // A server picks the first of these that the client offers.
+  std::string alpn_protocols_;
   // Buffered read operations are limited to this size
   int read_limit_;
   // Buffered write operations are limited to this size
@@ -758,6 +905,7 @@ class SslConnection : public NetConnection {
   virtual const HostPort& local_address() const;
   virtual const HostPort& remote_address() const;
   virtual std::string PrefixInfo() const;
+  virtual std::string application_protocol() const;
   //////////////////////////////////////////////////////////////////////
 
   //////////////////////////////////////////////////////////////////////
@@ -887,6 +1035,7 @@ class NetFactory {
 public:
   NetFactory(net::Selector* selector)
     : selector_(selector),
+      selector_pool_(NULL),
       tcp_acceptor_params_(),
       tcp_connection_params_()
 #if defined(USE_OPENSSL)
@@ -907,6 +1056,14 @@ public:
   void SetTcpConnectionParams(const TcpConnectionParams& params) {
     tcp_connection_params_ = params;
   }
+  // If set, the tcp acceptors we create serve their connections in the
+  // threads of this pool (see TcpShardedAcceptor). We do not own the pool.
+  void set_selector_pool(SelectorPool* selector_pool) {
+    selector_pool_ = selector_pool;
+  }
+  SelectorPool* selector_pool() const {
+    return selector_pool_;
+  }
 
 #if defined(USE_OPENSSL)
   void SetSslParams(const SslAcceptorParams&
@@ -936,6 +1093,10 @@ public:
   NetAcceptor* CreateAcceptor(PROTOCOL protocol) const {
     switch(protocol) {
       case PROTOCOL_TCP:
+        if ( selector_pool_ != NULL ) {
+          return new TcpShardedAcceptor(selector_, selector_pool_,
+                                        tcp_acceptor_params_);
+        }
         return new TcpAcceptor(selector_, tcp_acceptor_params_);
 #if defined(USE_OPENSSL)
       case PROTOCOL_SSL:
@@ -969,6 +1130,7 @@ public:
 
 private:
   whisper::net::Selector* const selector_;
+  SelectorPool* selector_pool_;
 
   TcpAcceptorParams tcp_acceptor_params_;
   TcpConnectionParams tcp_connection_params_;
@@ -34,6 +34,7 @@
 
 #include <unistd.h>
 #include <fcntl.h>
+#include <string.h>
 
 #if defined(HAVE_SYS_UIO_H)
 #include <sys/uio.h>
@@ -45,21 +46,37 @@
 #endif
 
 #include <sys/socket.h>
+#if defined(HAVE_SYS_SENDFILE_H)
+#include <sys/sendfile.h>
+#endif
+#if defined(HAVE_LINUX_ERRQUEUE_H)
+#include <linux/errqueue.h>
+#endif
 #include "whisperlib/base/core_errno.h"
 #include "whisperlib/base/gflags.h"
+#include "whisperlib/io/buffer/buffer_ring.h"
 
 
 #if defined(HAVE_SYS_UIO_H)
 #define __USE_WRITEV__
 #endif
 
+#if defined(HAVE_LINUX_ERRQUEUE_H) && defined(SO_ZEROCOPY) && \
+    defined(MSG_ZEROCOPY)
+#define __USE_ZEROCOPY__
+#endif
+
 #ifdef  __USE_WRITEV__
 
 //////////////////////////////////////////////////////////////////////
 
 DEFINE_int32(default_read_for_writev_size, 16384,
              "You can tune this in order to get some "
-             "better network performance");
+             "better network performance (this is the initial and the "
+             "minimum size of a writev batch)");
+DEFINE_int32(max_writev_batch_size, 1 << 20,
+             "We grow the writev batches of a connection up to this size, "
+             "as long as its socket takes all we write");
 
 #endif
 
@@ -82,6 +99,206 @@ ssize_t Selectable::Write(const char* buf, size_t size) {
 
 //////////////////////////////////////////////////////////////////////
 
+ssize_t Selectable::WriteFileRegion(int fd, io::DataBlock* block,
+                                    io::BlockSize pos, size_t size) {
+#if defined(HAVE_SYS_SENDFILE_H)
+  off_t offset = block->file_offset() + pos;
+  const ssize_t cb = ::sendfile(fd, block->file_fd(), &offset, size);
+  if ( cb == 0 && size > 0 ) {
+    // The file got shorter under the region - we cannot send it
+    LOG_ERROR << "sendfile: end of file in a file region, fd: "
+              << block->file_fd() << " offset: " << offset;
+    errno = EIO;
+    return -1;
+  }
+  if ( cb >= 0 || (errno != EINVAL && errno != ENOSYS) ) {
+    return cb;
+  }
+  // fd does not take sendfile - write the data (mapped in memory)
+#endif
+  return ::write(fd, block->buffer() + pos, size);
+}
+
+ssize_t Selectable::WriteZeroCopy(int fd, io::DataBlock* block,
+                                  io::BlockSize pos, size_t size) {
+#ifdef __USE_ZEROCOPY__
+  struct ::iovec iov;
+  iov.iov_base = const_cast<char*>(block->buffer() + pos);
+  iov.iov_len = size;
+  struct ::msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  const ssize_t cb = ::sendmsg(fd, &msg, MSG_ZEROCOPY);
+  if ( cb >= 0 ) {
+    block->IncRef();
+    zerocopy_pending_.push_back(std::make_pair(zerocopy_next_id_++, block));
+    return cb;
+  }
+  if ( errno != ENOBUFS ) {
+    return cb;
+  }
+  // Out of pinned memory for this socket - send this one normally
+#endif
+  return ::write(fd, block->buffer() + pos, size);
+}
+
+bool Selectable::EnableZeroCopy(size_t min_size) {
+#ifdef __USE_ZEROCOPY__
+  const int one = 1;
+  if ( min_size == 0 ||
+       setsockopt(GetFd(), SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) ) {
+    return false;
+  }
+  zerocopy_min_size_ = std::min(min_size, size_t(kMaxInt32));
+  return true;
+#else
+  errno = ENOSYS;
+  return false;
+#endif
+}
+
+namespace {
+
+#ifdef __USE_ZEROCOPY__
+// Reads the MSG_ZEROCOPY completions from the error queue of fd, and
+// releases the blocks of the completed sends from pending. Sets *copied
+// if the kernel copied the data anyway. Returns false on failure to read
+// the error queue (w/ errno set).
+bool ReadZeroCopyCompletions(int fd, Selectable::ZeroCopyList* pending,
+                             bool* copied) {
+  while ( !pending->empty() ) {
+    char control[128];
+    struct ::msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if ( ::recvmsg(fd, &msg, MSG_ERRQUEUE) < 0 ) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+    for ( struct ::cmsghdr* cm = CMSG_FIRSTHDR(&msg); cm != NULL;
+          cm = CMSG_NXTHDR(&msg, cm) ) {
+      const struct ::sock_extended_err* const err =
+          reinterpret_cast<const struct ::sock_extended_err*>(CMSG_DATA(cm));
+      if ( err->ee_errno != 0 ||
+           err->ee_origin != SO_EE_ORIGIN_ZEROCOPY ) {
+        continue;
+      }
+      if ( err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED ) {
+        *copied = true;
+      }
+      // Sends [ee_info, ee_data] are done (ids wrap around)
+      for ( Selectable::ZeroCopyList::iterator it = pending->begin();
+            it != pending->end(); ) {
+        if ( int32(it->first - err->ee_info) >= 0 &&
+             int32(err->ee_data - it->first) >= 0 ) {
+          it->second->DecRef();
+          it = pending->erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Keeps a closed socket (already shut down) open until the kernel reports
+// done the MSG_ZEROCOPY sends from its pending blocks, then closes it.
+// A shut down socket is always "in error" for the selector, so we poll
+// its error queue on an alarm. If the completions do not come (error, or
+// a peer that does not ack for too long) we leak the blocks rather than
+// let them be reused while the kernel may still read them.
+class ZeroCopyDrainer {
+ public:
+  ZeroCopyDrainer(Selector* selector, int fd,
+                  Selectable::ZeroCopyList* pending)
+      : selector_(selector),
+        fd_(fd),
+        start_ms_(selector->now()) {
+    pending_.swap(*pending);
+  }
+  void Start() {
+    selector_->RegisterAlarm(NewCallback(this, &ZeroCopyDrainer::Check),
+                             kCheckIntervalMs);
+  }
+
+ private:
+  ~ZeroCopyDrainer() {
+    ::close(fd_);
+  }
+  void Check() {
+    bool copied = false;
+    if ( !ReadZeroCopyCompletions(fd_, &pending_, &copied) ) {
+      LOG_ERROR << "Error reading the zerocopy completions of fd: " << fd_
+                << " - leaking " << pending_.size() << " blocks: "
+                << GetLastSystemErrorDescription();
+      delete this;
+      return;
+    }
+    if ( pending_.empty() ) {
+      delete this;
+      return;
+    }
+    if ( selector_->now() - start_ms_ > kMaxDrainMs ) {
+      LOG_ERROR << "No zerocopy completions for fd: " << fd_ << " in "
+                << kMaxDrainMs << " ms - leaking " << pending_.size()
+                << " blocks";
+      delete this;
+      return;
+    }
+    Start();
+  }
+
+  static const int64 kCheckIntervalMs = 100;
+  static const int64 kMaxDrainMs = 20 * 60 * 1000;
+
+  Selector* const selector_;
+  const int fd_;
+  const int64 start_ms_;
+  Selectable::ZeroCopyList pending_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(ZeroCopyDrainer);
+};
+#endif
+
+}  // namespace
+
+bool Selectable::ProcessZeroCopyCompletions() {
+#ifdef __USE_ZEROCOPY__
+  bool copied = false;
+  const bool success = ReadZeroCopyCompletions(GetFd(), &zerocopy_pending_,
+                                               &copied);
+  if ( copied ) {
+    // The kernel copied the data anyway (e.g. loopback) - we only pay
+    // for the notifications, so stop.
+    zerocopy_min_size_ = 0;
+  }
+  return success;
+#else
+  return true;
+#endif
+}
+
+bool Selectable::DrainZeroCopy(int fd) {
+#ifdef __USE_ZEROCOPY__
+  if ( zerocopy_pending_.empty() ) {
+    return false;
+  }
+  bool copied = false;
+  if ( ReadZeroCopyCompletions(fd, &zerocopy_pending_, &copied) &&
+       zerocopy_pending_.empty() ) {
+    return false;
+  }
+  (new ZeroCopyDrainer(selector_, fd, &zerocopy_pending_))->Start();
+  return true;
+#else
+  return false;
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////
+
 // Is unclear so far if (and what) advantage seems to add writev
 // to the overall performance..
 //
@@ -95,51 +312,62 @@ ssize_t Selectable::Write(const char* buf, size_t size) {
 #ifdef __USE_WRITEV__
 
 ssize_t Selectable::Write(io::MemoryStream* ms, ssize_t size) {
-  size_t scratch = 0;
   ssize_t cb = 0;
 #ifdef _DEBUG
   size_t initial_size = ms->Size();
 #endif
   const int fd = GetFd();
+  struct ::iovec iov[kMaxWritevIovecs];
+  if ( writev_batch_size_ == 0 ) {
+    writev_batch_size_ = FLAGS_default_read_for_writev_size;
+  }
 
   while ( !ms->IsEmpty() && (size < 0 || cb < size) ) {
-    ms->MarkerSet();
-    struct ::iovec* iov = NULL;
-    int iovcnt = 0;
-    const ssize_t buf_size = (size < 0)
-        ? FLAGS_default_read_for_writev_size
-        : std::min(size - cb, ssize_t(FLAGS_default_read_for_writev_size));
-    scratch = ms->ReadForWritev(&iov, &iovcnt, buf_size);
-    if ( iovcnt > 0 ) {
-      const ssize_t crt_cb = ::writev(fd, iov, iovcnt);
-      const int err = errno;
-      delete [] iov;
-      if ( crt_cb < 0 ) {
-        ms->MarkerRestore();
-        if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
-          // Not really an error for non-blocking sockets
+    const size_t max_size = (size < 0)
+        ? writev_batch_size_
+        : std::min(size_t(size - cb), writev_batch_size_);
+    io::BlockSize pos = 0;
+    io::DataBlock* const block = ms->PeekReadBlock(&pos);
+    CHECK(block != NULL) << " bugs: unempty MemoryStream is unreadable.";
+    size_t batch = std::min(size_t(block->size() - pos), max_size);
+    ssize_t crt_cb;
+    if ( block->is_file_region() ) {
+      crt_cb = WriteFileRegion(fd, block, pos, batch);
+    } else if ( zerocopy_min_size_ > 0 && block->is_external() &&
+                size_t(block->size() - pos) >= zerocopy_min_size_ ) {
+      crt_cb = WriteZeroCopy(fd, block, pos, batch);
+    } else {
+      int iovcnt = 0;
+      batch = ms->PeekForWritev(iov, NUMBEROF(iov), &iovcnt, max_size,
+                                io::BlockSize(zerocopy_min_size_));
+      if ( iovcnt <= 0 ) {
+        LOG_FATAL << "Dumb shit: " << batch << " -- " << ms->Size();
+      }
+      crt_cb = ::writev(fd, iov, iovcnt);
+    }
+    if ( crt_cb < 0 ) {
+      if ( errno == EAGAIN || errno == EWOULDBLOCK ) {
+        // Not really an error for non-blocking sockets
 #ifdef _DEBUG
-          DCHECK_EQ(initial_size, cb + ms->Size());
+        DCHECK_EQ(initial_size, cb + ms->Size());
 #endif
-          return cb;
-        }
-        return -1;
-      }
-      if ( size_t(crt_cb) < scratch ) {
-        // Written something but not all - we need to return and mark
-        // the right amount in the buffer
-        ms->MarkerRestore();
-        ms->Skip(crt_cb);
-      } else {
-        // Everything written - no need for the marker
-        ms->MarkerClear();
-      }
-      cb += crt_cb;
-      if ( size_t(crt_cb) < scratch || err != 0 ) {
-        break;   // EAGAIN || EWOULDBLOCK
+        return cb;
       }
-    } else {
-      LOG_FATAL << "Dumb shit: " << scratch << " -- " << ms->Size();
+      return -1;
+    }
+    ms->Skip(crt_cb);
+    cb += crt_cb;
+    if ( size_t(crt_cb) < batch ) {
+      // The socket send buffer is full - it took this much, so we expect
+      // it to take about as much next time.
+      writev_batch_size_ = std::max(size_t(crt_cb),
+                                    size_t(FLAGS_default_read_for_writev_size));
+      break;   // EAGAIN || EWOULDBLOCK
+    }
+    if ( batch == writev_batch_size_ ) {
+      // Everything taken - try larger batches
+      writev_batch_size_ = std::min(2 * writev_batch_size_,
+                                    size_t(FLAGS_max_writev_batch_size));
     }
   }
 #ifdef _DEBUG
@@ -223,5 +451,25 @@ ssize_t Selectable::Read(io::MemoryStream* ms, ssize_t size) {
   }
   return cb;
 }
+
+ssize_t Selectable::ReadShared(io::MemoryStream* ms, ssize_t size) {
+  io::BufferRing* const ring = selector_->read_ring();
+  char* buffer;
+  ssize_t cb = 0;
+  while ( (size < 0) || (cb < size) ) {
+    size_t space;
+    ring->GetSpace(&buffer, &space);
+    if ( size >= 0 && space > size_t(size - cb) ) {
+      space = size - cb;
+    }
+    const ssize_t received = Read(buffer, space);
+    if ( received <= 0 ) {
+      return cb;
+    }
+    cb += received;
+    ring->ConfirmSpace(received, ms);
+  }
+  return cb;
+}
 }  // namespace net
 }  // namespace whisper
@@ -32,6 +32,8 @@
 #ifndef __NET_BASE_SELECTABLE_H__
 #define __NET_BASE_SELECTABLE_H__
 
+#include <deque>
+#include <utility>
 #include "whisperlib/io/buffer/memory_stream.h"
 #include "whisperlib/net/selector.h"
 #include "whisperlib/net/selector_event_data.h"
@@ -43,16 +45,30 @@ class Selectable {
  public:
   Selectable()
       : selector_(NULL),
+        writev_batch_size_(0),
+        zerocopy_min_size_(0),
+        zerocopy_next_id_(0),
         desire_(Selector::kWantRead | Selector::kWantError) {
   }
   explicit Selectable(Selector* selector)
       : selector_(selector),
+        writev_batch_size_(0),
+        zerocopy_min_size_(0),
+        zerocopy_next_id_(0),
         desire_(Selector::kWantRead | Selector::kWantError) {
   }
 
   virtual ~Selectable() {
+    // Not given to DrainZeroCopy: the kernel may still read these, so we
+    // cannot release them.
+    LOG_ERROR_IF(!zerocopy_pending_.empty())
+        << "Leaking " << zerocopy_pending_.size() << " zerocopy blocks";
   }
 
+  // MSG_ZEROCOPY sends not yet reported done by the kernel: their ids
+  // and the blocks they send from (we hold a reference on each)
+  typedef std::deque< std::pair<uint32, io::DataBlock*> > ZeroCopyList;
+
   Selector* selector() const {
     return selector_;
   }
@@ -97,14 +113,59 @@ class Selectable {
   ssize_t Write(const char* buf, size_t size);
   ssize_t Read(char* buf, size_t size);
 
-  // Read/Write interface for MemoryStream-s for copy-less stuff
+  // Read/Write interface for MemoryStream-s for copy-less stuff.
+  // File regions in ms are sent w/ sendfile, and, if enabled, large
+  // external blocks w/ MSG_ZEROCOPY.
   ssize_t Write(io::MemoryStream* ms, ssize_t size = -1);
   ssize_t Read(io::MemoryStream* ms, ssize_t size = -1);
+  // Same as above, but reads in the shared buffers of our selector, and
+  // appends to ms just the bytes read (so ms holds no buffer space
+  // when it has no data).
+  ssize_t ReadShared(io::MemoryStream* ms, ssize_t size = -1);
+
+  // Turns on MSG_ZEROCOPY sends for external blocks of at least min_size
+  // bytes. The kernel pins the pages of these blocks until it reports
+  // them sent on the socket error queue - so we keep a reference on them
+  // until ProcessZeroCopyCompletions() sees that.
+  // Returns false if not supported (for the socket or by the system).
+  bool EnableZeroCopy(size_t min_size);
+  // Releases the blocks that the kernel is done with. Call when the
+  // socket signals an error. Returns false on failure to read the error
+  // queue (w/ errno set).
+  bool ProcessZeroCopyCompletions();
+  // Call when closing the socket fd, after shutting it down: if the
+  // kernel may still read from pending blocks, fd (and the blocks) go to
+  // a drainer that closes fd and releases them once the kernel is done.
+  // Returns true if fd was taken over (do not close it).
+  bool DrainZeroCopy(int fd);
+  bool has_pending_zerocopy() const {
+    return !zerocopy_pending_.empty();
+  }
 
   // the selector that controls this object
   Selector* selector_;
 
  private:
+  // Maximum number of iovec entries we pass to a writev (IOV_MAX on linux)
+  static const int kMaxWritevIovecs = 1024;
+  // How much we try to write in a writev when writing a MemoryStream -
+  // adapted to what the socket takes (0 - not initialized)
+  size_t writev_batch_size_;
+
+  // Sends [pos, pos + size) of the file region block
+  ssize_t WriteFileRegion(int fd, io::DataBlock* block,
+                          io::BlockSize pos, size_t size);
+  // Sends [pos, pos + size) of the block w/ MSG_ZEROCOPY
+  ssize_t WriteZeroCopy(int fd, io::DataBlock* block,
+                        io::BlockSize pos, size_t size);
+
+  // Minimum size of external blocks sent w/ MSG_ZEROCOPY (0 - disabled)
+  size_t zerocopy_min_size_;
+  // Id of the next MSG_ZEROCOPY send (the kernel counts them the same way)
+  uint32 zerocopy_next_id_;
+  // Blocks (and the ids of their sends) not yet released by the kernel
+  ZeroCopyList zerocopy_pending_;
+
   // the desire for read or write **DO NOT TOUCH** updated by the selector only
   int32 desire_;
 
@@ -32,6 +32,7 @@
 #include "whisperlib/net/selector.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 #include <fcntl.h>
 
@@ -43,6 +44,8 @@
 #include "whisperlib/base/core_errno.h"
 #include "whisperlib/base/timer.h"
 #include "whisperlib/base/gflags.h"
+#include "whisperlib/sync/event.h"
+#include "whisperlib/io/buffer/buffer_ring.h"
 #include "whisperlib/net/selectable.h"
 
 using namespace std;
@@ -53,12 +56,25 @@ DEFINE_bool(selector_high_alarm_precission,
             false,
             "Loose some CPU time and gain that extra milisecond precission "
             "for selector alarms..");
+DEFINE_int32(selector_alarm_granularity_ms,
+             1,
+             "Selector alarms expiring within the same interval of these "
+             "many miliseconds are run together (an alarm may run late "
+             "by up to this amount)");
 DEFINE_int32(selector_num_closures_per_event,
              64,
              "We don't run more than these many closures per event");
 DEFINE_int32(selector_events_to_read_per_poll,
              64,
              "We process at most these many events per poll step");
+DEFINE_int32(selector_read_ring_block_size,
+             65536,
+             "Size of the blocks in which the connections that share the "
+             "read buffers of their selector read their data");
+DEFINE_int32(selector_read_ring_min_read_size,
+             4096,
+             "We offer at least these many bytes for a read in the shared "
+             "read buffers of a selector");
 DEFINE_int32(debug_check_long_callbacks_ms,
              500,
              "If greater than zero, we check (in debug mode only !) "
@@ -74,6 +90,8 @@ whisper::Closure* glb_stop_signal = whisper::NewPermanentCallback(&StopSignal);
 #ifdef __USE_LEAN_SELECTOR__
 static const int kCallbackQueueSize = 10000;
 #endif
+// We keep at most these many unused alarm timers around
+static const size_t kMaxFreeAlarmTimers = 1024;
 }
 
 namespace whisper {
@@ -82,12 +100,17 @@ namespace net {
 Selector::Selector()
   : tid_(0),
     should_end_(false),
+    num_registered_(0),
+    alarms_(timer::TicksMsec(), FLAGS_selector_alarm_granularity_ms),
 #ifdef __USE_LEAN_SELECTOR__
     to_run_(kCallbackQueueSize),
 #else
+    to_run_pending_(NULL),
+    sleeping_(false),
     base_(NULL),
 #endif //   __USE_LEAN_SELECTOR__
     now_(timer::TicksMsec()),
+    read_ring_(NULL),
     call_on_close_(NULL) {
 #ifndef  __USE_LEAN_SELECTOR__
 #ifdef HAVE_EVENTFD_H
@@ -116,6 +139,14 @@ Selector::Selector()
 Selector::~Selector() {
   CHECK(tid_ == 0);
   CHECK(registered_.empty());
+  for ( ClosureAlarmsMap::const_iterator it = closure_alarms_.begin();
+        it != closure_alarms_.end(); ++it ) {
+    delete it->second;
+  }
+  for ( size_t i = 0; i < free_alarm_timers_.size(); ++i ) {
+    delete free_alarm_timers_[i];
+  }
+  delete read_ring_;
 #ifndef __USE_LEAN_SELECTOR__
 #ifdef HAVE_EVENTFD_H
   close(event_fd_);
@@ -130,6 +161,7 @@ void Selector::Loop() {
   CHECK(tid_ ==  0) << "Loop already started -- bad !";
   should_end_ = false;
   tid_ = pthread_self();
+  alarms_.set_owner_thread(tid_);
   LOG_INFO << "Starting selector loop";
 
   vector<SelectorEventData> events;
@@ -139,9 +171,7 @@ void Selector::Loop() {
       now_ = timer::TicksMsec();
     }
     if ( !alarms_.empty() ) {
-      if ( alarms_.begin()->first < now_ + to_sleep_ms ) {
-        to_sleep_ms = alarms_.begin()->first - now_;
-      }
+      to_sleep_ms = alarms_.NextExpiryMs(now_, to_sleep_ms);
     }
 
     int run_count = 0;
@@ -155,13 +185,20 @@ void Selector::Loop() {
         ++run_count;
     }
 #else          // __USE_LEAN_SELECTOR__
-    mutex_.Lock();
-    if ( !to_run_.empty() ) {
+    if ( to_run_pending_ != NULL ) {
       to_sleep_ms = 0;
+    } else if ( to_sleep_ms > 0 ) {
+      // From now on who posts closures has to wake us up ..
+      sleeping_ = true;
+      // .. but check for the ones posted meanwhile
+      if ( !to_run_.empty() ) {
+        to_sleep_ms = 0;
+      }
     }
-    mutex_.Unlock();
     events.clear();
-    if (!base_->LoopStep(to_sleep_ms, &events)) {
+    const bool step_ok = base_->LoopStep(to_sleep_ms, &events);
+    sleeping_ = false;
+    if ( !step_ok ) {
       LOG_ERROR << "ERROR in select loop step. Exiting Loop.";
       break;
     }
@@ -175,6 +212,7 @@ void Selector::Loop() {
       Selectable* const s = reinterpret_cast<Selectable *>(event.data_);
       if ( s == NULL ) {
         // was probably a wake signal..
+        ClearWakeSignals();
         continue;
       }
       if ( s->selector() == NULL ) {
@@ -227,34 +265,7 @@ void Selector::Loop() {
     if ( FLAGS_selector_high_alarm_precission ) {
       now_ = timer::TicksMsec();
     }
-    while ( !alarms_.empty() ) {
-      if ( alarms_.begin()->first > now_ ) {
-        // this alarm and all that follow are in the future
-        break;
-      }
-      Closure* closure = alarms_.begin()->second;
-      const bool erased = reverse_alarms_.erase(closure);
-      CHECK(erased);
-      run_count++;
-      alarms_.erase(alarms_.begin());
-#ifdef _DEBUG
-      const int64 processing_begin =
-          FLAGS_debug_check_long_callbacks_ms > 0 ? timer::TicksMsec() : 0;
-#endif
-      closure->Run();
-#ifdef _DEBUG
-      if ( FLAGS_debug_check_long_callbacks_ms > 0 ) {
-        const int64 processing_end = timer::TicksMsec();
-        if ( processing_end - processing_begin >
-             FLAGS_debug_check_long_callbacks_ms ) {
-          LOG_WARN << this << " ====>> Unexpectedly long alarm processing: "
-                    << " callback: " << closure
-                    << " time spent:  "
-                    << processing_end - processing_begin;
-        }
-      }
-#endif
-    }
+    run_count += RunAlarms();
     if ( run_count > 2 * FLAGS_selector_num_closures_per_event ) {
       LOG_WARN << this << " We run to many closures per event: " << run_count;
     }
@@ -276,30 +287,18 @@ void Selector::Loop() {
     LOG_INFO << "Running closures on shutdown, count: " << run_count;
   }
 #ifndef __USE_LEAN_SELECTOR__
-  mutex_.Lock();
-  CHECK(to_run_.empty());
-  mutex_.Unlock();
+  CHECK(to_run_.empty() && to_run_pending_ == NULL);
 #endif
 
-  // Run remaining alarms
-  while ( !alarms_.empty() ) {
-    now_ = timer::TicksMsec();
-    if ( alarms_.begin()->first > now_ ) {
-      // this alarm and all that follow are in the future
-      break;
-    }
-    Closure* closure = alarms_.begin()->second;
-    const bool erased = reverse_alarms_.erase(closure);
-    CHECK(erased);
-    alarms_.erase(alarms_.begin());
+  // Drop the remaining expired alarms
+  now_ = timer::TicksMsec();
+  TimerWheel::Timer* expired;
+  while ( (expired = alarms_.PopExpired(now_)) != NULL ) {
+    ReleaseClosureAlarm(expired);
   }
   if ( !alarms_.empty() ) {
-    LOG_WARN << "Now: " << now_ << " ms";
-  }
-  for ( AlarmSet::const_iterator it = alarms_.begin(); it != alarms_.end();
-        ++it ) {
-    LOG_WARN << "Leaking alarm, run at: " << it->first
-              << " ms, due in: " << (it->first - now_) << " ms";
+    LOG_WARN << "Leaking " << alarms_.size() << " alarms, now: "
+             << now_ << " ms";
   }
 
 #ifndef __USE_LEAN_SELECTOR__
@@ -311,6 +310,7 @@ void Selector::Loop() {
     call_on_close_->Run();
     call_on_close_ = NULL;
   }
+  alarms_.set_owner_thread(0);
   tid_ = 0;
 }
 
@@ -323,52 +323,146 @@ void Selector::MakeLoopExit() {
 #endif
 }
 
-void Selector::RunInSelectLoop(Closure* callback) {
-  DCHECK(tid_ != 0 || !should_end_) << "Selector already stopped";
+Closure* Selector::PrepareToRun(Closure* callback) {
   CHECK_NOT_NULL(callback);
-  #ifdef _DEBUG
+#ifndef __USE_LEAN_SELECTOR__
+  if ( callback->is_permanent() ) {
+    // A permanent closure may be posted again before it runs, so it
+    // cannot be linked in to_run_ itself.
+    callback = whisper::NewCallback(callback, &Closure::Run);
+  }
+#endif
+#ifdef _DEBUG
   callback->set_selector_registered(true);
-  #endif
+#endif
+  return callback;
+}
 
+void Selector::RunInSelectLoop(Closure* callback) {
+  DCHECK(tid_ != 0 || !should_end_) << "Selector already stopped";
+  callback = PrepareToRun(callback);
 #ifdef __USE_LEAN_SELECTOR__
   to_run_.Put(callback);
 #else
-  mutex_.Lock();
-  to_run_.push_back(callback);
-  mutex_.Unlock();
-  if ( !IsInSelectThread() ) {
-    SendWakeSignal();
+  to_run_.Push(callback);
+  MaybeSendWakeSignal();
+#endif
+}
+
+void Selector::RunInSelectLoop(std::vector<Closure*>& callbacks) {
+  DCHECK(tid_ != 0 || !should_end_) << "Selector already stopped";
+  if ( callbacks.empty() ) {
+    return;
   }
+#ifdef __USE_LEAN_SELECTOR__
+  for ( size_t i = 0; i < callbacks.size(); ++i ) {
+    to_run_.Put(PrepareToRun(callbacks[i]));
+  }
+#else
+  Closure* const first = PrepareToRun(callbacks[0]);
+  Closure* last = first;
+  for ( size_t i = 1; i < callbacks.size(); ++i ) {
+    Closure* const callback = PrepareToRun(callbacks[i]);
+    last->set_queue_next(callback);
+    last = callback;
+  }
+  to_run_.PushChain(first, last);
+  MaybeSendWakeSignal();
 #endif
+  callbacks.clear();
 }
 void Selector::RegisterAlarm(Closure* callback, int64 timeout_in_ms) {
+  CHECK_NOT_NULL(callback);
+  TimerWheel::Timer* timer = NULL;
+  ClosureAlarmsMap::const_iterator it = closure_alarms_.find(callback);
+  if ( it != closure_alarms_.end() ) {
+    timer = it->second;
+  } else if ( !free_alarm_timers_.empty() ) {
+    timer = free_alarm_timers_.back();
+    free_alarm_timers_.pop_back();
+    timer->set_callback(callback);
+    closure_alarms_.insert(make_pair(callback, timer));
+  } else {
+    timer = new TimerWheel::Timer(callback);
+    closure_alarms_.insert(make_pair(callback, timer));
+  }
+  RegisterTimer(timer, timeout_in_ms);
+}
+void Selector::UnregisterAlarm(Closure* callback) {
+  CHECK(IsInSelectThread());
+  ClosureAlarmsMap::const_iterator it = closure_alarms_.find(callback);
+  if ( it != closure_alarms_.end() ) {
+    TimerWheel::Timer* const timer = it->second;
+    CHECK(alarms_.Cancel(timer));
+    ReleaseClosureAlarm(timer);
+  }
+}
+void Selector::RegisterTimer(TimerWheel::Timer* timer, int64 timeout_in_ms) {
   DCHECK(tid_ != 0 || !should_end_) << "Selector already stopped";
   CHECK(IsInSelectThread() || (tid_ == 0 && !should_end_));
-  CHECK_NOT_NULL(callback);
+  CHECK_NOT_NULL(timer->callback());
   const int64 wake_up_time = now_ + timeout_in_ms;
   CHECK(timeout_in_ms < 0 || timeout_in_ms <= wake_up_time)
     << "Overflow, timeout_in_ms: " << timeout_in_ms << " is too big";
+  alarms_.Schedule(timer, wake_up_time);
+  // We do not need to wake .. we are in the select loop :)
+}
+void Selector::UnregisterTimer(TimerWheel::Timer* timer) {
+  CHECK(IsInSelectThread() || tid_ == 0);
+  alarms_.Cancel(timer);
+}
 
-  std::pair<ReverseAlarmsMap::iterator, bool> result =
-      reverse_alarms_.insert(make_pair(callback, wake_up_time));
-  if ( result.second ) {
-    // New alarm inserted; Now add to alarms_ too.
-    alarms_.insert(make_pair(wake_up_time, callback));
-  } else {
-    // Old alarm needs replacement.
-    alarms_.erase(make_pair(result.first->second, callback));
-    alarms_.insert(make_pair(wake_up_time, callback));
-    result.first->second = wake_up_time;
+io::BufferRing* Selector::read_ring() {
+  DCHECK(IsInSelectThread() || tid_ == 0);
+  if ( read_ring_ == NULL ) {
+    read_ring_ = new io::BufferRing(FLAGS_selector_read_ring_block_size,
+                                    FLAGS_selector_read_ring_min_read_size);
   }
-  // We do not need to wake .. we are in the select loop :)
+  return read_ring_;
 }
-void Selector::UnregisterAlarm(Closure* callback) {
-  CHECK(IsInSelectThread());
-  ReverseAlarmsMap::iterator it = reverse_alarms_.find(callback);
-  if ( it != reverse_alarms_.end() ) {
-    int count = alarms_.erase(make_pair(it->second, callback));
-    CHECK_EQ(count,1);
-    reverse_alarms_.erase(it);
+
+int Selector::RunAlarms() {
+  int run_count = 0;
+  TimerWheel::Timer* expired;
+  while ( (expired = alarms_.PopExpired(now_)) != NULL ) {
+    Closure* const closure = expired->callback();
+    ReleaseClosureAlarm(expired);
+    run_count++;
+#ifdef _DEBUG
+    const int64 processing_begin =
+        FLAGS_debug_check_long_callbacks_ms > 0 ? timer::TicksMsec() : 0;
+#endif
+    closure->Run();
+#ifdef _DEBUG
+    if ( FLAGS_debug_check_long_callbacks_ms > 0 ) {
+      const int64 processing_end = timer::TicksMsec();
+      if ( processing_end - processing_begin >
+           FLAGS_debug_check_long_callbacks_ms ) {
+        LOG_WARN << this << " ====>> Unexpectedly long alarm processing: "
+                  << " callback: " << closure
+                  << " time spent:  "
+                  << processing_end - processing_begin;
+      }
+    }
+#endif
+  }
+  return run_count;
+}
+
+void Selector::ReleaseClosureAlarm(TimerWheel::Timer* timer) {
+  if ( closure_alarms_.empty() ) {
+    return;
+  }
+  ClosureAlarmsMap::iterator it = closure_alarms_.find(timer->callback());
+  if ( it == closure_alarms_.end() || it->second != timer ) {
+    // not ours (registered w/ RegisterTimer)
+    return;
+  }
+  closure_alarms_.erase(it);
+  if ( free_alarm_timers_.size() < kMaxFreeAlarmTimers ) {
+    free_alarm_timers_.push_back(timer);
+  } else {
+    delete timer;
   }
 }
 
@@ -407,26 +501,17 @@ int Selector::RunClosures(int /*num_closures*/) {
 
 
 #else  // __USE_LEAN_SELECTOR__
-#ifdef HAVE_EVENTFD_H
-  char buffer[1024];
-#else
-  char buffer[32];
-#endif
-
-  int cb = 0;
-  while ( (cb = ::read(event_fd_, buffer, sizeof(buffer))) > 0 ) {
-    VLOG(10) << " Cleaned some " << cb << " bytes from signal pipe.";
-  }
   int run_count = 0;
   while ( run_count < FLAGS_selector_num_closures_per_event ) {
-    mutex_.Lock();
-    if ( to_run_.empty() ) {
-      mutex_.Unlock();
-      break;
+    if ( to_run_pending_ == NULL ) {
+      to_run_pending_ = to_run_.PopAll();
+      if ( to_run_pending_ == NULL ) {
+        break;
+      }
     }
-    Closure* closure = to_run_.front();
-    to_run_.pop_front();
-    mutex_.Unlock();
+    Closure* const closure = to_run_pending_;
+    to_run_pending_ = closure->queue_next();
+    closure->set_queue_next(NULL);
 
 #ifdef _DEBUG
     const int64 processing_begin = FLAGS_debug_check_long_callbacks_ms > 0 ?
@@ -468,6 +553,29 @@ void Selector::SendWakeSignal() {
 #endif  // __USE_LEAN_SELECTOR__
 }
 
+void Selector::MaybeSendWakeSignal() {
+#ifndef  __USE_LEAN_SELECTOR__
+  // Only the first one to see the loop sleeping signals it
+  if ( sleeping_ && sleeping_.exchange(false) ) {
+    SendWakeSignal();
+  }
+#endif  // __USE_LEAN_SELECTOR__
+}
+
+void Selector::ClearWakeSignals() {
+#ifndef  __USE_LEAN_SELECTOR__
+#ifdef HAVE_EVENTFD_H
+  char buffer[1024];
+#else
+  char buffer[32];
+#endif
+  int cb = 0;
+  while ( (cb = ::read(event_fd_, buffer, sizeof(buffer))) > 0 ) {
+    VLOG(10) << " Cleaned some " << cb << " bytes from signal pipe.";
+  }
+#endif  // __USE_LEAN_SELECTOR__
+}
+
 //////////////////////////////////////////////////////////////////////
 
 bool Selector::Register(Selectable* s) {
@@ -487,6 +595,7 @@ bool Selector::Register(Selectable* s) {
   }
   // Insert in the local set of registered objs
   registered_.insert(s);
+  num_registered_ = registered_.size();
 
   return base_->Add(fd, s, s->desire_);
 #endif   //  __USE_LEAN_SELECTOR__
@@ -505,6 +614,7 @@ void Selector::Unregister(Selectable* s) {
 
   base_->Delete(fd);
   registered_.erase(it);
+  num_registered_ = registered_.size();
   s->set_selector(NULL);
 #endif   //  __USE_LEAN_SELECTOR__
 }
@@ -529,6 +639,106 @@ void Selector::UpdateDesire(Selectable* s, bool enable, int32 desire) {
 
 //////////////////////////////////////////////////////////////////////
 
+void SelectorThread::Execution() {
+#if defined(__linux__) && defined(CPU_SET)
+  if ( cpu_ >= 0 ) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu_, &cpus);
+    const int error = pthread_setaffinity_np(pthread_self(),
+                                             sizeof(cpus), &cpus);
+    if ( error != 0 ) {
+      LOG_WARN << "Cannot bind selector thread to cpu: " << cpu_
+               << " error: " << GetSystemErrorDescription(error);
+    }
+  }
+#endif
+  selector_.Loop();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+SelectorPool::SelectorPool(int num_threads, bool pin_to_cpus)
+    : next_thread_(0),
+      is_running_(false) {
+  const int num_cpus = NumCpus();
+  if ( num_threads <= 0 ) {
+    num_threads = num_cpus;
+  }
+  for ( int i = 0; i < num_threads; ++i ) {
+    threads_.push_back(new SelectorThread(pin_to_cpus ? i % num_cpus : -1));
+  }
+}
+
+SelectorPool::~SelectorPool() {
+  Stop();
+  for ( size_t i = 0; i < threads_.size(); ++i ) {
+    delete threads_[i];
+  }
+  threads_.clear();
+}
+
+void SelectorPool::Start() {
+  for ( size_t i = 0; i < threads_.size(); ++i ) {
+    threads_[i]->Start();
+  }
+  is_running_ = true;
+}
+
+void SelectorPool::Stop() {
+  for ( size_t i = 0; i < threads_.size(); ++i ) {
+    threads_[i]->Stop();
+  }
+  is_running_ = false;
+}
+
+void SelectorPool::CleanAndCloseAll() {
+  for ( size_t i = 0; i < threads_.size(); ++i ) {
+    threads_[i]->CleanAndCloseAll();
+  }
+}
+
+Selector* SelectorPool::GetLeastLoadedSelector() {
+  const size_t size = threads_.size();
+  const size_t start = next_thread_++;
+  Selector* chosen = NULL;
+  int32 min_load = kMaxInt32;
+  for ( size_t i = 0; i < size; ++i ) {
+    Selector* const selector = threads_[(start + i) % size]->mutable_selector();
+    const int32 load = selector->num_registered();
+    if ( load < min_load ) {
+      min_load = load;
+      chosen = selector;
+    }
+  }
+  return chosen;
+}
+
+namespace {
+void RunAndSignal(Closure* closure, synch::Event* done) {
+  closure->Run();
+  done->Signal();
+}
+}
+
+void SelectorPool::RunInSelectLoopAndWait(Selector* selector,
+                                          Closure* closure) {
+  if ( selector->IsInSelectThread() || selector->IsStopped() ) {
+    closure->Run();
+    return;
+  }
+  synch::Event done(false, true);
+  selector->RunInSelectLoop(NewCallback(&RunAndSignal, closure, &done));
+  done.Wait();
+}
+
+int SelectorPool::NumCpus() {
+  const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  return num_cpus > 0 ? static_cast<int>(num_cpus) : 1;
+}
+
+//////////////////////////////////////////////////////////////////////
+
 }  // namespace net
 
 }  // namespace whisper
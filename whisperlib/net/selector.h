@@ -37,6 +37,8 @@
 #include <deque>
 #include <set>
 #include <map>
+#include <vector>
+#include <atomic>
 
 #include "whisperlib/base/types.h"
 #include "whisperlib/base/hash.h"
@@ -44,7 +46,9 @@
 
 #include "whisperlib/base/callback.h"
 #include "whisperlib/sync/mutex.h"
+#include "whisperlib/sync/mpsc_queue.h"
 #include "whisperlib/sync/thread.h"
+#include "whisperlib/net/timer_wheel.h"
 
 #ifdef __USE_LEAN_SELECTOR__
 #include "whisperlib/sync/lock_free_producer_consumer_queue.h"
@@ -56,6 +60,9 @@
 // Just a helper function
 
 namespace whisper {
+namespace io {
+class BufferRing;
+}
 namespace net {
 
 class Selectable;
@@ -82,6 +89,13 @@ class Selector {
   //  s - the selectable object to be unregistered
   void Unregister(Selectable* s);
 
+  // The number of currently registered I/O objects. This is a load
+  // indicator for distributing connections among selectors.
+  // - THIS IS SAFE TO CALL FROM ANOTHER THREAD - (the value is approximate)
+  int32 num_registered() const {
+    return num_registered_;
+  }
+
   // Enable/disable a certain event callback for the given selectable
   // -- Call this only from the select loop
   void EnableWriteCallback(Selectable* s, bool enable) {
@@ -104,6 +118,15 @@ class Selector {
   bool IsExiting() const {
     return should_end_;
   }
+  // Returns true if the select loop ended - nothing runs in it any more
+  // (and the closures posted to it are never run)
+  bool IsStopped() const {
+    return tid_ == 0 && should_end_;
+  }
+  // Returns true if the select loop runs now (in some thread)
+  bool IsLooping() const {
+    return tid_ != 0;
+  }
 
   // Returns true if this call was made from the select server thread
   bool IsInSelectThread() const {
@@ -122,6 +145,14 @@ class Selector {
   }
  public:
   void RunInSelectLoop(Closure* callback);
+  // Same as above, for a batch of closures (run in order) - much cheaper
+  // than posting them one by one. We take the closures out of callbacks.
+  void RunInSelectLoop(std::vector<Closure*>& callbacks);
+  // Same as above for a lambda or other callable (no heap allocation
+  // for the small ones)
+  void RunInSelectLoop(InlineCallback<void()> callback) {
+    RunInSelectLoop(NewInlineCallback(std::move(callback)));
+  }
   template <typename T> void DeleteInSelectLoop(T* ob) {
     RunInSelectLoop(
         whisper::NewCallback(&Selector::GeneralAsynchronousDelete<T>, ob));
@@ -137,9 +168,27 @@ class Selector {
   // Cancels a previously registered alarm.
   void UnregisterAlarm(Closure* callback);
 
+  // Same as above, but w/ a timer owned by the caller (which points to the
+  // callback to run). Use these for frequently re-armed alarms: they
+  // involve no lookup and no allocation.
+  // The timer is disarmed when it fires, and on its destruction.
+  void RegisterTimer(TimerWheel::Timer* timer, int64 timeout_in_ms);
+  void UnregisterTimer(TimerWheel::Timer* timer);
+
+  // Runs the callable once, after timeout_in_ms. As there is no closure
+  // to identify the alarm, it cannot be unregistered.
+  void RegisterAlarm(InlineCallback<void()> callback, int64 timeout_in_ms) {
+    RegisterAlarm(NewInlineCallback(std::move(callback)), timeout_in_ms);
+  }
+
   // The current moment when the select loop was broken:
   int64 now() const { return now_; }
 
+  // A buffer ring shared by the selectables of this selector that want
+  // to read into it (created on first use).
+  // -- Call this only from the select loop
+  io::BufferRing* read_ring();
+
   // Desires of selectables
   static const int32 kWantRead  = 1;
   static const int32 kWantWrite = 2;
@@ -156,10 +205,22 @@ class Selector {
  private:
   // This runs all the functions from to_run_ (if any)
   int RunClosures(int max_num_closures);
+  // Runs the expired alarms, returns how many
+  int RunAlarms();
+  // If timer was allocated by RegisterAlarm, forgets about it (the timer
+  // must be disarmed)
+  void ReleaseClosureAlarm(TimerWheel::Timer* timer);
 
   // This writes a byte in the internal pipe in order to make the
   // select loop wake up
   void SendWakeSignal();
+  // Wakes up the select loop if it sleeps (or is about to) - the signal
+  // is sent only once per sleep, no matter how many closures are posted.
+  void MaybeSendWakeSignal();
+  // Reads the wake up signals from the internal pipe
+  void ClearWakeSignals();
+  // Returns the closure to put in to_run_ for running callback
+  Closure* PrepareToRun(Closure* callback);
 
  private:
   // selector's internal thread id
@@ -170,20 +231,20 @@ class Selector {
 
   typedef std::set<Selectable*> SelectableSet;
   typedef std::list<Selectable*> SelectableList;
-  // typedef multimap<int64, Closure*> AlarmsMap;
-  typedef std::set< std::pair<int64, Closure*> > AlarmSet;
-  // Map from alarm to wake up time
-  typedef hash_map<Closure*, int64> ReverseAlarmsMap;
+  // Map from alarm closure to the timer we allocated for it
+  typedef hash_map<Closure*, TimerWheel::Timer*> ClosureAlarmsMap;
 
   // the set of registered I/O objects
   SelectableSet registered_;
+  // registered_.size(), readable from other threads
+  std::atomic_int num_registered_;
   // Alarms..
-  AlarmSet alarms_;
-  // The same alarms, mapped by closure; allows us to cancel an alarm
-  ReverseAlarmsMap reverse_alarms_;
-
-  // guards access to closure queue: to_run_
-  synch::Spin mutex_;
+  TimerWheel alarms_;
+  // The timers of the alarms registered by closure; allows us to cancel
+  // or re-register them.
+  ClosureAlarmsMap closure_alarms_;
+  // Unused timers for closure_alarms_
+  std::vector<TimerWheel::Timer*> free_alarm_timers_;
 
   // Internal control:
 
@@ -200,8 +261,13 @@ class Selector {
                            //  event_fd_
 #endif
 
-    // functions registered to be run in the select loop
-  std::deque<Closure*> to_run_;
+  // functions registered to be run in the select loop
+  synch::MpscQueue<Closure> to_run_;
+  // functions taken from to_run_, but not run yet (select thread only)
+  Closure* to_run_pending_;
+  // Set while the select loop sleeps (or is about to) w/o anything to run:
+  // who posts closures must wake it up.
+  std::atomic_bool sleeping_;
 
     // OS specific selector base implementation
   SelectorBase* base_;
@@ -212,6 +278,9 @@ class Selector {
   // take the value of selector_->now()
   int64 now_;
 
+  // Shared buffers for reads (see read_ring())
+  io::BufferRing* read_ring_;
+
   // we wake up in loop every 100 ms by default
 #ifdef __USE_LEAN_SELECTOR__
   static const int32 kStandardWakeUpTimeMs = 1000;
@@ -228,8 +297,11 @@ class Selector {
 
 class SelectorThread {
  public:
-  SelectorThread()
-      : thread_(NewCallback(this, &SelectorThread::Execution)), stopped_(true) {
+  // If cpu >= 0 the selector thread is bound to that cpu (where supported).
+  explicit SelectorThread(int cpu = -1)
+      : thread_(NewCallback(this, &SelectorThread::Execution)),
+        cpu_(cpu),
+        stopped_(true) {
   }
   ~SelectorThread() {
     Stop();
@@ -259,17 +331,75 @@ class SelectorThread {
   Selector* mutable_selector() {
     return &selector_;
   }
+  int cpu() const {
+    return cpu_;
+  }
+  bool is_running() const {
+    return !stopped_;
+  }
 
  private:
-  void Execution() {
-    selector_.Loop();
-  }
+  void Execution();
+
   whisper::thread::Thread thread_;
   Selector selector_;
+  const int cpu_;
   bool stopped_;
 
   DISALLOW_EVIL_CONSTRUCTORS(SelectorThread);
 };
+
+// SelectorPool
+// ------------
+// A group of SelectorThreads sharing the networking work of a server.
+// When set in a NetFactory (see NetFactory::set_selector_pool), the tcp
+// acceptors created by the factory listen on every thread of the pool
+// (through SO_REUSEPORT where available), so both the accept and the
+// processing of a connection happen on the same, possibly cpu bound, thread.
+class SelectorPool {
+ public:
+  // num_threads <= 0 means one thread for each online cpu.
+  // If pin_to_cpus is set, thread i runs on cpu (i % number of cpus).
+  explicit SelectorPool(int num_threads, bool pin_to_cpus = false);
+  ~SelectorPool();
+
+  void Start();
+  void Stop();
+  // Closes all the connections in all the threads (asynchronously)
+  void CleanAndCloseAll();
+
+  size_t size() const {
+    return threads_.size();
+  }
+  bool is_running() const {
+    return is_running_;
+  }
+  Selector* selector(size_t i) {
+    return threads_[i]->mutable_selector();
+  }
+  const std::vector<SelectorThread*>* threads() const {
+    return &threads_;
+  }
+  // Returns the selector with the least registered I/O objects.
+  // - THIS IS SAFE TO CALL FROM ANOTHER THREAD -
+  Selector* GetLeastLoadedSelector();
+
+  // Runs the closure in the given selector and waits for it to complete.
+  // If called from that selector's thread, or if the selector is stopped,
+  // the closure runs right away.
+  static void RunInSelectLoopAndWait(Selector* selector, Closure* closure);
+
+  // Number of cpus online on this machine
+  static int NumCpus();
+
+ private:
+  std::vector<SelectorThread*> threads_;
+  // where the least loaded search starts - spreads ties among threads
+  std::atomic_size_t next_thread_;
+  bool is_running_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(SelectorPool);
+};
 }  // namespace net
 }  // namespace whisper
 
@@ -0,0 +1,237 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Measures the memory held by mostly idle server connections: opens many
+// client connections, sends a small request on each, and after the server
+// consumed all of them, reports the resident memory and the data block
+// memory (from the BlockPool) per connection - for connections that read
+// in their own buffers, and for connections that read in the buffer ring
+// of their selector (TcpConnectionParams::shared_read_buffer_).
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <malloc.h>
+#include <atomic>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/io/buffer/block_pool.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_connections,
+             2000,
+             "Number of idle connections to open");
+DEFINE_int32(request_size,
+             256,
+             "Each client sends a request of this size");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static std::atomic_int glb_num_open(0);
+static std::atomic_int glb_num_requests(0);
+
+// Consumes the requests, closes when the client closes.
+class IdleConnection {
+ public:
+  IdleConnection(net::NetConnection* connection)
+      : connection_(connection), received_(0) {
+    ++glb_num_open;
+    connection_->SetReadHandler(NewPermanentCallback(
+        this, &IdleConnection::ReadHandler), true);
+    connection_->SetWriteHandler(NewPermanentCallback(
+        this, &IdleConnection::WriteHandler), true);
+    connection_->SetCloseHandler(NewPermanentCallback(
+        this, &IdleConnection::CloseHandler), true);
+  }
+  ~IdleConnection() {
+    delete connection_;
+    --glb_num_open;
+  }
+ private:
+  bool ReadHandler() {
+    received_ += connection_->inbuf()->Size();
+    connection_->inbuf()->Skip(connection_->inbuf()->Size());
+    if ( received_ == FLAGS_request_size ) {
+      ++glb_num_requests;
+    }
+    return true;
+  }
+  bool WriteHandler() {
+    return true;
+  }
+  void CloseHandler(int err, net::NetConnection::CloseWhat what) {
+    if ( what != net::NetConnection::CLOSE_READ_WRITE ) {
+      connection_->FlushAndClose();
+      return;
+    }
+    connection_->net_selector()->DeleteInSelectLoop(this);
+  }
+  net::NetConnection* const connection_;
+  int32 received_;
+};
+
+class IdleServer {
+ public:
+  IdleServer(const net::NetFactory& net_factory)
+      : acceptor_(net_factory.CreateAcceptor(net::PROTOCOL_TCP)) {
+    acceptor_->SetFilterHandler(NewPermanentCallback(
+        this, &IdleServer::FilterHandler), true);
+    acceptor_->SetAcceptHandler(NewPermanentCallback(
+        this, &IdleServer::AcceptHandler), true);
+  }
+  ~IdleServer() {
+    delete acceptor_;
+  }
+  net::NetAcceptor* acceptor() {
+    return acceptor_;
+  }
+  void Listen(bool* success) {
+    *success = acceptor_->Listen(net::HostPort("127.0.0.1", 0));
+  }
+  void Close() {
+    acceptor_->Close();
+  }
+ private:
+  bool FilterHandler(const net::HostPort& /*peer*/) {
+    return true;
+  }
+  void AcceptHandler(net::NetConnection* connection) {
+    new IdleConnection(connection);   // auto deletes on close
+  }
+  net::NetAcceptor* const acceptor_;
+};
+
+static int64 ResidentBytes() {
+  FILE* f = ::fopen("/proc/self/statm", "r");
+  CHECK(f != NULL);
+  long size = 0, resident = 0;
+  CHECK_EQ(::fscanf(f, "%ld %ld", &size, &resident), 2);
+  ::fclose(f);
+  return int64(resident) * ::sysconf(_SC_PAGESIZE);
+}
+
+static int64 BlockBytes() {
+  io::BlockPool::Stats stats;
+  io::BlockPool::GetStats(&stats);
+  return stats.outstanding_bytes_;
+}
+
+static void WaitFor(const std::atomic_int& counter, int value) {
+  const int64 start_ts = timer::TicksMsec();
+  while ( counter != value ) {
+    CHECK_LT(timer::TicksMsec() - start_ts, 30000)
+        << " Timeout waiting: " << counter << " / " << value;
+    ::usleep(1000);
+  }
+}
+
+// Returns the data block bytes per idle connection
+static double RunTest(bool shared_read_buffer) {
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  net::TcpConnectionParams connection_params;
+  connection_params.shared_read_buffer_ = shared_read_buffer;
+  net::TcpAcceptorParams acceptor_params(connection_params,
+                                         FLAGS_num_connections);
+  net_factory.SetTcpParams(acceptor_params);
+
+  IdleServer server(net_factory);
+  bool success = false;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(),
+      NewCallback(&server, &IdleServer::Listen, &success));
+  CHECK(success);
+  const net::HostPort server_address = server.acceptor()->local_address();
+  struct sockaddr_storage addr;
+  CHECK(!server_address.SockAddr(&addr));   // ipv4
+
+  glb_num_requests = 0;
+  const int64 start_rss = ResidentBytes();
+  const int64 start_blocks = BlockBytes();
+  const std::string request(FLAGS_request_size, 'x');
+  std::vector<int> clients;
+  for ( int32 i = 0; i < FLAGS_num_connections; ++i ) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    CHECK_GE(fd, 0);
+    CHECK_EQ(::connect(fd, reinterpret_cast<struct sockaddr*>(&addr),
+                       sizeof(struct sockaddr_in)), 0);
+    CHECK_EQ(::write(fd, request.data(), request.size()),
+             ssize_t(request.size()));
+    clients.push_back(fd);
+  }
+  WaitFor(glb_num_requests, FLAGS_num_connections);
+  const int64 rss = ResidentBytes() - start_rss;
+  const int64 blocks = BlockBytes() - start_blocks;
+
+  for ( size_t i = 0; i < clients.size(); ++i ) {
+    ::close(clients[i]);
+  }
+  WaitFor(glb_num_open, 0);
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server_thread.mutable_selector(),
+      NewCallback(&server, &IdleServer::Close));
+  server_thread.Stop();
+  // return the freed memory to the system, for the next test
+  io::BlockPool::Trim();
+  ::malloc_trim(0);
+
+  LOG_INFO << (shared_read_buffer ? "Shared read buffer" : "Own read buffer")
+           << ": " << FLAGS_num_connections << " idle connections - "
+           << "resident memory: "
+           << double(rss) / FLAGS_num_connections << " bytes per connection"
+           << ", data blocks: "
+           << double(blocks) / FLAGS_num_connections
+           << " bytes per connection";
+  return double(blocks) / FLAGS_num_connections;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  const double own_bytes = RunTest(false);
+  const double shared_bytes = RunTest(true);
+  // Shared: just the ring block, for all the connections
+  CHECK_LT(shared_bytes, own_bytes);
+  CHECK_LT(shared_bytes, 64);
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
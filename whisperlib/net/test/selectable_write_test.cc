@@ -0,0 +1,323 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Benchmark for writing large MemoryStream-s to a socket: sends large
+// responses over a loopback tcp connection (drained by a reader thread)
+// w/ Selectable::Write, and w/ the old ReadForWritev based loop (fixed
+// 16K batches, allocated iovec), and reports the write syscalls per MB
+// and the cpu time per GB spent by the sender.
+// Use --response_size / --block_size to change the shape of the responses.
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/core_errno.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/net/selectable.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/sync/event.h"
+#include "whisperlib/sync/thread.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(response_size,
+             16 << 20,
+             "Size of a response");
+DEFINE_int32(num_responses,
+             32,
+             "Send these many responses in each test");
+DEFINE_int32(block_size,
+             4096,
+             "Responses are made of blocks of this size");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// Reads and checks everything from the fd
+class Reader {
+ public:
+  Reader(int fd, int64 expected)
+      : fd_(fd), expected_(expected), received_(0),
+        thread_(NewCallback(this, &Reader::Run)) {
+    CHECK(thread_.SetJoinable());
+    CHECK(thread_.Start());
+  }
+  void Wait() {
+    CHECK(thread_.Join());
+    CHECK_EQ(received_, expected_);
+  }
+ private:
+  void Run() {
+    char buffer[1 << 16];
+    while ( received_ < expected_ ) {
+      const ssize_t cb = ::read(fd_, buffer, sizeof(buffer));
+      CHECK_GT(cb, 0) << " Read error: " << GetLastSystemErrorDescription();
+      for ( ssize_t i = 0; i < cb; ++i ) {
+        CHECK_EQ(buffer[i], static_cast<char>(
+            (received_ + i) % FLAGS_response_size % 251));
+      }
+      received_ += cb;
+    }
+  }
+  const int fd_;
+  const int64 expected_;
+  int64 received_;
+  thread::Thread thread_;
+};
+
+// Writes MemoryStream-s on a (non blocking) fd
+class Writer : public net::Selectable {
+ public:
+  explicit Writer(int fd, net::Selector* selector = NULL)
+      : net::Selectable(selector), fd_(fd) {
+  }
+  virtual int GetFd() const {
+    return fd_;
+  }
+  virtual void Close() {
+  }
+  bool EnableZeroCopy() {
+    return net::Selectable::EnableZeroCopy(1);
+  }
+  bool has_pending_zerocopy() const {
+    return net::Selectable::has_pending_zerocopy();
+  }
+  ssize_t WriteOnce(io::MemoryStream* ms) {
+    return Write(ms);
+  }
+  // Closes the socket like a connection does (in the selector thread)
+  void ShutdownAndClose() {
+    ::shutdown(fd_, SHUT_WR);
+    if ( !DrainZeroCopy(fd_) ) {
+      ::close(fd_);
+    }
+  }
+  // Writes everything from ms, waiting for the fd when it is full
+  void Send(io::MemoryStream* ms, bool legacy) {
+    while ( !ms->IsEmpty() ) {
+      const ssize_t cb = legacy ? LegacyWrite(ms) : Write(ms);
+      CHECK_GE(cb, 0) << " Write error: " << GetLastSystemErrorDescription();
+      if ( !ms->IsEmpty() ) {
+        struct pollfd pfd = { fd_, POLLOUT, 0 };
+        CHECK_GE(::poll(&pfd, 1, -1), 0);
+      }
+    }
+  }
+ private:
+  // What Selectable::Write used to do
+  ssize_t LegacyWrite(io::MemoryStream* ms) {
+    ssize_t cb = 0;
+    while ( !ms->IsEmpty() ) {
+      ms->MarkerSet();
+      struct ::iovec* iov = NULL;
+      int iovcnt = 0;
+      const size_t scratch = ms->ReadForWritev(&iov, &iovcnt, 16384);
+      const ssize_t crt_cb = ::writev(fd_, iov, iovcnt);
+      delete [] iov;
+      if ( crt_cb < 0 ) {
+        ms->MarkerRestore();
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? cb : -1;
+      }
+      if ( size_t(crt_cb) < scratch ) {
+        ms->MarkerRestore();
+        ms->Skip(crt_cb);
+        return cb + crt_cb;
+      }
+      ms->MarkerClear();
+      cb += crt_cb;
+    }
+    return cb;
+  }
+  const int fd_;
+};
+
+// We count the writev calls by interposing our own writev (the library
+// calls resolve to this one, as we link statically with it).
+static int64 glb_num_writev = 0;
+extern "C" ssize_t writev(int fd, const struct iovec* iov, int iovcnt) {
+  ++glb_num_writev;
+  return ::syscall(SYS_writev, fd, iov, iovcnt);
+}
+
+static int64 ThreadCpuNsec() {
+  struct timespec ts;
+  CHECK_EQ(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts), 0);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Returns a connected pair of tcp sockets, over loopback
+static void TcpPair(int* client, int* server) {
+  const int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(listener, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  socklen_t addr_len = sizeof(addr);
+  CHECK_EQ(::bind(listener, reinterpret_cast<struct sockaddr*>(&addr),
+                  addr_len), 0);
+  CHECK_EQ(::listen(listener, 1), 0);
+  CHECK_EQ(::getsockname(listener, reinterpret_cast<struct sockaddr*>(&addr),
+                         &addr_len), 0);
+  *client = ::socket(AF_INET, SOCK_STREAM, 0);
+  CHECK_GE(*client, 0);
+  CHECK_EQ(::connect(*client, reinterpret_cast<struct sockaddr*>(&addr),
+                     addr_len), 0);
+  *server = ::accept(listener, NULL, NULL);
+  CHECK_GE(*server, 0);
+  ::close(listener);
+}
+
+static void RunBenchmark(const char* name, bool legacy,
+                         const std::string& response) {
+  int client, server;
+  TcpPair(&client, &server);
+  CHECK_EQ(fcntl(server, F_SETFL, fcntl(server, F_GETFL, 0) | O_NONBLOCK), 0);
+  const int64 total = int64(FLAGS_num_responses) * response.size();
+  Reader reader(client, total);
+  Writer writer(server);
+
+  const int64 start_syscalls = glb_num_writev;
+  const int64 start_cpu = ThreadCpuNsec();
+  const int64 start_ts = timer::TicksUsec();
+  for ( int32 i = 0; i < FLAGS_num_responses; ++i ) {
+    io::MemoryStream ms(FLAGS_block_size);
+    for ( size_t pos = 0; pos < response.size(); pos += FLAGS_block_size ) {
+      ms.Write(response.data() + pos,
+               std::min(response.size() - pos, size_t(FLAGS_block_size)));
+    }
+    writer.Send(&ms, legacy);
+  }
+  const int64 cpu_ns = ThreadCpuNsec() - start_cpu;
+  const int64 syscalls = glb_num_writev - start_syscalls;
+  reader.Wait();
+  const int64 duration_us = timer::TicksUsec() - start_ts;
+  ::close(client);
+  ::close(server);
+
+  const double mb = total / 1048576.0;
+  LOG_INFO << name << ": " << (total / static_cast<double>(duration_us))
+           << " MB/s, write syscalls: " << syscalls
+           << " (" << syscalls / mb << " per MB), sender cpu: "
+           << cpu_ns / 1000000.0 / (mb / 1024) << " ms per GB";
+}
+
+static void CloseFile(int fd) {
+  ::close(fd);
+}
+
+// A file region that gets truncated under us fails the write, instead of
+// writing 0 bytes forever
+static void TestTruncatedFileRegion() {
+  char name[] = "/tmp/selectable_write_test_XXXXXX";
+  const int fd = ::mkstemp(name);
+  CHECK_GE(fd, 0);
+  ::unlink(name);
+  const std::string data(65536, 'x');
+  CHECK_EQ(::write(fd, data.data(), data.size()), ssize_t(data.size()));
+  io::MemoryStream ms;
+  ms.AppendFileRegion(fd, 0, data.size(), NewCallback(&CloseFile, fd));
+  CHECK_EQ(::ftruncate(fd, 1000), 0);
+
+  int client, server;
+  TcpPair(&client, &server);
+  CHECK_EQ(fcntl(server, F_SETFL, fcntl(server, F_GETFL, 0) | O_NONBLOCK), 0);
+  Writer writer(server);
+  ssize_t cb = 0;
+  for ( int i = 0; i < 3 && cb >= 0; ++i ) {
+    cb = writer.WriteOnce(&ms);
+  }
+  CHECK_EQ(cb, -1);
+  CHECK_EQ(errno, EIO);
+  ::close(client);
+  ::close(server);
+  LOG_INFO << "Truncated file region test PASS";
+}
+
+// The blocks sent w/ MSG_ZEROCOPY are released only after the kernel is
+// done w/ them, even when the socket is closed before that
+static void TestZeroCopyClose(const std::string& response) {
+  int client, server;
+  TcpPair(&client, &server);
+  CHECK_EQ(fcntl(server, F_SETFL, fcntl(server, F_GETFL, 0) | O_NONBLOCK), 0);
+  net::SelectorThread selector_thread;
+  selector_thread.Start();
+  Writer writer(server, selector_thread.mutable_selector());
+  if ( !writer.EnableZeroCopy() ) {
+    LOG_WARN << "MSG_ZEROCOPY not supported - skipping the zerocopy test";
+    ::close(client);
+    ::close(server);
+    return;
+  }
+  synch::Event released(false, true);
+  Reader reader(client, response.size());
+  {
+    io::MemoryStream ms;
+    ms.AppendRaw(response.data(), response.size(),
+                 NewCallback(&released, &synch::Event::Signal));
+    writer.Send(&ms, false);
+  }
+  LOG_INFO << "Zerocopy sends pending on close: "
+           << writer.has_pending_zerocopy();
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector_thread.mutable_selector(),
+      NewCallback(&writer, &Writer::ShutdownAndClose));
+  reader.Wait();
+  CHECK(released.Wait(10000));
+  selector_thread.Stop();
+  ::close(client);
+  LOG_INFO << "Zerocopy close test PASS";
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  std::string response;
+  for ( int32 i = 0; i < FLAGS_response_size; ++i ) {
+    response.push_back(static_cast<char>(i % 251));
+  }
+  RunBenchmark("ReadForWritev (16K batches)", true, response);
+  RunBenchmark("Selectable::Write", false, response);
+  TestTruncatedFileRegion();
+  TestZeroCopyClose(response);
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,317 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Benchmark for the SelectorPool: an echo server served by a pool of
+// 1, 2, 4 .. N selector threads, loaded by clients that either do
+// request / reply round trips on persistent connections (req/s), or open a
+// connection for each request (connections/s).
+
+#include <unistd.h>
+#include <atomic>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(max_server_threads,
+             0,
+             "Benchmark server pools of 1, 2, 4 .. up to these many threads "
+             "(0 - the number of cpus)");
+DEFINE_int32(num_client_threads,
+             2,
+             "Client connections run in these many selector threads");
+DEFINE_int32(num_connections,
+             64,
+             "Number of concurrent client connections");
+DEFINE_int32(request_size,
+             128,
+             "Size of each echoed request");
+DEFINE_int32(run_time_ms,
+             2000,
+             "Run each test for this long");
+DEFINE_bool(reuse_port,
+            true,
+            "Each server thread accepts on its own SO_REUSEPORT socket; "
+            "else one acceptor hands connections to the least loaded thread");
+DEFINE_bool(cpu_steering,
+            false,
+            "Steer connections to the acceptor of the receiving cpu");
+DEFINE_bool(pin_to_cpus,
+            false,
+            "Bind the server selector threads to cpus");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static std::atomic_bool glb_stop(false);
+static std::atomic<int64> glb_num_requests(0);
+static std::atomic<int64> glb_num_connections(0);
+static std::atomic_int glb_num_clients(0);
+
+// Echoes back everything, closes when the client closes.
+class EchoConnection {
+ public:
+  EchoConnection(net::NetConnection* connection)
+      : connection_(connection) {
+    connection_->SetReadHandler(NewPermanentCallback(
+        this, &EchoConnection::ReadHandler), true);
+    connection_->SetWriteHandler(NewPermanentCallback(
+        this, &EchoConnection::WriteHandler), true);
+    connection_->SetCloseHandler(NewPermanentCallback(
+        this, &EchoConnection::CloseHandler), true);
+  }
+  ~EchoConnection() {
+    delete connection_;
+  }
+ private:
+  bool ReadHandler() {
+    connection_->Write(connection_->inbuf());
+    return true;
+  }
+  bool WriteHandler() {
+    return true;
+  }
+  void CloseHandler(int err, net::NetConnection::CloseWhat what) {
+    if ( what != net::NetConnection::CLOSE_READ_WRITE ) {
+      connection_->FlushAndClose();
+      return;
+    }
+    connection_->net_selector()->DeleteInSelectLoop(this);
+  }
+  net::NetConnection* const connection_;
+};
+
+class EchoServer {
+ public:
+  EchoServer(const net::NetFactory& net_factory)
+      : acceptor_(net_factory.CreateAcceptor(net::PROTOCOL_TCP)) {
+    acceptor_->SetFilterHandler(NewPermanentCallback(
+        this, &EchoServer::FilterHandler), true);
+    acceptor_->SetAcceptHandler(NewPermanentCallback(
+        this, &EchoServer::AcceptHandler), true);
+  }
+  ~EchoServer() {
+    delete acceptor_;
+  }
+  net::NetAcceptor* acceptor() {
+    return acceptor_;
+  }
+  void Listen(bool* success) {
+    *success = acceptor_->Listen(net::HostPort("127.0.0.1", 0));
+  }
+  void Close() {
+    acceptor_->Close();
+  }
+ private:
+  bool FilterHandler(const net::HostPort& /*peer*/) {
+    return true;
+  }
+  void AcceptHandler(net::NetConnection* connection) {
+    new EchoConnection(connection);   // auto deletes on close
+  }
+  net::NetAcceptor* const acceptor_;
+};
+
+// Sends a request, waits for the echo, and repeats - on the same
+// connection or (if reconnect) on a new one, until glb_stop.
+class BenchClient {
+ public:
+  BenchClient(net::Selector* selector, const net::HostPort& server,
+              bool reconnect)
+      : selector_(selector),
+        net_factory_(selector),
+        server_(server),
+        reconnect_(reconnect),
+        request_(FLAGS_request_size, 'x'),
+        connection_(NULL),
+        received_(0) {
+    ++glb_num_clients;
+    Connect();
+  }
+  ~BenchClient() {
+    delete connection_;
+    --glb_num_clients;
+  }
+ private:
+  void Connect() {
+    connection_ = net_factory_.CreateConnection(net::PROTOCOL_TCP);
+    connection_->SetConnectHandler(NewPermanentCallback(
+        this, &BenchClient::ConnectHandler), true);
+    connection_->SetReadHandler(NewPermanentCallback(
+        this, &BenchClient::ReadHandler), true);
+    connection_->SetWriteHandler(NewPermanentCallback(
+        this, &BenchClient::WriteHandler), true);
+    connection_->SetCloseHandler(NewPermanentCallback(
+        this, &BenchClient::CloseHandler), true);
+    CHECK(connection_->Connect(server_));
+  }
+  void ConnectHandler() {
+    ++glb_num_connections;
+    SendRequest();
+  }
+  void SendRequest() {
+    received_ = 0;
+    connection_->Write(request_);
+  }
+  bool ReadHandler() {
+    received_ += connection_->inbuf()->Size();
+    connection_->inbuf()->Clear();
+    if ( received_ < request_.size() ) {
+      return true;
+    }
+    ++glb_num_requests;
+    if ( glb_stop || reconnect_ ) {
+      connection_->FlushAndClose();
+      return true;
+    }
+    SendRequest();
+    return true;
+  }
+  bool WriteHandler() {
+    return true;
+  }
+  void CloseHandler(int err, net::NetConnection::CloseWhat what) {
+    if ( what != net::NetConnection::CLOSE_READ_WRITE ) {
+      connection_->FlushAndClose();
+      return;
+    }
+    selector_->DeleteInSelectLoop(connection_);
+    connection_ = NULL;
+    if ( glb_stop ) {
+      selector_->DeleteInSelectLoop(this);
+      return;
+    }
+    CHECK(reconnect_) << " Server closed a persistent connection, err: "
+                      << err;
+    Connect();
+  }
+
+  net::Selector* const selector_;
+  net::NetFactory net_factory_;
+  const net::HostPort server_;
+  const bool reconnect_;
+  const std::string request_;
+  net::NetConnection* connection_;
+  size_t received_;
+};
+
+static void StartClient(net::Selector* selector, net::HostPort server,
+                        bool reconnect) {
+  new BenchClient(selector, server, reconnect);
+}
+
+// Returns the number of events (requests or connections) per second
+static double RunBenchmark(int num_server_threads, bool reconnect) {
+  net::SelectorThread main_thread;
+  main_thread.Start();
+  net::SelectorPool server_pool(num_server_threads, FLAGS_pin_to_cpus);
+  server_pool.Start();
+  net::SelectorPool client_pool(FLAGS_num_client_threads);
+  client_pool.Start();
+
+  net::NetFactory net_factory(main_thread.mutable_selector());
+  net::TcpAcceptorParams acceptor_params;
+  acceptor_params.reuse_port_ = FLAGS_reuse_port;
+  acceptor_params.cpu_steering_ = FLAGS_cpu_steering;
+  net_factory.SetTcpParams(acceptor_params);
+  net_factory.set_selector_pool(&server_pool);
+
+  EchoServer server(net_factory);
+  bool success = false;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      main_thread.mutable_selector(),
+      NewCallback(&server, &EchoServer::Listen, &success));
+  CHECK(success);
+  const net::HostPort server_address = server.acceptor()->local_address();
+
+  glb_stop = false;
+  glb_num_requests = 0;
+  glb_num_connections = 0;
+  const int64 start_ts = timer::TicksMsec();
+  for ( int i = 0; i < FLAGS_num_connections; ++i ) {
+    client_pool.selector(i % client_pool.size())->RunInSelectLoop(
+        NewCallback(&StartClient,
+                    client_pool.selector(i % client_pool.size()),
+                    server_address, reconnect));
+  }
+  ::usleep(FLAGS_run_time_ms * 1000);
+  const int64 num_events = reconnect ? glb_num_connections.load()
+                                     : glb_num_requests.load();
+  const int64 duration_ms = timer::TicksMsec() - start_ts;
+  glb_stop = true;
+  while ( glb_num_clients > 0 ) {
+    ::usleep(10000);
+  }
+  if ( !reconnect ) {
+    // Else ~EchoServer closes the acceptor, w/ all the selectors stopped
+    net::SelectorPool::RunInSelectLoopAndWait(
+        main_thread.mutable_selector(),
+        NewCallback(&server, &EchoServer::Close));
+  }
+  server_pool.CleanAndCloseAll();
+  client_pool.Stop();
+  server_pool.Stop();
+  main_thread.Stop();
+
+  return num_events * 1000.0 / duration_ms;
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  const int max_threads = (FLAGS_max_server_threads > 0
+                           ? FLAGS_max_server_threads
+                           : net::SelectorPool::NumCpus());
+  LOG_INFO << "Selector pool benchmark: reuse_port: " << FLAGS_reuse_port
+           << " connections: " << FLAGS_num_connections
+           << " request_size: " << FLAGS_request_size;
+  for ( int num_threads = 1; ; num_threads *= 2 ) {
+    if ( num_threads > max_threads ) {
+      num_threads = max_threads;
+    }
+    const double req_per_sec = RunBenchmark(num_threads, false);
+    const double conn_per_sec = RunBenchmark(num_threads, true);
+    LOG_INFO << "Server threads: " << num_threads
+             << " - requests/s: " << static_cast<int64>(req_per_sec)
+             << " - connections/s: " << static_cast<int64>(conn_per_sec);
+    if ( num_threads == max_threads ) {
+      break;
+    }
+  }
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -30,6 +30,8 @@
 // Author: Catalin Popescu
 
 #include <stdlib.h>
+#include <atomic>
+#include <vector>
 
 #include "whisperlib/net/connection.h"
 #include "whisperlib/base/types.h"
@@ -37,8 +39,11 @@
 #include "whisperlib/base/system.h"
 #include "whisperlib/base/gflags.h"
 #include "whisperlib/base/scoped_ptr.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/sync/thread.h"
 
 #include "whisperlib/net/address.h"
+#include "whisperlib/net/alarm.h"
 #include "whisperlib/net/selector.h"
 
 //////////////////////////////////////////////////////////////////////
@@ -88,6 +93,25 @@ DEFINE_int32(time_between_connections_ms,
              1000,
              "Start a new connection after this time ... ");
 
+DEFINE_int32(num_post_threads,
+             4,
+             "For the RunInSelectLoop benchmark: post closures from "
+             "these many threads");
+DEFINE_int32(num_posts,
+             200000,
+             "For the RunInSelectLoop benchmark: each thread posts "
+             "these many closures");
+DEFINE_int32(post_batch_size,
+             64,
+             "For the RunInSelectLoop benchmark: post closures in batches "
+             "of this size");
+DEFINE_int32(num_chained_closures,
+             1000000,
+             "For the closure benchmark: run these many closures in the "
+             "select loop");
+
+DECLARE_bool(callback_pool);
+
 //////////////////////////////////////////////////////////////////////
 
 static int32 global_num_clients = 0;
@@ -466,10 +490,213 @@ void StartEchoConnection(size_t num_to_start,
   }
 }
 
+//////////////////////////////////////////////////////////////////////
+//
+// Cross thread RunInSelectLoop benchmark: a few threads post closures to
+// a selector, one by one or in batches. We check that the closures of a
+// thread run in the order they were posted.
+//
+
+static std::vector<int64> glb_last_posted;   // select thread only
+static std::atomic<int64> glb_num_run(0);
+
+static void RunPosted(int32 thread_index, int64 seq) {
+  CHECK_EQ(glb_last_posted[thread_index] + 1, seq);
+  glb_last_posted[thread_index] = seq;
+  ++glb_num_run;
+}
+
+static void Post(whisper::net::Selector* selector, int32 thread_index,
+                 int32 batch_size) {
+  std::vector<whisper::Closure*> batch;
+  for ( int64 seq = 0; seq < FLAGS_num_posts; ++seq ) {
+    whisper::Closure* const callback =
+        whisper::NewCallback(&RunPosted, thread_index, seq);
+    if ( batch_size <= 1 ) {
+      selector->RunInSelectLoop(callback);
+      continue;
+    }
+    batch.push_back(callback);
+    if ( int32(batch.size()) >= batch_size ) {
+      selector->RunInSelectLoop(batch);
+    }
+  }
+  selector->RunInSelectLoop(batch);
+}
+
+static void PostBenchmark(int32 batch_size) {
+  whisper::net::SelectorThread selector_thread;
+  selector_thread.Start();
+  glb_last_posted.assign(FLAGS_num_post_threads, -1);
+  glb_num_run = 0;
+  const int64 total = int64(FLAGS_num_post_threads) * FLAGS_num_posts;
+  const int64 start_ts = whisper::timer::TicksUsec();
+  std::vector<whisper::thread::Thread*> threads;
+  for ( int32 i = 0; i < FLAGS_num_post_threads; ++i ) {
+    threads.push_back(new whisper::thread::Thread(whisper::NewCallback(
+        &Post, selector_thread.mutable_selector(), i, batch_size)));
+    CHECK(threads.back()->SetJoinable());
+    CHECK(threads.back()->Start());
+  }
+  for ( size_t i = 0; i < threads.size(); ++i ) {
+    CHECK(threads[i]->Join());
+    delete threads[i];
+  }
+  while ( glb_num_run < total ) {
+    ::usleep(1000);
+  }
+  const int64 duration_us = whisper::timer::TicksUsec() - start_ts;
+  selector_thread.Stop();
+  LOG_INFO << "RunInSelectLoop from " << FLAGS_num_post_threads
+           << " threads, batches of " << batch_size << ": "
+           << total * 1000000.0 / duration_us << " closures per second";
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// Alarms started, stopped and deleted from a thread other than the one of
+// their selector.
+//
+
+static std::atomic<int64> glb_num_alarms(0);
+
+static void AlarmFired() {
+  ++glb_num_alarms;
+}
+
+static void AlarmTest() {
+  whisper::net::SelectorThread selector_thread;
+  selector_thread.Start();
+  whisper::net::Selector* const selector = selector_thread.mutable_selector();
+  {
+    whisper::util::Alarm alarm(*selector);
+    alarm.Set(whisper::NewPermanentCallback(&AlarmFired), true, 10,
+              false, true);
+    while ( glb_num_alarms < 1 ) {
+      ::usleep(1000);
+    }
+  }
+  for ( int i = 0; i < 1000; ++i ) {
+    whisper::util::Alarm* const alarm = new whisper::util::Alarm(*selector);
+    alarm->Set(whisper::NewPermanentCallback(&AlarmFired), true, 100000,
+               false, true);
+    if ( i % 2 ) {
+      alarm->Stop();
+    }
+    delete alarm;   // no operation on its timer may be pending
+  }
+  selector_thread.Stop();
+  CHECK_EQ(glb_num_alarms, 1);
+  LOG_INFO << "Alarm test PASS";
+}
+
+// Two selectors, each w/ an alarm that restarts the alarm of the other one
+// when it fires (from the wrong thread, so this must not wait).
+static std::atomic<int64> glb_num_ping_pongs(0);
+
+static void PingPong(whisper::util::Alarm** other) {
+  ++glb_num_ping_pongs;
+  (*other)->Start();
+}
+
+static void CrossAlarmTest() {
+  whisper::net::SelectorThread thread_a, thread_b;
+  thread_a.Start();
+  thread_b.Start();
+  whisper::util::Alarm* alarm_a =
+      new whisper::util::Alarm(*thread_a.mutable_selector());
+  whisper::util::Alarm* alarm_b =
+      new whisper::util::Alarm(*thread_b.mutable_selector());
+  alarm_a->Set(whisper::NewPermanentCallback(&PingPong, &alarm_b), true, 1,
+               true, false);
+  alarm_b->Set(whisper::NewPermanentCallback(&PingPong, &alarm_a), true, 1,
+               true, false);
+  alarm_a->Start();
+  alarm_b->Start();
+  const int64 start = whisper::timer::TicksMsec();
+  while ( glb_num_ping_pongs < 200 ) {
+    CHECK_LT(whisper::timer::TicksMsec() - start, 10000)
+        << " Cross selector alarms stuck";
+    ::usleep(1000);
+  }
+  thread_a.Stop();
+  thread_b.Stop();
+  delete alarm_a;
+  delete alarm_b;
+  LOG_INFO << "Cross alarm test PASS";
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// Closure benchmark: a chain of closures, each posting the next one from
+// the select loop - w/ heap allocated closures, w/ pooled closures, and
+// w/ lambdas. We count the calls to malloc by interposing our own
+// (the library calls resolve to this one, as we link statically with it).
+//
+
+extern "C" void* __libc_malloc(size_t size);
+static std::atomic<int64> glb_num_mallocs(0);
+extern "C" void* malloc(size_t size) {
+  ++glb_num_mallocs;
+  return __libc_malloc(size);
+}
+
+class ChainBenchmark {
+ public:
+  ChainBenchmark(whisper::net::Selector* selector, bool use_lambdas)
+      : selector_(selector), use_lambdas_(use_lambdas),
+        left_(FLAGS_num_chained_closures) {
+  }
+  void Step() {
+    if ( --left_ <= 0 ) {
+      selector_->MakeLoopExit();
+      return;
+    }
+    if ( use_lambdas_ ) {
+      selector_->RunInSelectLoop([this]() { Step(); });
+    } else {
+      selector_->RunInSelectLoop(
+          whisper::NewCallback(this, &ChainBenchmark::Step));
+    }
+  }
+ private:
+  whisper::net::Selector* const selector_;
+  const bool use_lambdas_;
+  int64 left_;
+};
+
+static void ClosureBenchmark(const char* name, bool use_pool,
+                             bool use_lambdas) {
+  FLAGS_callback_pool = use_pool;
+  whisper::net::Selector selector;
+  ChainBenchmark benchmark(&selector, use_lambdas);
+  selector.RunInSelectLoop(
+      whisper::NewCallback(&benchmark, &ChainBenchmark::Step));
+  const int64 start_mallocs = glb_num_mallocs;
+  const int64 start_ts = whisper::timer::TicksUsec();
+  selector.Loop();
+  const int64 duration_us = whisper::timer::TicksUsec() - start_ts;
+  const int64 num_mallocs = glb_num_mallocs - start_mallocs;
+  FLAGS_callback_pool = true;
+  LOG_INFO << name << ": "
+           << FLAGS_num_chained_closures * 1000000.0 / duration_us
+           << " closures per second, "
+           << double(num_mallocs) / FLAGS_num_chained_closures
+           << " mallocs per closure";
+}
+
 //////////////////////////////////////////////////////////////////////
 
 int main(int argc, char* argv[]) {
   whisper::common::Init(argc, argv);
+  ClosureBenchmark("NewCallback", false, false);
+  ClosureBenchmark("NewCallback (pooled)", true, false);
+  ClosureBenchmark("Lambda", true, true);
+  PostBenchmark(1);
+  PostBenchmark(FLAGS_post_batch_size);
+  AlarmTest();
+  CrossAlarmTest();
+
   whisper::net::Selector selector;
 
   whisper::net::NetFactory net_factory(&selector);
@@ -0,0 +1,156 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Checks the TimerWheel and measures its arm / re-arm / cancel / fire
+// rates for a large number of timers.
+
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+
+#include "whisperlib/net/timer_wheel.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_timers,
+             1000000,
+             "Number of timers to use");
+DEFINE_int32(max_timeout_ms,
+             600000,
+             "Timers are set to expire randomly in up to these many ms");
+DEFINE_int32(granularity_ms,
+             1,
+             "Granularity of the timer wheel");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+static int64 glb_num_fired = 0;
+static void Fired() {
+  ++glb_num_fired;
+}
+
+static void LogRate(const char* what, int64 count, int64 start_us) {
+  const int64 duration_us = timer::TicksUsec() - start_us;
+  LOG_INFO << what << ": " << count << " in " << duration_us << " us - "
+           << (duration_us > 0 ? count * 1000000 / duration_us : count)
+           << " per second";
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  const int64 granularity = FLAGS_granularity_ms;
+  int64 now = 1000000;
+  net::TimerWheel wheel(now, granularity);
+  Closure* fired = NewPermanentCallback(&Fired);
+
+  std::vector<net::TimerWheel::Timer*> timers;
+  for ( int32 i = 0; i < FLAGS_num_timers; ++i ) {
+    timers.push_back(new net::TimerWheel::Timer(fired));
+  }
+  // The timeouts to use, generated upfront
+  std::vector<int64> timeouts;
+  for ( int32 i = 0; i < FLAGS_num_timers; ++i ) {
+    timeouts.push_back(random() % FLAGS_max_timeout_ms);
+  }
+
+  int64 start = timer::TicksUsec();
+  for ( size_t i = 0; i < timers.size(); ++i ) {
+    wheel.Schedule(timers[i], now + timeouts[i]);
+  }
+  LogRate("Arm", timers.size(), start);
+  CHECK_EQ(wheel.size(), timers.size());
+
+  // Move time a bit, and re-arm everything (as on connection activity)
+  now += FLAGS_max_timeout_ms / 10;
+  while ( wheel.PopExpired(now) != NULL ) {
+  }
+  start = timer::TicksUsec();
+  for ( size_t i = 0; i < timers.size(); ++i ) {
+    wheel.Schedule(timers[i], now + timeouts[timers.size() - i - 1]);
+  }
+  LogRate("Re-arm", timers.size(), start);
+  CHECK_EQ(wheel.size(), timers.size());
+
+  // Cancel every other timer
+  start = timer::TicksUsec();
+  int64 num_canceled = 0;
+  for ( size_t i = 0; i < timers.size(); i += 2 ) {
+    CHECK(wheel.Cancel(timers[i]));
+    ++num_canceled;
+  }
+  LogRate("Cancel", num_canceled, start);
+  CHECK(!wheel.Cancel(timers[0]));
+  CHECK_EQ(wheel.size(), timers.size() - num_canceled);
+
+  // Fire everything, moving the time in 1 ms steps, like the selector
+  const int64 end = now + FLAGS_max_timeout_ms + granularity;
+  int64 last_now = now - 1;
+  start = timer::TicksUsec();
+  for ( ; now <= end; ++now ) {
+    net::TimerWheel::Timer* t;
+    while ( (t = wheel.PopExpired(now)) != NULL ) {
+      CHECK_LE(t->when_ms(), now) << " Timer fired early";
+      CHECK_GT(t->when_ms() + granularity, last_now) << " Timer fired late";
+      CHECK(!t->is_armed());
+      t->callback()->Run();
+    }
+    last_now = now;
+  }
+  LogRate("Fire", glb_num_fired, start);
+  CHECK_EQ(glb_num_fired, timers.size() - num_canceled);
+  CHECK(wheel.empty());
+  CHECK(wheel.PopExpired(now) == NULL);
+
+  // The wait for the next expiration
+  CHECK_EQ(wheel.NextExpiryMs(now, 100), 100);
+  wheel.Schedule(timers[1], now + 50);
+  CHECK_LE(wheel.NextExpiryMs(now, 100), 50);
+
+  // Destroying an armed timer disarms it
+  wheel.Schedule(timers[3], now + (1LL << 40));
+  CHECK_EQ(wheel.size(), 2);
+  delete timers[1];
+  timers[1] = NULL;
+  CHECK_EQ(wheel.size(), 1);
+  CHECK(timers[3]->is_armed());
+
+  for ( size_t i = 0; i < timers.size(); ++i ) {
+    delete timers[i];
+  }
+  CHECK(wheel.empty());
+  delete fired;
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -36,37 +36,64 @@ using namespace std;
 namespace whisper {
 namespace net {
 
+namespace {
+// We keep at most these many unused timeouts per Timeouter
+const size_t kMaxFreeTimeouts = 4;
+}
+
+Timeouter::~Timeouter() {
+  UnsetAllTimeouts();
+  for ( size_t i = 0; i < free_timeouts_.size(); ++i ) {
+    delete free_timeouts_[i];
+  }
+  delete callback_;
+}
+
 void Timeouter::SetTimeout(int64 timeout_id, int64 timeout_in_ms) {
-  Closure* closure = NULL;
-  ClosureMap::iterator it = timeout_closures_.find(timeout_id);
-  if ( it != timeout_closures_.end() ) {
-    closure = it->second;
+  Timeout* timeout = NULL;
+  TimeoutMap::iterator it = timeouts_.find(timeout_id);
+  if ( it != timeouts_.end() ) {
+    timeout = it->second;
   } else {
-    closure = NewCallback(this, &Timeouter::TimeoutFunction, timeout_id);
-    timeout_closures_.insert(make_pair(timeout_id, closure));
+    if ( !free_timeouts_.empty() ) {
+      timeout = free_timeouts_.back();
+      free_timeouts_.pop_back();
+    } else {
+      timeout = new Timeout(this);
+    }
+    timeout->id_ = timeout_id;
+    timeouts_.insert(make_pair(timeout_id, timeout));
   }
-  selector_->RegisterAlarm(closure, timeout_in_ms);
+  selector_->RegisterTimer(&timeout->timer_, timeout_in_ms);
 }
 
 bool Timeouter::UnsetTimeout(int64 timeout_id) {
-  ClosureMap::iterator it = timeout_closures_.find(timeout_id);
-  if ( it == timeout_closures_.end() ) {
+  TimeoutMap::iterator it = timeouts_.find(timeout_id);
+  if ( it == timeouts_.end() ) {
     return false;
   }
-  Closure* c = it->second;
-  timeout_closures_.erase(it);
-  delete c;
-  selector_->UnregisterAlarm(c);
+  Timeout* const timeout = it->second;
+  timeouts_.erase(it);
+  selector_->UnregisterTimer(&timeout->timer_);
+  ReleaseTimeout(timeout);
   return true;
 }
 
 void Timeouter::UnsetAllTimeouts() {
-  for ( ClosureMap::iterator it = timeout_closures_.begin();
-        it != timeout_closures_.end(); ++it ) {
-    selector_->UnregisterAlarm(it->second);
-    delete it->second;
+  for ( TimeoutMap::iterator it = timeouts_.begin();
+        it != timeouts_.end(); ++it ) {
+    selector_->UnregisterTimer(&it->second->timer_);
+    ReleaseTimeout(it->second);
+  }
+  timeouts_.clear();
+}
+
+void Timeouter::ReleaseTimeout(Timeout* timeout) {
+  if ( free_timeouts_.size() < kMaxFreeTimeouts ) {
+    free_timeouts_.push_back(timeout);
+  } else {
+    delete timeout;
   }
-  timeout_closures_.clear();
 }
 }  // namespace net
 }  // namespace whisper
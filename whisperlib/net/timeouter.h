@@ -33,6 +33,7 @@
 #define __NET_BASE_TIMEOUTER_H__
 
 #include <map>
+#include <vector>
 #include "whisperlib/net/selector.h"
 #include "whisperlib/base/types.h"
 #include "whisperlib/base/log.h"
@@ -49,13 +50,10 @@ class Timeouter {
   Timeouter(Selector* selector, TimeoutCallback* callback)
       : selector_(selector),
         callback_(callback),
-        timeout_closures_() {
+        timeouts_() {
     CHECK(callback->is_permanent());
   }
-  ~Timeouter() {
-    UnsetAllTimeouts();
-    delete callback_;
-  }
+  ~Timeouter();
 
   // Registers (or reregisters) a timeout call in timeout_in_ms ms from
   // this moment with the given timeout_id.
@@ -70,18 +68,41 @@ class Timeouter {
   void UnsetAllTimeouts();
 
  private:
-  void TimeoutFunction(int64 timeout_id) {
+  // A pending timeout: its selector timer and the permanent closure
+  // that the timer runs. We recycle them, so setting and resetting
+  // timeouts normally allocates nothing.
+  struct Timeout {
+    int64 id_;
+    Closure* const closure_;
+    TimerWheel::Timer timer_;
+    explicit Timeout(Timeouter* timeouter)
+        : id_(0),
+          closure_(NewPermanentCallback(timeouter,
+                                        &Timeouter::TimeoutFunction, this)),
+          timer_(closure_) {
+    }
+    ~Timeout() {
+      delete closure_;
+    }
+  };
+  void TimeoutFunction(Timeout* timeout) {
+    const int64 timeout_id = timeout->id_;
     // First clear the timeout that we got from the map of timeouts !
-    CHECK(timeout_closures_.erase(timeout_id));
+    CHECK(timeouts_.erase(timeout_id));
+    ReleaseTimeout(timeout);
     callback_->Run(timeout_id);
   }
+  // Disposes of a (disarmed) timeout
+  void ReleaseTimeout(Timeout* timeout);
 
   Selector* const selector_;
   TimeoutCallback* const callback_;
 
-  // Timeout callbacks - use them w/ SetTimeout/Unset
-  typedef std::map<int64, Closure*> ClosureMap;
-  ClosureMap timeout_closures_;
+  // Timeouts - use them w/ SetTimeout/Unset
+  typedef std::map<int64, Timeout*> TimeoutMap;
+  TimeoutMap timeouts_;
+  // Unused timeouts, ready for reuse
+  std::vector<Timeout*> free_timeouts_;
 };
 }  // namespace net
 }  // namespace whisper
@@ -0,0 +1,185 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/net/timer_wheel.h"
+
+namespace whisper {
+namespace net {
+
+TimerWheel::TimerWheel(int64 now_ms, int64 granularity_ms)
+    : granularity_ms_(granularity_ms),
+      current_tick_(0),
+      size_(0),
+      owner_thread_(0) {
+  CHECK_GT(granularity_ms_, 0);
+  current_tick_ = now_ms / granularity_ms_;
+}
+
+TimerWheel::~TimerWheel() {
+  CancelAll();
+}
+
+void TimerWheel::Schedule(Timer* timer, int64 when_ms) {
+  if ( timer->wheel_ == NULL ) {
+    timer->wheel_ = this;
+    ++size_;
+  } else {
+    CHECK(timer->wheel_ == this);
+    timer->Unlink();
+  }
+  // Round up - we never fire early
+  int64 expire_tick = when_ms / granularity_ms_;
+  if ( when_ms % granularity_ms_ > 0 ) {
+    ++expire_tick;
+  }
+  timer->expire_tick_ = expire_tick;
+  timer->when_ms_ = when_ms;
+  Place(timer);
+}
+
+bool TimerWheel::Cancel(Timer* timer) {
+  if ( timer->wheel_ == NULL ) {
+    return false;
+  }
+  CHECK(timer->wheel_ == this);
+  timer->Unlink();
+  timer->wheel_ = NULL;
+  --size_;
+  return true;
+}
+
+void TimerWheel::CancelAll() {
+  Link all;
+  for ( int i = 0; i < kRootSize; ++i ) {
+    root_[i].MoveTo(&all);
+  }
+  for ( int l = 0; l < kNumLevels; ++l ) {
+    for ( int i = 0; i < kLevelSize; ++i ) {
+      levels_[l][i].MoveTo(&all);
+    }
+  }
+  expired_.MoveTo(&all);
+  while ( !all.empty() ) {
+    Timer* const timer = static_cast<Timer*>(all.next_);
+    timer->Unlink();
+    timer->wheel_ = NULL;
+  }
+  size_ = 0;
+}
+
+TimerWheel::Timer* TimerWheel::PopExpired(int64 now_ms) {
+  const int64 now_tick = now_ms / granularity_ms_;
+  while ( expired_.empty() && current_tick_ <= now_tick ) {
+    if ( size_ == 0 ) {
+      // nothing to cascade on the way - just jump
+      current_tick_ = now_tick + 1;
+      break;
+    }
+    Tick();
+  }
+  if ( expired_.empty() ) {
+    return NULL;
+  }
+  Timer* const timer = static_cast<Timer*>(expired_.next_);
+  timer->Unlink();
+  timer->wheel_ = NULL;
+  --size_;
+  return timer;
+}
+
+int64 TimerWheel::NextExpiryMs(int64 now_ms, int64 max_ms) const {
+  if ( !expired_.empty() ) {
+    return 0;
+  }
+  if ( size_ == 0 ) {
+    return max_ms;
+  }
+  const int64 end_tick = (now_ms + max_ms) / granularity_ms_;
+  for ( int64 tick = current_tick_; tick <= end_tick; ++tick ) {
+    const int index = tick & (kRootSize - 1);
+    // On a root turn we may cascade something expiring right away
+    if ( index == 0 || !root_[index].empty() ) {
+      const int64 wait_ms = tick * granularity_ms_ - now_ms;
+      return wait_ms < 0 ? 0 : wait_ms;
+    }
+  }
+  return max_ms;
+}
+
+void TimerWheel::Place(Timer* timer) {
+  const int64 delta = timer->expire_tick_ - current_tick_;
+  if ( delta < kRootSize ) {
+    const int64 tick = delta < 0 ? current_tick_ : timer->expire_tick_;
+    root_[tick & (kRootSize - 1)].PushBack(timer);
+    return;
+  }
+  int64 expire_tick = timer->expire_tick_;
+  int l = 0;
+  for ( ; l < kNumLevels - 1; ++l ) {
+    if ( delta < (1LL << (kRootBits + (l + 1) * kLevelBits)) ) {
+      break;
+    }
+  }
+  const int shift = kRootBits + l * kLevelBits;
+  if ( delta >= (1LL << (shift + kLevelBits)) ) {
+    // Too far away - park it in the last slot; when cascaded it gets
+    // placed again, based on its real expiration.
+    expire_tick = current_tick_ + (1LL << (shift + kLevelBits)) - 1;
+  }
+  levels_[l][(expire_tick >> shift) & (kLevelSize - 1)].PushBack(timer);
+}
+
+void TimerWheel::Cascade(int level, int index) {
+  Link to_place;
+  levels_[level][index].MoveTo(&to_place);
+  while ( !to_place.empty() ) {
+    Timer* const timer = static_cast<Timer*>(to_place.next_);
+    timer->Unlink();
+    Place(timer);
+  }
+}
+
+void TimerWheel::Tick() {
+  const int index = current_tick_ & (kRootSize - 1);
+  if ( index == 0 ) {
+    for ( int l = 0; l < kNumLevels; ++l ) {
+      const int level_index =
+          (current_tick_ >> (kRootBits + l * kLevelBits)) & (kLevelSize - 1);
+      Cascade(l, level_index);
+      if ( level_index != 0 ) {
+        break;
+      }
+    }
+  }
+  root_[index].MoveTo(&expired_);
+  ++current_tick_;
+}
+
+}  // namespace net
+}  // namespace whisper
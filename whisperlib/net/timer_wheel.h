@@ -0,0 +1,194 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A hierarchical timing wheel, used by the Selector for its alarms.
+//
+// Time is divided in ticks of granularity_ms. The first level has a slot
+// for each of the next 256 ticks, and each of the next three levels has 64
+// slots, each covering a full turn of the level below. A timer is an
+// intrusive list node, so arming, re-arming and canceling it are O(1) and
+// do not allocate. When a level completes a turn, the next slot of the
+// level above is cascaded (re-distributed) into the lower levels.
+//
+// All the timers expiring in the same tick are fired together, so a larger
+// granularity batches expirations (at the price of precision: a timer may
+// fire up to granularity_ms late, but never early).
+//
+// NOTE: IT IS THREAD-UNSAFE - all the operations on a wheel and its armed
+//       timers (including destroying them) must come from one thread at a
+//       time (see set_owner_thread).
+//
+
+#ifndef __NET_BASE_TIMER_WHEEL_H__
+#define __NET_BASE_TIMER_WHEEL_H__
+
+#include <pthread.h>
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/callback.h"
+
+namespace whisper {
+namespace net {
+
+class TimerWheel {
+ private:
+  // Doubly linked circular list element
+  struct Link {
+    Link* prev_;
+    Link* next_;
+    Link() : prev_(this), next_(this) {}
+    bool empty() const {
+      return next_ == this;
+    }
+    void Unlink() {
+      prev_->next_ = next_;
+      next_->prev_ = prev_;
+      prev_ = next_ = this;
+    }
+    void PushBack(Link* l) {
+      l->prev_ = prev_;
+      l->next_ = this;
+      prev_->next_ = l;
+      prev_ = l;
+    }
+    // Moves all our elements to the back of the given list
+    void MoveTo(Link* l) {
+      if ( empty() ) return;
+      next_->prev_ = l->prev_;
+      prev_->next_ = l;
+      l->prev_->next_ = next_;
+      l->prev_ = prev_;
+      prev_ = next_ = this;
+    }
+  };
+
+ public:
+  // The wheel entry. Embed it in your objects (it does not allocate)
+  // and arm it with TimerWheel::Schedule.
+  class Timer : private Link {
+   public:
+    // callback: what to run on expiration - not owned. The wheel does
+    //   not run it, it only returns the expired timers (see PopExpired).
+    explicit Timer(Closure* callback)
+        : callback_(callback), wheel_(NULL),
+          expire_tick_(0), when_ms_(0) {
+    }
+    // Cancels the timer if armed (which can be done only in the owner
+    // thread of the wheel)
+    ~Timer() {
+      if ( wheel_ != NULL ) {
+        CHECK(wheel_->IsInOwnerThread())
+            << "Armed timer destroyed outside the thread of its wheel";
+        wheel_->Cancel(this);
+      }
+    }
+    Closure* callback() const { return callback_; }
+    void set_callback(Closure* callback) { callback_ = callback; }
+    // If the timer is currently scheduled
+    bool is_armed() const { return wheel_ != NULL; }
+    // When it is supposed to expire (valid only when armed)
+    int64 when_ms() const { return when_ms_; }
+
+   private:
+    Closure* callback_;
+    TimerWheel* wheel_;
+    int64 expire_tick_;
+    int64 when_ms_;
+
+    friend class TimerWheel;
+    DISALLOW_EVIL_CONSTRUCTORS(Timer);
+  };
+
+  // now_ms: the current time, on the same scale as what you pass
+  //   to Schedule / PopExpired (e.g. timer::TicksMsec()).
+  TimerWheel(int64 now_ms, int64 granularity_ms);
+  // Cancels all the remaining timers
+  ~TimerWheel();
+
+  // Arms (or re-arms) the timer to expire at when_ms.
+  // A time in the past makes it expire on the next PopExpired.
+  void Schedule(Timer* timer, int64 when_ms);
+  // Disarms a timer. Returns false if the timer was not armed.
+  bool Cancel(Timer* timer);
+  // Disarms all the timers
+  void CancelAll();
+
+  // Returns (and disarms) the next timer expired at now_ms,
+  // NULL if none. Call it until it returns NULL, running the callbacks of
+  // the returned timers (it is safe to Schedule / Cancel in between).
+  Timer* PopExpired(int64 now_ms);
+
+  // Returns the number of ms from now_ms until the next timer may expire,
+  // at most max_ms. It may return a sooner time (when a higher level
+  // needs cascading), but never a later one.
+  int64 NextExpiryMs(int64 now_ms, int64 max_ms) const;
+
+  int64 granularity_ms() const { return granularity_ms_; }
+  // The thread that uses the wheel (0 - none in particular), checked when
+  // an armed timer is destroyed.
+  void set_owner_thread(pthread_t tid) { owner_thread_ = tid; }
+  bool IsInOwnerThread() const {
+    return owner_thread_ == 0 || pthread_equal(owner_thread_, pthread_self());
+  }
+  // Number of armed timers
+  int64 size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+ private:
+  // Puts an armed timer in the proper slot
+  void Place(Timer* timer);
+  // Redistributes the timers from the given slot of a higher level
+  void Cascade(int level, int index);
+  // Processes the next tick, moving its timers to expired_
+  void Tick();
+
+  static const int kRootBits = 8;
+  static const int kRootSize = 1 << kRootBits;
+  static const int kLevelBits = 6;
+  static const int kLevelSize = 1 << kLevelBits;
+  static const int kNumLevels = 3;   // above the root
+
+  const int64 granularity_ms_;
+  // The next tick to process
+  int64 current_tick_;
+  int64 size_;
+  pthread_t owner_thread_;
+
+  Link root_[kRootSize];
+  Link levels_[kNumLevels][kLevelSize];
+  // timers expired and not yet popped
+  Link expired_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TimerWheel);
+};
+
+}  // namespace net
+}  // namespace whisper
+
+#endif  // __NET_BASE_TIMER_WHEEL_H__
@@ -40,6 +40,14 @@ static const char kRpcErrorCode[] = "X-Rpc-Error";
 static const char kRpcErrorReason[] = "X-Rpc-Reason";
 static const char kRpcHttpIsStreaming[] = "X-Rpc-Streaming";
 static const char kRpcHttpHeartBeat[] = "X-Rpc-Heart-Beat";
+// The call deadline, in milliseconds
+static const char kRpcHttpTimeout[] = "Timeout";
+// Marks a batch of calls, POST-ed to the path of their service: the body is
+// a sequence of tcp::FRAME_REQUEST frames (see rpc_tcp_frames.h), w/ the
+// index of the method in the service as code, and the deadline of the call,
+// if any, under tcp::FLAG_DEADLINE. The reply body has a
+// tcp::FRAME_REPLY or tcp::FRAME_ERROR frame for each call, in order.
+static const char kRpcHttpBatch[] = "X-Rpc-Batch";
 static const char kRpcContentType[] = "application/x-protobuf";
 static const char kRpcErrorContentType[] = "text/plain";
 static const char kRpcGzipEncoding[] = "gzip";
@@ -149,10 +149,58 @@ std::string RequestStatsToHtml(const pb::RequestStats& stat, int64 now_ts, int64
   }
   return s;
 }
+static std::string LatencyToHtml(const pb::LatencyHistogram& stat) {
+  if (stat.count() == 0) {
+    return "-";
+  }
+  return strutil::StringPrintf(
+    "%" PRId64 " / %" PRId64 " / %" PRId64 " / %" PRId64 " / %" PRId64,
+    stat.sum_us() / stat.count(), stat.p50_us(), stat.p99_us(),
+    stat.p999_us(), stat.max_us());
+}
+std::string MethodStatsToHtml(const pb::MethodStats& stat) {
+  std::string errors;
+  for (int i = 0; i < stat.errors_size(); ++i) {
+    errors += strutil::StringPrintf(
+      "%s%s: %" PRId64, errors.empty() ? "" : "<br>",
+      strutil::XmlStrEscape(stat.errors(i).error_name()).c_str(),
+      stat.errors(i).count());
+  }
+  return strutil::StringPrintf(
+    "\n<tr>"
+    "\n  <td %s>%s</td>"           // path
+    "\n  <td %s>%" PRId64 "</td>"  // calls
+    "\n  <td %s>%s</td>"           // errors
+    "\n  <td %s>%s / %s</td>"      // bytes
+    "\n  <td %s>%s</td>"           // queue
+    "\n  <td %s>%s</td>"           // handler
+    "\n  <td %s>%s</td>"           // write
+    "\n</tr>",
+    kStatuszColLine, strutil::XmlStrEscape(stat.path()).c_str(),
+    kStatuszColLine, stat.num_calls(),
+    kStatuszColLine, errors.empty() ? "-" : errors.c_str(),
+    kStatuszColLine, strutil::StrHumanBytes(stat.bytes_in()).c_str(),
+    strutil::StrHumanBytes(stat.bytes_out()).c_str(),
+    kStatuszColLine, LatencyToHtml(stat.queue_time()).c_str(),
+    kStatuszColLine, LatencyToHtml(stat.handler_time()).c_str(),
+    kStatuszColLine, LatencyToHtml(stat.write_time()).c_str());
+}
 std::string ServerStatsToHtml(const pb::ServerStats& stat) {
   std::string s;
   const int64 now = time(NULL);
   s += MachineStatsToHtml(stat.machine_stats());
+  if (stat.method_stats_size()) {
+    s += "\n<h3>Methods:</h3><table cellpadding=\"3\" width=\"80%\">\n";
+    s += "\n<tr bgcolor=\"#e8e0f8\"><th>Method</th><th>Calls</th>"
+      "<th>Errors</th><th>Bytes in / out</th>"
+      "<th>Queue us<br>avg / p50 / p99 / p99.9 / max</th>"
+      "<th>Handler us<br>avg / p50 / p99 / p99.9 / max</th>"
+      "<th>Write us<br>avg / p50 / p99 / p99.9 / max</th></tr>";
+    for (int i = 0; i < stat.method_stats_size(); ++i) {
+      s += MethodStatsToHtml(stat.method_stats(i));
+    }
+    s += "\n</table>";
+  }
   s += strutil::StringPrintf(
     "\n<h3>[%d] Live Requests:</h3><table cellpadding=\"3\" width=\"80%%\">\n",
     stat.live_req_size());
@@ -210,18 +258,27 @@ const char* GetErrorCodeString(rpc::ErrorCode error) {
 Controller::Controller()
   : google::protobuf::RpcController(),
     mutex_(true),
-    transport_(NULL), server_streaming_callback_(NULL) {
+    transport_(NULL), own_transport_(true), server_streaming_callback_(NULL) {
   Reset();
 }
 
 Controller::Controller(Transport* transport)
   : google::protobuf::RpcController(),
     mutex_(true),
-    transport_(NULL), server_streaming_callback_(NULL)  {
+    transport_(NULL), own_transport_(true), server_streaming_callback_(NULL)  {
   Reset();
   transport_ = transport;
 }
 
+Controller::Controller(Transport* transport, bool own_transport)
+  : google::protobuf::RpcController(),
+    mutex_(true),
+    transport_(NULL), own_transport_(true), server_streaming_callback_(NULL)  {
+  Reset();
+  transport_ = transport;
+  own_transport_ = own_transport;
+}
+
 Controller::~Controller() {
   CHECK(cancel_callback_ == NULL);
   Reset();
@@ -236,7 +293,9 @@ void Controller::Reset() {
   error_code_ = rpc::ERROR_NONE;
   error_reason_.clear();
   cancel_callback_ = NULL;
-  delete transport_;
+  if (own_transport_) {
+    delete transport_;
+  }
   transport_ = NULL;
   timeout_ms_ = 0;
   is_urgent_ = false;
@@ -278,6 +337,11 @@ rpc::ErrorCode Controller::GetErrorCode() {
   return error_code_;
 }
 
+const std::string& Controller::GetErrorReason() {
+  synch::MutexLocker l(&mutex_);
+  return error_reason_;
+}
+
 void Controller::SetErrorCode(rpc::ErrorCode code) {
   DCHECK_NE(code, rpc::ERROR_NONE);
   DCHECK_NE(code, rpc::ERROR_CANCELLED);
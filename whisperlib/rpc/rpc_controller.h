@@ -39,7 +39,7 @@
 #include "whisperlib/net/address.h"
 #include <google/protobuf/service.h>
 #include "whisperlib/sync/mutex.h"
-#include <deque>
+#include <list>
 
 namespace whisper {
 namespace net {
@@ -51,10 +51,12 @@ class RequestStats;
 class ServerStats;
 class MachineStats;
 class ClientStats;
+class MethodStats;
 }
 
 std::string MachineStatsToHtml(const pb::MachineStats& stat);
 std::string RequestStatsToHtml(const pb::RequestStats& stat, int64 now_ts, int64 now_sec);
+std::string MethodStatsToHtml(const pb::MethodStats& stat);
 std::string ServerStatsToHtml(const pb::ServerStats& stat);
 std::string ClientStatsToHtml(const pb::ClientStats& stat);
 std::string GetStatuszHeadHtml();
@@ -155,6 +157,8 @@ public:
   Controller();
   // This version is used on the server
   Controller(Transport* transport);
+  // Same, w/ a transport that we do not own (which outlives us)
+  Controller(Transport* transport, bool own_transport);
   virtual ~Controller();
 
   // Resets the rpc::Controller to its initial state so that it may be reused in
@@ -323,6 +327,7 @@ private:
   //   set_server_streaming_callback_se
   mutable synch::Mutex mutex_;
   Transport* transport_;
+  bool own_transport_;
   google::protobuf::Closure* cancel_callback_;
   ErrorCode error_code_;
   std::string error_reason_;
@@ -331,7 +336,8 @@ private:
   bool is_streaming_;
   bool is_finalized_;
   bool compress_transfer_;
-  std::deque<google::protobuf::Message*> streamed_messages_;
+  // (a list, as an empty deque allocates - most calls do not stream)
+  std::list<google::protobuf::Message*> streamed_messages_;
   whisper::Closure* server_streaming_callback_;
   std::string custom_content_type_;
 
@@ -38,6 +38,7 @@
 //
 #include "whisperlib/rpc/rpc_http_client.h"
 
+#include <algorithm>
 #include <google/protobuf/message.h>
 #include <google/protobuf/descriptor.h>
 #include "whisperlib/base/log.h"
@@ -49,6 +50,7 @@
 #include "whisperlib/io/num_streaming.h"
 #include "whisperlib/rpc/rpc_controller.h"
 #include "whisperlib/rpc/rpc_consts.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
 #include "whisperlib/sync/event.h"
 #include "whisperlib/rpc/RpcStats.pb.h"
 
@@ -67,7 +69,15 @@ HttpClient::HttpClient(http::FailSafeClient* failsafe_client,
     xid_(2 + (timer::TicksNsec() % 256)),  // small number over 1 - for differentiation in statusz
     closing_(false),
     stats_msg_text_size_(2048),
-    stats_msg_history_size_(200) {
+    stats_msg_history_size_(200),
+    batch_max_delay_ms_(0),
+    batch_max_calls_(0),
+    batch_max_bytes_(0),
+    pending_batch_(NULL),
+    num_sent_batches_(0),
+    batch_send_callback_(whisper::NewPermanentCallback(
+                           this, &HttpClient::SendBatch)),
+    batch_timer_(batch_send_callback_) {
 }
 
 HttpClient::HttpClient(http::FailSafeClient* failsafe_client,
@@ -86,7 +96,15 @@ HttpClient::HttpClient(http::FailSafeClient* failsafe_client,
     xid_(2 + (timer::TicksNsec() % 256)),  // small number over 1 - for differentiation in statusz
     closing_(false),
     stats_msg_text_size_(2048),
-    stats_msg_history_size_(200) {
+    stats_msg_history_size_(200),
+    batch_max_delay_ms_(0),
+    batch_max_calls_(0),
+    batch_max_bytes_(0),
+    pending_batch_(NULL),
+    num_sent_batches_(0),
+    batch_send_callback_(whisper::NewPermanentCallback(
+                           this, &HttpClient::SendBatch)),
+    batch_timer_(batch_send_callback_) {
 }
 
 HttpClient::~HttpClient() {
@@ -95,6 +113,8 @@ HttpClient::~HttpClient() {
     delete completed_queries_.back();
     completed_queries_.pop_back();
   }
+  delete pending_batch_;
+  delete batch_send_callback_;
   // CHECK(queries_.empty());
 }
 
@@ -133,7 +153,7 @@ void HttpClient::StartClose() {
   }
   failsafe_client_->ForceCloseAll();
 
-  if (to_wait_cancel_.empty()) {
+  if (to_wait_cancel_.empty() && num_sent_batches_ == 0) {
     LOG_INFO << " Done Http Rpc client - deleting self: " << ToString()
              << " canceled: " << to_cancel.size() << " self: " << this;
     selector_->DeleteInSelectLoop(this);
@@ -178,57 +198,41 @@ void HttpClient::CallMethod(const google::protobuf::MethodDescriptor* method,
   //
   rpc::Controller* rpc_controller = reinterpret_cast<rpc::Controller*>(controller);
 
-  VLOG(5) << "Sending request on http path: [" << http_request_path_ << "]";
-  // req will be deleted on CallbackRequestDone
-  const string path(strutil::JoinPaths(http_request_path_, method->name()));
   const int64 xid = GetNextXid();
-  http::ClientRequest* req = new http::ClientRequest(http::METHOD_POST, path);
-  if (req == NULL) {
-    rpc_controller->SetErrorCode(rpc::ERROR_CLIENT);
-    rpc_controller->SetFailed("Error in request allocation");
-    if (done) done->Run();
-    return;
-  }
-  req->set_request_id(xid);
-
-  // write necessary parameters - headers
-  for (size_t i = 0; i != request_headers_.size(); ++i) {
-    req->request()->client_header()->AddField(request_headers_[i].first,
-                                              request_headers_[i].second, true);
-  }
-  if ( !auth_user_.empty() ) {
-    req->request()->client_header()->SetAuthorizationField(auth_user_, auth_pass_);
-  }
-
-  req->request()->set_server_use_gzip_encoding(rpc_controller->compress_transfer(), true);
-
-  req->request()->client_header()->AddField(
-    kRpcHttpXid, sizeof(kRpcHttpXid) - 1,
-    strutil::StringPrintf("%" PRId64, xid), true, true);
-  req->request()->client_header()->AddField(
-    http::kHeaderContentType,
-    sizeof(http::kHeaderContentType) - 1,
-    kRpcContentType, sizeof(kRpcContentType) - 1, true, true);
-  if (rpc_controller->is_streaming()) {
-    req->request()->client_header()->AddField(
-      kRpcHttpIsStreaming, sizeof(kRpcHttpIsStreaming) - 1,
-      strutil::StringPrintf("%d", int(rpc_controller->is_streaming())),
-      true, true);
-    req->request()->client_header()->AddField(
-      kRpcHttpHeartBeat, sizeof(kRpcHttpHeartBeat) - 1,
-      strutil::StringPrintf(
-        "%d", int(failsafe_client_->client_params()->read_timeout_ms_) / 2 / 1000),
+  // Batched calls get their http request when their batch is formed
+  http::ClientRequest* req = NULL;
+  if (batch_max_calls_ == 0 || rpc_controller->is_streaming()) {
+    VLOG(5) << "Sending request on http path: [" << http_request_path_ << "]";
+    // req will be deleted on CallbackRequestDone
+    const string path(strutil::JoinPaths(http_request_path_, method->name()));
+    req = new http::ClientRequest(http::METHOD_POST, path);
+    if (req == NULL) {
+      rpc_controller->SetErrorCode(rpc::ERROR_CLIENT);
+      rpc_controller->SetFailed("Error in request allocation");
+      if (done) done->Run();
+      return;
+    }
+    PrepareHttpRequest(req, xid, rpc_controller->compress_transfer());
+    if (rpc_controller->is_streaming()) {
+      req->request()->client_header()->AddField(
+        kRpcHttpIsStreaming, sizeof(kRpcHttpIsStreaming) - 1,
+        strutil::StringPrintf("%d", int(rpc_controller->is_streaming())),
         true, true);
-  }
-
-  //req->request()->client_header()->AddField(http::kHeaderContentEncoding,
-  //                                          sizeof(http::kHeaderContentEncoding) - 1,
-  //                                          kRpcGzipEncoding, sizeof(kRpcGzipEncoding) - 1,
-  //                                          true, true);
+      req->request()->client_header()->AddField(
+        kRpcHttpHeartBeat, sizeof(kRpcHttpHeartBeat) - 1,
+        strutil::StringPrintf(
+          "%d", int(failsafe_client_->client_params()->read_timeout_ms_) / 2 / 1000),
+          true, true);
+    }
 
+    //req->request()->client_header()->AddField(http::kHeaderContentEncoding,
+    //                                          sizeof(http::kHeaderContentEncoding) - 1,
+    //                                          kRpcGzipEncoding, sizeof(kRpcGzipEncoding) - 1,
+    //                                          true, true);
 
-  // write RPC message
-  io::SerializeProto(request, req->request()->client_data());
+    // write RPC message
+    io::SerializeProto(request, req->request()->client_data());
+  }
 
   google::protobuf::Closure* const cancel_callback =
     google::protobuf::internal::NewCallback(
@@ -262,6 +266,30 @@ void HttpClient::CallMethod(const google::protobuf::MethodDescriptor* method,
   delete done_ev;
 }
 
+void HttpClient::PrepareHttpRequest(http::ClientRequest* req, int64 xid,
+                                    bool compress_transfer) {
+  req->set_request_id(xid);
+
+  // write necessary parameters - headers
+  for (size_t i = 0; i != request_headers_.size(); ++i) {
+    req->request()->client_header()->AddField(request_headers_[i].first,
+                                              request_headers_[i].second, true);
+  }
+  if ( !auth_user_.empty() ) {
+    req->request()->client_header()->SetAuthorizationField(auth_user_, auth_pass_);
+  }
+
+  req->request()->set_server_use_gzip_encoding(compress_transfer, true);
+
+  req->request()->client_header()->AddField(
+    kRpcHttpXid, sizeof(kRpcHttpXid) - 1,
+    strutil::StringPrintf("%" PRId64, xid), true, true);
+  req->request()->client_header()->AddField(
+    http::kHeaderContentType,
+    sizeof(http::kHeaderContentType) - 1,
+    kRpcContentType, sizeof(kRpcContentType) - 1, true, true);
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void HttpClient::StartRequest(HttpClient::QueryStruct* qs) {
@@ -270,6 +298,7 @@ void HttpClient::StartRequest(HttpClient::QueryStruct* qs) {
   } else {
     mutex_.Lock();
     string error;
+    bool batched = false;
     if (closing_) {
       error = "We are closing the client";
     } else {
@@ -287,6 +316,9 @@ void HttpClient::StartRequest(HttpClient::QueryStruct* qs) {
               &http::ClientStreamReceiverProtocol::BeginStreamReceiving,
               qs->req_, qs->stream_callback_));
         }
+      } else if (qs->req_ == NULL) {
+        qs->started_ = true;
+        batched = true;
       } else {
         qs->started_ = true;
         Closure* const req_done_callback = whisper::NewCallback(
@@ -307,8 +339,200 @@ void HttpClient::StartRequest(HttpClient::QueryStruct* qs) {
       done->Run();
     } else {
       mutex_.Unlock();
+      if (batched) {
+        AddToBatch(qs);
+      }
+    }
+  }
+}
+
+void HttpClient::AddToBatch(HttpClient::QueryStruct* qs) {
+  DCHECK(selector_->IsInSelectThread());
+  if (pending_batch_ == NULL) {
+    http::ClientRequest* const req =
+      new http::ClientRequest(http::METHOD_POST, http_request_path_);
+    PrepareHttpRequest(req, qs->xid_, qs->controller_->compress_transfer());
+    pending_batch_ = new Batch(req);
+    if (batch_max_delay_ms_ > 0) {
+      selector_->RegisterTimer(&batch_timer_, batch_max_delay_ms_);
+    } else {
+      // after the callbacks already queued for this loop iteration
+      selector_->RunInSelectLoop(batch_send_callback_);
+    }
+  }
+  Batch* const batch = pending_batch_;
+  io::MemoryStream* const out = batch->req_->request()->client_data();
+  const int64 timeout_ms = qs->controller_->timeout_ms();
+  if (!tcp::WriteRequestFrame(0, qs->method_->index(), qs->xid_,
+                              timeout_ms > 0 ? uint32(timeout_ms) : 0,
+                              *qs->request_, out)) {
+    UnregisterQuery(qs);
+    qs->controller_->SetErrorCode(rpc::ERROR_CLIENT);
+    qs->controller_->SetFailed("Uninitialized request: " +
+                               qs->request_->InitializationErrorString());
+    CompleteQuery(qs);
+    return;
+  }
+  qs->batch_ = batch;
+  batch->queries_.push_back(qs);
+  if (timeout_ms > 0) {
+    qs->deadline_callback_ = whisper::NewPermanentCallback(
+      this, &rpc::HttpClient::CallbackBatchedDeadline, qs);
+    qs->deadline_timer_.set_callback(qs->deadline_callback_);
+    selector_->RegisterTimer(&qs->deadline_timer_, timeout_ms);
+  }
+  batch->urgent_ = batch->urgent_ || qs->controller_->is_urgent();
+  if (batch->urgent_ ||
+      batch->queries_.size() >= batch_max_calls_ ||
+      (batch_max_bytes_ > 0 && out->Size() >= batch_max_bytes_)) {
+    SendBatch();
+  }
+}
+
+void HttpClient::SendBatch() {
+  DCHECK(selector_->IsInSelectThread());
+  Batch* const batch = pending_batch_;
+  if (batch == NULL) {
+    return;
+  }
+  pending_batch_ = NULL;
+  selector_->UnregisterTimer(&batch_timer_);
+  if (batch->queries_.empty()) {
+    delete batch;   // all failed or cancelled
+    return;
+  }
+  http::Header* const header = batch->req_->request()->client_header();
+  header->AddField(kRpcHttpBatch, sizeof(kRpcHttpBatch) - 1,
+                   strutil::StringPrintf("%d", int(batch->queries_.size())),
+                   true, true);
+  batch->sent_ = true;
+  ++num_sent_batches_;
+  failsafe_client_->StartRequestWithUrgency(
+    batch->req_,
+    whisper::NewCallback(this, &rpc::HttpClient::CallbackBatchDone, batch),
+    batch->urgent_);
+}
+
+void HttpClient::CallbackBatchDone(HttpClient::Batch* batch) {
+  DCHECK(selector_->IsInSelectThread());
+  --num_sent_batches_;
+  std::vector<QueryStruct*> queries;
+  queries.swap(batch->queries_);
+  for (size_t i = 0; i < queries.size(); ++i) {
+    queries[i]->batch_ = NULL;
+    selector_->UnregisterTimer(&queries[i]->deadline_timer_);
+    UnregisterQuery(queries[i]);
+  }
+  const http::ClientError cli_error = batch->req_->error();
+  const http::HttpReturnCode ret_code =
+      batch->req_->request()->server_header()->status_code();
+  io::MemoryStream* const in = batch->req_->request()->server_data();
+  if (cli_error != http::CONN_OK) {
+    LOG_WARN << "Network Error: batch of " << queries.size() << " calls on "
+             << http_request_path_ << " : " << http::ClientErrorName(cli_error);
+    for (size_t i = 0; i < queries.size(); ++i) {
+      queries[i]->controller_->SetErrorCode(rpc::ERROR_NETWORK);
+      queries[i]->controller_->SetFailed(
+        std::string(http::ClientErrorName(cli_error)) + " / Http Client Error");
+    }
+  } else if (ret_code != http::OK) {
+    ErrorCode error_code = rpc::ERROR_SERVER;
+    if (ret_code == http::UNKNOWN) {
+      error_code = rpc::ERROR_NETWORK;
+    } else if (ret_code >= 400 && ret_code < 500) {
+      error_code = rpc::ERROR_USER;
+    }
+    LOG_WARN << "Server Http Error: batch of " << queries.size()
+             << " calls on " << http_request_path_ << ": "
+             << http::GetHttpReturnCodeName(ret_code);
+    const std::string reason(in->ToString() + " / Http Server Error: " +
+                             http::GetHttpReturnCodeName(ret_code));
+    for (size_t i = 0; i < queries.size(); ++i) {
+      queries[i]->controller_->SetErrorCode(error_code);
+      queries[i]->controller_->SetFailed(reason);
+    }
+    if ( error_code != rpc::ERROR_NETWORK ) {
+      failsafe_client_->Reset();
+    }
+  } else {
+    // The replies come in the order of the calls - w/ the ones of the
+    // calls cancelled meanwhile, which we skip.
+    size_t next = 0;
+    tcp::FrameHeader header;
+    while (tcp::PeekFrameHeader(*in, &header) &&
+           in->Size() >= tcp::kFrameHeaderSize + header.length_) {
+      in->Skip(tcp::kFrameHeaderSize);
+      QueryStruct* qs = NULL;
+      if (next < queries.size() && queries[next]->xid_ == header.xid_) {
+        qs = queries[next++];
+      }
+      if (qs == NULL) {
+        in->Skip(header.length_);
+      } else if (header.type_ == tcp::FRAME_REPLY) {
+        if (!tcp::ReadMessagePayload(in, header.length_, qs->response_)) {
+          qs->controller_->SetErrorCode(rpc::ERROR_PARSE);
+          LOG_WARN << "Parsing Response Error: req[" << ToString(qs)
+                   << "] size:" << header.length_;
+        }
+      } else if (header.type_ == tcp::FRAME_ERROR) {
+        std::string reason;
+        in->ReadString(&reason, header.length_);
+        qs->controller_->SetErrorCode(
+          static_cast<rpc::ErrorCode>(header.code_));
+        qs->controller_->SetFailed(reason);
+      } else {
+        in->Skip(header.length_);
+        qs->controller_->SetErrorCode(rpc::ERROR_PARSE);
+      }
+    }
+    in->Clear();
+    for (; next < queries.size(); ++next) {
+      LOG_WARN << "No reply in the batch for: req["
+               << ToString(queries[next]) << "]";
+      queries[next]->controller_->SetErrorCode(rpc::ERROR_PARSE);
     }
   }
+  delete batch;
+
+  const bool delete_self =
+    closing_ && num_sent_batches_ == 0 && to_wait_cancel_.empty();
+  for (size_t i = 0; i < queries.size(); ++i) {
+    CompleteQuery(queries[i]);
+  }
+  if (delete_self) {
+    DLOG_INFO << " Done Http Rpc client - deleting self: " << ToString();
+    selector_->DeleteInSelectLoop(this);
+  }
+}
+
+void HttpClient::CancelBatchedQuery(HttpClient::QueryStruct* qs) {
+  Batch* const batch = qs->batch_;
+  batch->queries_.erase(std::find(batch->queries_.begin(),
+                                  batch->queries_.end(), qs));
+  qs->batch_ = NULL;
+  selector_->UnregisterTimer(&qs->deadline_timer_);
+  if (batch->queries_.empty()) {
+    // Nobody waits for this batch anymore
+    if (!batch->sent_) {
+      pending_batch_ = NULL;
+      selector_->UnregisterTimer(&batch_timer_);
+      delete batch;
+    } else if (failsafe_client_->CancelRequest(batch->req_)) {
+      --num_sent_batches_;
+      delete batch;
+    }  // else CallbackBatchDone gets it
+  }
+  UnregisterQuery(qs);
+  CompleteQuery(qs);
+}
+
+void HttpClient::CallbackBatchedDeadline(HttpClient::QueryStruct* qs) {
+  DCHECK(selector_->IsInSelectThread());
+  LOG_WARN << "Timeout of " << qs->controller_->timeout_ms()
+           << " ms expired for batched req[" << ToString(qs) << "]";
+  qs->controller_->SetErrorCode(rpc::ERROR_NETWORK);
+  qs->controller_->SetFailed("Timeout / Http Client Error");
+  CancelBatchedQuery(qs);
 }
 
 void HttpClient::CallbackCancelRequested(int64 xid) {
@@ -333,6 +557,7 @@ HttpClient::QueryStruct::QueryStruct(http::ClientRequest* req,
     xid_(xid),
     method_(method),
     controller_(controller),
+    request_(request),
     response_(response),
     done_(done),
     cancel_callback_(cancel_callback),
@@ -341,10 +566,14 @@ HttpClient::QueryStruct::QueryStruct(http::ClientRequest* req,
     protocol_(NULL),
     stream_callback_(NULL),
     next_message_size_(-1),
+    batch_(NULL),
+    deadline_callback_(NULL),
+    deadline_timer_(NULL),
     stats_(new pb::RequestStats()) {
   stats_->set_peer_address(method->name());
   stats_->set_start_time_ts(timer::TicksNsec());
-  stats_->set_method_txt(req->name() + strutil::StringPrintf(" / xid: %" PRId64, xid));
+  stats_->set_method_txt((req != NULL ? req->name() : "batched " + method->name()) +
+                         strutil::StringPrintf(" / xid: %" PRId64, xid));
   if (controller->is_streaming()) {
     stats_->set_is_streaming(true);
   }
@@ -355,20 +584,27 @@ HttpClient::QueryStruct::QueryStruct(http::ClientRequest* req,
   }
   stats_->set_response_type_name(response->GetDescriptor()->full_name());
 }
+HttpClient::Batch::~Batch() {
+  delete req_;
+}
+
 HttpClient::QueryStruct::~QueryStruct() {
   delete req_;
   delete cancel_callback_;
   delete protocol_;
   delete stream_callback_;
+  delete deadline_callback_;
   delete stats_;
 }
 
 pb::RequestStats* HttpClient::QueryStruct::GrabStats(size_t limit_print) {
-  stats_->set_server_size(req_->request()->stats().server_size_ +
-                          req_->request()->server_data()->Size());
-  stats_->set_server_raw_size(req_->request()->stats().server_raw_size_);
-  stats_->set_client_size(req_->request()->stats().client_size_);
-  stats_->set_client_raw_size(req_->request()->stats().client_raw_size_);
+  if (req_ != NULL) {
+    stats_->set_server_size(req_->request()->stats().server_size_ +
+                            req_->request()->server_data()->Size());
+    stats_->set_server_raw_size(req_->request()->stats().server_raw_size_);
+    stats_->set_client_size(req_->request()->stats().client_size_);
+    stats_->set_client_raw_size(req_->request()->stats().client_raw_size_);
+  }
 
   stats_->set_response_time_ts(timer::TicksNsec());
   stats_->set_response_size(response_->ByteSize());
@@ -403,6 +639,11 @@ bool HttpClient::CancelRequestVerified(int64 xid) {
   CHECK(!qs->cancelled_);
   qs->cancelled_ = true;
 
+  if (qs->batch_ != NULL) {
+    CancelBatchedQuery(qs);
+    return true;
+  }
+
   if (qs->started_) {
     if (qs->protocol_) {
       delete qs->protocol_;   // clears the request
@@ -481,19 +722,10 @@ bool HttpClient::CallbackRequestStream(HttpClient::QueryStruct* qs) {
 
 void HttpClient::CallbackRequestDone(HttpClient::QueryStruct* qs) {
   DCHECK(selector_->IsInSelectThread());
-  mutex_.Lock();
   // LOG_INFO
   //   << "Callback done request: " << qs->xid_ << " / " << ToString() << " / "
   //   << qs->cancelled_ << " // " << qs->req_->name() << " / queue size: " << queries_.size();
-  CHECK(queries_.erase(qs->xid_));
-
-  // From this moment the request cannot be canceled
-  qs->controller_->NotifyOnCancel(NULL);
-  delete qs->cancel_callback_;
-  qs->cancel_callback_ = NULL;
-  qs->controller_->set_is_finalized();
-
-  mutex_.Unlock();
+  UnregisterQuery(qs);
   bool delete_self = false;
   if ( !qs->cancelled_ ) {
     const http::ClientError cli_error = qs->req_->error();
@@ -540,12 +772,36 @@ void HttpClient::CallbackRequestDone(HttpClient::QueryStruct* qs) {
       }
     }
   } else {
-    qs->req_->request()->server_data()->Clear();
+    if (qs->req_ != NULL) {
+      qs->req_->request()->server_data()->Clear();
+    }
     if (!to_wait_cancel_.empty()) {
       to_wait_cancel_.erase(qs->xid_);
-      delete_self = to_wait_cancel_.empty();
+      delete_self = to_wait_cancel_.empty() && num_sent_batches_ == 0;
     }
   }
+  CompleteQuery(qs);
+
+  if (delete_self) {
+    DLOG_INFO << " Done Http Rpc client - deleting self: " << ToString();
+    selector_->DeleteInSelectLoop(this);
+  }
+}
+
+void HttpClient::UnregisterQuery(HttpClient::QueryStruct* qs) {
+  mutex_.Lock();
+  CHECK(queries_.erase(qs->xid_));
+
+  // From this moment the request cannot be canceled
+  qs->controller_->NotifyOnCancel(NULL);
+  delete qs->cancel_callback_;
+  qs->cancel_callback_ = NULL;
+  qs->controller_->set_is_finalized();
+
+  mutex_.Unlock();
+}
+
+void HttpClient::CompleteQuery(HttpClient::QueryStruct* qs) {
   mutex_.Lock();
   completed_queries_.push_front(qs->GrabStats(stats_msg_text_size_));
   while (completed_queries_.size() > stats_msg_history_size_) {
@@ -556,11 +812,6 @@ void HttpClient::CallbackRequestDone(HttpClient::QueryStruct* qs) {
 
   qs->done_->Run();
   delete qs;
-
-  if (delete_self) {
-    DLOG_INFO << " Done Http Rpc client - deleting self: " << ToString();
-    selector_->DeleteInSelectLoop(this);
-  }
 }
 }  // namespace rpc
 }  // namespace whisper
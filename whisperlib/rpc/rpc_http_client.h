@@ -48,6 +48,7 @@
 #include "whisperlib/base/types.h"
 #include "whisperlib/base/callback.h"
 #include "whisperlib/sync/mutex.h"
+#include "whisperlib/net/timer_wheel.h"
 #include <google/protobuf/service.h>
 #include "whisperlib/base/hash.h"
 #include WHISPER_HASH_SET_HEADER
@@ -145,6 +146,24 @@ class HttpClient : public google::protobuf::RpcChannel {
   }
   void GetClientStats(pb::ClientStats* stats) const;
 
+  // Turns on batching: the (non streaming) calls issued within
+  // max_delay_ms of the first pending one are sent in a single http
+  // request, of at most max_calls calls and about max_bytes of encoded
+  // requests (rpc::HttpServer splits it - see kRpcHttpBatch). With a 0
+  // max_delay_ms the calls issued in the same select loop iteration go
+  // together. A 0 max_bytes puts no limit on the size. Urgent calls send
+  // the pending batch right away.
+  // The calls still complete, and can be cancelled, one by one - but, as
+  // for any http call, a cancel does not reach the server, which replies
+  // to a batch when all its calls are done. Each call gets its own timeout
+  // (Controller::timeout_ms), which is sent to the server, and fails
+  // it w/ ERROR_NETWORK when expired. Set it before issuing any call.
+  void set_batching(int64 max_delay_ms, size_t max_calls, size_t max_bytes) {
+    batch_max_delay_ms_ = max_delay_ms;
+    batch_max_calls_ = max_calls;
+    batch_max_bytes_ = max_bytes;
+  }
+
 private:
   // We set this callback as cancel callback for the rpc controller this function.
   void CallbackCancelRequested(int64 xid);
@@ -157,13 +176,15 @@ private:
 
   //////////////////////////////////////////////////////////////////////
 
+  struct Batch;
   // Structure that wraps an RPC query request to the server
   struct QueryStruct {
-    http::ClientRequest* const req_;
+    http::ClientRequest* const req_;      // NULL when batched
     const int64 xid_;
 
     const google::protobuf::MethodDescriptor* const method_;
     rpc::Controller* const controller_;
+    const google::protobuf::Message* const request_;
     google::protobuf::Message* const response_;
     google::protobuf::Closure* done_;
     google::protobuf::Closure* cancel_callback_;
@@ -172,6 +193,10 @@ private:
     http::ClientStreamReceiverProtocol* protocol_;
     whisper::ResultClosure<bool>* stream_callback_;
     int32 next_message_size_;
+    Batch* batch_;     // the batch we are in, until completed
+    // Fails the batched call on its timeout
+    Closure* deadline_callback_;
+    net::TimerWheel::Timer deadline_timer_;
 
     pb::RequestStats* stats_;
 
@@ -188,12 +213,40 @@ private:
     pb::RequestStats* GrabStats(size_t limit_print);
   };
 
+  // Calls sent in one http request (see set_batching)
+  struct Batch {
+    explicit Batch(http::ClientRequest* req)
+      : req_(req), urgent_(false), sent_(false) {
+    }
+    ~Batch();
+    http::ClientRequest* const req_;
+    std::vector<QueryStruct*> queries_;    // not completed yet
+    bool urgent_;
+    bool sent_;
+  };
+
   // Debug string for a query
   std::string ToString(const QueryStruct* qs) const;
 
+  // Sets the headers common to all our http requests
+  void PrepareHttpRequest(http::ClientRequest* req, int64 xid,
+                          bool compress_transfer);
+
   // Actually starts the RPC from the select thread
   void StartRequest(QueryStruct* qs);
 
+  // Batching: adds a call to the pending batch, and sends the batch
+  // when full (or when batch_timer_ fires)
+  void AddToBatch(QueryStruct* qs);
+  void SendBatch();
+  // Called when the http request of a batch completes
+  void CallbackBatchDone(Batch* batch);
+  // Takes a batched call out of its batch, and completes it right away
+  // (cancelled or failed)
+  void CancelBatchedQuery(QueryStruct* qs);
+  // Fails a batched call on its timeout
+  void CallbackBatchedDeadline(QueryStruct* qs);
+
   // Cancels an RPC from the selector thread
   void CancelRequest(int64 xid);   // non bool returning (can be used for Closures)
   bool CancelRequestVerified(int64 xid);    // if one wants the return value
@@ -204,6 +257,11 @@ private:
   // when launching the query (you probably want to delete it).
   void CallbackRequestDone(QueryStruct* qs);
 
+  // Takes a completed query out of queries_ - it cannot be canceled anymore
+  void UnregisterQuery(QueryStruct* qs);
+  // Registers the stats of a query, runs its done callback and deletes it
+  void CompleteQuery(QueryStruct* qs);
+
   // For streaming requests, this will be called when some new data is available.
   bool CallbackRequestStream(HttpClient::QueryStruct* qs);
 
@@ -233,6 +291,15 @@ private:
   // Save at most these many bytes from response / reply
   size_t stats_msg_text_size_;
   size_t stats_msg_history_size_;
+
+  // Batching parameters (off for 0 batch_max_calls_) and state
+  int64 batch_max_delay_ms_;
+  size_t batch_max_calls_;
+  size_t batch_max_bytes_;
+  Batch* pending_batch_;
+  int num_sent_batches_;      // w/ the http request in progress
+  Closure* const batch_send_callback_;
+  net::TimerWheel::Timer batch_timer_;
  private:
   DISALLOW_EVIL_CONSTRUCTORS(HttpClient);
 };
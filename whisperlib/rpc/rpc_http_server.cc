@@ -40,8 +40,10 @@
 #include "whisperlib/base/log.h"
 #include "whisperlib/base/core_errno.h"
 #include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
 #include "whisperlib/rpc/rpc_consts.h"
 #include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
 #include "whisperlib/io/buffer/protobuf_stream.h"
 #include "whisperlib/io/ioutil.h"
 #include "whisperlib/http/http_server_protocol.h"
@@ -96,7 +98,10 @@ HttpServer::HttpServer(http::Server* server,
     stream_proto_error_close_(false),
     stats_msg_text_size_(2048),
     stats_msg_history_size_(200),
+    stats_msg_sample_every_(100),
     num_current_requests_(0),
+    live_requests_(NULL),
+    num_completed_requests_(0),
     http_server_(server) {
   http_server_->RegisterProcessor(path_,
                                   NewPermanentCallback(this, &HttpServer::ProcessRequest),
@@ -128,6 +133,9 @@ bool HttpServer::RegisterService(const string& sub_path,
     LOG_WARN << " Tried to double register " << full_path;
     return false;
   }
+  if ( !methods_.Add(full_path, service) ) {
+    return false;
+  }
   LOG_INFO << " Registering: " << full_name << " on path: " << full_path;
   services_.insert(make_pair(full_path, service));
   return true;
@@ -151,6 +159,7 @@ bool HttpServer::UnregisterService(const string& sub_path,
     return false;
   }
   services_.erase(full_path);
+  methods_.Remove(full_path, service);
   return true;
 }
 
@@ -174,6 +183,7 @@ void HttpServer::ProcessRpcStatusRequest(http::ServerRequest* req) {
   req->ReplyWithStatus(http::OK);
 }
 void HttpServer::ProcessRequest(http::ServerRequest* req) {
+  const int64 received_ns = timer::TicksNsec();
   const string req_id =
     req->request()->client_header()->FindField(http::kHeaderXRequestId);
   if ( !req_id.empty() ) {
@@ -208,45 +218,42 @@ void HttpServer::ProcessRequest(http::ServerRequest* req) {
     << "], sub_path: [" << sub_path << "]"
     << " client url: " << req->request()->client_header()->uri();
 
-  // sub_path should be "a/b/c/service_name/method_name"
-  //
-  // We extract:
-  //   service_full_path = "a/b/c/service_name"
-  //   service_path = "a/b/c";
-  //   service_name = "service_name";
-  //   method_name = "method_name";
-  //
-  string service_full_path;
-  string method_name;
-  size_t last_slash_index = sub_path.rfind('/');
-  if ( last_slash_index == std::string::npos ) {
-    service_full_path = sub_path;
-  } else {
-    service_full_path = sub_path.substr(0, last_slash_index);
-    method_name = sub_path.substr(last_slash_index + 1);
-  }
-
-  mutex_.Lock();
-  ServicesMap::const_iterator it = services_.find(service_full_path);
-  google::protobuf::Service* service = (it == services_.end() ? NULL : it->second);
-  mutex_.Unlock();
-
-  if (service == NULL) {
-    RegisterErrorRequest(service_full_path + " - unknown service.", req, peer_address);
-    // LOG_ERROR << "Unknown service: " << service_full_path;
-    // TODO(cpopescu): stats
-    ReplyToRequest(req, http::NOT_FOUND, NULL, kRpcErrorServiceNotFound);
+  // For batches, sub_path is that of the service: "a/b/c/service_name"
+  if ( req->request()->client_header()->HasField(kRpcHttpBatch) ) {
+    ProcessBatchRequest(req, sub_path, peer_address, received_ns);
     return;
   }
 
-  // maybe process auto-forms request -- TODO(cpopescu)
-  const google::protobuf::MethodDescriptor* const method =
-    service->GetDescriptor()->FindMethodByName(method_name);
+  // sub_path should be "a/b/c/service_name/method_name", which is
+  // directly the path of a registered method
+  RegisteredMethod* const method = methods_.Find(sub_path);
   if (method == NULL) {
-    RegisterErrorRequest(method_name + " - unknown method for service: " + service_full_path,
-                         req, peer_address);
-    // TODO(cpopescu): stats
-    ReplyToRequest(req, http::NOT_FOUND, NULL, kRpcErrorMethodNotFound);
+    // We extract:
+    //   service_full_path = "a/b/c/service_name"
+    //   method_name = "method_name";
+    // to tell what's missing
+    string service_full_path;
+    string method_name;
+    size_t last_slash_index = sub_path.rfind('/');
+    if ( last_slash_index == std::string::npos ) {
+      service_full_path = sub_path;
+    } else {
+      service_full_path = sub_path.substr(0, last_slash_index);
+      method_name = sub_path.substr(last_slash_index + 1);
+    }
+    mutex_.Lock();
+    const bool has_service = services_.find(service_full_path) != services_.end();
+    mutex_.Unlock();
+    if (!has_service) {
+      RegisterErrorRequest(service_full_path + " - unknown service.", req, peer_address);
+      // TODO(cpopescu): stats
+      ReplyToRequest(req, http::NOT_FOUND, NULL, kRpcErrorServiceNotFound);
+    } else {
+      RegisterErrorRequest(method_name + " - unknown method for service: " + service_full_path,
+                           req, peer_address);
+      // TODO(cpopescu): stats
+      ReplyToRequest(req, http::NOT_FOUND, NULL, kRpcErrorMethodNotFound);
+    }
     return;
   }
 
@@ -257,7 +264,8 @@ void HttpServer::ProcessRequest(http::ServerRequest* req) {
     RegisterErrorRequest(strutil::StringPrintf(
                            "Too many concurrent requests: %d",
                            num_current_requests_), req, peer_address);
-    // TODO(cpopescu): stats
+    method->stats_.RecordCall(ERROR_SERVER, req->request()->stats().client_size_,
+                              0, -1, -1, -1);
     ReplyToRequest(req, http::INTERNAL_SERVER_ERROR, NULL, kRpcErrorServerOverloaded);
     return;
   }
@@ -267,9 +275,9 @@ void HttpServer::ProcessRequest(http::ServerRequest* req) {
     req->AuthenticateRequest(
       authenticator_,
       whisper::NewCallback(this, &HttpServer::ProcessAuthenticatedRequest,
-                           req, service, method));
+                           req, method, received_ns));
   } else {
-    ProcessAuthenticatedRequest(req, service, method,
+    ProcessAuthenticatedRequest(req, method, received_ns,
                                 net::UserAuthenticator::Authenticated);
   }
 }
@@ -278,44 +286,50 @@ void HttpServer::ProcessRequest(http::ServerRequest* req) {
 
 void HttpServer::ProcessAuthenticatedRequest(
   http::ServerRequest* req,
-  google::protobuf::Service* service,
-  const google::protobuf::MethodDescriptor* method,
+  RegisteredMethod* method,
+  int64 received_ns,
   net::UserAuthenticator::Answer auth_answer) {
   if ( !req->net_selector()->IsInSelectThread() ) {
     req->net_selector()->RunInSelectLoop(
       whisper::NewCallback(this, &HttpServer::ProcessAuthenticatedRequest,
-                           req, service, method, auth_answer));
+                           req, method, received_ns, auth_answer));
     return;
   }
   net::HostPort peer_address(GetRemoteAddress(req));
   if ( auth_answer != net::UserAuthenticator::Authenticated ) {
     RegisterErrorRequest(std::string("Unauthenticated request: ") +
                          net::UserAuthenticator::AnswerName(auth_answer), req, peer_address);
+    method->stats_.RecordCall(ERROR_USER, req->request()->stats().client_size_,
+                              0, -1, -1, -1);
     req->AnswerUnauthorizedRequest(authenticator_);
     return;
   }
 
   // Authenticated - OK !
   // read RPC packet from HTTP GET or POST
-  google::protobuf::Message* request =
-    service->GetRequestPrototype(method).New();
+  google::protobuf::Message* request = method->request_pool_.New();
 
   const char* error_reason = NULL;
+  int64 request_size = 0;
   if ( req->request()->client_header()->method() == http::METHOD_GET ) {
     // is HTTP GET enabled for rpc ?
     if ( !FLAGS_rpc_enable_http_get ) {
       error_reason = kRpcErrorMethodNotSupported;
-    } else if (!request->ParseFromString(
-                 URL::UrlUnescape(req->request()->url()->query()))) {
-      error_reason = kRpcErrorBadEncoded;
+    } else {
+      const std::string encoded(URL::UrlUnescape(req->request()->url()->query()));
+      request_size = encoded.size();
+      if (!request->ParseFromString(encoded)) {
+        error_reason = kRpcErrorBadEncoded;
+      }
     }
   } else if ( req->request()->client_header()->method() == http::METHOD_POST ) {
+    request_size = req->request()->client_data()->Size();
     if (!io::ParseProto(request, req->request()->client_data())) {
       error_reason = kRpcErrorBadEncoded;
     }
   } else if ( req->request()->client_header()->method() ==
               http::METHOD_OPTIONS ) {
-    delete request;
+    method->request_pool_.Release(request, 0);
     ReplyToRequest(req, http::OK, NULL, NULL);
     return;
   } else {
@@ -324,15 +338,17 @@ void HttpServer::ProcessAuthenticatedRequest(
   if (error_reason != NULL) {
     std::string error_str(std::string("Bad request: http method: ")
                           + http::GetHttpMethodName(req->request()->client_header()->method())
-                          + " service:  " + service->GetDescriptor()->full_name()
-                          + " method: " + method->full_name()
+                          + " service:  " + method->service_->GetDescriptor()->full_name()
+                          + " method: " + method->method_->full_name()
                           + " reason: " + error_reason);
     RegisterErrorRequest(error_str, req, peer_address);
-    delete request;
+    method->stats_.RecordCall(ERROR_USER, req->request()->stats().client_size_,
+                              0, -1, -1, -1);
+    method->request_pool_.Release(request, 0);
     ReplyToRequest(req, http::BAD_REQUEST, NULL, error_reason);
     return;
   }
-  StartProcessing(req, service, method, request);
+  StartProcessing(req, method, received_ns, request, request_size);
 }
 
 ////////////////////////////////////////////////////////////////////
@@ -351,27 +367,28 @@ net::HostPort HttpServer::GetRemoteAddress(http::ServerRequest* req) {
 }
 
 void HttpServer::StartProcessing(http::ServerRequest* req,
-                                 google::protobuf::Service* service,
-                                 const google::protobuf::MethodDescriptor* method,
-                                 google::protobuf::Message* request) {
+                                 RegisteredMethod* method,
+                                 int64 received_ns,
+                                 google::protobuf::Message* request,
+                                 int64 request_size) {
   net::HostPort peer_address(GetRemoteAddress(req));
   if (peer_address.IsInvalid()) {
     RegisterErrorRequest("Invalid peer address", req, peer_address);
-    delete request;
+    method->stats_.RecordCall(ERROR_USER, req->request()->stats().client_size_,
+                              0, -1, -1, -1);
+    method->request_pool_.Release(request, request_size);
     ReplyToRequest(req, http::BAD_REQUEST, NULL, kRpcErrorBadProxyHeader);
     return;
   }
 
-  rpc::Transport* transport = new rpc::Transport(req->net_selector(),
-                                                 rpc::Transport::HTTP,
-                                                 net::HostPort(),
-                                                 peer_address);
+  RpcData* const rpc_data = new RpcData(this, req, method, peer_address,
+                                        request, request_size, received_ns);
   if ( authenticator_ != NULL ) {
     req->request()->client_header()->GetAuthorizationField(
-      transport->mutable_user(), transport->mutable_passwd());
+      rpc_data->transport_.mutable_user(), rpc_data->transport_.mutable_passwd());
   }
 
-  rpc::Controller* const controller = new rpc::Controller(transport);
+  rpc::Controller* const controller = &rpc_data->controller_;
   string is_streaming;
   int heart_beat_ms = kRpcDefaultHeartBeat * 1000;
   if ( req->request()->client_header()->FindField(kRpcHttpIsStreaming, &is_streaming) ) {
@@ -390,7 +407,8 @@ void HttpServer::StartProcessing(http::ServerRequest* req,
 
   // Any timeouts ?
   string timeout_str;
-  if ( req->request()->client_header()->FindField("Timeout", &timeout_str) ) {
+  if ( req->request()->client_header()->FindField(kRpcHttpTimeout,
+                                                  &timeout_str) ) {
     errno = 0;   // essential as strtol would not set a 0 errno
     const int64 timeout_ms = strtoll(timeout_str.c_str(), NULL, 10);
     if ( timeout_ms > 0 ) {
@@ -409,23 +427,19 @@ void HttpServer::StartProcessing(http::ServerRequest* req,
   }
   req->request()->set_server_use_gzip_encoding(true, true);
 
-  google::protobuf::Message* response = service->GetResponsePrototype(method).New();
-  google::protobuf::Closure* done_callback = NULL;
-  RpcData* const rpc_data = new RpcData(req, controller, request, response, peer_address,
-                                        stats_msg_text_size_);
-  mutex_.Lock();
-  current_requests_.insert(rpc_data);
-  mutex_.Unlock();
-
   if (controller->is_streaming()) {
-    done_callback = ::google::protobuf::internal::NewPermanentCallback(
-      this, &HttpServer::RpcStreamCallback, rpc_data);
+    rpc_data->streaming_mutex_ = new synch::Spin();
+    rpc_data->streaming_message_ = new io::MemoryStream();
     rpc_data->streaming_heartbeat_ms_ = heart_beat_ms;
-  } else {
-    done_callback = ::google::protobuf::internal::NewCallback(
-      this, &HttpServer::RpcCallback, rpc_data);
   }
-  service->CallMethod(method, controller, request, response, done_callback);
+  rpc_data->call_ns_ = timer::TicksNsec();
+  mutex_.Lock();
+  LinkLiveRequest(rpc_data);
+  mutex_.Unlock();
+
+  // (rpc_data is the done callback)
+  method->service_->CallMethod(method->method_, controller, request,
+                               rpc_data->response_, rpc_data);
   if (controller->is_streaming() && !controller->IsFinalized()) {
     RpcStreamCallback(rpc_data);  // maybe start the header and so..
   }
@@ -446,14 +460,14 @@ void HttpServer::RpcStreamCallback(RpcData* data) {
 
   data->streaming_mutex_->Lock();
   if (!data->streaming_sent_response_) {
-    if (data->controller_->Failed()) {
+    if (data->controller_.Failed()) {
       data->streaming_mutex_->Unlock();
       ReplyToRequest(data->req_, http::INTERNAL_SERVER_ERROR,
-                     data->controller_, NULL);
+                     &data->controller_, NULL);
       RpcStreamClosed(data);
       return;
     }
-    PrepareForResponse(data->req_, data->controller_, NULL);
+    PrepareForResponse(data->req_, &data->controller_, NULL);
     data->streaming_req_close_callback_ = whisper::NewCallback(
       this, &HttpServer::RpcStreamClosed, data);
     data->streaming_heartbeat_callback_ = whisper::NewPermanentCallback(
@@ -472,8 +486,8 @@ void HttpServer::RpcStreamCallback(RpcData* data) {
 
 void HttpServer::RpcStreamHeartbeat(RpcData* data) {
   if (data->req_->is_orphaned() ||
-      data->controller_->Failed() ||
-      data->controller_->IsCanceled()) {
+      data->controller_.Failed() ||
+      data->controller_.IsCanceled()) {
     return;  // they'll close it ..
   }
   data->req_->net_selector()->RegisterAlarm(
@@ -495,10 +509,10 @@ void HttpServer::RpcStreamSomeData(RpcData* data) {
   data->streaming_mutex_->Lock();
   // There was some error encountered ?
   if (data->req_->is_orphaned() ||
-      data->controller_->Failed() ||
-      data->controller_->IsCanceled()) {
+      data->controller_.Failed() ||
+      data->controller_.IsCanceled()) {
     data->streaming_mutex_->Unlock();
-    data->controller_->set_is_finalized();
+    data->controller_.set_is_finalized();
     data->req_->EndStreamingData();   // Streaming Closed gets called..
     return;
   }
@@ -531,23 +545,19 @@ void HttpServer::RpcStreamSomeData(RpcData* data) {
       }
     }
   } while (size > 0 && popped);
-  {
-    data->streaming_mutex_->Lock();
-    data->stats_->set_streamed_size(data->stats_->streamed_size() + start_size - size);
-    data->streaming_mutex_->Unlock();
-  }
+  data->streamed_size_ += start_size - size;
 
   // Implicit end of stream -
   // no streaming_callback, no message, nothing to be sent.
-  if (data->controller_->server_streaming_callback() == NULL &&
+  if (data->controller_.server_streaming_callback() == NULL &&
       data->streaming_message_->IsEmpty() &&
-      !data->controller_->HasStreamedMessage()) {
+      !data->controller_.HasStreamedMessage()) {
     data->stream_ended_ = true;
   }
   if (data->streaming_message_->IsEmpty()) {
     if (data->stream_ended_) {
       data->streaming_mutex_->Unlock();
-      data->controller_->set_is_finalized();
+      data->controller_.set_is_finalized();
       data->req_->EndStreamingData();
       // Streaming Closed gets called - we are done
       return;   // end of stream
@@ -559,8 +569,8 @@ void HttpServer::RpcStreamSomeData(RpcData* data) {
     data->streaming_mutex_->Lock();
   }
   if (!data->stream_ended_ && !data->streaming_scheduled_
-      && !data->controller_->HasStreamedMessage()
-      && data->controller_->server_streaming_callback() != NULL) {
+      && !data->controller_.HasStreamedMessage()
+      && data->controller_.server_streaming_callback() != NULL) {
     data->streaming_scheduled_ = true;
     data->streaming_mutex_->Unlock();
     data->req_->net_selector()->RunInSelectLoop(
@@ -572,8 +582,8 @@ void HttpServer::RpcStreamSomeData(RpcData* data) {
 
 void HttpServer::RpcData::RunStreamingCallback() {
   streaming_scheduled_ = false;
-  if (controller_->server_streaming_callback()) {
-    controller_->server_streaming_callback()->Run();
+  if (controller_.server_streaming_callback()) {
+    controller_.server_streaming_callback()->Run();
   }
 }
 
@@ -591,35 +601,71 @@ void HttpServer::RpcStreamClosed(RpcData* data) {
       data->streaming_heartbeat_callback_);
   }
   data->streaming_req_close_callback_ = NULL;
-  data->controller_->FinalizeStreamingOnNetworkError();
+  data->controller_.FinalizeStreamingOnNetworkError();
 
   RpcCompleteData(data, net_selector);
 }
 
 void HttpServer::RpcCompleteData(RpcData* data,
                                  net::Selector* net_selector) {
+  const int64 end_ns = timer::TicksNsec();
+  data->RecordMethodStats(end_ns);
+  // The detailed stats (w/ the text of the messages) are built
+  // only for the sampled calls
+  pb::RequestStats* stats = NULL;
+  const uint64 num_completed = ++num_completed_requests_;
+  if (data->controller_.Failed() ||
+      (stats_msg_sample_every_ > 0 &&
+       num_completed % stats_msg_sample_every_ == 0)) {
+    stats = new pb::RequestStats();
+    data->FillStats(stats, stats_msg_text_size_, end_ns);
+  }
+
   synch::MutexLocker l(&mutex_);
   --num_current_requests_;
-  current_requests_.erase(data);
-  completed_requests_.push_front(data->GrabStats(stats_msg_text_size_));
-  while (completed_requests_.size() > stats_msg_history_size_) {
-    delete completed_requests_.back();
-    completed_requests_.pop_back();
+  UnlinkLiveRequest(data);
+  if (stats != NULL) {
+    completed_requests_.push_front(stats);
+    while (completed_requests_.size() > stats_msg_history_size_) {
+      delete completed_requests_.back();
+      completed_requests_.pop_back();
+    }
   }
 
   net_selector->DeleteInSelectLoop(data);
 }
 
+void HttpServer::LinkLiveRequest(RpcData* data) {
+  data->live_prev_ = NULL;
+  data->live_next_ = live_requests_;
+  if (live_requests_ != NULL) {
+    live_requests_->live_prev_ = data;
+  }
+  live_requests_ = data;
+}
+
+void HttpServer::UnlinkLiveRequest(RpcData* data) {
+  if (data->live_prev_ != NULL) {
+    data->live_prev_->live_next_ = data->live_next_;
+  } else {
+    live_requests_ = data->live_next_;
+  }
+  if (data->live_next_ != NULL) {
+    data->live_next_->live_prev_ = data->live_prev_;
+  }
+  data->live_prev_ = data->live_next_ = NULL;
+}
+
 
 bool HttpServer::RpcStreamPopMessageDataLocked(RpcData* data) {
   // DCHECK(data->streaming_mutex_->IsHeld());
   bool popped = false;
   while (data->streaming_message_->IsEmpty() &&
-         data->controller_->HasStreamedMessage() &&
+         data->controller_.HasStreamedMessage() &&
          !data->stream_ended_) {
     data->streaming_message_sent_size_ = false;
     pair<google::protobuf::Message*, bool> msg =
-      data->controller_->PopStreamedMessage();
+      data->controller_.PopStreamedMessage();
     DCHECK(msg.second);  // have to have something in there
     if (!msg.first) {
       data->stream_ended_ = true;
@@ -648,17 +694,18 @@ bool HttpServer::RpcStreamPopMessageDataLocked(RpcData* data) {
 
 
 void HttpServer::RpcCallback(RpcData* data) {
-  data->controller_->set_is_finalized();
+  data->done_ns_ = timer::TicksNsec();
+  data->controller_.set_is_finalized();
   // Keep a pointer on the selector, as the 'req_'
   // gets automatically deleted by ReplyToRequest()
   net::Selector* net_selector = data->req_->net_selector();
-  if (data->controller_->Failed()) {
-    if (data->controller_->GetErrorCode() == ERROR_USER) {
+  if (data->controller_.Failed()) {
+    if (data->controller_.GetErrorCode() == ERROR_USER) {
       ReplyToRequest(data->req_, http::BAD_REQUEST,
-                     data->controller_, data->controller_->ErrorText().c_str());
+                     &data->controller_, data->controller_.ErrorText().c_str());
     } else {
       ReplyToRequest(data->req_, http::INTERNAL_SERVER_ERROR,
-                     data->controller_, data->controller_->ErrorText().c_str());
+                     &data->controller_, data->controller_.ErrorText().c_str());
     }
   } else if (!io::SerializeProto(data->response_,
                                  data->req_->request()->server_data())) {
@@ -670,6 +717,216 @@ void HttpServer::RpcCallback(RpcData* data) {
   RpcCompleteData(data, net_selector);
 }
 
+void HttpServer::ProcessBatchRequest(http::ServerRequest* req,
+                                     const std::string& service_path,
+                                     const net::HostPort& peer_address,
+                                     int64 received_ns) {
+  mutex_.Lock();
+  ServicesMap::const_iterator it = services_.find(service_path);
+  google::protobuf::Service* const service =
+    it == services_.end() ? NULL : it->second;
+  mutex_.Unlock();
+  if (service == NULL) {
+    RegisterErrorRequest(service_path + " - unknown service for batch.",
+                         req, peer_address);
+    ReplyToRequest(req, http::NOT_FOUND, NULL, kRpcErrorServiceNotFound);
+    return;
+  }
+
+  mutex_.Lock();
+  ++num_current_requests_;
+  if ( num_current_requests_ >= max_concurrent_requests_ ) {
+    mutex_.Unlock();
+    RegisterErrorRequest(strutil::StringPrintf(
+                           "Too many concurrent requests: %d",
+                           num_current_requests_), req, peer_address);
+    ReplyToRequest(req, http::INTERNAL_SERVER_ERROR, NULL, kRpcErrorServerOverloaded);
+    return;
+  }
+  mutex_.Unlock();
+
+  BatchData* const batch = new BatchData(this, req, service_path, service,
+                                         peer_address, received_ns);
+  if (authenticator_ != NULL) {
+    req->AuthenticateRequest(
+      authenticator_,
+      whisper::NewCallback(this, &HttpServer::ProcessAuthenticatedBatch,
+                           batch));
+  } else {
+    ProcessAuthenticatedBatch(batch, net::UserAuthenticator::Authenticated);
+  }
+}
+
+void HttpServer::ProcessAuthenticatedBatch(
+  BatchData* batch,
+  net::UserAuthenticator::Answer auth_answer) {
+  http::ServerRequest* const req = batch->req_;
+  if ( !req->net_selector()->IsInSelectThread() ) {
+    req->net_selector()->RunInSelectLoop(
+      whisper::NewCallback(this, &HttpServer::ProcessAuthenticatedBatch,
+                           batch, auth_answer));
+    return;
+  }
+  const net::HostPort peer_address(batch->transport_.peer_address());
+  if ( auth_answer != net::UserAuthenticator::Authenticated ) {
+    RegisterErrorRequest(std::string("Unauthenticated batch request: ") +
+                         net::UserAuthenticator::AnswerName(auth_answer),
+                         req, peer_address);
+    delete batch;
+    req->AnswerUnauthorizedRequest(authenticator_);
+    return;
+  }
+  if ( req->request()->client_header()->method() != http::METHOD_POST ) {
+    RegisterErrorRequest(std::string("Bad batch request: http method: ") +
+                         http::GetHttpMethodName(
+                           req->request()->client_header()->method()),
+                         req, peer_address);
+    delete batch;
+    ReplyToRequest(req, http::BAD_REQUEST, NULL, kRpcErrorMethodNotSupported);
+    return;
+  }
+  if ( authenticator_ != NULL ) {
+    req->request()->client_header()->GetAuthorizationField(
+      batch->transport_.mutable_user(), batch->transport_.mutable_passwd());
+  }
+  // Split the body in calls - the frame code is the index of the method
+  const google::protobuf::ServiceDescriptor* const service =
+    batch->service_->GetDescriptor();
+  io::MemoryStream* const in = req->request()->client_data();
+  size_t num_started = 0;
+  tcp::FrameHeader header;
+  while (tcp::PeekFrameHeader(*in, &header) &&
+         header.type_ == tcp::FRAME_REQUEST &&
+         in->Size() >= tcp::kFrameHeaderSize + header.length_) {
+    in->Skip(tcp::kFrameHeaderSize);
+    // Each call may come w/ its own deadline
+    uint32 size = header.length_;
+    uint32 timeout_ms = 0;
+    bool bad_deadline = false;
+    if ((header.flags_ & tcp::FLAG_DEADLINE) != 0) {
+      bad_deadline = !tcp::ReadDeadline(in, &size, &timeout_ms);
+    }
+    RegisteredMethod* method = NULL;
+    if (header.code_ < uint32(service->method_count())) {
+      const google::protobuf::MethodDescriptor* const md =
+        service->method(header.code_);
+      method = methods_.Find(tcp::MethodId(batch->service_path_, md->name()));
+      if (method != NULL && method->method_ != md) {
+        method = NULL;
+      }
+    }
+    google::protobuf::Message* request = NULL;
+    const char* error_reason = NULL;
+    rpc::ErrorCode error_code = ERROR_PARSE;
+    if (bad_deadline) {
+      in->Skip(size);
+      error_reason = kRpcErrorBadEncoded;
+    } else if (method == NULL) {
+      in->Skip(size);
+      error_reason = kRpcErrorMethodNotFound;
+      error_code = ERROR_USER;
+    } else {
+      request = method->request_pool_.New();
+      if (!tcp::ReadMessagePayload(in, size, request)) {
+        method->request_pool_.Release(request, 0);
+        request = NULL;
+        error_reason = kRpcErrorBadEncoded;
+      }
+    }
+    BatchCall* const call = new BatchCall(batch, method, header.xid_,
+                                          request, size);
+    if (error_reason != NULL) {
+      call->controller_.SetErrorCode(error_code);
+      call->controller_.SetFailed(error_reason);
+    } else {
+      if (timeout_ms > 0) {
+        call->controller_.set_timeout_ms(timeout_ms);
+      }
+      ++num_started;
+    }
+    batch->calls_.push_back(call);
+  }
+  if (!in->IsEmpty() || batch->calls_.empty()) {
+    in->Clear();
+    RegisterErrorRequest("Badly encoded batch request", req, peer_address);
+    delete batch;
+    ReplyToRequest(req, http::BAD_REQUEST, NULL, kRpcErrorBadEncoded);
+    return;
+  }
+  req->request()->set_server_use_gzip_encoding(true, true);
+
+  // (the extra pending call keeps the batch alive while we start them)
+  batch->num_pending_ = num_started + 1;
+  for (size_t i = 0; i < batch->calls_.size(); ++i) {
+    BatchCall* const call = batch->calls_[i];
+    if (call->controller_.Failed()) {
+      continue;
+    }
+    call->call_ns_ = timer::TicksNsec();
+    call->method_->service_->CallMethod(call->method_->method_,
+                                        &call->controller_, call->request_,
+                                        call->response_, call);
+  }
+  if (--batch->num_pending_ == 0) {
+    CompleteBatch(batch);
+  }
+}
+
+void HttpServer::BatchCallDone(BatchCall* call) {
+  call->done_ns_ = timer::TicksNsec();
+  call->controller_.set_is_finalized();
+  BatchData* const batch = call->batch_;
+  if (--batch->num_pending_ > 0) {
+    return;
+  }
+  net::Selector* const net_selector = batch->req_->net_selector();
+  if (net_selector->IsInSelectThread()) {
+    CompleteBatch(batch);
+  } else {
+    net_selector->RunInSelectLoop(
+      whisper::NewCallback(this, &HttpServer::CompleteBatch, batch));
+  }
+}
+
+void HttpServer::CompleteBatch(BatchData* batch) {
+  http::ServerRequest* const req = batch->req_;
+  net::Selector* const net_selector = req->net_selector();
+  io::MemoryStream* const out = req->request()->server_data();
+  const int64 end_ns = timer::TicksNsec();
+  for (size_t i = 0; i < batch->calls_.size(); ++i) {
+    BatchCall* const call = batch->calls_[i];
+    rpc::Controller* const controller = &call->controller_;
+    controller->CallCancelCallback(false);
+    const size_t out_size = out->Size();
+    if (controller->Failed()) {
+      tcp::WriteFrame(tcp::FRAME_ERROR, 0, controller->GetErrorCode(),
+                      call->xid_, controller->GetErrorReason(), out);
+    } else if (!tcp::WriteMessageFrame(tcp::FRAME_REPLY, 0, 0, call->xid_,
+                                       *call->response_, out)) {
+      LOG_ERROR << "Error serializing the batched response: "
+                << call->response_->InitializationErrorString();
+      controller->SetErrorCode(ERROR_SERVER);
+      tcp::WriteFrame(tcp::FRAME_ERROR, 0, ERROR_SERVER, call->xid_,
+                      kRpcErrorSerializingResponse, out);
+    }
+    if (call->method_ != NULL) {
+      const bool started = call->call_ns_ > 0;
+      call->method_->stats_.RecordCall(
+        controller->GetErrorCode(),
+        tcp::kFrameHeaderSize + call->request_size_, out->Size() - out_size,
+        started ? (call->call_ns_ - batch->received_ns_) / 1000 : -1,
+        started ? (call->done_ns_ - call->call_ns_) / 1000 : -1,
+        started ? (end_ns - call->done_ns_) / 1000 : -1);
+    }
+  }
+  ReplyToRequest(req, http::OK, NULL, NULL);
+
+  mutex_.Lock();
+  --num_current_requests_;
+  mutex_.Unlock();
+  net_selector->DeleteInSelectLoop(batch);
+}
+
 void HttpServer::PrepareForResponse(http::ServerRequest* req,
                                     rpc::Controller* controller,
                                     const char* error_reason) {
@@ -718,10 +975,18 @@ void HttpServer::GetServerStats(pb::ServerStats* stats) const {
   stats->set_now_ts(timer::TicksNsec());
   GetMachineStats(stats->mutable_machine_stats());
 
+  std::vector<const RegisteredMethod*> methods;
+  methods_.GetMethods(&methods);
+  for (size_t i = 0; i < methods.size(); ++i) {
+    pb::MethodStats* const method_stats = stats->add_method_stats();
+    method_stats->set_path(methods[i]->path_);
+    methods[i]->stats_.Get(method_stats);
+  }
+
   synch::MutexLocker l(&mutex_);
-  for (std::set<RpcData*>::const_iterator it = current_requests_.begin();
-       it != current_requests_.end(); ++it) {
-    if ((*it)->stats_) stats->add_live_req()->CopyFrom(*(*it)->stats_);
+  for (const RpcData* data = live_requests_; data != NULL;
+       data = data->live_next_) {
+    data->FillStats(stats->add_live_req(), stats_msg_text_size_, 0);
   }
   for (size_t i = 0; i < completed_requests_.size(); ++i) {
     stats->add_completed_req()->CopyFrom(*completed_requests_[i]);
@@ -828,65 +1093,144 @@ pb::RequestStats* HttpServer::BuildErrorStats(http::ServerRequest* req,
   return stats;
 }
 
-HttpServer::RpcData::RpcData(http::ServerRequest* req,
-                             rpc::Controller* controller,
-                             const google::protobuf::Message* request,
-                             google::protobuf::Message* response,
+HttpServer::RpcData::RpcData(HttpServer* server,
+                             http::ServerRequest* req,
+                             RegisteredMethod* method,
                              const net::HostPort& remote_address,
-                             size_t limit_print)
-  : req_(req), controller_(controller), request_(request), response_(response),
+                             google::protobuf::Message* request,
+                             int64 request_size,
+                             int64 received_ns)
+  : server_(server), req_(req), method_(method),
+    transport_(req->net_selector(), rpc::Transport::HTTP,
+               net::HostPort(), remote_address),
+    controller_(&transport_, false),
+    request_(request), response_(method->response_pool_.New()),
+    request_size_(request_size),
     xid_(req->request()->client_header()->FindField(kRpcHttpXid)),
-    streaming_mutex_(controller_->is_streaming() ? new synch::Spin() : NULL),
+    received_ns_(received_ns),
+    call_ns_(0),
+    done_ns_(0),
+    live_prev_(NULL),
+    live_next_(NULL),
+    streaming_mutex_(NULL),
     streaming_scheduled_(false),
-  streaming_sent_response_(false),
-  streaming_message_sent_size_(false),
-  stream_ended_(false),
-  streaming_heartbeat_ms_(0),
-  streaming_message_(controller_->is_streaming() ? new io::MemoryStream() : NULL),
-  streaming_req_close_callback_(NULL),
-  streaming_heartbeat_callback_(NULL),
-  stats_(new pb::RequestStats()) {
-  stats_->set_peer_address(remote_address.ToString());
-  stats_->set_start_time_ts(timer::TicksNsec());
-  stats_->set_method_txt(req->request()->url()->path() + " xid:" + xid_);
-  if (controller->is_streaming()) {
-    stats_->set_is_streaming(true);
+    streaming_sent_response_(false),
+    streaming_message_sent_size_(false),
+    stream_ended_(false),
+    streaming_heartbeat_ms_(0),
+    streaming_message_(NULL),
+    streamed_size_(0),
+    streaming_req_close_callback_(NULL),
+    streaming_heartbeat_callback_(NULL) {
+}
+
+void HttpServer::RpcData::Run() {
+  if (controller_.is_streaming()) {
+    server_->RpcStreamCallback(this);
+  } else {
+    server_->RpcCallback(this);
+  }
+}
+
+void HttpServer::RpcData::FillStats(pb::RequestStats* stats,
+                                    size_t limit_print,
+                                    int64 end_ns) const {
+  stats->set_peer_address(transport_.peer_address().ToString());
+  stats->set_start_time_ts(call_ns_);
+  stats->set_method_txt(req_->request()->url()->path() + " xid:" + xid_);
+  if (controller_.is_streaming()) {
+    stats->set_is_streaming(true);
+    stats->set_streamed_size(streamed_size_);
+  }
+  stats->set_request_type_name(request_->GetDescriptor()->full_name());
+  stats->set_request_size(request_size_);
+  if (size_t(request_size_) < limit_print) {
+    stats->set_request_txt(request_->ShortDebugString());
   }
-  stats_->set_request_type_name(request->GetDescriptor()->full_name());
-  stats_->set_request_size(request->ByteSize());
-  if (size_t(stats_->request_size()) < limit_print) {
-    stats_->set_request_txt(request->ShortDebugString());
+  stats->set_response_type_name(response_->GetDescriptor()->full_name());
+  if (end_ns == 0) {
+    return;   // in progress - the response is in the works
   }
-  stats_->set_response_type_name(response->GetDescriptor()->full_name());
+  stats->set_server_size(req_->request()->stats().server_size_ +
+                         req_->request()->server_data()->Size());
+  stats->set_server_raw_size(req_->request()->stats().server_raw_size_);
+  stats->set_client_size(req_->request()->stats().client_size_);
+  stats->set_client_raw_size(req_->request()->stats().client_raw_size_);
+  stats->set_response_time_ts(end_ns);
+  stats->set_response_size(response_->ByteSizeLong());
+  if (controller_.Failed()) {
+    stats->set_error_txt(controller_.ErrorText());
+  } else if (size_t(stats->response_size()) < limit_print) {
+    stats->set_response_txt(response_->ShortDebugString());
+  }
+}
+
+void HttpServer::RpcData::RecordMethodStats(int64 end_ns) {
+  // Streaming calls have no done_ns_ - the handler time lasts
+  // until the stream ends, and the writes are part of it.
+  const int64 handler_end_ns = done_ns_ > 0 ? done_ns_ : end_ns;
+  method_->stats_.RecordCall(
+    controller_.GetErrorCode(),
+    req_->request()->stats().client_size_,
+    req_->request()->stats().server_size_ +
+    req_->request()->server_data()->Size(),
+    (call_ns_ - received_ns_) / 1000,
+    (handler_end_ns - call_ns_) / 1000,
+    done_ns_ > 0 ? (end_ns - done_ns_) / 1000 : -1);
+}
+
+HttpServer::BatchData::BatchData(HttpServer* server,
+                                 http::ServerRequest* req,
+                                 const std::string& service_path,
+                                 google::protobuf::Service* service,
+                                 const net::HostPort& remote_address,
+                                 int64 received_ns)
+  : server_(server), req_(req),
+    service_path_(service_path), service_(service),
+    transport_(req->net_selector(), rpc::Transport::HTTP,
+               net::HostPort(), remote_address),
+    received_ns_(received_ns),
+    num_pending_(0) {
 }
 
-pb::RequestStats* HttpServer::RpcData::GrabStats(size_t limit_print) {
-  stats_->set_server_size(req_->request()->stats().server_size_ +
-                          req_->request()->server_data()->Size());
-  stats_->set_server_raw_size(req_->request()->stats().server_raw_size_);
-  stats_->set_client_size(req_->request()->stats().client_size_);
-  stats_->set_client_raw_size(req_->request()->stats().client_raw_size_);
+HttpServer::BatchData::~BatchData() {
+  for (size_t i = 0; i < calls_.size(); ++i) {
+    delete calls_[i];
+  }
+}
 
-  stats_->set_response_time_ts(timer::TicksNsec());
-  stats_->set_response_size(response_->ByteSize());
+HttpServer::BatchCall::BatchCall(BatchData* batch,
+                                 RegisteredMethod* method,
+                                 int64 xid,
+                                 google::protobuf::Message* request,
+                                 uint32 request_size)
+  : batch_(batch), method_(method), xid_(xid),
+    controller_(&batch->transport_, false),
+    request_(request), request_size_(request_size),
+    response_(method != NULL ? method->response_pool_.New() : NULL),
+    call_ns_(0),
+    done_ns_(0) {
+}
 
-  if (controller_->Failed()) {
-    stats_->set_error_txt(controller_->ErrorText());
-  } else if (size_t(stats_->response_size()) < limit_print) {
-    stats_->set_response_txt(response_->ShortDebugString());
+HttpServer::BatchCall::~BatchCall() {
+  if (method_ != NULL) {
+    if (request_ != NULL) {
+      method_->request_pool_.Release(request_, request_size_);
+    }
+    method_->response_pool_.Release(response_, response_->ByteSizeLong());
   }
-  pb::RequestStats* stats = stats_; stats_ = NULL;
-  return stats;
+}
+
+void HttpServer::BatchCall::Run() {
+  batch_->server_->BatchCallDone(this);
 }
 
 HttpServer::RpcData::~RpcData() {
   delete streaming_heartbeat_callback_;
-  delete controller_;
-  delete request_;
-  delete response_;
+  method_->request_pool_.Release(request_, request_size_);
+  method_->response_pool_.Release(response_, response_->ByteSizeLong());
   delete streaming_message_;
   delete streaming_mutex_;
-  delete stats_;
 }
 
 }  // namespace rpc
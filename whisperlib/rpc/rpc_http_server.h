@@ -42,18 +42,23 @@
 #ifndef __NET_RPC_LIB_SERVER_RPC_HTTP_SERVER_H__
 #define __NET_RPC_LIB_SERVER_RPC_HTTP_SERVER_H__
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <set>
 #include <deque>
+#include <vector>
 #include "whisperlib/base/types.h"
 #include "whisperlib/sync/mutex.h"
 #include "whisperlib/net/address.h"
 #include "whisperlib/io/buffer/memory_stream.h"
 #include "whisperlib/base/hash.h"
 #include WHISPER_HASH_SET_HEADER
+#include WHISPER_HASH_MAP_HEADER
 
 #include "whisperlib/net/user_authenticator.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_method_table.h"
 
 namespace google { namespace protobuf {
 class Service;
@@ -114,6 +119,17 @@ class HttpServer {
     return path_;
   }
 
+  // Looks up a registered method by its path under path()
+  // ("sub_path/package.Service/Method") or by its id (see tcp::MethodId(),
+  // for the rpc::TcpServer serving our services). NULL if none.
+  // These don't lock, and the returned methods live as long as we do.
+  RegisteredMethod* FindMethod(const std::string& method_path) const {
+    return methods_.Find(method_path);
+  }
+  RegisteredMethod* FindMethod(uint32 method_id) const {
+    return methods_.Find(method_id);
+  }
+
   static net::HostPort GetRemoteAddress(http::ServerRequest* req);
 
 
@@ -140,6 +156,12 @@ class HttpServer {
   void set_stats_msg_history_size(size_t sz) {
     stats_msg_history_size_ = sz;
   }
+  // The stats (w/ the text of the messages) of one in these many completed
+  // calls, and of all failed ones, are kept in the history. 1 keeps all,
+  // 0 only the failed ones.
+  void set_stats_msg_sample_every(size_t n) {
+    stats_msg_sample_every_ = n;
+  }
 
   void GetServerStats(pb::ServerStats* stats) const;
   void GetMachineStats(pb::MachineStats* stats) const;
@@ -150,23 +172,49 @@ protected:
   pb::RequestStats* BuildErrorStats(http::ServerRequest* req,
                                     const net::HostPort& remote_address,
                                     const std::string& error);
-  struct RpcData {
-    RpcData(http::ServerRequest* req,
-            rpc::Controller* controller,
-            const google::protobuf::Message* request,
-            google::protobuf::Message* response,
+  // The state of a call, in one allocation - w/ its transport and
+  // controller (the request and response come from the pools of the
+  // method). It is also the done callback of the call: permanent, as
+  // streaming calls run it multiple times.
+  struct RpcData : public google::protobuf::Closure {
+    RpcData(HttpServer* server,
+            http::ServerRequest* req,
+            RegisteredMethod* method,
             const net::HostPort& remote_address,
-            size_t stats_limit_print);
-    ~RpcData();
+            google::protobuf::Message* request,
+            int64 request_size,
+            int64 received_ns);
+    virtual ~RpcData();
 
+    // RpcCallback, or RpcStreamCallback for streaming calls
+    virtual void Run();
     void RunStreamingCallback();
-    pb::RequestStats* GrabStats(size_t limit_print);
-
+    // The stats of a completed call (end_ns is when it completed), or of
+    // one in progress (end_ns is 0). The text of the messages is included
+    // if shorter than limit_print.
+    void FillStats(pb::RequestStats* stats, size_t limit_print,
+                   int64 end_ns) const;
+    // Accounts the completed call in the stats of its method
+    void RecordMethodStats(int64 end_ns);
+
+    HttpServer* const server_;
     http::ServerRequest* req_;
-    rpc::Controller* controller_;
-    const google::protobuf::Message* request_;
-    google::protobuf::Message* response_;
+    RegisteredMethod* const method_;
+    rpc::Transport transport_;
+    rpc::Controller controller_;
+    google::protobuf::Message* const request_;
+    google::protobuf::Message* const response_;
+    const int64 request_size_;
     const std::string xid_;
+    // (timer::TicksNsec()) when the http request was received, when the
+    // implementation was called, and when it called done (if not streaming)
+    const int64 received_ns_;
+    int64 call_ns_;
+    int64 done_ns_;
+
+    // In the list of live calls of the server
+    RpcData* live_prev_;
+    RpcData* live_next_;
 
     synch::Spin* streaming_mutex_;
     bool streaming_scheduled_;
@@ -175,11 +223,51 @@ protected:
     bool stream_ended_;
     int64 streaming_heartbeat_ms_;
     io::MemoryStream* streaming_message_;
+    std::atomic<int64> streamed_size_;
 
-    Closure* streaming_req_close_callback_;
-    Closure* streaming_heartbeat_callback_;
+    whisper::Closure* streaming_req_close_callback_;
+    whisper::Closure* streaming_heartbeat_callback_;
+  };
 
-    pb::RequestStats* stats_;
+  // The calls of a batch request (see kRpcHttpBatch) - we reply when
+  // all of them are done.
+  struct BatchCall;
+  struct BatchData {
+    BatchData(HttpServer* server,
+              http::ServerRequest* req,
+              const std::string& service_path,
+              google::protobuf::Service* service,
+              const net::HostPort& remote_address,
+              int64 received_ns);
+    ~BatchData();
+
+    HttpServer* const server_;
+    http::ServerRequest* const req_;
+    const std::string service_path_;
+    google::protobuf::Service* const service_;
+    rpc::Transport transport_;    // shared by the calls
+    const int64 received_ns_;
+    std::vector<BatchCall*> calls_;
+    // The calls still in the works (+1 while we start them)
+    std::atomic<size_t> num_pending_;
+  };
+  // A call of a batch - also its done callback, as RpcData. Calls that
+  // cannot be started (unknown method, bad request) are failed upfront.
+  struct BatchCall : public google::protobuf::Closure {
+    BatchCall(BatchData* batch, RegisteredMethod* method, int64 xid,
+              google::protobuf::Message* request, uint32 request_size);
+    virtual ~BatchCall();
+    virtual void Run();
+
+    BatchData* const batch_;
+    RegisteredMethod* const method_;    // NULL for an unknown method
+    const int64 xid_;
+    rpc::Controller controller_;
+    google::protobuf::Message* const request_;
+    const uint32 request_size_;
+    google::protobuf::Message* const response_;
+    int64 call_ns_;     // as in RpcData (0 if not started)
+    int64 done_ns_;
   };
 
 
@@ -189,19 +277,33 @@ protected:
   // After the authentication completes, the processing is continued in
   // this function (that we force in req->net_selector();
   void ProcessAuthenticatedRequest(http::ServerRequest* req,
-                                   google::protobuf::Service* service,
-                                   const google::protobuf::MethodDescriptor* method,
+                                   RegisteredMethod* method,
+                                   int64 received_ns,
                                    net::UserAuthenticator::Answer auth_answer);
 
   // In this function we state the actual processing (i.e. service->CallMethod)
   void StartProcessing(http::ServerRequest* req,
-                       google::protobuf::Service* service,
-                       const google::protobuf::MethodDescriptor* method,
-                       google::protobuf::Message* request);
+                       RegisteredMethod* method,
+                       int64 received_ns,
+                       google::protobuf::Message* request,
+                       int64 request_size);
 
   // Callback from service->CallMethod
   void RpcCallback(RpcData* data);
 
+  // Batch requests: ProcessRequest passes them here, and they continue,
+  // after authentication, by starting all their calls.
+  void ProcessBatchRequest(http::ServerRequest* req,
+                           const std::string& service_path,
+                           const net::HostPort& peer_address,
+                           int64 received_ns);
+  void ProcessAuthenticatedBatch(BatchData* batch,
+                                 net::UserAuthenticator::Answer auth_answer);
+  // Done callback of a batched call (from any thread)
+  void BatchCallDone(BatchCall* call);
+  // Replies w/ the results of all calls (in the select loop)
+  void CompleteBatch(BatchData* batch);
+
   // Closes a request - schedules the reply in the request select server
   void ReplyToRequest(http::ServerRequest* req,
                       int status,
@@ -231,6 +333,9 @@ protected:
 
   // Completes a data - deletes & registers stats.
   void RpcCompleteData(RpcData* data, net::Selector* net_selector);
+  // Add / remove a call to / from live_requests_ (w/ mutex_ held)
+  void LinkLiveRequest(RpcData* data);
+  void UnlinkLiveRequest(RpcData* data);
 
   // Utilities for preparing and sending the rpc answers.
   void PrepareForResponse(http::ServerRequest* req,
@@ -267,15 +372,19 @@ protected:
   // Save at most these many bytes from response / reply
   size_t stats_msg_text_size_;
   size_t stats_msg_history_size_;
+  size_t stats_msg_sample_every_;
 
   // Current statistics
   int num_current_requests_;
-  std::set<RpcData*> current_requests_;
+  RpcData* live_requests_;     // linked through RpcData::live_next_
+  std::atomic<uint64> num_completed_requests_;
   std::deque<pb::RequestStats*> completed_requests_;
 
   // What services we provide ..
   typedef std::map<std::string, google::protobuf::Service*> ServicesMap;
   ServicesMap services_;
+  // .. and their methods, which is where we dispatch the calls
+  MethodTable methods_;
 
   http::Server* http_server_;
 
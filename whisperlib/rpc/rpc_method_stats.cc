@@ -0,0 +1,278 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/rpc/rpc_method_stats.h"
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+#include "whisperlib/sync/mutex.h"
+#include "whisperlib/rpc/RpcStats.pb.h"
+
+namespace whisper {
+namespace rpc {
+
+LatencyHistogram::LatencyHistogram()
+  : sum_(0), max_(0) {
+  for (int i = 0; i < kNumBuckets; ++i) {
+    counts_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+  for (int i = 0; i < kNumBuckets; ++i) {
+    const int64 count = other.counts_[i].load(std::memory_order_relaxed);
+    if (count) {
+      counts_[i].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+  sum_.fetch_add(other.sum(), std::memory_order_relaxed);
+  if (other.max() > max()) {
+    max_.store(other.max(), std::memory_order_relaxed);
+  }
+}
+
+int64 LatencyHistogram::count() const {
+  int64 count = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    count += counts_[i].load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+int64 LatencyHistogram::Percentile(double q) const {
+  const int64 total = count();
+  if (total == 0) {
+    return 0;
+  }
+  int64 target = int64(ceil(q * total));
+  if (target < 1) target = 1;
+  int64 seen = 0;
+  for (int i = 0; i < kNumBuckets - 1; ++i) {
+    seen += counts_[i].load(std::memory_order_relaxed);
+    if (seen >= target) {
+      return std::min(BucketStart(i + 1) - 1, max());
+    }
+  }
+  return max();
+}
+
+void LatencyHistogram::Get(pb::LatencyHistogram* histogram) const {
+  int64 total = 0;
+  for (int i = 0; i < kNumBuckets; ++i) {
+    const int64 count = counts_[i].load(std::memory_order_relaxed);
+    if (count) {
+      histogram->add_bucket_start_us(BucketStart(i));
+      histogram->add_bucket_count(count);
+      total += count;
+    }
+  }
+  histogram->set_count(total);
+  histogram->set_sum_us(sum());
+  histogram->set_max_us(max());
+  histogram->set_p50_us(Percentile(0.5));
+  histogram->set_p90_us(Percentile(0.9));
+  histogram->set_p99_us(Percentile(0.99));
+  histogram->set_p999_us(Percentile(0.999));
+}
+
+//////////////////////////////////////////////////////////////////////
+
+namespace {
+// Hands out distinct shard indexes to the live threads - an index is given
+// again only after the thread that had it exits, so a shard has at most
+// one writer. Past MethodStats::kNumShards live threads, the others get
+// the shared index kNumShards.
+class ShardIndexes {
+ public:
+  ShardIndexes() : next_(0) {
+  }
+  int Acquire() {
+    synch::SpinLocker l(&spin_);
+    if (!free_.empty()) {
+      const int index = free_.back();
+      free_.pop_back();
+      return index;
+    }
+    return next_ < MethodStats::kNumShards ? next_++ : MethodStats::kNumShards;
+  }
+  void Release(int index) {
+    if (index < MethodStats::kNumShards) {
+      synch::SpinLocker l(&spin_);
+      free_.push_back(index);
+    }
+  }
+ private:
+  synch::Spin spin_;
+  int next_;
+  std::vector<int> free_;
+};
+// Never deleted - threads may exit after the static destructors run
+ShardIndexes* const g_shard_indexes = new ShardIndexes();
+
+struct ThreadShardIndex {
+  ThreadShardIndex() : index_(g_shard_indexes->Acquire()) {
+  }
+  ~ThreadShardIndex() {
+    g_shard_indexes->Release(index_);
+  }
+  const int index_;
+};
+thread_local ThreadShardIndex tls_shard_index;
+
+inline void Add(std::atomic<int64>* counter, int64 value,
+                bool single_writer) {
+  if (single_writer) {
+    counter->store(counter->load(std::memory_order_relaxed) + value,
+                   std::memory_order_relaxed);
+  } else {
+    counter->fetch_add(value, std::memory_order_relaxed);
+  }
+}
+}  // namespace
+
+MethodStats::Shard::Shard()
+  : num_calls_(0), bytes_in_(0), bytes_out_(0) {
+  for (int i = 0; i < kNumErrorCodes; ++i) {
+    num_errors_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+void MethodStats::Shard::RecordCall(bool single_writer,
+                                    ErrorCode error_code,
+                                    int64 bytes_in, int64 bytes_out,
+                                    int64 queue_us, int64 handler_us,
+                                    int64 write_us) {
+  Add(&num_calls_, 1, single_writer);
+  if (error_code != ERROR_NONE &&
+      error_code >= 0 && error_code < kNumErrorCodes) {
+    Add(&num_errors_[error_code], 1, single_writer);
+  }
+  Add(&bytes_in_, bytes_in, single_writer);
+  Add(&bytes_out_, bytes_out, single_writer);
+  if (single_writer) {
+    if (queue_us >= 0) queue_time_.RecordSingleWriter(queue_us);
+    if (handler_us >= 0) handler_time_.RecordSingleWriter(handler_us);
+    if (write_us >= 0) write_time_.RecordSingleWriter(write_us);
+  } else {
+    if (queue_us >= 0) queue_time_.Record(queue_us);
+    if (handler_us >= 0) handler_time_.Record(handler_us);
+    if (write_us >= 0) write_time_.Record(write_us);
+  }
+}
+
+MethodStats::MethodStats() {
+  for (int i = 0; i <= kNumShards; ++i) {
+    shards_[i].store(NULL, std::memory_order_relaxed);
+  }
+}
+
+MethodStats::~MethodStats() {
+  for (int i = 0; i <= kNumShards; ++i) {
+    delete shards_[i].load();
+  }
+}
+
+MethodStats::Shard* MethodStats::GetShard(int index) {
+  std::atomic<Shard*>& slot = shards_[index];
+  Shard* shard = slot.load(std::memory_order_acquire);
+  if (shard == NULL) {
+    Shard* const new_shard = new Shard();
+    if (slot.compare_exchange_strong(shard, new_shard,
+                                     std::memory_order_acq_rel)) {
+      shard = new_shard;
+    } else {
+      delete new_shard;   // another thread of the shared shard won
+    }
+  }
+  return shard;
+}
+
+void MethodStats::RecordCall(ErrorCode error_code,
+                             int64 bytes_in, int64 bytes_out,
+                             int64 queue_us, int64 handler_us,
+                             int64 write_us) {
+  const int index = tls_shard_index.index_;
+  GetShard(index)->RecordCall(index < kNumShards, error_code,
+                              bytes_in, bytes_out,
+                              queue_us, handler_us, write_us);
+}
+
+int64 MethodStats::num_calls() const {
+  int64 num_calls = 0;
+  for (int i = 0; i <= kNumShards; ++i) {
+    const Shard* const shard = shards_[i].load(std::memory_order_acquire);
+    if (shard != NULL) {
+      num_calls += shard->num_calls_.load(std::memory_order_relaxed);
+    }
+  }
+  return num_calls;
+}
+
+void MethodStats::Get(pb::MethodStats* stats) const {
+  int64 num_calls = 0;
+  int64 num_errors[kNumErrorCodes] = { 0, };
+  int64 bytes_in = 0;
+  int64 bytes_out = 0;
+  LatencyHistogram queue_time;
+  LatencyHistogram handler_time;
+  LatencyHistogram write_time;
+  for (int i = 0; i <= kNumShards; ++i) {
+    const Shard* const shard = shards_[i].load(std::memory_order_acquire);
+    if (shard == NULL) {
+      continue;
+    }
+    num_calls += shard->num_calls_.load(std::memory_order_relaxed);
+    for (int e = 0; e < kNumErrorCodes; ++e) {
+      num_errors[e] += shard->num_errors_[e].load(std::memory_order_relaxed);
+    }
+    bytes_in += shard->bytes_in_.load(std::memory_order_relaxed);
+    bytes_out += shard->bytes_out_.load(std::memory_order_relaxed);
+    queue_time.Merge(shard->queue_time_);
+    handler_time.Merge(shard->handler_time_);
+    write_time.Merge(shard->write_time_);
+  }
+  stats->set_num_calls(num_calls);
+  for (int e = 0; e < kNumErrorCodes; ++e) {
+    if (num_errors[e]) {
+      pb::ErrorCount* const error = stats->add_errors();
+      error->set_error_code(e);
+      error->set_error_name(GetErrorCodeString(ErrorCode(e)));
+      error->set_count(num_errors[e]);
+    }
+  }
+  stats->set_bytes_in(bytes_in);
+  stats->set_bytes_out(bytes_out);
+  queue_time.Get(stats->mutable_queue_time());
+  handler_time.Get(stats->mutable_handler_time());
+  write_time.Get(stats->mutable_write_time());
+}
+
+}  // namespace rpc
+}  // namespace whisper
@@ -0,0 +1,181 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Per method rpc stats: number of calls, errors by type, bytes in and out,
+// and latency histograms for the time a call waits before reaching its
+// implementation (queue), spends in it (handler), and takes to have its
+// reply put on the wire (write).
+//
+// Recording is meant to be cheap on the call path: while it lives, a thread
+// is the only writer of its shard, so it updates the counters w/ plain
+// (relaxed atomic) loads and stores, no locked instructions. The shards are
+// merged only when the stats are read (the statusz page, GetServerStats).
+//
+#ifndef __WHISPERLIB_RPC_RPC_METHOD_STATS_H__
+#define __WHISPERLIB_RPC_RPC_METHOD_STATS_H__
+
+#include <atomic>
+#include "whisperlib/base/types.h"
+#include "whisperlib/rpc/rpc_controller.h"
+
+namespace whisper {
+namespace rpc {
+namespace pb {
+class LatencyHistogram;
+class MethodStats;
+}
+
+// A histogram of latencies in microseconds, w/ log-linear buckets (as in
+// HDR histograms): the values under kSubBuckets have a bucket each, and
+// every power of two range above is split in kSubBuckets equal buckets.
+// So the relative error of a value read back is below 1 / kSubBuckets,
+// and a bucket index is computed w/ a few bit operations.
+class LatencyHistogram {
+ public:
+  static const int kSubBucketBits = 3;
+  static const int kSubBuckets = 1 << kSubBucketBits;
+  // Values from 2^kMaxValueBits us (~71 minutes) up go in the last bucket
+  static const int kMaxValueBits = 32;
+  static const int kNumBuckets =
+    (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+  LatencyHistogram();
+
+  static int BucketIndex(int64 value_us) {
+    if (value_us < kSubBuckets) {
+      return value_us < 0 ? 0 : int(value_us);
+    }
+    const int msb = 63 - __builtin_clzll(value_us);
+    if (msb >= kMaxValueBits) {
+      return kNumBuckets - 1;
+    }
+    return (msb - kSubBucketBits + 1) * kSubBuckets
+      + int(value_us >> (msb - kSubBucketBits)) - kSubBuckets;
+  }
+  // The smallest value that falls in a bucket
+  static int64 BucketStart(int index) {
+    const int group = index >> kSubBucketBits;
+    const int64 sub = index & (kSubBuckets - 1);
+    return group == 0 ? sub : (kSubBuckets + sub) << (group - 1);
+  }
+
+  // Can be called from any thread
+  void Record(int64 value_us) {
+    counts_[BucketIndex(value_us)].fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(value_us, std::memory_order_relaxed);
+    int64 max_us = max_.load(std::memory_order_relaxed);
+    while (value_us > max_us &&
+           !max_.compare_exchange_weak(max_us, value_us,
+                                       std::memory_order_relaxed)) {
+    }
+  }
+  // Cheaper, when only one thread records in this histogram (others
+  // can still read it)
+  void RecordSingleWriter(int64 value_us) {
+    std::atomic<int64>& count = counts_[BucketIndex(value_us)];
+    count.store(count.load(std::memory_order_relaxed) + 1,
+                std::memory_order_relaxed);
+    sum_.store(sum_.load(std::memory_order_relaxed) + value_us,
+               std::memory_order_relaxed);
+    if (value_us > max_.load(std::memory_order_relaxed)) {
+      max_.store(value_us, std::memory_order_relaxed);
+    }
+  }
+  // Adds the values recorded in other to ours
+  void Merge(const LatencyHistogram& other);
+
+  int64 count() const;
+  int64 sum() const {
+    return sum_.load(std::memory_order_relaxed);
+  }
+  int64 max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+  // The value under which a fraction q of the recorded values are - the end
+  // of the bucket the value falls in (bounded by max()).
+  int64 Percentile(double q) const;
+
+  void Get(pb::LatencyHistogram* histogram) const;
+
+ private:
+  std::atomic<int64> counts_[kNumBuckets];
+  std::atomic<int64> sum_;
+  std::atomic<int64> max_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(LatencyHistogram);
+};
+
+class MethodStats {
+ public:
+  // The live threads get a shard each, up to this many - the others
+  // share one more shard, which they update w/ atomic adds.
+  static const int kNumShards = 16;
+  static const int kNumErrorCodes = ERROR_PARSE + 1;
+
+  MethodStats();
+  ~MethodStats();
+
+  // Records a finished call. Negative times are not recorded (e.g. a call
+  // rejected before reaching the implementation has no handler time).
+  void RecordCall(ErrorCode error_code,
+                  int64 bytes_in, int64 bytes_out,
+                  int64 queue_us, int64 handler_us, int64 write_us);
+
+  // These merge the shards
+  int64 num_calls() const;
+  void Get(pb::MethodStats* stats) const;
+
+ private:
+  struct Shard {
+    Shard();
+    void RecordCall(bool single_writer, ErrorCode error_code,
+                    int64 bytes_in, int64 bytes_out,
+                    int64 queue_us, int64 handler_us, int64 write_us);
+    std::atomic<int64> num_calls_;
+    std::atomic<int64> num_errors_[kNumErrorCodes];
+    std::atomic<int64> bytes_in_;
+    std::atomic<int64> bytes_out_;
+    LatencyHistogram queue_time_;
+    LatencyHistogram handler_time_;
+    LatencyHistogram write_time_;
+    char padding_[64];    // no false sharing w/ the next allocation
+  };
+  // Allocated on first use, so the methods called from one thread only
+  // take one shard.
+  Shard* GetShard(int index);
+
+  std::atomic<Shard*> shards_[kNumShards + 1];
+
+  DISALLOW_EVIL_CONSTRUCTORS(MethodStats);
+};
+
+}  // namespace rpc
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_RPC_RPC_METHOD_STATS_H__
@@ -0,0 +1,177 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/rpc/rpc_method_table.h"
+
+#include <algorithm>
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/service.h>
+
+#include "whisperlib/base/log.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
+
+namespace whisper {
+namespace rpc {
+
+MessagePool::MessagePool(const google::protobuf::Message* prototype,
+                         size_t max_size,
+                         size_t max_message_size)
+  : prototype_(prototype),
+    max_size_(max_size),
+    max_message_size_(max_message_size) {
+}
+
+MessagePool::~MessagePool() {
+  for (size_t i = 0; i < free_.size(); ++i) {
+    delete free_[i];
+  }
+}
+
+google::protobuf::Message* MessagePool::New() {
+  {
+    synch::SpinLocker l(&spin_);
+    if (!free_.empty()) {
+      google::protobuf::Message* const message = free_.back();
+      free_.pop_back();
+      return message;
+    }
+  }
+  return prototype_->New();
+}
+
+void MessagePool::Release(google::protobuf::Message* message,
+                          size_t byte_size) {
+  if (byte_size <= max_message_size_) {
+    message->Clear();
+    synch::SpinLocker l(&spin_);
+    if (free_.size() < max_size_) {
+      free_.push_back(message);
+      return;
+    }
+  }
+  delete message;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+RegisteredMethod::RegisteredMethod(
+    google::protobuf::Service* service,
+    const google::protobuf::MethodDescriptor* method,
+    const std::string& service_path)
+  : service_(service),
+    method_(method),
+    path_(service_path + "/" + method->name()),
+    id_(tcp::MethodId(service_path, method->name())),
+    request_pool_(&service->GetRequestPrototype(method),
+                  kDefaultMessagePoolSize, kMaxPooledMessageSize),
+    response_pool_(&service->GetResponsePrototype(method),
+                   kDefaultMessagePoolSize, kMaxPooledMessageSize) {
+}
+
+//////////////////////////////////////////////////////////////////////
+
+MethodTable::MethodTable()
+  : index_(new Index()) {
+}
+
+MethodTable::~MethodTable() {
+  delete index_.load();
+  for (size_t i = 0; i < retired_.size(); ++i) {
+    delete retired_[i];
+  }
+  for (size_t i = 0; i < methods_.size(); ++i) {
+    delete methods_[i];
+  }
+}
+
+bool MethodTable::Add(const std::string& service_path,
+                      google::protobuf::Service* service) {
+  const google::protobuf::ServiceDescriptor* const descriptor =
+    service->GetDescriptor();
+  Index* const index = new Index(*index_.load());
+  std::vector<RegisteredMethod*> methods;
+  for (int i = 0; i < descriptor->method_count(); ++i) {
+    RegisteredMethod* const method = new RegisteredMethod(
+      service, descriptor->method(i), service_path);
+    methods.push_back(method);
+    if (!index->by_path_.insert(std::make_pair(method->path_, method)).second ||
+        !index->by_id_.insert(std::make_pair(method->id_, method)).second) {
+      LOG_ERROR << " Method path or id collision for " << method->path_
+                << " (id: " << method->id_ << ") - cannot register.";
+      for (size_t j = 0; j < methods.size(); ++j) {
+        delete methods[j];
+      }
+      delete index;
+      return false;
+    }
+  }
+  methods_.insert(methods_.end(), methods.begin(), methods.end());
+  Publish(index);
+  return true;
+}
+
+void MethodTable::Remove(const std::string& service_path,
+                         google::protobuf::Service* service) {
+  const google::protobuf::ServiceDescriptor* const descriptor =
+    service->GetDescriptor();
+  Index* const index = new Index(*index_.load());
+  for (int i = 0; i < descriptor->method_count(); ++i) {
+    PathMap::iterator it = index->by_path_.find(
+      service_path + "/" + descriptor->method(i)->name());
+    if (it != index->by_path_.end() && it->second->service_ == service) {
+      index->by_id_.erase(it->second->id_);
+      index->by_path_.erase(it);
+    }
+  }
+  Publish(index);
+}
+
+void MethodTable::Publish(Index* index) {
+  retired_.push_back(index_.exchange(index, std::memory_order_acq_rel));
+}
+
+static bool CompareMethodPaths(const RegisteredMethod* a,
+                               const RegisteredMethod* b) {
+  return a->path_ < b->path_;
+}
+
+void MethodTable::GetMethods(
+    std::vector<const RegisteredMethod*>* methods) const {
+  const Index* const index = index_.load(std::memory_order_acquire);
+  const size_t start = methods->size();
+  for (PathMap::const_iterator it = index->by_path_.begin();
+       it != index->by_path_.end(); ++it) {
+    methods->push_back(it->second);
+  }
+  std::sort(methods->begin() + start, methods->end(), CompareMethodPaths);
+}
+
+}  // namespace rpc
+}  // namespace whisper
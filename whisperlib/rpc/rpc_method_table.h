@@ -0,0 +1,170 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// The dispatch table of a rpc::HttpServer: every method of the registered
+// services, resolved once at registration, w/ what a call needs to run it
+// (the service, the method descriptor, pools of request / response
+// messages) and its per method stats. The rpc transports look methods up
+// by path or by id, w/o locking.
+//
+#ifndef __WHISPERLIB_RPC_RPC_METHOD_TABLE_H__
+#define __WHISPERLIB_RPC_RPC_METHOD_TABLE_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/hash.h"
+#include WHISPER_HASH_MAP_HEADER
+#include "whisperlib/sync/mutex.h"
+#include "whisperlib/rpc/rpc_method_stats.h"
+
+namespace google { namespace protobuf {
+class Message;
+class MethodDescriptor;
+class Service;
+} }
+
+namespace whisper {
+namespace rpc {
+
+// Keep at most these many free messages of a type ..
+static const size_t kDefaultMessagePoolSize = 64;
+// .. and only those w/ a serialized size below this - a cleared message
+// keeps the memory of its fields, so we don't hold on to large ones.
+static const size_t kMaxPooledMessageSize = 64 << 10;
+
+// Recycles the messages of one type: the released messages are cleared
+// and handed out again, which saves their allocation, and that of their
+// fields, on the next calls.
+class MessagePool {
+ public:
+  MessagePool(const google::protobuf::Message* prototype,
+              size_t max_size,
+              size_t max_message_size);
+  ~MessagePool();
+
+  google::protobuf::Message* New();
+  // Returns a message New()-ed from this pool. byte_size is the (last
+  // known) serialized size of the message, 0 if unknown.
+  void Release(google::protobuf::Message* message, size_t byte_size);
+
+  size_t num_free() const {
+    synch::SpinLocker l(&spin_);
+    return free_.size();
+  }
+
+ private:
+  const google::protobuf::Message* const prototype_;
+  const size_t max_size_;
+  const size_t max_message_size_;
+  mutable synch::Spin spin_;
+  std::vector<google::protobuf::Message*> free_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(MessagePool);
+};
+
+// A method of a registered service
+struct RegisteredMethod {
+  RegisteredMethod(google::protobuf::Service* service,
+                   const google::protobuf::MethodDescriptor* method,
+                   const std::string& service_path);
+
+  google::protobuf::Service* const service_;
+  const google::protobuf::MethodDescriptor* const method_;
+  // service_path + "/" + method name (e.g. "sub/package.Service/Method")
+  const std::string path_;
+  // The tcp::MethodId() of the method
+  const uint32 id_;
+
+  MessagePool request_pool_;
+  MessagePool response_pool_;
+
+  MethodStats stats_;
+
+ private:
+  DISALLOW_EVIL_CONSTRUCTORS(RegisteredMethod);
+};
+
+//
+// Add / Remove build a new copy of the lookup tables, which replaces the
+// current one, so lookups need no lock. The replaced tables and the removed
+// methods are kept until the MethodTable is deleted, as calls in flight
+// may still use them - (un)registering services is meant to be rare.
+//
+class MethodTable {
+ public:
+  MethodTable();
+  ~MethodTable();
+
+  // Adds the methods of service, registered under service_path
+  // ("sub_path/package.Service"). Fails if a method path or id is
+  // already registered.
+  // Add / Remove have to be synchronized by the caller.
+  bool Add(const std::string& service_path,
+           google::protobuf::Service* service);
+  void Remove(const std::string& service_path,
+              google::protobuf::Service* service);
+
+  // Lookups - NULL if not found
+  RegisteredMethod* Find(const std::string& method_path) const {
+    const Index* const index = index_.load(std::memory_order_acquire);
+    PathMap::const_iterator it = index->by_path_.find(method_path);
+    return it == index->by_path_.end() ? NULL : it->second;
+  }
+  RegisteredMethod* Find(uint32 method_id) const {
+    const Index* const index = index_.load(std::memory_order_acquire);
+    IdMap::const_iterator it = index->by_id_.find(method_id);
+    return it == index->by_id_.end() ? NULL : it->second;
+  }
+
+  // Appends the registered methods, sorted by path
+  void GetMethods(std::vector<const RegisteredMethod*>* methods) const;
+
+ private:
+  typedef hash_map<std::string, RegisteredMethod*> PathMap;
+  typedef hash_map<uint32, RegisteredMethod*> IdMap;
+  struct Index {
+    PathMap by_path_;
+    IdMap by_id_;
+  };
+  // Replaces the current index
+  void Publish(Index* index);
+
+  std::atomic<const Index*> index_;
+  std::vector<const Index*> retired_;
+  std::vector<RegisteredMethod*> methods_;    // all ever added - we own
+
+  DISALLOW_EVIL_CONSTRUCTORS(MethodTable);
+};
+
+}  // namespace rpc
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_RPC_RPC_METHOD_TABLE_H__
@@ -0,0 +1,343 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/rpc/rpc_tcp_client.h"
+
+#include <vector>
+#include <google/protobuf/message.h>
+#include <google/protobuf/descriptor.h>
+
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/sync/event.h"
+
+namespace whisper {
+namespace rpc {
+
+TcpClient::TcpClient(net::Selector* selector,
+                     const net::NetFactory& net_factory,
+                     net::PROTOCOL net_protocol,
+                     const net::HostPort& server,
+                     const std::string& service_path,
+                     int32 reopen_connection_interval_ms)
+  : RpcChannel(),
+    selector_(selector),
+    net_factory_(net_factory),
+    net_protocol_(net_protocol),
+    server_(server),
+    service_path_(service_path),
+    reopen_connection_interval_ms_(reopen_connection_interval_ms),
+    xid_(2 + (timer::TicksNsec() % 256)),
+    closing_(false),
+    net_connection_(NULL),
+    connected_(false),
+    last_connect_error_ms_(0) {
+}
+
+TcpClient::~TcpClient() {
+  CHECK(calls_.empty());
+  delete net_connection_;
+}
+
+void TcpClient::StartClose() {
+  if (!selector_->IsInSelectThread()) {
+    selector_->RunInSelectLoop(whisper::NewCallback(this, &TcpClient::StartClose));
+    return;
+  }
+  LOG_INFO << "Starting to close rpc tcp client: " << ToString();
+  closing_ = true;
+  std::vector<Call*> calls;
+  for (CallMap::const_iterator it = calls_.begin(); it != calls_.end(); ++it) {
+    calls.push_back(it->second);
+  }
+  for (size_t i = 0; i < calls.size(); ++i) {
+    FailCall(calls[i], ERROR_CLIENT, "We are closing the client");
+  }
+  if (net_connection_ != NULL) {
+    net_connection_->ForceClose();
+  }
+  selector_->DeleteInSelectLoop(this);
+}
+
+std::string TcpClient::ToString() const {
+  return strutil::StringPrintf(
+    "TcpClient{server_: %s, service_path_: %s}",
+    server_.ToString().c_str(), service_path_.c_str());
+}
+
+void TcpClient::CallMethod(const google::protobuf::MethodDescriptor* method,
+                           google::protobuf::RpcController* controller,
+                           const google::protobuf::Message* request,
+                           google::protobuf::Message* response,
+                           google::protobuf::Closure* done) {
+  rpc::Controller* rpc_controller = reinterpret_cast<rpc::Controller*>(controller);
+  synch::Event* done_ev = NULL;
+  if (done == NULL) {
+    CHECK(!rpc_controller->is_streaming())
+      << "Streaming calls need a permanent done callback";
+    CHECK(!selector_->IsInSelectThread())
+      << "Synchronous calls would block the selector forever";
+    done_ev = new synch::Event(false, true);
+  }
+  const int64 xid = GetNextXid();
+  Call* const call = new Call(
+    xid, method, rpc_controller, request, response,
+    done == NULL
+    ? ::google::protobuf::internal::NewCallback(done_ev, &synch::Event::Signal)
+    : done,
+    ::google::protobuf::internal::NewPermanentCallback(
+      this, &TcpClient::CallbackCancelRequested, xid));
+  if (selector_->IsInSelectThread()) {
+    StartCall(call);
+  } else {
+    selector_->RunInSelectLoop(
+      whisper::NewCallback(this, &TcpClient::StartCall, call));
+  }
+  if (done_ev != NULL) {
+    done_ev->Wait();
+    delete done_ev;
+  }
+}
+
+void TcpClient::StartCall(Call* call) {
+  DCHECK(selector_->IsInSelectThread());
+  if (closing_) {
+    FailCall(call, ERROR_CLIENT, "We are closing the client");
+    return;
+  }
+  if (net_connection_ == NULL && !Connect()) {
+    FailCall(call, ERROR_NETWORK, "Cannot connect to: " + server_.ToString());
+    return;
+  }
+  const uint32 method_id = tcp::MethodId(service_path_, call->method_->name());
+  const int64 timeout_ms = call->controller_->timeout_ms();
+  if (!tcp::WriteRequestFrame(
+        call->controller_->is_streaming() ? tcp::FLAG_STREAMING : 0,
+        method_id, call->xid_, timeout_ms > 0 ? uint32(timeout_ms) : 0,
+        *call->request_, output())) {
+    FailCall(call, ERROR_CLIENT, "Uninitialized request: " +
+             call->request_->InitializationErrorString());
+    return;
+  }
+  Flush();
+  calls_.insert(std::make_pair(call->xid_, call));
+  call->controller_->NotifyOnCancel(call->cancel_callback_);
+}
+
+void TcpClient::CallbackCancelRequested(int64 xid) {
+  // Always in the next loop - this may be called from within StartCall
+  selector_->RunInSelectLoop(
+    whisper::NewCallback(this, &TcpClient::CancelCall, xid));
+}
+
+void TcpClient::CancelCall(int64 xid) {
+  CallMap::const_iterator it = calls_.find(xid);
+  if (it == calls_.end()) {
+    return;   // completed already
+  }
+  if (net_connection_ != NULL) {
+    tcp::WriteFrameHeader(tcp::FrameHeader(0, tcp::FRAME_CANCEL, 0, 0, xid),
+                          output());
+    Flush();
+  }
+  // The controller is already marked as cancelled
+  CompleteCall(it->second);
+}
+
+void TcpClient::FailCall(Call* call, rpc::ErrorCode error_code,
+                         const std::string& reason) {
+  if (error_code == ERROR_NONE || error_code == ERROR_CANCELLED) {
+    error_code = ERROR_SERVER;
+  }
+  call->controller_->SetErrorCode(error_code);
+  call->controller_->SetFailed(reason.empty()
+                               ? GetErrorCodeString(error_code) : reason);
+  CompleteCall(call);
+}
+
+void TcpClient::CompleteCall(Call* call) {
+  calls_.erase(call->xid_);
+  // From this moment the call cannot be canceled
+  call->controller_->NotifyOnCancel(NULL);
+  call->controller_->set_is_finalized();
+  google::protobuf::Closure* const done = call->done_;
+  delete call;
+  done->Run();
+}
+
+bool TcpClient::Connect() {
+  if (last_connect_error_ms_ > 0 &&
+      selector_->now() - last_connect_error_ms_ < reopen_connection_interval_ms_) {
+    return false;
+  }
+  net_connection_ = net_factory_.CreateConnection(net_protocol_);
+  net_connection_->SetConnectHandler(whisper::NewPermanentCallback(
+      this, &TcpClient::ConnectionConnectHandler), true);
+  net_connection_->SetReadHandler(whisper::NewPermanentCallback(
+      this, &TcpClient::ConnectionReadHandler), true);
+  net_connection_->SetWriteHandler(whisper::NewPermanentCallback(
+      this, &TcpClient::ConnectionWriteHandler), true);
+  net_connection_->SetCloseHandler(whisper::NewPermanentCallback(
+      this, &TcpClient::ConnectionCloseHandler), true);
+  connected_ = false;
+  if (!net_connection_->Connect(server_)) {
+    LOG_WARN << "RPC tcp - error connecting to: " << server_;
+    last_connect_error_ms_ = selector_->now();
+    selector_->DeleteInSelectLoop(net_connection_);
+    net_connection_ = NULL;
+    return false;
+  }
+  return true;
+}
+
+void TcpClient::ConnectionConnectHandler() {
+  connected_ = true;
+  last_connect_error_ms_ = 0;
+  if (!pending_output_.IsEmpty()) {
+    net_connection_->Write(&pending_output_);
+  }
+}
+
+bool TcpClient::ConnectionReadHandler() {
+  io::MemoryStream* const in = net_connection_->inbuf();
+  tcp::FrameHeader header;
+  while (tcp::PeekFrameHeader(*in, &header)) {
+    if (header.length_ > tcp::kDefaultMaxFrameSize) {
+      LOG_WARN << "RPC tcp - frame too long from: " << server_
+               << " - " << header.ToString();
+      return false;
+    }
+    if (in->Size() < tcp::kFrameHeaderSize + header.length_) {
+      break;
+    }
+    in->Skip(tcp::kFrameHeaderSize);
+    if (!ProcessFrame(header)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool TcpClient::ProcessFrame(const tcp::FrameHeader& header) {
+  io::MemoryStream* const in = net_connection_->inbuf();
+  CallMap::const_iterator it = calls_.find(header.xid_);
+  if (it == calls_.end()) {
+    in->Skip(header.length_);   // a call that we cancelled
+    return true;
+  }
+  Call* const call = it->second;
+  switch (header.type_) {
+    case tcp::FRAME_REPLY:
+      if (!tcp::ReadMessagePayload(in, header.length_, call->response_)) {
+        LOG_WARN << "Parsing Response Error: " << call->method_->full_name()
+                 << " size: " << header.length_;
+        call->controller_->SetErrorCode(ERROR_PARSE);
+        call->controller_->SetFailed("Error parsing the response");
+      }
+      CompleteCall(call);
+      return true;
+    case tcp::FRAME_STREAM: {
+      // A NULL message is pushed when parsing fails - as rpc::HttpClient
+      google::protobuf::Message* message = call->response_->New();
+      if (!tcp::ReadMessagePayload(in, header.length_, message)) {
+        LOG_WARN << "Parsing Response Error: " << call->method_->full_name()
+                 << " size: " << header.length_;
+        delete message;
+        message = NULL;
+      }
+      call->controller_->PushStreamedMessage(message);
+      call->done_->Run();
+      return true;
+    }
+    case tcp::FRAME_STREAM_END:
+      in->Skip(header.length_);
+      CompleteCall(call);
+      return true;
+    case tcp::FRAME_ERROR: {
+      std::string reason;
+      in->ReadString(&reason, header.length_);
+      FailCall(call, static_cast<rpc::ErrorCode>(header.code_), reason);
+      return true;
+    }
+  }
+  LOG_WARN << "RPC tcp - unexpected frame from: " << server_
+           << " - " << header.ToString();
+  return false;
+}
+
+void TcpClient::ConnectionCloseHandler(int err,
+                                       net::NetConnection::CloseWhat what) {
+  if (what != net::NetConnection::CLOSE_READ_WRITE) {
+    net_connection_->ForceClose();
+    return;
+  }
+  if (!connected_) {
+    LOG_WARN << "RPC tcp - cannot connect to: " << server_
+             << " err: " << err;
+    last_connect_error_ms_ = selector_->now();
+  }
+  selector_->DeleteInSelectLoop(net_connection_);
+  net_connection_ = NULL;
+  connected_ = false;
+  pending_output_.Clear();
+
+  std::vector<Call*> calls;
+  for (CallMap::const_iterator it = calls_.begin(); it != calls_.end(); ++it) {
+    calls.push_back(it->second);
+  }
+  for (size_t i = 0; i < calls.size(); ++i) {
+    FailCall(calls[i], ERROR_NETWORK, "Connection closed");
+  }
+}
+
+TcpClient::Call::Call(int64 xid,
+                      const google::protobuf::MethodDescriptor* method,
+                      rpc::Controller* controller,
+                      const google::protobuf::Message* request,
+                      google::protobuf::Message* response,
+                      google::protobuf::Closure* done,
+                      google::protobuf::Closure* cancel_callback)
+  : xid_(xid),
+    method_(method),
+    controller_(controller),
+    request_(request),
+    response_(response),
+    done_(done),
+    cancel_callback_(cancel_callback) {
+}
+
+TcpClient::Call::~Call() {
+  delete cancel_callback_;
+}
+
+}  // namespace rpc
+}  // namespace whisper
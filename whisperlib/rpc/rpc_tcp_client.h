@@ -0,0 +1,187 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A rpc channel talking the binary framed protocol of rpc_tcp_frames.h to
+// a rpc::TcpServer, over one persistent connection that multiplexes all
+// the calls issued on this channel.
+//
+#ifndef __WHISPERLIB_RPC_RPC_TCP_CLIENT_H__
+#define __WHISPERLIB_RPC_RPC_TCP_CLIENT_H__
+
+#include <atomic>
+#include <string>
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/hash.h"
+#include WHISPER_HASH_MAP_HEADER
+#include "whisperlib/io/buffer/memory_stream.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
+#include <google/protobuf/service.h>
+
+namespace whisper {
+namespace net {
+class Selector;
+}
+namespace rpc {
+
+//
+// The connection is opened on the first call, and reopened on demand after
+// it closes (but not sooner than reopen_connection_interval_ms after a
+// failed connect - the calls fail w/ ERROR_NETWORK meanwhile). When the
+// connection breaks, all the calls in flight fail w/ ERROR_NETWORK - there
+// are no retries at this level.
+//
+// Same as rpc::HttpClient, create it w/ new and call StartClose() to delete
+// it (in the selector), and pass a permanent done closure for streaming
+// calls, which is run for every new batch of streamed messages, and once
+// more when the stream ends.
+//
+class TcpClient : public google::protobuf::RpcChannel {
+ public:
+  // service_path is the path under which the service was registered in the
+  // rpc::HttpServer: the sub_path of RegisterService joined w/ the service
+  // full name (e.g. "test/whisper.rpc.TestService").
+  // We don't own the net_factory, which needs to live longer than us.
+  TcpClient(net::Selector* selector,
+            const net::NetFactory& net_factory,
+            net::PROTOCOL net_protocol,
+            const net::HostPort& server,
+            const std::string& service_path,
+            int32 reopen_connection_interval_ms = 5000);
+  // Don't call the destructor directly, call StartClose
+  virtual ~TcpClient();
+
+  // Fails all pending calls (w/ ERROR_CLIENT), closes the connection and
+  // deletes this client in the selector.
+  void StartClose();
+
+  std::string ToString() const;
+
+  // Main interface function - calls the proper method.
+  // The controller *must* be of rpc::Controller type
+  virtual void CallMethod(const google::protobuf::MethodDescriptor* method,
+                          google::protobuf::RpcController* controller,
+                          const google::protobuf::Message* request,
+                          google::protobuf::Message* response,
+                          google::protobuf::Closure* done);
+
+  net::Selector* selector() const {
+    return selector_;
+  }
+  const net::HostPort& server() const {
+    return server_;
+  }
+  const std::string& service_path() const {
+    return service_path_;
+  }
+
+ private:
+  struct Call {
+    Call(int64 xid,
+         const google::protobuf::MethodDescriptor* method,
+         rpc::Controller* controller,
+         const google::protobuf::Message* request,
+         google::protobuf::Message* response,
+         google::protobuf::Closure* done,
+         google::protobuf::Closure* cancel_callback);
+    ~Call();
+
+    const int64 xid_;
+    const google::protobuf::MethodDescriptor* const method_;
+    rpc::Controller* const controller_;
+    const google::protobuf::Message* const request_;
+    google::protobuf::Message* const response_;
+    google::protobuf::Closure* const done_;
+    google::protobuf::Closure* const cancel_callback_;   // permanent
+  };
+
+  int64 GetNextXid() {
+    return xid_.fetch_add(1);
+  }
+
+  // Sends a call from the selector thread
+  void StartCall(Call* call);
+  // The cancel callback of our controllers (from any thread) ..
+  void CallbackCancelRequested(int64 xid);
+  // .. which cancels the call in the selector thread
+  void CancelCall(int64 xid);
+  // Sets the error of a call and completes it
+  void FailCall(Call* call, rpc::ErrorCode error_code,
+                const std::string& reason);
+  // Runs the done of a call and deletes it (w/ the call unregistered)
+  void CompleteCall(Call* call);
+
+  // Opens a new connection to the server - false on error.
+  bool Connect();
+  void ConnectionConnectHandler();
+  bool ConnectionReadHandler();
+  bool ConnectionWriteHandler() {
+    return true;
+  }
+  void ConnectionCloseHandler(int err, net::NetConnection::CloseWhat what);
+  // Processes a server frame, w/ the payload in the connection input
+  bool ProcessFrame(const tcp::FrameHeader& header);
+
+  // Where we write the frames: the connection, or the pending buffer
+  // until the connection is established.
+  io::MemoryStream* output() {
+    return connected_ ? net_connection_->outbuf() : &pending_output_;
+  }
+  void Flush() {
+    if (connected_) net_connection_->RequestWriteEvents(true);
+  }
+
+  net::Selector* const selector_;
+  const net::NetFactory& net_factory_;
+  const net::PROTOCOL net_protocol_;
+  const net::HostPort server_;
+  const std::string service_path_;
+  const int32 reopen_connection_interval_ms_;
+
+  std::atomic_int_fast64_t xid_;   // next call id
+  bool closing_;
+
+  // The connection and its state - used only in the selector thread
+  net::NetConnection* net_connection_;
+  bool connected_;
+  int64 last_connect_error_ms_;
+  io::MemoryStream pending_output_;
+
+  typedef hash_map<int64, Call*> CallMap;
+  CallMap calls_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TcpClient);
+};
+
+}  // namespace rpc
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_RPC_RPC_TCP_CLIENT_H__
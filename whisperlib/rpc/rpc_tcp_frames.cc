@@ -0,0 +1,202 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/rpc/rpc_tcp_frames.h"
+
+#include <google/protobuf/message.h>
+#include <google/protobuf/io/coded_stream.h>
+
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/io/buffer/protobuf_stream.h"
+
+namespace whisper {
+namespace rpc {
+namespace tcp {
+
+const char* FrameTypeName(uint8 type) {
+  switch ( type ) {
+    CONSIDER(FRAME_REQUEST);
+    CONSIDER(FRAME_CANCEL);
+    CONSIDER(FRAME_REPLY);
+    CONSIDER(FRAME_STREAM);
+    CONSIDER(FRAME_STREAM_END);
+    CONSIDER(FRAME_ERROR);
+  }
+  return "FRAME_UNKNOWN";
+}
+
+std::string FrameHeader::ToString() const {
+  return strutil::StringPrintf("%s[xid: %" PRId64 ", flags: 0x%x, code: %u"
+                               ", length: %u]",
+                               FrameTypeName(type_), xid_,
+                               static_cast<unsigned>(flags_),
+                               static_cast<unsigned>(code_),
+                               static_cast<unsigned>(length_));
+}
+
+namespace {
+inline uint32 DecodeUInt32(const char* p) {
+  const uint8* const b = reinterpret_cast<const uint8*>(p);
+  return (static_cast<uint32>(b[0]) << 24) | (static_cast<uint32>(b[1]) << 16) |
+         (static_cast<uint32>(b[2]) << 8) | b[3];
+}
+inline void EncodeUInt32(uint32 value, char* p) {
+  p[0] = static_cast<char>(value >> 24);
+  p[1] = static_cast<char>(value >> 16);
+  p[2] = static_cast<char>(value >> 8);
+  p[3] = static_cast<char>(value);
+}
+}  // namespace
+
+bool PeekFrameHeader(const io::MemoryStream& in, FrameHeader* header) {
+  char buf[kFrameHeaderSize];
+  if ( in.Peek(buf, sizeof(buf)) < sizeof(buf) ) {
+    return false;
+  }
+  header->length_ = DecodeUInt32(buf);
+  header->type_ = static_cast<uint8>(buf[4]);
+  header->flags_ = static_cast<uint8>(buf[5]);
+  header->code_ = DecodeUInt32(buf + 6);
+  header->xid_ = static_cast<int64>(
+      (static_cast<uint64>(DecodeUInt32(buf + 10)) << 32) |
+      DecodeUInt32(buf + 14));
+  return true;
+}
+
+void WriteFrameHeader(const FrameHeader& header, io::MemoryStream* out) {
+  char buf[kFrameHeaderSize];
+  EncodeUInt32(header.length_, buf);
+  buf[4] = static_cast<char>(header.type_);
+  buf[5] = static_cast<char>(header.flags_);
+  EncodeUInt32(header.code_, buf + 6);
+  EncodeUInt32(static_cast<uint32>(static_cast<uint64>(header.xid_) >> 32),
+               buf + 10);
+  EncodeUInt32(static_cast<uint32>(header.xid_), buf + 14);
+  out->Write(buf, sizeof(buf));
+}
+
+void WriteFrame(uint8 type, uint8 flags, uint32 code, int64 xid,
+                const std::string& payload, io::MemoryStream* out) {
+  WriteFrameHeader(FrameHeader(payload.size(), type, flags, code, xid), out);
+  if ( !payload.empty() ) {
+    out->Write(payload.data(), payload.size());
+  }
+}
+
+namespace {
+// Appends message, serialized w/ the sizes cached by a previous ByteSize()
+bool WriteCachedMessage(const google::protobuf::Message& message,
+                        io::MemoryStream* out) {
+  io::ProtobufWriteStream stream(out);
+  google::protobuf::io::CodedOutputStream coded(&stream);
+  message.SerializeWithCachedSizes(&coded);
+  return !coded.HadError();
+}
+}  // namespace
+
+bool WriteMessageFrame(uint8 type, uint8 flags, uint32 code, int64 xid,
+                       const google::protobuf::Message& message,
+                       io::MemoryStream* out) {
+  if ( !message.IsInitialized() ) {
+    return false;
+  }
+  WriteFrameHeader(FrameHeader(message.ByteSize(), type, flags, code, xid), out);
+  return WriteCachedMessage(message, out);
+}
+
+bool WriteRequestFrame(uint8 flags, uint32 code, int64 xid, uint32 timeout_ms,
+                       const google::protobuf::Message& request,
+                       io::MemoryStream* out) {
+  if ( timeout_ms == 0 ) {
+    return WriteMessageFrame(FRAME_REQUEST, flags & ~FLAG_DEADLINE, code, xid,
+                             request, out);
+  }
+  if ( !request.IsInitialized() ) {
+    return false;
+  }
+  WriteFrameHeader(FrameHeader(kDeadlineSize + request.ByteSize(),
+                               FRAME_REQUEST, flags | FLAG_DEADLINE, code, xid),
+                   out);
+  char buf[kDeadlineSize];
+  EncodeUInt32(timeout_ms, buf);
+  out->Write(buf, sizeof(buf));
+  return WriteCachedMessage(request, out);
+}
+
+bool ReadDeadline(io::MemoryStream* in, uint32* size, uint32* timeout_ms) {
+  char buf[kDeadlineSize];
+  if ( *size < kDeadlineSize || in->Peek(buf, sizeof(buf)) < sizeof(buf) ) {
+    return false;
+  }
+  in->Skip(sizeof(buf));
+  *size -= kDeadlineSize;
+  *timeout_ms = DecodeUInt32(buf);
+  return true;
+}
+
+bool ReadMessagePayload(io::MemoryStream* in, uint32 size,
+                        google::protobuf::Message* message) {
+  // The limit of io::ParseProto only stops it at block boundaries, so the
+  // next frame in the same block would be parsed too - we bound the parsing
+  // in the coded stream, which also gives back whatever it read ahead.
+  const size_t init_size = in->Size();
+  bool success = false;
+  {
+    io::ProtobufReadStream stream(in);
+    google::protobuf::io::CodedInputStream coded(&stream);
+    coded.PushLimit(size);
+    success = message->ParseFromCodedStream(&coded) &&
+              coded.ConsumedEntireMessage();
+  }
+  const size_t parsed = init_size - in->Size();
+  if ( parsed < size ) {
+    in->Skip(size - parsed);
+  }
+  return success;
+}
+
+uint32 MethodId(const std::string& service_path,
+                const std::string& method_name) {
+  // FNV-1a over "service_path/method_name" - stable across builds and
+  // platforms, as both ends of a connection have to agree on it.
+  uint32 h = 2166136261u;
+  for ( size_t i = 0; i < service_path.size(); ++i ) {
+    h = (h ^ static_cast<uint8>(service_path[i])) * 16777619u;
+  }
+  h = (h ^ static_cast<uint8>('/')) * 16777619u;
+  for ( size_t i = 0; i < method_name.size(); ++i ) {
+    h = (h ^ static_cast<uint8>(method_name[i])) * 16777619u;
+  }
+  return h;
+}
+
+}  // namespace tcp
+}  // namespace rpc
+}  // namespace whisper
@@ -0,0 +1,133 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Framing of the binary rpc protocol over persistent TCP connections, used
+// by rpc::TcpServer and rpc::TcpClient. A connection carries any number of
+// concurrent calls, each identified by the xid the client picked for it.
+// Every frame is a fixed header followed by its payload:
+//
+//   uint32 length   - of the payload following the header
+//   uint8  type     - FrameType
+//   uint8  flags    - FrameFlag
+//   uint32 code     - the method id for FRAME_REQUEST, the rpc::ErrorCode
+//                     for FRAME_ERROR, 0 otherwise
+//   int64  xid      - the call this frame belongs to
+//
+// All numbers are big endian. Payloads are serialized protobufs, except for
+// FRAME_ERROR, which carries the error reason text.
+//
+#ifndef __WHISPERLIB_RPC_RPC_TCP_FRAMES_H__
+#define __WHISPERLIB_RPC_RPC_TCP_FRAMES_H__
+
+#include <string>
+#include "whisperlib/base/types.h"
+#include "whisperlib/io/buffer/memory_stream.h"
+
+namespace google { namespace protobuf {
+class Message;
+} }
+
+namespace whisper {
+namespace rpc {
+namespace tcp {
+
+static const size_t kFrameHeaderSize = 18;
+// Frames longer than this close the connection, as a protection
+// against garbage on the wire.
+static const uint32 kDefaultMaxFrameSize = 64 << 20;
+
+enum FrameType {
+  FRAME_REQUEST = 0x1,     // client -> server, payload: the request
+  FRAME_CANCEL = 0x2,      // client -> server, no payload
+  FRAME_REPLY = 0x3,       // server -> client, payload: the response
+  FRAME_STREAM = 0x4,      // server -> client, payload: a streamed response
+  FRAME_STREAM_END = 0x5,  // server -> client, no payload
+  FRAME_ERROR = 0x6,       // server -> client, payload: the error reason
+};
+const char* FrameTypeName(uint8 type);
+
+enum FrameFlag {
+  FLAG_STREAMING = 0x1,    // REQUEST - the server should stream responses
+  FLAG_DEADLINE = 0x2,     // REQUEST - the payload starts w/ the timeout of
+                           //   the call (kDeadlineSize bytes, in ms), which
+                           //   the server sets on the call controller.
+};
+static const size_t kDeadlineSize = 4;
+
+struct FrameHeader {
+  uint32 length_;
+  uint8 type_;
+  uint8 flags_;
+  uint32 code_;
+  int64 xid_;
+  FrameHeader() : length_(0), type_(0), flags_(0), code_(0), xid_(0) {}
+  FrameHeader(uint32 length, uint8 type, uint8 flags, uint32 code, int64 xid)
+      : length_(length), type_(type), flags_(flags), code_(code), xid_(xid) {}
+  std::string ToString() const;
+};
+
+// Peeks a frame header from the start of in (w/o consuming it). Returns
+// false if there is not enough data.
+bool PeekFrameHeader(const io::MemoryStream& in, FrameHeader* header);
+
+// Frame writers - each appends a full frame to out:
+void WriteFrameHeader(const FrameHeader& header, io::MemoryStream* out);
+void WriteFrame(uint8 type, uint8 flags, uint32 code, int64 xid,
+                const std::string& payload, io::MemoryStream* out);
+// Returns false, w/o writing anything, if message is not initialized.
+bool WriteMessageFrame(uint8 type, uint8 flags, uint32 code, int64 xid,
+                       const google::protobuf::Message& message,
+                       io::MemoryStream* out);
+
+// Writes a FRAME_REQUEST frame for request. A non zero timeout_ms is
+// prepended to it, under FLAG_DEADLINE.
+bool WriteRequestFrame(uint8 flags, uint32 code, int64 xid, uint32 timeout_ms,
+                       const google::protobuf::Message& request,
+                       io::MemoryStream* out);
+// Consumes the deadline prefix of a FLAG_DEADLINE request payload of *size
+// bytes from in, and decrements *size accordingly. Returns false, w/o
+// consuming anything, if the payload is too short.
+bool ReadDeadline(io::MemoryStream* in, uint32* size, uint32* timeout_ms);
+
+// Parses message from the next size bytes of in, which are consumed
+// no matter the outcome.
+bool ReadMessagePayload(io::MemoryStream* in, uint32 size,
+                        google::protobuf::Message* message);
+
+// The id under which the clients call the method method_name of the
+// service registered under service_path in rpc::HttpServer (i.e. the
+// sub_path joined w/ the full service name, as in the HTTP urls).
+uint32 MethodId(const std::string& service_path,
+                const std::string& method_name);
+
+}  // namespace tcp
+}  // namespace rpc
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_RPC_RPC_TCP_FRAMES_H__
@@ -0,0 +1,524 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+#include "whisperlib/rpc/rpc_tcp_server.h"
+
+#include <algorithm>
+#include <google/protobuf/service.h>
+#include <google/protobuf/message.h>
+#include <google/protobuf/descriptor.h>
+
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/net/ipclassifier.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/rpc/rpc_consts.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_http_server.h"
+
+namespace whisper {
+namespace rpc {
+
+//////////////////////////////////////////////////////////////////////
+//
+// rpc::TcpServer
+//
+TcpServer::TcpServer(net::Selector* selector,
+                     const net::NetFactory& net_factory,
+                     HttpServer* rpc_server,
+                     int max_concurrent_requests,
+                     const std::string& ip_class_restriction)
+  : selector_(selector),
+    net_factory_(net_factory),
+    rpc_server_(rpc_server),
+    max_concurrent_requests_(max_concurrent_requests),
+    accepted_clients_(ip_class_restriction.empty() ? NULL
+      : net::IpClassifier::CreateClassifier(ip_class_restriction)),
+    max_frame_size_(tcp::kDefaultMaxFrameSize),
+    max_output_buffer_size_(1 << 20),
+    max_concurrent_connections_(10000),
+    num_connections_(0),
+    num_current_requests_(0) {
+}
+
+TcpServer::~TcpServer() {
+  for (size_t i = 0; i < acceptors_.size(); ++i) {
+    delete acceptors_[i].first;
+  }
+  acceptors_.clear();
+  delete accepted_clients_;
+  LOG_INFO_IF(num_connections_ > 0)
+    << " Exiting the RPC tcp server with " << num_connections_
+    << " connections still open !!";
+}
+
+void TcpServer::AddAcceptor(net::PROTOCOL net_protocol,
+                            const net::HostPort& local_address) {
+  net::NetAcceptor* const acceptor = net_factory_.CreateAcceptor(net_protocol);
+  acceptor->SetFilterHandler(whisper::NewPermanentCallback(
+      this, &TcpServer::AcceptorFilterHandler), true);
+  acceptor->SetAcceptHandler(whisper::NewPermanentCallback(
+      this, &TcpServer::AcceptorAcceptHandler), true);
+  acceptors_.push_back(std::make_pair(acceptor, local_address));
+}
+
+void TcpServer::StartServing() {
+  for (size_t i = 0; i < acceptors_.size(); ++i) {
+    CHECK(acceptors_[i].first->Listen(acceptors_[i].second));
+    LOG_INFO << "RPC tcp turned on listening on: " << acceptors_[i].second;
+  }
+}
+
+void TcpServer::StopServing() {
+  for (size_t i = 0; i < acceptors_.size(); ++i) {
+    acceptors_[i].first->Close();
+  }
+}
+
+bool TcpServer::AcceptorFilterHandler(const net::HostPort& peer_address) {
+  if (num_connections_ >= max_concurrent_connections_) {
+    LOG_WARN << "RPC tcp - too many connections ! - refusing "
+             << peer_address;
+    return false;
+  }
+  if (accepted_clients_ != NULL &&
+      !accepted_clients_->IsInClass(peer_address.ip_object())) {
+    LOG_WARN << "RPC tcp - client not accepted for ip address: "
+             << peer_address;
+    return false;
+  }
+  return true;
+}
+
+void TcpServer::AcceptorAcceptHandler(net::NetConnection* net_connection) {
+  ++num_connections_;
+  new TcpServerConnection(this, net_connection);
+}
+
+bool TcpServer::StartRequest() {
+  if (++num_current_requests_ > max_concurrent_requests_) {
+    --num_current_requests_;
+    return false;
+  }
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////
+//
+// rpc::TcpServerConnection
+//
+TcpServerConnection::TcpServerConnection(TcpServer* server,
+                                         net::NetConnection* net_connection)
+  : selector_(net_connection->net_selector()),
+    server_(server),
+    net_connection_(net_connection),
+    local_address_(net_connection->local_address()),
+    peer_address_(net_connection->remote_address()),
+    closed_(false),
+    deleting_(false) {
+  net_connection_->SetReadHandler(whisper::NewPermanentCallback(
+      this, &TcpServerConnection::ConnectionReadHandler), true);
+  net_connection_->SetWriteHandler(whisper::NewPermanentCallback(
+      this, &TcpServerConnection::ConnectionWriteHandler), true);
+  net_connection_->SetCloseHandler(whisper::NewPermanentCallback(
+      this, &TcpServerConnection::ConnectionCloseHandler), true);
+}
+
+TcpServerConnection::~TcpServerConnection() {
+  CHECK(calls_.empty());
+  delete net_connection_;
+  server_->RemoveConnection();
+}
+
+bool TcpServerConnection::ConnectionReadHandler() {
+  DCHECK(selector_->IsInSelectThread());
+  io::MemoryStream* const in = net_connection_->inbuf();
+  tcp::FrameHeader header;
+  while (!closed_ && tcp::PeekFrameHeader(*in, &header)) {
+    if (header.length_ > server_->max_frame_size()) {
+      LOG_WARN << "RPC tcp - frame too long from: " << peer_address_
+               << " - " << header.ToString();
+      return false;
+    }
+    if (in->Size() < tcp::kFrameHeaderSize + header.length_) {
+      break;
+    }
+    in->Skip(tcp::kFrameHeaderSize);
+    switch (header.type_) {
+      case tcp::FRAME_REQUEST:
+        StartCall(header);
+        break;
+      case tcp::FRAME_CANCEL:
+        in->Skip(header.length_);
+        CancelCall(header.xid_);
+        break;
+      default:
+        LOG_WARN << "RPC tcp - unexpected frame from: " << peer_address_
+                 << " - " << header.ToString();
+        return false;
+    }
+  }
+  return true;
+}
+
+bool TcpServerConnection::ConnectionWriteHandler() {
+  DCHECK(selector_->IsInSelectThread());
+  if (!blocked_streams_.empty() &&
+      net_connection_->outbuf()->Size() < server_->max_output_buffer_size() / 2) {
+    std::vector<Call*> to_resume;
+    to_resume.swap(blocked_streams_);
+    for (size_t i = 0; i < to_resume.size(); ++i) {
+      to_resume[i]->stream_blocked_ = false;
+      StreamSomeData(to_resume[i]);
+    }
+  }
+  return true;
+}
+
+void TcpServerConnection::ConnectionCloseHandler(
+    int /*err*/, net::NetConnection::CloseWhat what) {
+  DCHECK(selector_->IsInSelectThread());
+  if (what != net::NetConnection::CLOSE_READ_WRITE) {
+    net_connection_->FlushAndClose();
+    return;
+  }
+  if (closed_) {
+    return;
+  }
+  closed_ = true;
+  // Nobody to reply to anymore - cancel everything in flight. Normal calls
+  // complete when the implementation runs their done callbacks.
+  std::vector<Call*> calls;
+  for (CallMap::const_iterator it = calls_.begin(); it != calls_.end(); ++it) {
+    calls.push_back(it->second);
+  }
+  for (size_t i = 0; i < calls.size(); ++i) {
+    Call* const call = calls[i];
+    if (call->completed_) continue;
+    call->cancelled_ = true;
+    if (call->controller_.is_streaming()) {
+      call->controller_.FinalizeStreamingOnNetworkError();
+      CompleteCall(call);
+    } else {
+      call->controller_.CallCancelCallback(true);
+    }
+  }
+  MaybeDelete();
+}
+
+void TcpServerConnection::StartCall(const tcp::FrameHeader& header) {
+  const int64 received_ns = timer::TicksNsec();
+  io::MemoryStream* const in = net_connection_->inbuf();
+  RegisteredMethod* const method = server_->rpc_server()->FindMethod(header.code_);
+  if (method == NULL) {
+    in->Skip(header.length_);
+    LOG_WARN << "RPC tcp - unknown method id from: " << peer_address_
+             << " - " << header.ToString();
+    WriteError(header.xid_, ERROR_USER, kRpcErrorMethodNotFound);
+    return;
+  }
+  if (calls_.find(header.xid_) != calls_.end()) {
+    in->Skip(header.length_);
+    WriteError(header.xid_, ERROR_CLIENT, "Duplicate xid");
+    return;
+  }
+  if (!server_->StartRequest()) {
+    in->Skip(header.length_);
+    LOG_WARN << "RPC tcp - too many concurrent requests: "
+             << server_->num_current_requests();
+    method->stats_.RecordCall(ERROR_SERVER,
+                              tcp::kFrameHeaderSize + header.length_, 0,
+                              -1, -1, -1);
+    WriteError(header.xid_, ERROR_SERVER, kRpcErrorServerOverloaded);
+    return;
+  }
+  // The call may come w/ its deadline
+  uint32 size = header.length_;
+  uint32 timeout_ms = 0;
+  google::protobuf::Message* request = NULL;
+  if ((header.flags_ & tcp::FLAG_DEADLINE) == 0 ||
+      tcp::ReadDeadline(in, &size, &timeout_ms)) {
+    request = method->request_pool_.New();
+    if (!tcp::ReadMessagePayload(in, size, request)) {
+      method->request_pool_.Release(request, size);
+      request = NULL;
+    }
+  } else {
+    in->Skip(size);
+  }
+  if (request == NULL) {
+    server_->EndRequest();
+    LOG_WARN << "RPC tcp - bad request from: " << peer_address_
+             << " for: " << method->path_;
+    method->stats_.RecordCall(ERROR_PARSE,
+                              tcp::kFrameHeaderSize + header.length_, 0,
+                              -1, -1, -1);
+    WriteError(header.xid_, ERROR_PARSE, kRpcErrorBadEncoded);
+    return;
+  }
+  Call* const call = new Call(this, header.xid_, method,
+                              (header.flags_ & tcp::FLAG_STREAMING) != 0,
+                              request, header.length_, received_ns);
+  calls_.insert(std::make_pair(call->xid_, call));
+  rpc::Controller* const controller = &call->controller_;
+  if (timeout_ms > 0) {
+    controller->set_timeout_ms(timeout_ms);
+  }
+  call->call_ns_ = timer::TicksNsec();
+  method->service_->CallMethod(method->method_, controller, request,
+                               call->response_, call);
+  // (the call is deleted only in the next select loop iteration)
+  if (controller->is_streaming() && !call->completed_ &&
+      !controller->IsFinalized()) {
+    StreamSomeData(call);   // maybe start streaming
+  }
+}
+
+void TcpServerConnection::CancelCall(int64 xid) {
+  CallMap::const_iterator it = calls_.find(xid);
+  if (it == calls_.end()) {
+    return;   // completed already
+  }
+  Call* const call = it->second;
+  call->cancelled_ = true;
+  if (call->controller_.is_streaming()) {
+    call->controller_.FinalizeStreamingOnNetworkError();
+    CompleteCall(call);
+  } else {
+    call->controller_.CallCancelCallback(true);
+  }
+}
+
+void TcpServerConnection::CallDone(Call* call) {
+  if (call->done_ns_ == 0) {
+    call->done_ns_ = timer::TicksNsec();
+  }
+  if (!selector_->IsInSelectThread()) {
+    selector_->RunInSelectLoop(
+      whisper::NewCallback(this, &TcpServerConnection::CallDone, call));
+    return;
+  }
+  rpc::Controller* const controller = &call->controller_;
+  controller->set_is_finalized();
+  controller->CallCancelCallback(false);
+  if (!closed_ && !call->cancelled_) {
+    const size_t out_size = net_connection_->outbuf()->Size();
+    if (controller->Failed()) {
+      WriteError(call->xid_, controller->GetErrorCode(),
+                 controller->GetErrorReason());
+    } else if (!tcp::WriteMessageFrame(tcp::FRAME_REPLY, 0, 0, call->xid_,
+                                       *call->response_,
+                                       net_connection_->outbuf())) {
+      LOG_ERROR << "RPC tcp - error serializing the response: "
+                << call->response_->InitializationErrorString();
+      WriteError(call->xid_, ERROR_SERVER, kRpcErrorSerializingResponse);
+    } else {
+      net_connection_->RequestWriteEvents(true);
+    }
+    call->bytes_out_ += net_connection_->outbuf()->Size() - out_size;
+  }
+  CompleteCall(call);
+}
+
+void TcpServerConnection::StreamCallback(Call* call) {
+  if (!selector_->IsInSelectThread()) {
+    selector_->RunInSelectLoop(
+      whisper::NewCallback(this, &TcpServerConnection::StreamCallback, call));
+    return;
+  }
+  StreamSomeData(call);
+}
+
+void TcpServerConnection::StreamSomeData(Call* call) {
+  if (call->completed_ || call->stream_blocked_) {
+    return;
+  }
+  rpc::Controller* const controller = &call->controller_;
+  if (closed_ || call->cancelled_ || controller->IsCanceled()) {
+    controller->FinalizeStreamingOnNetworkError();
+    CompleteCall(call);
+    return;
+  }
+  if (controller->Failed()) {
+    WriteError(call->xid_, controller->GetErrorCode(),
+               controller->GetErrorReason());
+    CompleteCall(call);
+    return;
+  }
+  io::MemoryStream* const out = net_connection_->outbuf();
+  const size_t out_size = out->Size();
+  bool stream_ended = false;
+  while (out->Size() < server_->max_output_buffer_size()) {
+    std::pair<google::protobuf::Message*, bool> msg =
+      controller->PopStreamedMessage();
+    if (!msg.second) {
+      break;
+    }
+    if (msg.first == NULL) {
+      stream_ended = true;
+      break;
+    }
+    if (!tcp::WriteMessageFrame(tcp::FRAME_STREAM, 0, 0, call->xid_,
+                                *msg.first, out)) {
+      LOG_ERROR << "RPC tcp - error serializing rpc streamed message. "
+                << (server_->rpc_server()->stream_proto_error_close()
+                    ? "closing" : "skipping")
+                << " uninitialized: " << msg.first->InitializationErrorString();
+      if (server_->rpc_server()->stream_proto_error_close()) {
+        delete msg.first;
+        controller->SetErrorCode(ERROR_SERVER);
+        WriteError(call->xid_, ERROR_SERVER, kRpcErrorSerializingResponse);
+        call->bytes_out_ += out->Size() - out_size;
+        CompleteCall(call);
+        return;
+      }
+    }
+    delete msg.first;
+  }
+  // Implicit end of stream - no streaming callback and nothing to send.
+  if (!stream_ended &&
+      controller->server_streaming_callback() == NULL &&
+      !controller->HasStreamedMessage()) {
+    stream_ended = true;
+  }
+  if (stream_ended) {
+    controller->set_is_finalized();
+    tcp::WriteFrameHeader(tcp::FrameHeader(0, tcp::FRAME_STREAM_END, 0, 0,
+                                           call->xid_), out);
+    net_connection_->RequestWriteEvents(true);
+    call->bytes_out_ += out->Size() - out_size;
+    CompleteCall(call);
+    return;
+  }
+  call->bytes_out_ += out->Size() - out_size;
+  net_connection_->RequestWriteEvents(true);
+  if (out->Size() >= server_->max_output_buffer_size()) {
+    // Continue when the client reads some data (ConnectionWriteHandler)
+    call->stream_blocked_ = true;
+    blocked_streams_.push_back(call);
+    return;
+  }
+  if (!call->streaming_scheduled_ && !controller->HasStreamedMessage() &&
+      controller->server_streaming_callback() != NULL) {
+    call->streaming_scheduled_ = true;
+    selector_->RunInSelectLoop(
+      whisper::NewCallback(call, &Call::RunStreamingCallback));
+  }
+}
+
+void TcpServerConnection::CompleteCall(Call* call) {
+  DCHECK(!call->completed_);
+  call->completed_ = true;
+  call->controller_.CallCancelCallback(false);
+  // Streaming calls have no done_ns_ - the handler time lasts until
+  // the stream ends, and the writes are part of it.
+  const int64 end_ns = timer::TicksNsec();
+  const int64 handler_end_ns = call->done_ns_ > 0 ? call->done_ns_ : end_ns;
+  call->method_->stats_.RecordCall(
+    call->cancelled_ ? ERROR_CANCELLED : call->controller_.GetErrorCode(),
+    tcp::kFrameHeaderSize + call->request_size_, call->bytes_out_,
+    (call->call_ns_ - call->received_ns_) / 1000,
+    (handler_end_ns - call->call_ns_) / 1000,
+    call->done_ns_ > 0 ? (end_ns - call->done_ns_) / 1000 : -1);
+  calls_.erase(call->xid_);
+  if (call->stream_blocked_) {
+    blocked_streams_.erase(std::find(blocked_streams_.begin(),
+                                     blocked_streams_.end(), call));
+  }
+  server_->EndRequest();
+  selector_->DeleteInSelectLoop(call);
+  MaybeDelete();
+}
+
+void TcpServerConnection::WriteError(int64 xid, rpc::ErrorCode error_code,
+                                     const std::string& reason) {
+  if (closed_) {
+    return;
+  }
+  tcp::WriteFrame(tcp::FRAME_ERROR, 0, error_code, xid, reason,
+                  net_connection_->outbuf());
+  net_connection_->RequestWriteEvents(true);
+}
+
+void TcpServerConnection::MaybeDelete() {
+  if (closed_ && calls_.empty() && !deleting_) {
+    deleting_ = true;
+    selector_->DeleteInSelectLoop(this);
+  }
+}
+
+TcpServerConnection::Call::Call(TcpServerConnection* connection,
+                                int64 xid,
+                                RegisteredMethod* method,
+                                bool is_streaming,
+                                google::protobuf::Message* request,
+                                uint32 request_size,
+                                int64 received_ns)
+  : connection_(connection),
+    xid_(xid),
+    method_(method),
+    transport_(connection->selector_, rpc::Transport::TCP,
+               connection->local_address_, connection->peer_address_),
+    controller_(&transport_, false),
+    request_(request),
+    request_size_(request_size),
+    response_(method->response_pool_.New()),
+    received_ns_(received_ns),
+    call_ns_(0),
+    done_ns_(0),
+    bytes_out_(0),
+    streaming_scheduled_(false),
+    stream_blocked_(false),
+    cancelled_(false),
+    completed_(false) {
+  controller_.set_is_streaming(is_streaming);
+}
+
+TcpServerConnection::Call::~Call() {
+  method_->request_pool_.Release(request_, request_size_);
+  method_->response_pool_.Release(response_, response_->ByteSizeLong());
+}
+
+void TcpServerConnection::Call::Run() {
+  if (controller_.is_streaming()) {
+    connection_->StreamCallback(this);
+  } else {
+    connection_->CallDone(this);
+  }
+}
+
+void TcpServerConnection::Call::RunStreamingCallback() {
+  streaming_scheduled_ = false;
+  if (!completed_ && controller_.server_streaming_callback() != NULL) {
+    controller_.server_streaming_callback()->Run();
+  }
+}
+
+}  // namespace rpc
+}  // namespace whisper
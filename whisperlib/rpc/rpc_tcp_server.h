@@ -0,0 +1,248 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Serves the rpc services registered in a rpc::HttpServer over the binary
+// framed protocol of rpc_tcp_frames.h, on persistent TCP connections that
+// multiplex any number of concurrent calls. This skips the HTTP encoding
+// and parsing of each call, and is meant for internal clients (there is no
+// authentication - restrict the accepted clients by ip class if needed).
+//
+// Usage:
+//   rpc::HttpServer rpc_server(&http_server, NULL, "/rpc", ...);
+//   rpc_server.RegisterService("sub_path", &service);
+//   rpc::TcpServer tcp_server(&selector, net_factory, &rpc_server, 1000, "");
+//   tcp_server.AddAcceptor(net::PROTOCOL_TCP, net::HostPort(0, port));
+//   selector.RunInSelectLoop(NewCallback(&tcp_server,
+//                                        &rpc::TcpServer::StartServing));
+// and on the client side:
+//   rpc::TcpClient* client = new rpc::TcpClient(
+//       &selector, net_factory, net::PROTOCOL_TCP, server_address,
+//       "sub_path/package.ServiceName");
+//
+#ifndef __WHISPERLIB_RPC_RPC_TCP_SERVER_H__
+#define __WHISPERLIB_RPC_RPC_TCP_SERVER_H__
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/hash.h"
+#include WHISPER_HASH_MAP_HEADER
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
+
+namespace google { namespace protobuf {
+class Closure;
+class Message;
+} }
+
+namespace whisper {
+namespace net {
+class IpClassifier;
+class Selector;
+}
+namespace rpc {
+class HttpServer;
+struct RegisteredMethod;
+class TcpServerConnection;
+
+class TcpServer {
+ public:
+  // The services are looked up in rpc_server, which has to live longer
+  // than us. The connections are accepted in selector, and served in the
+  // selectors given by the acceptor params of net_factory.
+  TcpServer(net::Selector* selector,
+            const net::NetFactory& net_factory,
+            HttpServer* rpc_server,
+            int max_concurrent_requests,
+            const std::string& ip_class_restriction);
+  ~TcpServer();
+
+  // Adds a listening address - call before StartServing()
+  void AddAcceptor(net::PROTOCOL net_protocol,
+                   const net::HostPort& local_address);
+
+  // Starts / stops listening on all acceptors (in the selector thread)
+  void StartServing();
+  void StopServing();
+
+  HttpServer* rpc_server() const {
+    return rpc_server_;
+  }
+  int num_connections() const {
+    return num_connections_;
+  }
+  int num_current_requests() const {
+    return num_current_requests_;
+  }
+
+  // Frames longer than this close the connection
+  uint32 max_frame_size() const {
+    return max_frame_size_;
+  }
+  void set_max_frame_size(uint32 value) {
+    max_frame_size_ = value;
+  }
+  // We stop pulling streamed messages from an implementation when this
+  // much data waits to be written to its client.
+  size_t max_output_buffer_size() const {
+    return max_output_buffer_size_;
+  }
+  void set_max_output_buffer_size(size_t value) {
+    max_output_buffer_size_ = value;
+  }
+  int max_concurrent_connections() const {
+    return max_concurrent_connections_;
+  }
+  void set_max_concurrent_connections(int value) {
+    max_concurrent_connections_ = value;
+  }
+
+ private:
+  friend class TcpServerConnection;
+
+  bool AcceptorFilterHandler(const net::HostPort& peer_address);
+  void AcceptorAcceptHandler(net::NetConnection* net_connection);
+
+  // Accounts for a new call - returns false if we are overloaded.
+  bool StartRequest();
+  void EndRequest() {
+    --num_current_requests_;
+  }
+  void RemoveConnection() {
+    --num_connections_;
+  }
+
+  net::Selector* const selector_;
+  const net::NetFactory& net_factory_;
+  HttpServer* const rpc_server_;
+  const int max_concurrent_requests_;
+  // If not null accept clients only from guys identified under this class
+  net::IpClassifier* const accepted_clients_;
+
+  uint32 max_frame_size_;
+  size_t max_output_buffer_size_;
+  int max_concurrent_connections_;
+
+  std::vector<std::pair<net::NetAcceptor*, net::HostPort> > acceptors_;
+
+  std::atomic_int num_connections_;
+  std::atomic_int num_current_requests_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TcpServer);
+};
+
+// One client connection of a TcpServer - lives in the selector of
+// the connection, and deletes itself after the connection closes and all
+// its calls complete.
+class TcpServerConnection {
+ public:
+  TcpServerConnection(TcpServer* server, net::NetConnection* net_connection);
+  ~TcpServerConnection();
+
+ private:
+  // All the state of a call, in one allocation - it is also the (permanent)
+  // done closure that we pass to the implementation.
+  struct Call : public google::protobuf::Closure {
+    Call(TcpServerConnection* connection, int64 xid, RegisteredMethod* method,
+         bool is_streaming,
+         google::protobuf::Message* request, uint32 request_size,
+         int64 received_ns);
+    virtual ~Call();
+    // The done callback: CallDone, or StreamCallback when streaming
+    virtual void Run();
+    // Asks the implementation for more streamed messages
+    void RunStreamingCallback();
+
+    TcpServerConnection* const connection_;
+    const int64 xid_;
+    RegisteredMethod* const method_;
+    rpc::Transport transport_;
+    rpc::Controller controller_;
+    google::protobuf::Message* const request_;
+    const uint32 request_size_;
+    google::protobuf::Message* const response_;
+    // For the method stats: (timer::TicksNsec()) when the request frame
+    // was read, the implementation called, and done called (if not
+    // streaming), and the size of the frames written for the call.
+    const int64 received_ns_;
+    int64 call_ns_;
+    int64 done_ns_;
+    int64 bytes_out_;
+    bool streaming_scheduled_;
+    bool stream_blocked_;     // waits for space in the output buffer
+    bool cancelled_;          // by the client, or by the connection close
+    bool completed_;
+  };
+
+  bool ConnectionReadHandler();
+  bool ConnectionWriteHandler();
+  void ConnectionCloseHandler(int err, net::NetConnection::CloseWhat what);
+
+  // Starts a call on a FRAME_REQUEST (w/ the payload in the input)
+  void StartCall(const tcp::FrameHeader& header);
+  // On FRAME_CANCEL
+  void CancelCall(int64 xid);
+
+  // The done callback of normal calls (from any thread)
+  void CallDone(Call* call);
+  // The done callback of streaming calls (from any thread, multiple times)
+  void StreamCallback(Call* call);
+  // Writes the streamed messages that fit in the output buffer, and
+  // detects the end of stream.
+  void StreamSomeData(Call* call);
+
+  // Unregisters and deletes (in the select loop) a finished call
+  void CompleteCall(Call* call);
+
+  void WriteError(int64 xid, rpc::ErrorCode error_code,
+                  const std::string& reason);
+  void MaybeDelete();
+
+  net::Selector* const selector_;
+  TcpServer* const server_;
+  net::NetConnection* const net_connection_;
+  const net::HostPort local_address_;
+  const net::HostPort peer_address_;
+  bool closed_;
+  bool deleting_;
+
+  typedef hash_map<int64, Call*> CallMap;
+  CallMap calls_;
+  std::vector<Call*> blocked_streams_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(TcpServerConnection);
+};
+
+}  // namespace rpc
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_RPC_RPC_TCP_SERVER_H__
@@ -0,0 +1,268 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the rpc::LatencyHistogram buckets and percentiles, and the merging
+// of the rpc::MethodStats shards recorded from several threads. Then
+// measures the cost of recording a call, from one and from several
+// threads, vs. keeping the same stats under a mutex.
+//
+
+#include <sched.h>
+#include <atomic>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/sync/mutex.h"
+#include "whisperlib/sync/thread.h"
+#include "whisperlib/rpc/rpc_method_stats.h"
+#include "whisperlib/rpc/RpcStats.pb.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_calls,
+             2000000,
+             "Benchmark: record these many calls, in each thread");
+DEFINE_int32(num_threads,
+             4,
+             "Benchmark: record from these many threads");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+void TestBuckets() {
+  typedef rpc::LatencyHistogram H;
+  CHECK_EQ(H::BucketIndex(0), 0);
+  CHECK_EQ(H::BucketIndex(-5), 0);
+  CHECK_EQ(H::BucketIndex(H::kSubBuckets - 1), H::kSubBuckets - 1);
+  CHECK_EQ(H::BucketIndex(1LL << 40), H::kNumBuckets - 1);
+  CHECK_EQ(H::BucketIndex((1LL << H::kMaxValueBits) - 1), H::kNumBuckets - 1);
+  int last_index = 0;
+  for ( int64 v = 0; v < (1LL << H::kMaxValueBits); v += 1 + v / 61 ) {
+    const int index = H::BucketIndex(v);
+    CHECK_GE(index, last_index) << " v: " << v;
+    CHECK_LE(H::BucketStart(index), v) << " v: " << v;
+    CHECK_GT(H::BucketStart(index + 1), v) << " v: " << v;
+    // the relative error of the bucket start
+    CHECK_LE((v - H::BucketStart(index)) * H::kSubBuckets, v) << " v: " << v;
+    last_index = index;
+  }
+  CHECK_EQ(last_index, H::kNumBuckets - 1);
+  LOG_INFO << "Buckets OK";
+}
+
+void TestPercentiles() {
+  rpc::LatencyHistogram h;
+  CHECK_EQ(h.Percentile(0.5), 0);
+  for ( int64 v = 1; v <= 10000; ++v ) {
+    h.Record(v);
+  }
+  CHECK_EQ(h.count(), 10000);
+  CHECK_EQ(h.sum(), 10000LL * 10001 / 2);
+  CHECK_EQ(h.max(), 10000);
+  // The values are reported as the end of their bucket - at most
+  // 1 / kSubBuckets above.
+  const double qs[] = { 0.5, 0.9, 0.99, 0.999 };
+  for ( size_t i = 0; i < NUMBEROF(qs); ++i ) {
+    const int64 expected = int64(qs[i] * 10000);
+    const int64 p = h.Percentile(qs[i]);
+    CHECK_GE(p, expected) << " q: " << qs[i];
+    CHECK_LE(p, expected + expected / rpc::LatencyHistogram::kSubBuckets)
+      << " q: " << qs[i];
+  }
+  CHECK_EQ(h.Percentile(1.0), 10000);
+
+  rpc::pb::LatencyHistogram pb;
+  h.Get(&pb);
+  CHECK_EQ(pb.count(), 10000);
+  CHECK_EQ(pb.bucket_start_us_size(), pb.bucket_count_size());
+  int64 total = 0;
+  for ( int i = 0; i < pb.bucket_count_size(); ++i ) {
+    CHECK_GT(pb.bucket_count(i), 0);
+    total += pb.bucket_count(i);
+  }
+  CHECK_EQ(total, 10000);
+  CHECK_EQ(pb.p50_us(), h.Percentile(0.5));
+  LOG_INFO << "Percentiles OK - p50: " << pb.p50_us() << " p99: " << pb.p99_us()
+           << " p99.9: " << pb.p999_us();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+std::atomic_int g_num_started(0);
+
+// Records num_calls w/ an error every 10 calls, and times in 1..1000 us -
+// after all threads started, so more threads than shards record at once.
+void RecordCalls(rpc::MethodStats* stats, int num_threads, int num_calls) {
+  ++g_num_started;
+  while ( g_num_started < num_threads ) {
+    sched_yield();
+  }
+  for ( int i = 0; i < num_calls; ++i ) {
+    stats->RecordCall(i % 10 ? rpc::ERROR_NONE : rpc::ERROR_SERVER,
+                      100, 200, i % 1000 + 1, 2 * (i % 1000) + 1, -1);
+  }
+}
+
+void TestShards() {
+  static const int kNumThreads = rpc::MethodStats::kNumShards + 8;
+  static const int kNumCalls = 10000;
+  rpc::MethodStats stats;
+  std::vector<thread::Thread*> threads;
+  for ( int i = 0; i < kNumThreads; ++i ) {
+    threads.push_back(new thread::Thread(
+        NewCallback(&RecordCalls, &stats, kNumThreads, kNumCalls)));
+    threads.back()->SetJoinable();
+    CHECK(threads.back()->Start());
+  }
+  for ( int i = 0; i < kNumThreads; ++i ) {
+    CHECK(threads[i]->Join());
+    delete threads[i];
+  }
+  const int64 total = int64(kNumThreads) * kNumCalls;
+  CHECK_EQ(stats.num_calls(), total);
+  rpc::pb::MethodStats pb;
+  stats.Get(&pb);
+  CHECK_EQ(pb.num_calls(), total);
+  CHECK_EQ(pb.errors_size(), 1);
+  CHECK_EQ(pb.errors(0).error_code(), rpc::ERROR_SERVER);
+  CHECK_EQ(pb.errors(0).error_name(), "ERROR_SERVER");
+  CHECK_EQ(pb.errors(0).count(), total / 10);
+  CHECK_EQ(pb.bytes_in(), total * 100);
+  CHECK_EQ(pb.bytes_out(), total * 200);
+  CHECK_EQ(pb.queue_time().count(), total);
+  CHECK_EQ(pb.queue_time().max_us(), 1000);
+  CHECK_EQ(pb.handler_time().count(), total);
+  CHECK_EQ(pb.handler_time().max_us(), 1999);
+  CHECK_EQ(pb.write_time().count(), 0);
+  LOG_INFO << "Shards OK - queue: "
+           << pb.queue_time().p50_us() << " / " << pb.queue_time().p99_us()
+           << " handler: "
+           << pb.handler_time().p50_us() << " / " << pb.handler_time().p99_us();
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// The same stats, in one copy guarded by a mutex
+struct LockedStats {
+  LockedStats() : num_calls_(0), num_errors_(0), bytes_in_(0), bytes_out_(0) {
+  }
+  void RecordCall(rpc::ErrorCode error_code,
+                  int64 bytes_in, int64 bytes_out,
+                  int64 queue_us, int64 handler_us, int64 write_us) {
+    synch::MutexLocker l(&mutex_);
+    ++num_calls_;
+    if ( error_code != rpc::ERROR_NONE ) ++num_errors_;
+    bytes_in_ += bytes_in;
+    bytes_out_ += bytes_out;
+    if ( queue_us >= 0 ) queue_time_.Record(queue_us);
+    if ( handler_us >= 0 ) handler_time_.Record(handler_us);
+    if ( write_us >= 0 ) write_time_.Record(write_us);
+  }
+  synch::Mutex mutex_;
+  int64 num_calls_;
+  int64 num_errors_;
+  int64 bytes_in_;
+  int64 bytes_out_;
+  rpc::LatencyHistogram queue_time_;
+  rpc::LatencyHistogram handler_time_;
+  rpc::LatencyHistogram write_time_;
+};
+
+template <class S>
+void RecordTimes(S* stats, int num_calls) {
+  for ( int i = 0; i < num_calls; ++i ) {
+    stats->RecordCall(rpc::ERROR_NONE, 100, 200,
+                      i % 100, i % 1000, i % 10);
+  }
+}
+
+// Returns the ns per recorded call, w/ num_threads recording concurrently
+// (the total time over the total number of calls)
+template <class S>
+int64 TimeRecording(S* stats, int num_threads) {
+  const int64 start = timer::TicksNsec();
+  if ( num_threads == 1 ) {
+    RecordTimes(stats, FLAGS_num_calls);
+  } else {
+    std::vector<thread::Thread*> threads;
+    for ( int i = 0; i < num_threads; ++i ) {
+      threads.push_back(new thread::Thread(
+          NewCallback(&RecordTimes<S>, stats, FLAGS_num_calls)));
+      threads.back()->SetJoinable();
+      CHECK(threads.back()->Start());
+    }
+    for ( int i = 0; i < num_threads; ++i ) {
+      CHECK(threads[i]->Join());
+      delete threads[i];
+    }
+  }
+  return (timer::TicksNsec() - start) / (int64(num_threads) * FLAGS_num_calls);
+}
+
+void BenchmarkRecording() {
+  const int thread_counts[] = { 1, FLAGS_num_threads };
+  for ( size_t i = 0; i < NUMBEROF(thread_counts); ++i ) {
+    const int num_threads = thread_counts[i];
+    rpc::MethodStats sharded;
+    LockedStats locked;
+    const int64 sharded_ns = TimeRecording(&sharded, num_threads);
+    const int64 locked_ns = TimeRecording(&locked, num_threads);
+    CHECK_EQ(sharded.num_calls(), int64(num_threads) * FLAGS_num_calls);
+    CHECK_EQ(locked.num_calls_, int64(num_threads) * FLAGS_num_calls);
+    LOG_INFO << " Recording a call from " << num_threads << " thread(s): "
+             << sharded_ns << " ns w/ per thread shards, "
+             << locked_ns << " ns under a mutex";
+  }
+  // And the read side - merging the shards
+  rpc::MethodStats stats;
+  TimeRecording(&stats, FLAGS_num_threads);
+  static const int kNumGets = 100;
+  const int64 start = timer::TicksNsec();
+  for ( int i = 0; i < kNumGets; ++i ) {
+    rpc::pb::MethodStats pb;
+    stats.Get(&pb);
+  }
+  LOG_INFO << " Reading the stats of a method: "
+           << (timer::TicksNsec() - start) / kNumGets / 1000 << " us";
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  TestBuckets();
+  TestPercentiles();
+  TestShards();
+  BenchmarkRecording();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,262 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests the rpc::MethodTable lookups (by path and id, through registering
+// and unregistering services) and the message pools. Then compares the
+// CPU spent per call to an empty handler for dispatching through the table
+// vs. looking up the service by path, the method by name and allocating
+// the messages for every call.
+//
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <google/protobuf/descriptor.h>
+#include <google/protobuf/stubs/callback.h>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/strutil.h"
+#include "whisperlib/rpc/rpc_method_table.h"
+#include "whisperlib/rpc/rpc_tcp_frames.h"
+#include "whisperlib/rpc/test/rpc_test_proto.pb.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_calls,
+             1000000,
+             "Benchmark: dispatch these many calls");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// Completes all calls right away, w/o doing anything
+class EmptyService : public rpc::TestService {
+ public:
+  virtual void Mirror(google::protobuf::RpcController* controller,
+                      const rpc::TestReq* request,
+                      rpc::TestReq* response,
+                      google::protobuf::Closure* done) {
+    done->Run();
+  }
+  virtual void Sum(google::protobuf::RpcController* controller,
+                   const rpc::TestReq* request,
+                   rpc::TestReply* response,
+                   google::protobuf::Closure* done) {
+    done->Run();
+  }
+  virtual void Multiply(google::protobuf::RpcController* controller,
+                        const rpc::TestReq* request,
+                        rpc::TestReply* response,
+                        google::protobuf::Closure* done) {
+    done->Run();
+  }
+};
+
+class EmptyStreamService : public rpc::TestStreamService {
+};
+
+void TestLookups() {
+  EmptyService service;
+  EmptyService other_service;
+  EmptyStreamService stream_service;
+  rpc::MethodTable table;
+  CHECK(table.Find("a/whisper.rpc.TestService/Sum") == NULL);
+
+  CHECK(table.Add("a/whisper.rpc.TestService", &service));
+  CHECK(table.Add("whisper.rpc.TestService", &other_service));
+  CHECK(table.Add("a/whisper.rpc.TestStreamService", &stream_service));
+  CHECK(!table.Add("a/whisper.rpc.TestService", &other_service));
+
+  rpc::RegisteredMethod* const sum =
+      table.Find("a/whisper.rpc.TestService/Sum");
+  CHECK(sum != NULL);
+  CHECK(sum->service_ == &service);
+  CHECK_EQ(sum->method_->name(), "Sum");
+  CHECK_EQ(sum->path_, "a/whisper.rpc.TestService/Sum");
+  CHECK_EQ(sum->id_, rpc::tcp::MethodId("a/whisper.rpc.TestService", "Sum"));
+  CHECK(table.Find(sum->id_) == sum);
+  CHECK(table.Find("whisper.rpc.TestService/Sum")->service_ ==
+        &other_service);
+  CHECK(table.Find("a/whisper.rpc.TestStreamService/Subscribe") != NULL);
+  CHECK(table.Find("a/whisper.rpc.TestService/Divide") == NULL);
+  CHECK(table.Find("a/whisper.rpc.TestService") == NULL);
+
+  std::vector<const rpc::RegisteredMethod*> methods;
+  table.GetMethods(&methods);
+  CHECK_EQ(methods.size(), 8);
+  CHECK_EQ(methods[0]->path_, "a/whisper.rpc.TestService/Mirror");
+  CHECK_EQ(methods[7]->path_, "whisper.rpc.TestService/Sum");
+
+  // The removed methods are still good for calls in flight
+  table.Remove("a/whisper.rpc.TestService", &service);
+  CHECK(table.Find("a/whisper.rpc.TestService/Sum") == NULL);
+  CHECK(table.Find(sum->id_) == NULL);
+  CHECK_EQ(sum->method_->name(), "Sum");
+  CHECK(table.Find("whisper.rpc.TestService/Sum") != NULL);
+  CHECK(table.Add("a/whisper.rpc.TestService", &service));
+  CHECK(table.Find("a/whisper.rpc.TestService/Sum") != sum);
+  LOG_INFO << "Lookups test PASS";
+}
+
+void TestPool() {
+  rpc::MessagePool pool(&rpc::TestReq::default_instance(), 2, 100);
+  rpc::TestReq* const m1 = static_cast<rpc::TestReq*>(pool.New());
+  rpc::TestReq* const m2 = static_cast<rpc::TestReq*>(pool.New());
+  rpc::TestReq* const m3 = static_cast<rpc::TestReq*>(pool.New());
+  CHECK(m1 != m2 && m2 != m3);
+  m1->set_x(1);
+  m1->set_s("abc");
+  pool.Release(m1, m1->ByteSize());
+  CHECK_EQ(pool.num_free(), 1);
+  // Cleared when reused
+  rpc::TestReq* const m4 = static_cast<rpc::TestReq*>(pool.New());
+  CHECK(m4 == m1);
+  CHECK(!m4->has_x());
+  CHECK(!m4->has_s());
+  // Large messages are not kept ..
+  m2->set_s(std::string(200, 'a'));
+  pool.Release(m2, m2->ByteSize());
+  CHECK_EQ(pool.num_free(), 0);
+  // .. and neither are those over the size of the pool
+  pool.Release(m3, 0);
+  pool.Release(m4, 0);
+  pool.Release(static_cast<rpc::TestReq*>(pool.New()), 0);
+  pool.Release(new rpc::TestReq(), 0);
+  CHECK_EQ(pool.num_free(), 2);
+  LOG_INFO << "Pool test PASS";
+}
+
+//////////////////////////////////////////////////////////////////////
+
+void Nothing() {
+}
+
+// The lookup w/o a dispatch table
+typedef std::map<std::string, google::protobuf::Service*> ServicesMap;
+
+void DispatchByName(const ServicesMap& services,
+                    const std::string& sub_path,
+                    const std::string& encoded_request,
+                    google::protobuf::Closure* done) {
+  const size_t last_slash_index = sub_path.rfind('/');
+  const std::string service_full_path = sub_path.substr(0, last_slash_index);
+  const std::string method_name = sub_path.substr(last_slash_index + 1);
+  ServicesMap::const_iterator it = services.find(service_full_path);
+  CHECK(it != services.end());
+  google::protobuf::Service* const service = it->second;
+  const google::protobuf::MethodDescriptor* const method =
+      service->GetDescriptor()->FindMethodByName(method_name);
+  CHECK(method != NULL);
+  google::protobuf::Message* const request =
+      service->GetRequestPrototype(method).New();
+  CHECK(request->ParseFromString(encoded_request));
+  google::protobuf::Message* const response =
+      service->GetResponsePrototype(method).New();
+  service->CallMethod(method, NULL, request, response, done);
+  delete request;
+  delete response;
+}
+
+void DispatchByTable(const rpc::MethodTable& table,
+                     const std::string& sub_path,
+                     const std::string& encoded_request,
+                     google::protobuf::Closure* done) {
+  rpc::RegisteredMethod* const method = table.Find(sub_path);
+  CHECK(method != NULL);
+  google::protobuf::Message* const request = method->request_pool_.New();
+  CHECK(request->ParseFromString(encoded_request));
+  google::protobuf::Message* const response = method->response_pool_.New();
+  method->service_->CallMethod(method->method_, NULL, request, response,
+                               done);
+  method->stats_.RecordCall(rpc::ERROR_NONE, encoded_request.size(), 0,
+                            -1, -1, -1);
+  method->request_pool_.Release(request, encoded_request.size());
+  method->response_pool_.Release(response, 0);
+}
+
+void BenchmarkDispatch() {
+  // A few services, as a server would have
+  static const int kNumServices = 20;
+  std::vector<EmptyService*> services;
+  ServicesMap services_map;
+  rpc::MethodTable table;
+  for ( int i = 0; i < kNumServices; ++i ) {
+    services.push_back(new EmptyService());
+    const std::string path = strutil::StringPrintf(
+        "service%d/whisper.rpc.TestService", i);
+    services_map[path] = services.back();
+    CHECK(table.Add(path, services.back()));
+  }
+  const std::string sub_path("service7/whisper.rpc.TestService/Sum");
+  rpc::TestReq request;
+  request.set_x(1);
+  request.set_y(2);
+  request.set_s(std::string(100, 'a'));
+  const std::string encoded_request = request.SerializeAsString();
+  google::protobuf::Closure* const done =
+      ::google::protobuf::internal::NewPermanentCallback(&Nothing);
+
+  int64 start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_calls; ++i ) {
+    DispatchByName(services_map, sub_path, encoded_request, done);
+  }
+  const int64 by_name_ns = timer::TicksNsec() - start;
+
+  start = timer::TicksNsec();
+  for ( int i = 0; i < FLAGS_num_calls; ++i ) {
+    DispatchByTable(table, sub_path, encoded_request, done);
+  }
+  const int64 by_table_ns = timer::TicksNsec() - start;
+  CHECK_EQ(table.Find(sub_path)->stats_.num_calls(), FLAGS_num_calls);
+
+  LOG_INFO << " Dispatch by service path and method name: "
+           << by_name_ns / FLAGS_num_calls << " ns per call";
+  LOG_INFO << " Dispatch by method table, w/ message pools: "
+           << by_table_ns / FLAGS_num_calls << " ns per call - speedup: "
+           << double(by_name_ns) / by_table_ns;
+  delete done;
+  for ( size_t i = 0; i < services.size(); ++i ) {
+    delete services[i];
+  }
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  TestLookups();
+  TestPool();
+  BenchmarkDispatch();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
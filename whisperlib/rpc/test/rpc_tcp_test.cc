@@ -0,0 +1,875 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Tests rpc::TcpServer / rpc::TcpClient w/ the test services registered in
+// a rpc::HttpServer: replies, errors, unknown methods, server streaming,
+// cancelling and closing w/ calls in flight. Then compares the latency of
+// sequential calls and the call rate w/ many concurrent calls against the
+// same services called through rpc::HttpClient, and checks the per method
+// stats accumulated over all these calls.
+//
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/http/failsafe_http_client.h"
+#include "whisperlib/http/http_server_protocol.h"
+#include "whisperlib/net/address.h"
+#include "whisperlib/net/connection.h"
+#include "whisperlib/net/selector.h"
+#include "whisperlib/rpc/rpc_controller.h"
+#include "whisperlib/rpc/rpc_http_client.h"
+#include "whisperlib/rpc/rpc_http_server.h"
+#include "whisperlib/rpc/rpc_tcp_client.h"
+#include "whisperlib/rpc/rpc_tcp_server.h"
+#include "whisperlib/rpc/RpcStats.pb.h"
+#include "whisperlib/rpc/test/rpc_test_proto.pb.h"
+#include "whisperlib/sync/event.h"
+
+//////////////////////////////////////////////////////////////////////
+
+DEFINE_int32(num_calls,
+             20000,
+             "Benchmark: complete these many calls for a concurrency level");
+DEFINE_int32(num_streamed,
+             20000,
+             "Stream these many messages in the streaming test");
+DEFINE_int32(http_pool_size,
+             8,
+             "Benchmark: max connections of the http client");
+
+//////////////////////////////////////////////////////////////////////
+
+using namespace whisper;
+
+// Counts the heap allocations made in the server selector thread
+std::atomic<int64> g_server_allocations(0);
+thread_local bool tls_in_server_thread = false;
+
+void* operator new(size_t size) {
+  if ( tls_in_server_thread ) {
+    g_server_allocations.fetch_add(1, std::memory_order_relaxed);
+  }
+  void* const p = ::malloc(size == 0 ? 1 : size);
+  if ( p == NULL ) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+void operator delete(void* p) noexcept {
+  ::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  ::free(p);
+}
+
+class TestServiceImpl : public rpc::TestService {
+ public:
+  TestServiceImpl() : num_held_(0), num_cancelled_(0) {
+  }
+  virtual void Mirror(google::protobuf::RpcController* controller,
+                      const rpc::TestReq* request,
+                      rpc::TestReq* response,
+                      google::protobuf::Closure* done) {
+    response->CopyFrom(*request);
+    done->Run();
+  }
+  // Fails, or replies w/ the timeout of the call, when asked to
+  virtual void Sum(google::protobuf::RpcController* controller,
+                   const rpc::TestReq* request,
+                   rpc::TestReply* response,
+                   google::protobuf::Closure* done) {
+    if (request->s() == "fail") {
+      controller->SetFailed("Failed on request");
+    } else if (request->s() == "timeout") {
+      response->set_z(static_cast<rpc::Controller*>(controller)->timeout_ms());
+    } else {
+      response->set_z(request->x() + request->y());
+    }
+    done->Run();
+  }
+  // Does not reply when asked to - the call completes when cancelled
+  virtual void Multiply(google::protobuf::RpcController* rpc_controller,
+                        const rpc::TestReq* request,
+                        rpc::TestReply* response,
+                        google::protobuf::Closure* done) {
+    if (request->s() == "hold") {
+      rpc::Controller* const controller =
+          static_cast<rpc::Controller*>(rpc_controller);
+      controller->NotifyOnCancel(::google::protobuf::internal::NewCallback(
+          this, &TestServiceImpl::Release, controller, done));
+      ++num_held_;
+      return;
+    }
+    response->set_z(int64(request->x()) * request->y());
+    done->Run();
+  }
+  int num_held() const { return num_held_; }
+  int num_cancelled() const { return num_cancelled_; }
+
+ private:
+  void Release(rpc::Controller* controller, google::protobuf::Closure* done) {
+    if (controller->IsCanceled()) {
+      ++num_cancelled_;
+    }
+    done->Run();
+  }
+  std::atomic_int num_held_;
+  std::atomic_int num_cancelled_;
+};
+
+// Subscribe streams the sequence [seq, end_seq), a few messages at a time,
+// as the rpc server asks for more.
+class TestStreamServiceImpl : public rpc::TestStreamService {
+ public:
+  static const int kBatchSize = 16;
+
+  TestStreamServiceImpl() : payload_(200, 'x') {
+  }
+  virtual void Publish(google::protobuf::RpcController* controller,
+                       const rpc::TestPubReq* request,
+                       rpc::TestPubReply* response,
+                       google::protobuf::Closure* done) {
+    response->set_seq(request->data().t_size());
+    done->Run();
+  }
+  virtual void Subscribe(google::protobuf::RpcController* rpc_controller,
+                         const rpc::TestSubReq* request,
+                         rpc::TestSubReply* response,
+                         google::protobuf::Closure* done) {
+    rpc::Controller* const controller =
+        static_cast<rpc::Controller*>(rpc_controller);
+    if (!controller->is_streaming()) {
+      response->set_seq(request->seq());
+      response->mutable_data()->set_s(payload_);
+      done->Run();
+      return;
+    }
+    Stream* const stream = new Stream(controller, done, request->seq(),
+                                      request->end_seq());
+    stream->next_callback_ = whisper::NewPermanentCallback(
+        this, &TestStreamServiceImpl::StreamNext, stream);
+    controller->set_server_streaming_callback(stream->next_callback_);
+    StreamNext(stream);
+  }
+
+ private:
+  struct Stream {
+    Stream(rpc::Controller* controller, google::protobuf::Closure* done,
+           int64 next_seq, int64 end_seq)
+        : controller_(controller), done_(done),
+          next_seq_(next_seq), end_seq_(end_seq), next_callback_(NULL) {
+    }
+    rpc::Controller* const controller_;
+    google::protobuf::Closure* const done_;
+    int64 next_seq_;
+    const int64 end_seq_;
+    Closure* next_callback_;
+  };
+  void EndStream(Stream* stream) {
+    stream->controller_->set_server_streaming_callback(NULL);
+    delete stream->next_callback_;
+    delete stream;
+  }
+  void StreamNext(Stream* stream) {
+    if (stream->controller_->Failed()) {
+      EndStream(stream);   // the rpc server is done w/ this call
+      return;
+    }
+    for (int i = 0; i < kBatchSize && stream->next_seq_ < stream->end_seq_;
+         ++i) {
+      rpc::TestSubReply* const reply = new rpc::TestSubReply();
+      reply->set_seq(stream->next_seq_++);
+      reply->mutable_data()->set_s(payload_);
+      stream->controller_->PushStreamedMessage(reply);
+    }
+    google::protobuf::Closure* const done = stream->done_;
+    if (stream->next_seq_ >= stream->end_seq_) {
+      EndStream(stream);
+    }
+    done->Run();
+  }
+  const std::string payload_;
+};
+
+net::HostPort FreePort() {
+  const int tmp_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in tmp_addr;
+  memset(&tmp_addr, 0, sizeof(tmp_addr));
+  tmp_addr.sin_family = AF_INET;
+  tmp_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  CHECK_EQ(::bind(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                  sizeof(tmp_addr)), 0);
+  socklen_t len = sizeof(tmp_addr);
+  CHECK_EQ(::getsockname(tmp_fd, reinterpret_cast<struct sockaddr*>(&tmp_addr),
+                         &len), 0);
+  ::close(tmp_fd);
+  return net::HostPort("127.0.0.1", ntohs(tmp_addr.sin_port));
+}
+
+void WaitForCalls(const TestServiceImpl* service,
+                  int num_held, int num_cancelled) {
+  const int64 start = timer::TicksMsec();
+  while ( service->num_held() != num_held ||
+          service->num_cancelled() != num_cancelled ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+struct Server {
+  net::Selector* selector_;
+  net::NetFactory* net_factory_;
+  http::Server* http_server_;
+  rpc::HttpServer* rpc_server_;
+  rpc::TcpServer* tcp_server_;
+  TestServiceImpl service_;
+  TestStreamServiceImpl stream_service_;
+};
+
+void StartServer(Server* s, net::HostPort http_address,
+                 net::HostPort tcp_address) {
+  tls_in_server_thread = true;
+  http::ServerParams params;
+  s->http_server_ = new http::Server("rpc_tcp_test", s->selector_,
+                                     *s->net_factory_, params);
+  s->http_server_->AddAcceptor(net::PROTOCOL_TCP, http_address);
+  s->rpc_server_ = new rpc::HttpServer(s->http_server_, NULL, "/rpc",
+                                       true, 100000, "");
+  CHECK(s->rpc_server_->RegisterService("test", &s->service_));
+  CHECK(s->rpc_server_->RegisterService("test", &s->stream_service_));
+  s->tcp_server_ = new rpc::TcpServer(s->selector_, *s->net_factory_,
+                                      s->rpc_server_, 100000, "");
+  s->tcp_server_->set_max_output_buffer_size(64 << 10);
+  s->tcp_server_->AddAcceptor(net::PROTOCOL_TCP, tcp_address);
+  s->http_server_->StartServing();
+  s->tcp_server_->StartServing();
+}
+
+void StopServer(Server* s) {
+  s->tcp_server_->StopServing();
+  s->http_server_->StopServing();
+}
+
+void DeleteServer(Server* s) {
+  delete s->tcp_server_;
+  delete s->rpc_server_;
+  delete s->http_server_;
+}
+
+//////////////////////////////////////////////////////////////////////
+
+http::BaseClientConnection* CreateConnection(net::Selector* selector,
+                                             net::NetFactory* net_factory) {
+  return new http::SimpleClientConnection(selector, *net_factory,
+                                          net::PROTOCOL_TCP);
+}
+
+struct HttpRpcClient {
+  net::Selector* selector_;
+  net::NetFactory* net_factory_;
+  http::ClientParams params_;
+  http::FailSafeClient* fsc_;
+  rpc::HttpClient* client_;
+};
+
+void CreateHttpClient(HttpRpcClient* c, net::HostPort server) {
+  c->fsc_ = new http::FailSafeClient(
+      c->selector_, &c->params_, std::vector<net::HostPort>(1, server),
+      NewPermanentCallback(&CreateConnection, c->selector_, c->net_factory_),
+      true, 3, 20000, 2000, "");
+  http::FailSafeClient::PoolParams pool_params;
+  pool_params.max_connections_per_host_ = FLAGS_http_pool_size;
+  c->fsc_->SetPoolParams(pool_params);
+  c->client_ = new rpc::HttpClient(c->fsc_,
+                                   "/rpc/test/whisper.rpc.TestService");
+}
+
+void CreateBatchingHttpClient(HttpRpcClient* c, net::HostPort server,
+                              int64 max_delay_ms) {
+  CreateHttpClient(c, server);
+  c->client_->set_batching(max_delay_ms, 64, 64 << 10);
+}
+
+void DeleteHttpClient(HttpRpcClient* c) {
+  delete c->fsc_;
+  c->fsc_ = NULL;
+}
+
+// Keeps a number of Sum calls in flight through a channel, until a total
+// number completes.
+class Load {
+ public:
+  Load(google::protobuf::RpcChannel* channel, int concurrency, int num_calls)
+      : stub_(channel),
+        concurrency_(concurrency),
+        num_calls_(num_calls),
+        num_started_(0),
+        num_done_(0),
+        done_(false, true) {
+  }
+  // Runs in the selector thread of the channel
+  void Start() {
+    for ( int i = 0; i < concurrency_ && i < num_calls_; ++i ) {
+      StartOne(new Slot());
+    }
+  }
+  // Runs in the main thread - returns the duration in nanoseconds
+  int64 Run(net::Selector* selector) {
+    const int64 start = timer::TicksNsec();
+    selector->RunInSelectLoop(NewCallback(this, &Load::Start));
+    CHECK(done_.Wait(60000)) << " Load timed out: " << num_done_;
+    return timer::TicksNsec() - start;
+  }
+
+ private:
+  struct Slot {
+    rpc::Controller controller_;
+    rpc::TestReq request_;
+    rpc::TestReply reply_;
+  };
+  void StartOne(Slot* slot) {
+    slot->controller_.Reset();
+    slot->request_.set_x(num_started_++);
+    slot->request_.set_y(1);
+    stub_.Sum(&slot->controller_, &slot->request_, &slot->reply_,
+              ::google::protobuf::internal::NewCallback(
+                  this, &Load::Done, slot));
+  }
+  void Done(Slot* slot) {
+    CHECK(!slot->controller_.Failed()) << slot->controller_.ErrorText();
+    CHECK_EQ(slot->reply_.z(), slot->request_.x() + 1);
+    ++num_done_;
+    if ( num_started_ < num_calls_ ) {
+      StartOne(slot);
+      return;
+    }
+    delete slot;
+    if ( num_done_ == num_calls_ ) {
+      done_.Signal();
+    }
+  }
+
+  rpc::TestService_Stub stub_;
+  const int concurrency_;
+  const int num_calls_;
+  int num_started_;
+  int num_done_;
+  synch::Event done_;
+};
+
+// Returns the calls per second
+double RunLoad(const char* name, google::protobuf::RpcChannel* channel,
+               net::Selector* selector, int concurrency) {
+  Load load(channel, concurrency, FLAGS_num_calls);
+  const int64 allocations = g_server_allocations;
+  const int64 duration = load.Run(selector);
+  const double rate = FLAGS_num_calls * 1e9 / duration;
+  LOG_INFO << " " << name << " - " << concurrency << " concurrent calls: "
+           << FLAGS_num_calls << " calls in " << duration / 1000000
+           << " ms - " << int64(rate) << " calls per second, "
+           << duration / FLAGS_num_calls / 1000 << " us per call, "
+           << double(g_server_allocations - allocations) / FLAGS_num_calls
+           << " server allocations per call";
+  return rate;
+}
+
+// Collects a stream of Subscribe replies
+class StreamReader {
+ public:
+  StreamReader()
+      : next_seq_(0),
+        done_(false, true),
+        done_callback_(::google::protobuf::internal::NewPermanentCallback(
+            this, &StreamReader::Next)) {
+    controller_.set_is_streaming(true);
+  }
+  ~StreamReader() {
+    delete done_callback_;
+  }
+  // Returns the number of messages received
+  int64 Run(rpc::TestStreamService_Stub* stub, int64 seq, int64 end_seq) {
+    request_.set_seq(seq);
+    request_.set_end_seq(end_seq);
+    next_seq_ = seq;
+    stub->Subscribe(&controller_, &request_, &reply_, done_callback_);
+    CHECK(done_.Wait(60000)) << " Stream timed out at: " << next_seq_;
+    CHECK(!controller_.Failed()) << controller_.ErrorText();
+    return next_seq_ - seq;
+  }
+
+ private:
+  void Next() {
+    while ( true ) {
+      std::pair<google::protobuf::Message*, bool> msg =
+          controller_.PopStreamedMessage();
+      if ( !msg.second ) {
+        break;
+      }
+      CHECK(msg.first != NULL);
+      const rpc::TestSubReply* const reply =
+          static_cast<const rpc::TestSubReply*>(msg.first);
+      CHECK_EQ(reply->seq(), next_seq_);
+      ++next_seq_;
+      delete msg.first;
+    }
+    if ( controller_.IsFinalized() ) {
+      done_.Signal();
+    }
+  }
+
+  rpc::Controller controller_;
+  rpc::TestSubReq request_;
+  rpc::TestSubReply reply_;
+  int64 next_seq_;
+  synch::Event done_;
+  google::protobuf::Closure* const done_callback_;
+};
+
+//////////////////////////////////////////////////////////////////////
+
+void TestCalls(rpc::TcpClient* client) {
+  rpc::TestService_Stub stub(client,
+                             google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+  {
+    rpc::Controller controller;
+    rpc::TestReq request;
+    rpc::TestReply reply;
+    request.set_x(3);
+    request.set_y(4);
+    stub.Sum(&controller, &request, &reply, NULL);
+    CHECK(!controller.Failed()) << controller.ErrorText();
+    CHECK_EQ(reply.z(), 7);
+    controller.Reset();
+    stub.Multiply(&controller, &request, &reply, NULL);
+    CHECK(!controller.Failed()) << controller.ErrorText();
+    CHECK_EQ(reply.z(), 12);
+  }
+  {
+    // A message larger than the socket buffers, both ways
+    rpc::Controller controller;
+    rpc::TestReq request;
+    rpc::TestReq reply;
+    request.set_x(1);
+    request.set_y(2);
+    request.set_s(std::string(4 << 20, 'a'));
+    stub.Mirror(&controller, &request, &reply, NULL);
+    CHECK(!controller.Failed()) << controller.ErrorText();
+    CHECK_EQ(reply.s(), request.s());
+    CHECK_EQ(reply.y(), 2);
+  }
+  {
+    // The error of the implementation gets to the client
+    rpc::Controller controller;
+    rpc::TestReq request;
+    rpc::TestReply reply;
+    request.set_x(3);
+    request.set_y(4);
+    request.set_s("fail");
+    stub.Sum(&controller, &request, &reply, NULL);
+    CHECK(controller.Failed());
+    CHECK_EQ(controller.GetErrorCode(), rpc::ERROR_USER);
+    CHECK_EQ(controller.GetErrorReason(), "Failed on request");
+  }
+  {
+    // The server gets the timeout of the call
+    rpc::Controller controller;
+    rpc::TestReq request;
+    rpc::TestReply reply;
+    request.set_x(3);
+    request.set_y(4);
+    request.set_s("timeout");
+    controller.set_timeout_ms(1500);
+    stub.Sum(&controller, &request, &reply, NULL);
+    CHECK(!controller.Failed()) << controller.ErrorText();
+    CHECK_EQ(reply.z(), 1500);
+  }
+  LOG_INFO << "Calls test PASS";
+}
+
+void TestErrors(net::Selector* selector, const net::NetFactory& net_factory,
+                const net::HostPort& server_address) {
+  rpc::TestReq request;
+  request.set_x(3);
+  request.set_y(4);
+  {
+    rpc::TcpClient* const client = new rpc::TcpClient(
+        selector, net_factory, net::PROTOCOL_TCP, server_address,
+        "test/whisper.rpc.NoService");
+    rpc::TestService_Stub stub(client,
+        google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+    rpc::Controller controller;
+    rpc::TestReply reply;
+    stub.Sum(&controller, &request, &reply, NULL);
+    CHECK_EQ(controller.GetErrorCode(), rpc::ERROR_USER);
+    // The connection is still good
+    rpc::TestStreamService_Stub stream_stub(client,
+        google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+    controller.Reset();
+    rpc::TestPubReq pub_request;
+    rpc::TestPubReply pub_reply;
+    pub_request.mutable_data()->add_t("a");
+    stream_stub.Publish(&controller, &pub_request, &pub_reply, NULL);
+    CHECK_EQ(controller.GetErrorCode(), rpc::ERROR_USER);
+    client->StartClose();
+  }
+  {
+    rpc::TcpClient* const client = new rpc::TcpClient(
+        selector, net_factory, net::PROTOCOL_TCP, FreePort(),
+        "test/whisper.rpc.TestService");
+    rpc::TestService_Stub stub(client,
+        google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+    rpc::Controller controller;
+    rpc::TestReply reply;
+    stub.Sum(&controller, &request, &reply, NULL);
+    CHECK_EQ(controller.GetErrorCode(), rpc::ERROR_NETWORK);
+    client->StartClose();
+  }
+  LOG_INFO << "Errors test PASS";
+}
+
+void TestStreaming(rpc::TcpClient* client) {
+  rpc::TestStreamService_Stub stub(client,
+      google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+  {
+    rpc::Controller controller;
+    rpc::TestSubReq request;
+    rpc::TestSubReply reply;
+    request.set_seq(5);
+    stub.Subscribe(&controller, &request, &reply, NULL);
+    CHECK(!controller.Failed()) << controller.ErrorText();
+    CHECK_EQ(reply.seq(), 5);
+  }
+  {
+    StreamReader reader;
+    CHECK_EQ(reader.Run(&stub, 10, 10 + TestStreamServiceImpl::kBatchSize),
+             TestStreamServiceImpl::kBatchSize);
+  }
+  {
+    // Goes through the flow control of the server
+    StreamReader reader;
+    const int64 start = timer::TicksNsec();
+    CHECK_EQ(reader.Run(&stub, 0, FLAGS_num_streamed), FLAGS_num_streamed);
+    LOG_INFO << " Streamed " << FLAGS_num_streamed << " messages in "
+             << (timer::TicksNsec() - start) / 1000000 << " ms";
+  }
+  LOG_INFO << "Streaming test PASS";
+}
+
+void TestCancel(rpc::TcpClient* client, TestServiceImpl* service) {
+  rpc::TestService_Stub stub(client,
+                             google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+  rpc::Controller controller;
+  rpc::TestReq request;
+  rpc::TestReply reply;
+  request.set_x(3);
+  request.set_y(4);
+  request.set_s("hold");
+  synch::Event done(false, true);
+  stub.Multiply(&controller, &request, &reply,
+                ::google::protobuf::internal::NewCallback(
+                    &done, &synch::Event::Signal));
+  WaitForCalls(service, 1, 0);
+  CHECK(!done.Wait(100));
+  controller.StartCancel();
+  CHECK(done.Wait(10000));
+  CHECK(controller.IsCanceled());
+  WaitForCalls(service, 1, 1);
+  // The connection is still good
+  request.set_s("");
+  controller.Reset();
+  stub.Multiply(&controller, &request, &reply, NULL);
+  CHECK(!controller.Failed()) << controller.ErrorText();
+  CHECK_EQ(reply.z(), 12);
+  LOG_INFO << "Cancel test PASS";
+}
+
+void TestClose(net::Selector* selector, const net::NetFactory& net_factory,
+               const net::HostPort& server_address,
+               TestServiceImpl* service) {
+  rpc::TcpClient* const client = new rpc::TcpClient(
+      selector, net_factory, net::PROTOCOL_TCP, server_address,
+      "test/whisper.rpc.TestService");
+  rpc::TestService_Stub stub(client,
+                             google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+  rpc::Controller controller;
+  rpc::TestReq request;
+  rpc::TestReply reply;
+  request.set_x(3);
+  request.set_y(4);
+  request.set_s("hold");
+  synch::Event done(false, true);
+  stub.Multiply(&controller, &request, &reply,
+                ::google::protobuf::internal::NewCallback(
+                    &done, &synch::Event::Signal));
+  WaitForCalls(service, 2, 1);
+  // The client fails its call, the server cancels it
+  client->StartClose();
+  CHECK(done.Wait(10000));
+  CHECK_EQ(controller.GetErrorCode(), rpc::ERROR_CLIENT);
+  WaitForCalls(service, 2, 2);
+  LOG_INFO << "Close test PASS";
+}
+
+// Signals when a number of calls are done
+class CallCounter {
+ public:
+  explicit CallCounter(int num_calls)
+      : num_calls_(num_calls), num_done_(0), done_(false, true) {
+  }
+  void Done() {
+    if ( ++num_done_ == num_calls_ ) {
+      done_.Signal();
+    }
+  }
+  int num_done() const { return num_done_; }
+  bool Wait(int64 timeout_ms) { return done_.Wait(timeout_ms); }
+
+ private:
+  const int num_calls_;
+  std::atomic_int num_done_;
+  synch::Event done_;
+};
+
+// Batched http calls - each w/ its own result, error or cancellation
+void TestHttpBatching(rpc::HttpClient* client) {
+  rpc::TestService_Stub stub(client,
+                             google::protobuf::Service::STUB_DOESNT_OWN_CHANNEL);
+  static const int kNumCalls = 10;
+  rpc::Controller controllers[kNumCalls];
+  rpc::TestReq requests[kNumCalls];
+  rpc::TestReply replies[kNumCalls];
+  rpc::TestReq mirror_request;
+  rpc::TestReq mirror_reply;
+  CallCounter counter(kNumCalls + 1);
+  // All in the same batch (the client waits 100 ms for more calls)
+  for ( int i = 0; i < kNumCalls; ++i ) {
+    requests[i].set_x(i);
+    requests[i].set_y(100);
+    if ( i == 3 ) {
+      requests[i].set_s("fail");
+    }
+    if ( i == 5 || i == 6 ) {
+      // the server gets the timeout of each call
+      requests[i].set_s("timeout");
+      controllers[i].set_timeout_ms(1000 * i);
+    }
+    if ( i == 2 ) {
+      // expires while the call waits for its batch
+      controllers[i].set_timeout_ms(20);
+    }
+    stub.Sum(&controllers[i], &requests[i], &replies[i],
+             ::google::protobuf::internal::NewCallback(
+                 &counter, &CallCounter::Done));
+  }
+  rpc::Controller mirror_controller;
+  mirror_request.set_x(1);
+  mirror_request.set_y(2);
+  mirror_request.set_s(std::string(1000, 'm'));
+  stub.Mirror(&mirror_controller, &mirror_request, &mirror_reply,
+              ::google::protobuf::internal::NewCallback(
+                  &counter, &CallCounter::Done));
+  // Completes right away, w/o waiting for the batch
+  controllers[7].StartCancel();
+  int64 start = timer::TicksMsec();
+  while ( counter.num_done() < 1 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  CHECK(controllers[7].IsCanceled());
+  CHECK(counter.Wait(10000));
+  for ( int i = 0; i < kNumCalls; ++i ) {
+    if ( i == 3 ) {
+      CHECK_EQ(controllers[i].GetErrorCode(), rpc::ERROR_USER);
+      CHECK_EQ(controllers[i].GetErrorReason(), "Failed on request");
+    } else if ( i == 2 ) {
+      CHECK_EQ(controllers[i].GetErrorCode(), rpc::ERROR_NETWORK);
+    } else if ( i == 5 || i == 6 ) {
+      CHECK(!controllers[i].Failed()) << i << ": "
+                                      << controllers[i].ErrorText();
+      CHECK_EQ(replies[i].z(), 1000 * i);
+    } else if ( i != 7 ) {
+      CHECK(!controllers[i].Failed()) << i << ": "
+                                      << controllers[i].ErrorText();
+      CHECK_EQ(replies[i].z(), i + 100);
+    }
+  }
+  CHECK(!mirror_controller.Failed()) << mirror_controller.ErrorText();
+  CHECK_EQ(mirror_reply.s(), mirror_request.s());
+
+  // An urgent call goes w/o waiting
+  rpc::Controller controller;
+  controller.set_is_urgent(true);
+  start = timer::TicksMsec();
+  stub.Sum(&controller, &requests[0], &replies[0], NULL);
+  CHECK(!controller.Failed()) << controller.ErrorText();
+  CHECK_LT(timer::TicksMsec() - start, 100);
+  LOG_INFO << "Http batching test PASS";
+}
+
+// The per method stats, accumulated from both transports
+void TestMethodStats(rpc::HttpServer* rpc_server) {
+  rpc::pb::ServerStats stats;
+  rpc_server->GetServerStats(&stats);
+  const rpc::pb::MethodStats* sum_stats = NULL;
+  for ( int i = 0; i < stats.method_stats_size(); ++i ) {
+    if ( stats.method_stats(i).path() == "test/whisper.rpc.TestService/Sum" ) {
+      sum_stats = &stats.method_stats(i);
+    }
+  }
+  CHECK(sum_stats != NULL);
+  CHECK_GT(sum_stats->num_calls(), 1000);
+  CHECK_GT(sum_stats->bytes_in(), 0);
+  CHECK_GT(sum_stats->bytes_out(), 0);
+  // The one failed on purpose in TestCalls
+  CHECK_EQ(sum_stats->errors_size(), 1);
+  CHECK_EQ(sum_stats->errors(0).error_code(), rpc::ERROR_USER);
+  CHECK_EQ(sum_stats->errors(0).count(), 1);
+  CHECK_EQ(sum_stats->queue_time().count(), sum_stats->num_calls());
+  CHECK_EQ(sum_stats->handler_time().count(), sum_stats->num_calls());
+  CHECK_EQ(sum_stats->write_time().count(), sum_stats->num_calls());
+  CHECK_NE(rpc::ServerStatsToHtml(stats).find(
+               "test/whisper.rpc.TestService/Sum"), std::string::npos);
+  LOG_INFO << "Method stats test PASS - Sum: " << sum_stats->num_calls()
+           << " calls, handler p50: " << sum_stats->handler_time().p50_us()
+           << " us, p99: " << sum_stats->handler_time().p99_us() << " us";
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+
+  const net::HostPort http_address = FreePort();
+  const net::HostPort tcp_address = FreePort();
+  net::SelectorThread server_thread;
+  server_thread.Start();
+  net::NetFactory net_factory(server_thread.mutable_selector());
+  Server server;
+  server.selector_ = server_thread.mutable_selector();
+  server.net_factory_ = &net_factory;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server.selector_,
+      NewCallback(&StartServer, &server, http_address, tcp_address));
+
+  net::SelectorThread client_thread;
+  client_thread.Start();
+  net::Selector* const selector = client_thread.mutable_selector();
+  net::NetFactory client_net_factory(selector);
+
+  rpc::TcpClient* const client = new rpc::TcpClient(
+      selector, client_net_factory, net::PROTOCOL_TCP, tcp_address,
+      "test/whisper.rpc.TestService");
+  rpc::TcpClient* const stream_client = new rpc::TcpClient(
+      selector, client_net_factory, net::PROTOCOL_TCP, tcp_address,
+      "test/whisper.rpc.TestStreamService");
+  TestCalls(client);
+  TestErrors(selector, client_net_factory, tcp_address);
+  TestStreaming(stream_client);
+  TestCancel(client, &server.service_);
+  TestClose(selector, client_net_factory, tcp_address, &server.service_);
+
+  HttpRpcClient http_client;
+  http_client.selector_ = selector;
+  http_client.net_factory_ = &client_net_factory;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&CreateHttpClient, &http_client, http_address));
+
+  static const int kConcurrency[] = { 1, 16, 128 };
+  for ( size_t i = 0; i < NUMBEROF(kConcurrency); ++i ) {
+    const double http_rate = RunLoad("http", http_client.client_, selector,
+                                     kConcurrency[i]);
+    const double tcp_rate = RunLoad("tcp", client, selector, kConcurrency[i]);
+    LOG_INFO << " Concurrency " << kConcurrency[i]
+             << " - tcp speedup: " << tcp_rate / http_rate;
+  }
+  TestMethodStats(server.rpc_server_);
+
+  HttpRpcClient batch_test_client;
+  batch_test_client.selector_ = selector;
+  batch_test_client.net_factory_ = &client_net_factory;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&CreateBatchingHttpClient, &batch_test_client,
+                            http_address, int64(100)));
+  TestHttpBatching(batch_test_client.client_);
+  batch_test_client.client_->StartClose();
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&DeleteHttpClient, &batch_test_client));
+
+  // Tiny calls, w/ the ones issued together batched
+  HttpRpcClient batch_client;
+  batch_client.selector_ = selector;
+  batch_client.net_factory_ = &client_net_factory;
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&CreateBatchingHttpClient, &batch_client,
+                            http_address, int64(0)));
+  for ( size_t i = 0; i < NUMBEROF(kConcurrency); ++i ) {
+    const double http_rate = RunLoad("http", http_client.client_, selector,
+                                     kConcurrency[i]);
+    const double batch_rate = RunLoad("http batched", batch_client.client_,
+                                      selector, kConcurrency[i]);
+    LOG_INFO << " Concurrency " << kConcurrency[i]
+             << " - http batching speedup: " << batch_rate / http_rate;
+  }
+  batch_client.client_->StartClose();
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&DeleteHttpClient, &batch_client));
+
+  http_client.client_->StartClose();
+  net::SelectorPool::RunInSelectLoopAndWait(
+      selector, NewCallback(&DeleteHttpClient, &http_client));
+  client->StartClose();
+  stream_client->StartClose();
+  client_thread.Stop();
+
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server.selector_, NewCallback(&StopServer, &server));
+  const int64 start = timer::TicksMsec();
+  while ( server.tcp_server_->num_connections() > 0 ) {
+    CHECK_LT(timer::TicksMsec() - start, 10000);
+    ::usleep(1000);
+  }
+  net::SelectorPool::RunInSelectLoopAndWait(
+      server.selector_, NewCallback(&DeleteServer, &server));
+  server_thread.Stop();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// A lock free, multiple producer - single consumer, intrusive queue:
+// the elements are linked through their own queue_next() pointer, so
+// pushing involves no allocation. Producers push with one compare and
+// swap (for a single element or for a whole chain of them), and the
+// consumer takes everything in one exchange, so there is no ABA problem.
+// The elements come out in the order they were pushed.
+//
+// T needs:
+//    T* queue_next() const;
+//    void set_queue_next(T* next);
+//
+
+#ifndef __WHISPERLIB_SYNC_MPSC_QUEUE_H__
+#define __WHISPERLIB_SYNC_MPSC_QUEUE_H__
+
+#include <atomic>
+#include "whisperlib/base/types.h"
+
+namespace whisper {
+namespace synch {
+
+template <class T>
+class MpscQueue {
+ public:
+  MpscQueue() : head_(NULL) {
+  }
+  ~MpscQueue() {
+  }
+
+  // Pushes an element - THIS IS SAFE TO CALL FROM ANY THREAD
+  // Returns true if the queue was empty before.
+  bool Push(T* element) {
+    return PushChain(element, element);
+  }
+  // Pushes the chain first -> ... -> last (linked by queue_next(), in the
+  // order they should come out) in one operation.
+  // Returns true if the queue was empty before.
+  bool PushChain(T* first, T* last) {
+    // We keep the elements in reverse order (newest first)
+    last->set_queue_next(NULL);
+    T* const newest = Reverse(first);
+    T* head = head_.load(std::memory_order_relaxed);
+    do {
+      first->set_queue_next(head);
+    } while ( !head_.compare_exchange_weak(head, newest) );
+    return head == NULL;
+  }
+
+  // Takes all the elements from the queue - CALL FROM THE CONSUMER ONLY.
+  // Returns the first one (the others follow through queue_next()),
+  // or NULL if the queue is empty.
+  T* PopAll() {
+    if ( head_.load(std::memory_order_relaxed) == NULL ) {
+      return NULL;
+    }
+    return Reverse(head_.exchange(NULL));
+  }
+
+  // Approximate, if called while others push. All the operations on the
+  // queue are sequentially consistent, so a consumer can safely check this
+  // after announcing (in another atomic) that it goes to sleep.
+  bool empty() const {
+    return head_.load() == NULL;
+  }
+
+ private:
+  // Reverses a NULL terminated chain, returns the new first element
+  static T* Reverse(T* p) {
+    T* reversed = NULL;
+    while ( p != NULL ) {
+      T* const next = p->queue_next();
+      p->set_queue_next(reversed);
+      reversed = p;
+      p = next;
+    }
+    return reversed;
+  }
+
+  // The newest element; the others follow through queue_next()
+  std::atomic<T*> head_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(MpscQueue);
+};
+
+}  // namespace synch
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_SYNC_MPSC_QUEUE_H__
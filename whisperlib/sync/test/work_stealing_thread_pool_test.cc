@@ -0,0 +1,367 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Checks the WorkStealingThreadPool (and its deque), and benchmarks it
+// against the other thread pools on jobs w/ skewed durations.
+
+#include <atomic>
+#include <vector>
+
+#include "whisperlib/base/types.h"
+#include "whisperlib/base/log.h"
+#include "whisperlib/base/system.h"
+#include "whisperlib/base/timer.h"
+#include "whisperlib/base/gflags.h"
+#include "whisperlib/sync/thread.h"
+#include "whisperlib/sync/thread_pool.h"
+#include "whisperlib/sync/work_stealing_deque.h"
+
+DEFINE_int32(num_threads, 4, "Threads in the benchmarked pools");
+DEFINE_int32(num_jobs, 4096, "Jobs to run in each benchmark");
+DEFINE_int32(job_spin, 2000, "Iterations of a short job");
+DEFINE_int32(long_job_every, 16, "Each these many jobs one is long");
+DEFINE_int32(long_job_factor, 50, "How much longer the long jobs are");
+
+using namespace whisper;
+
+static std::atomic<int64> glb_num_done(0);
+
+static int64 JobCost(int32 index) {
+  return (index % FLAGS_long_job_every) == 0
+      ? int64(FLAGS_job_spin) * FLAGS_long_job_factor
+      : FLAGS_job_spin;
+}
+static void Spin(int64 num) {
+  volatile int64 x = 0;
+  for ( int64 i = 0; i < num; ++i ) {
+    x += i;
+  }
+}
+static void Job(int64 num) {
+  Spin(num);
+  ++glb_num_done;
+}
+static void IndexedJob(int64 num, size_t /*thread_index*/) {
+  Job(num);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void StealerThread(synch::WorkStealingDeque<int>* deque,
+                          std::atomic_bool* done,
+                          std::vector<int>* got) {
+  while ( true ) {
+    int* p = deque->Steal();
+    if ( p != NULL ) {
+      got->push_back(*p);
+    } else if ( *done && deque->empty() ) {
+      break;
+    }
+  }
+}
+
+// Each element is got exactly once, either by the owner or by a thief
+void TestDeque() {
+  const int kNumElements = 200000;
+  const int kNumThieves = 3;
+  std::vector<int> values(kNumElements);
+  for ( int i = 0; i < kNumElements; ++i ) {
+    values[i] = i;
+  }
+  synch::WorkStealingDeque<int> deque(4);   // grows a lot
+  std::atomic_bool done(false);
+  std::vector< std::vector<int> > got(kNumThieves + 1);
+  std::vector<thread::Thread*> thieves;
+  for ( int i = 0; i < kNumThieves; ++i ) {
+    thieves.push_back(new thread::Thread(
+        NewCallback(&StealerThread, &deque, &done, &got[i + 1])));
+    thieves.back()->SetJoinable();
+    thieves.back()->Start();
+  }
+  for ( int i = 0; i < kNumElements; ++i ) {
+    deque.Push(&values[i]);
+    if ( (i % 3) == 0 ) {
+      int* p = deque.Pop();
+      if ( p != NULL ) got[0].push_back(*p);
+    }
+  }
+  int* p;
+  while ( (p = deque.Pop()) != NULL ) {
+    got[0].push_back(*p);
+  }
+  done = true;
+  for ( int i = 0; i < kNumThieves; ++i ) {
+    thieves[i]->Join();
+    delete thieves[i];
+  }
+  std::vector<int> seen(kNumElements, 0);
+  for ( size_t i = 0; i < got.size(); ++i ) {
+    LOG_INFO << " Deque " << (i == 0 ? "owner" : "thief") << " got: "
+             << got[i].size();
+    for ( size_t j = 0; j < got[i].size(); ++j ) {
+      ++seen[got[i][j]];
+    }
+  }
+  for ( int i = 0; i < kNumElements; ++i ) {
+    CHECK_EQ(seen[i], 1) << " at: " << i;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////
+
+// Recursive fork / join: sums [begin, end) by splitting it in RunBatch-es
+// issued from inside the pool threads.
+static void Sum(thread::WorkStealingThreadPool* pool,
+                int64 begin, int64 end, int64* result) {
+  if ( end - begin <= 64 ) {
+    int64 sum = 0;
+    for ( int64 i = begin; i < end; ++i ) {
+      sum += i;
+    }
+    *result = sum;
+    return;
+  }
+  const int64 mid = (begin + end) / 2;
+  int64 left = 0, right = 0;
+  std::vector<Closure*> jobs;
+  jobs.push_back(NewCallback(&Sum, pool, begin, mid, &left));
+  jobs.push_back(NULL);   // ignored
+  jobs.push_back(NewCallback(&Sum, pool, mid, end, &right));
+  pool->RunBatch(jobs, NULL);
+  *result = left + right;
+}
+
+static void SignalEvent(synch::Event* ev) {
+  ev->Signal();
+}
+
+void TestForkJoin() {
+  thread::WorkStealingThreadPool pool(FLAGS_num_threads);
+  const int64 kNum = 1 << 16;
+  int64 result = 0;
+  std::vector<Closure*> jobs;
+  jobs.push_back(NewCallback(&Sum, &pool, int64(0), kNum, &result));
+  pool.RunBatch(jobs, NULL);
+  CHECK_EQ(result, kNum * (kNum - 1) / 2);
+
+  // Asynchronous batches
+  synch::Event done(false, true);
+  jobs.clear();
+  glb_num_done = 0;
+  for ( int32 i = 0; i < 100; ++i ) {
+    jobs.push_back(NewCallback(&Job, int64(10)));
+  }
+  pool.RunBatch(jobs, NewCallback(&SignalEvent, &done));
+  done.Wait();
+  CHECK_EQ(glb_num_done.load(), 100);
+  // Empty ones complete on the spot
+  done.Reset();
+  pool.RunBatch(std::vector<Closure*>(), NewCallback(&SignalEvent, &done));
+  CHECK(done.Wait(0));
+  LOG_INFO << " Fork / join steals: " << pool.num_steals();
+}
+
+static void BatchWaiter(thread::WorkStealingThreadPool* pool,
+                        synch::Event* started) {
+  std::vector<Closure*> jobs;
+  for ( int32 i = 0; i < 10; ++i ) {
+    jobs.push_back(NewCallback(&Job, int64(10)));
+  }
+  started->Signal();
+  pool->RunBatch(jobs, NULL);
+}
+
+// Jobs added to a pool that gets destroyed are deleted w/o running
+void TestDestroy() {
+  glb_num_done = 0;
+  {
+    thread::WorkStealingThreadPool pool(2, false, NULL, false);
+    for ( int32 i = 0; i < 100; ++i ) {
+      pool.AddJob(NewCallback(&Job, int64(10)));
+    }
+  }
+  CHECK_EQ(glb_num_done.load(), 0);
+  // .. and their batches complete w/o them
+  synch::Event done(false, true);
+  {
+    thread::WorkStealingThreadPool pool(2, false, NULL, false);
+    std::vector<Closure*> jobs;
+    for ( int32 i = 0; i < 10; ++i ) {
+      jobs.push_back(NewCallback(&Job, int64(10)));
+    }
+    pool.RunBatch(jobs, NewCallback(&SignalEvent, &done));
+    CHECK(!done.Wait(0));
+  }
+  CHECK(done.Wait(0));
+  // .. also when someone waits for them
+  synch::Event started(false, true);
+  thread::WorkStealingThreadPool* const waited_pool =
+      new thread::WorkStealingThreadPool(2, false, NULL, false);
+  thread::Thread waiter(NewCallback(&BatchWaiter, waited_pool, &started));
+  waiter.SetJoinable();
+  waiter.Start();
+  started.Wait();
+  timer::SleepMsec(100);   // let it queue its jobs and block
+  delete waited_pool;
+  waiter.Join();
+  CHECK_EQ(glb_num_done.load(), 0);
+  // .. while FinishWork runs everything
+  thread::WorkStealingThreadPool pool(2);
+  for ( int32 i = 0; i < 100; ++i ) {
+    pool.AddJob(NewCallback(&Job, int64(10)));
+  }
+  pool.FinishWork();
+  CHECK_EQ(glb_num_done.load(), 100);
+}
+
+//////////////////////////////////////////////////////////////////////
+
+static void Report(const char* name, int64 start_ns) {
+  const int64 duration_ns = timer::TicksNsec() - start_ns;
+  CHECK_EQ(glb_num_done.load(), FLAGS_num_jobs) << name;
+  LOG_INFO << " Benchmark " << name << ": " << FLAGS_num_jobs
+           << " jobs in " << duration_ns / 1000 << " us - "
+           << int64(FLAGS_num_jobs * 1e9 / duration_ns) << " per second";
+}
+
+// Spawns all the jobs from inside the pool (so all go to one deque)
+static void Spawner(thread::WorkStealingThreadPool* pool) {
+  for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+    pool->AddJob(NewCallback(&Job, JobCost(i)));
+  }
+}
+
+void Benchmark() {
+  const size_t kNumThreads = FLAGS_num_threads;
+  const size_t kBacklog = FLAGS_num_jobs + kNumThreads + 1;
+  const size_t kSleepUsec = 100;
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::ThreadPool pool(kNumThreads, kBacklog);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.jobs()->Put(NewCallback(&Job, JobCost(i)));
+    }
+    pool.FinishWork();
+    Report("ThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::ThreadPool pool(kNumThreads, kBacklog);
+    std::vector<Closure*> jobs;
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      jobs.push_back(NewCallback(&Job, JobCost(i)));
+    }
+    pool.RunBatch(jobs, NULL);
+    Report("ThreadPool::RunBatch", start);
+  }
+  {
+    // Round robin - all the long jobs land in the same queue
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::MultiQueueThreadPool pool(kNumThreads, kBacklog);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.jobs(i % kNumThreads)->Put(NewCallback(&Job, JobCost(i)));
+    }
+    pool.FinishWork();
+    Report("MultiQueueThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::LockFreeThreadPool pool(1, kNumThreads, kBacklog, kSleepUsec);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.jobs()->Put(NewCallback(&IndexedJob, JobCost(i)), 0);
+    }
+    pool.FinishWork();
+    Report("LockFreeThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::LockFreeMultiQueueThreadPool pool(1, kNumThreads, kBacklog,
+                                              kSleepUsec);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.jobs(i % kNumThreads)->Put(NewCallback(&IndexedJob, JobCost(i)), 0);
+    }
+    pool.FinishWork();
+    Report("LockFreeMultiQueueThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::LockedThreadPool pool(1, kNumThreads, kBacklog, kSleepUsec);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.jobs()->Put(NewCallback(&IndexedJob, JobCost(i)));
+    }
+    pool.FinishWork();
+    Report("LockedThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::WorkStealingThreadPool pool(kNumThreads);
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      pool.AddJob(NewCallback(&Job, JobCost(i)));
+    }
+    pool.FinishWork();
+    Report("WorkStealingThreadPool", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::WorkStealingThreadPool pool(kNumThreads);
+    std::vector<Closure*> jobs;
+    for ( int32 i = 0; i < FLAGS_num_jobs; ++i ) {
+      jobs.push_back(NewCallback(&Job, JobCost(i)));
+    }
+    pool.RunBatch(jobs, NULL);
+    Report("WorkStealingThreadPool::RunBatch", start);
+  }
+  {
+    glb_num_done = 0;
+    const int64 start = timer::TicksNsec();
+    thread::WorkStealingThreadPool pool(kNumThreads);
+    pool.AddJob(NewCallback(&Spawner, &pool));
+    pool.FinishWork();
+    Report("WorkStealingThreadPool (spawned in pool)", start);
+    LOG_INFO << " Steals: " << pool.num_steals();
+  }
+}
+
+int main(int argc, char* argv[]) {
+  common::Init(argc, argv);
+  TestDeque();
+  TestForkJoin();
+  TestDestroy();
+  Benchmark();
+  LOG_INFO << "PASS";
+  common::Exit(0);
+}
@@ -559,5 +559,349 @@ void LockedThreadPool::ThreadRun(size_t thread_index) {
   }
 }
 
+////////////////////////////////////////////////////////////////////////////////
+
+struct WorkStealingThreadPool::Worker {
+  Worker(WorkStealingThreadPool* pool, size_t index)
+    : pool_(pool), index_(index),
+      seed_(static_cast<uint32>(index * 2654435761UL + 1)),
+      num_steals_(0) {
+  }
+  WorkStealingThreadPool* const pool_;
+  const size_t index_;
+  // for picking the victims
+  uint32 seed_;
+  std::atomic<size_t> num_steals_;
+  synch::WorkStealingDeque<Closure> jobs_;
+};
+
+struct WorkStealingThreadPool::Batch {
+  Batch(size_t num_jobs, Closure* completion, bool pool_waiter)
+    : num_to_finish_(num_jobs),
+      num_refs_(num_jobs + (completion == NULL ? 1 : 0)),
+      completion_(completion),
+      pool_waiter_(pool_waiter),
+      done_(false, true) {
+  }
+  std::atomic<size_t> num_to_finish_;
+  // one for each job, plus one for the waiter (if no completion)
+  std::atomic<size_t> num_refs_;
+  Closure* const completion_;
+  // the waiter is a pool thread, sleeping in WaitForWork (not on done_)
+  const bool pool_waiter_;
+  synch::Event done_;
+};
+
+// Runs a job of a batch. If deleted w/o running (by the pool destructor),
+// deletes the job too - the destructor accounts for it in the batch.
+class WorkStealingThreadPool::BatchJob : public Closure {
+ public:
+  BatchJob(WorkStealingThreadPool* pool, Batch* batch, Closure* job)
+    : Closure(false), pool_(pool), batch_(batch), job_(job) {
+  }
+  virtual ~BatchJob() {
+    if ( job_ != NULL && !job_->is_permanent() ) {
+      delete job_;
+    }
+  }
+ protected:
+  virtual void RunInternal() {
+    Closure* const job = job_;
+    job_ = NULL;
+    job->Run();
+    pool_->FinishBatchJob(batch_);
+  }
+ private:
+  WorkStealingThreadPool* const pool_;
+  Batch* const batch_;
+  Closure* job_;
+};
+
+thread_local WorkStealingThreadPool::Worker*
+WorkStealingThreadPool::current_worker_ = NULL;
+
+WorkStealingThreadPool::WorkStealingThreadPool(size_t num_threads,
+                                               bool low_priority,
+                                               Closure* completion_callback,
+                                               bool auto_start)
+  : ThreadPoolBase(num_threads, low_priority, completion_callback),
+    num_injected_(0),
+    num_pending_(0),
+    work_epoch_(0),
+    num_sleeping_(0),
+    finishing_(false),
+    stopping_(false) {
+  CHECK_SYS_FUN(pthread_cond_init(&wake_cond_, NULL), 0);
+  for ( size_t i = 0; i < num_threads; ++i ) {
+    workers_.push_back(new Worker(this, i));
+  }
+  if ( auto_start ) {
+    Start();
+  }
+}
+
+WorkStealingThreadPool::~WorkStealingThreadPool() {
+  stopping_ = true;
+  WakeUpAll();
+  {
+    synch::MutexLocker l(&wait_mutex_);
+    WaitForFinishLocked();
+  }
+  // The threads are gone - we can act as the owner of their deques
+  for ( size_t i = 0; i < workers_.size(); ++i ) {
+    Closure* job;
+    while ( (job = workers_[i]->jobs_.Pop()) != NULL ) {
+      if ( !job->is_permanent() ) {
+        delete job;
+      }
+    }
+    delete workers_[i];
+  }
+  for ( size_t i = 0; i < injection_.size(); ++i ) {
+    if ( !injection_[i]->is_permanent() ) {
+      delete injection_[i];
+    }
+  }
+  // All the jobs still unfinished in a batch were deleted above
+  std::set<Batch*> batches;
+  {
+    synch::MutexLocker l(&batches_mutex_);
+    batches.swap(batches_);
+  }
+  for ( std::set<Batch*>::const_iterator it = batches.begin();
+        it != batches.end(); ++it ) {
+    Batch* const batch = *it;
+    const size_t num_deleted = batch->num_to_finish_.exchange(0);
+    if ( batch->completion_ != NULL ) {
+      batch->completion_->Run();
+    } else {
+      batch->done_.Signal();
+    }
+    UnrefBatch(batch, num_deleted);
+  }
+  pthread_cond_destroy(&wake_cond_);
+}
+
+void WorkStealingThreadPool::AddJob(Closure* job) {
+  CHECK_NOT_NULL(job);
+  // Count it before it becomes visible, so num_pending_ never underflows
+  ++num_pending_;
+  Worker* const worker = current_worker_;
+  if ( worker != NULL && worker->pool_ == this ) {
+    worker->jobs_.Push(job);
+  } else {
+    synch::MutexLocker l(&injection_mutex_);
+    injection_.push_back(job);
+    ++num_injected_;
+  }
+  WakeUp();
+}
+
+void WorkStealingThreadPool::WakeUp() {
+  // The epoch is bumped before looking at num_sleeping_, while a sleeper
+  // counts itself before looking at the epoch - so one of us sees the other.
+  ++work_epoch_;
+  if ( num_sleeping_ > 0 ) {
+    synch::MutexLocker l(&wake_mutex_);
+    CHECK_SYS_FUN(pthread_cond_signal(&wake_cond_), 0);
+  }
+}
+
+void WorkStealingThreadPool::WakeUpAll() {
+  ++work_epoch_;
+  synch::MutexLocker l(&wake_mutex_);
+  CHECK_SYS_FUN(pthread_cond_broadcast(&wake_cond_), 0);
+}
+
+void WorkStealingThreadPool::WaitForWork(uint64 epoch, const Batch* batch) {
+  ++num_sleeping_;
+  {
+    synch::MutexLocker l(&wake_mutex_);
+    while ( work_epoch_ == epoch &&
+            (batch == NULL ? !stopping_ : batch->num_to_finish_ > 0) ) {
+      CHECK_SYS_FUN(pthread_cond_wait(&wake_cond_, &wake_mutex_.mutex()), 0);
+    }
+  }
+  --num_sleeping_;
+}
+
+Closure* WorkStealingThreadPool::GetJob(Worker* worker) {
+  Closure* job = worker->jobs_.Pop();
+  if ( job == NULL && num_injected_ > 0 ) {
+    synch::MutexLocker l(&injection_mutex_);
+    if ( !injection_.empty() ) {
+      job = injection_.front();
+      injection_.pop_front();
+      --num_injected_;
+    }
+  }
+  if ( job == NULL ) {
+    job = StealJob(worker);
+  }
+  if ( job != NULL ) {
+    --num_pending_;
+  }
+  return job;
+}
+
+Closure* WorkStealingThreadPool::StealJob(Worker* worker) {
+  const size_t num_workers = workers_.size();
+  if ( num_workers < 2 ) {
+    return NULL;
+  }
+  // xorshift32
+  worker->seed_ ^= worker->seed_ << 13;
+  worker->seed_ ^= worker->seed_ >> 17;
+  worker->seed_ ^= worker->seed_ << 5;
+  const size_t start = worker->seed_ % num_workers;
+  for ( size_t i = 0; i < num_workers; ++i ) {
+    Worker* const victim = workers_[(start + i) % num_workers];
+    if ( victim == worker ) {
+      continue;
+    }
+    Closure* const job = victim->jobs_.Steal();
+    if ( job != NULL ) {
+      worker->num_steals_.fetch_add(1, std::memory_order_relaxed);
+      return job;
+    }
+  }
+  return NULL;
+}
+
+size_t WorkStealingThreadPool::num_steals() const {
+  size_t num_steals = 0;
+  for ( size_t i = 0; i < workers_.size(); ++i ) {
+    num_steals += workers_[i]->num_steals_.load(std::memory_order_relaxed);
+  }
+  return num_steals;
+}
+
+void WorkStealingThreadPool::FinishBatchJob(Batch* batch) {
+  if ( --batch->num_to_finish_ == 0 ) {
+    CompleteBatch(batch);
+  }
+  UnrefBatch(batch, 1);
+}
+
+void WorkStealingThreadPool::CompleteBatch(Batch* batch) {
+  {
+    synch::MutexLocker l(&batches_mutex_);
+    batches_.erase(batch);
+  }
+  if ( batch->completion_ != NULL ) {
+    batch->completion_->Run();
+  } else if ( batch->pool_waiter_ ) {
+    WakeUpAll();
+  } else {
+    batch->done_.Signal();
+  }
+}
+
+void WorkStealingThreadPool::UnrefBatch(Batch* batch, size_t num_refs) {
+  if ( num_refs > 0 && (batch->num_refs_ -= num_refs) == 0 ) {
+    delete batch;
+  }
+}
+
+void WorkStealingThreadPool::RunBatch(const std::vector<Closure*>& jobs,
+                                      Closure* completion) {
+  size_t num_jobs = 0;
+  for ( size_t i = 0; i < jobs.size(); ++i ) {
+    if ( jobs[i] != NULL ) {
+      ++num_jobs;
+    }
+  }
+  if ( num_jobs == 0 ) {
+    if ( completion != NULL ) {
+      completion->Run();
+    }
+    return;
+  }
+  Worker* const worker = current_worker_;
+  const bool in_pool = (worker != NULL && worker->pool_ == this);
+  Batch* const batch = new Batch(num_jobs, completion,
+                                 in_pool && completion == NULL);
+  {
+    synch::MutexLocker l(&batches_mutex_);
+    batches_.insert(batch);
+  }
+  for ( size_t i = 0; i < jobs.size(); ++i ) {
+    if ( jobs[i] != NULL ) {
+      AddJob(new BatchJob(this, batch, jobs[i]));
+    }
+  }
+  if ( completion != NULL ) {
+    return;
+  }
+  if ( in_pool ) {
+    // Blocking a pool thread may starve the pool - help instead.
+    // We get our own jobs first, as they are at the bottom of our deque.
+    // We keep at it even when stopping, as the pool waits for us.
+    while ( batch->num_to_finish_ > 0 ) {
+      const uint64 epoch = work_epoch_;
+      Closure* const job = GetJob(worker);
+      if ( job != NULL ) {
+        job->Run();
+      } else {
+        // the rest of the batch runs in other threads
+        WaitForWork(epoch, batch);
+      }
+    }
+    // we may have taken a wake up meant for a new job
+    if ( num_pending_ > 0 ) {
+      WakeUp();
+    }
+  } else {
+    batch->done_.Wait();
+  }
+  UnrefBatch(batch, 1);
+}
+
+void WorkStealingThreadPool::FinishWork() {
+  LOG_INFO_THREADS << " WorkStealingThreadPool Finishing work for: "
+                   << thread_count();
+  finishing_ = true;
+  WakeUpAll();
+  synch::MutexLocker l(&wait_mutex_);
+  WaitForFinishLocked();
+  LOG_INFO_THREADS << " WorkStealingThreadPool Work Finished: "
+                   << thread_count() << " steals: " << num_steals();
+}
+
+void WorkStealingThreadPool::ThreadRun(size_t thread_index) {
+  LOG_INFO_THREADS << " WorkStealingThreadPool Running thread: "
+                   << thread_index;
+  Worker* const worker = workers_[thread_index];
+  current_worker_ = worker;
+  size_t num_jobs = 0;
+  while ( !stopping_ ) {
+    // Read before looking for jobs, so we do not sleep through a job
+    // added after we looked.
+    const uint64 epoch = work_epoch_;
+    Closure* const job = GetJob(worker);
+    if ( job != NULL ) {
+      // more work than us - pass the word
+      if ( num_pending_ > 0 && num_sleeping_ > 0 ) {
+        WakeUp();
+      }
+      job->Run();
+      ++num_jobs;
+      continue;
+    }
+    if ( finishing_ && num_pending_ == 0 ) {
+      break;
+    }
+    // Nothing to do, or some job is being pushed / we lost a race for it
+    // (the pusher bumps the epoch when done).
+    WaitForWork(epoch, NULL);
+  }
+  // let the others see the stop / finish too
+  WakeUpAll();
+  current_worker_ = NULL;
+  LOG_INFO_THREADS << " WorkStealingThreadPool ended - thread id: "
+                   << thread_index << " with: " << num_jobs << " jobs, "
+                   << worker->num_steals_ << " stolen";
+}
+
 }  // namespace thread
 }  // namespace whisper
@@ -33,10 +33,16 @@
 #ifndef __WHISPERLIB_SYNC_THREAD_POOL_H__
 #define __WHISPERLIB_SYNC_THREAD_POOL_H__
 
+#include <pthread.h>
+#include <atomic>
+#include <deque>
+#include <set>
 #include <vector>
+#include "whisperlib/sync/event.h"
 #include "whisperlib/sync/thread.h"
 #include "whisperlib/sync/producer_consumer_queue.h"
 #include "whisperlib/sync/lock_free_producer_consumer_queue.h"
+#include "whisperlib/sync/work_stealing_deque.h"
 
 namespace whisper {
 namespace thread {
@@ -263,6 +269,93 @@ private:
 
   DISALLOW_EVIL_CONSTRUCTORS(MultiQueueThreadPool);
 };
+
+//////////////////////////////////////////////////////////////////////
+
+/** A thread pool in which each thread has its own deque of jobs. Jobs
+ * added from a pool thread go to the deque of that thread (and run LIFO,
+ * while the data is still warm), jobs from outside go to a shared
+ * injection queue. Idle threads steal from the other end of the deque of
+ * a random thread - so a few long jobs do not hold up the jobs queued
+ * behind them.
+ */
+class WorkStealingThreadPool : public ThreadPoolBase {
+public:
+  WorkStealingThreadPool(size_t num_threads, bool low_priority=false,
+                         Closure* completion_callback=NULL,
+                         bool auto_start=true);
+  // Stops the threads, then deletes the pending jobs. The batches that
+  // lose jobs this way are completed w/o them (their completion runs, or
+  // their RunBatch returns).
+  ~WorkStealingThreadPool();
+
+  // Schedules a job for running. Never blocks (there is no backlog limit).
+  void AddJob(Closure* job);
+
+  // Same semantics as ThreadPool::RunBatch. When called w/o a completion
+  // from inside a job of this pool, the calling thread runs jobs while it
+  // waits (so jobs can fork / join recursively w/o deadlocking the pool).
+  void RunBatch(const std::vector<Closure*>& jobs, Closure* completion);
+
+  // Terminates the threads after all the jobs (including the ones added
+  // in the meantime by the jobs) are done. The pool is useless afterwards.
+  void FinishWork();
+
+  // How many jobs were stolen from another thread
+  size_t num_steals() const;
+
+protected:
+  virtual void ThreadRun(size_t thread_index);
+
+private:
+  struct Worker;
+  struct Batch;
+  class BatchJob;
+
+  // Returns the next job for the given worker: from its deque, from the
+  // injection queue, or stolen from a random worker. NULL if none found.
+  Closure* GetJob(Worker* worker);
+  Closure* StealJob(Worker* worker);
+  // Wakes up one sleeping thread, if any.
+  void WakeUp();
+  // Wakes up all the sleeping threads.
+  void WakeUpAll();
+  // Blocks the calling pool thread until work_epoch_ moves from epoch
+  // (or, if batch is given, until the batch is done).
+  void WaitForWork(uint64 epoch, const Batch* batch);
+  void FinishBatchJob(Batch* batch);
+  void CompleteBatch(Batch* batch);
+  static void UnrefBatch(Batch* batch, size_t num_refs);
+
+  // The worker of the current thread (NULL outside our threads)
+  static thread_local Worker* current_worker_;
+
+  std::vector<Worker*> workers_;
+
+  // Jobs added from outside the pool threads
+  synch::Mutex injection_mutex_;
+  std::deque<Closure*> injection_;
+  std::atomic<size_t> num_injected_;
+
+  // Jobs scheduled and not yet picked up
+  std::atomic<size_t> num_pending_;
+  // Bumped whenever there may be new work (or the threads should exit).
+  // A thread looking for work sleeps only while this stays unchanged.
+  std::atomic<uint64> work_epoch_;
+  // Threads waiting on wake_cond_
+  std::atomic<size_t> num_sleeping_;
+  synch::Mutex wake_mutex_;
+  pthread_cond_t wake_cond_;
+  // Batches with jobs not finished yet (completed by the destructor)
+  synch::Mutex batches_mutex_;
+  std::set<Batch*> batches_;
+  // Set by FinishWork - threads exit when no more jobs are pending
+  std::atomic_bool finishing_;
+  // Set by the destructor - threads exit ASAP
+  std::atomic_bool stopping_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(WorkStealingThreadPool);
+};
 }  // namespace thread
 }  // namespace whisper
 
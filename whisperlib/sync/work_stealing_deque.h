@@ -0,0 +1,172 @@
+// Copyright (c) 2026, Whispersoft s.r.l.
+// All rights reserved.
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are
+// met:
+//
+// * Redistributions of source code must retain the above copyright
+// notice, this list of conditions and the following disclaimer.
+// * Redistributions in binary form must reproduce the above
+// copyright notice, this list of conditions and the following disclaimer
+// in the documentation and/or other materials provided with the
+// distribution.
+// * Neither the name of Whispersoft s.r.l. nor the names of its
+// contributors may be used to endorse or promote products derived from
+// this software without specific prior written permission.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+//
+// Chase-Lev work stealing deque (w/ the memory orderings from "Correct
+// and Efficient Work-Stealing for Weak Memory Models", Le et al.).
+// The owner thread pushes and pops at the bottom (LIFO, w/o any atomic
+// read-modify-write except when fighting for the last element), while
+// any other thread can steal from the top (FIFO, one CAS).
+// The buffer grows as needed; old buffers are released w/ the deque
+// (thieves may still be reading them).
+//
+
+#ifndef __WHISPERLIB_SYNC_WORK_STEALING_DEQUE_H__
+#define __WHISPERLIB_SYNC_WORK_STEALING_DEQUE_H__
+
+#include <atomic>
+#include <vector>
+#include "whisperlib/base/types.h"
+
+namespace whisper {
+namespace synch {
+
+template <class T>
+class WorkStealingDeque {
+ public:
+  explicit WorkStealingDeque(size_t initial_size = 1024)
+      : top_(0), bottom_(0), buffer_(new Buffer(NextPow2(initial_size))) {
+    old_buffers_.push_back(buffer_.load(std::memory_order_relaxed));
+  }
+  ~WorkStealingDeque() {
+    for ( size_t i = 0; i < old_buffers_.size(); ++i ) {
+      delete old_buffers_[i];
+    }
+  }
+
+  // OWNER ONLY: Adds an element at the bottom
+  void Push(T* p) {
+    const int64 b = bottom_.load(std::memory_order_relaxed);
+    const int64 t = top_.load(std::memory_order_acquire);
+    Buffer* buffer = buffer_.load(std::memory_order_relaxed);
+    if ( b - t > int64(buffer->mask_) ) {
+      buffer = Grow(buffer, b, t);
+    }
+    buffer->Put(b, p);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+  // OWNER ONLY: Removes the bottom element (NULL if empty)
+  T* Pop() {
+    const int64 b = bottom_.load(std::memory_order_relaxed) - 1;
+    Buffer* const buffer = buffer_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64 t = top_.load(std::memory_order_relaxed);
+    if ( t > b ) {
+      // empty
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return NULL;
+    }
+    T* p = buffer->Get(b);
+    if ( t == b ) {
+      // the last one - thieves may want it too
+      if ( !top_.compare_exchange_strong(t, t + 1,
+                                         std::memory_order_seq_cst,
+                                         std::memory_order_relaxed) ) {
+        p = NULL;
+      }
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return p;
+  }
+  // ANY THREAD: Removes the top element (NULL if empty, or if we lost
+  // it to another thief or to the owner)
+  T* Steal() {
+    int64 t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const int64 b = bottom_.load(std::memory_order_acquire);
+    if ( t >= b ) {
+      return NULL;
+    }
+    Buffer* const buffer = buffer_.load(std::memory_order_acquire);
+    T* const p = buffer->Get(t);
+    if ( !top_.compare_exchange_strong(t, t + 1,
+                                       std::memory_order_seq_cst,
+                                       std::memory_order_relaxed) ) {
+      return NULL;
+    }
+    return p;
+  }
+
+  // Approximate
+  size_t size() const {
+    const int64 b = bottom_.load(std::memory_order_relaxed);
+    const int64 t = top_.load(std::memory_order_relaxed);
+    return b > t ? size_t(b - t) : 0;
+  }
+  bool empty() const {
+    return size() == 0;
+  }
+
+ private:
+  struct Buffer {
+    explicit Buffer(size_t size)
+        : mask_(size - 1), data_(new std::atomic<T*>[size]) {
+    }
+    ~Buffer() {
+      delete [] data_;
+    }
+    T* Get(int64 i) const {
+      return data_[i & mask_].load(std::memory_order_relaxed);
+    }
+    void Put(int64 i, T* p) {
+      data_[i & mask_].store(p, std::memory_order_relaxed);
+    }
+    const size_t mask_;
+    std::atomic<T*>* const data_;
+  };
+
+  static size_t NextPow2(size_t size) {
+    size_t ret = 2;
+    while ( ret < size ) ret <<= 1;
+    return ret;
+  }
+  Buffer* Grow(Buffer* buffer, int64 b, int64 t) {
+    Buffer* const bigger = new Buffer(2 * (buffer->mask_ + 1));
+    for ( int64 i = t; i < b; ++i ) {
+      bigger->Put(i, buffer->Get(i));
+    }
+    buffer_.store(bigger, std::memory_order_release);
+    old_buffers_.push_back(bigger);
+    return bigger;
+  }
+
+  std::atomic<int64> top_;
+  std::atomic<int64> bottom_;
+  std::atomic<Buffer*> buffer_;
+  // All the buffers we allocated (owner only)
+  std::vector<Buffer*> old_buffers_;
+
+  DISALLOW_EVIL_CONSTRUCTORS(WorkStealingDeque);
+};
+
+}  // namespace synch
+}  // namespace whisper
+
+#endif  // __WHISPERLIB_SYNC_WORK_STEALING_DEQUE_H__